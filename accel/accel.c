@@ -29,11 +29,46 @@
 #include "sysemu/arch_init.h"
 #include "sysemu/sysemu.h"
 #include "qom/object.h"
+#include "qapi/visitor.h"
+
+static void accel_get_halt_poll_max_ns(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    AccelState *accel = ACCEL(obj);
+    uint64_t value = accel->halt_poll_max_ns;
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
+static void accel_set_halt_poll_max_ns(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    AccelState *accel = ACCEL(obj);
+    uint64_t value;
+
+    if (!visit_type_uint64(v, name, &value, errp)) {
+        return;
+    }
+    accel->halt_poll_max_ns = value;
+}
+
+static void accel_class_init(ObjectClass *oc, void *data)
+{
+    object_class_property_add(oc, "halt-poll-max-ns", "uint64",
+        accel_get_halt_poll_max_ns, accel_set_halt_poll_max_ns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "halt-poll-max-ns",
+        "Longest time an idle vCPU polls for a wakeup in userspace "
+        "before sleeping (default: 0, i.e. no polling)");
+}
 
 static const TypeInfo accel_type = {
     .name = TYPE_ACCEL,
     .parent = TYPE_OBJECT,
     .class_size = sizeof(AccelClass),
+    .class_init = accel_class_init,
     .instance_size = sizeof(AccelState),
 };
 
@@ -23,6 +23,7 @@
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/s390x/adapter.h"
@@ -37,6 +38,7 @@
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "sysemu/sev.h"
@@ -75,6 +77,8 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    /* Where to resume harvesting the dirty ring of the vCPU */
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -104,6 +108,13 @@ struct KVMState
     OnOffAuto kernel_irqchip_split;
     bool sync_mmu;
     uint64_t manual_dirty_log_protect;
+    /* Number of entries of the per-vCPU dirty rings, 0 when not used */
+    uint32_t kvm_dirty_ring_size;
+    /* Size of the per-vCPU dirty rings in bytes */
+    uint32_t kvm_dirty_ring_bytes;
+    QemuThread dirty_ring_reaper;
+    /* Pages collected from the dirty bitmaps or rings, for the dirty rate */
+    uint64_t dirty_log_pages;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -113,6 +124,10 @@ struct KVMState
 #ifdef KVM_CAP_IRQ_ROUTING
     struct kvm_irq_routing *irq_routes;
     int nr_allocated_irq_routes;
+    /* irq_routes differs from what KVM was last given */
+    bool irq_routes_dirty;
+    /* nesting of kvm_irqchip_begin_route_changes() */
+    int irq_routes_batch;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
@@ -176,8 +191,15 @@ typedef struct KVMResampleFd KVMResampleFd;
 static QLIST_HEAD(, KVMResampleFd) kvm_resample_fd_list =
     QLIST_HEAD_INITIALIZER(kvm_resample_fd_list);
 
-#define kvm_slots_lock(kml)      qemu_mutex_lock(&(kml)->slots_lock)
-#define kvm_slots_unlock(kml)    qemu_mutex_unlock(&(kml)->slots_lock)
+/*
+ * Protects the slots of every KVMMemoryListener and everything inside
+ * them.  The lock is global so that the dirty ring reaper, which gets
+ * entries for any address space, can take it once for all of them.
+ */
+static QemuMutex kml_slots_lock;
+
+#define kvm_slots_lock()    qemu_mutex_lock(&kml_slots_lock)
+#define kvm_slots_unlock()  qemu_mutex_unlock(&kml_slots_lock)
 
 static inline void kvm_resample_fd_remove(int gsi)
 {
@@ -242,7 +264,7 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len)
     return 1;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
     KVMState *s = kvm_state;
@@ -263,14 +285,14 @@ bool kvm_has_free_slot(MachineState *ms)
     bool result;
     KVMMemoryListener *kml = &s->memory_listener;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     result = !!kvm_get_free_slot(kml);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return result;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
@@ -331,7 +353,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
     KVMMemoryListener *kml = &s->memory_listener;
     int i, ret = 0;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
@@ -341,7 +363,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
             break;
         }
     }
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -381,6 +403,86 @@ err:
     return ret;
 }
 
+/*
+ * Exit statistics of a vCPU.  Only the vCPU thread updates them; readers
+ * hold the BQL, which keeps the vCPU from going away.
+ */
+#define KVM_VCPU_STATS_REASONS 64
+#define KVM_VCPU_STATS_BUCKETS 24
+
+typedef struct KVMVcpuStats {
+    uint64_t exits[KVM_VCPU_STATS_REASONS];
+    /* log2 histogram of the handling time, in microseconds */
+    uint64_t exit_time[KVM_VCPU_STATS_REASONS][KVM_VCPU_STATS_BUCKETS];
+    /* from KVM_GET_STATS_FD, or -1 */
+    int stats_fd;
+} KVMVcpuStats;
+
+static const char *const kvm_exit_reason_names[] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_ARM_NISV] = "arm-nisv",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+};
+
+static void kvm_vcpu_stats_init(CPUState *cpu)
+{
+    KVMVcpuStats *stats = g_new0(KVMVcpuStats, 1);
+
+    stats->stats_fd = -1;
+#ifdef KVM_GET_STATS_FD
+    if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
+        /* a vCPU ioctl, which blocks while the vCPU runs */
+        stats->stats_fd = kvm_vcpu_ioctl(cpu, KVM_GET_STATS_FD, NULL);
+        if (stats->stats_fd < 0) {
+            stats->stats_fd = -1;
+        }
+    }
+#endif
+    cpu->kvm_vcpu_stats = stats;
+}
+
+static void kvm_vcpu_stats_destroy(CPUState *cpu)
+{
+    KVMVcpuStats *stats = cpu->kvm_vcpu_stats;
+
+    if (stats) {
+        if (stats->stats_fd >= 0) {
+            close(stats->stats_fd);
+        }
+        g_free(stats);
+        cpu->kvm_vcpu_stats = NULL;
+    }
+}
+
+static uint64_t kvm_dirty_ring_reap(KVMState *s);
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -407,9 +509,22 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Don't lose what is left in the ring */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
+    kvm_vcpu_stats_destroy(cpu);
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
@@ -423,7 +538,8 @@ void kvm_destroy_vcpu(CPUState *cpu)
     }
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id,
+                        uint32_t *fetch_index)
 {
     struct KVMParkedVcpu *cpu;
 
@@ -433,14 +549,75 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            *fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    *fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
+typedef struct KVMVcpuCreation {
+    const unsigned long *vcpu_ids;
+    int *fds;
+    int nr;
+    int next;
+} KVMVcpuCreation;
+
+static void *kvm_precreate_vcpu_thread_fn(void *opaque)
+{
+    KVMVcpuCreation *c = opaque;
+    int i;
+
+    while ((i = qatomic_fetch_inc(&c->next)) < c->nr) {
+        c->fds[i] = kvm_vm_ioctl(kvm_state, KVM_CREATE_VCPU,
+                                 (void *)c->vcpu_ids[i]);
+    }
+    return NULL;
+}
+
+void kvm_precreate_vcpus(const unsigned long *vcpu_ids, int nr)
+{
+    KVMVcpuCreation c = {
+        .vcpu_ids = vcpu_ids,
+        .fds = g_new(int, nr),
+        .nr = nr,
+    };
+    g_autofree QemuThread *threads = NULL;
+    int nr_threads, i;
+
+    nr_threads = MIN(nr, MIN(sysconf(_SC_NPROCESSORS_ONLN), 64));
+    if (nr_threads < 2) {
+        g_free(c.fds);
+        return;
+    }
+
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "kvm-vcpu-create",
+                           kvm_precreate_vcpu_thread_fn, &c,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < nr; i++) {
+        struct KVMParkedVcpu *vcpu;
+
+        if (c.fds[i] < 0) {
+            continue;
+        }
+        vcpu = g_malloc0(sizeof(*vcpu));
+        vcpu->vcpu_id = vcpu_ids[i];
+        vcpu->kvm_fd = c.fds[i];
+        QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
+    }
+    g_free(c.fds);
+}
+
 int kvm_init_vcpu(CPUState *cpu, Error **errp)
 {
     KVMState *s = kvm_state;
@@ -449,7 +626,7 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
 
     trace_kvm_init_vcpu(cpu->cpu_index, kvm_arch_vcpu_id(cpu));
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu), &cpu->kvm_fetch_index);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "kvm_init_vcpu: kvm_get_vcpu failed (%lu)",
                          kvm_arch_vcpu_id(cpu));
@@ -483,12 +660,30 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            ret = -errno;
+            cpu->kvm_dirty_gfns = NULL;
+            error_setg_errno(errp, -ret,
+                             "kvm_init_vcpu: mmap'ing dirty ring failed (%lu)",
+                             kvm_arch_vcpu_id(cpu));
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
                          "kvm_init_vcpu: kvm_arch_init_vcpu failed (%lu)",
                          kvm_arch_vcpu_id(cpu));
+        goto err;
     }
+
+    kvm_vcpu_stats_init(cpu);
 err:
     return ret;
 }
@@ -511,7 +706,7 @@ static int kvm_mem_flags(MemoryRegion *mr)
     return flags;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
                                  MemoryRegion *mr)
 {
@@ -537,7 +732,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
         return 0;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     while (size && !ret) {
         slot_size = MIN(kvm_max_slot_size, size);
@@ -553,7 +748,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
     }
 
 out:
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     return ret;
 }
 
@@ -599,6 +794,7 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
                        memory_region_get_ram_addr(section->mr);
     ram_addr_t pages = int128_get64(section->size) / qemu_real_host_page_size;
 
+    kvm_state->dirty_log_pages += bitmap_count_one(bitmap, pages);
     cpu_physical_memory_set_dirty_lebitmap(bitmap, start, pages);
     return 0;
 }
@@ -626,13 +822,209 @@ static void kvm_memslot_init_dirty_bitmap(KVMSlot *mem)
     mem->dirty_bmap = g_malloc0(bitmap_size);
 }
 
+/*
+ * With the dirty ring, KVM pushes the address of every page the guest
+ * dirties to a per-vCPU ring instead of the per-slot bitmap.  The rings
+ * are harvested into KVMSlot.dirty_bmap, so that syncing only has to
+ * look at the pages that were actually dirtied rather than querying and
+ * write protecting every slot.
+ */
+
+/* Interval between two runs of the dirty ring reaper thread */
+#define KVM_DIRTY_RING_REAPER_INTERVAL_US  G_USEC_PER_SEC
+
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return qatomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    qatomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml = NULL;
+    KVMSlot *mem;
+    int i;
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml->as_id == as_id) {
+            kml = s->as[i].ml;
+            break;
+        }
+    }
+    if (!kml || slot_id >= s->nr_slots) {
+        return;
+    }
+
+    mem = &kml->slots[slot_id];
+    if (!mem->memory_size ||
+        offset >= (mem->memory_size / qemu_real_host_page_size)) {
+        /* The slot went away meanwhile */
+        return;
+    }
+    if (!mem->dirty_bmap) {
+        kvm_memslot_init_dirty_bitmap(mem);
+    }
+    set_bit(offset, mem->dirty_bmap);
+}
+
+/* Called with kml_slots_lock held */
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t fetch = cpu->kvm_fetch_index;
+    uint32_t count = 0;
+
+    for (;;) {
+        /* The ring size is a power of two, the index wraps cleanly */
+        cur = &cpu->kvm_dirty_gfns[fetch & (ring_size - 1)];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+    cpu->dirty_pages += count;
+    s->dirty_log_pages += count;
+
+    return count;
+}
+
+/* Must be called with the iothread lock and kml_slots_lock held */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int ret;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        /* Let KVM write protect the collected pages and reuse the entries */
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == total);
+    }
+    trace_kvm_dirty_ring_reap(total);
+
+    return total;
+}
+
+/*
+ * kvm_dirty_ring_reap: harvest the dirty rings of all the vCPUs into
+ * the dirty bitmaps of the slots
+ *
+ * Must be called with the iothread lock held.  Returns the number of
+ * pages collected.
+ */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    uint64_t total;
+
+    kvm_slots_lock();
+    total = kvm_dirty_ring_reap_locked(s);
+    kvm_slots_unlock();
+
+    return total;
+}
+
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
+uint64_t kvm_dirty_log_pages(void)
+{
+    return kvm_state->dirty_log_pages;
+}
+
+static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* No need to do anything, the vCPU has left KVM_RUN */
+}
+
+/*
+ * kvm_dirty_ring_flush: collect everything dirtied so far
+ *
+ * A page can be dirtied without being in the ring yet, for example
+ * when it is still in the PML buffer of a running vCPU.  Kicking every
+ * vCPU out of KVM_RUN makes KVM flush those, and then the rings are
+ * harvested.
+ *
+ * Must be called with the iothread lock held.
+ */
+static void kvm_dirty_ring_flush(KVMState *s)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_cpu_synchronize_kick, RUN_ON_CPU_NULL);
+    }
+    kvm_dirty_ring_reap(s);
+}
+
+static void *kvm_dirty_ring_reaper_thread(void *data)
+{
+    KVMState *s = data;
+
+    rcu_register_thread();
+
+    while (true) {
+        trace_kvm_dirty_ring_reaper("wait");
+        g_usleep(KVM_DIRTY_RING_REAPER_INTERVAL_US);
+
+        /*
+         * Emptying the rings in the background keeps the vCPUs from
+         * exiting with KVM_EXIT_DIRTY_RING_FULL.
+         */
+        trace_kvm_dirty_ring_reaper("reap");
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/*
+ * kvm_dirty_ring_sync_slot - push the harvested dirty pages of a slot
+ * to QEMU's dirty bitmap
+ *
+ * NOTE: caller must be with kml_slots_lock held.
+ */
+static void kvm_dirty_ring_sync_slot(KVMSlot *mem)
+{
+    ram_addr_t pages = mem->memory_size / qemu_real_host_page_size;
+
+    if (!mem->dirty_bmap) {
+        return;
+    }
+    cpu_physical_memory_set_dirty_lebitmap(mem->dirty_bmap,
+                                           mem->ram_start_offset, pages);
+    bitmap_zero(mem->dirty_bmap, pages);
+}
+
 /**
  * kvm_physical_sync_dirty_bitmap - Sync dirty bitmap from kernel space
  *
  * This function will first try to fetch dirty bitmap from the kernel,
  * and then updates qemu's dirty bitmap.
  *
- * NOTE: caller must be with kml->slots_lock held.
+ * NOTE: caller must be with kml_slots_lock held.
  *
  * @kml: the KVM memory listener object
  * @section: the memory section to sync the dirty bitmap with
@@ -658,6 +1050,12 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
             goto out;
         }
 
+        if (s->kvm_dirty_ring_size) {
+            /* The bitmap was filled by the dirty ring reaper */
+            kvm_dirty_ring_sync_slot(mem);
+            goto next;
+        }
+
         if (!mem->dirty_bmap) {
             /* Allocate on the first log_sync, once and for all */
             kvm_memslot_init_dirty_bitmap(mem);
@@ -675,6 +1073,7 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
         subsection.size = int128_make64(slot_size);
         kvm_get_dirty_pages_log_range(&subsection, d.dirty_bitmap);
 
+next:
         slot_offset += slot_size;
         start_addr += slot_size;
         size -= slot_size;
@@ -824,7 +1223,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
         return ret;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     for (i = 0; i < s->nr_slots; i++) {
         mem = &kml->slots[i];
@@ -850,7 +1249,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
         }
     }
 
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -1126,72 +1525,161 @@ void kvm_set_max_memslot_size(hwaddr max_slot_size)
     kvm_max_slot_size = max_slot_size;
 }
 
-static void kvm_set_phys_mem(KVMMemoryListener *kml,
-                             MemoryRegionSection *section, bool add)
+/*
+ * Compute the guest physical range that KVM maps for @section and the host
+ * memory behind it.  Returns 0 if there is nothing to map; *@add is
+ * cleared if the section has to trap every access, i.e. its slots must go
+ * away even though the section is being added.
+ */
+static hwaddr kvm_section_slot_range(MemoryRegionSection *section, bool *add,
+                                     hwaddr *start_addr, void **ram,
+                                     ram_addr_t *ram_start_offset)
 {
-    KVMSlot *mem;
-    int err;
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
-    hwaddr start_addr, size, slot_size;
-    void *ram;
+    hwaddr size, delta;
 
     if (!memory_region_is_ram(mr)) {
         if (writeable || !kvm_readonly_mem_allowed) {
-            return;
+            return 0;
         } else if (!mr->romd_mode) {
             /* If the memory device is not in romd_mode, then we actually want
              * to remove the kvm memory slot so all accesses will trap. */
-            add = false;
+            *add = false;
         }
     }
 
-    size = kvm_align_section(section, &start_addr);
+    size = kvm_align_section(section, start_addr);
     if (!size) {
-        return;
+        return 0;
     }
 
-    /* use aligned delta to align the ram address */
-    ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
-          (start_addr - section->offset_within_address_space);
+    /* use aligned delta to align the ram address and offset */
+    delta = section->offset_within_region +
+            (*start_addr - section->offset_within_address_space);
+    *ram_start_offset = memory_region_get_ram_addr(mr) + delta;
+    *ram = memory_region_get_ram_ptr(mr) + delta;
+    return size;
+}
 
-    kvm_slots_lock(kml);
+/*
+ * Flag the slots of a section that goes away.  They are only unregistered
+ * by kvm_commit_slot_deletes(), so that a slot the same transaction maps
+ * again can be left alone.
+ * Called with kml_slots_lock held.
+ */
+static void kvm_mark_slots_deleted(KVMMemoryListener *kml,
+                                   MemoryRegionSection *section,
+                                   hwaddr start_addr, hwaddr size)
+{
+    hwaddr slot_size;
+    KVMSlot *mem;
 
-    if (!add) {
-        do {
-            slot_size = MIN(kvm_max_slot_size, size);
-            mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
-            if (!mem) {
-                goto out;
-            }
-            if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-                kvm_physical_sync_dirty_bitmap(kml, section);
+    do {
+        slot_size = MIN(kvm_max_slot_size, size);
+        mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
+        if (!mem) {
+            return;
+        }
+        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+            if (kvm_state->kvm_dirty_ring_size) {
+                /* Pick up the last pages of the slot from the rings */
+                kvm_dirty_ring_reap_locked(kvm_state);
             }
+            kvm_physical_sync_dirty_bitmap(kml, section);
+        }
+        mem->pending_delete = true;
+        start_addr += slot_size;
+        size -= slot_size;
+    } while (size);
+}
 
-            /* unregister the slot */
-            g_free(mem->dirty_bmap);
-            mem->dirty_bmap = NULL;
-            mem->memory_size = 0;
-            mem->flags = 0;
-            err = kvm_set_user_memory_region(kml, mem, false);
+/*
+ * Keep the slots that a section being added would create anew with the
+ * same address, size and backing memory, updating only their flags.
+ * Called with kml_slots_lock held.
+ */
+static void kvm_reuse_slots(KVMMemoryListener *kml, MemoryRegion *mr,
+                            hwaddr start_addr, hwaddr size, void *ram,
+                            ram_addr_t ram_start_offset)
+{
+    hwaddr slot_size;
+    KVMSlot *mem;
+    int err;
+
+    do {
+        slot_size = MIN(kvm_max_slot_size, size);
+        mem = kvm_lookup_matching_slot(kml, start_addr, slot_size);
+        if (mem && mem->pending_delete && mem->ram == ram &&
+            mem->ram_start_offset == ram_start_offset) {
+            mem->pending_delete = false;
+            if ((kvm_mem_flags(mr) & KVM_MEM_LOG_DIRTY_PAGES) &&
+                !mem->dirty_bmap) {
+                kvm_memslot_init_dirty_bitmap(mem);
+            }
+            err = kvm_slot_update_flags(kml, mem, mr);
             if (err) {
-                fprintf(stderr, "%s: error unregistering slot: %s\n",
-                        __func__, strerror(-err));
+                fprintf(stderr, "%s: error updating slot: %s\n", __func__,
+                        strerror(-err));
                 abort();
             }
-            start_addr += slot_size;
-            size -= slot_size;
-        } while (size);
-        goto out;
+        }
+        start_addr += slot_size;
+        ram_start_offset += slot_size;
+        ram += slot_size;
+        size -= slot_size;
+    } while (size);
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_commit_slot_deletes(KVMMemoryListener *kml)
+{
+    KVMSlot *mem;
+    int i, err;
+
+    for (i = 0; i < kvm_state->nr_slots; i++) {
+        mem = &kml->slots[i];
+        if (!mem->pending_delete) {
+            continue;
+        }
+
+        /* unregister the slot */
+        g_free(mem->dirty_bmap);
+        mem->dirty_bmap = NULL;
+        mem->memory_size = 0;
+        mem->flags = 0;
+        mem->pending_delete = false;
+        err = kvm_set_user_memory_region(kml, mem, false);
+        if (err) {
+            fprintf(stderr, "%s: error unregistering slot: %s\n",
+                    __func__, strerror(-err));
+            abort();
+        }
     }
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_register_slots(KVMMemoryListener *kml, MemoryRegion *mr,
+                               hwaddr start_addr, hwaddr size, void *ram,
+                               ram_addr_t ram_start_offset)
+{
+    hwaddr slot_size;
+    KVMSlot *mem;
+    int err;
 
-    /* register the new slot */
     do {
         slot_size = MIN(kvm_max_slot_size, size);
+        /* a slot kept by kvm_reuse_slots() is already in place */
+        if (kvm_lookup_matching_slot(kml, start_addr, slot_size)) {
+            goto next;
+        }
+
+        /* register the new slot */
         mem = kvm_alloc_slot(kml);
         mem->memory_size = slot_size;
         mem->start_addr = start_addr;
         mem->ram = ram;
+        mem->ram_start_offset = ram_start_offset;
         mem->flags = kvm_mem_flags(mr);
 
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
@@ -1207,31 +1695,109 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                     strerror(-err));
             abort();
         }
+next:
         start_addr += slot_size;
+        ram_start_offset += slot_size;
         ram += slot_size;
         size -= slot_size;
     } while (size);
-
-out:
-    kvm_slots_unlock(kml);
 }
 
 static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMMemoryUpdate *update = g_new0(KVMMemoryUpdate, 1);
 
     memory_region_ref(section->mr);
-    kvm_set_phys_mem(kml, section, true);
+    update->section = *section;
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_add, update, next);
 }
 
 static void kvm_region_del(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMMemoryUpdate *update = g_new0(KVMMemoryUpdate, 1);
+
+    /* the reference taken by kvm_region_add() is dropped at commit */
+    update->section = *section;
+    QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
+}
+
+/*
+ * Apply the sections added and removed by a memory transaction as a
+ * whole.  Every KVM_SET_USER_MEMORY_REGION call makes KVM zap and rebuild
+ * the guest page tables, so only issue those that the transaction really
+ * needs: slots that are removed and created again with the same range and
+ * backing memory stay in place.  Deletions go first, since KVM does not
+ * allow slots to overlap.
+ */
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMMemoryUpdate *update, *tmp;
+    hwaddr start_addr, size;
+    ram_addr_t ram_start_offset;
+    void *ram;
+    bool add;
+
+    if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
+        QSIMPLEQ_EMPTY(&kml->transaction_del)) {
+        return;
+    }
+
+    kvm_slots_lock();
+
+    QSIMPLEQ_FOREACH(update, &kml->transaction_del, next) {
+        add = false;
+        size = kvm_section_slot_range(&update->section, &add, &start_addr,
+                                      &ram, &ram_start_offset);
+        if (size) {
+            kvm_mark_slots_deleted(kml, &update->section, start_addr, size);
+        }
+    }
+    QSIMPLEQ_FOREACH(update, &kml->transaction_add, next) {
+        add = true;
+        size = kvm_section_slot_range(&update->section, &add, &start_addr,
+                                      &ram, &ram_start_offset);
+        if (size && !add) {
+            kvm_mark_slots_deleted(kml, &update->section, start_addr, size);
+        }
+    }
+    QSIMPLEQ_FOREACH(update, &kml->transaction_add, next) {
+        add = true;
+        size = kvm_section_slot_range(&update->section, &add, &start_addr,
+                                      &ram, &ram_start_offset);
+        if (size && add) {
+            kvm_reuse_slots(kml, update->section.mr, start_addr, size, ram,
+                            ram_start_offset);
+        }
+    }
+
+    kvm_commit_slot_deletes(kml);
+
+    QSIMPLEQ_FOREACH(update, &kml->transaction_add, next) {
+        add = true;
+        size = kvm_section_slot_range(&update->section, &add, &start_addr,
+                                      &ram, &ram_start_offset);
+        if (size && add) {
+            kvm_register_slots(kml, update->section.mr, start_addr, size, ram,
+                               ram_start_offset);
+        }
+    }
 
-    kvm_set_phys_mem(kml, section, false);
-    memory_region_unref(section->mr);
+    kvm_slots_unlock();
+
+    QSIMPLEQ_FOREACH_SAFE(update, &kml->transaction_add, next, tmp) {
+        g_free(update);
+    }
+    QSIMPLEQ_INIT(&kml->transaction_add);
+    QSIMPLEQ_FOREACH_SAFE(update, &kml->transaction_del, next, tmp) {
+        memory_region_unref(update->section.mr);
+        g_free(update);
+    }
+    QSIMPLEQ_INIT(&kml->transaction_del);
 }
 
 static void kvm_log_sync(MemoryListener *listener,
@@ -1240,14 +1806,37 @@ static void kvm_log_sync(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     r = kvm_physical_sync_dirty_bitmap(kml, section);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
 }
 
+/*
+ * Used instead of kvm_log_sync() with the dirty ring, which can only be
+ * harvested for all the slots at once.
+ */
+static void kvm_log_sync_global(MemoryListener *l)
+{
+    KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
+    KVMState *s = kvm_state;
+    KVMSlot *mem;
+    int i;
+
+    kvm_dirty_ring_flush(s);
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_slots; i++) {
+        mem = &kml->slots[i];
+        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+            kvm_dirty_ring_sync_slot(mem);
+        }
+    }
+    kvm_slots_unlock();
+}
+
 static void kvm_log_clear(MemoryListener *listener,
                           MemoryRegionSection *section)
 {
@@ -1342,9 +1931,10 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
-    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
+    QSIMPLEQ_INIT(&kml->transaction_add);
+    QSIMPLEQ_INIT(&kml->transaction_del);
 
     for (i = 0; i < s->nr_slots; i++) {
         kml->slots[i].slot = i;
@@ -1352,10 +1942,15 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
+    kml->listener.commit = kvm_region_commit;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
-    kml->listener.log_clear = kvm_log_clear;
+    if (s->kvm_dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+        kml->listener.log_clear = kvm_log_clear;
+    }
     kml->listener.priority = 10;
 
     memory_listener_register(&kml->listener, as);
@@ -1422,6 +2017,8 @@ void kvm_init_irq_routing(KVMState *s)
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    /* the first commit replaces the kernel's default routing */
+    s->irq_routes_dirty = true;
 
     if (!kvm_direct_msi_allowed) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
@@ -1444,10 +2041,37 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * KVM_SET_GSI_ROUTING replaces the whole table, so skip it when
+     * nothing changed, and leave it to the end of a batch of changes.
+     */
+    if (!s->irq_routes_dirty || s->irq_routes_batch) {
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
+}
+
+void kvm_irqchip_begin_route_changes(KVMState *s)
+{
+    if (kvm_gsi_direct_mapping() || !kvm_gsi_routing_enabled()) {
+        return;
+    }
+    s->irq_routes_batch++;
+}
+
+void kvm_irqchip_end_route_changes(KVMState *s)
+{
+    if (kvm_gsi_direct_mapping() || !kvm_gsi_routing_enabled()) {
+        return;
+    }
+    assert(s->irq_routes_batch > 0);
+    s->irq_routes_batch--;
+    kvm_irqchip_commit_routes(s);
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1470,6 +2094,7 @@ static void kvm_add_routing_entry(KVMState *s,
     new = &s->irq_routes->entries[n];
 
     *new = *entry;
+    s->irq_routes_dirty = true;
 
     set_gsi(s, entry->gsi);
 }
@@ -1491,6 +2116,7 @@ static int kvm_update_routing_entry(KVMState *s,
         }
 
         *entry = *new_entry;
+        s->irq_routes_dirty = true;
 
         return 0;
     }
@@ -1526,6 +2152,7 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            s->irq_routes_dirty = true;
         }
     }
     clear_gsi(s, virq);
@@ -2018,6 +2645,9 @@ static int kvm_init(MachineState *ms)
 
     s = KVM_STATE(ms->accelerator);
 
+    qemu_mutex_init(&kml_slots_lock);
+    qemu_mutex_init(&kvm_exit_profile_lock);
+
     /*
      * On systems where the kernel can support different base page
      * sizes, host page size may be different from TARGET_PAGE_SIZE,
@@ -2140,10 +2770,48 @@ static int kvm_init(MachineState *ms)
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
 
-    dirty_log_manual_caps =
-        kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
-    dirty_log_manual_caps &= (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
-                              KVM_DIRTY_LOG_INITIALLY_SET);
+    /*
+     * Enable the dirty ring before any vCPU is created, the kernel
+     * refuses it afterwards.  KVM reports the maximum ring size in
+     * bytes.
+     */
+    if (s->kvm_dirty_ring_size) {
+        uint64_t ring_bytes;
+
+        ring_bytes = s->kvm_dirty_ring_size * sizeof(struct kvm_dirty_gfn);
+        ret = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+        if (ret <= 0) {
+            warn_report("KVM dirty ring not available, using bitmap method");
+            s->kvm_dirty_ring_size = 0;
+        } else if (ring_bytes > ret) {
+            error_report("KVM dirty ring size %" PRIu32 " too big "
+                         "(maximum is %zu).  Please use a smaller value.",
+                         s->kvm_dirty_ring_size,
+                         ret / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        } else {
+            ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+            if (ret) {
+                error_report("Enabling of KVM dirty ring failed: %s",
+                             strerror(-ret));
+                goto err;
+            }
+            s->kvm_dirty_ring_bytes = ring_bytes;
+        }
+    }
+
+    /*
+     * With the dirty ring the per-slot bitmaps of KVM are not used, so
+     * there is nothing to clear manually.
+     */
+    dirty_log_manual_caps = 0;
+    if (!s->kvm_dirty_ring_size) {
+        dirty_log_manual_caps =
+            kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
+        dirty_log_manual_caps &= (KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE |
+                                  KVM_DIRTY_LOG_INITIALLY_SET);
+    }
     s->manual_dirty_log_protect = dirty_log_manual_caps;
     if (dirty_log_manual_caps) {
         ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0,
@@ -2252,6 +2920,12 @@ static int kvm_init(MachineState *ms)
         assert(!ret);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
+
     cpus_register_accel(&kvm_cpus);
     return 0;
 
@@ -2273,12 +2947,318 @@ void kvm_set_sigmask_len(KVMState *s, unsigned int sigmask_len)
     s->sigmask_len = sigmask_len;
 }
 
+/*
+ * Opt-in profile of the MMIO and port I/O exits handled by QEMU, counted
+ * per memory region and offset, to find the device registers that would
+ * gain from coalescing.
+ */
+typedef struct KVMExitProfileKey {
+    MemoryRegion *mr;
+    hwaddr offset;
+} KVMExitProfileKey;
+
+typedef struct KVMExitProfileEntry {
+    KVMExitProfileKey key;
+    char *region;
+    bool io;
+    unsigned size;
+    uint64_t reads;
+    uint64_t writes;
+} KVMExitProfileEntry;
+
+static bool kvm_exit_profile_enabled;
+/* protects kvm_exit_profile, which is never freed once created */
+static QemuMutex kvm_exit_profile_lock;
+static GHashTable *kvm_exit_profile;
+
+static guint kvm_exit_profile_hash(gconstpointer p)
+{
+    const KVMExitProfileKey *key = p;
+
+    return g_direct_hash(key->mr) ^ g_int64_hash(&key->offset);
+}
+
+static gboolean kvm_exit_profile_equal(gconstpointer a, gconstpointer b)
+{
+    const KVMExitProfileKey *ka = a, *kb = b;
+
+    return ka->mr == kb->mr && ka->offset == kb->offset;
+}
+
+static void kvm_exit_profile_entry_free(gpointer p)
+{
+    KVMExitProfileEntry *entry = p;
+
+    g_free(entry->region);
+    g_free(entry);
+}
+
+static void kvm_exit_profile_record(AddressSpace *as, hwaddr addr,
+                                    MemTxAttrs attrs, int size, bool is_write)
+{
+    KVMExitProfileEntry *entry;
+    KVMExitProfileKey key;
+    hwaddr len = size;
+
+    RCU_READ_LOCK_GUARD();
+    key.mr = address_space_translate(as, addr, &key.offset, &len, is_write,
+                                     attrs);
+
+    qemu_mutex_lock(&kvm_exit_profile_lock);
+    entry = g_hash_table_lookup(kvm_exit_profile, &key);
+    if (!entry) {
+        /*
+         * The region may go away before the profile is queried, so only
+         * its name is kept; a region allocated at the same address later
+         * shares its counters.
+         */
+        entry = g_new0(KVMExitProfileEntry, 1);
+        entry->key = key;
+        entry->region = g_strdup(memory_region_name(key.mr) ?: "");
+        entry->io = as == &address_space_io;
+        g_hash_table_insert(kvm_exit_profile, &entry->key, entry);
+    }
+    entry->size = size;
+    if (is_write) {
+        entry->writes++;
+    } else {
+        entry->reads++;
+    }
+    qemu_mutex_unlock(&kvm_exit_profile_lock);
+}
+
+void qmp_x_kvm_exit_profile(bool enable, Error **errp)
+{
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM acceleration is not active");
+        return;
+    }
+
+    qemu_mutex_lock(&kvm_exit_profile_lock);
+    if (enable) {
+        if (kvm_exit_profile) {
+            g_hash_table_remove_all(kvm_exit_profile);
+        } else {
+            kvm_exit_profile = g_hash_table_new_full(kvm_exit_profile_hash,
+                                                     kvm_exit_profile_equal,
+                                                     NULL,
+                                                     kvm_exit_profile_entry_free);
+        }
+    }
+    qatomic_set(&kvm_exit_profile_enabled, enable);
+    qemu_mutex_unlock(&kvm_exit_profile_lock);
+}
+
+static gint kvm_exit_profile_cmp(gconstpointer a, gconstpointer b)
+{
+    const KVMExitProfileEntry *ea = a, *eb = b;
+    uint64_t na = ea->reads + ea->writes;
+    uint64_t nb = eb->reads + eb->writes;
+
+    return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+KvmExitInfoList *qmp_x_query_kvm_exit_profile(Error **errp)
+{
+    KvmExitInfoList *head = NULL, **prev = &head;
+    GList *entries, *l;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM acceleration is not active");
+        return NULL;
+    }
+
+    qemu_mutex_lock(&kvm_exit_profile_lock);
+    if (!kvm_exit_profile) {
+        qemu_mutex_unlock(&kvm_exit_profile_lock);
+        return NULL;
+    }
+    entries = g_list_sort(g_hash_table_get_values(kvm_exit_profile),
+                          kvm_exit_profile_cmp);
+    for (l = entries; l; l = l->next) {
+        KVMExitProfileEntry *entry = l->data;
+        KvmExitInfoList *elem = g_new0(KvmExitInfoList, 1);
+        KvmExitInfo *info = g_new0(KvmExitInfo, 1);
+
+        info->region = g_strdup(entry->region);
+        info->io = entry->io;
+        info->offset = entry->key.offset;
+        info->size = entry->size;
+        info->reads = entry->reads;
+        info->writes = entry->writes;
+
+        elem->value = info;
+        *prev = elem;
+        prev = &elem->next;
+    }
+    qemu_mutex_unlock(&kvm_exit_profile_lock);
+    g_list_free(entries);
+    return head;
+}
+
+/* Called from the vCPU thread */
+static void kvm_vcpu_stats_account(CPUState *cpu, uint32_t reason,
+                                   int64_t start)
+{
+    KVMVcpuStats *stats = cpu->kvm_vcpu_stats;
+    int64_t us = (get_clock() - start) / SCALE_US;
+    int bucket = us > 0 ? MIN(64 - clz64(us), KVM_VCPU_STATS_BUCKETS - 1) : 0;
+
+    reason = MIN(reason, KVM_VCPU_STATS_REASONS - 1);
+    qatomic_set_u64(&stats->exits[reason], stats->exits[reason] + 1);
+    qatomic_set_u64(&stats->exit_time[reason][bucket],
+                    stats->exit_time[reason][bucket] + 1);
+}
+
+#ifdef KVM_GET_STATS_FD
+static KvmBinaryStatList *kvm_vcpu_binary_stats(int fd)
+{
+    KvmBinaryStatList *head = NULL, **prev = &head;
+    struct kvm_stats_header header;
+    g_autofree void *descs = NULL;
+    size_t desc_size, descs_size;
+    uint32_t i;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        return NULL;
+    }
+    desc_size = sizeof(struct kvm_stats_desc) + header.name_size;
+    descs_size = desc_size * header.num_desc;
+    descs = g_malloc0(descs_size);
+    if (pread(fd, descs, descs_size, header.desc_offset) != descs_size) {
+        return NULL;
+    }
+
+    for (i = 0; i < header.num_desc; i++) {
+        struct kvm_stats_desc *desc = descs + i * desc_size;
+        g_autofree uint64_t *data = g_new(uint64_t, desc->size);
+        size_t data_size = desc->size * sizeof(uint64_t);
+        KvmBinaryStatList *elem;
+        KvmBinaryStat *stat;
+        uint64List **vprev;
+        int j;
+
+        if (pread(fd, data, data_size, header.data_offset + desc->offset) !=
+            data_size) {
+            continue;
+        }
+
+        stat = g_new0(KvmBinaryStat, 1);
+        stat->name = g_strndup(desc->name, header.name_size);
+        stat->exponent = desc->exponent;
+        vprev = &stat->values;
+        for (j = 0; j < desc->size; j++) {
+            uint64List *value = g_new0(uint64List, 1);
+
+            value->value = data[j];
+            *vprev = value;
+            vprev = &value->next;
+        }
+
+        elem = g_new0(KvmBinaryStatList, 1);
+        elem->value = stat;
+        *prev = elem;
+        prev = &elem->next;
+    }
+    return head;
+}
+#endif
+
+static KvmExitReasonStatsList *kvm_vcpu_exit_stats(KVMVcpuStats *stats)
+{
+    KvmExitReasonStatsList *head = NULL, **prev = &head;
+    uint32_t reason;
+
+    for (reason = 0; reason < KVM_VCPU_STATS_REASONS; reason++) {
+        uint64_t count = qatomic_read_u64(&stats->exits[reason]);
+        KvmExitReasonStatsList *elem;
+        KvmExitReasonStats *info;
+        uint64List **hprev;
+        int last, i;
+
+        if (!count) {
+            continue;
+        }
+
+        info = g_new0(KvmExitReasonStats, 1);
+        info->reason = reason;
+        if (reason < ARRAY_SIZE(kvm_exit_reason_names) &&
+            kvm_exit_reason_names[reason]) {
+            info->has_name = true;
+            info->name = g_strdup(kvm_exit_reason_names[reason]);
+        }
+        info->count = count;
+
+        for (last = KVM_VCPU_STATS_BUCKETS - 1; last >= 0; last--) {
+            if (qatomic_read_u64(&stats->exit_time[reason][last])) {
+                break;
+            }
+        }
+        hprev = &info->handling_time;
+        for (i = 0; i <= last; i++) {
+            uint64List *value = g_new0(uint64List, 1);
+
+            value->value = qatomic_read_u64(&stats->exit_time[reason][i]);
+            *hprev = value;
+            hprev = &value->next;
+        }
+
+        elem = g_new0(KvmExitReasonStatsList, 1);
+        elem->value = info;
+        *prev = elem;
+        prev = &elem->next;
+    }
+    return head;
+}
+
+KvmVcpuStatsList *qmp_query_kvm_vcpu_stats(Error **errp)
+{
+    KvmVcpuStatsList *head = NULL, **prev = &head;
+    CPUState *cpu;
+
+    if (!kvm_enabled()) {
+        error_setg(errp, "KVM acceleration is not active");
+        return NULL;
+    }
+
+    CPU_FOREACH(cpu) {
+        KVMVcpuStats *stats = cpu->kvm_vcpu_stats;
+        KvmVcpuStatsList *elem;
+        KvmVcpuStats *info;
+
+        if (!stats) {
+            continue;
+        }
+
+        info = g_new0(KvmVcpuStats, 1);
+        info->cpu_index = cpu->cpu_index;
+        info->exits = kvm_vcpu_exit_stats(stats);
+#ifdef KVM_GET_STATS_FD
+        if (stats->stats_fd >= 0) {
+            info->has_kvm_stats = true;
+            info->kvm_stats = kvm_vcpu_binary_stats(stats->stats_fd);
+        }
+#endif
+
+        elem = g_new0(KvmVcpuStatsList, 1);
+        elem->value = info;
+        *prev = elem;
+        prev = &elem->next;
+    }
+    return head;
+}
+
 static void kvm_handle_io(uint16_t port, MemTxAttrs attrs, void *data, int direction,
                           int size, uint32_t count)
 {
     int i;
     uint8_t *ptr = data;
 
+    if (qatomic_read(&kvm_exit_profile_enabled)) {
+        kvm_exit_profile_record(&address_space_io, port, attrs, size,
+                                direction == KVM_EXIT_IO_OUT);
+    }
+
     for (i = 0; i < count; i++) {
         address_space_rw(&address_space_io, port, attrs,
                          ptr, size,
@@ -2464,6 +3444,7 @@ int kvm_cpu_exec(CPUState *cpu)
 
     do {
         MemTxAttrs attrs;
+        int64_t exit_start;
 
         if (cpu->vcpu_dirty) {
             kvm_arch_put_registers(cpu, KVM_PUT_RUNTIME_STATE);
@@ -2487,6 +3468,7 @@ int kvm_cpu_exec(CPUState *cpu)
         smp_rmb();
 
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
+        exit_start = get_clock();
 
         attrs = kvm_arch_post_run(cpu, run);
 
@@ -2504,6 +3486,7 @@ int kvm_cpu_exec(CPUState *cpu)
             if (run_ret == -EINTR || run_ret == -EAGAIN) {
                 DPRINTF("io window exit\n");
                 kvm_eat_signals(cpu);
+                kvm_vcpu_stats_account(cpu, KVM_EXIT_INTR, exit_start);
                 ret = EXCP_INTERRUPT;
                 break;
             }
@@ -2536,6 +3519,11 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_MMIO:
             DPRINTF("handle_mmio\n");
             /* Called outside BQL */
+            if (qatomic_read(&kvm_exit_profile_enabled)) {
+                kvm_exit_profile_record(&address_space_memory,
+                                        run->mmio.phys_addr, attrs,
+                                        run->mmio.len, run->mmio.is_write);
+            }
             address_space_rw(&address_space_memory,
                              run->mmio.phys_addr, attrs,
                              run->mmio.data,
@@ -2547,6 +3535,17 @@ int kvm_cpu_exec(CPUState *cpu)
             DPRINTF("irq_window_open\n");
             ret = EXCP_INTERRUPT;
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * The reaper thread could not keep up with this vCPU,
+             * harvest the rings before going back to the guest.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
             qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
@@ -2588,6 +3587,7 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+        kvm_vcpu_stats_account(cpu, run->exit_reason, exit_start);
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -3143,6 +4143,34 @@ static void kvm_set_kvm_shadow_mem(Object *obj, Visitor *v,
     s->kvm_shadow_mem = value;
 }
 
+static void kvm_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of two");
+        return;
+    }
+
+    s->kvm_dirty_ring_size = value;
+}
+
 static void kvm_set_kernel_irqchip(Object *obj, Visitor *v,
                                    const char *name, void *opaque,
                                    Error **errp)
@@ -3220,6 +4248,12 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size");
+
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        kvm_get_dirty_ring_size, kvm_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 }
 
 static const TypeInfo kvm_accel_type = {
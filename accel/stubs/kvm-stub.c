@@ -16,6 +16,8 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "hw/pci/msi.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
 #endif
 
 KVMState *kvm_state;
@@ -115,6 +117,14 @@ void kvm_irqchip_commit_routes(KVMState *s)
 {
 }
 
+void kvm_irqchip_begin_route_changes(KVMState *s)
+{
+}
+
+void kvm_irqchip_end_route_changes(KVMState *s)
+{
+}
+
 void kvm_irqchip_add_change_notifier(Notifier *n)
 {
 }
@@ -149,6 +159,20 @@ bool kvm_has_free_slot(MachineState *ms)
     return false;
 }
 
+void kvm_precreate_vcpus(const unsigned long *vcpu_ids, int nr)
+{
+}
+
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+uint64_t kvm_dirty_log_pages(void)
+{
+    return 0;
+}
+
 void kvm_init_cpu_signals(CPUState *cpu)
 {
     abort();
@@ -158,4 +182,21 @@ bool kvm_arm_supports_user_irq(void)
 {
     return false;
 }
+
+void qmp_x_kvm_exit_profile(bool enable, Error **errp)
+{
+    error_setg(errp, "KVM acceleration is not active");
+}
+
+KvmExitInfoList *qmp_x_query_kvm_exit_profile(Error **errp)
+{
+    error_setg(errp, "KVM acceleration is not active");
+    return NULL;
+}
+
+KvmVcpuStatsList *qmp_query_kvm_vcpu_stats(Error **errp)
+{
+    error_setg(errp, "KVM acceleration is not active");
+    return NULL;
+}
 #endif
@@ -414,7 +414,7 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
         tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
-        qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+        tb_jmp_cache_insert(tb_jmp_cache_set(cpu, pc), tb);
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
@@ -681,17 +681,29 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 #ifndef CONFIG_USER_ONLY
     /* Ensure global icount has gone forward */
     icount_update(cpu);
+    if (cpu->icount_budget == 0 && replay_mode == REPLAY_MODE_NONE) {
+        /*
+         * The deadline the budget was computed for may have moved since,
+         * e.g. a timer was rearmed later.  Extend the budget instead of
+         * leaving cpu_exec, unless a deadline is due now.  With replay,
+         * the budget must go through the main loop to be accounted.
+         */
+        cpu->icount_budget = icount_get_limit();
+    }
     /* Refill decrementer and continue execution.  */
     insns_left = MIN(0xffff, cpu->icount_budget);
     cpu_neg(cpu)->icount_decr.u16.low = insns_left;
     cpu->icount_extra = cpu->icount_budget - insns_left;
-    if (!cpu->icount_extra) {
-        /* Execute any remaining instructions, then let the main loop
-         * handle the next event.
-         */
-        if (insns_left > 0) {
-            cpu_exec_nocache(cpu, insns_left, tb, false);
-        }
+
+    /*
+     * If the next TB has more instructions than the budget has left,
+     * execute a TB cut to exactly that many, then let the main loop
+     * handle the next event.  The TB is cached like any other, rather
+     * than translated and thrown away every time the budget runs out.
+     */
+    if (insns_left > 0 && insns_left < tb->icount) {
+        assert(cpu->icount_extra == 0);
+        cpu->cflags_next_tb = (tb->cflags & ~CF_COUNT_MASK) | insns_left;
     }
 #endif
 }
@@ -321,6 +321,21 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_miss_counts(size_t *pmiss, size_t *pvictim)
+{
+    CPUState *cpu;
+    size_t miss = 0, victim = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        miss += qatomic_read(&env_tlb(env)->c.miss_count);
+        victim += qatomic_read(&env_tlb(env)->c.victim_hit_count);
+    }
+    *pmiss = miss;
+    *pvictim = victim;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -666,6 +681,195 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
     tlb_flush_page_by_mmuidx_all_cpus_synced(src, addr, ALL_MMUIDX_BITS);
 }
 
+static void tlb_flush_range_locked(CPUArchState *env, int midx,
+                                   target_ulong addr, target_ulong len)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong last = addr + len - 1;
+    target_ulong i;
+
+    /*
+     * Past the size of the TLB, testing every page of the range takes
+     * longer than flushing everything.  A large page that overlaps the
+     * range needs a full flush anyway.
+     */
+    if ((len >> TARGET_PAGE_BITS) > tlb_n_entries(f) ||
+        (last >= d->large_page_addr &&
+         addr <= (d->large_page_addr | ~d->large_page_mask))) {
+        tlb_debug("forcing full flush midx %d ("
+                  TARGET_FMT_lx "+" TARGET_FMT_lx ")\n", midx, addr, len);
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    for (i = 0; i < len; i += TARGET_PAGE_SIZE) {
+        target_ulong page = addr + i;
+
+        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+        tlb_flush_vtlb_page_locked(env, midx, page);
+    }
+}
+
+typedef struct {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+/**
+ * tlb_flush_range_by_mmuidx_async_0:
+ * @cpu: cpu on which to flush
+ * @d: page aligned range of virtual addresses and set of mmu_idx to flush
+ *
+ * Helper for tlb_flush_range_by_mmuidx and friends, flush the pages of
+ * the range from the tlbs indicated by the idxmap from @cpu.
+ */
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range: " TARGET_FMT_lx "+" TARGET_FMT_lx " mmu_map:0x%x\n",
+              d.addr, d.len, d.idxmap);
+
+    qemu_spin_lock(&env_tlb(env)->c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if ((d.idxmap >> mmu_idx) & 1) {
+            tlb_flush_range_locked(env, mmu_idx, d.addr, d.len);
+        }
+    }
+    qemu_spin_unlock(&env_tlb(env)->c.lock);
+
+    tb_flush_jmp_cache_range(cpu, d.addr, d.len);
+}
+
+/**
+ * tlb_flush_range_by_mmuidx_async_1:
+ * @cpu: cpu on which to flush
+ * @data: allocated TLBFlushRangeData
+ *
+ * Helper for tlb_flush_range_by_mmuidx and friends, called through
+ * async_run_on_cpu.  Free the structure when done.
+ */
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+    g_free(d);
+}
+
+static inline bool tlb_range_in_one_page(target_ulong addr, target_ulong len)
+{
+    return len <= TARGET_PAGE_SIZE &&
+           ((addr ^ (addr + len - 1)) & TARGET_PAGE_MASK) == 0;
+}
+
+/* Round the range out to whole pages */
+static TLBFlushRangeData tlb_flush_range_data(target_ulong addr,
+                                              target_ulong len,
+                                              uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    d.addr = addr & TARGET_PAGE_MASK;
+    d.len = ROUND_UP(addr + len, TARGET_PAGE_SIZE) - d.addr;
+    d.idxmap = idxmap;
+    return d;
+}
+
+/* Queue @d on every CPU but @src_cpu, with one allocation per CPU */
+static void tlb_flush_range_others(CPUState *src_cpu, TLBFlushRangeData d)
+{
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    /* A single page is handled without allocating memory */
+    if (tlb_range_in_one_page(addr, len)) {
+        tlb_flush_page_by_mmuidx(cpu, addr, idxmap);
+        return;
+    }
+
+    d = tlb_flush_range_data(addr, len, idxmap);
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d);
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu,
+                                        target_ulong addr, target_ulong len,
+                                        uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    if (tlb_range_in_one_page(addr, len)) {
+        tlb_flush_page_by_mmuidx_all_cpus(src_cpu, addr, idxmap);
+        return;
+    }
+
+    d = tlb_flush_range_data(addr, len, idxmap);
+    tlb_flush_range_others(src_cpu, d);
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+}
+
+void tlb_flush_range_all_cpus(CPUState *src, target_ulong addr,
+                              target_ulong len)
+{
+    tlb_flush_range_by_mmuidx_all_cpus(src, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    if (tlb_range_in_one_page(addr, len)) {
+        tlb_flush_page_by_mmuidx_all_cpus_synced(src_cpu, addr, idxmap);
+        return;
+    }
+
+    d = tlb_flush_range_data(addr, len, idxmap);
+    tlb_flush_range_others(src_cpu, d);
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
+void tlb_flush_range_all_cpus_synced(CPUState *src, target_ulong addr,
+                                     target_ulong len)
+{
+    tlb_flush_range_by_mmuidx_all_cpus_synced(src, addr, len,
+                                              ALL_MMUIDX_BITS);
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -1148,9 +1352,11 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    CPUTLBCommon *c = &env_tlb(env)->c;
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
+    qatomic_set(&c->miss_count, c->miss_count + 1);
     for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
         CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
         target_ulong cmp;
@@ -1175,6 +1381,7 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
             CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+            qatomic_set(&c->victim_hit_count, c->victim_hit_count + 1);
             return true;
         }
     }
@@ -0,0 +1,282 @@
+/*
+ * perf(1) integration for translated code
+ *
+ * Without help perf only sees anonymous addresses in code_gen_buffer.
+ * Two formats are supported to map them back to guest code:
+ *
+ * - the perf map (/tmp/perf-$PID.map) is a text file with one
+ *   "start size name" line per range of host code;
+ *
+ * - the jitdump (./jit-$PID.dump) is a binary log of timestamped code
+ *   load records, including a copy of the code so that perf annotate
+ *   works.  The format is described in the Linux sources, in
+ *   tools/perf/Documentation/jitdump-specification.txt.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "elf.h"
+#include "perf.h"
+
+static QemuMutex perf_lock;
+static bool perf_lock_initialized;
+
+static FILE *perfmap;
+
+static FILE *jitdump;
+static void *jitdump_marker;
+static uint64_t jitdump_code_index;
+
+static const void *prologue_start;
+static size_t prologue_size;
+
+#define JITHEADER_MAGIC   0x4A695444
+#define JITHEADER_VERSION 1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+static void perf_lock_init(void)
+{
+    if (!perf_lock_initialized) {
+        qemu_mutex_init(&perf_lock);
+        perf_lock_initialized = true;
+    }
+}
+
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
+void perf_enable_perfmap(void)
+{
+    char *path = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        warn_report("Could not open %s: %s, proceeding without perf map",
+                    path, strerror(errno));
+    } else {
+        perf_lock_init();
+    }
+    g_free(path);
+}
+
+/* The clock used by "perf record -k 1" */
+static uint64_t perf_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The ELF machine of the host, i.e. of the code in code_gen_buffer */
+static uint32_t perf_elf_machine(void)
+{
+    uint8_t ehdr[EI_NIDENT + 4];
+    uint16_t machine;
+    ssize_t len;
+    int fd;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) {
+        return EM_NONE;
+    }
+    len = read(fd, ehdr, sizeof(ehdr));
+    close(fd);
+    if (len != sizeof(ehdr) || memcmp(ehdr, ELFMAG, SELFMAG)) {
+        return EM_NONE;
+    }
+    /* e_machine follows e_ident and e_type, in host byte order */
+    memcpy(&machine, ehdr + EI_NIDENT + 2, sizeof(machine));
+    return machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header = {
+        .magic = JITHEADER_MAGIC,
+        .version = JITHEADER_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = perf_elf_machine(),
+        .pid = getpid(),
+        .timestamp = perf_timestamp(),
+    };
+    char *path = g_strdup_printf("./jit-%d.dump", getpid());
+    int fd;
+
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    path, strerror(errno));
+        goto out;
+    }
+
+    /*
+     * perf record finds the dump through an executable mapping of it,
+     * which shows up as an MMAP event in the recording.
+     */
+    jitdump_marker = mmap(NULL, qemu_real_host_page_size,
+                          PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (jitdump_marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    path, strerror(errno));
+        jitdump_marker = NULL;
+        close(fd);
+        goto out;
+    }
+
+    jitdump = fdopen(fd, "w+");
+    if (!jitdump) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    path, strerror(errno));
+        munmap(jitdump_marker, qemu_real_host_page_size);
+        jitdump_marker = NULL;
+        close(fd);
+        goto out;
+    }
+    fwrite(&header, sizeof(header), 1, jitdump);
+    perf_lock_init();
+
+out:
+    g_free(path);
+}
+
+/* Called with perf_lock held */
+static void perf_write(const void *start, size_t size, const char *name)
+{
+    if (perfmap) {
+        fprintf(perfmap, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)start, size, name);
+    }
+    if (jitdump) {
+        struct jr_code_load load = {
+            .p.id = JIT_CODE_LOAD,
+            .p.total_size = sizeof(load) + strlen(name) + 1 + size,
+            .p.timestamp = perf_timestamp(),
+            .pid = getpid(),
+            .tid = qemu_get_thread_id(),
+            .vma = (uintptr_t)start,
+            .code_addr = (uintptr_t)start,
+            .code_size = size,
+            .code_index = jitdump_code_index++,
+        };
+
+        fwrite(&load, sizeof(load), 1, jitdump);
+        fwrite(name, strlen(name) + 1, 1, jitdump);
+        fwrite(start, size, 1, jitdump);
+    }
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (!perf_enabled()) {
+        return;
+    }
+
+    qemu_mutex_lock(&perf_lock);
+    prologue_start = start;
+    prologue_size = size;
+    perf_write(start, size, "tcg-prologue-buffer");
+    qemu_mutex_unlock(&perf_lock);
+}
+
+void perf_report_code(const void *start, size_t size, uint64_t guest_pc)
+{
+    char name[32];
+
+    if (!perf_enabled()) {
+        return;
+    }
+
+    snprintf(name, sizeof(name), "guest-0x%" PRIx64, guest_pc);
+    qemu_mutex_lock(&perf_lock);
+    perf_write(start, size, name);
+    qemu_mutex_unlock(&perf_lock);
+}
+
+void perf_report_flush(void)
+{
+    if (!perfmap) {
+        return;
+    }
+
+    /*
+     * The perf map has no way to retire a range, and perf would pick
+     * an arbitrary one of the symbols at a reused address.  Start over
+     * with only the prologue, which is never flushed.  The jitdump
+     * needs nothing: the new code load records are simply more recent.
+     */
+    qemu_mutex_lock(&perf_lock);
+    fflush(perfmap);
+    if (ftruncate(fileno(perfmap), 0) == 0) {
+        rewind(perfmap);
+        if (prologue_start) {
+            fprintf(perfmap, "%" PRIxPTR " %zx tcg-prologue-buffer\n",
+                    (uintptr_t)prologue_start, prologue_size);
+        }
+    }
+    qemu_mutex_unlock(&perf_lock);
+}
+
+void perf_exit(void)
+{
+    if (!perf_enabled()) {
+        return;
+    }
+
+    qemu_mutex_lock(&perf_lock);
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+    if (jitdump) {
+        struct jr_prefix rec = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(rec),
+            .timestamp = perf_timestamp(),
+        };
+
+        fwrite(&rec, sizeof(rec), 1, jitdump);
+        munmap(jitdump_marker, qemu_real_host_page_size);
+        jitdump_marker = NULL;
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+    qemu_mutex_unlock(&perf_lock);
+}
@@ -0,0 +1,63 @@
+/*
+ * perf(1) integration for translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef ACCEL_TCG_PERF_H
+#define ACCEL_TCG_PERF_H
+
+/*
+ * perf_enable_perfmap:
+ *
+ * Describe translated code in /tmp/perf-$PID.map, which perf reads
+ * without any additional step.  perf only keeps the last symbol
+ * registered for an address, so the map is rewritten on every tb_flush
+ * and describes the current contents of the translation buffer.
+ */
+void perf_enable_perfmap(void);
+
+/*
+ * perf_enable_jitdump:
+ *
+ * Describe translated code in ./jit-$PID.dump, to be merged with
+ * "perf inject --jit" into a recording made with "perf record -k 1".
+ * Records are timestamped, so code that is retranslated at the same
+ * host address after a tb_flush is attributed correctly.
+ */
+void perf_enable_jitdump(void);
+
+/* perf_enabled: true if either perf map or jitdump is being written */
+bool perf_enabled(void);
+
+/*
+ * perf_report_prologue:
+ * @start: start of the prologue and epilogue in the translation buffer
+ * @size: size of the prologue and epilogue
+ */
+void perf_report_prologue(const void *start, size_t size);
+
+/*
+ * perf_report_code:
+ * @start: start of the host code
+ * @size: size of the host code
+ * @guest_pc: guest address that the host code was translated from
+ *
+ * Called with the translation buffer region of @start owned by the
+ * caller; may be called concurrently by several vCPU threads.
+ */
+void perf_report_code(const void *start, size_t size, uint64_t guest_pc);
+
+/*
+ * perf_report_flush:
+ *
+ * Called when all translated code has been discarded, with all vCPUs
+ * stopped.
+ */
+void perf_report_flush(void);
+
+/* perf_exit: complete and close the files */
+void perf_exit(void);
+
+#endif
@@ -75,6 +75,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_INLINE_PER_VCPU,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -142,6 +143,37 @@ static void gen_empty_inline_cb(void)
     tcg_temp_free_i64(val);
 }
 
+/*
+ * Same as above, at an offset in the scoreboard slot of the vCPU.  The
+ * location of the slots is loaded from the scoreboard at run-time, as
+ * it changes when vCPUs are added in user mode.
+ */
+static void gen_empty_inline_per_vcpu_cb(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
+    TCGv_i32 element_size = tcg_const_i32(0); /* overwritten later */
+    TCGv_ptr slot_offset = tcg_temp_new_ptr();
+    TCGv_i64 val = tcg_temp_new_i64();
+    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_mul_i32(cpu_index, cpu_index, element_size);
+    tcg_gen_ext_i32_ptr(slot_offset, cpu_index);
+    tcg_gen_ld_ptr(ptr, ptr, offsetof(struct qemu_plugin_scoreboard, data));
+    tcg_gen_add_ptr(ptr, ptr, slot_offset);
+
+    /* the offset in the slot is added to the ld/st offsets later */
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_addi_i64(val, val, 0xdeadface);
+    tcg_gen_st_i64(val, ptr, 0);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(slot_offset);
+    tcg_temp_free_i32(element_size);
+    tcg_temp_free_i32(cpu_index);
+}
+
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
 {
     do_gen_mem_cb(addr, info);
@@ -198,6 +230,8 @@ static inline void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_INLINE_PER_VCPU,
+                    gen_empty_inline_per_vcpu_cb);
         break;
     default:
         g_assert_not_reached();
@@ -233,6 +267,9 @@ void plugin_gen_empty_mem_callback(TCGv addr, uint32_t info)
 
     fn.inline_fn = gen_empty_inline_cb;
     gen_mem_wrapped(PLUGIN_GEN_CB_INLINE, &fn, 0, info, false);
+
+    fn.inline_fn = gen_empty_inline_per_vcpu_cb;
+    gen_mem_wrapped(PLUGIN_GEN_CB_INLINE_PER_VCPU, &fn, 0, info, false);
 }
 
 static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
@@ -353,28 +390,70 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
+static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op, intptr_t offset)
 {
     if (TCG_TARGET_REG_BITS == 32) {
         /* 2x ld_i32 */
         op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->args[2] += offset;
         op = copy_op(begin_op, op, INDEX_op_ld_i32);
+        op->args[2] += offset;
     } else {
         /* ld_i64 */
         op = copy_op(begin_op, op, INDEX_op_ld_i64);
+        op->args[2] += offset;
     }
     return op;
 }
 
-static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
+static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op, intptr_t offset)
 {
     if (TCG_TARGET_REG_BITS == 32) {
         /* 2x st_i32 */
         op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[2] += offset;
         op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[2] += offset;
     } else {
         /* st_i64 */
         op = copy_op(begin_op, op, INDEX_op_st_i64);
+        op->args[2] += offset;
+    }
+    return op;
+}
+
+static TCGOp *copy_ext_i32_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* mov_i32 */
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        /* ext_i32_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_ld_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* ld_i32 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i32);
+    } else {
+        /* ld_i64 */
+        op = copy_op(begin_op, op, INDEX_op_ld_i64);
+    }
+    return op;
+}
+
+static TCGOp *copy_add_ptr(TCGOp **begin_op, TCGOp *op)
+{
+    if (UINTPTR_MAX == UINT32_MAX) {
+        /* add_i32 */
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        /* add_i64 */
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
     }
     return op;
 }
@@ -465,7 +544,7 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
     op = copy_const_ptr(&begin_op, op, cb->userp);
 
     /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    op = copy_ld_i64(&begin_op, op, 0);
 
     /* const_i64 */
     op = copy_const_i64(&begin_op, op, cb->inline_insn.imm);
@@ -474,7 +553,51 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
     op = copy_add_i64(&begin_op, op);
 
     /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+    op = copy_st_i64(&begin_op, op, 0);
+
+    return op;
+}
+
+static TCGOp *append_inline_per_vcpu_cb(const struct qemu_plugin_dyn_cb *cb,
+                                        TCGOp *begin_op, TCGOp *op,
+                                        int *unused)
+{
+    struct qemu_plugin_scoreboard *score = cb->userp;
+    intptr_t offset = cb->inline_insn.offset;
+
+    /* const_i32 == movi_i32 */
+    op = copy_op(&begin_op, op, INDEX_op_movi_i32);
+    op->args[1] = score->element_size;
+
+    /* const_ptr */
+    op = copy_const_ptr(&begin_op, op, score);
+
+    /* ld_i32 */
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+
+    /* mul_i32 */
+    op = copy_op(&begin_op, op, INDEX_op_mul_i32);
+
+    /* ext_i32_ptr */
+    op = copy_ext_i32_ptr(&begin_op, op);
+
+    /* ld_ptr */
+    op = copy_ld_ptr(&begin_op, op);
+
+    /* add_ptr */
+    op = copy_add_ptr(&begin_op, op);
+
+    /* ld_i64 */
+    op = copy_ld_i64(&begin_op, op, offset);
+
+    /* const_i64 */
+    op = copy_const_i64(&begin_op, op, cb->inline_insn.imm);
+
+    /* add_i64 */
+    op = copy_add_i64(&begin_op, op);
+
+    /* st_i64 */
+    op = copy_st_i64(&begin_op, op, offset);
 
     return op;
 }
@@ -571,6 +694,12 @@ inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
     inject_cb_type(cbs, begin_op, append_inline_cb, ok);
 }
 
+static void
+inject_inline_per_vcpu_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
+{
+    inject_cb_type(cbs, begin_op, append_inline_per_vcpu_cb, ok);
+}
+
 static void
 inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
 {
@@ -611,12 +740,13 @@ static void inject_mem_helper(TCGOp *begin_op, GArray *arr)
 static void inject_mem_enable_helper(struct qemu_plugin_insn *plugin_insn,
                                      TCGOp *begin_op)
 {
-    GArray *cbs[2];
+    GArray *cbs[3];
     GArray *arr;
     size_t n_cbs, i;
 
     cbs[0] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR];
     cbs[1] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE];
+    cbs[2] = plugin_insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE_PER_VCPU];
 
     n_cbs = 0;
     for (i = 0; i < ARRAY_SIZE(cbs); i++) {
@@ -678,6 +808,13 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_inline_per_vcpu(const struct qemu_plugin_tb *ptb,
+                                          TCGOp *begin_op)
+{
+    inject_inline_per_vcpu_cb(ptb->cbs[PLUGIN_CB_INLINE_PER_VCPU], begin_op,
+                              op_ok);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -694,6 +831,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_inline_per_vcpu(const struct qemu_plugin_tb *ptb,
+                                            TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+    inject_inline_per_vcpu_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE_PER_VCPU],
+                              begin_op, op_ok);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -711,6 +856,16 @@ static void plugin_gen_mem_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(cbs, begin_op, op_rw);
 }
 
+static void plugin_gen_mem_inline_per_vcpu(const struct qemu_plugin_tb *ptb,
+                                           TCGOp *begin_op, int insn_idx)
+{
+    const GArray *cbs;
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    cbs = insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE_PER_VCPU];
+    inject_inline_per_vcpu_cb(cbs, begin_op, op_rw);
+}
+
 static void plugin_gen_enable_mem_helper(const struct qemu_plugin_tb *ptb,
                                          TCGOp *begin_op, int insn_idx)
 {
@@ -740,6 +895,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_tb_inline(ptb, begin_op);
             return;
+        case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+            plugin_gen_tb_inline_per_vcpu(ptb, begin_op);
+            return;
         default:
             g_assert_not_reached();
         }
@@ -751,6 +909,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_insn_inline(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+            plugin_gen_insn_inline_per_vcpu(ptb, begin_op, insn_idx);
+            return;
         case PLUGIN_GEN_ENABLE_MEM_HELPER:
             plugin_gen_enable_mem_helper(ptb, begin_op, insn_idx);
             return;
@@ -765,6 +926,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_mem_inline(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+            plugin_gen_mem_inline_per_vcpu(ptb, begin_op, insn_idx);
+            return;
         default:
             g_assert_not_reached();
         }
@@ -816,6 +980,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_INLINE_PER_VCPU:
+                type = "inline per vcpu";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
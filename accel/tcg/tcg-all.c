@@ -26,19 +26,28 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "sysemu/tcg.h"
+#include "sysemu/sysemu.h"
 #include "sysemu/cpu-timers.h"
 #include "tcg/tcg.h"
+#include "exec/exec-all.h"
+#include "qemu/host-utils.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "hw/boards.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "tcg-cpus.h"
+#include "perf.h"
 
 struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
     unsigned long tb_size;
+    unsigned int jmp_cache_bits;
+    bool perfmap;
+    bool jitdump;
+    bool tb_exec_count;
+    bool tb_revive;
 };
 typedef struct TCGState TCGState;
 
@@ -94,14 +103,36 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->jmp_cache_bits = TB_JMP_CACHE_BITS;
 }
 
 bool mttcg_enabled;
 
+static void tcg_perf_exit(Notifier *n, void *data)
+{
+    perf_exit();
+}
+
+static Notifier tcg_perf_exit_notifier = {
+    .notify = tcg_perf_exit,
+};
+
 static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 
+    if (s->perfmap) {
+        perf_enable_perfmap();
+    }
+    if (s->jitdump) {
+        perf_enable_jitdump();
+    }
+    if (perf_enabled()) {
+        qemu_add_exit_notifier(&tcg_perf_exit_notifier);
+    }
+    tb_jmp_cache_bits = s->jmp_cache_bits;
+    tb_exec_count_enabled = s->tb_exec_count;
+    tb_revive_enabled = s->tb_revive;
     tcg_exec_init(s->tb_size * 1024 * 1024);
     mttcg_enabled = s->mttcg_enabled;
     cpus_register_accel(&tcg_cpus);
@@ -168,6 +199,95 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_jmp_cache_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = 1u << s->jmp_cache_bits;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_size(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    if (!is_power_of_2(value) ||
+        value < (1u << TB_JMP_CACHE_BITS_MIN) ||
+        value > (1u << TB_JMP_CACHE_BITS_MAX)) {
+        error_setg(errp, "jmp-cache-size must be a power of 2 between %u "
+                   "and %u", 1u << TB_JMP_CACHE_BITS_MIN,
+                   1u << TB_JMP_CACHE_BITS_MAX);
+        return;
+    }
+
+    s->jmp_cache_bits = ctz32(value);
+}
+
+static bool tcg_get_perfmap(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->perfmap;
+}
+
+static void tcg_set_perfmap(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->perfmap = value;
+}
+
+static bool tcg_get_jitdump(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->jitdump;
+}
+
+static void tcg_set_jitdump(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->jitdump = value;
+}
+
+static bool tcg_get_tb_exec_count(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_exec_count;
+}
+
+static void tcg_set_tb_exec_count(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_exec_count = value;
+}
+
+static bool tcg_get_tb_revive(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return s->tb_revive;
+}
+
+static void tcg_set_tb_revive(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    s->tb_revive = value;
+}
+
 static void tcg_accel_class_init(ObjectClass *oc, void *data)
 {
     AccelClass *ac = ACCEL_CLASS(oc);
@@ -185,6 +305,36 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "jmp-cache-size", "int",
+        tcg_get_jmp_cache_size, tcg_set_jmp_cache_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "jmp-cache-size",
+        "Number of sets of the per-vCPU TB jump cache");
+
+    object_class_property_add_bool(oc, "perfmap",
+                                   tcg_get_perfmap, tcg_set_perfmap);
+    object_class_property_set_description(oc, "perfmap",
+        "Write translated code ranges to /tmp/perf-<pid>.map");
+
+    object_class_property_add_bool(oc, "jitdump",
+                                   tcg_get_jitdump, tcg_set_jitdump);
+    object_class_property_set_description(oc, "jitdump",
+        "Write translated code to ./jit-<pid>.dump for perf inject");
+
+    object_class_property_add_bool(oc, "tb-exec-count",
+                                   tcg_get_tb_exec_count,
+                                   tcg_set_tb_exec_count);
+    object_class_property_set_description(oc, "tb-exec-count",
+        "Count translation block executions and list the hottest "
+        "in 'info jit'");
+
+    object_class_property_add_bool(oc, "tb-revive",
+                                   tcg_get_tb_revive,
+                                   tcg_set_tb_revive);
+    object_class_property_set_description(oc, "tb-revive",
+        "Reuse invalidated translation blocks whose guest code is "
+        "unchanged");
+
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -50,8 +50,11 @@
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#include "perf.h"
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
+#include "qemu/interval-tree.h"
+#include "qemu/rcu.h"
 #include "qemu/qemu-print.h"
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
@@ -110,8 +113,6 @@ typedef struct PageDesc {
        of lookups we do to a given page to use a bitmap */
     unsigned long *code_bitmap;
     unsigned int code_write_count;
-#else
-    unsigned long flags;
 #endif
 #ifndef CONFIG_USER_ONLY
     QemuSpin lock;
@@ -570,6 +571,129 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * The flags of guest pages are kept in an interval tree, with one node
+ * per run of pages that have the same flags; unmapped pages have no node.
+ * The flags of a node never change: updating a range replaces the nodes
+ * it covers.
+ *
+ * Updates are done with mmap_lock held.  Lookups can also be done within
+ * an RCU read-side critical section, but may then miss a node that a
+ * concurrent update is moving around (see qemu/interval-tree.h); when a
+ * lockless lookup finds no node, it has to be retried under mmap_lock.
+ */
+typedef struct PageFlagsNode {
+    struct rcu_head rcu;
+    IntervalTreeNode itree;
+    int flags;
+} PageFlagsNode;
+
+static IntervalTreeRoot pageflags_root;
+
+static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
+{
+    IntervalTreeNode *n;
+
+    n = interval_tree_iter_first(&pageflags_root, start, last);
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
+
+static void pageflags_create(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p = g_new(PageFlagsNode, 1);
+
+    p->itree.start = start;
+    p->itree.last = last;
+    p->flags = flags;
+    interval_tree_insert(&p->itree, &pageflags_root);
+}
+
+static void pageflags_destroy(PageFlagsNode *p)
+{
+    interval_tree_remove(&p->itree, &pageflags_root);
+    g_free_rcu(p, rcu);
+}
+
+/* Unmap [start, last], splitting the nodes that straddle its ends */
+static void pageflags_remove_range(target_ulong start, target_ulong last)
+{
+    PageFlagsNode *p;
+
+    while ((p = pageflags_find(start, last)) != NULL) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+        int p_flags = p->flags;
+
+        pageflags_destroy(p);
+        if (p_start < start) {
+            pageflags_create(p_start, start - 1, p_flags);
+        }
+        if (p_last > last) {
+            pageflags_create(last + 1, p_last, p_flags);
+        }
+    }
+}
+
+/*
+ * Map [start, last], which must be unmapped, with @flags; merge it with
+ * the nodes next to it if they have the same flags.
+ */
+static void pageflags_add_range(target_ulong start, target_ulong last,
+                                int flags)
+{
+    PageFlagsNode *p;
+
+    if (start != 0) {
+        p = pageflags_find(start - 1, start - 1);
+        if (p && p->flags == flags) {
+            start = p->itree.start;
+            pageflags_destroy(p);
+        }
+    }
+    if (last + 1 != 0) {
+        p = pageflags_find(last + 1, last + 1);
+        if (p && p->flags == flags) {
+            last = p->itree.last;
+            pageflags_destroy(p);
+        }
+    }
+    pageflags_create(start, last, flags);
+}
+
+/*
+ * Update the flags of the mapped pages in [start, last] to
+ * (flags & ~clear) | set, and return the union of their old flags.
+ */
+static int pageflags_set_clear(target_ulong start, target_ulong last,
+                               int set, int clear)
+{
+    PageFlagsNode *p;
+    int old_flags = 0;
+
+    assert_memory_lock();
+    while ((p = pageflags_find(start, last)) != NULL) {
+        target_ulong p_start = MAX(start, p->itree.start);
+        target_ulong p_last = MIN(last, p->itree.last);
+        int flags = p->flags;
+        int new_flags = (flags & ~clear) | set;
+
+        old_flags |= flags;
+        if (new_flags != flags) {
+            pageflags_remove_range(p_start, p_last);
+            if (new_flags) {
+                pageflags_add_range(p_start, p_last, new_flags);
+            }
+        }
+        if (p_last == last) {
+            break;
+        }
+        start = p_last + 1;
+    }
+    return old_flags;
+}
+#endif
+
 static void page_lock_pair(PageDesc **ret_p1, tb_page_addr_t phys1,
                            PageDesc **ret_p2, tb_page_addr_t phys2, int alloc);
 
@@ -1147,6 +1271,9 @@ static void tb_htable_init(void)
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    if (tb_revive_enabled) {
+        qht_init(&tb_ctx.dead_htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    }
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -1159,6 +1286,7 @@ void tcg_exec_init(unsigned long tb_size)
     page_init();
     tb_htable_init();
     code_gen_alloc(tb_size);
+    atexit(dump_exec_info_at_exit);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
        initialize the prologue now.  */
@@ -1166,13 +1294,29 @@ void tcg_exec_init(unsigned long tb_size)
 #endif
 }
 
-/* call with @p->lock held */
+/*
+ * Drop the code bitmap of @p because a TB was removed from the page.
+ * The write count is kept, so that the bitmap is rebuilt on the next
+ * write instead of going back to checking every write against the
+ * whole TB list.
+ *
+ * Call with @p->lock held.
+ */
 static inline void invalidate_page_bitmap(PageDesc *p)
 {
     assert_page_locked(p);
 #ifdef CONFIG_SOFTMMU
     g_free(p->code_bitmap);
     p->code_bitmap = NULL;
+#endif
+}
+
+/* Like invalidate_page_bitmap, for a page that holds no code anymore */
+static inline void reset_page_bitmap(PageDesc *p)
+{
+    assert_page_locked(p);
+#ifdef CONFIG_SOFTMMU
+    invalidate_page_bitmap(p);
     p->code_write_count = 0;
 #endif
 }
@@ -1191,7 +1335,7 @@ static void page_flush_tb_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
-            invalidate_page_bitmap(pd + i);
+            reset_page_bitmap(pd + i);
             page_unlock(&pd[i]);
         }
     } else {
@@ -1249,9 +1393,13 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     }
 
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
+    if (tb_revive_enabled) {
+        qht_reset(&tb_ctx.dead_htable);
+    }
     page_flush_tb();
 
     tcg_region_reset_all();
+    perf_report_flush();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     qatomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
@@ -1277,6 +1425,22 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+bool tb_exec_count_enabled;
+bool tb_revive_enabled;
+
+void tb_jmp_cache_init(CPUState *cpu)
+{
+    cpu->tb_jmp_cache_bits = tb_jmp_cache_bits;
+    cpu->tb_jmp_cache = g_new0(TBJmpCacheSet, 1u << tb_jmp_cache_bits);
+}
+
+void tb_jmp_cache_destroy(CPUState *cpu)
+{
+    g_free(cpu->tb_jmp_cache);
+    cpu->tb_jmp_cache = NULL;
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1424,6 +1588,37 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
+/*
+ * Keep the invalidated @tb in case its guest code is written back unchanged,
+ * or the write that invalidated it hit another part of the page.
+ */
+static void tb_revive_keep(TranslationBlock *tb, tb_page_addr_t phys_pc)
+{
+    void *existing_tb = NULL;
+    uint32_t h;
+
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb_cflags(tb) & CF_HASH_MASK,
+                     tb->trace_vcpu_dstate);
+    /* prefer the most recently invalidated TB for the same guest code */
+    if (!qht_insert(&tb_ctx.dead_htable, tb, h, &existing_tb) &&
+        existing_tb) {
+        qht_remove(&tb_ctx.dead_htable, existing_tb, h);
+        qht_insert(&tb_ctx.dead_htable, tb, h, NULL);
+    }
+}
+
+/*
+ * Forget the invalidated TBs kept for revival.  Must be called by those
+ * that invalidate TBs to have the guest code translated again, rather
+ * than because it was modified, e.g. to insert a breakpoint.
+ */
+void tb_revive_forget(void)
+{
+    if (tb_revive_enabled) {
+        qht_reset(&tb_ctx.dead_htable);
+    }
+}
+
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
@@ -1435,6 +1630,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     PageDesc *p;
     uint32_t h;
     tb_page_addr_t phys_pc;
+    int i;
 
     assert_memory_lock();
 
@@ -1465,10 +1661,15 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (qatomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            qatomic_set(&cpu->tb_jmp_cache[h], NULL);
+        TBJmpCacheSet *set;
+
+        h = tb_jmp_cache_hash_func(tb->pc, cpu->tb_jmp_cache_bits);
+        set = &cpu->tb_jmp_cache[h];
+        for (i = 0; i < TB_JMP_CACHE_WAYS; i++) {
+            if (qatomic_read(&set->tb[i]) == tb) {
+                qatomic_set(&set->tb[i], NULL);
+            }
         }
     }
 
@@ -1479,6 +1680,10 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
 
+    if (tb->guest_code) {
+        tb_revive_keep(tb, phys_pc);
+    }
+
     qatomic_set(&tcg_ctx->tb_phys_invalidate_count,
                tcg_ctx->tb_phys_invalidate_count + 1);
 }
@@ -1504,30 +1709,38 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 }
 
 #ifdef CONFIG_SOFTMMU
+/* Mark the bytes of @tb that are in @p, @n being the page index in @tb */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 /* call with @p->lock held */
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
     assert_page_locked(p);
     p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
 
     PAGE_FOR_EACH_TB(p, tb, n) {
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-             }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
     }
 }
 #endif
@@ -1552,28 +1765,27 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
     p->first_tb = (uintptr_t)tb | n;
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    /*
+     * Keep the bitmap up to date rather than dropping it, so that a
+     * guest that keeps generating code next to data it writes does not
+     * fall back to checking every write against the whole TB list.
+     */
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
-        target_ulong addr;
-        PageDesc *p2;
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
         int prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
         page_addr &= qemu_host_page_mask;
-        prot = 0;
-        for (addr = page_addr; addr < page_addr + qemu_host_page_size;
-            addr += TARGET_PAGE_SIZE) {
-
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
-            }
-            prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+        prot = pageflags_set_clear(page_addr,
+                                   page_addr + qemu_host_page_size - 1,
+                                   0, PAGE_WRITE);
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
         if (DEBUG_TB_INVALIDATE_GATE) {
@@ -1670,6 +1882,146 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+/*
+ * Describe the host code of @tb to perf, one range per guest instruction
+ * so that hot instructions show up and not only hot blocks.  The slow
+ * paths at the end of the block are attributed to the block itself.
+ */
+static void tb_perf_report(TranslationBlock *tb, size_t code_size)
+{
+    size_t chunk_start = 0;
+    int insn;
+
+    for (insn = 0; insn < tb->icount; insn++) {
+        size_t chunk_end = tcg_ctx->gen_insn_end_off[insn];
+
+        if (chunk_end > chunk_start) {
+            perf_report_code(tb->tc.ptr + chunk_start,
+                             chunk_end - chunk_start,
+                             tcg_ctx->gen_insn_data[insn][0]);
+            chunk_start = chunk_end;
+        }
+    }
+    if (chunk_start < code_size) {
+        perf_report_code(tb->tc.ptr + chunk_start, code_size - chunk_start,
+                         tb->pc);
+    }
+}
+
+/*
+ * Keep a copy of the guest code of @tb at @p, if the TB can be revived
+ * once invalidated.  Returns the number of bytes used at @p, or -1 if
+ * the code buffer is full.
+ */
+static int tb_keep_guest_code(CPUState *cpu, TranslationBlock *tb,
+                              void *host_pc, uint8_t *p)
+{
+    target_ulong last_page = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+
+    tb->guest_code = NULL;
+    /* plugins may want to instrument each translation */
+    if (!tb_revive_enabled || !host_pc || (tb->cflags & CF_NOCACHE) ||
+        (tb->pc & TARGET_PAGE_MASK) != last_page ||
+        test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return 0;
+    }
+    if (unlikely(p + tb->size > (uint8_t *)tcg_ctx->code_gen_highwater)) {
+        return -1;
+    }
+    memcpy(p, host_pc, tb->size);
+    tb->guest_code = p;
+    return tb->size;
+}
+
+struct tb_revive_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    tb_page_addr_t phys_page1;
+    uint32_t flags;
+    uint32_t cf_mask;
+    uint32_t trace_vcpu_dstate;
+};
+
+static bool tb_revive_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_revive_desc *desc = d;
+
+    return tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags &&
+        tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
+        (tb_cflags(tb) & CF_HASH_MASK) == desc->cf_mask;
+}
+
+/*
+ * Link again an invalidated TB for @pc whose guest code, at @host_pc,
+ * is unchanged.  Returns the TB to execute, or NULL if there is none.
+ *
+ * Called with mmap_lock held for user mode emulation.
+ */
+static TranslationBlock *tb_revive(CPUState *cpu, tb_page_addr_t phys_pc,
+                                   void *host_pc, target_ulong pc,
+                                   target_ulong cs_base, uint32_t flags,
+                                   uint32_t cflags)
+{
+    struct tb_revive_desc desc;
+    TranslationBlock *tb, *existing_tb;
+    uint32_t h;
+
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return NULL;
+    }
+
+    desc.pc = pc;
+    desc.cs_base = cs_base;
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    desc.flags = flags;
+    desc.cf_mask = cflags & CF_HASH_MASK;
+    desc.trace_vcpu_dstate = *cpu->trace_dstate;
+    h = tb_hash_func(phys_pc, pc, flags, desc.cf_mask,
+                     desc.trace_vcpu_dstate);
+    tb = qht_lookup_custom(&tb_ctx.dead_htable, &desc, h, tb_revive_cmp);
+    if (!tb || memcmp(tb->guest_code, host_pc, tb->size)) {
+        return NULL;
+    }
+    /* only one vCPU gets to revive it */
+    if (!qht_remove(&tb_ctx.dead_htable, tb, h)) {
+        return NULL;
+    }
+
+    /*
+     * No jump can be chained from @tb while the LSB of jmp_dest[] is set,
+     * so reset the outgoing jumps before clearing it.
+     */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    qatomic_set(&tb->jmp_dest[0], (uintptr_t)NULL);
+    qatomic_set(&tb->jmp_dest[1], (uintptr_t)NULL);
+
+    qemu_spin_lock(&tb->jmp_lock);
+    qatomic_set(&tb->cflags, cflags);
+    qemu_spin_unlock(&tb->jmp_lock);
+
+    existing_tb = tb_link_page(tb, phys_pc, -1);
+    if (unlikely(existing_tb != tb)) {
+        /* @pc was translated meanwhile, @tb is gone for good */
+        qemu_spin_lock(&tb->jmp_lock);
+        qatomic_set(&tb->cflags, cflags | CF_INVALID);
+        qemu_spin_unlock(&tb->jmp_lock);
+        return existing_tb;
+    }
+    qatomic_inc(&tb_ctx.revive_count);
+    return tb;
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -1680,7 +2032,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     tcg_insn_unit *gen_code_buf;
-    int gen_code_size, search_size, max_insns;
+    int gen_code_size, search_size, guest_code_size, max_insns;
+    int64_t gen_start = cpu_get_host_ticks();
+    void *host_pc;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
@@ -1688,7 +2042,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     assert_memory_lock();
 
-    phys_pc = get_page_addr_code(env, pc);
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
 
     if (phys_pc == -1) {
         /* Generate a temporary TB with 1 insn in it */
@@ -1699,6 +2053,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+    if (tb_revive_enabled && !(cflags & CF_NOCACHE)) {
+        tb = tb_revive(cpu, phys_pc, host_pc, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
+    }
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
@@ -1729,6 +2090,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1803,6 +2165,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (unlikely(search_size < 0)) {
         goto buffer_overflow;
     }
+    guest_code_size = tb_keep_guest_code(cpu, tb, host_pc,
+                                         (void *)gen_code_buf +
+                                         gen_code_size + search_size);
+    if (unlikely(guest_code_size < 0)) {
+        goto buffer_overflow;
+    }
     tb->tc.size = gen_code_size;
 
 #ifdef CONFIG_PROFILER
@@ -1878,8 +2246,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 #endif
 
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
-        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
-                 CODE_GEN_ALIGN));
+        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size +
+                 guest_code_size, CODE_GEN_ALIGN));
 
     /* init jump list */
     qemu_spin_init(&tb->jmp_lock);
@@ -1917,7 +2285,14 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tb_destroy(tb);
         return existing_tb;
     }
+    if (perf_enabled()) {
+        tb_perf_report(tb, tcg_ctx->data_gen_ptr ?
+                       tcg_ctx->data_gen_ptr - tb->tc.ptr : gen_code_size);
+    }
     tcg_tb_insert(tb);
+
+    qatomic_inc(&tb_ctx.gen_count);
+    stat64_add(&tb_ctx.gen_ticks, cpu_get_host_ticks() - gen_start);
     return tb;
 }
 
@@ -1997,7 +2372,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
-        invalidate_page_bitmap(p);
+        reset_page_bitmap(p);
         tlb_unprotect_code(start);
     }
 #endif
@@ -2093,6 +2468,7 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
     }
 
     assert_page_locked(p);
+    qatomic_inc(&tb_ctx.smc_write_count);
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
         build_page_bitmap(p);
@@ -2106,6 +2482,7 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
         if (b & ((1 << len) - 1)) {
             goto do_invalidate;
         }
+        qatomic_inc(&tb_ctx.smc_bitmap_skip_count);
     } else {
     do_invalidate:
         tb_invalidate_phys_page_range__locked(pages, p, start, start + len,
@@ -2278,10 +2655,13 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
-    unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    unsigned int bits = cpu->tb_jmp_cache_bits;
+    unsigned int i, j, i0 = tb_jmp_cache_hash_page(page_addr, bits);
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+    for (i = 0; i < tb_jmp_page_size(bits); i++) {
+        for (j = 0; j < TB_JMP_CACHE_WAYS; j++) {
+            qatomic_set(&cpu->tb_jmp_cache[i0 + i].tb[j], NULL);
+        }
     }
 }
 
@@ -2293,6 +2673,29 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
     tb_jmp_cache_clear_page(cpu, addr);
 }
 
+void tb_flush_jmp_cache_range(CPUState *cpu, target_ulong addr,
+                              target_ulong len)
+{
+    unsigned int bits = cpu->tb_jmp_cache_bits;
+    target_ulong i;
+
+    /*
+     * There are only that many groups of sets for pages, a range with
+     * at least as many pages covers all of them.
+     */
+    if (len >> TARGET_PAGE_BITS >= (1u << bits) / tb_jmp_page_size(bits)) {
+        cpu_tb_jmp_cache_clear(cpu);
+        return;
+    }
+
+    tb_jmp_cache_clear_page(cpu, addr - TARGET_PAGE_SIZE);
+    for (i = 0; i < len; i += TARGET_PAGE_SIZE) {
+        tb_jmp_cache_clear_page(cpu, addr + i);
+    }
+}
+
+#endif /* !CONFIG_USER_ONLY */
+
 static void print_qht_statistics(struct qht_stats hst)
 {
     uint32_t hgram_opts;
@@ -2363,11 +2766,90 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static double jmp_cache_percent(size_t n, size_t total)
+{
+    return total ? (double)n * 100 / total : 0;
+}
+
+static void print_jmp_cache_statistics(void)
+{
+    CPUState *cpu;
+
+    qemu_printf("\nJump cache:\n");
+    CPU_FOREACH(cpu) {
+        size_t hit0 = qatomic_read(&cpu->tb_jmp_cache_hits[0]);
+        size_t hit1 = qatomic_read(&cpu->tb_jmp_cache_hits[1]);
+        size_t miss = qatomic_read(&cpu->tb_jmp_cache_misses);
+        size_t total = hit0 + hit1 + miss;
+
+        qemu_printf("cpu %-15d %u sets, lookups %zu "
+                    "(way 0 %0.1f%%, way 1 %0.1f%%, miss %0.1f%%)\n",
+                    cpu->cpu_index, 1u << cpu->tb_jmp_cache_bits, total,
+                    jmp_cache_percent(hit0, total),
+                    jmp_cache_percent(hit1, total),
+                    jmp_cache_percent(miss, total));
+    }
+}
+
+#define HOT_TB_COUNT 16
+
+static gboolean tb_hot_iter(gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+static gint tb_hot_cmp(gconstpointer a, gconstpointer b)
+{
+    const TranslationBlock *ta = *(const TranslationBlock **)a;
+    const TranslationBlock *tb = *(const TranslationBlock **)b;
+    uint64_t ca = ta->exec_count;
+    uint64_t cb = tb->exec_count;
+
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* List the most executed TBs, see the tb-exec-count accelerator property */
+static void print_hot_tbs(void)
+{
+    GPtrArray *tbs = g_ptr_array_new();
+    uint64_t total = 0;
+    guint i;
+
+    tcg_tb_foreach(tb_hot_iter, tbs);
+    for (i = 0; i < tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+        total += tb->exec_count;
+    }
+    g_ptr_array_sort(tbs, tb_hot_cmp);
+
+    qemu_printf("\nHottest TBs (%" PRIu64 " executions):\n", total);
+    for (i = 0; i < MIN(tbs->len, HOT_TB_COUNT); i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+        uint64_t count = tb->exec_count;
+
+        if (!count) {
+            break;
+        }
+        qemu_printf("pc " TARGET_FMT_lx " %" PRIu64 " (%0.1f%%) "
+                    "%u insns, %zu host bytes, %s\n",
+                    tb->pc, count, (double)count * 100 / total,
+                    tb->icount, tb->tc.size,
+                    tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID
+                    ? "direct jump" : "indirect jump");
+    }
+    g_ptr_array_free(tbs, true);
+}
+
 void dump_exec_info(void)
 {
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
-    size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t nb_tbs, gen_count;
+    size_t smc_writes, smc_skips;
+#ifdef CONFIG_SOFTMMU
+    size_t flush_full, flush_part, flush_elide, tlb_miss, tlb_victim;
+#endif
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2399,19 +2881,57 @@ void dump_exec_info(void)
     print_qht_statistics(hst);
     qht_statistics_destroy(&hst);
 
+    print_jmp_cache_statistics();
+    if (tb_exec_count_enabled) {
+        print_hot_tbs();
+    }
+
     qemu_printf("\nStatistics:\n");
+    gen_count = qatomic_read(&tb_ctx.gen_count);
+    qemu_printf("TB gen count        %zu (avg %" PRIu64 " host ticks/TB)\n",
+                gen_count,
+                gen_count ? stat64_get(&tb_ctx.gen_ticks) / gen_count : 0);
     qemu_printf("TB flush count      %u\n",
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
+    if (tb_revive_enabled) {
+        qemu_printf("TB revive count     %zu\n",
+                    qatomic_read(&tb_ctx.revive_count));
+    }
+    smc_writes = qatomic_read(&tb_ctx.smc_write_count);
+    smc_skips = qatomic_read(&tb_ctx.smc_bitmap_skip_count);
+    qemu_printf("SMC write count     %zu (bitmap skipped %zu%%)\n",
+                smc_writes, smc_writes ? smc_skips * 100 / smc_writes : 0);
 
+#ifdef CONFIG_SOFTMMU
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    tlb_miss_counts(&tlb_miss, &tlb_victim);
+    qemu_printf("TLB misses          %zu (victim TLB hits %zu%%)\n",
+                tlb_miss, tlb_miss ? tlb_victim * 100 / tlb_miss : 0);
+#endif
     tcg_dump_info();
 }
 
+/*
+ * With "-d jit", print the statistics when QEMU exits.  linux-user leaves
+ * with _exit() and calls this from preexit_cleanup(); everything else
+ * gets here from atexit().
+ */
+void dump_exec_info_at_exit(void)
+{
+    static bool dumped;
+
+    if (qemu_loglevel_mask(LOG_JIT_STATS) && !qatomic_xchg(&dumped, true)) {
+        dump_exec_info();
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+
 void dump_opcount_info(void)
 {
     tcg_dump_op_count();
@@ -2430,88 +2950,39 @@ void cpu_interrupt(CPUState *cpu, int mask)
  * Walks guest process memory "regions" one by one
  * and calls callback function 'fn' for each region.
  */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    target_ulong start;
-    int prot;
-};
-
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   target_ulong end, int new_prot)
-{
-    if (data->start != -1u) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
-    }
-
-    data->start = (new_prot ? end : -1u);
-    data->prot = new_prot;
-
-    return 0;
-}
-
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 target_ulong base, int level, void **lp)
+int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
 {
-    target_ulong pa;
-    int i, rc;
-
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
-    }
+    IntervalTreeNode *n;
+    target_ulong start = 0, last = 0;
+    int prot = 0;
+    int rc = 0;
 
-    if (level == 0) {
-        PageDesc *pd = *lp;
-
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            int prot = pd[i].flags;
+    mmap_lock();
+    for (n = interval_tree_iter_first(&pageflags_root, 0, -1);
+         n != NULL;
+         n = interval_tree_iter_next(n, 0, -1)) {
+        PageFlagsNode *p = container_of(n, PageFlagsNode, itree);
 
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
+        if (prot && p->flags == prot && n->start == last + 1) {
+            last = n->last;
+            continue;
         }
-    } else {
-        void **pp = *lp;
-
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            pa = base | ((target_ulong)i <<
-                (TARGET_PAGE_BITS + V_L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
+        if (prot) {
+            rc = fn(priv, start, last + 1, prot);
             if (rc != 0) {
-                return rc;
+                goto out;
             }
         }
+        start = n->start;
+        last = n->last;
+        prot = p->flags;
     }
-
-    return 0;
-}
-
-int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
-{
-    struct walk_memory_regions_data data;
-    uintptr_t i, l1_sz = v_l1_size;
-
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1u;
-    data.prot = 0;
-
-    for (i = 0; i < l1_sz; i++) {
-        target_ulong base = i << (v_l1_shift + TARGET_PAGE_BITS);
-        int rc = walk_memory_regions_1(&data, base, v_l2_levels, l1_map + i);
-        if (rc != 0) {
-            return rc;
-        }
+    if (prot) {
+        rc = fn(priv, start, last + 1, prot);
     }
-
-    return walk_memory_regions_end(&data, 0, 0);
+ out:
+    mmap_unlock();
+    return rc;
 }
 
 static int dump_region(void *priv, target_ulong start,
@@ -2540,13 +3011,62 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageDesc *p;
+    PageFlagsNode *p;
+    int flags;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
+    WITH_RCU_READ_LOCK_GUARD() {
+        p = pageflags_find(address, address);
+        if (p) {
+            return p->flags;
+        }
+    }
+    if (have_mmap_lock()) {
         return 0;
     }
-    return p->flags;
+
+    /* the lockless lookup may have missed the page: retry under the lock */
+    mmap_lock();
+    p = pageflags_find(address, address);
+    flags = p ? p->flags : 0;
+    mmap_unlock();
+    return flags;
+}
+
+/*
+ * Invalidate the code in the pages of [start, last] that are not
+ * writable yet, mapped or not.
+ */
+static void page_invalidate_unwritable(target_ulong start, target_ulong last)
+{
+    while (true) {
+        PageFlagsNode *p = pageflags_find(start, last);
+        target_ulong addr, ro_last;
+
+        if (p && p->itree.start <= start) {
+            ro_last = MIN(last, p->itree.last);
+            if (p->flags & PAGE_WRITE) {
+                goto next;
+            }
+        } else {
+            ro_last = p ? p->itree.start - 1 : last;
+        }
+
+        for (addr = start; ; addr += TARGET_PAGE_SIZE) {
+            PageDesc *pd = page_find(addr >> TARGET_PAGE_BITS);
+
+            if (pd && pd->first_tb) {
+                tb_invalidate_phys_page(addr, 0);
+            }
+            if (ro_last - addr < TARGET_PAGE_SIZE) {
+                break;
+            }
+        }
+    next:
+        if (ro_last == last) {
+            break;
+        }
+        start = ro_last + 1;
+    }
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -2554,7 +3074,7 @@ int page_get_flags(target_ulong address)
    on PAGE_WRITE.  The mmap_lock should already be held.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    target_ulong last;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2565,32 +3085,27 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
 
     start = start & TARGET_PAGE_MASK;
     end = TARGET_PAGE_ALIGN(end);
+    last = end - 1;
 
     if (flags & PAGE_WRITE) {
         flags |= PAGE_WRITE_ORG;
-    }
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
 
         /* If the write protection bit is set, then we invalidate
            the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0);
-        }
-        p->flags = flags;
+        page_invalidate_unwritable(start, last);
+    }
+
+    pageflags_remove_range(start, last);
+    if (flags) {
+        pageflags_add_range(start, last, flags);
     }
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    target_ulong last;
+    bool had_lock, locked;
+    int ret = -1;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2602,43 +3117,69 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     if (len == 0) {
         return 0;
     }
-    if (start + len - 1 < start) {
+    last = start + len - 1;
+    if (last < start) {
         /* We've wrapped around.  */
         return -1;
     }
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
+    had_lock = locked = have_mmap_lock();
+    rcu_read_lock();
+    while (true) {
+        PageFlagsNode *p = pageflags_find(start, last);
+        target_ulong p_last;
+        int p_flags;
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
-        }
-        if (!(p->flags & PAGE_VALID)) {
-            return -1;
+        if (p == NULL || p->itree.start > start) {
+            if (!locked) {
+                /* the lockless lookup may have missed the page */
+                mmap_lock();
+                locked = true;
+                continue;
+            }
+            break;
         }
+        p_flags = p->flags;
+        p_last = p->itree.last;
 
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
-            return -1;
+        if (!(p_flags & PAGE_VALID)) {
+            break;
+        }
+        if ((flags & PAGE_READ) && !(p_flags & PAGE_READ)) {
+            break;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
-                return -1;
+            if (!(p_flags & PAGE_WRITE_ORG)) {
+                break;
             }
-            /* unprotect the page if it was put read-only because it
-               contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0)) {
-                    return -1;
+            /* unprotect the pages that were put read-only because they
+               contain translated code */
+            if (!(p_flags & PAGE_WRITE)) {
+                target_ulong addr, ro_last = MIN(last, p_last);
+
+                for (addr = start & TARGET_PAGE_MASK; ;
+                     addr += TARGET_PAGE_SIZE) {
+                    if (!page_unprotect(addr, 0)) {
+                        goto out;
+                    }
+                    if (ro_last - addr < TARGET_PAGE_SIZE) {
+                        break;
+                    }
                 }
             }
         }
+        if (p_last >= last) {
+            ret = 0;
+            break;
+        }
+        start = p_last + 1;
     }
-    return 0;
+ out:
+    rcu_read_unlock();
+    if (locked && !had_lock) {
+        mmap_unlock();
+    }
+    return ret;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
@@ -2649,17 +3190,17 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
  */
 int page_unprotect(target_ulong address, uintptr_t pc)
 {
-    unsigned int prot;
     bool current_tb_invalidated;
-    PageDesc *p;
-    target_ulong host_start, host_end, addr;
+    PageFlagsNode *p;
+    target_ulong host_start, offset;
+    int prot;
 
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
     mmap_lock();
 
-    p = page_find(address >> TARGET_PAGE_BITS);
+    p = pageflags_find(address, address);
     if (!p) {
         mmap_unlock();
         return 0;
@@ -2682,22 +3223,20 @@ int page_unprotect(target_ulong address, uintptr_t pc)
 #endif
         } else {
             host_start = address & qemu_host_page_mask;
-            host_end = host_start + qemu_host_page_size;
 
-            prot = 0;
-            for (addr = host_start; addr < host_end; addr += TARGET_PAGE_SIZE) {
-                p = page_find(addr >> TARGET_PAGE_BITS);
-                p->flags |= PAGE_WRITE;
-                prot |= p->flags;
+            prot = pageflags_set_clear(host_start,
+                                       host_start + qemu_host_page_size - 1,
+                                       PAGE_WRITE, 0) | PAGE_WRITE;
+            for (offset = 0; offset < qemu_host_page_size;
+                 offset += TARGET_PAGE_SIZE) {
+                target_ulong addr = host_start + offset;
 
                 /* and since the content will be modified, we must invalidate
                    the corresponding translated code. */
                 current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
-#ifdef CONFIG_USER_ONLY
                 if (DEBUG_TB_CHECK_GATE) {
                     tb_invalidate_check(addr);
                 }
-#endif
             }
             mprotect((void *)g2h(host_start), qemu_host_page_size,
                      prot & PAGE_BITS);
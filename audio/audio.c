@@ -31,6 +31,7 @@
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qapi-visit-audio.h"
 #include "qemu/cutils.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
@@ -848,6 +849,25 @@ static void audio_timer (void *opaque)
     audio_reset_timer(s);
 }
 
+static void audio_run_bh(void *opaque)
+{
+    AudioState *s = opaque;
+
+    audio_run(s, "callback");
+    audio_reset_timer(s);
+}
+
+/*
+ * For backends that are driven by callbacks from their own threads: voices
+ * in poll mode are not served by the timer, so the callbacks ask for a run
+ * of the main loop side whenever the host device has taken or produced
+ * audio.
+ */
+void audio_run_async(AudioState *s)
+{
+    qemu_bh_schedule(s->run_bh);
+}
+
 /*
  * Public API
  */
@@ -1642,6 +1662,11 @@ static void free_audio_state(AudioState *s)
         s->ts = NULL;
     }
 
+    if (s->run_bh) {
+        qemu_bh_delete(s->run_bh);
+        s->run_bh = NULL;
+    }
+
     g_free(s);
 }
 
@@ -1750,6 +1775,7 @@ static AudioState *audio_init(Audiodev *dev, const char *name)
     QTAILQ_INSERT_TAIL(&audio_states, s, list);
 
     s->ts = timer_new_ns(QEMU_CLOCK_VIRTUAL, audio_timer, s);
+    s->run_bh = qemu_bh_new(audio_run_bh, s);
 
     s->nb_hw_voices_out = audio_get_pdo_out(dev)->voices;
     s->nb_hw_voices_in = audio_get_pdo_in(dev)->voices;
@@ -25,7 +25,7 @@
 #ifndef QEMU_AUDIO_INT_H
 #define QEMU_AUDIO_INT_H
 
-#ifdef CONFIG_AUDIO_COREAUDIO
+#if defined(CONFIG_AUDIO_COREAUDIO) || defined(CONFIG_FLOAT_MIXENG)
 #define FLOAT_MIXENG
 /* #define RECIPROCAL */
 #endif
@@ -211,6 +211,7 @@ typedef struct AudioState {
     void *drv_opaque;
 
     QEMUTimer *ts;
+    QEMUBH *run_bh;
     QLIST_HEAD (card_listhead, QEMUSoundCard) card_head;
     QLIST_HEAD (hw_in_listhead, HWVoiceIn) hw_head_in;
     QLIST_HEAD (hw_out_listhead, HWVoiceOut) hw_head_out;
@@ -240,6 +241,7 @@ int audio_bug (const char *funcname, int cond);
 void *audio_calloc (const char *funcname, int nmemb, size_t size);
 
 void audio_run(AudioState *s, const char *msg);
+void audio_run_async(AudioState *s);
 
 typedef struct RateCtl {
     int64_t start_ticks;
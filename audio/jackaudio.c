@@ -65,6 +65,7 @@ typedef struct QJackClient {
     jack_nframes_t  freq;
 
     struct QJack   *j;
+    AudioState     *s;
     int             nchannels;
     int             buffersize;
     jack_port_t   **port;
@@ -88,6 +89,12 @@ static int qjack_client_init(QJackClient *c);
 static void qjack_client_connect_ports(QJackClient *c);
 static void qjack_client_fini(QJackClient *c);
 
+/* Voices are run from qjack_process() while the client is up */
+static int qjack_poll_mode(QJackClient *c)
+{
+    return c->enabled && c->state == QJACK_STATE_RUNNING && c->opt->try_poll;
+}
+
 static void qjack_buffer_create(QJackBuffer *buffer, int channels, int frames)
 {
     buffer->channels = channels;
@@ -284,6 +291,11 @@ static int qjack_process(jack_nframes_t nframes, void *arg)
         }
     }
 
+    /* refill or drain the fifo for the next period */
+    if (likely(c->enabled) && c->opt->try_poll) {
+        audio_run_async(c->s);
+    }
+
     return 0;
 }
 
@@ -310,6 +322,11 @@ static void qjack_shutdown(void *arg)
 {
     QJackClient *c = (QJackClient *)arg;
     c->state = QJACK_STATE_SHUTDOWN;
+
+    /* let qjack_write/qjack_read hand the voice back to the timer */
+    if (c->enabled && c->opt->try_poll) {
+        audio_run_async(c->s);
+    }
 }
 
 static void qjack_client_recover(QJackClient *c)
@@ -336,9 +353,11 @@ static size_t qjack_write(HWVoiceOut *hw, void *buf, size_t len)
     ++jo->c.packets;
 
     if (jo->c.state != QJACK_STATE_RUNNING) {
+        hw->poll_mode = 0;
         qjack_client_recover(&jo->c);
         return len;
     }
+    hw->poll_mode = qjack_poll_mode(&jo->c);
 
     qjack_client_connect_ports(&jo->c);
     return qjack_buffer_write(&jo->c.fifo, buf, len);
@@ -350,9 +369,11 @@ static size_t qjack_read(HWVoiceIn *hw, void *buf, size_t len)
     ++ji->c.packets;
 
     if (ji->c.state != QJACK_STATE_RUNNING) {
+        hw->poll_mode = 0;
         qjack_client_recover(&ji->c);
         return len;
     }
+    hw->poll_mode = qjack_poll_mode(&ji->c);
 
     qjack_client_connect_ports(&ji->c);
     return qjack_buffer_read(&ji->c.fifo, buf, len);
@@ -493,6 +514,7 @@ static int qjack_init_out(HWVoiceOut *hw, struct audsettings *as,
 
     jo->c.out       = true;
     jo->c.enabled   = false;
+    jo->c.s         = hw->s;
     jo->c.nchannels = as->nchannels;
     jo->c.opt       = dev->u.jack.out;
 
@@ -529,6 +551,7 @@ static int qjack_init_in(HWVoiceIn *hw, struct audsettings *as,
 
     ji->c.out       = false;
     ji->c.enabled   = false;
+    ji->c.s         = hw->s;
     ji->c.nchannels = as->nchannels;
     ji->c.opt       = dev->u.jack.in;
 
@@ -592,12 +615,14 @@ static void qjack_enable_out(HWVoiceOut *hw, bool enable)
 {
     QJackOut *jo = (QJackOut *)hw;
     jo->c.enabled = enable;
+    hw->poll_mode = qjack_poll_mode(&jo->c);
 }
 
 static void qjack_enable_in(HWVoiceIn *hw, bool enable)
 {
     QJackIn *ji = (QJackIn *)hw;
     ji->c.enabled = enable;
+    hw->poll_mode = qjack_poll_mode(&ji->c);
 }
 
 static int qjack_thread_creator(jack_native_thread_t *thread,
@@ -614,9 +639,19 @@ static int qjack_thread_creator(jack_native_thread_t *thread,
     return ret;
 }
 
+static void qjack_init_per_direction(AudiodevJackPerDirectionOptions *opdo)
+{
+    if (!opdo->has_try_poll) {
+        opdo->try_poll = true;
+        opdo->has_try_poll = true;
+    }
+}
+
 static void *qjack_init(Audiodev *dev)
 {
     assert(dev->driver == AUDIODEV_DRIVER_JACK);
+    qjack_init_per_direction(dev->u.jack.in);
+    qjack_init_per_direction(dev->u.jack.out);
     return dev;
 }
 
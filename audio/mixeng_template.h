@@ -54,19 +54,25 @@ static inline mixeng_real glue (conv_, ET) (IN_T v)
 #endif
 }
 
+/*
+ * The clip functions are written with selects rather than early returns,
+ * so that the loops below calling them can be vectorized.  Out of range
+ * values are zeroed before scaling so that the float to integer
+ * conversion stays defined for them.
+ */
 static inline IN_T glue (clip_, ET) (mixeng_real v)
 {
-    if (v >= 1.f) {
-        return IN_MAX;
-    } else if (v < -1.f) {
-        return IN_MIN;
-    }
+    mixeng_real c = (v >= 1.f || v < -1.f) ? 0.f : v;
+    IN_T r;
 
 #ifdef SIGNED
-    return ENDIAN_CONVERT((IN_T)(v * (((mixeng_real)IN_MAX - IN_MIN) / 2.f)));
+    r = (IN_T)(c * (((mixeng_real)IN_MAX - IN_MIN) / 2.f));
 #else
-    return ENDIAN_CONVERT((IN_T)((v * ((mixeng_real)IN_MAX / 2.f)) + HALF));
+    r = (IN_T)((c * ((mixeng_real)IN_MAX / 2.f)) + HALF);
 #endif
+    r = v >= 1.f ? IN_MAX : r;
+    r = v < -1.f ? IN_MIN : r;
+    return ENDIAN_CONVERT(r);
 }
 
 #else  /* !FLOAT_MIXENG */
@@ -83,67 +89,66 @@ static inline int64_t glue (conv_, ET) (IN_T v)
 
 static inline IN_T glue (clip_, ET) (int64_t v)
 {
-    if (v >= 0x7fffffffLL) {
-        return IN_MAX;
-    } else if (v < -2147483648LL) {
-        return IN_MIN;
-    }
+    int64_t r;
 
 #ifdef SIGNED
-    return ENDIAN_CONVERT ((IN_T) (v >> (32 - SHIFT)));
+    r = v >> (32 - SHIFT);
 #else
-    return ENDIAN_CONVERT ((IN_T) ((v >> (32 - SHIFT)) + HALF));
+    r = (v >> (32 - SHIFT)) + HALF;
 #endif
+    r = v >= 0x7fffffffLL ? IN_MAX : r;
+    r = v < -2147483648LL ? IN_MIN : r;
+    return ENDIAN_CONVERT ((IN_T) r);
 }
 #endif
 
+/*
+ * struct st_sample is a pair of scalars, so a stereo buffer is handled as
+ * a flat array of 2 * samples interleaved values.
+ */
 static void glue (glue (conv_, ET), _to_stereo)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
+    typeof(dst->l) *out = &dst->l;
+    const IN_T *in = src;
+    int i;
 
-    while (samples--) {
-        out->l = glue (conv_, ET) (*in++);
-        out->r = glue (conv_, ET) (*in++);
-        out += 1;
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = glue (conv_, ET) (in[i]);
     }
 }
 
 static void glue (glue (conv_, ET), _to_mono)
     (struct st_sample *dst, const void *src, int samples)
 {
-    struct st_sample *out = dst;
-    IN_T *in = (IN_T *) src;
-
-    while (samples--) {
-        out->l = glue (conv_, ET) (in[0]);
-        out->r = out->l;
-        out += 1;
-        in += 1;
+    const IN_T *in = src;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        dst[i].l = dst[i].r = glue (conv_, ET) (in[i]);
     }
 }
 
 static void glue (glue (clip_, ET), _from_stereo)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l);
-        *out++ = glue (clip_, ET) (in->r);
-        in += 1;
+    const typeof(src->l) *in = &src->l;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples * 2; i++) {
+        out[i] = glue (clip_, ET) (in[i]);
     }
 }
 
 static void glue (glue (clip_, ET), _from_mono)
     (void *dst, const struct st_sample *src, int samples)
 {
-    const struct st_sample *in = src;
-    IN_T *out = (IN_T *) dst;
-    while (samples--) {
-        *out++ = glue (clip_, ET) (in->l + in->r);
-        in += 1;
+    IN_T *out = dst;
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        out[i] = glue (clip_, ET) (src[i].l + src[i].r);
     }
 }
 
@@ -1,6 +1,7 @@
 /* public domain */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
 #include "qemu/module.h"
 #include "qemu-common.h"
 #include "audio.h"
@@ -354,6 +355,28 @@ static void stream_state_cb (pa_stream *s, void * userdata)
     }
 }
 
+/*
+ * The stream asks for more playback data or has captured some: in poll
+ * mode the voice is run from here rather than from the audio timer.
+ */
+static void stream_write_cb(pa_stream *s, size_t length, void *userdata)
+{
+    HWVoiceOut *hw = userdata;
+
+    if (qatomic_read(&hw->poll_mode)) {
+        audio_run_async(hw->s);
+    }
+}
+
+static void stream_read_cb(pa_stream *s, size_t length, void *userdata)
+{
+    HWVoiceIn *hw = userdata;
+
+    if (qatomic_read(&hw->poll_mode)) {
+        audio_run_async(hw->s);
+    }
+}
+
 static pa_stream *qpa_simple_new (
         PAConnection *c,
         const char *name,
@@ -494,6 +517,10 @@ static int qpa_init_out(HWVoiceOut *hw, struct audsettings *as,
         goto fail1;
     }
 
+    pa_threaded_mainloop_lock(c->mainloop);
+    pa_stream_set_write_callback(pa->stream, stream_write_cb, hw);
+    pa_threaded_mainloop_unlock(c->mainloop);
+
     audio_pcm_init_info (&hw->info, &obt_as);
     hw->samples = audio_buffer_samples(
         qapi_AudiodevPaPerDirectionOptions_base(ppdo),
@@ -542,6 +569,10 @@ static int qpa_init_in(HWVoiceIn *hw, struct audsettings *as, void *drv_opaque)
         goto fail1;
     }
 
+    pa_threaded_mainloop_lock(c->mainloop);
+    pa_stream_set_read_callback(pa->stream, stream_read_cb, hw);
+    pa_threaded_mainloop_unlock(c->mainloop);
+
     audio_pcm_init_info (&hw->info, &obt_as);
     hw->samples = audio_buffer_samples(
         qapi_AudiodevPaPerDirectionOptions_base(ppdo),
@@ -608,6 +639,27 @@ static void qpa_fini_in (HWVoiceIn *hw)
     }
 }
 
+static void qpa_enable_out(HWVoiceOut *hw, bool enable)
+{
+    PAVoiceOut *pa = (PAVoiceOut *) hw;
+
+    qatomic_set(&hw->poll_mode, enable && pa->g->dev->u.pa.out->try_poll);
+    if (hw->poll_mode) {
+        /* the stream may have asked for data while the voice was off */
+        audio_run_async(hw->s);
+    }
+}
+
+static void qpa_enable_in(HWVoiceIn *hw, bool enable)
+{
+    PAVoiceIn *pa = (PAVoiceIn *) hw;
+
+    qatomic_set(&hw->poll_mode, enable && pa->g->dev->u.pa.in->try_poll);
+    if (hw->poll_mode) {
+        audio_run_async(hw->s);
+    }
+}
+
 static void qpa_volume_out(HWVoiceOut *hw, Volume *vol)
 {
     PAVoiceOut *pa = (PAVoiceOut *) hw;
@@ -703,6 +755,10 @@ static int qpa_validate_per_direction_opts(Audiodev *dev,
         pdo->has_latency = true;
         pdo->latency = 15000;
     }
+    if (!pdo->has_try_poll) {
+        pdo->has_try_poll = true;
+        pdo->try_poll = true;
+    }
     return 1;
 }
 
@@ -863,13 +919,15 @@ static struct audio_pcm_ops qpa_pcm_ops = {
     .get_buffer_out = qpa_get_buffer_out,
     .put_buffer_out = qpa_write, /* pa handles it */
     .volume_out = qpa_volume_out,
+    .enable_out = qpa_enable_out,
 
     .init_in  = qpa_init_in,
     .fini_in  = qpa_fini_in,
     .read     = qpa_read,
     .get_buffer_in = qpa_get_buffer_in,
     .put_buffer_in = qpa_put_buffer_in,
-    .volume_in = qpa_volume_in
+    .volume_in = qpa_volume_in,
+    .enable_in = qpa_enable_in
 };
 
 static struct audio_driver pa_audio_driver = {
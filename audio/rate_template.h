@@ -50,9 +50,12 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
 
     if (rate->opos_inc == (1ULL + UINT_MAX)) {
         int i, n = *isamp > *osamp ? *osamp : *isamp;
-        for (i = 0; i < n; i++) {
-            OP (obuf[i].l, ibuf[i].l);
-            OP (obuf[i].r, ibuf[i].r);
+        typeof(obuf->l) *o = &obuf->l;
+        const typeof(ibuf->l) *in = &ibuf->l;
+
+        /* Both channels in one flat loop, so that it can be vectorized */
+        for (i = 0; i < n * 2; i++) {
+            OP (o[i], in[i]);
         }
         *isamp = n;
         *osamp = n;
@@ -92,8 +95,8 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
 #else
         t = (rate->opos & UINT_MAX) / (mixeng_real) UINT_MAX;
 #endif
-        out.l = (ilast.l * (1.0 - t)) + icur.l * t;
-        out.r = (ilast.r * (1.0 - t)) + icur.r * t;
+        out.l = (ilast.l * (1.f - t)) + icur.l * t;
+        out.r = (ilast.r * (1.f - t)) + icur.r * t;
 #else
         t = rate->opos & 0xffffffff;
         out.l = (ilast.l * ((int64_t) UINT_MAX - t) + icur.l * t) >> 32;
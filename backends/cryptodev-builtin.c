@@ -26,6 +26,7 @@
 #include "qapi/error.h"
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
+#include "qemu/lockable.h"
 #include "qom/object.h"
 
 
@@ -39,6 +40,8 @@ OBJECT_DECLARE_SIMPLE_TYPE(CryptoDevBackendBuiltin, CRYPTODEV_BACKEND_BUILTIN)
 
 
 typedef struct CryptoDevBackendBuiltinSession {
+    /* Serializes the queues that use the session at the same time */
+    QemuMutex lock;
     QCryptoCipher *cipher;
     uint8_t direction; /* encryption or decryption */
     uint8_t type; /* cipher? hash? aead? */
@@ -60,22 +63,25 @@ struct CryptoDevBackendBuiltin {
 static void cryptodev_builtin_init(
              CryptoDevBackend *backend, Error **errp)
 {
-    /* Only support one queue */
     int queues = backend->conf.peers.queues;
     CryptoDevBackendClient *cc;
+    size_t i;
 
-    if (queues != 1) {
+    if (queues > MAX_CRYPTO_QUEUE_NUM) {
         error_setg(errp,
-                  "Only support one queue in cryptdov-builtin backend");
+                  "the maximum number of queues is %d",
+                  MAX_CRYPTO_QUEUE_NUM);
         return;
     }
 
-    cc = cryptodev_backend_new_client(
-              "cryptodev-builtin", NULL);
-    cc->info_str = g_strdup_printf("cryptodev-builtin0");
-    cc->queue_index = 0;
-    cc->type = CRYPTODEV_BACKEND_TYPE_BUILTIN;
-    backend->conf.peers.ccs[0] = cc;
+    for (i = 0; i < queues; i++) {
+        cc = cryptodev_backend_new_client(
+                  "cryptodev-builtin", NULL);
+        cc->info_str = g_strdup_printf("cryptodev-builtin%zu", i);
+        cc->queue_index = i;
+        cc->type = CRYPTODEV_BACKEND_TYPE_BUILTIN;
+        backend->conf.peers.ccs[i] = cc;
+    }
 
     backend->conf.crypto_services =
                          1u << VIRTIO_CRYPTO_SERVICE_CIPHER |
@@ -231,6 +237,7 @@ static int cryptodev_builtin_create_cipher_session(
     }
 
     sess = g_new0(CryptoDevBackendBuiltinSession, 1);
+    qemu_mutex_init(&sess->lock);
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
@@ -282,15 +289,16 @@ static int cryptodev_builtin_sym_close_session(
     assert(session_id < MAX_NUM_SESSIONS && builtin->sessions[session_id]);
 
     qcrypto_cipher_free(builtin->sessions[session_id]->cipher);
+    qemu_mutex_destroy(&builtin->sessions[session_id]->lock);
     g_free(builtin->sessions[session_id]);
     builtin->sessions[session_id] = NULL;
     return 0;
 }
 
-static int cryptodev_builtin_sym_operation(
+static int cryptodev_builtin_sym_run(
                  CryptoDevBackend *backend,
                  CryptoDevBackendSymOpInfo *op_info,
-                 uint32_t queue_index, Error **errp)
+                 Error **errp)
 {
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
@@ -312,6 +320,9 @@ static int cryptodev_builtin_sym_operation(
 
     sess = builtin->sessions[op_info->session_id];
 
+    /* The IV is state of the cipher object until the operation is done */
+    QEMU_LOCK_GUARD(&sess->lock);
+
     if (op_info->iv_len > 0) {
         ret = qcrypto_cipher_setiv(sess->cipher, op_info->iv,
                                    op_info->iv_len, errp);
@@ -336,6 +347,25 @@ static int cryptodev_builtin_sym_operation(
     return VIRTIO_CRYPTO_OK;
 }
 
+/* The builtin backend finishes each operation before returning */
+static int cryptodev_builtin_sym_operation(
+                 CryptoDevBackend *backend,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *opaque,
+                 Error **errp)
+{
+    int ret;
+
+    ret = cryptodev_builtin_sym_run(backend, op_info, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    cb(opaque, ret);
+    return 0;
+}
+
 static void cryptodev_builtin_cleanup(
              CryptoDevBackend *backend,
              Error **errp)
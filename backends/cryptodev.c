@@ -105,13 +105,16 @@ int cryptodev_backend_sym_close_session(
 static int cryptodev_backend_sym_operation(
                  CryptoDevBackend *backend,
                  CryptoDevBackendSymOpInfo *op_info,
-                 uint32_t queue_index, Error **errp)
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *cb_opaque,
+                 Error **errp)
 {
     CryptoDevBackendClass *bc =
                       CRYPTODEV_BACKEND_GET_CLASS(backend);
 
     if (bc->do_sym_op) {
-        return bc->do_sym_op(backend, op_info, queue_index, errp);
+        return bc->do_sym_op(backend, op_info, queue_index,
+                             cb, cb_opaque, errp);
     }
 
     return -VIRTIO_CRYPTO_ERR;
@@ -120,7 +123,9 @@ static int cryptodev_backend_sym_operation(
 int cryptodev_backend_crypto_operation(
                  CryptoDevBackend *backend,
                  void *opaque,
-                 uint32_t queue_index, Error **errp)
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *cb_opaque,
+                 Error **errp)
 {
     VirtIOCryptoReq *req = opaque;
 
@@ -129,7 +134,7 @@ int cryptodev_backend_crypto_operation(
         op_info = req->u.sym_op_info;
 
         return cryptodev_backend_sym_operation(backend,
-                         op_info, queue_index, errp);
+                         op_info, queue_index, cb, cb_opaque, errp);
     } else {
         error_setg(errp, "Unsupported cryptodev alg type: %" PRIu32 "",
                    req->flags);
@@ -214,6 +214,29 @@ static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
     return backend->prealloc;
 }
 
+/* Host nodes whose CPUs should touch the backend's memory */
+static const unsigned long *
+host_memory_backend_prealloc_nodes(HostMemoryBackend *backend)
+{
+    if (backend->policy == HOST_MEM_POLICY_DEFAULT ||
+        bitmap_empty(backend->host_nodes, MAX_NODES)) {
+        return NULL;
+    }
+    return backend->host_nodes;
+}
+
+void host_memory_backend_prealloc_range(HostMemoryBackend *backend,
+                                        uint64_t offset, uint64_t size,
+                                        Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+
+    os_mem_prealloc(fd, ptr + offset, size, backend->prealloc_threads,
+                    host_memory_backend_prealloc_nodes(backend),
+                    MAX_NODES, false, errp);
+}
+
 static void host_memory_backend_set_prealloc(Object *obj, bool value,
                                              Error **errp)
 {
@@ -230,7 +253,9 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, &local_err);
+        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads,
+                        host_memory_backend_prealloc_nodes(backend),
+                        MAX_NODES, false, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -387,11 +412,15 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 #endif
         /* Preallocate memory after the NUMA policy has been instantiated.
          * This is necessary to guarantee memory is allocated with
-         * specified NUMA policy in place.
+         * specified NUMA policy in place.  Backends created before the
+         * machine are populated in the background until the board is
+         * initialized, see os_mem_prealloc_finish().
          */
         if (backend->prealloc) {
             os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            backend->prealloc_threads, &local_err);
+                            backend->prealloc_threads,
+                            host_memory_backend_prealloc_nodes(backend),
+                            MAX_NODES, true, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -1453,6 +1453,7 @@ static int bdrv_open_driver(BlockDriverState *bs, BlockDriver *drv,
         error_propagate(errp, local_err);
         return -EINVAL;
     }
+    trace_bdrv_open_driver(bs, bs->node_name, drv->format_name);
 
     bs->drv = drv;
     bs->read_only = !(bs->open_flags & BDRV_O_RDWR);
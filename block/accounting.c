@@ -32,12 +32,46 @@
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
 static const int qtest_latency_ns = NANOSECONDS_PER_SECOND / 1000;
 
+/* 1-2-5 steps from 10 us to 5 s, in ns */
+static const uint64_t block_latency_histogram_default[] = {
+    10000, 20000, 50000,
+    100000, 200000, 500000,
+    1000000, 2000000, 5000000,
+    10000000, 20000000, 50000000,
+    100000000, 200000000, 500000000,
+    1000000000, 2000000000, 5000000000,
+};
+
+static void block_latency_histogram_init(BlockLatencyHistogram *hist,
+                                         const uint64_t *boundaries,
+                                         int nboundaries)
+{
+    g_free(hist->boundaries);
+    g_free(hist->bins);
+
+    hist->nbins = nboundaries + 1;
+    hist->boundaries = g_memdup(boundaries, nboundaries * sizeof(*boundaries));
+    hist->bins = g_new0(Stat64, hist->nbins);
+}
+
 void block_acct_init(BlockAcctStats *stats)
 {
+    enum BlockAcctType types[] = {
+        BLOCK_ACCT_READ, BLOCK_ACCT_WRITE, BLOCK_ACCT_FLUSH
+    };
+    int i;
+
     qemu_mutex_init(&stats->lock);
     if (qtest_enabled()) {
         clock_type = QEMU_CLOCK_VIRTUAL;
     }
+
+    /* Accounting a request is cheap enough to keep these on all the time */
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        block_latency_histogram_init(&stats->latency_histogram[types[i]],
+                                     block_latency_histogram_default,
+                                     ARRAY_SIZE(block_latency_histogram_default));
+    }
 }
 
 void block_acct_setup(BlockAcctStats *stats, bool account_invalid,
@@ -53,6 +87,7 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    block_latency_histograms_clear(stats);
     qemu_mutex_destroy(&stats->lock);
 }
 
@@ -94,48 +129,31 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->type = type;
 }
 
-/* block_latency_histogram_compare_func:
- * Compare @key with interval [@it[0], @it[1]).
- * Return: -1 if @key < @it[0]
- *          0 if @key in [@it[0], @it[1])
- *         +1 if @key >= @it[1]
- */
-static int block_latency_histogram_compare_func(const void *key, const void *it)
-{
-    uint64_t k = *(uint64_t *)key;
-    uint64_t a = ((uint64_t *)it)[0];
-    uint64_t b = ((uint64_t *)it)[1];
-
-    return k < a ? -1 : (k < b ? 0 : 1);
-}
-
 static void block_latency_histogram_account(BlockLatencyHistogram *hist,
                                             int64_t latency_ns)
 {
-    uint64_t *pos;
+    uint64_t latency = MAX(latency_ns, 0);
+    int lo, hi;
 
     if (hist->bins == NULL) {
         /* histogram disabled */
         return;
     }
 
+    /* Find the first boundary above @latency; its index is the bin's */
+    lo = 0;
+    hi = hist->nbins - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
 
-    if (latency_ns < hist->boundaries[0]) {
-        hist->bins[0]++;
-        return;
-    }
-
-    if (latency_ns >= hist->boundaries[hist->nbins - 2]) {
-        hist->bins[hist->nbins - 1]++;
-        return;
+        if (latency < hist->boundaries[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
     }
 
-    pos = bsearch(&latency_ns, hist->boundaries, hist->nbins - 2,
-                  sizeof(hist->boundaries[0]),
-                  block_latency_histogram_compare_func);
-    assert(pos != NULL);
-
-    hist->bins[pos - hist->boundaries + 1]++;
+    stat64_add(&hist->bins[lo], 1);
 }
 
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
@@ -165,7 +183,7 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
     }
 
     g_free(hist->bins);
-    hist->bins = g_new0(uint64_t, hist->nbins);
+    hist->bins = g_new0(Stat64, hist->nbins);
 
     return 0;
 }
@@ -199,29 +217,30 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         return;
     }
 
-    qemu_mutex_lock(&stats->lock);
-
     if (failed) {
-        stats->failed_ops[cookie->type]++;
+        stat64_add(&stats->failed_ops[cookie->type], 1);
     } else {
-        stats->nr_bytes[cookie->type] += cookie->bytes;
-        stats->nr_ops[cookie->type]++;
+        stat64_add(&stats->nr_bytes[cookie->type], cookie->bytes);
+        stat64_add(&stats->nr_ops[cookie->type], 1);
     }
 
     block_latency_histogram_account(&stats->latency_histogram[cookie->type],
                                     latency_ns);
 
     if (!failed || stats->account_failed) {
-        stats->total_time_ns[cookie->type] += latency_ns;
-        stats->last_access_time_ns = time_ns;
-
-        QSLIST_FOREACH(s, &stats->intervals, entries) {
-            timed_average_account(&s->latency[cookie->type], latency_ns);
+        stat64_add(&stats->total_time_ns[cookie->type], latency_ns);
+        stat64_max(&stats->last_access_time_ns, time_ns);
+
+        /* Intervals are only added while setting up the device */
+        if (!QSLIST_EMPTY(&stats->intervals)) {
+            qemu_mutex_lock(&stats->lock);
+            QSLIST_FOREACH(s, &stats->intervals, entries) {
+                timed_average_account(&s->latency[cookie->type], latency_ns);
+            }
+            qemu_mutex_unlock(&stats->lock);
         }
     }
 
-    qemu_mutex_unlock(&stats->lock);
-
     cookie->type = BLOCK_ACCT_NONE;
 }
 
@@ -243,13 +262,11 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
      * not.  The reason is that invalid requests are accounted during their
      * submission, therefore there's no actual I/O involved.
      */
-    qemu_mutex_lock(&stats->lock);
-    stats->invalid_ops[type]++;
+    stat64_add(&stats->invalid_ops[type], 1);
 
     if (stats->account_invalid) {
-        stats->last_access_time_ns = qemu_clock_get_ns(clock_type);
+        stat64_max(&stats->last_access_time_ns, qemu_clock_get_ns(clock_type));
     }
-    qemu_mutex_unlock(&stats->lock);
 }
 
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
@@ -257,14 +274,13 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 {
     assert(type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-    stats->merged[type] += num_requests;
-    qemu_mutex_unlock(&stats->lock);
+    stat64_add(&stats->merged[type], num_requests);
 }
 
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
-    return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
+    return qemu_clock_get_ns(clock_type) -
+           stat64_get(&stats->last_access_time_ns);
 }
 
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
@@ -189,17 +189,32 @@ static int coroutine_fn backup_loop(BackupBlockJob *job)
 
     bdbi = bdrv_dirty_iter_new(block_copy_dirty_bitmap(job->bcs));
     while ((offset = bdrv_dirty_iter_next(bdbi)) != -1) {
+        /*
+         * Without a speed limit, hand block-copy a window large enough to
+         * keep all of its workers busy; it skips clean areas by itself.
+         * With a limit, keep the granularity of the rate limiting fine.
+         */
+        int64_t bytes = job->common.speed ? job->cluster_size :
+                        block_copy_preferred_bytes(job->bcs);
+
+        bytes = QEMU_ALIGN_UP(MIN(bytes, (int64_t)job->len - offset),
+                              job->cluster_size);
         do {
             if (yield_and_check(job)) {
                 goto out;
             }
-            ret = backup_do_cow(job, offset, job->cluster_size, &error_is_read);
+            ret = backup_do_cow(job, offset, bytes, &error_is_read);
             if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
                            BLOCK_ERROR_ACTION_REPORT)
             {
                 goto out;
             }
         } while (ret < 0);
+
+        if (offset + bytes >= job->len) {
+            break;
+        }
+        bdrv_set_dirty_iter(bdbi, offset + bytes);
     }
 
  out:
@@ -337,6 +352,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                   const char *filter_node_name,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
+                  const BackupPerf *perf,
                   int creation_flags,
                   BlockCompletionFunc *cb, void *opaque,
                   JobTxn *txn, Error **errp)
@@ -347,6 +363,8 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     BdrvRequestFlags write_flags;
     BlockDriverState *backup_top = NULL;
     BlockCopyState *bcs = NULL;
+    int max_workers = BLOCK_COPY_MAX_WORKERS;
+    int64_t max_chunk = 0;
 
     assert(bs);
     assert(target);
@@ -423,6 +441,26 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         goto error;
     }
 
+    if (perf && perf->has_max_workers) {
+        if (perf->max_workers < 1 ||
+            perf->max_workers > BLOCK_COPY_MAX_WORKERS) {
+            error_setg(errp, "max-workers must be between 1 and %d",
+                       BLOCK_COPY_MAX_WORKERS);
+            goto error;
+        }
+        max_workers = perf->max_workers;
+    }
+
+    if (perf && perf->has_max_chunk) {
+        if (perf->max_chunk < 0 ||
+            (perf->max_chunk && perf->max_chunk < cluster_size)) {
+            error_setg(errp, "max-chunk must be 0 or at least the job cluster "
+                       "size (%" PRIi64 ")", cluster_size);
+            goto error;
+        }
+        max_chunk = perf->max_chunk;
+    }
+
     /*
      * If source is in backing chain of target assume that target is going to be
      * used for "image fleecing", i.e. it should represent a kind of snapshot of
@@ -467,6 +505,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
 
     block_copy_set_progress_callback(bcs, backup_progress_bytes_callback, job);
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
+    block_copy_set_perf(bcs, max_workers, max_chunk);
 
     /* Required permissions are already taken by backup-top target */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
@@ -1210,6 +1210,7 @@ blk_do_preadv(BlockBackend *blk, int64_t offset, unsigned int bytes,
 
     ret = bdrv_co_preadv(blk->root, offset, bytes, qiov, flags);
     bdrv_dec_in_flight(bs);
+    trace_blk_co_preadv_done(blk, offset, ret);
     return ret;
 }
 
@@ -1260,6 +1261,7 @@ blk_do_pwritev_part(BlockBackend *blk, int64_t offset, unsigned int bytes,
     ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
                                flags);
     bdrv_dec_in_flight(bs);
+    trace_blk_co_pwritev_done(blk, offset, ret);
     return ret;
 }
 
@@ -2416,6 +2418,25 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+/*
+ * Like blk_co_copy_range(), for users like block jobs whose source is a
+ * child of their own filter node rather than a BlockBackend.
+ */
+int coroutine_fn blk_co_copy_range_from_child(BdrvChild *src, int64_t off_in,
+                                              BlockBackend *blk_out,
+                                              int64_t off_out, int bytes,
+                                              BdrvRequestFlags read_flags,
+                                              BdrvRequestFlags write_flags)
+{
+    int r;
+    r = blk_check_byte_request(blk_out, off_out, bytes);
+    if (r) {
+        return r;
+    }
+    return bdrv_co_copy_range(src, off_in, blk_out->root, off_out,
+                              bytes, read_flags, write_flags);
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
@@ -20,12 +20,22 @@
 #include "sysemu/block-backend.h"
 #include "qemu/units.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #include "block/aio_task.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
+#define BLOCK_COPY_MAX_CHUNK (16 * MiB)
+#define BLOCK_COPY_MAX_ZEROES (1 * GiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
-#define BLOCK_COPY_MAX_WORKERS 64
+#define BLOCK_COPY_INITIAL_WORKERS 16
+
+/* Parameters of block_copy_tune() */
+#define BLOCK_COPY_TUNE_INTERVAL_NS (100 * SCALE_MS)
+#define BLOCK_COPY_TUNE_HOLD_WINDOWS 10
+#define BLOCK_COPY_LATENCY_LOW_NS (10 * SCALE_MS)
+#define BLOCK_COPY_LATENCY_HIGH_NS (100 * SCALE_MS)
 
 static coroutine_fn int block_copy_task_entry(AioTask *task);
 
@@ -42,6 +52,7 @@ typedef struct BlockCopyTask {
     int64_t offset;
     int64_t bytes;
     bool zeroes;
+    int64_t start_ns;
     QLIST_ENTRY(BlockCopyTask) list;
     CoQueue wait_queue; /* coroutines blocked on this task */
 } BlockCopyTask;
@@ -91,6 +102,22 @@ typedef struct BlockCopyState {
     void *progress_opaque;
 
     SharedResource *mem;
+
+    /*
+     * Adaptive request sizing and parallelism, see block_copy_tune().
+     * copy_size is the current request size; it is only tuned for buffered
+     * copying without compression.
+     */
+    int max_workers;
+    int64_t max_chunk;          /* 0 for no limit but BLOCK_COPY_MAX_CHUNK */
+    int workers;
+    int workers_step;           /* direction of the search: 1, -1 or 0 */
+    int hold_windows;           /* windows to wait before probing again */
+    int64_t window_start_ns;
+    int64_t window_bytes;
+    int64_t window_latency_ns;  /* sum of the latency of window_tasks */
+    int window_tasks;
+    uint64_t prev_throughput;   /* bytes per second in the previous window */
 } BlockCopyState;
 
 static BlockCopyTask *find_conflicting_task(BlockCopyState *s,
@@ -217,6 +244,20 @@ static uint32_t block_copy_max_transfer(BdrvChild *source, BdrvChild *target)
                                      target->bs->bl.max_transfer));
 }
 
+static int64_t block_copy_chunk_limit(BlockCopyState *s)
+{
+    int64_t limit = MIN_NON_ZERO(s->max_chunk, BLOCK_COPY_MAX_CHUNK);
+
+    return MAX(QEMU_ALIGN_DOWN(limit, s->cluster_size), s->cluster_size);
+}
+
+/* Request size for buffered copying before any tuning */
+static int64_t block_copy_buffer_size(BlockCopyState *s)
+{
+    return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
+               block_copy_chunk_limit(s));
+}
+
 BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
                                      int64_t cluster_size,
                                      BdrvRequestFlags write_flags, Error **errp)
@@ -240,6 +281,9 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = write_flags,
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
+        .max_workers = BLOCK_COPY_MAX_WORKERS,
+        .workers = BLOCK_COPY_INITIAL_WORKERS,
+        .workers_step = 1,
     };
 
     if (block_copy_max_transfer(source, target) < cluster_size) {
@@ -261,7 +305,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
          * successful copy_range (look at block_copy_do_copy).
          */
         s->use_copy_range = true;
-        s->copy_size = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+        s->copy_size = block_copy_buffer_size(s);
     }
 
     QLIST_INIT(&s->tasks);
@@ -269,6 +313,26 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     return s;
 }
 
+void block_copy_set_perf(BlockCopyState *s, int max_workers, int64_t max_chunk)
+{
+    assert(max_workers >= 1 && max_workers <= BLOCK_COPY_MAX_WORKERS);
+    assert(max_chunk == 0 || max_chunk >= s->cluster_size);
+
+    s->max_workers = max_workers;
+    s->workers = MIN(s->workers, max_workers);
+    s->max_chunk = max_chunk;
+    s->copy_size = MIN(s->copy_size, block_copy_chunk_limit(s));
+}
+
+/*
+ * Number of bytes worth handing to a single block_copy() call so that all
+ * of its workers are kept busy.
+ */
+int64_t block_copy_preferred_bytes(BlockCopyState *s)
+{
+    return s->workers * s->copy_size;
+}
+
 void block_copy_set_progress_callback(
         BlockCopyState *s,
         ProgressBytesCallbackFunc progress_bytes_callback,
@@ -304,7 +368,9 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
 
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
-        co_put_to_shres(task->s->mem, task->bytes);
+        if (!task->zeroes) {
+            co_put_to_shres(task->s->mem, task->bytes);
+        }
         block_copy_task_end(task, -ECANCELED);
         g_free(task);
         return -ECANCELED;
@@ -357,7 +423,7 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
         if (ret < 0) {
             trace_block_copy_copy_range_fail(s, offset, ret);
             s->use_copy_range = false;
-            s->copy_size = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+            s->copy_size = block_copy_buffer_size(s);
             /* Fallback to read+write with allocated buffer */
         } else {
             if (s->use_copy_range) {
@@ -375,6 +441,7 @@ static int coroutine_fn block_copy_do_copy(BlockCopyState *s,
                             QEMU_ALIGN_DOWN(block_copy_max_transfer(s->source,
                                                                     s->target),
                                             s->cluster_size));
+                s->copy_size = MIN(s->copy_size, block_copy_chunk_limit(s));
             }
             goto out;
         }
@@ -412,12 +479,92 @@ out:
     return ret;
 }
 
+/*
+ * block_copy_tune
+ *
+ * Account a completed data request and, once per measurement window,
+ * adjust the number of workers and the request size:
+ *
+ * - The worker count does a hill climb on throughput.  It keeps moving in
+ *   the same direction while throughput improves by more than 5%, turns
+ *   around when it drops by as much, and holds still in between.  After a
+ *   while it probes upwards again, in case the target got faster.
+ *
+ * - Requests that complete within BLOCK_COPY_LATENCY_LOW_NS are dominated
+ *   by per-request overhead (think NBD round trips), so their size is
+ *   doubled.  Above BLOCK_COPY_LATENCY_HIGH_NS they are halved, so that we
+ *   don't flood the target and guest writes waiting for them don't stall.
+ */
+static void block_copy_tune(BlockCopyState *s, int64_t bytes,
+                            int64_t latency_ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->window_start_ns;
+    uint64_t throughput, margin = s->prev_throughput / 20;
+    int64_t avg_latency_ns;
+
+    s->window_bytes += bytes;
+    s->window_latency_ns += latency_ns;
+    s->window_tasks++;
+
+    if (!s->window_start_ns) {
+        /* First completion, start measuring from here */
+        s->window_start_ns = now;
+        s->window_bytes = s->window_latency_ns = s->window_tasks = 0;
+        return;
+    }
+    if (elapsed < BLOCK_COPY_TUNE_INTERVAL_NS ||
+        s->window_tasks < s->workers) {
+        return;
+    }
+
+    throughput = muldiv64(s->window_bytes, NANOSECONDS_PER_SECOND, elapsed);
+    avg_latency_ns = s->window_latency_ns / s->window_tasks;
+
+    if (!s->prev_throughput || throughput > s->prev_throughput + margin) {
+        if (!s->workers_step) {
+            s->workers_step = 1;
+        }
+    } else if (throughput + margin < s->prev_throughput) {
+        s->workers_step = s->workers_step ? -s->workers_step : -1;
+    } else if (s->workers_step) {
+        s->workers_step = 0;
+        s->hold_windows = BLOCK_COPY_TUNE_HOLD_WINDOWS;
+    } else if (--s->hold_windows <= 0) {
+        s->workers_step = 1;
+    }
+
+    if (s->workers_step > 0) {
+        s->workers = MIN(s->workers * 2, s->max_workers);
+    } else if (s->workers_step < 0) {
+        s->workers = MAX(s->workers / 2, 1);
+    }
+
+    if (!s->use_copy_range && !(s->write_flags & BDRV_REQ_WRITE_COMPRESSED)) {
+        if (avg_latency_ns < BLOCK_COPY_LATENCY_LOW_NS) {
+            s->copy_size = MIN(s->copy_size * 2, block_copy_chunk_limit(s));
+        } else if (avg_latency_ns > BLOCK_COPY_LATENCY_HIGH_NS) {
+            s->copy_size = MAX(QEMU_ALIGN_DOWN(s->copy_size / 2,
+                                               s->cluster_size),
+                               s->cluster_size);
+        }
+    }
+
+    trace_block_copy_tune(s, throughput, avg_latency_ns, s->workers,
+                          s->copy_size);
+
+    s->prev_throughput = throughput;
+    s->window_start_ns = now;
+    s->window_bytes = s->window_latency_ns = s->window_tasks = 0;
+}
+
 static coroutine_fn int block_copy_task_entry(AioTask *task)
 {
     BlockCopyTask *t = container_of(task, BlockCopyTask, task);
     bool error_is_read = false;
     int ret;
 
+    t->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = block_copy_do_copy(t->s, t->offset, t->bytes, t->zeroes,
                              &error_is_read);
     if (ret < 0 && !t->call_state->failed) {
@@ -427,7 +574,15 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
         progress_work_done(t->s->progress, t->bytes);
         t->s->progress_bytes_callback(t->bytes, t->s->progress_opaque);
     }
-    co_put_to_shres(t->s->mem, t->bytes);
+    if (!t->zeroes) {
+        /* Zero writes are cheap and would skew the measurement */
+        if (ret >= 0) {
+            block_copy_tune(t->s, t->bytes,
+                            qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                            t->start_ns);
+        }
+        co_put_to_shres(t->s->mem, t->bytes);
+    }
     block_copy_task_end(t, ret);
 
     return ret;
@@ -537,6 +692,48 @@ int64_t block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/*
+ * block_copy_task_extend_zeroes
+ *
+ * Grow a task that writes zeroes over the directly following dirty clusters
+ * that read as zeroes as well, so that a sparse area takes one request
+ * instead of one per copy_size.
+ */
+static void coroutine_fn block_copy_task_extend_zeroes(BlockCopyTask *task,
+                                                       int64_t end)
+{
+    BlockCopyState *s = task->s;
+
+    while (task->bytes < BLOCK_COPY_MAX_ZEROES && task_end(task) < end) {
+        int64_t offset = task_end(task);
+        int64_t bytes = MIN(end - offset, BLOCK_COPY_MAX_ZEROES - task->bytes);
+        int64_t dirty_offset, dirty_bytes, status_bytes;
+        int ret;
+
+        if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
+                                               offset, offset + bytes, bytes,
+                                               &dirty_offset, &dirty_bytes) ||
+            dirty_offset != offset)
+        {
+            break;
+        }
+        dirty_bytes = QEMU_ALIGN_UP(dirty_bytes, s->cluster_size);
+
+        ret = block_copy_block_status(s, offset, dirty_bytes, &status_bytes);
+        if (!(ret & BDRV_BLOCK_ZERO) ||
+            (s->skip_unallocated && !(ret & BDRV_BLOCK_ALLOCATED)))
+        {
+            break;
+        }
+
+        /* The area is dirty, so there are no tasks in it */
+        assert(!find_conflicting_task(s, offset, status_bytes));
+        bdrv_reset_dirty_bitmap(s->copy_bitmap, offset, status_bytes);
+        s->in_flight_bytes += status_bytes;
+        task->bytes += status_bytes;
+    }
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -598,16 +795,21 @@ static int coroutine_fn block_copy_dirty_clusters(BlockCopyState *s,
             continue;
         }
         task->zeroes = ret & BDRV_BLOCK_ZERO;
+        if (task->zeroes) {
+            block_copy_task_extend_zeroes(task, end);
+        }
 
         trace_block_copy_process(s, task->offset);
 
-        co_get_from_shres(s->mem, task->bytes);
+        if (!task->zeroes) {
+            co_get_from_shres(s->mem, task->bytes);
+        }
 
         offset = task_end(task);
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(BLOCK_COPY_MAX_WORKERS);
+            aio = aio_task_pool_new(s->workers);
         }
 
         ret = block_copy_task_run(aio, task);
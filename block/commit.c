@@ -15,6 +15,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -29,8 +30,13 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Upper limit for the max-workers option */
+    COMMIT_MAX_WORKERS = 64,
 };
 
+typedef struct CommitTask CommitTask;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -41,9 +47,23 @@ typedef struct CommitBlockJob {
     BlockdevOnError on_error;
     bool base_read_only;
     bool chain_frozen;
+    /* Try copy offload (e.g. copy_file_range) before read + write */
+    bool use_copy_range;
     char *backing_file_str;
+    int max_workers;
+    /* Chunks whose copy failed and that still need an on-error decision */
+    QSIMPLEQ_HEAD(, CommitTask) failed_tasks;
 } CommitBlockJob;
 
+struct CommitTask {
+    AioTask task;
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    bool error_in_source;
+    QSIMPLEQ_ENTRY(CommitTask) next;
+};
+
 static int commit_prepare(Job *job)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -112,6 +132,101 @@ static void commit_clean(Job *job)
     blk_unref(s->top);
 }
 
+static int coroutine_fn commit_copy(CommitBlockJob *s, int64_t offset,
+                                    int64_t bytes, bool *error_in_source)
+{
+    void *buf;
+    int ret;
+
+    assert(bytes < SIZE_MAX);
+
+    if (s->use_copy_range) {
+        ret = blk_co_copy_range(s->top, offset, s->base, offset, bytes, 0, 0);
+        if (ret >= 0) {
+            return ret;
+        }
+        /* Real I/O errors will show up again below */
+        trace_commit_copy_range_fail(s, offset, ret);
+        s->use_copy_range = false;
+    }
+
+    buf = blk_blockalign(s->top, bytes);
+    *error_in_source = true;
+    ret = blk_co_pread(s->top, offset, bytes, buf, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwrite(s->base, offset, bytes, buf, 0);
+        if (ret < 0) {
+            *error_in_source = false;
+        }
+    }
+    qemu_vfree(buf);
+
+    return ret;
+}
+
+static int coroutine_fn commit_task_entry(AioTask *task)
+{
+    CommitTask *t = container_of(task, CommitTask, task);
+    CommitBlockJob *s = t->s;
+    int ret;
+
+    ret = commit_copy(s, t->offset, t->bytes, &t->error_in_source);
+    if (ret < 0) {
+        /*
+         * Leave the error to commit_run(), which decides on the on-error
+         * action; keep the pool status clean so that other tasks go on.
+         */
+        t->task.ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->failed_tasks, t, next);
+        return 0;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    g_free(t);
+    return 0;
+}
+
+/*
+ * Wait for all running copies and apply the on-error policy to the ones
+ * that failed, retrying them synchronously until they succeed or the policy
+ * says to give up.  Returns the error to report, or 0.
+ */
+static int coroutine_fn commit_handle_failed(CommitBlockJob *s,
+                                             AioTaskPool *pool)
+{
+    CommitTask *t;
+    int ret;
+
+    aio_task_pool_wait_all(pool);
+
+    while ((t = QSIMPLEQ_FIRST(&s->failed_tasks)) != NULL) {
+        BlockErrorAction action =
+            block_job_error_action(&s->common, s->on_error,
+                                   t->error_in_source, -t->task.ret);
+        if (action == BLOCK_ERROR_ACTION_REPORT) {
+            return t->task.ret;
+        }
+
+        /* Both 'stop' and 'ignore' retry the request */
+        job_sleep_ns(&s->common.job, 0);
+        if (job_is_cancelled(&s->common.job)) {
+            return 0;
+        }
+
+        ret = commit_copy(s, t->offset, t->bytes, &t->error_in_source);
+        if (ret < 0) {
+            t->task.ret = ret;
+            continue;
+        }
+
+        job_progress_update(&s->common.job, t->bytes);
+        QSIMPLEQ_REMOVE_HEAD(&s->failed_tasks, next);
+        g_free(t);
+    }
+
+    return 0;
+}
+
 static int coroutine_fn commit_run(Job *job, Error **errp)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -119,8 +234,13 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    void *buf = NULL;
     int64_t len, base_len;
+    int64_t extent_end = 0;
+    bool extent_allocated = false;
+    AioTaskPool *pool = NULL;
+    CommitTask *t;
+
+    QSIMPLEQ_INIT(&s->failed_tasks);
 
     ret = len = blk_getlength(s->top);
     if (len < 0) {
@@ -140,12 +260,9 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
+    pool = aio_task_pool_new(s->max_workers);
 
     for (offset = 0; offset < len; offset += n) {
-        bool copy;
-        bool error_in_source = true;
-
         /* Note that even when no rate limit is applied we need to yield
          * with no pending I/O here so that bdrv_drain_all() returns.
          */
@@ -153,47 +270,76 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
-        /* Copy if allocated above the base */
-        ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay, true,
-                                      offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret == 1);
-        trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            assert(n < SIZE_MAX);
-
-            ret = blk_co_pread(s->top, offset, n, buf, 0);
-            if (ret >= 0) {
-                ret = blk_co_pwrite(s->base, offset, n, buf, 0);
-                if (ret < 0) {
-                    error_in_source = false;
-                }
+
+        if (!QSIMPLEQ_EMPTY(&s->failed_tasks)) {
+            ret = commit_handle_failed(s, pool);
+            if (ret < 0) {
+                goto out;
+            }
+            if (job_is_cancelled(&s->common.job)) {
+                break;
             }
         }
-        if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error,
-                                       error_in_source, -ret);
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                goto out;
-            } else {
+
+        /*
+         * Query the allocation status of the whole remaining image at once
+         * and then work through the returned extent chunk by chunk.
+         */
+        if (offset >= extent_end) {
+            ret = bdrv_is_allocated_above(blk_bs(s->top), s->base_overlay,
+                                          true, offset, len - offset, &n);
+            trace_commit_one_iteration(s, offset, n, ret);
+            if (ret < 0) {
+                BlockErrorAction action =
+                    block_job_error_action(&s->common, s->on_error, true,
+                                           -ret);
+                if (action == BLOCK_ERROR_ACTION_REPORT) {
+                    goto out;
+                }
                 n = 0;
                 continue;
             }
+            /* Copy if allocated above the base */
+            extent_allocated = (ret == 1);
+            extent_end = offset + n;
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
 
-        if (copy) {
-            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
-        } else {
+        if (!extent_allocated) {
+            n = extent_end - offset;
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
+            continue;
         }
+
+        n = MIN(extent_end - offset, COMMIT_BUFFER_SIZE);
+
+        aio_task_pool_wait_slot(pool);
+        t = g_new(CommitTask, 1);
+        *t = (CommitTask) {
+            .task.func  = commit_task_entry,
+            .s          = s,
+            .offset     = offset,
+            .bytes      = n,
+        };
+        aio_task_pool_start_task(pool, &t->task);
+
+        delay_ns = block_job_ratelimit_get_delay(&s->common, n);
     }
 
     ret = 0;
+    if (!job_is_cancelled(&s->common.job)) {
+        ret = commit_handle_failed(s, pool);
+    }
 
 out:
-    qemu_vfree(buf);
+    if (pool) {
+        aio_task_pool_wait_all(pool);
+        aio_task_pool_free(pool);
+    }
+    while ((t = QSIMPLEQ_FIRST(&s->failed_tasks)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed_tasks, next);
+        g_free(t);
+    }
 
     return ret;
 }
@@ -248,7 +394,7 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, BlockDriverState *top,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
-                  const char *filter_node_name, Error **errp)
+                  const char *filter_node_name, int max_workers, Error **errp)
 {
     CommitBlockJob *s;
     BlockDriverState *iter;
@@ -265,6 +411,12 @@ void commit_start(const char *job_id, BlockDriverState *bs,
         return;
     }
 
+    if (max_workers < 1 || max_workers > COMMIT_MAX_WORKERS) {
+        error_setg(errp, "max-workers must be between 1 and %d",
+                   COMMIT_MAX_WORKERS);
+        return;
+    }
+
     base_size = bdrv_getlength(base);
     if (base_size < 0) {
         error_setg_errno(errp, -base_size, "Could not inquire base image size");
@@ -395,6 +547,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
 
     s->backing_file_str = g_strdup(backing_file_str);
     s->on_error = on_error;
+    s->use_copy_range = true;
+    s->max_workers = max_workers;
 
     trace_commit_start(bs, base, top, s);
     job_start(&s->common.job);
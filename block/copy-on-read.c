@@ -23,11 +23,79 @@
 #include "qemu/osdep.h"
 #include "block/block_int.h"
 #include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/ratelimit.h"
+#include "qapi/error.h"
+#include "trace.h"
 
+/*
+ * Number of consecutive non-sequential reads after which the access
+ * pattern is considered random and prefetching is suspended.  A single
+ * sequential read resumes it.
+ */
+#define COR_RANDOM_THRESHOLD        4
+
+/* Prefetch granularity if the child does not report a cluster size */
+#define COR_DEFAULT_CLUSTER_SIZE    (64 * KiB)
+
+#define COR_PREFETCH_SLICE_NS       (100 * SCALE_MS)
+
+typedef struct BDRVStateCOR {
+    /* Prefetch window in bytes; 0 if prefetching is disabled */
+    int64_t prefetch_bytes;
+    int64_t cluster_size;
+    unsigned int prefetch_max_in_flight;
+    uint64_t prefetch_bps;
+    RateLimit prefetch_limit;
+
+    /* End of the previous guest read, for sequential access detection */
+    int64_t last_end;
+    unsigned int random_reads;
+    /* Everything below this offset has already been submitted for prefetch */
+    int64_t prefetch_end;
+    unsigned int prefetch_in_flight;
+} BDRVStateCOR;
+
+typedef struct CORPrefetch {
+    BlockDriverState *bs;
+    int64_t offset;
+    int64_t bytes;
+} CORPrefetch;
+
+static QemuOptsList runtime_opts = {
+    .name = "copy-on-read",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = "prefetch-clusters",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of clusters to copy in the background after a "
+                    "copy-on-read miss (0 = disabled)",
+        },
+        {
+            .name = "prefetch-max-in-flight",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of concurrent prefetch requests",
+        },
+        {
+            .name = "prefetch-bps",
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum prefetch bandwidth in bytes per second "
+                    "(0 = unlimited)",
+        },
+        { /* end of list */ }
+    },
+};
 
 static int cor_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
+    BDRVStateCOR *s = bs->opaque;
+    BlockDriverInfo bdi;
+    QemuOpts *opts;
+    uint64_t prefetch_clusters;
+    int ret;
+
     bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
                                BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
                                false, errp);
@@ -35,6 +103,43 @@ static int cor_open(BlockDriverState *bs, QDict *options, int flags,
         return -EINVAL;
     }
 
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    prefetch_clusters = qemu_opt_get_number(opts, "prefetch-clusters", 0);
+    s->prefetch_max_in_flight =
+        qemu_opt_get_number(opts, "prefetch-max-in-flight", 4);
+    s->prefetch_bps = qemu_opt_get_size(opts, "prefetch-bps", 0);
+
+    if (s->prefetch_max_in_flight == 0) {
+        error_setg(errp, "prefetch-max-in-flight must be greater than 0");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    ret = bdrv_get_info(bs->file->bs, &bdi);
+    if (ret < 0 || bdi.cluster_size == 0) {
+        s->cluster_size = COR_DEFAULT_CLUSTER_SIZE;
+    } else {
+        s->cluster_size = bdi.cluster_size;
+    }
+
+    if (prefetch_clusters > BDRV_REQUEST_MAX_BYTES / s->cluster_size) {
+        error_setg(errp, "prefetch-clusters must not exceed %" PRId64,
+                   (int64_t)(BDRV_REQUEST_MAX_BYTES / s->cluster_size));
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->prefetch_bytes = prefetch_clusters * s->cluster_size;
+
+    if (s->prefetch_bps) {
+        ratelimit_set_speed(&s->prefetch_limit, s->prefetch_bps,
+                            COR_PREFETCH_SLICE_NS);
+    }
+
     bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
         (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
 
@@ -42,7 +147,10 @@ static int cor_open(BlockDriverState *bs, QDict *options, int flags,
         ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
             bs->file->bs->supported_zero_flags);
 
-    return 0;
+    ret = 0;
+fail:
+    qemu_opts_del(opts);
+    return ret;
 }
 
 
@@ -74,12 +182,116 @@ static int64_t cor_getlength(BlockDriverState *bs)
 }
 
 
+static void coroutine_fn cor_prefetch_entry(void *opaque)
+{
+    CORPrefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVStateCOR *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_preadv(bs->file, p->offset, p->bytes, NULL,
+                         BDRV_REQ_COPY_ON_READ | BDRV_REQ_PREFETCH);
+    trace_cor_prefetch_done(bs, p->offset, p->bytes, ret);
+
+    s->prefetch_in_flight--;
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Called for each guest read.  Tracks whether the guest is reading
+ * sequentially and, after a copy-on-read miss, copies the following
+ * prefetch window from the backing chain in the background.
+ */
+static void coroutine_fn cor_maybe_prefetch(BlockDriverState *bs,
+                                            int64_t offset, int64_t bytes,
+                                            int64_t total_bytes, bool miss)
+{
+    BDRVStateCOR *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int64_t start, len;
+    CORPrefetch *p;
+    Coroutine *co;
+
+    if (offset >= s->last_end - s->prefetch_bytes &&
+        offset <= s->last_end + s->prefetch_bytes)
+    {
+        s->random_reads = 0;
+    } else if (s->random_reads < COR_RANDOM_THRESHOLD) {
+        s->random_reads++;
+    }
+    s->last_end = end;
+
+    if (!miss || s->random_reads >= COR_RANDOM_THRESHOLD ||
+        s->prefetch_in_flight >= s->prefetch_max_in_flight)
+    {
+        return;
+    }
+
+    /* Do not resubmit what a previous prefetch already covers */
+    start = QEMU_ALIGN_UP(end, s->cluster_size);
+    if (s->prefetch_end > start && s->prefetch_end <= end + s->prefetch_bytes) {
+        start = s->prefetch_end;
+    }
+    len = QEMU_ALIGN_UP(end, s->cluster_size) + s->prefetch_bytes - start;
+    len = MIN(len, total_bytes - start);
+    if (len <= 0) {
+        return;
+    }
+
+    /*
+     * Prefetching is purely opportunistic: rather than delaying it (and
+     * with it any drain), drop it altogether when over the rate limit.
+     */
+    if (s->prefetch_bps &&
+        ratelimit_calculate_delay(&s->prefetch_limit, len) > 0)
+    {
+        trace_cor_prefetch_throttled(bs, start, len);
+        return;
+    }
+
+    trace_cor_prefetch(bs, start, len);
+    s->prefetch_end = start + len;
+    s->prefetch_in_flight++;
+    bdrv_inc_in_flight(bs);
+
+    p = g_new(CORPrefetch, 1);
+    *p = (CORPrefetch) {
+        .bs     = bs,
+        .offset = start,
+        .bytes  = len,
+    };
+    co = qemu_coroutine_create(cor_prefetch_entry, p);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
 static int coroutine_fn cor_co_preadv(BlockDriverState *bs,
                                       uint64_t offset, uint64_t bytes,
                                       QEMUIOVector *qiov, int flags)
 {
-    return bdrv_co_preadv(bs->file, offset, bytes, qiov,
-                          flags | BDRV_REQ_COPY_ON_READ);
+    BDRVStateCOR *s = bs->opaque;
+    bool miss = false;
+    int ret;
+
+    if (s->prefetch_bytes) {
+        int64_t pnum;
+
+        ret = bdrv_is_allocated(bs->file->bs, offset, bytes, &pnum);
+        miss = ret == 0 || (ret > 0 && pnum < bytes);
+    }
+
+    ret = bdrv_co_preadv(bs->file, offset, bytes, qiov,
+                         flags | BDRV_REQ_COPY_ON_READ);
+
+    if (ret >= 0 && s->prefetch_bytes) {
+        int64_t total_bytes = bdrv_getlength(bs);
+
+        if (total_bytes >= 0) {
+            cor_maybe_prefetch(bs, offset, bytes, total_bytes, miss);
+        }
+    }
+
+    return ret;
 }
 
 
@@ -131,6 +343,7 @@ static void cor_lock_medium(BlockDriverState *bs, bool locked)
 
 static BlockDriver bdrv_copy_on_read = {
     .format_name                        = "copy-on-read",
+    .instance_size                      = sizeof(BDRVStateCOR),
 
     .bdrv_open                          = cor_open,
     .bdrv_child_perm                    = cor_child_perm,
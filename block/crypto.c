@@ -22,6 +22,7 @@
 
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -35,9 +36,26 @@
 
 typedef struct BlockCrypto BlockCrypto;
 
+/*
+ * A node runs up to one encryption/decryption worker thread per online CPU,
+ * but allows at least this many
+ */
+#define BLOCK_CRYPTO_MIN_THREAD_LIMIT 4
+
+/*
+ * Requests are encrypted/decrypted in slices of this size, which are
+ * processed by the worker threads in parallel.
+ */
+#define BLOCK_CRYPTO_SLICE_SIZE (64 * 1024)
+
 struct BlockCrypto {
     QCryptoBlock *block;
     bool updating_keys;
+
+    /* Worker threads in use; only touched from the node's AioContext */
+    int nb_threads;
+    int max_threads;
+    CoQueue thread_task_queue;
 };
 
 
@@ -159,6 +177,7 @@ static QemuOptsList block_crypto_runtime_opts_luks = {
     .head = QTAILQ_HEAD_INITIALIZER(block_crypto_runtime_opts_luks.head),
     .desc = {
         BLOCK_CRYPTO_OPT_DEF_LUKS_KEY_SECRET(""),
+        BLOCK_CRYPTO_OPT_DEF_LUKS_CIPHER_BACKEND(""),
         { /* end of list */ }
     },
 };
@@ -290,11 +309,19 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     if (flags & BDRV_O_NO_IO) {
         cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
     }
+
+    /* Every worker thread needs a cipher of its own */
+    qemu_co_queue_init(&crypto->thread_task_queue);
+    crypto->max_threads = BLOCK_CRYPTO_MIN_THREAD_LIMIT;
+#ifdef _SC_NPROCESSORS_ONLN
+    crypto->max_threads = MAX(crypto->max_threads,
+                              sysconf(_SC_NPROCESSORS_ONLN));
+#endif
     crypto->block = qcrypto_block_open(open_opts, NULL,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       crypto->max_threads,
                                        errp);
 
     if (!crypto->block) {
@@ -396,6 +423,120 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef struct BlockCryptoEncDecData {
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoEncDecData;
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+
+    if (data->encrypt) {
+        return qcrypto_block_encrypt(data->block, data->offset,
+                                     data->buf, data->len, NULL);
+    } else {
+        return qcrypto_block_decrypt(data->block, data->offset,
+                                     data->buf, data->len, NULL);
+    }
+}
+
+/* Run one slice in a worker thread, waiting for a free one if needed */
+static int coroutine_fn
+block_crypto_co_process(BlockDriverState *bs, BlockCryptoEncDecData *data)
+{
+    BlockCrypto *crypto = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    int ret;
+
+    while (crypto->nb_threads >= crypto->max_threads) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, NULL);
+    }
+    crypto->nb_threads++;
+
+    ret = thread_pool_submit_co(pool, block_crypto_encdec_pool_func, data);
+
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+
+    return ret;
+}
+
+typedef struct BlockCryptoSliceCo {
+    BlockDriverState *bs;
+    BlockCryptoEncDecData data;
+    Coroutine *waiter;
+    int *remaining;
+    int *ret;
+} BlockCryptoSliceCo;
+
+static void coroutine_fn block_crypto_slice_entry(void *opaque)
+{
+    BlockCryptoSliceCo slice = *(BlockCryptoSliceCo *)opaque;
+    int ret;
+
+    ret = block_crypto_co_process(slice.bs, &slice.data);
+    if (ret < 0) {
+        *slice.ret = ret;
+    }
+    if (--*slice.remaining == 0) {
+        aio_co_wake(slice.waiter);
+    }
+}
+
+/*
+ * Encrypt or decrypt @len bytes of @buf, which belong to the guest
+ * @offset, in place.  Large buffers are split into slices that are
+ * processed by several worker threads at once.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       uint8_t *buf, size_t len, bool encrypt)
+{
+    BlockCrypto *crypto = bs->opaque;
+    BlockCryptoSliceCo slice = {
+        .bs = bs,
+        .data = {
+            .block = crypto->block,
+            .encrypt = encrypt,
+        },
+        .waiter = qemu_coroutine_self(),
+    };
+    int remaining = 1; /* held by this coroutine until all are started */
+    int ret = 0;
+    size_t done;
+
+    if (len <= BLOCK_CRYPTO_SLICE_SIZE) {
+        slice.data.offset = offset;
+        slice.data.buf = buf;
+        slice.data.len = len;
+        return block_crypto_co_process(bs, &slice.data) < 0 ? -EIO : 0;
+    }
+
+    slice.remaining = &remaining;
+    slice.ret = &ret;
+    for (done = 0; done < len; done += slice.data.len) {
+        Coroutine *co;
+
+        slice.data.offset = offset + done;
+        slice.data.buf = buf + done;
+        slice.data.len = MIN(len - done, BLOCK_CRYPTO_SLICE_SIZE);
+
+        remaining++;
+        co = qemu_coroutine_create(block_crypto_slice_entry, &slice);
+        qemu_coroutine_enter(co);
+    }
+
+    if (--remaining > 0) {
+        qemu_coroutine_yield();
+    }
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -439,9 +580,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -495,9 +636,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -45,6 +45,7 @@
 #define BLOCK_CRYPTO_OPT_LUKS_STATE "state"
 #define BLOCK_CRYPTO_OPT_LUKS_OLD_SECRET "old-secret"
 #define BLOCK_CRYPTO_OPT_LUKS_NEW_SECRET "new-secret"
+#define BLOCK_CRYPTO_OPT_LUKS_CIPHER_BACKEND "cipher-backend"
 
 
 #define BLOCK_CRYPTO_OPT_DEF_LUKS_KEY_SECRET(prefix)                    \
@@ -58,6 +59,13 @@
         .help = "Name of encryption cipher algorithm",     \
     }
 
+#define BLOCK_CRYPTO_OPT_DEF_LUKS_CIPHER_BACKEND(prefix)       \
+    {                                                          \
+        .name = prefix BLOCK_CRYPTO_OPT_LUKS_CIPHER_BACKEND,   \
+        .type = QEMU_OPT_STRING,                               \
+        .help = "Cipher implementation (auto/library/afalg)",  \
+    }
+
 #define BLOCK_CRYPTO_OPT_DEF_LUKS_CIPHER_MODE(prefix)      \
     {                                                      \
         .name = prefix BLOCK_CRYPTO_OPT_LUKS_CIPHER_MODE,  \
@@ -64,8 +64,13 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define CURL_NUM_ACB    8
 #define CURL_TIMEOUT_MAX 10000
 
+/* Granularity of the block cache */
+#define CURL_CACHE_BLOCK_SIZE (64 * 1024)
+
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
+#define CURL_BLOCK_OPT_READAHEAD_PARALLEL "readahead-parallel"
+#define CURL_BLOCK_OPT_CACHE_SIZE "cache-size"
 #define CURL_BLOCK_OPT_SSLVERIFY "sslverify"
 #define CURL_BLOCK_OPT_TIMEOUT "timeout"
 #define CURL_BLOCK_OPT_COOKIE    "cookie"
@@ -78,6 +83,8 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
+#define CURL_BLOCK_OPT_READAHEAD_PARALLEL_DEFAULT 0
+#define CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT 0
 
 struct BDRVCURLState;
 struct CURLState;
@@ -96,18 +103,28 @@ typedef struct CURLAIOCB {
     size_t end;
 } CURLAIOCB;
 
+/*
+ * Sockets belong to the multi handle rather than to a transfer, because
+ * with HTTP/2 several transfers are multiplexed over one connection.
+ */
 typedef struct CURLSocket {
     int fd;
-    struct CURLState *state;
+    struct BDRVCURLState *s;
     QLIST_ENTRY(CURLSocket) next;
 } CURLSocket;
 
+typedef struct CURLCacheBlock {
+    uint64_t index;
+    size_t len;
+    QTAILQ_ENTRY(CURLCacheBlock) lru;
+    char data[];
+} CURLCacheBlock;
+
 typedef struct CURLState
 {
     struct BDRVCURLState *s;
     CURLAIOCB *acb[CURL_NUM_ACB];
     CURL *curl;
-    QLIST_HEAD(, CURLSocket) sockets;
     char *orig_buf;
     uint64_t buf_start;
     size_t buf_off;
@@ -124,6 +141,7 @@ typedef struct BDRVCURLState {
     CURLState states[CURL_NUM_STATES];
     char *url;
     size_t readahead_size;
+    uint64_t readahead_parallel;
     bool sslverify;
     uint64_t timeout;
     char *cookie;
@@ -135,6 +153,18 @@ typedef struct BDRVCURLState {
     char *password;
     char *proxyusername;
     char *proxypassword;
+    QLIST_HEAD(, CURLSocket) sockets;
+
+    /*
+     * Data fetched by completed transfers, in CURL_CACHE_BLOCK_SIZE
+     * blocks indexed by offset / CURL_CACHE_BLOCK_SIZE.  The least
+     * recently used blocks are evicted once @cache_used exceeds
+     * @cache_size.
+     */
+    uint64_t cache_size;
+    uint64_t cache_used;
+    GHashTable *cache;
+    QTAILQ_HEAD(, CURLCacheBlock) cache_lru;
 } BDRVCURLState;
 
 static void curl_clean_state(CURLState *s);
@@ -162,14 +192,10 @@ static int curl_timer_cb(CURLM *multi, long timeout_ms, void *opaque)
 static int curl_sock_cb(CURL *curl, curl_socket_t fd, int action,
                         void *userp, void *sp)
 {
-    BDRVCURLState *s;
-    CURLState *state = NULL;
+    BDRVCURLState *s = userp;
     CURLSocket *socket;
 
-    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&state);
-    s = state->s;
-
-    QLIST_FOREACH(socket, &state->sockets, next) {
+    QLIST_FOREACH(socket, &s->sockets, next) {
         if (socket->fd == fd) {
             break;
         }
@@ -177,8 +203,8 @@ static int curl_sock_cb(CURL *curl, curl_socket_t fd, int action,
     if (!socket) {
         socket = g_new0(CURLSocket, 1);
         socket->fd = fd;
-        socket->state = state;
-        QLIST_INSERT_HEAD(&state->sockets, socket, next);
+        socket->s = s;
+        QLIST_INSERT_HEAD(&s->sockets, socket, next);
     }
 
     trace_curl_sock_cb(action, (int)fd);
@@ -273,6 +299,113 @@ read_end:
     return size * nmemb;
 }
 
+/* Called with s->mutex held.  */
+static void curl_cache_evict(BDRVCURLState *s, uint64_t limit)
+{
+    while (s->cache_used > limit) {
+        CURLCacheBlock *block = QTAILQ_LAST(&s->cache_lru);
+
+        QTAILQ_REMOVE(&s->cache_lru, block, lru);
+        g_hash_table_remove(s->cache, &block->index);
+        s->cache_used -= block->len;
+        g_free(block);
+    }
+}
+
+/*
+ * Add the complete cache blocks in @buf, which holds @len bytes from
+ * offset @start, to the block cache.
+ *
+ * Called with s->mutex held.
+ */
+static void curl_cache_insert(BDRVCURLState *s, uint64_t start,
+                              const char *buf, size_t len)
+{
+    uint64_t index;
+
+    if (!s->cache_size) {
+        return;
+    }
+
+    for (index = DIV_ROUND_UP(start, CURL_CACHE_BLOCK_SIZE);; index++) {
+        uint64_t offset = index * CURL_CACHE_BLOCK_SIZE;
+        uint64_t block_len;
+        CURLCacheBlock *block;
+
+        if (offset >= s->len) {
+            break;
+        }
+        block_len = MIN(CURL_CACHE_BLOCK_SIZE, s->len - offset);
+        if (offset + block_len > start + len) {
+            break;
+        }
+
+        block = g_hash_table_lookup(s->cache, &index);
+        if (block) {
+            QTAILQ_REMOVE(&s->cache_lru, block, lru);
+            QTAILQ_INSERT_HEAD(&s->cache_lru, block, lru);
+            continue;
+        }
+
+        block = g_malloc(sizeof(*block) + block_len);
+        block->index = index;
+        block->len = block_len;
+        memcpy(block->data, buf + (offset - start), block_len);
+        g_hash_table_insert(s->cache, &block->index, block);
+        QTAILQ_INSERT_HEAD(&s->cache_lru, block, lru);
+        s->cache_used += block_len;
+    }
+
+    curl_cache_evict(s, s->cache_size);
+}
+
+/*
+ * Complete @acb from the block cache if it covers the whole request.
+ *
+ * Called with s->mutex held.
+ */
+static bool curl_cache_read(BDRVCURLState *s, uint64_t start, uint64_t len,
+                            CURLAIOCB *acb)
+{
+    uint64_t clamped_end = MIN(start + len, s->len);
+    uint64_t first, last, index, pos;
+
+    if (!s->cache_size || clamped_end <= start) {
+        return false;
+    }
+
+    first = start / CURL_CACHE_BLOCK_SIZE;
+    last = (clamped_end - 1) / CURL_CACHE_BLOCK_SIZE;
+    for (index = first; index <= last; index++) {
+        if (!g_hash_table_contains(s->cache, &index)) {
+            return false;
+        }
+    }
+
+    pos = start;
+    for (index = first; index <= last; index++) {
+        CURLCacheBlock *block = g_hash_table_lookup(s->cache, &index);
+        uint64_t block_start = index * CURL_CACHE_BLOCK_SIZE;
+        uint64_t n = MIN(block_start + block->len, clamped_end) - pos;
+
+        qemu_iovec_from_buf(acb->qiov, pos - start,
+                            block->data + (pos - block_start), n);
+        pos += n;
+
+        QTAILQ_REMOVE(&s->cache_lru, block, lru);
+        QTAILQ_INSERT_HEAD(&s->cache_lru, block, lru);
+    }
+
+    if (clamped_end - start < len) {
+        qemu_iovec_memset(acb->qiov, clamped_end - start, 0,
+                          len - (clamped_end - start));
+    }
+
+    trace_curl_cache_hit(start, len);
+    acb->ret = 0;
+    return true;
+}
+
 /* Called with s->mutex held.  */
 static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
                           CURLAIOCB *acb)
@@ -355,6 +488,11 @@ static void curl_multi_check_completion(BDRVCURLState *s)
             curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
                               (char **)&state);
 
+            if (!error) {
+                curl_cache_insert(s, state->buf_start, state->orig_buf,
+                                  state->buf_off);
+            }
+
             if (error) {
                 static int errcount = 100;
 
@@ -407,7 +545,7 @@ static void curl_multi_check_completion(BDRVCURLState *s)
 /* Called with s->mutex held.  */
 static void curl_multi_do_locked(CURLSocket *socket)
 {
-    BDRVCURLState *s = socket->state->s;
+    BDRVCURLState *s = socket->s;
     int running;
     int r;
 
@@ -423,7 +561,7 @@ static void curl_multi_do_locked(CURLSocket *socket)
 static void curl_multi_do(void *arg)
 {
     CURLSocket *socket = arg;
-    BDRVCURLState *s = socket->state->s;
+    BDRVCURLState *s = socket->s;
 
     qemu_mutex_lock(&s->mutex);
     curl_multi_do_locked(socket);
@@ -492,6 +630,15 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_NOSIGNAL, 1);
         curl_easy_setopt(state->curl, CURLOPT_ERRORBUFFER, state->errmsg);
         curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        /* Use HTTP/2 for https:// if the server supports it (7.47.0) */
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long) CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+        /* Prefer multiplexing over an existing connection (7.43.0) */
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
 
         if (s->username) {
             curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username);
@@ -524,7 +671,6 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
 #endif
     }
 
-    QLIST_INIT(&state->sockets);
     state->s = s;
 
     return 0;
@@ -541,13 +687,6 @@ static void curl_clean_state(CURLState *s)
     if (s->s->multi)
         curl_multi_remove_handle(s->s->multi, s->curl);
 
-    while (!QLIST_EMPTY(&s->sockets)) {
-        CURLSocket *socket = QLIST_FIRST(&s->sockets);
-
-        QLIST_REMOVE(socket, next);
-        g_free(socket);
-    }
-
     s->in_use = 0;
 
     qemu_co_enter_next(&s->s->free_state_waitq, &s->s->mutex);
@@ -580,6 +719,14 @@ static void curl_detach_aio_context(BlockDriverState *bs)
         curl_multi_cleanup(s->multi);
         s->multi = NULL;
     }
+    while (!QLIST_EMPTY(&s->sockets)) {
+        CURLSocket *socket = QLIST_FIRST(&s->sockets);
+
+        aio_set_fd_handler(s->aio_context, socket->fd, false,
+                           NULL, NULL, NULL, NULL);
+        QLIST_REMOVE(socket, next);
+        g_free(socket);
+    }
     qemu_mutex_unlock(&s->mutex);
 
     timer_del(&s->timer);
@@ -597,7 +744,12 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     assert(!s->multi);
     s->multi = curl_multi_init();
     s->aio_context = new_context;
+    curl_multi_setopt(s->multi, CURLMOPT_SOCKETDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    /* Let transfers to the same HTTP/2 server share a connection */
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #ifdef NEED_CURL_TIMER_CALLBACK
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
@@ -618,6 +770,16 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Readahead size",
         },
+        {
+            .name = CURL_BLOCK_OPT_READAHEAD_PARALLEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of readahead windows fetched in parallel",
+        },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the block cache shared by all requests",
+        },
         {
             .name = CURL_BLOCK_OPT_SSLVERIFY,
             .type = QEMU_OPT_BOOL,
@@ -706,6 +868,19 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
         goto out_noclean;
     }
 
+    s->readahead_parallel =
+        qemu_opt_get_number(opts, CURL_BLOCK_OPT_READAHEAD_PARALLEL,
+                            CURL_BLOCK_OPT_READAHEAD_PARALLEL_DEFAULT);
+    /* Leave at least half of the states to requests that have to wait */
+    if (s->readahead_parallel > CURL_NUM_STATES / 2) {
+        error_setg(errp, "readahead-parallel must not exceed %d",
+                   CURL_NUM_STATES / 2);
+        goto out_noclean;
+    }
+
+    s->cache_size = qemu_opt_get_size(opts, CURL_BLOCK_OPT_CACHE_SIZE,
+                                      CURL_BLOCK_OPT_CACHE_SIZE_DEFAULT);
+
     s->timeout = qemu_opt_get_number(opts, CURL_BLOCK_OPT_TIMEOUT,
                                      CURL_BLOCK_OPT_TIMEOUT_DEFAULT);
     if (s->timeout > CURL_TIMEOUT_MAX) {
@@ -830,6 +1005,9 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     curl_easy_cleanup(state->curl);
     state->curl = NULL;
 
+    s->cache = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->cache_lru);
+    QLIST_INIT(&s->sockets);
     curl_attach_aio_context(bs, bdrv_get_aio_context(bs));
 
     qemu_opts_del(opts);
@@ -850,22 +1028,142 @@ out_noclean:
     return -EINVAL;
 }
 
+/*
+ * Start fetching @len bytes from @start into @state's buffer.  @acb may be
+ * NULL for readahead that no request is waiting for yet.  On failure,
+ * @state is released again.
+ *
+ * Called with s->mutex held.
+ */
+static int curl_start_transfer(BDRVCURLState *s, CURLState *state,
+                               uint64_t start, uint64_t len, CURLAIOCB *acb)
+{
+    uint64_t end;
+
+    if (curl_init_state(s, state) < 0) {
+        curl_clean_state(state);
+        return -EIO;
+    }
+
+    state->buf_off = 0;
+    g_free(state->orig_buf);
+    state->buf_start = start;
+    state->buf_len = len;
+    end = start + state->buf_len - 1;
+    state->orig_buf = g_try_malloc(state->buf_len);
+    if (state->buf_len && state->orig_buf == NULL) {
+        curl_clean_state(state);
+        return -ENOMEM;
+    }
+    state->acb[0] = acb;
+
+    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
+    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
+
+    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
+        state->acb[0] = NULL;
+        curl_clean_state(state);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Return the end of the cached or fetched (or being fetched) data that
+ * contains @pos, or @pos if there is none.
+ *
+ * Called with s->mutex held.
+ */
+static uint64_t curl_covered_until(BDRVCURLState *s, uint64_t pos)
+{
+    uint64_t index = pos / CURL_CACHE_BLOCK_SIZE;
+    CURLCacheBlock *block;
+    int i;
+
+    for (i = 0; i < CURL_NUM_STATES; i++) {
+        CURLState *state = &s->states[i];
+        uint64_t buf_end = state->buf_start +
+                           (state->in_use ? state->buf_len : state->buf_off);
+
+        if (state->orig_buf && pos >= state->buf_start && pos < buf_end) {
+            return buf_end;
+        }
+    }
+
+    if (s->cache_size) {
+        block = g_hash_table_lookup(s->cache, &index);
+        if (block) {
+            return index * CURL_CACHE_BLOCK_SIZE + block->len;
+        }
+    }
+
+    return pos;
+}
+
+/*
+ * Keep up to readahead_parallel windows of readahead-size bytes after
+ * @pos in flight, using only states that are free right now.
+ *
+ * Called with s->mutex held.
+ */
+static void curl_start_readahead(BDRVCURLState *s, uint64_t pos)
+{
+    uint64_t limit;
+    bool started = false;
+    int running;
+
+    if (!s->readahead_parallel || !s->readahead_size) {
+        return;
+    }
+
+    limit = MIN(s->len, pos + s->readahead_parallel * s->readahead_size);
+    while (pos < limit) {
+        uint64_t covered = curl_covered_until(s, pos);
+        CURLState *state;
+        uint64_t len;
+
+        if (covered > pos) {
+            pos = covered;
+            continue;
+        }
+
+        state = curl_find_state(s);
+        if (!state) {
+            break;
+        }
+
+        len = MIN(s->readahead_size, s->len - pos);
+        if (curl_start_transfer(s, state, pos, len, NULL) < 0) {
+            break;
+        }
+        trace_curl_readahead(pos, len);
+        started = true;
+        pos += len;
+    }
+
+    if (started) {
+        curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+}
+
 static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
 {
     CURLState *state;
     int running;
+    int ret;
 
     BDRVCURLState *s = bs->opaque;
 
     uint64_t start = acb->offset;
-    uint64_t end;
 
     qemu_mutex_lock(&s->mutex);
 
     // In case we have the requested data already (e.g. read-ahead),
     // we can just call the callback and be done.
-    if (curl_find_buf(s, start, acb->bytes, acb)) {
-        goto out;
+    if (curl_cache_read(s, start, acb->bytes, acb) ||
+        curl_find_buf(s, start, acb->bytes, acb)) {
+        goto readahead;
     }
 
     // No cache found, so let's start a new request
@@ -877,43 +1175,24 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
         qemu_co_queue_wait(&s->free_state_waitq, &s->mutex);
     }
 
-    if (curl_init_state(s, state) < 0) {
-        curl_clean_state(state);
-        acb->ret = -EIO;
-        goto out;
-    }
-
     acb->start = 0;
     acb->end = MIN(acb->bytes, s->len - start);
 
-    state->buf_off = 0;
-    g_free(state->orig_buf);
-    state->buf_start = start;
-    state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
-    end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
-    if (state->buf_len && state->orig_buf == NULL) {
-        curl_clean_state(state);
-        acb->ret = -ENOMEM;
+    ret = curl_start_transfer(s, state, start,
+                              MIN(acb->end + s->readahead_size,
+                                  s->len - start),
+                              acb);
+    if (ret < 0) {
+        acb->ret = ret;
         goto out;
     }
-    state->acb[0] = acb;
-
-    snprintf(state->range, 127, "%" PRIu64 "-%" PRIu64, start, end);
     trace_curl_setup_preadv(acb->bytes, start, state->range);
-    curl_easy_setopt(state->curl, CURLOPT_RANGE, state->range);
-
-    if (curl_multi_add_handle(s->multi, state->curl) != CURLM_OK) {
-        state->acb[0] = NULL;
-        acb->ret = -EIO;
-
-        curl_clean_state(state);
-        goto out;
-    }
 
     /* Tell curl it needs to kick things off */
     curl_multi_socket_action(s->multi, CURL_SOCKET_TIMEOUT, 0, &running);
 
+readahead:
+    curl_start_readahead(s, start + acb->bytes);
 out:
     qemu_mutex_unlock(&s->mutex);
 }
@@ -944,6 +1223,9 @@ static void curl_close(BlockDriverState *bs)
     curl_detach_aio_context(bs);
     qemu_mutex_destroy(&s->mutex);
 
+    curl_cache_evict(s, 0);
+    g_hash_table_destroy(s->cache);
+
     g_free(s->cookie);
     g_free(s->url);
     g_free(s->username);
@@ -961,8 +1243,8 @@ static void curl_refresh_filename(BlockDriverState *bs)
 {
     BDRVCURLState *s = bs->opaque;
 
-    /* "readahead" and "timeout" do not change the guest-visible data,
-     * so ignore them */
+    /* "readahead", "readahead-parallel", "cache-size" and "timeout" do not
+     * change the guest-visible data, so ignore them */
     if (s->sslverify != CURL_BLOCK_OPT_SSLVERIFY_DEFAULT ||
         s->cookie || s->username || s->password || s->proxyusername ||
         s->proxypassword)
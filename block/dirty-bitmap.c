@@ -51,6 +51,9 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    BdrvDirtyBitmapLoadFunc *load; /* Reads the stored bits that have not been
+                                      merged into @bitmap yet, if any */
+    void *load_opaque;          /* Argument for @load, freed with it */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -257,6 +260,10 @@ int bdrv_dirty_bitmap_create_successor(BdrvDirtyBitmap *bitmap, Error **errp)
         return -1;
     }
 
+    if (bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+        return -1;
+    }
+
     /* Create an anonymous successor */
     granularity = bdrv_dirty_bitmap_granularity(bitmap);
     child = bdrv_create_dirty_bitmap(bitmap->bs, granularity, NULL, errp);
@@ -296,6 +303,7 @@ static void bdrv_release_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap)
     assert(!bdrv_dirty_bitmap_has_successor(bitmap));
     QLIST_REMOVE(bitmap, list);
     hbitmap_free(bitmap->bitmap);
+    g_free(bitmap->load_opaque);
     g_free(bitmap->name);
     g_free(bitmap);
 }
@@ -574,6 +582,24 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
     BlockDirtyInfoList *list = NULL;
     BlockDirtyInfoList **plist = &list;
 
+    /*
+     * The dirty count must include the stored bits.  A bitmap whose data
+     * cannot be read is no more usable than one left in use by a crash, so
+     * treat it the same way.
+     */
+    QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        Error *local_err = NULL;
+
+        if (bm->inconsistent) {
+            continue;
+        }
+        if (bdrv_dirty_bitmap_load(bm, &local_err) < 0) {
+            error_reportf_err(local_err, "Cannot load bitmap '%s': ",
+                              bm->name ?: "");
+            bdrv_dirty_bitmap_set_inconsistent(bm);
+        }
+    }
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
         BlockDirtyInfo *info = g_new0(BlockDirtyInfo, 1);
@@ -597,6 +623,75 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
     return list;
 }
 
+/* Called with BQL taken. */
+void bdrv_dirty_bitmap_set_lazy_load(BdrvDirtyBitmap *bitmap,
+                                     BdrvDirtyBitmapLoadFunc *load,
+                                     void *opaque)
+{
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    assert(!bitmap->load);
+    bitmap->load = load;
+    bitmap->load_opaque = opaque;
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
+bool bdrv_dirty_bitmap_lazy(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->load;
+}
+
+/**
+ * bdrv_dirty_bitmap_load: merge the stored bits of a lazily loaded bitmap
+ * into its in-memory state.  Does nothing if there are none left.
+ *
+ * Writes that happened in the meantime have only set bits in memory, so the
+ * stored bits are read into a temporary bitmap and ORed in.  On failure the
+ * bitmap is left as it was and a later call retries.
+ *
+ * Called with BQL taken, outside bdrv_dirty_bitmap_lock..unlock.
+ */
+int bdrv_dirty_bitmap_load(BdrvDirtyBitmap *bitmap, Error **errp)
+{
+    BlockDriverState *bs = bitmap->bs;
+    AioContext *ctx;
+    BdrvDirtyBitmap *tmp;
+    int ret;
+
+    if (!bitmap->load) {
+        return 0;
+    }
+
+    ctx = bdrv_get_aio_context(bs);
+    aio_context_acquire(ctx);
+
+    tmp = bdrv_create_dirty_bitmap(bs, bdrv_dirty_bitmap_granularity(bitmap),
+                                   NULL, errp);
+    if (!tmp) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    bdrv_disable_dirty_bitmap(tmp);
+
+    ret = bitmap->load(tmp, bitmap->load_opaque, errp);
+    if (ret < 0) {
+        goto out_release;
+    }
+
+    bdrv_dirty_bitmaps_lock(bs);
+    hbitmap_merge(bitmap->bitmap, tmp->bitmap, bitmap->bitmap);
+    bitmap->load = NULL;
+    g_free(bitmap->load_opaque);
+    bitmap->load_opaque = NULL;
+    bdrv_dirty_bitmaps_unlock(bs);
+    trace_bdrv_dirty_bitmap_load(bitmap);
+
+out_release:
+    bdrv_release_dirty_bitmap(tmp);
+out:
+    aio_context_release(ctx);
+    return ret;
+}
+
 /* Called within bdrv_dirty_bitmap_lock..unlock */
 bool bdrv_dirty_bitmap_get_locked(BdrvDirtyBitmap *bitmap, int64_t offset)
 {
@@ -700,7 +795,13 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
     bdrv_dirty_bitmaps_lock(bitmap->bs);
     if (!out) {
         hbitmap_reset_all(bitmap->bitmap);
+        /* The stored bits are cleared too */
+        bitmap->load = NULL;
+        g_free(bitmap->load_opaque);
+        bitmap->load_opaque = NULL;
     } else {
+        /* @out could not restore the stored bits */
+        assert(!bitmap->load);
         HBitmap *backup = bitmap->bitmap;
         bitmap->bitmap = hbitmap_alloc(bitmap->size,
                                        hbitmap_granularity(backup));
@@ -0,0 +1,709 @@
+/*
+ * Sharing QEMU block devices via vhost-user protocol
+ *
+ * Parts of the code based on nbd/server.c and the vhost-user-blk sample in
+ * contrib/vhost-user-blk.
+ *
+ * Copyright (c) 2017 Intel Corporation. All rights reserved.
+ * Copyright (c) 2020 Red Hat, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "contrib/libvhost-user/libvhost-user.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "io/channel-socket.h"
+#include "io/net-listener.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "sysemu/block-backend.h"
+#include "vhost-user-blk-server.h"
+
+enum {
+    VHOST_USER_BLK_NUM_QUEUES_DEFAULT = 1,
+    VHOST_USER_BLK_MAX_QUEUES = 1024,
+    VHOST_USER_BLK_MAX_DISCARD_SECTORS = 32768,
+    VHOST_USER_BLK_MAX_WRITE_ZEROES_SECTORS = 32768,
+};
+
+struct virtio_blk_inhdr {
+    unsigned char status;
+};
+
+typedef struct VuBlkExport VuBlkExport;
+
+typedef struct VuBlkReq {
+    VuVirtqElement elem;        /* must be first, allocated by libvhost-user */
+    struct virtio_blk_inhdr *in;
+    struct virtio_blk_outhdr out;
+    size_t in_len;
+    VuBlkExport *vexp;
+    VuVirtq *vq;
+} VuBlkReq;
+
+/* An fd that libvhost-user asked us to watch, i.e. a virtqueue kick fd */
+typedef struct VuBlkWatch {
+    VuBlkExport *vexp;
+    int fd;
+    vu_watch_cb cb;
+    void *pvt;
+    QTAILQ_ENTRY(VuBlkWatch) next;
+} VuBlkWatch;
+
+struct VuBlkExport {
+    BlockExport export;
+
+    QIONetListener *listener;
+    struct virtio_blk_config blkcfg;
+    uint32_t blk_size;
+    uint16_t num_queues;
+    bool writable;
+
+    /*
+     * The connected vhost-user master, if any.  vhost-user is a 1:1
+     * protocol, so further connections are refused while one is active.
+     *
+     * All of the fields below are only accessed with export.ctx held.
+     */
+    QIOChannelSocket *sioc;
+    VuDev vu_dev;
+    QTAILQ_HEAD(, VuBlkWatch) watches;
+
+    /*
+     * Set once the connection is going away.  vu_dev is torn down only after
+     * the last request has completed, because requests reference guest memory
+     * that vu_deinit() unmaps.
+     */
+    bool closing;
+    unsigned int in_flight;
+};
+
+static void vu_blk_set_handlers(VuBlkExport *vexp, bool enable);
+
+/* Runs in the main thread */
+static void vu_blk_close_bh(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    AioContext *ctx = vexp->export.ctx;
+    VuBlkWatch *watch, *next;
+
+    aio_context_acquire(ctx);
+
+    assert(vexp->closing && vexp->in_flight == 0);
+
+    /* The handlers are gone already, vu_deinit() closes the fds */
+    QTAILQ_FOREACH_SAFE(watch, &vexp->watches, next, next) {
+        QTAILQ_REMOVE(&vexp->watches, watch, next);
+        g_free(watch);
+    }
+
+    /* The socket is owned by sioc, don't let libvhost-user close it */
+    vexp->vu_dev.sock = -1;
+    vu_deinit(&vexp->vu_dev);
+
+    object_unref(OBJECT(vexp->sioc));
+    vexp->sioc = NULL;
+    vexp->closing = false;
+
+    /* Drop the reference taken for the connection in vu_blk_accept() */
+    blk_exp_unref(&vexp->export);
+
+    aio_context_release(ctx);
+}
+
+static void vu_blk_disconnect(VuBlkExport *vexp)
+{
+    if (!vexp->sioc || vexp->closing) {
+        return;
+    }
+
+    vexp->closing = true;
+    vu_blk_set_handlers(vexp, false);
+    qio_channel_shutdown(QIO_CHANNEL(vexp->sioc), QIO_CHANNEL_SHUTDOWN_BOTH,
+                         NULL);
+
+    if (vexp->in_flight == 0) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), vu_blk_close_bh, vexp);
+    }
+}
+
+static void vu_blk_req_done(VuBlkExport *vexp)
+{
+    assert(vexp->in_flight > 0);
+    if (--vexp->in_flight == 0 && vexp->closing) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), vu_blk_close_bh, vexp);
+    }
+}
+
+static void vu_blk_req_complete(VuBlkReq *req)
+{
+    VuBlkExport *vexp = req->vexp;
+    VuDev *vu_dev = &vexp->vu_dev;
+
+    if (!vexp->closing) {
+        vu_queue_push(vu_dev, req->vq, &req->elem, req->in_len);
+        vu_queue_notify(vu_dev, req->vq);
+    }
+
+    free(req);
+    vu_blk_req_done(vexp);
+}
+
+static bool vu_blk_sect_range_ok(VuBlkExport *vexp, uint64_t sector,
+                                 size_t size)
+{
+    uint64_t nb_sectors = size >> BDRV_SECTOR_BITS;
+    uint64_t total_sectors;
+
+    if (nb_sectors > BDRV_REQUEST_MAX_SECTORS) {
+        return false;
+    }
+    if ((sector << BDRV_SECTOR_BITS) % vexp->blk_size ||
+        size % vexp->blk_size)
+    {
+        return false;
+    }
+
+    blk_get_geometry(vexp->export.blk, &total_sectors);
+    if (sector > total_sectors || nb_sectors > total_sectors - sector) {
+        return false;
+    }
+
+    return true;
+}
+
+static int coroutine_fn
+vu_blk_discard_write_zeroes(VuBlkExport *vexp, struct iovec *iov,
+                            uint32_t iovcnt, uint32_t type)
+{
+    BlockBackend *blk = vexp->export.blk;
+    struct virtio_blk_discard_write_zeroes desc;
+    uint64_t sector;
+    uint32_t num_sectors, flags;
+    int64_t offset;
+    int bytes;
+    int ret;
+
+    /* Only one range is supported, see max_discard_seg/max_write_zeroes_seg */
+    if (iov_to_buf(iov, iovcnt, 0, &desc, sizeof(desc)) != sizeof(desc)) {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    sector = le64_to_cpu(desc.sector);
+    num_sectors = le32_to_cpu(desc.num_sectors);
+    flags = le32_to_cpu(desc.flags);
+
+    if (num_sectors > (type == VIRTIO_BLK_T_DISCARD ?
+                       VHOST_USER_BLK_MAX_DISCARD_SECTORS :
+                       VHOST_USER_BLK_MAX_WRITE_ZEROES_SECTORS) ||
+        !vu_blk_sect_range_ok(vexp, sector,
+                              (uint64_t)num_sectors << BDRV_SECTOR_BITS))
+    {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    offset = sector << BDRV_SECTOR_BITS;
+    bytes = num_sectors << BDRV_SECTOR_BITS;
+
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        if (flags) {
+            return VIRTIO_BLK_S_UNSUPP;
+        }
+        ret = blk_co_pdiscard(blk, offset, bytes);
+    } else {
+        BdrvRequestFlags blk_flags = 0;
+
+        if (flags & ~VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
+            return VIRTIO_BLK_S_UNSUPP;
+        }
+        if (flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
+            blk_flags |= BDRV_REQ_MAY_UNMAP;
+        }
+        ret = blk_co_pwrite_zeroes(blk, offset, bytes, blk_flags);
+    }
+
+    return ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+}
+
+/* Request parsing follows hw/block/virtio-blk.c */
+static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
+{
+    VuBlkReq *req = opaque;
+    VuBlkExport *vexp = req->vexp;
+    BlockBackend *blk = vexp->export.blk;
+    VuVirtqElement *elem = &req->elem;
+    struct iovec *in_iov = elem->in_sg;
+    struct iovec *out_iov = elem->out_sg;
+    unsigned in_num = elem->in_num;
+    unsigned out_num = elem->out_num;
+    uint32_t type;
+    uint8_t status;
+
+    if (out_num < 1 || in_num < 1) {
+        error_report("virtio-blk request missing headers");
+        goto fail;
+    }
+
+    if (iov_to_buf(out_iov, out_num, 0, &req->out,
+                   sizeof(req->out)) != sizeof(req->out))
+    {
+        error_report("virtio-blk request outhdr too short");
+        goto fail;
+    }
+    iov_discard_front(&out_iov, &out_num, sizeof(req->out));
+
+    if (in_iov[in_num - 1].iov_len < sizeof(struct virtio_blk_inhdr)) {
+        error_report("virtio-blk request inhdr too short");
+        goto fail;
+    }
+
+    /* The status byte is the last one, so all of in_iov is reported used */
+    req->in_len = iov_size(in_iov, in_num);
+    req->in = (void *)in_iov[in_num - 1].iov_base
+              + in_iov[in_num - 1].iov_len
+              - sizeof(struct virtio_blk_inhdr);
+    iov_discard_back(in_iov, &in_num, sizeof(struct virtio_blk_inhdr));
+
+    type = le32_to_cpu(req->out.type);
+    switch (type & ~VIRTIO_BLK_T_BARRIER) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+        bool is_write = type & VIRTIO_BLK_T_OUT;
+        uint64_t sector = le64_to_cpu(req->out.sector);
+        QEMUIOVector qiov;
+        int ret;
+
+        if (is_write && !vexp->writable) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+
+        if (is_write) {
+            qemu_iovec_init_external(&qiov, out_iov, out_num);
+        } else {
+            qemu_iovec_init_external(&qiov, in_iov, in_num);
+        }
+
+        if (!vu_blk_sect_range_ok(vexp, sector, qiov.size)) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+
+        if (is_write) {
+            ret = blk_co_pwritev(blk, sector << BDRV_SECTOR_BITS, qiov.size,
+                                 &qiov, 0);
+        } else {
+            ret = blk_co_preadv(blk, sector << BDRV_SECTOR_BITS, qiov.size,
+                                &qiov, 0);
+        }
+        status = ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+        break;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+        status = blk_co_flush(blk) < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+        break;
+    case VIRTIO_BLK_T_GET_ID: {
+        char id[VIRTIO_BLK_ID_BYTES];
+
+        strpadcpy(id, sizeof(id), vexp->export.id, '\0');
+        iov_from_buf(in_iov, in_num, 0, id, sizeof(id));
+        status = VIRTIO_BLK_S_OK;
+        break;
+    }
+    case VIRTIO_BLK_T_DISCARD:
+    case VIRTIO_BLK_T_WRITE_ZEROES:
+        if (!vexp->writable) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+        status = vu_blk_discard_write_zeroes(vexp, out_iov, out_num, type);
+        break;
+    default:
+        status = VIRTIO_BLK_S_UNSUPP;
+        break;
+    }
+
+    req->in->status = status;
+    vu_blk_req_complete(req);
+    return;
+
+fail:
+    free(req);
+    vu_blk_req_done(vexp);
+}
+
+/* Called with export.ctx held, from the kick fd handler */
+static void vu_blk_process_vq(VuDev *vu_dev, int idx)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    VuVirtq *vq = vu_get_queue(vu_dev, idx);
+
+    while (!vexp->closing) {
+        VuBlkReq *req;
+        Coroutine *co;
+
+        req = vu_queue_pop(vu_dev, vq, sizeof(VuBlkReq));
+        if (!req) {
+            break;
+        }
+
+        req->vexp = vexp;
+        req->vq = vq;
+        vexp->in_flight++;
+
+        co = qemu_coroutine_create(vu_blk_virtio_process_req, req);
+        aio_co_enter(vexp->export.ctx, co);
+    }
+}
+
+static void vu_blk_queue_set_started(VuDev *vu_dev, int idx, bool started)
+{
+    VuVirtq *vq = vu_get_queue(vu_dev, idx);
+
+    vu_set_queue_handler(vu_dev, vq, started ? vu_blk_process_vq : NULL);
+}
+
+static uint64_t vu_blk_get_features(VuDev *vu_dev)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    uint64_t features;
+
+    features = 1ull << VIRTIO_BLK_F_SEG_MAX |
+               1ull << VIRTIO_BLK_F_TOPOLOGY |
+               1ull << VIRTIO_BLK_F_BLK_SIZE |
+               1ull << VIRTIO_BLK_F_FLUSH |
+               1ull << VIRTIO_BLK_F_CONFIG_WCE |
+               1ull << VIRTIO_BLK_F_MQ;
+
+    if (vexp->writable) {
+        features |= 1ull << VIRTIO_BLK_F_DISCARD |
+                    1ull << VIRTIO_BLK_F_WRITE_ZEROES;
+    } else {
+        features |= 1ull << VIRTIO_BLK_F_RO;
+    }
+
+    return features;
+}
+
+static int vu_blk_get_config(VuDev *vu_dev, uint8_t *config, uint32_t len)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    int64_t length;
+
+    if (len > sizeof(vexp->blkcfg)) {
+        return -1;
+    }
+
+    /* Pick up resizes of the exported node */
+    length = blk_getlength(vexp->export.blk);
+    if (length >= 0) {
+        vexp->blkcfg.capacity = cpu_to_le64(length >> BDRV_SECTOR_BITS);
+    }
+
+    memcpy(config, &vexp->blkcfg, len);
+    return 0;
+}
+
+static int vu_blk_set_config(VuDev *vu_dev, const uint8_t *data,
+                             uint32_t offset, uint32_t size, uint32_t flags)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    uint8_t wce;
+
+    /* don't support live migration */
+    if (flags != VHOST_SET_CONFIG_TYPE_MASTER) {
+        return -EINVAL;
+    }
+
+    if (offset != offsetof(struct virtio_blk_config, wce) ||
+        size != 1) {
+        return -EINVAL;
+    }
+
+    wce = *data;
+    vexp->blkcfg.wce = wce;
+    blk_set_enable_write_cache(vexp->export.blk, wce);
+    return 0;
+}
+
+static const VuDevIface vu_blk_iface = {
+    .get_features           = vu_blk_get_features,
+    .queue_set_started      = vu_blk_queue_set_started,
+    .get_config             = vu_blk_get_config,
+    .set_config             = vu_blk_set_config,
+};
+
+static void vu_blk_panic_cb(VuDev *vu_dev, const char *buf)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+
+    error_report("vhost-user-blk export '%s': %s", vexp->export.id, buf);
+    vu_blk_disconnect(vexp);
+}
+
+static void vu_blk_watch_read(void *opaque)
+{
+    VuBlkWatch *watch = opaque;
+    VuBlkExport *vexp = watch->vexp;
+    AioContext *ctx = vexp->export.ctx;
+
+    /* @watch may be freed by the callback */
+    aio_context_acquire(ctx);
+    watch->cb(&vexp->vu_dev, VU_WATCH_IN, watch->pvt);
+    aio_context_release(ctx);
+}
+
+static VuBlkWatch *vu_blk_find_watch(VuBlkExport *vexp, int fd)
+{
+    VuBlkWatch *watch;
+
+    QTAILQ_FOREACH(watch, &vexp->watches, next) {
+        if (watch->fd == fd) {
+            return watch;
+        }
+    }
+    return NULL;
+}
+
+static void vu_blk_set_watch(VuDev *vu_dev, int fd, int vu_evt,
+                             vu_watch_cb cb, void *pvt)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    VuBlkWatch *watch;
+
+    /* libvhost-user only watches kick fds, and only for input */
+    assert(vu_evt == VU_WATCH_IN);
+
+    watch = vu_blk_find_watch(vexp, fd);
+    if (!watch) {
+        watch = g_new0(VuBlkWatch, 1);
+        watch->vexp = vexp;
+        watch->fd = fd;
+        QTAILQ_INSERT_TAIL(&vexp->watches, watch, next);
+    }
+    watch->cb = cb;
+    watch->pvt = pvt;
+
+    if (!vexp->closing) {
+        aio_set_fd_handler(vexp->export.ctx, fd, true, vu_blk_watch_read,
+                           NULL, NULL, watch);
+    }
+}
+
+static void vu_blk_remove_watch(VuDev *vu_dev, int fd)
+{
+    VuBlkExport *vexp = container_of(vu_dev, VuBlkExport, vu_dev);
+    VuBlkWatch *watch;
+
+    watch = vu_blk_find_watch(vexp, fd);
+    if (!watch) {
+        return;
+    }
+
+    aio_set_fd_handler(vexp->export.ctx, fd, true, NULL, NULL, NULL, NULL);
+    QTAILQ_REMOVE(&vexp->watches, watch, next);
+    g_free(watch);
+}
+
+static void vu_blk_client_read(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+    AioContext *ctx = vexp->export.ctx;
+
+    aio_context_acquire(ctx);
+    if (!vu_dispatch(&vexp->vu_dev)) {
+        vu_blk_disconnect(vexp);
+    }
+    aio_context_release(ctx);
+}
+
+/*
+ * Registers (or unregisters) the vhost-user socket and the kick fds in
+ * export.ctx.  Both are external so that a drained section also stops new
+ * requests from being submitted.
+ */
+static void vu_blk_set_handlers(VuBlkExport *vexp, bool enable)
+{
+    AioContext *ctx = vexp->export.ctx;
+    VuBlkWatch *watch;
+
+    aio_set_fd_handler(ctx, vexp->sioc->fd, true,
+                       enable ? vu_blk_client_read : NULL, NULL, NULL, vexp);
+
+    QTAILQ_FOREACH(watch, &vexp->watches, next) {
+        aio_set_fd_handler(ctx, watch->fd, true,
+                           enable ? vu_blk_watch_read : NULL, NULL, NULL,
+                           watch);
+    }
+}
+
+static void vu_blk_attach_aio_context(AioContext *ctx, void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    vexp->export.ctx = ctx;
+    if (vexp->sioc && !vexp->closing) {
+        vu_blk_set_handlers(vexp, true);
+    }
+}
+
+static void vu_blk_detach_aio_context(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    if (vexp->sioc && !vexp->closing) {
+        vu_blk_set_handlers(vexp, false);
+    }
+}
+
+/* Runs in the main thread */
+static void vu_blk_accept(QIONetListener *listener, QIOChannelSocket *sioc,
+                          gpointer opaque)
+{
+    VuBlkExport *vexp = opaque;
+    AioContext *ctx = vexp->export.ctx;
+
+    aio_context_acquire(ctx);
+
+    if (vexp->sioc) {
+        error_report("vhost-user-blk export '%s' is already connected, "
+                     "refusing another connection", vexp->export.id);
+        goto out;
+    }
+
+    /*
+     * libvhost-user reads whole messages at a time from the socket; it is
+     * only read when there is data, so blocking mode costs nothing.
+     */
+    qio_channel_set_name(QIO_CHANNEL(sioc), "vhost-user-blk-client");
+    if (qio_channel_set_blocking(QIO_CHANNEL(sioc), true, NULL) < 0) {
+        goto out;
+    }
+
+    if (!vu_init(&vexp->vu_dev, vexp->num_queues, sioc->fd, vu_blk_panic_cb,
+                 vu_blk_set_watch, vu_blk_remove_watch, &vu_blk_iface)) {
+        error_report("vhost-user-blk export '%s': Failed to initialize "
+                     "libvhost-user", vexp->export.id);
+        goto out;
+    }
+
+    object_ref(OBJECT(sioc));
+    vexp->sioc = sioc;
+    blk_exp_ref(&vexp->export);
+    vu_blk_set_handlers(vexp, true);
+
+out:
+    aio_context_release(ctx);
+}
+
+static void vu_blk_initialize_config(VuBlkExport *vexp)
+{
+    struct virtio_blk_config *config = &vexp->blkcfg;
+    int64_t length = blk_getlength(vexp->export.blk);
+
+    config->capacity = cpu_to_le64(MAX(length, 0) >> BDRV_SECTOR_BITS);
+    config->blk_size = cpu_to_le32(vexp->blk_size);
+    config->seg_max = cpu_to_le32(128 - 2);
+    config->min_io_size = cpu_to_le16(1);
+    config->opt_io_size = cpu_to_le32(1);
+    config->num_queues = cpu_to_le16(vexp->num_queues);
+    config->wce = blk_enable_write_cache(vexp->export.blk);
+    config->max_discard_sectors =
+        cpu_to_le32(VHOST_USER_BLK_MAX_DISCARD_SECTORS);
+    config->max_discard_seg = cpu_to_le32(1);
+    config->discard_sector_alignment =
+        cpu_to_le32(vexp->blk_size >> BDRV_SECTOR_BITS);
+    config->max_write_zeroes_sectors =
+        cpu_to_le32(VHOST_USER_BLK_MAX_WRITE_ZEROES_SECTORS);
+    config->max_write_zeroes_seg = cpu_to_le32(1);
+}
+
+static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
+                             Error **errp)
+{
+    VuBlkExport *vexp = container_of(exp, VuBlkExport, export);
+    BlockExportOptionsVhostUserBlk *vu_opts = &opts->u.vhost_user_blk;
+    uint64_t logical_block_size = BDRV_SECTOR_SIZE;
+    uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
+
+    if (vu_opts->addr->type != SOCKET_ADDRESS_TYPE_UNIX &&
+        vu_opts->addr->type != SOCKET_ADDRESS_TYPE_FD) {
+        error_setg(errp, "vhost-user-blk exports only support 'unix' and "
+                   "'fd' socket addresses");
+        return -EINVAL;
+    }
+
+    if (vu_opts->has_logical_block_size) {
+        logical_block_size = vu_opts->logical_block_size;
+    }
+    if (logical_block_size < BDRV_SECTOR_SIZE ||
+        logical_block_size > 32768 ||
+        !is_power_of_2(logical_block_size)) {
+        error_setg(errp, "logical-block-size must be a power of two between "
+                   "512 and 32768");
+        return -EINVAL;
+    }
+
+    if (vu_opts->has_num_queues) {
+        num_queues = vu_opts->num_queues;
+    }
+    if (num_queues == 0 || num_queues > VHOST_USER_BLK_MAX_QUEUES) {
+        error_setg(errp, "num-queues must be between 1 and %d",
+                   VHOST_USER_BLK_MAX_QUEUES);
+        return -EINVAL;
+    }
+
+    vexp->writable = opts->writable;
+    vexp->blk_size = logical_block_size;
+    vexp->num_queues = num_queues;
+    QTAILQ_INIT(&vexp->watches);
+
+    blk_set_guest_block_size(exp->blk, logical_block_size);
+    vu_blk_initialize_config(vexp);
+
+    vexp->listener = qio_net_listener_new();
+    qio_net_listener_set_name(vexp->listener, "vhost-user-blk-listener");
+    if (qio_net_listener_open_sync(vexp->listener, vu_opts->addr, 1,
+                                   errp) < 0) {
+        object_unref(OBJECT(vexp->listener));
+        return -EADDRNOTAVAIL;
+    }
+    qio_net_listener_set_client_func(vexp->listener, vu_blk_accept, vexp,
+                                     NULL);
+
+    blk_add_aio_context_notifier(exp->blk, vu_blk_attach_aio_context,
+                                 vu_blk_detach_aio_context, vexp);
+    return 0;
+}
+
+static void vu_blk_exp_delete(BlockExport *exp)
+{
+    VuBlkExport *vexp = container_of(exp, VuBlkExport, export);
+
+    assert(!vexp->sioc);
+    blk_remove_aio_context_notifier(exp->blk, vu_blk_attach_aio_context,
+                                    vu_blk_detach_aio_context, vexp);
+    object_unref(OBJECT(vexp->listener));
+}
+
+static void vu_blk_exp_request_shutdown(BlockExport *exp)
+{
+    VuBlkExport *vexp = container_of(exp, VuBlkExport, export);
+
+    qio_net_listener_disconnect(vexp->listener);
+    vu_blk_disconnect(vexp);
+}
+
+const BlockExportDriver blk_exp_vhost_user_blk = {
+    .type               = BLOCK_EXPORT_TYPE_VHOST_USER_BLK,
+    .instance_size      = sizeof(VuBlkExport),
+    .create             = vu_blk_exp_create,
+    .delete             = vu_blk_exp_delete,
+    .request_shutdown   = vu_blk_exp_request_shutdown,
+};
@@ -132,6 +132,47 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/* Number of extents remembered from SEEK_DATA/SEEK_HOLE lookups */
+#define RAW_EXTENT_CACHE_SIZE          16
+/* How long they are trusted if other users may write to the file */
+#define RAW_EXTENT_CACHE_SHARED_TTL_NS (100 * SCALE_MS)
+
+/*
+ * A data extent or hole found by find_allocation().  Unused entries have
+ * start == end.
+ */
+typedef struct RawExtent {
+    int64_t start;
+    int64_t end;
+    int64_t expire_ns;          /* 0 if it only changes through us */
+    bool data;
+} RawExtent;
+
+/*
+ * Largest request that adjacent or overlapping discard and write-zeroes
+ * requests are merged into.
+ */
+#define RAW_COALESCE_MAX_BYTES (1 * GiB)
+
+/*
+ * A discard or write-zeroes request that other requests of the same kind
+ * can still be merged into, see raw_co_coalesced_submit().
+ */
+typedef struct RawCoalescedReq {
+    int aio_type;
+    ThreadPoolFunc *handler;
+    int64_t offset;
+    int64_t end;
+    int ret;
+    unsigned int refcnt;
+
+    /* Coroutine that submits the merged request once it is woken up */
+    Coroutine *co;
+    /* Coroutines whose requests were merged into this one */
+    CoQueue waiters;
+    QTAILQ_ENTRY(RawCoalescedReq) next;
+} RawCoalescedReq;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -160,17 +201,49 @@ typedef struct BDRVRawState {
     bool discard_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+    bool use_linux_io_uring_fixed:1;
+    bool use_linux_io_uring_sqpoll:1;
     bool page_cache_inconsistent:1;
     bool has_fallocate;
     bool needs_alignment;
     bool drop_cache;
     bool check_cache_dropped;
+    int luring_fixed_fd;        /* fd registered with io_uring, or -1 */
+    int luring_sq_cpu;          /* SQPOLL thread CPU, or -1 */
+    bool luring_discard;        /* IORING_OP_FALLOCATE works for discards */
     struct {
         uint64_t discard_nb_ok;
         uint64_t discard_nb_failed;
         uint64_t discard_bytes_ok;
     } stats;
 
+    /*
+     * lseek(SEEK_DATA/SEEK_HOLE) can be slow and serialize against writes
+     * on some filesystems, so raw_co_block_status() caches its results.
+     * Our own writes, discards and truncation invalidate them.
+     */
+    RawExtent extent_cache[RAW_EXTENT_CACHE_SIZE];
+    unsigned extent_cache_next;
+
+    /*
+     * Discard and write-zeroes requests that arrive while the queue is
+     * plugged or while another one is in flight wait here, so that
+     * adjacent ones can be merged.
+     */
+    QTAILQ_HEAD(, RawCoalescedReq) coalesce_pending;
+    unsigned int coalesce_in_flight;
+    bool plugged;
+
+    /*
+     * SG_IO requests on an sg character device are submitted with write()
+     * and reaped with read(), see raw_sg_co_submit(), rather than taking a
+     * thread pool worker each for a blocking ioctl.
+     */
+    bool use_sg_async;
+    unsigned int sg_in_flight;
+    /* Requests waiting for the sg driver to accept more commands */
+    CoQueue sg_queue;
+
     PRManager *pr_mgr;
 } BDRVRawState;
 
@@ -183,6 +256,11 @@ typedef struct BDRVRawReopenState {
 
 static int fd_open(BlockDriverState *bs);
 static int64_t raw_getlength(BlockDriverState *bs);
+static void raw_extent_cache_invalidate(BDRVRawState *s, int64_t offset,
+                                        int64_t bytes);
+static void raw_extent_cache_clear(BDRVRawState *s);
+static void raw_sg_set_fd_handler(BlockDriverState *bs, AioContext *ctx,
+                                  bool enable);
 
 typedef struct RawPosixAIOData {
     BlockDriverState *bs;
@@ -527,12 +605,63 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-fixed",
+            .type = QEMU_OPT_BOOL,
+            .help = "use io_uring fixed files and buffers (default: off)",
+        },
+        {
+            .name = "aio-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "use an io_uring submission queue polling thread "
+                    "(default: off)",
+        },
+        {
+            .name = "aio-sq-cpu",
+            .type = QEMU_OPT_NUMBER,
+            .help = "host CPU for the submission queue polling thread",
+        },
+#endif
         { /* end of list */ }
     },
 };
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Keep the io_uring registered file in sync with s->fd.  The old fd is always
+ * unregistered first because the kernel holds a reference to registered files
+ * and a recycled fd number would otherwise refer to the wrong file.
+ */
+static void raw_luring_update_fixed_file(BlockDriverState *bs, bool enable)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *aio;
+
+    if (!s->use_linux_io_uring || !s->use_linux_io_uring_fixed) {
+        return;
+    }
+
+    aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+    if (s->luring_fixed_fd >= 0) {
+        luring_unregister_file(aio, s->luring_fixed_fd);
+        s->luring_fixed_fd = -1;
+    }
+    if (enable && s->fd >= 0) {
+        luring_enable_fixed_buffers(aio);
+        if (luring_register_file(aio, s->fd) == 0) {
+            s->luring_fixed_fd = s->fd;
+        }
+    }
+}
+#else
+static void raw_luring_update_fixed_file(BlockDriverState *bs, bool enable)
+{
+}
+#endif
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -579,9 +708,41 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
+    s->luring_fixed_fd = -1;
+    s->luring_discard = true;
+    QTAILQ_INIT(&s->coalesce_pending);
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_linux_io_uring_fixed = qemu_opt_get_bool(opts, "aio-fixed", false);
+    if (s->use_linux_io_uring_fixed && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->use_linux_io_uring_sqpoll = qemu_opt_get_bool(opts, "aio-sqpoll",
+                                                     false);
+    if (s->use_linux_io_uring_sqpoll && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-sqpoll requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->luring_sq_cpu = -1;
+    if (qemu_opt_get(opts, "aio-sq-cpu")) {
+        uint64_t sq_cpu = qemu_opt_get_number(opts, "aio-sq-cpu", 0);
+
+        if (!s->use_linux_io_uring_sqpoll) {
+            error_setg(errp, "aio-sq-cpu requires aio-sqpoll=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (sq_cpu > INT_MAX) {
+            error_setg(errp, "aio-sq-cpu is out of range");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->luring_sq_cpu = sq_cpu;
+    }
 #endif
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
@@ -678,7 +839,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs),
+                                      s->use_linux_io_uring_sqpoll,
+                                      s->luring_sq_cpu, errp)) {
             error_prepend(errp, "Unable to use io_uring: ");
             goto fail;
         }
@@ -770,6 +933,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+    raw_luring_update_fixed_file(bs, true);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1128,8 +1292,16 @@ static void raw_reopen_commit(BDRVReopenState *state)
     s->check_cache_dropped = rs->check_cache_dropped;
     s->open_flags = rs->open_flags;
 
+    raw_sg_set_fd_handler(state->bs, bdrv_get_aio_context(state->bs), false);
+    raw_luring_update_fixed_file(state->bs, false);
     qemu_close(s->fd);
     s->fd = rs->fd;
+    raw_luring_update_fixed_file(state->bs, true);
+    if ((s->open_flags & O_ACCMODE) != O_RDWR) {
+        s->use_sg_async = false;
+    }
+    raw_sg_set_fd_handler(state->bs, bdrv_get_aio_context(state->bs), true);
+    raw_extent_cache_clear(s);
 
     g_free(state->opaque);
     state->opaque = NULL;
@@ -2030,13 +2202,28 @@ static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                        uint64_t bytes, QEMUIOVector *qiov,
                                        int flags)
 {
+    BDRVRawState *s = bs->opaque;
+    int ret;
+
     assert(flags == 0);
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    ret = raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+
+    /*
+     * Invalidate on completion: a lookup while the write was in flight may
+     * still have seen the old hole.  Also on failure, the write may have
+     * partially happened.
+     */
+    raw_extent_cache_invalidate(s, offset, bytes);
+    return ret;
 }
 
+static void raw_coalesce_kick(BDRVRawState *s);
+
 static void raw_aio_plug(BlockDriverState *bs)
 {
-    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+    BDRVRawState *s = bs->opaque;
+
+    s->plugged = true;
 #ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
@@ -2053,7 +2240,14 @@ static void raw_aio_plug(BlockDriverState *bs)
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
-    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+    BDRVRawState *s = bs->opaque;
+
+    /*
+     * Start the merged discards first so that with io_uring they are still
+     * batched into the same submission as the other plugged requests.
+     */
+    s->plugged = false;
+    raw_coalesce_kick(s);
 #ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
@@ -2094,10 +2288,114 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+#if defined(__linux__)
+typedef struct RawSgRequest {
+    struct sg_io_hdr *io_hdr;
+    void *usr_ptr;              /* the caller's, while ours is in io_hdr */
+    Coroutine *co;
+    bool done;
+} RawSgRequest;
+
+static void raw_sg_read(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVRawState *s = bs->opaque;
+    struct sg_io_hdr io_hdr;
+    RawSgRequest *req;
+    int waiting = 0;
+    ssize_t len;
+
+    /*
+     * Only read what is known to be complete: read() blocks otherwise, and
+     * the fd stays blocking because the thread pool may still use it.
+     */
+    if (ioctl(s->fd, SG_GET_NUM_WAITING, &waiting) < 0) {
+        return;
+    }
+
+    while (waiting-- > 0) {
+        do {
+            len = read(s->fd, &io_hdr, sizeof(io_hdr));
+        } while (len < 0 && errno == EINTR);
+        if (len < 0) {
+            break;
+        }
+
+        req = io_hdr.usr_ptr;
+        io_hdr.usr_ptr = req->usr_ptr;
+        *req->io_hdr = io_hdr;
+        req->done = true;
+
+        s->sg_in_flight--;
+        qemu_co_enter_next(&s->sg_queue, NULL);
+        aio_co_wake(req->co);
+    }
+}
+
+static void raw_sg_set_fd_handler(BlockDriverState *bs, AioContext *ctx,
+                                  bool enable)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_sg_async) {
+        aio_set_fd_handler(ctx, s->fd, false,
+                           enable ? raw_sg_read : NULL, NULL, NULL, bs);
+    }
+}
+
+/*
+ * Submit an SG_IO request through the asynchronous interface of the sg
+ * driver.  The driver completes the commands it accepted in any order, so
+ * usr_ptr identifies them; it is the caller's again on return.
+ */
+static int coroutine_fn raw_sg_co_submit(BlockDriverState *bs,
+                                         struct sg_io_hdr *io_hdr)
+{
+    BDRVRawState *s = bs->opaque;
+    RawSgRequest req = {
+        .io_hdr = io_hdr,
+        .usr_ptr = io_hdr->usr_ptr,
+        .co = qemu_coroutine_self(),
+    };
+    ssize_t len;
+
+    io_hdr->usr_ptr = &req;
+    for (;;) {
+        len = write(s->fd, io_hdr, sizeof(*io_hdr));
+        if (len >= 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EDOM && s->sg_in_flight) {
+            /* The per-fd command queue of the driver is full */
+            qemu_co_queue_wait(&s->sg_queue, NULL);
+            continue;
+        }
+        io_hdr->usr_ptr = req.usr_ptr;
+        return -errno;
+    }
+
+    s->sg_in_flight++;
+    while (!req.done) {
+        qemu_coroutine_yield();
+    }
+    return 0;
+}
+#else
+static void raw_sg_set_fd_handler(BlockDriverState *bs, AioContext *ctx,
+                                  bool enable)
+{
+}
+#endif
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
     BDRVRawState __attribute__((unused)) *s = bs->opaque;
+
+    raw_sg_set_fd_handler(bs, new_context, true);
 #ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
         Error *local_err = NULL;
@@ -2110,20 +2408,31 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        Error *local_err;
-        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+        Error *local_err = NULL;
+        if (!aio_setup_linux_io_uring(new_context,
+                                      s->use_linux_io_uring_sqpoll,
+                                      s->luring_sq_cpu, &local_err)) {
             error_reportf_err(local_err, "Unable to use linux io_uring, "
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
         }
     }
+    raw_luring_update_fixed_file(bs, true);
 #endif
 }
 
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    raw_sg_set_fd_handler(bs, bdrv_get_aio_context(bs), false);
+    raw_luring_update_fixed_file(bs, false);
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    raw_sg_set_fd_handler(bs, bdrv_get_aio_context(bs), false);
+    raw_luring_update_fixed_file(bs, false);
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -2172,7 +2481,9 @@ static int coroutine_fn raw_co_truncate(BlockDriverState *bs, int64_t offset,
 
     if (S_ISREG(st.st_mode)) {
         /* Always resizes to the exact @offset */
-        return raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        ret = raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        raw_extent_cache_clear(s);
+        return ret;
     }
 
     if (prealloc != PREALLOC_MODE_OFF) {
@@ -2584,6 +2895,68 @@ static int coroutine_fn raw_co_delete_file(BlockDriverState *bs,
     return ret;
 }
 
+static void raw_extent_cache_invalidate(BDRVRawState *s, int64_t offset,
+                                        int64_t bytes)
+{
+    int i;
+
+    for (i = 0; i < RAW_EXTENT_CACHE_SIZE; i++) {
+        RawExtent *e = &s->extent_cache[i];
+
+        if (e->start < offset + bytes && offset < e->end) {
+            e->start = e->end = 0;
+        }
+    }
+}
+
+static void raw_extent_cache_clear(BDRVRawState *s)
+{
+    memset(s->extent_cache, 0, sizeof(s->extent_cache));
+}
+
+static RawExtent *raw_extent_cache_find(BDRVRawState *s, int64_t offset)
+{
+    int64_t now = 0;
+    int i;
+
+    for (i = 0; i < RAW_EXTENT_CACHE_SIZE; i++) {
+        RawExtent *e = &s->extent_cache[i];
+
+        if (e->start > offset || offset >= e->end) {
+            continue;
+        }
+        if (e->expire_ns) {
+            if (!now) {
+                now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            }
+            if (now >= e->expire_ns) {
+                e->start = e->end = 0;
+                continue;
+            }
+        }
+        return e;
+    }
+    return NULL;
+}
+
+static void raw_extent_cache_add(BDRVRawState *s, int64_t start, int64_t end,
+                                 bool data)
+{
+    RawExtent *e = &s->extent_cache[s->extent_cache_next];
+
+    s->extent_cache_next = (s->extent_cache_next + 1) % RAW_EXTENT_CACHE_SIZE;
+    *e = (RawExtent) {
+        .start = start,
+        .end = end,
+        .data = data,
+    };
+    if (s->shared_perm & BLK_PERM_WRITE) {
+        /* Someone else may fill our holes (or punch new ones) */
+        e->expire_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                       RAW_EXTENT_CACHE_SHARED_TTL_NS;
+    }
+}
+
 /*
  * Find allocation range in @bs around offset @start.
  * May change underlying file descriptor's file offset.
@@ -2679,6 +3052,41 @@ static int find_allocation(BlockDriverState *bs, off_t start,
 #endif
 }
 
+/*
+ * Like find_allocation(), but use and fill the extent cache.  Trailing holes
+ * are not cached because their extent isn't known, and they are cheap to
+ * find anyway.
+ */
+static int find_allocation_cached(BlockDriverState *bs, off_t start,
+                                  off_t *data, off_t *hole)
+{
+    BDRVRawState *s = bs->opaque;
+    RawExtent *e = raw_extent_cache_find(s, start);
+    int ret;
+
+    if (e) {
+        trace_file_extent_cache_hit(bs, start, e->end, e->data);
+        if (e->data) {
+            *data = start;
+            *hole = e->end;
+        } else {
+            *hole = start;
+            *data = e->end;
+        }
+        return 0;
+    }
+
+    ret = find_allocation(bs, start, data, hole);
+    if (ret == 0) {
+        if (*data == start) {
+            raw_extent_cache_add(s, start, *hole, true);
+        } else {
+            raw_extent_cache_add(s, start, *data, false);
+        }
+    }
+    return ret;
+}
+
 /*
  * Returns the allocation status of the specified offset.
  *
@@ -2714,7 +3122,7 @@ static int coroutine_fn raw_co_block_status(BlockDriverState *bs,
         return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
     }
 
-    ret = find_allocation(bs, offset, &data, &hole);
+    ret = find_allocation_cached(bs, offset, &data, &hole);
     if (ret == -ENXIO) {
         /* Trailing hole */
         *pnum = bytes;
@@ -2884,27 +3292,154 @@ static void raw_account_discard(BDRVRawState *s, uint64_t nbytes, int ret)
     }
 }
 
-static coroutine_fn int
-raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+static int coroutine_fn raw_co_fallocate_submit(BlockDriverState *bs,
+                                                int aio_type,
+                                                ThreadPoolFunc *handler,
+                                                int64_t offset, int64_t bytes)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
-    int ret;
+
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    if (aio_type == QEMU_AIO_DISCARD && s->use_linux_io_uring &&
+        s->luring_discard && s->has_discard)
+    {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        int ret = luring_co_submit_discard(bs, aio, s->fd, offset, bytes);
+
+        if (ret != -EINVAL && ret != -EOPNOTSUPP) {
+            return translate_err(ret);
+        }
+        /*
+         * The kernel does not know IORING_OP_FALLOCATE or the filesystem
+         * cannot punch holes; let handle_aiocb_discard() sort it out.
+         */
+        s->luring_discard = false;
+    }
+#endif
 
     acb = (RawPosixAIOData) {
         .bs             = bs,
         .aio_fildes     = s->fd,
-        .aio_type       = QEMU_AIO_DISCARD,
+        .aio_type       = aio_type,
         .aio_offset     = offset,
         .aio_nbytes     = bytes,
     };
 
+    return raw_thread_pool_submit(bs, handler, &acb);
+}
+
+/* Wake up all coalesced requests that are waiting to be submitted */
+static void raw_coalesce_kick(BDRVRawState *s)
+{
+    RawCoalescedReq *req;
+
+    while ((req = QTAILQ_FIRST(&s->coalesce_pending)) != NULL) {
+        QTAILQ_REMOVE(&s->coalesce_pending, req, next);
+        aio_co_wake(req->co);
+    }
+}
+
+static void raw_coalesce_unref(RawCoalescedReq *req)
+{
+    if (--req->refcnt == 0) {
+        g_free(req);
+    }
+}
+
+/*
+ * Submit a discard or write-zeroes request, merging it with adjacent or
+ * overlapping requests of the same kind.
+ *
+ * A guest fstrim issues a storm of small discards, each of which would be
+ * a separate fallocate() in the thread pool.  These serialize on the inode
+ * lock in the host filesystem anyway, so there is little point in running
+ * them concurrently.  Instead, while the queue is plugged or another such
+ * request is in flight, new requests wait in s->coalesce_pending where
+ * later ones can be merged into them.  An idle device does not add any
+ * latency.
+ */
+static int coroutine_fn raw_co_coalesced_submit(BlockDriverState *bs,
+                                                int aio_type,
+                                                ThreadPoolFunc *handler,
+                                                int64_t offset, int bytes)
+{
+    BDRVRawState *s = bs->opaque;
+    RawCoalescedReq *req;
+    int64_t end = offset + bytes;
+    int ret;
+
+    QTAILQ_FOREACH(req, &s->coalesce_pending, next) {
+        if (req->aio_type == aio_type && req->handler == handler &&
+            offset <= req->end && end >= req->offset &&
+            MAX(req->end, end) - MIN(req->offset, offset) <=
+                RAW_COALESCE_MAX_BYTES)
+        {
+            trace_file_coalesce_merge(bs, aio_type, offset, bytes,
+                                      req->offset, req->end - req->offset);
+            req->offset = MIN(req->offset, offset);
+            req->end = MAX(req->end, end);
+            req->refcnt++;
+            qemu_co_queue_wait(&req->waiters, NULL);
+            ret = req->ret;
+            raw_coalesce_unref(req);
+            return ret;
+        }
+    }
+
+    if (s->plugged || s->coalesce_in_flight) {
+        req = g_new(RawCoalescedReq, 1);
+        *req = (RawCoalescedReq) {
+            .aio_type   = aio_type,
+            .handler    = handler,
+            .offset     = offset,
+            .end        = end,
+            .refcnt     = 1,
+            .co         = qemu_coroutine_self(),
+        };
+        qemu_co_queue_init(&req->waiters);
+        QTAILQ_INSERT_TAIL(&s->coalesce_pending, req, next);
+
+        /* Woken up by raw_coalesce_kick() */
+        qemu_coroutine_yield();
+
+        offset = req->offset;
+        end = req->end;
+    } else {
+        req = NULL;
+    }
+
+    trace_file_coalesce_submit(bs, aio_type, offset, end - offset);
+    s->coalesce_in_flight++;
+    ret = raw_co_fallocate_submit(bs, aio_type, handler, offset, end - offset);
+    s->coalesce_in_flight--;
+
+    if (req) {
+        req->ret = ret;
+        qemu_co_queue_restart_all(&req->waiters);
+        raw_coalesce_unref(req);
+    }
+    if (!s->plugged) {
+        raw_coalesce_kick(s);
+    }
+    return ret;
+}
+
+static coroutine_fn int
+raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+{
+    BDRVRawState *s = bs->opaque;
+    int aio_type = QEMU_AIO_DISCARD;
+    int ret;
+
     if (blkdev) {
-        acb.aio_type |= QEMU_AIO_BLKDEV;
+        aio_type |= QEMU_AIO_BLKDEV;
     }
 
-    ret = raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
+    ret = raw_co_coalesced_submit(bs, aio_type, handle_aiocb_discard,
+                                  offset, bytes);
     raw_account_discard(s, bytes, ret);
+    raw_extent_cache_invalidate(s, offset, bytes);
     return ret;
 }
 
@@ -2919,8 +3454,10 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
                      BdrvRequestFlags flags, bool blkdev)
 {
     BDRVRawState *s = bs->opaque;
-    RawPosixAIOData acb;
+    int aio_type = QEMU_AIO_WRITE_ZEROES;
     ThreadPoolFunc *handler;
+    bool coalesce = true;
+    int ret;
 
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -2954,32 +3491,33 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int bytes,
         req->overlap_bytes = req->bytes;
 
         bdrv_mark_request_serialising(req, bs->bl.request_alignment);
+
+        /* Only this request is covered by the serialising workaround */
+        coalesce = false;
     }
 #endif
 
-    acb = (RawPosixAIOData) {
-        .bs             = bs,
-        .aio_fildes     = s->fd,
-        .aio_type       = QEMU_AIO_WRITE_ZEROES,
-        .aio_offset     = offset,
-        .aio_nbytes     = bytes,
-    };
-
     if (blkdev) {
-        acb.aio_type |= QEMU_AIO_BLKDEV;
+        aio_type |= QEMU_AIO_BLKDEV;
     }
     if (flags & BDRV_REQ_NO_FALLBACK) {
-        acb.aio_type |= QEMU_AIO_NO_FALLBACK;
+        aio_type |= QEMU_AIO_NO_FALLBACK;
     }
 
     if (flags & BDRV_REQ_MAY_UNMAP) {
-        acb.aio_type |= QEMU_AIO_DISCARD;
+        aio_type |= QEMU_AIO_DISCARD;
         handler = handle_aiocb_write_zeroes_unmap;
     } else {
         handler = handle_aiocb_write_zeroes;
     }
 
-    return raw_thread_pool_submit(bs, handler, &acb);
+    if (coalesce) {
+        ret = raw_co_coalesced_submit(bs, aio_type, handler, offset, bytes);
+    } else {
+        ret = raw_co_fallocate_submit(bs, aio_type, handler, offset, bytes);
+    }
+    raw_extent_cache_invalidate(s, offset, bytes);
+    return ret;
 }
 
 static int coroutine_fn raw_co_pwrite_zeroes(
@@ -3128,15 +3666,20 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_luring_update_fixed_file(bs, false);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+        raw_luring_update_fixed_file(bs, true);
     }
     s->perm_change_fd = 0;
 
     raw_handle_perm_lock(bs, RAW_PL_COMMIT, perm, shared, NULL);
     s->perm = perm;
     s->shared_perm = shared;
+
+    /* Entries cached without expiry may not be valid any more */
+    raw_extent_cache_clear(s);
 }
 
 static void raw_abort_perm_update(BlockDriverState *bs)
@@ -3174,6 +3717,7 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
     RawPosixAIOData acb;
     BDRVRawState *s = bs->opaque;
     BDRVRawState *src_s;
+    int ret;
 
     assert(dst->bs == bs);
     if (src->bs->drv->bdrv_co_copy_range_to != raw_co_copy_range_to) {
@@ -3197,7 +3741,9 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
         },
     };
 
-    return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
+    ret = raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
+    raw_extent_cache_invalidate(s, dst_offset, bytes);
+    return ret;
 }
 
 BlockDriver bdrv_file = {
@@ -3230,6 +3776,7 @@ BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
     .bdrv_getlength = raw_getlength,
@@ -3499,6 +4046,18 @@ hdev_open_Mac_error:
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
 
+#if defined(__linux__)
+    /*
+     * Only the sg driver has the write()/read() interface to SG_IO, and it
+     * needs an fd that can be written to.
+     */
+    if (bs->sg && (s->open_flags & O_ACCMODE) == O_RDWR) {
+        s->use_sg_async = true;
+        qemu_co_queue_init(&s->sg_queue);
+        raw_sg_set_fd_handler(bs, bdrv_get_aio_context(bs), true);
+    }
+#endif
+
     return ret;
 }
 
@@ -3508,6 +4067,7 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
+    bool sg_fallback = false;
     int ret;
 
     ret = fd_open(bs);
@@ -3524,6 +4084,14 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         }
     }
 
+    if (req == SG_IO && s->use_sg_async) {
+        ret = raw_sg_co_submit(bs, buf);
+        if (ret != -EPERM) {
+            return ret;
+        }
+        sg_fallback = true;
+    }
+
     acb = (RawPosixAIOData) {
         .bs         = bs,
         .aio_type   = QEMU_AIO_IOCTL,
@@ -3535,7 +4103,17 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         },
     };
 
-    return raw_thread_pool_submit(bs, handle_aiocb_ioctl, &acb);
+    ret = raw_thread_pool_submit(bs, handle_aiocb_ioctl, &acb);
+    if (sg_fallback && ret != -EPERM) {
+        /*
+         * write() on sg devices is refused when it could be used to
+         * escalate privileges, e.g. with an fd passed in by another
+         * process, but the ioctl works; stay with the ioctl.
+         */
+        raw_sg_set_fd_handler(bs, bdrv_get_aio_context(bs), false);
+        s->use_sg_async = false;
+    }
+    return ret;
 }
 #endif /* linux */
 
@@ -3604,6 +4182,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -3728,6 +4307,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
@@ -3858,6 +4438,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
     .bdrv_getlength      = raw_getlength,
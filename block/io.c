@@ -1665,6 +1665,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
 
     bdrv_padding_destroy(&pad);
 
+    trace_bdrv_co_preadv_done(bs, offset, ret);
     return ret;
 }
 
@@ -2097,6 +2098,7 @@ out:
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
 
+    trace_bdrv_co_pwritev_done(bs, offset, ret);
     return ret;
 }
 
@@ -10,23 +10,40 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+#include <linux/falloc.h>
+#endif
 #include "qemu-common.h"
 #include "block/aio.h"
 #include "qemu/queue.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qapi/error.h"
+#include "exec/cpu-common.h"
+#include "exec/ramlist.h"
 #include "trace.h"
 
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Number of slots in the registered file table */
+#define MAX_FIXED_FILES 64
+
+/* Kernel limits for registered buffers */
+#define MAX_FIXED_BUFS 16384
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+
+/* Milliseconds before an idle submission queue polling thread sleeps */
+#define SQPOLL_IDLE_MS 1000
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
+    uint64_t nbytes;            /* length of requests without @qiov */
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
@@ -56,8 +73,39 @@ typedef struct LuringState {
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /*
+     * Registered file table, indexed by slot.  Unused slots are -1.
+     * Protected by AioContext lock.
+     */
+    int fixed_files[MAX_FIXED_FILES];
+    bool fixed_files_registered;
+
+    /*
+     * Guest RAM registered as fixed buffers, sorted by address.  RAM blocks
+     * larger than MAX_FIXED_BUF_SIZE are split into several buffers.
+     * Protected by AioContext lock.
+     */
+    bool fixed_bufs_enabled;
+    RAMBlockNotifier ram_notifier;
+    GArray *ram_regions;
+    struct iovec *fixed_bufs;
+    unsigned int nr_fixed_bufs;
+
+    /* Submission queue polling, see luring_init() */
+    bool sqpoll;
+    int sq_cpu;
+    QLIST_ENTRY(LuringState) sqpoll_next;
 } LuringState;
 
+/*
+ * LuringStates with a kernel submission queue polling thread.  New rings with
+ * the same sq_cpu attach to an existing polling thread instead of creating
+ * another one.  Only accessed under the BQL.
+ */
+static QLIST_HEAD(, LuringState) sqpoll_rings =
+    QLIST_HEAD_INITIALIZER(sqpoll_rings);
+
 /**
  * luring_resubmit:
  *
@@ -102,7 +150,8 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
                       remaining);
 
-    /* Update sqe */
+    /* Update sqe, a fixed buffer read is resubmitted as a regular readv */
+    luringcb->sqeq.opcode = IORING_OP_READV;
     luringcb->sqeq.off = nread;
     luringcb->sqeq.addr = (__u64)(uintptr_t)luringcb->resubmit_qiov.iov;
     luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
@@ -312,6 +361,273 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
     }
 }
 
+static int luring_fixed_file_index(LuringState *s, int fd)
+{
+    int i;
+
+    if (!s->fixed_files_registered) {
+        return -1;
+    }
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * luring_register_file:
+ * @s: AIO state
+ * @fd: file descriptor to register
+ *
+ * Add @fd to the registered file table so that requests on it do not need a
+ * file lookup in the kernel.  Registration is an optimization, requests on
+ * @fd still work through the regular path if it fails.
+ *
+ * Returns: 0 on success, -errno on failure.
+ */
+int luring_register_file(LuringState *s, int fd)
+{
+    int free_slot = -1;
+    int ret;
+    int i;
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == fd) {
+            return 0;
+        }
+        if (free_slot < 0 && s->fixed_files[i] == -1) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        return -ENOSPC;
+    }
+
+    s->fixed_files[free_slot] = fd;
+    if (!s->fixed_files_registered) {
+        /* The sparse table is registered once and then updated in place */
+        ret = io_uring_register_files(&s->ring, s->fixed_files,
+                                      MAX_FIXED_FILES);
+        if (ret == 0) {
+            s->fixed_files_registered = true;
+        }
+    } else {
+        ret = io_uring_register_files_update(&s->ring, free_slot, &fd, 1);
+        if (ret > 0) {
+            ret = 0;
+        }
+    }
+    trace_luring_register_file(s, fd, free_slot, ret);
+
+    if (ret < 0) {
+        s->fixed_files[free_slot] = -1;
+    }
+    return ret;
+}
+
+/**
+ * luring_unregister_file:
+ * @s: AIO state
+ * @fd: file descriptor previously passed to luring_register_file()
+ *
+ * Drop @fd from the registered file table.  This must be called before @fd is
+ * closed because the kernel keeps a reference to the registered file.
+ */
+void luring_unregister_file(LuringState *s, int fd)
+{
+    int slot = luring_fixed_file_index(s, fd);
+    int unused = -1;
+    int ret;
+
+    if (slot < 0) {
+        return;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, slot, &unused, 1);
+    trace_luring_unregister_file(s, fd, slot, ret);
+    s->fixed_files[slot] = -1;
+}
+
+static gint luring_ram_region_compare(gconstpointer a, gconstpointer b)
+{
+    const struct iovec *ra = a;
+    const struct iovec *rb = b;
+
+    if (ra->iov_base < rb->iov_base) {
+        return -1;
+    }
+    return ra->iov_base > rb->iov_base;
+}
+
+/*
+ * Re-register all known RAM regions as fixed buffers.  The kernel does not
+ * allow the buffer table to be changed in place, so the whole table is
+ * replaced.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    unsigned int nr = 0;
+    unsigned int i;
+    int ret;
+
+    if (s->nr_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+    }
+    g_free(s->fixed_bufs);
+    s->fixed_bufs = NULL;
+    s->nr_fixed_bufs = 0;
+
+    g_array_sort(s->ram_regions, luring_ram_region_compare);
+
+    for (i = 0; i < s->ram_regions->len; i++) {
+        struct iovec *r = &g_array_index(s->ram_regions, struct iovec, i);
+        nr += DIV_ROUND_UP(r->iov_len, MAX_FIXED_BUF_SIZE);
+    }
+    if (nr == 0) {
+        return;
+    }
+    if (nr > MAX_FIXED_BUFS) {
+        trace_luring_register_buffers(s, nr, -EINVAL);
+        return;
+    }
+
+    s->fixed_bufs = g_new(struct iovec, nr);
+    nr = 0;
+    for (i = 0; i < s->ram_regions->len; i++) {
+        struct iovec *r = &g_array_index(s->ram_regions, struct iovec, i);
+        size_t offset;
+
+        for (offset = 0; offset < r->iov_len; offset += MAX_FIXED_BUF_SIZE) {
+            s->fixed_bufs[nr].iov_base = r->iov_base + offset;
+            s->fixed_bufs[nr].iov_len = MIN(r->iov_len - offset,
+                                            MAX_FIXED_BUF_SIZE);
+            nr++;
+        }
+    }
+
+    ret = io_uring_register_buffers(&s->ring, s->fixed_bufs, nr);
+    trace_luring_register_buffers(s, nr, ret);
+    if (ret < 0) {
+        /* Most likely RLIMIT_MEMLOCK, fall back to regular readv/writev */
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        return;
+    }
+    s->nr_fixed_bufs = nr;
+}
+
+static void luring_ram_block_added(RAMBlockNotifier *n, void *host,
+                                   size_t size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    struct iovec region = { .iov_base = host, .iov_len = size };
+
+    if (s->aio_context) {
+        aio_context_acquire(s->aio_context);
+    }
+    g_array_append_val(s->ram_regions, region);
+    luring_update_fixed_bufs(s);
+    if (s->aio_context) {
+        aio_context_release(s->aio_context);
+    }
+}
+
+static void luring_ram_block_removed(RAMBlockNotifier *n, void *host,
+                                     size_t size)
+{
+    LuringState *s = container_of(n, LuringState, ram_notifier);
+    unsigned int i;
+
+    if (s->aio_context) {
+        aio_context_acquire(s->aio_context);
+    }
+    for (i = 0; i < s->ram_regions->len; i++) {
+        struct iovec *r = &g_array_index(s->ram_regions, struct iovec, i);
+
+        if (r->iov_base == host && r->iov_len == size) {
+            g_array_remove_index(s->ram_regions, i);
+            luring_update_fixed_bufs(s);
+            break;
+        }
+    }
+    if (s->aio_context) {
+        aio_context_release(s->aio_context);
+    }
+}
+
+static int luring_init_ramblock(RAMBlock *rb, void *opaque)
+{
+    LuringState *s = opaque;
+    struct iovec region = {
+        .iov_base = qemu_ram_get_host_addr(rb),
+        .iov_len = qemu_ram_get_used_length(rb),
+    };
+
+    if (region.iov_base) {
+        g_array_append_val(s->ram_regions, region);
+    }
+    return 0;
+}
+
+/**
+ * luring_enable_fixed_buffers:
+ * @s: AIO state
+ *
+ * Register guest RAM as fixed buffers and keep the registration up to date as
+ * RAM blocks come and go.  Single-buffer requests that fall inside guest RAM
+ * then use IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED.
+ */
+void luring_enable_fixed_buffers(LuringState *s)
+{
+    if (s->fixed_bufs_enabled) {
+        return;
+    }
+    s->fixed_bufs_enabled = true;
+
+    s->ram_regions = g_array_new(false, false, sizeof(struct iovec));
+    qemu_ram_foreach_block(luring_init_ramblock, s);
+    luring_update_fixed_bufs(s);
+
+    s->ram_notifier.ram_block_added = luring_ram_block_added;
+    s->ram_notifier.ram_block_removed = luring_ram_block_removed;
+    ram_block_notifier_add(&s->ram_notifier);
+}
+
+/*
+ * Returns the index of the registered buffer that contains all of @qiov, or
+ * -1 if @qiov cannot be submitted as a fixed buffer request.
+ */
+static int luring_fixed_buf_index(LuringState *s, QEMUIOVector *qiov)
+{
+    void *base;
+    size_t len;
+    unsigned int lo = 0;
+    unsigned int hi = s->nr_fixed_bufs;
+
+    /* Fixed buffer opcodes take a single contiguous buffer */
+    if (qiov->niov != 1) {
+        return -1;
+    }
+    base = qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        struct iovec *buf = &s->fixed_bufs[mid];
+
+        if (base < buf->iov_base) {
+            hi = mid;
+        } else if (base >= buf->iov_base + buf->iov_len) {
+            lo = mid + 1;
+        } else {
+            return len <= buf->iov_base + buf->iov_len - base ? mid : -1;
+        }
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -328,24 +644,53 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    int file_index = luring_fixed_file_index(s, fd);
+    int buf_index = -1;
+
+    if (luringcb->qiov && s->nr_fixed_bufs) {
+        buf_index = luring_fixed_buf_index(s, luringcb->qiov);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqes, fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                offset, luringcb->nbytes);
+        break;
+#endif
     default:
         fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
                         __func__, type);
         abort();
     }
+    if (file_index >= 0) {
+        sqes->fd = file_index;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -386,6 +731,40 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     return luringcb.ret;
 }
 
+/**
+ * luring_co_submit_discard:
+ *
+ * Punch a hole into a regular file with IORING_OP_FALLOCATE.  Kernels
+ * without support for the opcode fail the request with -EINVAL.
+ */
+int coroutine_fn luring_co_submit_discard(BlockDriverState *bs,
+                                          LuringState *s, int fd,
+                                          uint64_t offset, uint64_t bytes)
+{
+#ifdef CONFIG_FALLOCATE_PUNCH_HOLE
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .nbytes     = bytes,
+    };
+    trace_luring_co_submit(bs, s, &luringcb, fd, offset, bytes,
+                           QEMU_AIO_DISCARD);
+    ret = luring_do_submit(fd, &luringcb, s, offset, QEMU_AIO_DISCARD);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd, false, NULL, NULL, NULL,
@@ -402,28 +781,100 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
 
-LuringState *luring_init(Error **errp)
+static LuringState *luring_find_sqpoll_ring(int sq_cpu)
+{
+    LuringState *s;
+
+    QLIST_FOREACH(s, &sqpoll_rings, sqpoll_next) {
+        if (s->sq_cpu == sq_cpu) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * luring_init:
+ * @sqpoll: use a kernel thread to poll the submission queue
+ * @sq_cpu: host CPU to bind the polling thread to, or -1
+ * @errp: error object
+ *
+ * With @sqpoll, submitting requests usually does not need an io_uring_enter(2)
+ * syscall because the kernel thread picks up new sqes on its own, at the cost
+ * of a host CPU that spins while requests are being submitted.
+ */
+LuringState *luring_init(bool sqpoll, int sq_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQPOLL_IDLE_MS;
+        if (sq_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sq_cpu;
+        }
+#ifdef IORING_SETUP_ATTACH_WQ
+        {
+            LuringState *owner = luring_find_sqpoll_ring(sq_cpu);
+
+            if (owner) {
+                params.flags |= IORING_SETUP_ATTACH_WQ;
+                params.wq_fd = owner->ring.ring_fd;
+            }
+        }
+#endif
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+#ifdef IORING_SETUP_ATTACH_WQ
+    if (rc < 0 && (params.flags & IORING_SETUP_ATTACH_WQ)) {
+        /* Older kernels cannot share the polling thread */
+        params.flags &= ~IORING_SETUP_ATTACH_WQ;
+        params.wq_fd = 0;
+        rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
+    }
+#endif
     if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s",
+                         sqpoll ? " with SQPOLL" : "");
         g_free(s);
         return NULL;
     }
 
+    s->sqpoll = sqpoll;
+    s->sq_cpu = sq_cpu;
+    if (sqpoll) {
+        QLIST_INSERT_HEAD(&sqpoll_rings, s, sqpoll_next);
+    }
+    trace_luring_init_sqpoll(s, sqpoll, sq_cpu, params.flags);
+
     ioq_init(&s->io_q);
+    memset(s->fixed_files, -1, sizeof(s->fixed_files));
     return s;
 
 }
 
+bool luring_uses_sqpoll(LuringState *s)
+{
+    return s->sqpoll;
+}
+
 void luring_cleanup(LuringState *s)
 {
+    if (s->sqpoll) {
+        QLIST_REMOVE(s, sqpoll_next);
+    }
+    if (s->fixed_bufs_enabled) {
+        ram_block_notifier_remove(&s->ram_notifier);
+        g_array_free(s->ram_regions, true);
+        g_free(s->fixed_bufs);
+    }
     io_uring_queue_exit(&s->ring);
     g_free(s);
     trace_luring_cleanup_state(s);
@@ -62,14 +62,39 @@ QEMU_BUILD_BUG_ON((int)SCSI_XFER_NONE != (int)ISCSI_XFER_NONE);
 #include <scsi/sg.h>
 #endif
 
+struct IscsiLun;
+
+/*
+ * One iSCSI session (a libiscsi context and its TCP connection) to the
+ * LUN.  Reads, writes and flushes are spread over all the sessions, the
+ * rest goes through the first one.
+ */
+typedef struct IscsiSession {
+    struct iscsi_context *iscsi;
+    struct IscsiLun *iscsilun;
+    int index;
+    int events;
+    int in_flight;
+    bool request_timed_out;
+
+    /* Statistics, reported by query-blockstats */
+    uint64_t commands;
+    uint64_t bytes;
+    uint64_t failovers;
+    uint64_t reconnects;
+} IscsiSession;
+
 typedef struct IscsiLun {
+    /* The context of sessions[0] */
     struct iscsi_context *iscsi;
+    IscsiSession *sessions;
+    int num_sessions;
+    int next_session;
     AioContext *aio_context;
     int lun;
     enum scsi_inquiry_peripheral_device_type type;
     int block_size;
     uint64_t num_blocks;
-    int events;
     QEMUTimer *nop_timer;
     QEMUTimer *event_timer;
     QemuMutex mutex;
@@ -101,7 +126,6 @@ typedef struct IscsiLun {
     bool lbprz;
     bool dpofua;
     bool has_write_same;
-    bool request_timed_out;
 } IscsiLun;
 
 typedef struct IscsiTask {
@@ -112,6 +136,7 @@ typedef struct IscsiTask {
     struct scsi_task *task;
     Coroutine *co;
     IscsiLun *iscsilun;
+    IscsiSession *session;
     QEMUTimer retry_timer;
     int err_code;
     char *err_str;
@@ -136,6 +161,7 @@ typedef struct IscsiAIOCB {
 #define EVENT_INTERVAL 1000
 #define NOP_INTERVAL 5000
 #define MAX_NOP_FAILURES 3
+#define MAX_SESSIONS 16
 #define ISCSI_CMD_RETRIES ARRAY_SIZE(iscsi_retry_times)
 static const unsigned iscsi_retry_times[] = {8, 32, 128, 512, 2048, 8192, 32768};
 
@@ -256,7 +282,7 @@ iscsi_co_generic_cb(struct iscsi_context *iscsi, int status,
                     /* make sure the request is rescheduled AFTER the
                      * reconnect is initiated */
                     retry_time = EVENT_INTERVAL * 2;
-                    iTask->iscsilun->request_timed_out = true;
+                    iTask->session->request_timed_out = true;
                 }
                 error_report("iSCSI Busy/TaskSetFull/TimeOut"
                              " (retry #%u in %u ms): %s",
@@ -295,9 +321,54 @@ static void iscsi_co_init_iscsitask(IscsiLun *iscsilun, struct IscsiTask *iTask)
     *iTask = (struct IscsiTask) {
         .co         = qemu_coroutine_self(),
         .iscsilun   = iscsilun,
+        .session    = &iscsilun->sessions[0],
     };
 }
 
+/*
+ * Choose the session that a read, write or flush goes to: the one with
+ * the fewest commands in flight among those that are logged in, starting
+ * after the last one used so that requests are striped across the
+ * sessions.  When a command is retried, it fails over to another session
+ * if there is one.
+ *
+ * Called with QemuMutex held.
+ */
+static void iscsi_select_session(IscsiLun *iscsilun, IscsiTask *iTask,
+                                 uint64_t bytes)
+{
+    IscsiSession *failed = iTask->retries ? iTask->session : NULL;
+    IscsiSession *best = NULL;
+    int n = iscsilun->num_sessions;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        IscsiSession *s = &iscsilun->sessions[(iscsilun->next_session + i) % n];
+
+        if (s == failed || s->request_timed_out ||
+            !iscsi_is_logged_in(s->iscsi)) {
+            continue;
+        }
+        if (!best || s->in_flight < best->in_flight) {
+            best = s;
+        }
+    }
+    if (!best) {
+        /* libiscsi queues the command until the session is back */
+        best = failed ? failed : &iscsilun->sessions[iscsilun->next_session];
+    }
+
+    if (failed && best != failed) {
+        trace_iscsi_session_failover(iscsilun, failed->index, best->index);
+        failed->failovers++;
+    }
+    iscsilun->next_session = (best->index + 1) % n;
+    iTask->session = best;
+    best->in_flight++;
+    best->commands++;
+    best->bytes += bytes;
+}
+
 #ifdef __linux__
 
 /* Called (via iscsi_service) with QemuMutex held. */
@@ -355,39 +426,47 @@ static void iscsi_process_write(void *arg);
 
 /* Called with QemuMutex held.  */
 static void
-iscsi_set_events(IscsiLun *iscsilun)
+iscsi_set_events(IscsiSession *session)
 {
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiLun *iscsilun = session->iscsilun;
+    struct iscsi_context *iscsi = session->iscsi;
     int ev = iscsi_which_events(iscsi);
 
-    if (ev != iscsilun->events) {
+    if (ev != session->events) {
         aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsi),
                            false,
                            (ev & POLLIN) ? iscsi_process_read : NULL,
                            (ev & POLLOUT) ? iscsi_process_write : NULL,
                            NULL,
-                           iscsilun);
-        iscsilun->events = ev;
+                           session);
+        session->events = ev;
     }
 }
 
 static void iscsi_timed_check_events(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
 
-    /* check for timed out requests */
-    iscsi_service(iscsilun->iscsi, 0);
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
 
-    if (iscsilun->request_timed_out) {
-        iscsilun->request_timed_out = false;
-        iscsi_reconnect(iscsilun->iscsi);
-    }
+        /* check for timed out requests */
+        iscsi_service(session->iscsi, 0);
 
-    /* newer versions of libiscsi may return zero events. Ensure we are able
-     * to return to service once this situation changes. */
-    iscsi_set_events(iscsilun);
+        if (session->request_timed_out) {
+            session->request_timed_out = false;
+            trace_iscsi_session_reconnect(iscsilun, i);
+            session->reconnects++;
+            iscsi_reconnect(session->iscsi);
+        }
+
+        /* newer versions of libiscsi may return zero events. Ensure we are
+         * able to return to service once this situation changes. */
+        iscsi_set_events(session);
+    }
 
     qemu_mutex_unlock(&iscsilun->mutex);
 
@@ -398,24 +477,24 @@ static void iscsi_timed_check_events(void *opaque)
 static void
 iscsi_process_read(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *session = arg;
+    IscsiLun *iscsilun = session->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLIN);
-    iscsi_set_events(iscsilun);
+    iscsi_service(session->iscsi, POLLIN);
+    iscsi_set_events(session);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
 
 static void
 iscsi_process_write(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *session = arg;
+    IscsiLun *iscsilun = session->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLOUT);
-    iscsi_set_events(iscsilun);
+    iscsi_service(session->iscsi, POLLOUT);
+    iscsi_set_events(session);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
 
@@ -593,7 +672,7 @@ static void coroutine_fn iscsi_co_wait_for_task(IscsiTask *iTask,
                                                 IscsiLun *iscsilun)
 {
     while (!iTask->complete) {
-        iscsi_set_events(iscsilun);
+        iscsi_set_events(iTask->session);
         qemu_mutex_unlock(&iscsilun->mutex);
         qemu_coroutine_yield();
         qemu_mutex_lock(&iscsilun->mutex);
@@ -627,33 +706,35 @@ iscsi_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
 retry:
+    iscsi_select_session(iscsilun, &iTask, iov->size);
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_write16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_iov_task(iTask.session->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_write10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_iov_task(iTask.session->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_write16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_task(iTask.session->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_write10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_task(iTask.session->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     }
 #endif
     if (iTask.task == NULL) {
+        iTask.session->in_flight--;
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -662,6 +743,7 @@ retry:
                           iov->niov);
 #endif
     iscsi_co_wait_for_task(&iTask, iscsilun);
+    iTask.session->in_flight--;
 
     if (iTask.task != NULL) {
         scsi_free_scsi_task(iTask.task);
@@ -862,15 +944,16 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
 retry:
+    iscsi_select_session(iscsilun, &iTask, iov->size);
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_read16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_iov_task(iTask.session->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size, 0, 0, 0, 0, 0,
                                            iscsi_co_generic_cb, &iTask,
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_read10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_iov_task(iTask.session->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size,
                                            0, 0, 0, 0, 0,
@@ -878,12 +961,12 @@ retry:
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_read16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_task(iTask.session->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size, 0, 0, 0, 0, 0,
                                        iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_read10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_task(iTask.session->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size,
                                        0, 0, 0, 0, 0,
@@ -891,6 +974,7 @@ retry:
     }
 #endif
     if (iTask.task == NULL) {
+        iTask.session->in_flight--;
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -899,6 +983,7 @@ retry:
 #endif
 
     iscsi_co_wait_for_task(&iTask, iscsilun);
+    iTask.session->in_flight--;
     if (iTask.task != NULL) {
         scsi_free_scsi_task(iTask.task);
         iTask.task = NULL;
@@ -929,13 +1014,17 @@ static int coroutine_fn iscsi_co_flush(BlockDriverState *bs)
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
 retry:
-    if (iscsi_synchronizecache10_task(iscsilun->iscsi, iscsilun->lun, 0, 0, 0,
-                                      0, iscsi_co_generic_cb, &iTask) == NULL) {
+    iscsi_select_session(iscsilun, &iTask, 0);
+    if (iscsi_synchronizecache10_task(iTask.session->iscsi, iscsilun->lun,
+                                      0, 0, 0, 0, iscsi_co_generic_cb,
+                                      &iTask) == NULL) {
+        iTask.session->in_flight--;
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
 
     iscsi_co_wait_for_task(&iTask, iscsilun);
+    iTask.session->in_flight--;
 
     if (iTask.task != NULL) {
         scsi_free_scsi_task(iTask.task);
@@ -1122,7 +1211,7 @@ static BlockAIOCB *iscsi_aio_ioctl(BlockDriverState *bs,
         }
     }
 
-    iscsi_set_events(iscsilun);
+    iscsi_set_events(&iscsilun->sessions[0]);
     qemu_mutex_unlock(&iscsilun->mutex);
 
     return &acb->common;
@@ -1395,18 +1484,26 @@ static char *get_initiator_name(QemuOpts *opts)
 static void iscsi_nop_timed_event(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     QEMU_LOCK_GUARD(&iscsilun->mutex);
-    if (iscsi_get_nops_in_flight(iscsilun->iscsi) >= MAX_NOP_FAILURES) {
-        error_report("iSCSI: NOP timeout. Reconnecting...");
-        iscsilun->request_timed_out = true;
-    } else if (iscsi_nop_out_async(iscsilun->iscsi, NULL, NULL, 0, NULL) != 0) {
-        error_report("iSCSI: failed to sent NOP-Out. Disabling NOP messages.");
-        return;
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
+
+        if (iscsi_get_nops_in_flight(session->iscsi) >= MAX_NOP_FAILURES) {
+            error_report("iSCSI: NOP timeout on session %d. Reconnecting...",
+                         i);
+            session->request_timed_out = true;
+        } else if (iscsi_nop_out_async(session->iscsi, NULL, NULL, 0,
+                                       NULL) != 0) {
+            error_report("iSCSI: failed to sent NOP-Out. "
+                         "Disabling NOP messages.");
+            return;
+        }
+        iscsi_set_events(session);
     }
 
     timer_mod(iscsilun->nop_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + NOP_INTERVAL);
-    iscsi_set_events(iscsilun);
 }
 
 static void iscsi_readcapacity_sync(IscsiLun *iscsilun, Error **errp)
@@ -1520,10 +1617,15 @@ fail_with_err:
 static void iscsi_detach_aio_context(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
+    int i;
 
-    aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsilun->iscsi),
-                       false, NULL, NULL, NULL, NULL);
-    iscsilun->events = 0;
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
+
+        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(session->iscsi),
+                           false, NULL, NULL, NULL, NULL);
+        session->events = 0;
+    }
 
     if (iscsilun->nop_timer) {
         timer_del(iscsilun->nop_timer);
@@ -1541,9 +1643,12 @@ static void iscsi_attach_aio_context(BlockDriverState *bs,
                                      AioContext *new_context)
 {
     IscsiLun *iscsilun = bs->opaque;
+    int i;
 
     iscsilun->aio_context = new_context;
-    iscsi_set_events(iscsilun);
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        iscsi_set_events(&iscsilun->sessions[i]);
+    }
 
     /* Set up a timer for sending out iSCSI NOPs */
     iscsilun->nop_timer = aio_timer_new(iscsilun->aio_context,
@@ -1748,6 +1853,10 @@ static QemuOptsList runtime_opts = {
             .name = "timeout",
             .type = QEMU_OPT_NUMBER,
         },
+        {
+            .name = "sessions",
+            .type = QEMU_OPT_NUMBER,
+        },
         { /* end of list */ }
     },
 };
@@ -1776,75 +1885,62 @@ static void iscsi_save_designator(IscsiLun *lun,
     }
 }
 
-static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
-                      Error **errp)
+static void iscsi_close_sessions(IscsiLun *iscsilun)
 {
-    IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = NULL;
-    struct scsi_task *task = NULL;
-    struct scsi_inquiry_standard *inq = NULL;
-    struct scsi_inquiry_supported_pages *inq_vpd;
-    char *initiator_name = NULL;
-    QemuOpts *opts;
-    Error *local_err = NULL;
-    const char *transport_name, *portal, *target;
-#if LIBISCSI_API_VERSION >= (20160603)
-    enum iscsi_transport_type transport;
-#endif
-    int i, ret = 0, timeout = 0, lun;
+    int i;
 
-    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
-    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
-        ret = -EINVAL;
-        goto out;
-    }
-
-    transport_name = qemu_opt_get(opts, "transport");
-    portal = qemu_opt_get(opts, "portal");
-    target = qemu_opt_get(opts, "target");
-    lun = qemu_opt_get_number(opts, "lun", 0);
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        struct iscsi_context *iscsi = iscsilun->sessions[i].iscsi;
 
-    if (!transport_name || !portal || !target) {
-        error_setg(errp, "Need all of transport, portal and target options");
-        ret = -EINVAL;
-        goto out;
+        if (iscsi == NULL) {
+            continue;
+        }
+        if (iscsi_is_logged_in(iscsi)) {
+            iscsi_logout_sync(iscsi);
+        }
+        iscsi_destroy_context(iscsi);
     }
+    g_free(iscsilun->sessions);
+    iscsilun->sessions = NULL;
+    iscsilun->num_sessions = 0;
+    iscsilun->iscsi = NULL;
+}
 
-    if (!strcmp(transport_name, "tcp")) {
+/*
+ * Create the libiscsi context of @session and log it in to the LUN.  Each
+ * context gets a random ISID, so the sessions are distinct to the target.
+ */
+static int iscsi_session_connect(IscsiSession *session, QemuOpts *opts,
+                                 const char *initiator_name, Error **errp)
+{
+    struct iscsi_context *iscsi;
+    Error *local_err = NULL;
+    const char *portal = qemu_opt_get(opts, "portal");
+    const char *target = qemu_opt_get(opts, "target");
+    int lun = qemu_opt_get_number(opts, "lun", 0);
 #if LIBISCSI_API_VERSION >= (20160603)
-        transport = TCP_TRANSPORT;
-    } else if (!strcmp(transport_name, "iser")) {
-        transport = ISER_TRANSPORT;
-#else
-        /* TCP is what older libiscsi versions always use */
+    enum iscsi_transport_type transport =
+        strcmp(qemu_opt_get(opts, "transport"), "iser") ? TCP_TRANSPORT
+                                                         : ISER_TRANSPORT;
 #endif
-    } else {
-        error_setg(errp, "Unknown transport: %s", transport_name);
-        ret = -EINVAL;
-        goto out;
-    }
-
-    memset(iscsilun, 0, sizeof(IscsiLun));
-
-    initiator_name = get_initiator_name(opts);
+    int ret, timeout;
 
     iscsi = iscsi_create_context(initiator_name);
     if (iscsi == NULL) {
         error_setg(errp, "iSCSI: Failed to create iSCSI context.");
-        ret = -ENOMEM;
-        goto out;
+        return -ENOMEM;
     }
 #if LIBISCSI_API_VERSION >= (20160603)
     if (iscsi_init_transport(iscsi, transport)) {
         error_setg(errp, ("Error initializing transport."));
         ret = -EINVAL;
-        goto out;
+        goto fail;
     }
 #endif
     if (iscsi_set_targetname(iscsi, target)) {
         error_setg(errp, "iSCSI: Failed to set target name.");
         ret = -EINVAL;
-        goto out;
+        goto fail;
     }
 
     /* check if we got CHAP username/password via the options */
@@ -1852,13 +1948,13 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     if (local_err != NULL) {
         error_propagate(errp, local_err);
         ret = -EINVAL;
-        goto out;
+        goto fail;
     }
 
     if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
         error_setg(errp, "iSCSI: Failed to set session type to normal.");
         ret = -EINVAL;
-        goto out;
+        goto fail;
     }
 
     /* check if we got HEADER_DIGEST via the options */
@@ -1866,7 +1962,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     if (local_err != NULL) {
         error_propagate(errp, local_err);
         ret = -EINVAL;
-        goto out;
+        goto fail;
     }
 
     /* timeout handling is broken in libiscsi before 1.15.0 */
@@ -1874,7 +1970,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
 #if LIBISCSI_API_VERSION >= 20150621
     iscsi_set_timeout(iscsi, timeout);
 #else
-    if (timeout) {
+    if (timeout && session->index == 0) {
         warn_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
     }
 #endif
@@ -1883,10 +1979,81 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
         error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
             iscsi_get_error(iscsi));
         ret = -EINVAL;
+        goto fail;
+    }
+
+    session->iscsi = iscsi;
+    return 0;
+
+fail:
+    iscsi_destroy_context(iscsi);
+    return ret;
+}
+
+static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    IscsiLun *iscsilun = bs->opaque;
+    struct scsi_task *task = NULL;
+    struct scsi_inquiry_standard *inq = NULL;
+    struct scsi_inquiry_supported_pages *inq_vpd;
+    char *initiator_name = NULL;
+    QemuOpts *opts;
+    Error *local_err = NULL;
+    const char *transport_name, *portal, *target;
+    int i, ret = 0, lun, num_sessions;
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
         goto out;
     }
 
-    iscsilun->iscsi = iscsi;
+    transport_name = qemu_opt_get(opts, "transport");
+    portal = qemu_opt_get(opts, "portal");
+    target = qemu_opt_get(opts, "target");
+    lun = qemu_opt_get_number(opts, "lun", 0);
+
+    if (!transport_name || !portal || !target) {
+        error_setg(errp, "Need all of transport, portal and target options");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    /* TCP is what older libiscsi versions always use */
+    if (strcmp(transport_name, "tcp") &&
+        (LIBISCSI_API_VERSION < (20160603) || strcmp(transport_name, "iser"))) {
+        error_setg(errp, "Unknown transport: %s", transport_name);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    memset(iscsilun, 0, sizeof(IscsiLun));
+
+    initiator_name = get_initiator_name(opts);
+
+    num_sessions = qemu_opt_get_number(opts, "sessions", 1);
+    if (num_sessions < 1 || num_sessions > MAX_SESSIONS) {
+        error_setg(errp, "iSCSI: sessions must be between 1 and %d",
+                   MAX_SESSIONS);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    iscsilun->sessions = g_new0(IscsiSession, num_sessions);
+    iscsilun->num_sessions = num_sessions;
+    for (i = 0; i < num_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
+
+        session->iscsilun = iscsilun;
+        session->index = i;
+        ret = iscsi_session_connect(session, opts, initiator_name, errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    iscsilun->iscsi = iscsilun->sessions[0].iscsi;
     iscsilun->aio_context = bdrv_get_aio_context(bs);
     iscsilun->lun = lun;
     iscsilun->has_write_same = true;
@@ -2014,12 +2181,7 @@ out:
     }
 
     if (ret) {
-        if (iscsi != NULL) {
-            if (iscsi_is_logged_in(iscsi)) {
-                iscsi_logout_sync(iscsi);
-            }
-            iscsi_destroy_context(iscsi);
-        }
+        iscsi_close_sessions(iscsilun);
         memset(iscsilun, 0, sizeof(IscsiLun));
     }
 
@@ -2029,13 +2191,9 @@ out:
 static void iscsi_close(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
 
     iscsi_detach_aio_context(bs);
-    if (iscsi_is_logged_in(iscsi)) {
-        iscsi_logout_sync(iscsi);
-    }
-    iscsi_destroy_context(iscsi);
+    iscsi_close_sessions(iscsilun);
     if (iscsilun->dd) {
         g_free(iscsilun->dd->designator);
         g_free(iscsilun->dd);
@@ -2046,6 +2204,36 @@ static void iscsi_close(BlockDriverState *bs)
     memset(iscsilun, 0, sizeof(IscsiLun));
 }
 
+static BlockStatsSpecific *iscsi_get_specific_stats(BlockDriverState *bs)
+{
+    IscsiLun *iscsilun = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    IscsiSessionStatsList **next = &stats->u.iscsi.sessions;
+    int i;
+
+    stats->driver = BLOCKDEV_DRIVER_ISCSI;
+
+    QEMU_LOCK_GUARD(&iscsilun->mutex);
+    for (i = 0; i < iscsilun->num_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
+        IscsiSessionStatsList *entry = g_new0(IscsiSessionStatsList, 1);
+
+        entry->value = g_new(IscsiSessionStats, 1);
+        *entry->value = (IscsiSessionStats) {
+            .logged_in = iscsi_is_logged_in(session->iscsi),
+            .in_flight = session->in_flight,
+            .commands = session->commands,
+            .bytes = session->bytes,
+            .failovers = session->failovers,
+            .reconnects = session->reconnects,
+        };
+        *next = entry;
+        next = &entry->next;
+    }
+
+    return stats;
+}
+
 static void iscsi_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     /* We don't actually refresh here, but just return data queried in
@@ -2405,6 +2593,7 @@ static const char *const iscsi_strong_runtime_opts[] = {
     "lun",
     "initiator-name",
     "header-digest",
+    "sessions",
 
     NULL
 };
@@ -2425,6 +2614,7 @@ static BlockDriver bdrv_iscsi = {
 
     .bdrv_getlength  = iscsi_getlength,
     .bdrv_get_info   = iscsi_get_info,
+    .bdrv_get_specific_stats = iscsi_get_specific_stats,
     .bdrv_co_truncate    = iscsi_co_truncate,
     .bdrv_refresh_limits = iscsi_refresh_limits,
 
@@ -2464,6 +2654,7 @@ static BlockDriver bdrv_iser = {
 
     .bdrv_getlength  = iscsi_getlength,
     .bdrv_get_info   = iscsi_get_info,
+    .bdrv_get_specific_stats = iscsi_get_specific_stats,
     .bdrv_co_truncate    = iscsi_co_truncate,
     .bdrv_refresh_limits = iscsi_refresh_limits,
 
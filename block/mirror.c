@@ -80,6 +80,8 @@ typedef struct MirrorBlockJob {
     bool unmap;
     int target_cluster_size;
     int max_iov;
+    /* Try copy offload (e.g. copy_file_range) before read + write */
+    bool use_copy_range;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     bool prepared;
@@ -312,6 +314,16 @@ mirror_wait_for_free_in_flight_slot(MirrorBlockJob *s)
     mirror_wait_for_any_operation(s, false);
 }
 
+/* copy_range does not respect max_transfer, so don't exceed it */
+static int64_t mirror_max_copy_range(MirrorBlockJob *s)
+{
+    BlockDriverState *source = s->mirror_top_bs->backing->bs;
+
+    return MIN_NON_ZERO(INT_MAX,
+                        MIN_NON_ZERO(source->bl.max_transfer,
+                                     blk_bs(s->target)->bl.max_transfer));
+}
+
 /* Perform a mirror copy operation.
  *
  * *op->bytes_handled is set to the number of bytes copied after and
@@ -374,6 +386,27 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    /*
+     * The buffers are still taken above so that they limit the amount of
+     * data in flight, and so that we can fall back to them.  With copy
+     * offload they are never touched, though.
+     */
+    if (s->use_copy_range && op->bytes <= mirror_max_copy_range(s)) {
+        ret = blk_co_copy_range_from_child(s->mirror_top_bs->backing,
+                                           op->offset, s->target, op->offset,
+                                           op->bytes, 0, 0);
+        if (ret >= 0) {
+            mirror_write_complete(op, ret);
+            return;
+        }
+        /*
+         * Most likely unsupported by the nodes involved; real I/O errors
+         * will show up again with the fallback.
+         */
+        trace_mirror_copy_range_fail(s, op->offset, ret);
+        s->use_copy_range = false;
+    }
+
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                          &op->qiov, 0);
     mirror_read_complete(op, ret);
@@ -1714,6 +1747,7 @@ static BlockJob *mirror_start_job(
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->use_copy_range = true;
     if (auto_complete) {
         s->should_complete = true;
     }
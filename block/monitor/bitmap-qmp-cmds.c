@@ -297,6 +297,15 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
             abort();
         }
 
+        /*
+         * dst itself need not be loaded: merging only sets bits, and its
+         * stored bits are ORed in whenever they are read.
+         */
+        if (bdrv_dirty_bitmap_load(src, errp) < 0) {
+            dst = NULL;
+            goto out;
+        }
+
         bdrv_merge_dirty_bitmap(anon, src, NULL, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
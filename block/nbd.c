@@ -34,6 +34,7 @@
 #include "qemu/uri.h"
 #include "qemu/option.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 
 #include "qapi/qapi-visit-sockets.h"
@@ -46,6 +47,7 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -136,17 +138,45 @@ typedef struct BDRVNBDState {
 
     bool wait_connect;
     NBDConnectThread *connect_thread;
+
+    /*
+     * All connections of the node, conns[0] being the BDRVNBDState in
+     * bs->opaque.  Further connections are only opened if the server
+     * advertises NBD_FLAG_CAN_MULTI_CONN; they share the connection
+     * parameters above, which are owned by conns[0].
+     */
+    uint32_t multi_conn;
+    BDRVNBDState **conns;
+    int nr_conns;
 } BDRVNBDState;
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
                                                   Error **errp);
-static QIOChannelSocket *nbd_co_establish_connection(BlockDriverState *bs,
+static QIOChannelSocket *nbd_co_establish_connection(BDRVNBDState *s,
                                                      Error **errp);
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach);
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s, bool detach);
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp);
 
+/* Free the strings in @info, which every connection has its own copy of */
+static void nbd_clear_export_info(NBDExportInfo *info)
+{
+    int i;
+
+    g_free(info->x_dirty_bitmap);
+    info->x_dirty_bitmap = NULL;
+    g_free(info->name);
+    info->name = NULL;
+    g_free(info->description);
+    info->description = NULL;
+    for (i = 0; i < info->n_contexts; i++) {
+        g_free(info->contexts[i]);
+    }
+    g_free(info->contexts);
+    info->contexts = NULL;
+    info->n_contexts = 0;
+}
+
 static void nbd_clear_bdrvstate(BDRVNBDState *s)
 {
     object_unref(OBJECT(s->tlscreds));
@@ -158,6 +188,7 @@ static void nbd_clear_bdrvstate(BDRVNBDState *s)
     s->tlscredsid = NULL;
     g_free(s->x_dirty_bitmap);
     s->x_dirty_bitmap = NULL;
+    nbd_clear_export_info(&s->info);
 }
 
 static void nbd_channel_error(BDRVNBDState *s, int ret)
@@ -188,17 +219,27 @@ static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
     }
 }
 
+static void nbd_conn_detach_aio_context(BDRVNBDState *s)
+{
+    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+}
+
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    for (i = 0; i < s->nr_conns; i++) {
+        if (s->conns[i]->ioc) {
+            nbd_conn_detach_aio_context(s->conns[i]);
+        }
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
-    BlockDriverState *bs = opaque;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = opaque;
+    BlockDriverState *bs = s->bs;
 
     /*
      * The node is still drained, so we know the coroutine has yielded in
@@ -210,10 +251,15 @@ static void nbd_client_attach_aio_context_bh(void *opaque)
     bdrv_dec_in_flight(bs);
 }
 
-static void nbd_client_attach_aio_context(BlockDriverState *bs,
-                                          AioContext *new_context)
+static void nbd_conn_attach_aio_context(BDRVNBDState *s,
+                                        AioContext *new_context)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
+
+    if (!s->connection_co) {
+        /* This connection has already quit */
+        return;
+    }
 
     /*
      * s->connection_co is either yielded from nbd_receive_reply or from
@@ -229,37 +275,56 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
      * Need to wait here for the BH to run because the BH must run while the
      * node is still drained.
      */
-    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, bs);
+    aio_wait_bh_oneshot(new_context, nbd_client_attach_aio_context_bh, s);
 }
 
-static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
+static void nbd_client_attach_aio_context(BlockDriverState *bs,
+                                          AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    s->drained = true;
-    if (s->connection_co_sleep_ns_state) {
-        qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
+    for (i = 0; i < s->nr_conns; i++) {
+        nbd_conn_attach_aio_context(s->conns[i], new_context);
     }
+}
+
+static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
+{
+    BDRVNBDState *bs_state = (BDRVNBDState *)bs->opaque;
+    int i;
+
+    for (i = 0; i < bs_state->nr_conns; i++) {
+        BDRVNBDState *s = bs_state->conns[i];
+
+        s->drained = true;
+        if (s->connection_co_sleep_ns_state) {
+            qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
+        }
 
-    nbd_co_establish_connection_cancel(bs, false);
+        nbd_co_establish_connection_cancel(s, false);
+    }
 }
 
 static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *bs_state = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    s->drained = false;
-    if (s->wait_drained_end) {
-        s->wait_drained_end = false;
-        aio_co_wake(s->connection_co);
+    for (i = 0; i < bs_state->nr_conns; i++) {
+        BDRVNBDState *s = bs_state->conns[i];
+
+        s->drained = false;
+        if (s->wait_drained_end) {
+            s->wait_drained_end = false;
+            aio_co_wake(s->connection_co);
+        }
     }
 }
 
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
     if (s->ioc) {
         /* finish any pending coroutines */
         qio_channel_shutdown(s->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
@@ -274,7 +339,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
         if (s->connection_co_sleep_ns_state) {
             qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
         }
-        nbd_co_establish_connection_cancel(bs, true);
+        nbd_co_establish_connection_cancel(s, true);
     }
     if (qemu_in_coroutine()) {
         s->teardown_co = qemu_coroutine_self();
@@ -282,7 +347,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
         qemu_coroutine_yield();
         s->teardown_co = NULL;
     } else {
-        BDRV_POLL_WHILE(bs, s->connection_co);
+        BDRV_POLL_WHILE(s->bs, s->connection_co);
     }
     assert(!s->connection_co);
 }
@@ -376,10 +441,9 @@ static void *connect_thread_func(void *opaque)
 }
 
 static QIOChannelSocket *coroutine_fn
-nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
+nbd_co_establish_connection(BDRVNBDState *s, Error **errp)
 {
     QemuThread thread;
-    BDRVNBDState *s = bs->opaque;
     QIOChannelSocket *res;
     NBDConnectThread *thr = s->connect_thread;
 
@@ -471,10 +535,8 @@ nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
  * to CONNECT_THREAD_RUNNING_DETACHED state). s->connect_thread becomes NULL if
  * detach is true.
  */
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach)
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s, bool detach)
 {
-    BDRVNBDState *s = bs->opaque;
     NBDConnectThread *thr = s->connect_thread;
     bool wake = false;
     bool do_free = false;
@@ -544,14 +606,14 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
 
     /* Finalize previous connection if any */
     if (s->ioc) {
-        nbd_client_detach_aio_context(s->bs);
+        nbd_conn_detach_aio_context(s);
         object_unref(OBJECT(s->sioc));
         s->sioc = NULL;
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
     }
 
-    sioc = nbd_co_establish_connection(s->bs, &local_err);
+    sioc = nbd_co_establish_connection(s, &local_err);
     if (!sioc) {
         ret = -ECONNREFUSED;
         goto out;
@@ -559,7 +621,7 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
 
     bdrv_dec_in_flight(s->bs);
 
-    ret = nbd_client_handshake(s->bs, sioc, &local_err);
+    ret = nbd_client_handshake(s, sioc, &local_err);
 
     if (s->drained) {
         s->wait_drained_end = true;
@@ -702,7 +764,7 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
 
     s->connection_co = NULL;
     if (s->ioc) {
-        nbd_client_detach_aio_context(s->bs);
+        nbd_conn_detach_aio_context(s);
         object_unref(OBJECT(s->sioc));
         s->sioc = NULL;
         object_unref(OBJECT(s->ioc));
@@ -715,11 +777,10 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(BDRVNBDState *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -1415,12 +1476,40 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
+/*
+ * Pick the connection for a new request: the connected one with the fewest
+ * requests in flight.  The server promised multi-conn consistency, so any
+ * connection will do, flushes included: a flush covers the writes that have
+ * completed on all connections, and the block layer only flushes after the
+ * writes it cares about have completed.
+ */
+static BDRVNBDState *nbd_choose_conn(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *best = s;
+    int i;
+
+    for (i = 1; i < s->nr_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        if (c->state != NBD_CLIENT_CONNECTED) {
+            continue;
+        }
+        if (best->state != NBD_CLIENT_CONNECTED ||
+            c->in_flight < best->in_flight)
+        {
+            best = c;
+        }
+    }
+    return best;
+}
+
 static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_choose_conn(bs);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1431,7 +1520,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        ret = nbd_co_send_request(s, request, write_qiov);
         if (ret < 0) {
             continue;
         }
@@ -1457,7 +1546,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_choose_conn(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1490,7 +1579,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1606,7 +1695,7 @@ static int coroutine_fn nbd_client_co_block_status(
 {
     int ret, request_ret;
     NBDExtent extent = { 0 };
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s = nbd_choose_conn(bs);
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1642,7 +1731,7 @@ static int coroutine_fn nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        ret = nbd_co_send_request(s, &request, NULL);
         if (ret < 0) {
             continue;
         }
@@ -1687,14 +1776,19 @@ static int nbd_client_reopen_prepare(BDRVReopenState *state,
 
 static void nbd_client_close(BlockDriverState *bs)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *bs_state = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < bs_state->nr_conns; i++) {
+        BDRVNBDState *s = bs_state->conns[i];
+
+        if (s->ioc) {
+            nbd_send_request(s->ioc, &request);
+        }
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(s);
+    }
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1718,10 +1812,10 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
 }
 
 /* nbd_client_handshake takes ownership on sioc. On failure it is unref'ed. */
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
 
@@ -1739,8 +1833,7 @@ static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
     s->info.name = g_strdup(s->export ?: "");
     ret = nbd_receive_negotiate(aio_context, QIO_CHANNEL(sioc), s->tlscreds,
                                 s->hostname, &s->ioc, &s->info, errp);
-    g_free(s->info.x_dirty_bitmap);
-    g_free(s->info.name);
+    nbd_clear_export_info(&s->info);
     if (ret < 0) {
         object_unref(OBJECT(sioc));
         s->sioc = NULL;
@@ -2109,6 +2202,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server allows "
+                    "multiple connections. Default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -2165,6 +2264,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -2175,10 +2281,70 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/* Start the connection coroutine of a freshly handshaken connection */
+static void nbd_start_connection(BDRVNBDState *s)
+{
+    s->state = NBD_CLIENT_CONNECTED;
+
+    nbd_init_connect_thread(s);
+
+    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
+    bdrv_inc_in_flight(s->bs);
+    aio_co_schedule(bdrv_get_aio_context(s->bs), s->connection_co);
+}
+
+/*
+ * Open up to s->multi_conn - 1 further connections to the export.  Failing
+ * to do so is not fatal, we just use the connections we have.
+ */
+static void nbd_open_extra_connections(BDRVNBDState *s)
+{
+    Error *local_err = NULL;
+
+    while (s->nr_conns < s->multi_conn) {
+        BDRVNBDState *c = g_new0(BDRVNBDState, 1);
+        QIOChannelSocket *sioc;
+        int ret;
+
+        c->bs = s->bs;
+        c->reconnect_delay = s->reconnect_delay;
+        c->saddr = s->saddr;
+        c->export = s->export;
+        c->tlscredsid = s->tlscredsid;
+        c->tlscreds = s->tlscreds;
+        c->hostname = s->hostname;
+        c->x_dirty_bitmap = s->x_dirty_bitmap;
+        qemu_co_mutex_init(&c->send_mutex);
+        qemu_co_queue_init(&c->free_sema);
+
+        sioc = nbd_establish_connection(c->saddr, &local_err);
+        ret = sioc ? nbd_client_handshake(c, sioc, &local_err) : -ECONNREFUSED;
+        if (ret >= 0 && (c->info.size != s->info.size ||
+                         c->info.flags != s->info.flags))
+        {
+            error_setg(&local_err, "export changed between connections");
+            qio_channel_shutdown(c->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+            nbd_conn_detach_aio_context(c);
+            object_unref(OBJECT(c->sioc));
+            object_unref(OBJECT(c->ioc));
+            ret = -EINVAL;
+        }
+        if (ret < 0) {
+            warn_reportf_err(local_err, "Using %d of %u NBD connections: ",
+                             s->nr_conns, s->multi_conn);
+            nbd_clear_export_info(&c->info);
+            g_free(c);
+            return;
+        }
+
+        s->conns[s->nr_conns++] = c;
+    }
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
-    int ret;
+    int ret, i;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     QIOChannelSocket *sioc;
 
@@ -2200,19 +2366,28 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return -ECONNREFUSED;
     }
 
-    ret = nbd_client_handshake(bs, sioc, errp);
+    ret = nbd_client_handshake(s, sioc, errp);
     if (ret < 0) {
         nbd_clear_bdrvstate(s);
         return ret;
     }
-    /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
 
-    nbd_init_connect_thread(s);
+    s->conns = g_new(BDRVNBDState *, s->multi_conn);
+    s->conns[0] = s;
+    s->nr_conns = 1;
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+    if (s->multi_conn > 1) {
+        if (s->info.flags & NBD_FLAG_CAN_MULTI_CONN) {
+            nbd_open_extra_connections(s);
+        } else {
+            warn_report("NBD server does not allow multiple connections, "
+                        "using a single one");
+        }
+    }
+
+    for (i = 0; i < s->nr_conns; i++) {
+        nbd_start_connection(s->conns[i]);
+    }
 
     return 0;
 }
@@ -2259,8 +2434,22 @@ static void nbd_refresh_limits(BlockDriverState *bs, Error **errp)
 static void nbd_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
+    int i;
 
     nbd_client_close(bs);
+
+    /*
+     * The extra connections share the parameters owned by s, but each has
+     * its own export info
+     */
+    for (i = 1; i < s->nr_conns; i++) {
+        nbd_clear_export_info(&s->conns[i]->info);
+        g_free(s->conns[i]);
+    }
+    g_free(s->conns);
+    s->conns = NULL;
+    s->nr_conns = 0;
+
     nbd_clear_bdrvstate(s);
 }
 
@@ -104,6 +104,8 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* Round-robin cursor over the I/O queues, used in aio_context */
+    unsigned next_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -132,6 +134,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUES "queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -149,6 +152,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -658,17 +666,55 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     };
     if (nvme_cmd_sync(bs, s->queues[INDEX_ADMIN], &cmd)) {
         error_setg(errp, "Failed to create SQ io queue [%d]", n);
-        goto out_error;
+        goto out_delete_cq;
     }
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
     s->nr_queues++;
     return true;
+out_delete_cq:
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_DELETE_CQ,
+        .cdw10 = cpu_to_le32(n & 0xFFFF),
+    };
+    nvme_cmd_sync(bs, s->queues[INDEX_ADMIN], &cmd);
 out_error:
     nvme_free_queue_pair(q);
     return false;
 }
 
+/*
+ * Ask the controller for @nr_io_queues I/O queue pairs.  The controller may
+ * grant fewer; the caller finds out when queue creation starts failing.
+ */
+static void nvme_set_num_queues(BlockDriverState *bs, int nr_io_queues)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(0x07),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) |
+                             (nr_io_queues - 1)),
+    };
+
+    if (nvme_cmd_sync(bs, s->queues[INDEX_ADMIN], &cmd)) {
+        trace_nvme_set_num_queues_failed(s, nr_io_queues);
+    }
+}
+
+/*
+ * Pick the I/O queue for a new request.  All queues are serviced in the same
+ * AioContext, so spreading requests over them mostly buys more request slots
+ * and lets the controller work on several submission queues in parallel.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - INDEX_IO(0);
+
+    assert(nr_io_queues > 0);
+    return s->queues[INDEX_IO(s->next_io_queue++ % nr_io_queues)];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -680,7 +726,7 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int nr_io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     AioContext *aio_context = bdrv_get_aio_context(bs);
@@ -690,6 +736,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     uint64_t deadline, now;
     Error *local_err = NULL;
     volatile NvmeBar *regs = NULL;
+    int max_io_queues;
 
     qemu_co_mutex_init(&s->dma_map_lock);
     qemu_co_queue_init(&s->dma_flush_queue);
@@ -800,8 +847,23 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
+    max_io_queues = NVME_DOORBELL_SIZE /
+                    (sizeof(*s->doorbells) * s->doorbell_scale) - INDEX_IO(0);
+    nr_io_queues = MIN(nr_io_queues, max_io_queues);
+    if (nr_io_queues > 1) {
+        nvme_set_num_queues(bs, nr_io_queues);
+    }
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->nr_queues < INDEX_IO(nr_io_queues)) {
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            warn_reportf_err(local_err, "Using %d of %d NVMe I/O queues: ",
+                             s->nr_queues - INDEX_IO(0), nr_io_queues);
+            local_err = NULL;
+            break;
+        }
     }
 out:
     if (regs) {
@@ -893,6 +955,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    int64_t nr_io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -908,7 +971,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUES, 1);
+    if (nr_io_queues < 1 || nr_io_queues > 0xFFFF) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUES "' must be between 1 "
+                   "and 65535");
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, nr_io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1079,7 +1149,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1098,6 +1168,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1194,7 +1265,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1206,6 +1277,7 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
     };
 
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
@@ -1225,7 +1297,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = ((bytes >> s->blkshift) - 1) & 0xFFFF;
@@ -1258,6 +1330,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
 
     trace_nvme_write_zeroes(s, offset, bytes, flags);
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1278,7 +1351,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -1301,6 +1374,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     }
 
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
 
     buf = qemu_try_memalign(s->page_size, s->page_size);
     if (!buf) {
@@ -1438,9 +1512,6 @@ static void nvme_register_buf(BlockDriverState *bs, void *host, size_t size)
 
     ret = qemu_vfio_dma_map(s->vfio, host, size, false, NULL);
     if (ret) {
-        /* FIXME: we may run out of IOVA addresses after repeated
-         * bdrv_register_buf/bdrv_unregister_buf, because nvme_vfio_dma_unmap
-         * doesn't reclaim addresses for fixed mappings. */
         error_report("nvme_register_buf failed: %s", strerror(-ret));
     }
 }
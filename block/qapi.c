@@ -438,10 +438,17 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
 {
     *not_null = hist->bins != NULL;
     if (*not_null) {
+        g_autofree uint64_t *bins = g_new(uint64_t, hist->nbins);
+        int i;
+
+        for (i = 0; i < hist->nbins; i++) {
+            bins[i] = stat64_get(&hist->bins[i]);
+        }
+
         *info = g_new0(BlockLatencyHistogramInfo, 1);
 
         (*info)->boundaries = uint64_list(hist->boundaries, hist->nbins - 1);
-        (*info)->bins = uint64_list(hist->bins, hist->nbins);
+        (*info)->bins = uint64_list(bins, hist->nbins);
     }
 }
 
@@ -450,34 +457,41 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
 
-    ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
-    ds->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
-    ds->unmap_bytes = stats->nr_bytes[BLOCK_ACCT_UNMAP];
-    ds->rd_operations = stats->nr_ops[BLOCK_ACCT_READ];
-    ds->wr_operations = stats->nr_ops[BLOCK_ACCT_WRITE];
-    ds->unmap_operations = stats->nr_ops[BLOCK_ACCT_UNMAP];
-
-    ds->failed_rd_operations = stats->failed_ops[BLOCK_ACCT_READ];
-    ds->failed_wr_operations = stats->failed_ops[BLOCK_ACCT_WRITE];
-    ds->failed_flush_operations = stats->failed_ops[BLOCK_ACCT_FLUSH];
-    ds->failed_unmap_operations = stats->failed_ops[BLOCK_ACCT_UNMAP];
-
-    ds->invalid_rd_operations = stats->invalid_ops[BLOCK_ACCT_READ];
-    ds->invalid_wr_operations = stats->invalid_ops[BLOCK_ACCT_WRITE];
+    ds->rd_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_READ]);
+    ds->wr_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_WRITE]);
+    ds->unmap_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_UNMAP]);
+    ds->rd_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_READ]);
+    ds->wr_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_WRITE]);
+    ds->unmap_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_UNMAP]);
+
+    ds->failed_rd_operations = stat64_get(&stats->failed_ops[BLOCK_ACCT_READ]);
+    ds->failed_wr_operations = stat64_get(&stats->failed_ops[BLOCK_ACCT_WRITE]);
+    ds->failed_flush_operations =
+        stat64_get(&stats->failed_ops[BLOCK_ACCT_FLUSH]);
+    ds->failed_unmap_operations =
+        stat64_get(&stats->failed_ops[BLOCK_ACCT_UNMAP]);
+
+    ds->invalid_rd_operations =
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_READ]);
+    ds->invalid_wr_operations =
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_WRITE]);
     ds->invalid_flush_operations =
-        stats->invalid_ops[BLOCK_ACCT_FLUSH];
-    ds->invalid_unmap_operations = stats->invalid_ops[BLOCK_ACCT_UNMAP];
-
-    ds->rd_merged = stats->merged[BLOCK_ACCT_READ];
-    ds->wr_merged = stats->merged[BLOCK_ACCT_WRITE];
-    ds->unmap_merged = stats->merged[BLOCK_ACCT_UNMAP];
-    ds->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
-    ds->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
-    ds->rd_total_time_ns = stats->total_time_ns[BLOCK_ACCT_READ];
-    ds->flush_total_time_ns = stats->total_time_ns[BLOCK_ACCT_FLUSH];
-    ds->unmap_total_time_ns = stats->total_time_ns[BLOCK_ACCT_UNMAP];
-
-    ds->has_idle_time_ns = stats->last_access_time_ns > 0;
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_FLUSH]);
+    ds->invalid_unmap_operations =
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_UNMAP]);
+
+    ds->rd_merged = stat64_get(&stats->merged[BLOCK_ACCT_READ]);
+    ds->wr_merged = stat64_get(&stats->merged[BLOCK_ACCT_WRITE]);
+    ds->unmap_merged = stat64_get(&stats->merged[BLOCK_ACCT_UNMAP]);
+    ds->flush_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_FLUSH]);
+    ds->wr_total_time_ns = stat64_get(&stats->total_time_ns[BLOCK_ACCT_WRITE]);
+    ds->rd_total_time_ns = stat64_get(&stats->total_time_ns[BLOCK_ACCT_READ]);
+    ds->flush_total_time_ns =
+        stat64_get(&stats->total_time_ns[BLOCK_ACCT_FLUSH]);
+    ds->unmap_total_time_ns =
+        stat64_get(&stats->total_time_ns[BLOCK_ACCT_UNMAP]);
+
+    ds->has_idle_time_ns = stat64_get(&stats->last_access_time_ns) > 0;
     if (ds->has_idle_time_ns) {
         ds->idle_time_ns = block_acct_idle_time_ns(stats);
     }
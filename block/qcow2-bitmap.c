@@ -89,6 +89,7 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    bool keep_table; /* the stored data is still current, don't rewrite it */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
@@ -333,8 +334,14 @@ static int load_bitmap_data(BlockDriverState *bs,
             if (ret < 0) {
                 goto finish;
             }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
-                                               false);
+            /*
+             * Like above, no need to deserialize zeros.  Skipping them keeps
+             * the memory of large, mostly clean bitmaps unbacked.
+             */
+            if (!buffer_is_zero(buf, s->cluster_size)) {
+                bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+                                                   false);
+            }
         }
     }
     ret = 0;
@@ -347,18 +354,56 @@ finish:
     return ret;
 }
 
+/* Where to find the stored data of a bitmap that is not loaded yet */
+typedef struct Qcow2LazyBitmap {
+    BlockDriverState *bs;
+    Qcow2BitmapTable table;
+    char name[];
+} Qcow2LazyBitmap;
+
+/* BdrvDirtyBitmapLoadFunc for bitmaps set up by load_bitmap() */
+static int load_bitmap_lazy(BdrvDirtyBitmap *bitmap, void *opaque,
+                            Error **errp)
+{
+    Qcow2LazyBitmap *lb = opaque;
+    uint64_t *bitmap_table = NULL;
+    int ret;
+
+    ret = bitmap_table_load(lb->bs, &lb->table, &bitmap_table);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Could not read bitmap_table table from image for "
+                         "bitmap '%s'", lb->name);
+        return ret;
+    }
+
+    ret = load_bitmap_data(lb->bs, bitmap_table, lb->table.size, bitmap);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
+                         lb->name);
+    }
+
+    g_free(bitmap_table);
+    return ret;
+}
+
+/*
+ * Create the in-memory bitmap for @bm.  Its data is only read from the image
+ * when something needs it, see bdrv_dirty_bitmap_load(); until then writes
+ * are recorded on top of an empty bitmap.
+ */
 static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
                                     Qcow2Bitmap *bm, Error **errp)
 {
-    int ret;
-    uint64_t *bitmap_table = NULL;
     uint32_t granularity;
     BdrvDirtyBitmap *bitmap = NULL;
+    Qcow2LazyBitmap *lb;
+    size_t name_size;
 
     granularity = 1U << bm->granularity_bits;
     bitmap = bdrv_create_dirty_bitmap(bs, granularity, bm->name, errp);
     if (bitmap == NULL) {
-        goto fail;
+        return NULL;
     }
 
     if (bm->flags & BME_FLAG_IN_USE) {
@@ -366,31 +411,14 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         return bitmap;
     }
 
-    ret = bitmap_table_load(bs, &bm->table, &bitmap_table);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret,
-                         "Could not read bitmap_table table from image for "
-                         "bitmap '%s'", bm->name);
-        goto fail;
-    }
+    name_size = strlen(bm->name) + 1;
+    lb = g_malloc(sizeof(*lb) + name_size);
+    lb->bs = bs;
+    lb->table = bm->table;
+    memcpy(lb->name, bm->name, name_size);
+    bdrv_dirty_bitmap_set_lazy_load(bitmap, load_bitmap_lazy, lb);
 
-    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
-                         bm->name);
-        goto fail;
-    }
-
-    g_free(bitmap_table);
     return bitmap;
-
-fail:
-    g_free(bitmap_table);
-    if (bitmap != NULL) {
-        bdrv_release_dirty_bitmap(bitmap);
-    }
-
-    return NULL;
 }
 
 /*
@@ -1611,10 +1639,20 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            if (bdrv_dirty_bitmap_lazy(bitmap) &&
+                bdrv_get_dirty_count(bitmap) == 0)
+            {
+                /* Neither loaded nor written to: only the flags change */
+                bm->keep_table = true;
+            } else {
+                if (bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+                    goto fail;
+                }
+                tb = g_memdup(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
         }
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1634,7 +1672,9 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
 
-        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap)) {
+        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap) ||
+            bm->keep_table)
+        {
             continue;
         }
 
@@ -1674,7 +1714,7 @@ success:
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
-            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
+            bm->keep_table || bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
         {
             continue;
         }
@@ -215,6 +215,38 @@ static int l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Load the L2 slice that maps guest @offset into the L2 cache without
+ * changing any metadata.  Offsets without an L2 table are skipped, errors in
+ * the L1 entry are left for the actual access to report.
+ *
+ * Must be called with s->lock held.
+ */
+int qcow2_prefetch_l2_slice(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l1_index, l2_offset, *l2_slice;
+    int ret;
+
+    l1_index = offset_to_l1_index(s, offset);
+    if (l1_index >= s->l1_size) {
+        return 0;
+    }
+
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return 0;
+    }
+
+    ret = l2_load(bs, offset, l2_offset, &l2_slice);
+    if (ret < 0) {
+        return ret;
+    }
+
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    return 0;
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -1281,6 +1313,15 @@ static int calculate_l2_meta(BlockDriverState *bs, uint64_t host_cluster_offset,
         }
     }
 
+    s->stats.cow_bytes += (cow_start_to - cow_start_from) +
+                          (cow_end_to - cow_end_from);
+    if (has_subclusters(s) && !keep_old) {
+        /* Without subclusters, the whole rest of the clusters is copied */
+        s->stats.cow_bytes_avoided +=
+            cow_start_from + ROUND_UP(cow_end_from, s->cluster_size) -
+            cow_end_to;
+    }
+
     *m = g_malloc0(sizeof(**m));
     **m = (QCowL2Meta) {
         .next           = old_m,
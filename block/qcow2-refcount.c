@@ -28,6 +28,7 @@
 #include "qemu/range.h"
 #include "qemu/bswap.h"
 #include "qemu/cutils.h"
+#include "block/aio_task.h"
 #include "trace.h"
 
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
@@ -1241,10 +1242,27 @@ int coroutine_fn qcow2_flush_caches(BlockDriverState *bs)
 /* update the refcounts of snapshots and the copied flag */
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend)
+{
+    return qcow2_update_snapshot_refcount_except(bs, l1_table_offset, l1_size,
+                                                 addend, NULL, 0);
+}
+
+/*
+ * Like qcow2_update_snapshot_refcount(), but does not touch the L2 tables
+ * that @other_l1_table (in CPU byte order) has at the same L1 index.  This
+ * is for callers that take a reference to these tables through one L1
+ * table and drop one through the other, so that their refcounts and those
+ * of the clusters they map do not change.  The copied flag of the L1 entry
+ * is still updated.
+ */
+int qcow2_update_snapshot_refcount_except(BlockDriverState *bs,
+    int64_t l1_table_offset, int l1_size, int addend,
+    const uint64_t *other_l1_table, int other_l1_size)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table, *l2_slice, l2_offset, entry, l1_size2, refcount;
     bool l1_allocated = false;
+    bool shared;
     int64_t old_entry, old_l2_offset;
     unsigned slice, slice_size2, n_slices;
     int i, j, l1_modified = 0, nb_csectors;
@@ -1299,7 +1317,10 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                 goto fail;
             }
 
-            for (slice = 0; slice < n_slices; slice++) {
+            shared = i < other_l1_size &&
+                     (other_l1_table[i] & L1E_OFFSET_MASK) == l2_offset;
+
+            for (slice = 0; slice < n_slices && !shared; slice++) {
                 ret = qcow2_cache_get(bs, s->l2_table_cache,
                                       l2_offset + slice * slice_size2,
                                       (void **) &l2_slice);
@@ -1394,7 +1415,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                 qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
             }
 
-            if (addend != 0) {
+            if (addend != 0 && !shared) {
                 ret = qcow2_update_cluster_refcount(bs, l2_offset >>
                                                         s->cluster_bits,
                                                     abs(addend), addend < 0,
@@ -1766,11 +1787,38 @@ fail:
     return ret;
 }
 
+typedef struct Qcow2CheckL2Task {
+    AioTask task;
+
+    BlockDriverState *bs;
+    BdrvCheckResult *res;
+    void **refcount_table;
+    int64_t *refcount_table_size;
+    int64_t l2_offset;
+    int flags;
+    BdrvCheckMode fix;
+    bool active;
+} Qcow2CheckL2Task;
+
+static coroutine_fn int check_refcounts_l2_task_entry(AioTask *task)
+{
+    Qcow2CheckL2Task *t = container_of(task, Qcow2CheckL2Task, task);
+
+    return check_refcounts_l2(t->bs, t->res, t->refcount_table,
+                              t->refcount_table_size, t->l2_offset,
+                              t->flags, t->fix, t->active);
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
  * on L1 and L2 entries.
  *
+ * In coroutine context, up to QCOW2_MAX_WORKERS L2 tables are read and
+ * checked at the same time.  The tasks all run in the same AioContext and
+ * only yield for I/O, so they can update the refcount table and @res
+ * directly.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1783,6 +1831,7 @@ static int check_refcounts_l1(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
+    AioTaskPool *pool = NULL;
     int i, ret;
 
     l1_size2 = l1_size * L1E_SIZE;
@@ -1812,8 +1861,12 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
+    if (l1_size > 0 && qemu_in_coroutine()) {
+        pool = aio_task_pool_new(QCOW2_MAX_WORKERS);
+    }
+
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
+    for (i = 0; i < l1_size && aio_task_pool_status(pool) == 0; i++) {
         l2_offset = l1_table[i];
         if (l2_offset) {
             /* Mark L2 table as used */
@@ -1833,6 +1886,24 @@ static int check_refcounts_l1(BlockDriverState *bs,
             }
 
             /* Process and check L2 entries */
+            if (pool) {
+                Qcow2CheckL2Task *t = g_new(Qcow2CheckL2Task, 1);
+
+                *t = (Qcow2CheckL2Task) {
+                    .task.func = check_refcounts_l2_task_entry,
+                    .bs = bs,
+                    .res = res,
+                    .refcount_table = refcount_table,
+                    .refcount_table_size = refcount_table_size,
+                    .l2_offset = l2_offset,
+                    .flags = flags,
+                    .fix = fix,
+                    .active = active,
+                };
+                aio_task_pool_start_task(pool, &t->task);
+                continue;
+            }
+
             ret = check_refcounts_l2(bs, res, refcount_table,
                                      refcount_table_size, l2_offset, flags,
                                      fix, active);
@@ -1841,10 +1912,16 @@ static int check_refcounts_l1(BlockDriverState *bs,
             }
         }
     }
-    g_free(l1_table);
-    return 0;
+    ret = 0;
 
 fail:
+    if (pool) {
+        aio_task_pool_wait_all(pool);
+        if (ret == 0) {
+            ret = aio_task_pool_status(pool);
+        }
+        aio_task_pool_free(pool);
+    }
     g_free(l1_table);
     return ret;
 }
@@ -821,6 +821,10 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
      * increase all refcounts for the clusters referenced by the new one.
      * Decrease the refcount referenced by the old one only when the L1
      * table is overwritten.
+     *
+     * L2 tables that are the same in both L1 tables gain a reference and
+     * lose one, so they are skipped; after reverting a guest that wrote to
+     * few L2 tables since the snapshot, this leaves little to walk.
      */
     sn_l1_table = g_try_malloc0(cur_l1_bytes);
     if (cur_l1_bytes && sn_l1_table == NULL) {
@@ -834,8 +838,13 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
         goto fail;
     }
 
-    ret = qcow2_update_snapshot_refcount(bs, sn->l1_table_offset,
-                                         sn->l1_size, 1);
+    for (i = 0; i < s->l1_size; i++) {
+        be64_to_cpus(&sn_l1_table[i]);
+    }
+
+    ret = qcow2_update_snapshot_refcount_except(bs, sn->l1_table_offset,
+                                                sn->l1_size, 1,
+                                                s->l1_table, s->l1_size);
     if (ret < 0) {
         goto fail;
     }
@@ -847,8 +856,14 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
         goto fail;
     }
 
+    for (i = 0; i < s->l1_size; i++) {
+        cpu_to_be64s(&sn_l1_table[i]);
+    }
     ret = bdrv_pwrite_sync(bs->file, s->l1_table_offset, sn_l1_table,
                            cur_l1_bytes);
+    for (i = 0; i < s->l1_size; i++) {
+        be64_to_cpus(&sn_l1_table[i]);
+    }
     if (ret < 0) {
         goto fail;
     }
@@ -863,33 +878,42 @@ int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id)
      * the in-memory data instead of really using the offset to load a new one,
      * which is why this works.
      */
-    ret = qcow2_update_snapshot_refcount(bs, s->l1_table_offset,
-                                         s->l1_size, -1);
+    ret = qcow2_update_snapshot_refcount_except(bs, s->l1_table_offset,
+                                                s->l1_size, -1,
+                                                sn_l1_table, s->l1_size);
 
     /*
      * Now update the in-memory L1 table to be in sync with the on-disk one. We
-     * need to do this even if updating refcounts failed.
+     * need to do this even if updating refcounts failed.  sn_l1_table keeps
+     * the old L1 table for the update of QCOW_OFLAG_COPIED below.
      */
     for(i = 0;i < s->l1_size; i++) {
-        s->l1_table[i] = be64_to_cpu(sn_l1_table[i]);
+        uint64_t old_entry = s->l1_table[i];
+
+        s->l1_table[i] = sn_l1_table[i];
+        sn_l1_table[i] = old_entry;
     }
 
     if (ret < 0) {
         goto fail;
     }
 
-    g_free(sn_l1_table);
-    sn_l1_table = NULL;
-
     /*
      * Update QCOW_OFLAG_COPIED in the active L1 table (it may have changed
-     * when we decreased the refcount of the old snapshot.
+     * when we decreased the refcount of the old snapshot.  The L2 tables
+     * that were kept have the same references as before, so only the
+     * copied flag of their L1 entries needs to be looked at.
      */
-    ret = qcow2_update_snapshot_refcount(bs, s->l1_table_offset, s->l1_size, 0);
+    ret = qcow2_update_snapshot_refcount_except(bs, s->l1_table_offset,
+                                                s->l1_size, 0,
+                                                sn_l1_table, s->l1_size);
     if (ret < 0) {
         goto fail;
     }
 
+    g_free(sn_l1_table);
+    sn_l1_table = NULL;
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
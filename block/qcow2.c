@@ -316,7 +316,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, QCOW2_MAX_THREADS, errp);
+                                           bs, cflags, s->max_threads, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -1302,6 +1302,12 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     uint64_t l1_vm_state_index;
     bool update_header = false;
 
+    /* Needed before opening the crypto layer, which keeps a cipher each */
+    s->max_threads = QCOW2_MAX_THREADS;
+#ifdef _SC_NPROCESSORS_ONLN
+    s->max_threads = MAX(s->max_threads, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+
     ret = bdrv_pread(bs->file, 0, &header, sizeof(header));
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read qcow2 header");
@@ -1669,7 +1675,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            NULL, NULL, cflags,
-                                           QCOW2_MAX_THREADS, errp);
+                                           s->max_threads, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1832,6 +1838,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    QTAILQ_INIT(&s->compressed_writes);
+    qemu_co_queue_init(&s->compressed_alloc_queue);
 
     return ret;
 
@@ -2279,6 +2287,91 @@ static coroutine_fn int qcow2_co_preadv_task_entry(AioTask *task)
                                 t->qiov, t->qiov_offset);
 }
 
+typedef struct Qcow2L2Prefetch {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t end;
+} Qcow2L2Prefetch;
+
+static void coroutine_fn qcow2_co_l2_prefetch_entry(void *opaque)
+{
+    Qcow2L2Prefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t offset;
+    int ret = 0;
+
+    trace_qcow2_l2_prefetch(qemu_coroutine_self(), bs, p->offset, p->end);
+
+    /*
+     * Drop the lock between slices so that guest requests mapped by slices
+     * that are already cached do not wait for the whole prefetch.
+     */
+    for (offset = p->offset; offset < p->end && ret == 0;
+         offset += slice_bytes) {
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_prefetch_l2_slice(bs, offset);
+        qemu_co_mutex_unlock(&s->lock);
+    }
+
+    s->l2_prefetch_busy = false;
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Track sequential reads and, once a stream has been detected, start loading
+ * the L2 slices that map the area after the current request in the
+ * background.  This keeps L2 cache misses off the critical path of backups,
+ * image streaming and other large sequential readers.
+ */
+static void qcow2_l2_prefetch_account(BlockDriverState *bs, uint64_t offset,
+                                      uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t) s->l2_slice_size << s->cluster_bits;
+    uint64_t end = offset + bytes;
+    uint64_t start, prefetch_end;
+    Qcow2L2Prefetch *p;
+    Coroutine *co;
+
+    if (offset == s->seq_read_end) {
+        s->seq_read_count++;
+    } else {
+        s->seq_read_count = 0;
+        s->l2_prefetch_end = 0;
+    }
+    s->seq_read_end = end;
+
+    if (s->seq_read_count < QCOW2_L2_PREFETCH_THRESHOLD ||
+        s->l2_prefetch_busy) {
+        return;
+    }
+
+    start = MAX(ROUND_UP(end, slice_bytes), s->l2_prefetch_end);
+    prefetch_end = MIN(ROUND_UP(end, slice_bytes) +
+                       QCOW2_L2_PREFETCH_SLICES * slice_bytes,
+                       bs->total_sectors * BDRV_SECTOR_SIZE);
+    if (start >= prefetch_end) {
+        return;
+    }
+
+    p = g_new(Qcow2L2Prefetch, 1);
+    *p = (Qcow2L2Prefetch) {
+        .bs = bs,
+        .offset = start,
+        .end = prefetch_end,
+    };
+    s->l2_prefetch_end = prefetch_end;
+    s->l2_prefetch_busy = true;
+
+    /* The coroutine runs once the current request yields */
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_co_l2_prefetch_entry, p);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
 static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
                                              uint64_t offset, uint64_t bytes,
                                              QEMUIOVector *qiov,
@@ -2291,6 +2384,8 @@ static coroutine_fn int qcow2_co_preadv_part(BlockDriverState *bs,
     QCow2SubclusterType type;
     AioTaskPool *aio = NULL;
 
+    qcow2_l2_prefetch_account(bs, offset, bytes);
+
     while (bytes != 0 && aio_task_pool_status(aio) == 0) {
         /* prepare next request */
         cur_bytes = MIN(bytes, INT_MAX);
@@ -4463,6 +4558,31 @@ fail:
     return ret;
 }
 
+/* Queue a compressed write for allocation in guest offset order */
+static void qcow2_compressed_write_enqueue(BDRVQcow2State *s,
+                                           Qcow2CompressedWrite *w,
+                                           uint64_t offset)
+{
+    Qcow2CompressedWrite *cur;
+
+    w->offset = offset;
+    QTAILQ_FOREACH_REVERSE(cur, &s->compressed_writes, next) {
+        if (cur->offset < offset) {
+            QTAILQ_INSERT_AFTER(&s->compressed_writes, cur, w, next);
+            return;
+        }
+    }
+    QTAILQ_INSERT_HEAD(&s->compressed_writes, w, next);
+}
+
+/* Called with s->lock held */
+static void qcow2_compressed_write_dequeue(BDRVQcow2State *s,
+                                           Qcow2CompressedWrite *w)
+{
+    QTAILQ_REMOVE(&s->compressed_writes, w, next);
+    qemu_co_queue_restart_all(&s->compressed_alloc_queue);
+}
+
 static coroutine_fn int
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
@@ -4473,10 +4593,17 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     ssize_t out_len;
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
+    Qcow2CompressedWrite w;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
 
+    /*
+     * Take a place in the allocation order before compressing so that writes
+     * submitted later for lower offsets do not overtake this one.
+     */
+    qcow2_compressed_write_enqueue(s, &w, offset);
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes < s->cluster_size) {
         /* Zero-pad last write if image size is not cluster aligned */
@@ -4488,21 +4615,30 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
                                 buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
+
+    qemu_co_mutex_lock(&s->lock);
+    if (out_len < 0) {
+        qcow2_compressed_write_dequeue(s, &w);
+        qemu_co_mutex_unlock(&s->lock);
+        if (out_len != -ENOMEM) {
+            ret = -EINVAL;
+            goto fail;
+        }
+
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
         if (ret < 0) {
             goto fail;
         }
         goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    while (QTAILQ_FIRST(&s->compressed_writes) != &w) {
+        qemu_co_queue_wait(&s->compressed_alloc_queue, &s->lock);
+    }
     ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
                                                 &cluster_offset);
+    qcow2_compressed_write_dequeue(s, &w);
     if (ret < 0) {
         qemu_co_mutex_unlock(&s->lock);
         goto fail;
@@ -5030,9 +5166,24 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     BDRVQcow2State *s = bs->opaque;
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
+    bdi->orders_compressed_writes = true;
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2 = (BlockStatsSpecificQcow2) {
+        .cow_bytes = s->stats.cow_bytes,
+        .cow_bytes_avoided = s->stats.cow_bytes_avoided,
+    };
+
+    return stats;
+}
+
 static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
                                                   Error **errp)
 {
@@ -5886,6 +6037,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -71,6 +71,12 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Number of back-to-back sequential reads before L2 slices are prefetched */
+#define QCOW2_L2_PREFETCH_THRESHOLD 4
+
+/* Number of L2 slices loaded ahead of a sequential reader */
+#define QCOW2_L2_PREFETCH_SLICES 2
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -324,6 +330,11 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+typedef struct Qcow2CompressedWrite {
+    uint64_t offset;
+    QTAILQ_ENTRY(Qcow2CompressedWrite) next;
+} Qcow2CompressedWrite;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -408,6 +419,21 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    /*
+     * Compressed writes waiting to allocate host clusters, sorted by guest
+     * offset.  Compression runs in parallel but allocation happens in this
+     * order so that the image stays laid out sequentially.
+     */
+    QTAILQ_HEAD(, Qcow2CompressedWrite) compressed_writes;
+    CoQueue compressed_alloc_queue;
+
+    /* Sequential read detection for L2 slice prefetch */
+    uint64_t seq_read_end;
+    unsigned int seq_read_count;
+    uint64_t l2_prefetch_end;
+    bool l2_prefetch_busy;
 
     BdrvChild *data_file;
 
@@ -420,6 +446,13 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    struct {
+        /* Bytes in the COW regions of newly allocated clusters */
+        uint64_t cow_bytes;
+        /* COW bytes saved because only the touched subclusters are copied */
+        uint64_t cow_bytes_avoided;
+    } stats;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -869,6 +902,9 @@ void qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
 
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend);
+int qcow2_update_snapshot_refcount_except(BlockDriverState *bs,
+    int64_t l1_table_offset, int l1_size, int addend,
+    const uint64_t *other_l1_table, int other_l1_size);
 
 int coroutine_fn qcow2_flush_caches(BlockDriverState *bs);
 int coroutine_fn qcow2_write_caches(BlockDriverState *bs);
@@ -904,6 +940,7 @@ int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
 int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                           unsigned int *bytes, uint64_t *host_offset,
                           QCow2SubclusterType *subcluster_type);
+int qcow2_prefetch_l2_slice(BlockDriverState *bs, uint64_t offset);
 int qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                             unsigned int *bytes, uint64_t *host_offset,
                             QCowL2Meta **m);
@@ -17,6 +17,7 @@
 #include "qemu/cutils.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "block/block_int.h"
 #include "block/qdict.h"
 #include "qapi/error.h"
@@ -35,6 +36,19 @@
 #define QUORUM_OPT_BLKVERIFY      "blkverify"
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
+#define QUORUM_OPT_HEDGE_THRESHOLD "hedge-threshold"
+
+/* How long a child that failed a read is avoided by read-pattern=fastest */
+#define QUORUM_CHILD_RETRY_NS     (1000 * SCALE_MS)
+
+/* Every that many reads, read-pattern=fastest samples a child in turn */
+#define QUORUM_PROBE_INTERVAL     128
+
+/* Read statistics of a child, used by read-pattern=fastest */
+typedef struct QuorumChildStats {
+    int64_t latency_ns;         /* moving average, 0 if not measured yet */
+    int64_t failed_until_ns;    /* avoid the child until then */
+} QuorumChildStats;
 
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
@@ -90,6 +104,12 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
+
+    /* Indexed like @children */
+    QuorumChildStats *child_stats;
+    unsigned reads_since_probe;
+    unsigned next_probe_child;
+    int64_t hedge_threshold_ns; /* 0 disables hedged reads */
 } BDRVQuorumState;
 
 typedef struct QuorumAIOCB QuorumAIOCB;
@@ -662,6 +682,254 @@ static int read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+/* Called after every read from child @i to keep its statistics current */
+static void quorum_account_read(BDRVQuorumState *s, int i, int64_t start_ns,
+                                int ret)
+{
+    QuorumChildStats *stats = &s->child_stats[i];
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (ret < 0) {
+        stats->failed_until_ns = now + QUORUM_CHILD_RETRY_NS;
+        return;
+    }
+
+    stats->failed_until_ns = 0;
+    if (!stats->latency_ns) {
+        stats->latency_ns = MAX(now - start_ns, 1);
+    } else {
+        /* EWMA with a weight of 1/8 for the new sample */
+        stats->latency_ns += (now - start_ns - stats->latency_ns) / 8;
+        stats->latency_ns = MAX(stats->latency_ns, 1);
+    }
+}
+
+/*
+ * Fill @order with the indices of all children: healthy ones first,
+ * ordered by their average read latency (children that have not been
+ * read from yet count as fastest), followed by those that failed
+ * recently.  Every QUORUM_PROBE_INTERVAL reads, the next child in turn is
+ * put first, so that the statistics of slow children are refreshed, too.
+ */
+static void quorum_children_by_latency(BDRVQuorumState *s, int *order)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int i, j;
+
+    for (i = 0; i < s->num_children; i++) {
+        QuorumChildStats *stats = &s->child_stats[i];
+        bool failed = stats->failed_until_ns > now;
+
+        /* Insertion sort, there are only a handful of children */
+        for (j = i; j > 0; j--) {
+            QuorumChildStats *prev = &s->child_stats[order[j - 1]];
+            bool prev_failed = prev->failed_until_ns > now;
+
+            if (prev_failed < failed ||
+                (prev_failed == failed &&
+                 prev->latency_ns <= stats->latency_ns)) {
+                break;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    if (++s->reads_since_probe >= QUORUM_PROBE_INTERVAL) {
+        int probe = s->next_probe_child++ % s->num_children;
+
+        s->reads_since_probe = 0;
+        for (i = 0; order[i] != probe; i++) {
+            /* find it */
+        }
+        memmove(&order[1], &order[0], i * sizeof(order[0]));
+        order[0] = probe;
+    }
+}
+
+/*
+ * State of a hedged read.  It outlives the QuorumAIOCB if the losing child
+ * read is still in flight when the request is completed; whoever drops the
+ * last reference frees it.
+ */
+typedef struct QuorumHedgedRead {
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+
+    Coroutine *waiter;
+    bool waiting;
+    QemuCoSleepState *sleep_state;
+
+    int refcnt;
+    int pending;
+    int winner;             /* index into @reads, -1 while there is none */
+    int ret;
+
+    struct {
+        int child;
+        uint8_t *buf;
+        QEMUIOVector qiov;
+    } reads[2];
+    int num_reads;
+} QuorumHedgedRead;
+
+typedef struct QuorumHedgedReadCo {
+    QuorumHedgedRead *hr;
+    int idx;
+} QuorumHedgedReadCo;
+
+static void quorum_hedged_read_unref(QuorumHedgedRead *hr)
+{
+    int i;
+
+    if (--hr->refcnt) {
+        return;
+    }
+
+    for (i = 0; i < hr->num_reads; i++) {
+        qemu_vfree(hr->reads[i].buf);
+        qemu_iovec_destroy(&hr->reads[i].qiov);
+    }
+    g_free(hr);
+}
+
+static void coroutine_fn quorum_hedged_read_entry(void *opaque)
+{
+    QuorumHedgedReadCo *data = opaque;
+    QuorumHedgedRead *hr = data->hr;
+    int idx = data->idx;
+    BDRVQuorumState *s = hr->bs->opaque;
+    BdrvChild *child = s->children[hr->reads[idx].child];
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int ret;
+
+    ret = bdrv_co_preadv(child, hr->offset, hr->bytes,
+                         &hr->reads[idx].qiov, 0);
+    quorum_account_read(s, hr->reads[idx].child, start_ns, ret);
+
+    if (ret < 0) {
+        quorum_report_bad(QUORUM_OP_TYPE_READ, hr->offset, hr->bytes,
+                          child->bs->node_name, ret);
+        hr->ret = ret;
+    } else if (hr->winner < 0) {
+        hr->winner = idx;
+    }
+    hr->pending--;
+
+    if (hr->winner >= 0 || !hr->pending) {
+        if (hr->sleep_state) {
+            qemu_co_sleep_wake(hr->sleep_state);
+        } else if (hr->waiting) {
+            hr->waiting = false;
+            aio_co_wake(hr->waiter);
+        }
+    }
+
+    quorum_hedged_read_unref(hr);
+}
+
+static void quorum_hedged_read_start(QuorumHedgedRead *hr, int child)
+{
+    BDRVQuorumState *s = hr->bs->opaque;
+    QuorumHedgedReadCo data = {
+        .hr = hr,
+        .idx = hr->num_reads++,
+    };
+    Coroutine *co;
+
+    hr->reads[data.idx].child = child;
+    hr->reads[data.idx].buf = qemu_blockalign(s->children[child]->bs,
+                                              hr->bytes);
+    qemu_iovec_init_buf(&hr->reads[data.idx].qiov, hr->reads[data.idx].buf,
+                        hr->bytes);
+
+    hr->refcnt++;
+    hr->pending++;
+    co = qemu_coroutine_create(quorum_hedged_read_entry, &data);
+    qemu_coroutine_enter(co);
+}
+
+/*
+ * Read from @order[0] and, if it has not answered within the hedging
+ * threshold, from @order[1] as well.  Returns the number of children that
+ * were tried; if none of them succeeded, *ret is set to the error.
+ */
+static int read_hedged(QuorumAIOCB *acb, int *order, int *ret)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    QuorumHedgedRead *hr = g_new0(QuorumHedgedRead, 1);
+    int tried;
+
+    hr->bs = acb->bs;
+    hr->offset = acb->offset;
+    hr->bytes = acb->bytes;
+    hr->waiter = qemu_coroutine_self();
+    hr->refcnt = 1;
+    hr->winner = -1;
+
+    quorum_hedged_read_start(hr, order[0]);
+    if (hr->winner < 0 && hr->pending) {
+        qemu_co_sleep_ns_wakeable(QEMU_CLOCK_REALTIME, s->hedge_threshold_ns,
+                                  &hr->sleep_state);
+    }
+    if (hr->winner < 0) {
+        quorum_hedged_read_start(hr, order[1]);
+    }
+    while (hr->winner < 0 && hr->pending) {
+        hr->waiting = true;
+        qemu_coroutine_yield();
+    }
+
+    if (hr->winner >= 0) {
+        qemu_iovec_from_buf(acb->qiov, 0, hr->reads[hr->winner].buf,
+                            acb->bytes);
+        *ret = 0;
+    } else {
+        *ret = hr->ret;
+    }
+    tried = hr->num_reads;
+
+    /* A losing read may still be in flight; it must not wake us anymore */
+    hr->waiter = NULL;
+    quorum_hedged_read_unref(hr);
+
+    return tried;
+}
+
+static int read_fastest_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    g_autofree int *order = g_new(int, s->num_children);
+    int i = 0, ret = -EIO;
+
+    quorum_children_by_latency(s, order);
+
+    if (s->hedge_threshold_ns && s->num_children > 1) {
+        i = read_hedged(acb, order, &ret);
+        if (ret == 0) {
+            return 0;
+        }
+    }
+
+    /* Try the remaining children from the fastest to the slowest */
+    for (; i < s->num_children; i++) {
+        int n = order[i];
+        int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        acb->qcrs[n].bs = s->children[n]->bs;
+        ret = bdrv_co_preadv(s->children[n], acb->offset, acb->bytes,
+                             acb->qiov, 0);
+        quorum_account_read(s, n, start_ns, ret);
+        if (ret == 0) {
+            break;
+        }
+        quorum_report_bad_acb(&acb->qcrs[n], ret);
+    }
+
+    return ret;
+}
+
 static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -672,10 +940,16 @@ static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_FASTEST:
+        ret = read_fastest_child(acb);
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
@@ -890,7 +1164,13 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, fastest. Quorum is default",
+        },
+        {
+            .name = QUORUM_OPT_HEDGE_THRESHOLD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Microseconds before a read is hedged to a second child "
+                    "(read-pattern=fastest only)",
         },
         { /* end of list */ }
     },
@@ -943,11 +1223,21 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(errp, "Please set read-pattern as fifo or quorum");
+        error_setg(errp, "Please set read-pattern as fifo, fastest or quorum");
         goto exit;
     }
     s->read_pattern = ret;
 
+    s->hedge_threshold_ns = qemu_opt_get_number(opts,
+                                                QUORUM_OPT_HEDGE_THRESHOLD,
+                                                0) * SCALE_US;
+    if (s->hedge_threshold_ns &&
+        s->read_pattern != QUORUM_READ_PATTERN_FASTEST) {
+        error_setg(errp, "hedge-threshold requires read-pattern=fastest");
+        ret = -EINVAL;
+        goto exit;
+    }
+
     if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
         s->is_blkverify = qemu_opt_get_bool(opts, QUORUM_OPT_BLKVERIFY, false);
         if (s->is_blkverify && (s->num_children != 2 || s->threshold != 2)) {
@@ -969,6 +1259,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* allocate the children array */
     s->children = g_new0(BdrvChild *, s->num_children);
+    s->child_stats = g_new0(QuorumChildStats, s->num_children);
     opened = g_new0(bool, s->num_children);
 
     for (i = 0; i < s->num_children; i++) {
@@ -1003,6 +1294,7 @@ close_exit:
         bdrv_unref_child(bs, s->children[i]);
     }
     g_free(s->children);
+    g_free(s->child_stats);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -1019,6 +1311,7 @@ static void quorum_close(BlockDriverState *bs)
     }
 
     g_free(s->children);
+    g_free(s->child_stats);
 }
 
 static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
@@ -1060,6 +1353,9 @@ static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
         goto out;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->child_stats = g_renew(QuorumChildStats, s->child_stats,
+                             s->num_children + 1);
+    s->child_stats[s->num_children] = (QuorumChildStats) {};
     s->children[s->num_children++] = child;
 
 out:
@@ -1102,6 +1398,8 @@ static void quorum_del_child(BlockDriverState *bs, BdrvChild *child,
     /* We can safely remove this child now */
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->child_stats[i], &s->child_stats[i + 1],
+            (s->num_children - i - 1) * sizeof(QuorumChildStats));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
     bdrv_unref_child(bs, child);
 
@@ -22,6 +22,8 @@
 #include "block/qdict.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "qemu/event_notifier.h"
+#include "qemu/coroutine.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qdict.h"
@@ -66,13 +68,6 @@
 
 #define RBD_MAX_SNAPS 100
 
-/* The LIBRBD_SUPPORTS_IOVEC is defined in librbd.h */
-#ifdef LIBRBD_SUPPORTS_IOVEC
-#define LIBRBD_USE_IOVEC 1
-#else
-#define LIBRBD_USE_IOVEC 0
-#endif
-
 typedef enum {
     RBD_AIO_READ,
     RBD_AIO_WRITE,
@@ -80,23 +75,14 @@ typedef enum {
     RBD_AIO_FLUSH
 } RBDAIOCmd;
 
-typedef struct RBDAIOCB {
-    BlockAIOCB common;
+/* A request in flight, owned by the coroutine waiting for it */
+typedef struct RBDTask {
+    BlockDriverState *bs;
+    Coroutine *co;
+    bool complete;
     int64_t ret;
-    QEMUIOVector *qiov;
-    char *bounce;
-    RBDAIOCmd cmd;
-    int error;
-    struct BDRVRBDState *s;
-} RBDAIOCB;
-
-typedef struct RADOSCB {
-    RBDAIOCB *acb;
-    struct BDRVRBDState *s;
-    int64_t size;
-    char *buf;
-    int64_t ret;
-} RADOSCB;
+    QSLIST_ENTRY(RBDTask) next;
+} RBDTask;
 
 typedef struct BDRVRBDState {
     rados_t cluster;
@@ -106,6 +92,16 @@ typedef struct BDRVRBDState {
     char *snap;
     char *namespace;
     uint64_t image_size;
+
+    /*
+     * librbd completes requests in its own threads.  Completed tasks are
+     * pushed onto @completed and @completion_notifier is set when the list
+     * goes from empty to non-empty, so one wakeup in the node's AioContext
+     * reaps a whole batch of completions.
+     */
+    EventNotifier completion_notifier;
+    QSLIST_HEAD(, RBDTask) completed;
+    AioContext *aio_context;
 } BDRVRBDState;
 
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
@@ -330,17 +326,6 @@ static int qemu_rbd_set_keypairs(rados_t cluster, const char *keypairs_json,
     return ret;
 }
 
-static void qemu_rbd_memset(RADOSCB *rcb, int64_t offs)
-{
-    if (LIBRBD_USE_IOVEC) {
-        RBDAIOCB *acb = rcb->acb;
-        iov_memset(acb->qiov->iov, acb->qiov->niov, offs, 0,
-                   acb->qiov->size - offs);
-    } else {
-        memset(rcb->buf + offs, 0, rcb->size - offs);
-    }
-}
-
 /* FIXME Deprecate and remove keypairs or make it available in QMP. */
 static int qemu_rbd_do_create(BlockdevCreateOptions *options,
                               const char *keypairs, const char *password_secret,
@@ -458,53 +443,6 @@ exit:
     return ret;
 }
 
-/*
- * This aio completion is being called from rbd_finish_bh() and runs in qemu
- * BH context.
- */
-static void qemu_rbd_complete_aio(RADOSCB *rcb)
-{
-    RBDAIOCB *acb = rcb->acb;
-    int64_t r;
-
-    r = rcb->ret;
-
-    if (acb->cmd != RBD_AIO_READ) {
-        if (r < 0) {
-            acb->ret = r;
-            acb->error = 1;
-        } else if (!acb->error) {
-            acb->ret = rcb->size;
-        }
-    } else {
-        if (r < 0) {
-            qemu_rbd_memset(rcb, 0);
-            acb->ret = r;
-            acb->error = 1;
-        } else if (r < rcb->size) {
-            qemu_rbd_memset(rcb, r);
-            if (!acb->error) {
-                acb->ret = rcb->size;
-            }
-        } else if (!acb->error) {
-            acb->ret = r;
-        }
-    }
-
-    g_free(rcb);
-
-    if (!LIBRBD_USE_IOVEC) {
-        if (acb->cmd == RBD_AIO_READ) {
-            qemu_iovec_from_buf(acb->qiov, 0, acb->bounce, acb->qiov->size);
-        }
-        qemu_vfree(acb->bounce);
-    }
-
-    acb->common.cb(acb->common.opaque, (acb->ret > 0 ? 0 : acb->ret));
-
-    qemu_aio_unref(acb);
-}
-
 static char *qemu_rbd_mon_host(BlockdevOptionsRbd *opts, Error **errp)
 {
     const char **vals;
@@ -682,6 +620,91 @@ static int qemu_rbd_attempt_legacy_options(QDict *options,
     return r;
 }
 
+static void qemu_rbd_finish_task(RBDTask *task)
+{
+    task->complete = true;
+    aio_co_wake(task->co);
+}
+
+static void qemu_rbd_finish_bh(void *opaque)
+{
+    qemu_rbd_finish_task(opaque);
+}
+
+/* Runs in the node's AioContext and reaps all tasks completed so far */
+static void qemu_rbd_completion_read(EventNotifier *e)
+{
+    BDRVRBDState *s = container_of(e, BDRVRBDState, completion_notifier);
+    QSLIST_HEAD(, RBDTask) completed;
+    RBDTask *task, *next;
+
+    /* Clear before reaping, so that later completions notify again */
+    event_notifier_test_and_clear(e);
+    QSLIST_MOVE_ATOMIC(&completed, &s->completed);
+
+    QSLIST_FOREACH_SAFE(task, &completed, next, next) {
+        qemu_rbd_finish_task(task);
+    }
+}
+
+/*
+ * This is the callback function for all rbd_aio_* requests
+ *
+ * Note: this function is being called from a non qemu thread so
+ * we need to be careful about what we do here.  We only queue the task
+ * and kick the node's AioContext; the coroutine is woken up from
+ * qemu_rbd_completion_read() which runs in a qemu context.
+ */
+static void qemu_rbd_completion_cb(rbd_completion_t c, RBDTask *task)
+{
+    BDRVRBDState *s = task->bs->opaque;
+    RBDTask *old_head;
+
+    task->ret = rbd_aio_get_return_value(c);
+    rbd_aio_release(c);
+
+    if (replay_mode != REPLAY_MODE_NONE) {
+        /* Completions must be ordered by the replay log */
+        replay_bh_schedule_oneshot_event(bdrv_get_aio_context(task->bs),
+                                         qemu_rbd_finish_bh, task);
+        return;
+    }
+
+    /*
+     * Open-coded QSLIST_INSERT_HEAD_ATOMIC: once @task is on the list it
+     * may be reaped and freed at any time, so whether the list was empty
+     * must be decided from the head that the cmpxchg replaced.
+     */
+    do {
+        old_head = qatomic_read(&s->completed.slh_first);
+        task->next.sle_next = old_head;
+    } while (qatomic_cmpxchg(&s->completed.slh_first, old_head, task) !=
+             old_head);
+    if (!old_head) {
+        /* The list was empty, nobody has kicked the AioContext yet */
+        event_notifier_set(&s->completion_notifier);
+    }
+}
+
+static void qemu_rbd_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    aio_set_event_notifier(s->aio_context, &s->completion_notifier,
+                           false, NULL, NULL);
+    s->aio_context = NULL;
+}
+
+static void qemu_rbd_attach_aio_context(BlockDriverState *bs,
+                                        AioContext *new_context)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    s->aio_context = new_context;
+    aio_set_event_notifier(new_context, &s->completion_notifier,
+                           false, qemu_rbd_completion_read, NULL);
+}
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -775,6 +798,15 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* When extending regular files, we get zeros from the OS */
     bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
 
+    r = event_notifier_init(&s->completion_notifier, false);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "failed to initialize completion notifier");
+        rbd_close(s->image);
+        goto failed_open;
+    }
+    QSLIST_INIT(&s->completed);
+    qemu_rbd_attach_aio_context(bs, bdrv_get_aio_context(bs));
+
     r = 0;
     goto out;
 
@@ -814,6 +846,8 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
+    qemu_rbd_detach_aio_context(bs);
+    event_notifier_cleanup(&s->completion_notifier);
     rbd_close(s->image);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
@@ -837,35 +871,6 @@ static int qemu_rbd_resize(BlockDriverState *bs, uint64_t size)
     return 0;
 }
 
-static const AIOCBInfo rbd_aiocb_info = {
-    .aiocb_size = sizeof(RBDAIOCB),
-};
-
-static void rbd_finish_bh(void *opaque)
-{
-    RADOSCB *rcb = opaque;
-    qemu_rbd_complete_aio(rcb);
-}
-
-/*
- * This is the callback function for rbd_aio_read and _write
- *
- * Note: this function is being called from a non qemu thread so
- * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from rbd_finish_bh() which runs in a qemu context.
- */
-static void rbd_finish_aiocb(rbd_completion_t c, RADOSCB *rcb)
-{
-    RBDAIOCB *acb = rcb->acb;
-
-    rcb->ret = rbd_aio_get_return_value(c);
-    rbd_aio_release(c);
-
-    replay_bh_schedule_oneshot_event(bdrv_get_aio_context(acb->common.bs),
-                                     rbd_finish_bh, rcb);
-}
-
 static int rbd_aio_discard_wrapper(rbd_image_t image,
                                    uint64_t off,
                                    uint64_t len,
@@ -888,84 +893,77 @@ static int rbd_aio_flush_wrapper(rbd_image_t image,
 #endif
 }
 
-static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
-                                 int64_t off,
-                                 QEMUIOVector *qiov,
-                                 int64_t size,
-                                 BlockCompletionFunc *cb,
-                                 void *opaque,
-                                 RBDAIOCmd cmd)
+static int coroutine_fn qemu_rbd_start_co(BlockDriverState *bs,
+                                          uint64_t offset,
+                                          uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          RBDAIOCmd cmd)
 {
-    RBDAIOCB *acb;
-    RADOSCB *rcb = NULL;
+    BDRVRBDState *s = bs->opaque;
+    RBDTask task = { .bs = bs, .co = qemu_coroutine_self() };
     rbd_completion_t c;
+    char *bounce = NULL;
     int r;
+#ifndef LIBRBD_SUPPORTS_IOVEC /* defined in librbd.h */
+    char *buf = NULL;
+#endif
 
-    BDRVRBDState *s = bs->opaque;
-
-    acb = qemu_aio_get(&rbd_aiocb_info, bs, cb, opaque);
-    acb->cmd = cmd;
-    acb->qiov = qiov;
-    assert(!qiov || qiov->size == size);
-
-    rcb = g_new(RADOSCB, 1);
+    assert(!qiov || qiov->size == bytes);
 
-    if (!LIBRBD_USE_IOVEC) {
-        if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
-            acb->bounce = NULL;
+#ifndef LIBRBD_SUPPORTS_IOVEC
+    /*
+     * Without vectored I/O in librbd, only requests that are not contiguous
+     * in memory need a bounce buffer.
+     */
+    if (qiov) {
+        if (qiov->niov == 1) {
+            buf = qiov->iov[0].iov_base;
         } else {
-            acb->bounce = qemu_try_blockalign(bs, qiov->size);
-            if (acb->bounce == NULL) {
-                goto failed;
+            bounce = buf = qemu_try_blockalign(bs, bytes);
+            if (!bounce) {
+                return -ENOMEM;
+            }
+            if (cmd == RBD_AIO_WRITE) {
+                qemu_iovec_to_buf(qiov, 0, bounce, bytes);
             }
         }
-        if (cmd == RBD_AIO_WRITE) {
-            qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
-        }
-        rcb->buf = acb->bounce;
     }
+#endif
 
-    acb->ret = 0;
-    acb->error = 0;
-    acb->s = s;
-
-    rcb->acb = acb;
-    rcb->s = acb->s;
-    rcb->size = size;
-    r = rbd_aio_create_completion(rcb, (rbd_callback_t) rbd_finish_aiocb, &c);
+    r = rbd_aio_create_completion(&task,
+                                  (rbd_callback_t) qemu_rbd_completion_cb, &c);
     if (r < 0) {
-        goto failed;
+        goto out;
     }
 
     switch (cmd) {
-    case RBD_AIO_WRITE: {
+    case RBD_AIO_WRITE:
         /*
          * RBD APIs don't allow us to write more than actual size, so in order
          * to support growing images, we resize the image before write
          * operations that exceed the current size.
          */
-        if (off + size > s->image_size) {
-            r = qemu_rbd_resize(bs, off + size);
+        if (offset + bytes > s->image_size) {
+            r = qemu_rbd_resize(bs, offset + bytes);
             if (r < 0) {
-                goto failed_completion;
+                break;
             }
         }
 #ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, off, c);
+        r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, offset, c);
 #else
-            r = rbd_aio_write(s->image, off, size, rcb->buf, c);
+        r = rbd_aio_write(s->image, offset, bytes, buf, c);
 #endif
         break;
-    }
     case RBD_AIO_READ:
 #ifdef LIBRBD_SUPPORTS_IOVEC
-            r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, off, c);
+        r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, offset, c);
 #else
-            r = rbd_aio_read(s->image, off, size, rcb->buf, c);
+        r = rbd_aio_read(s->image, offset, bytes, buf, c);
 #endif
         break;
     case RBD_AIO_DISCARD:
-        r = rbd_aio_discard_wrapper(s->image, off, size, c);
+        r = rbd_aio_discard_wrapper(s->image, offset, bytes, c);
         break;
     case RBD_AIO_FLUSH:
         r = rbd_aio_flush_wrapper(s->image, c);
@@ -975,53 +973,64 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     }
 
     if (r < 0) {
-        goto failed_completion;
+        rbd_aio_release(c);
+        goto out;
     }
-    return &acb->common;
 
-failed_completion:
-    rbd_aio_release(c);
-failed:
-    g_free(rcb);
-    if (!LIBRBD_USE_IOVEC) {
-        qemu_vfree(acb->bounce);
+    while (!task.complete) {
+        qemu_coroutine_yield();
+    }
+
+    r = task.ret;
+    if (cmd == RBD_AIO_READ) {
+        if (r < 0) {
+            qemu_iovec_memset(qiov, 0, 0, bytes);
+        } else {
+            /* Reads beyond the end of the image return zeroes */
+            if (r < bytes) {
+                if (bounce) {
+                    memset(bounce + r, 0, bytes - r);
+                } else {
+                    qemu_iovec_memset(qiov, r, 0, bytes - r);
+                }
+            }
+            if (bounce) {
+                qemu_iovec_from_buf(qiov, 0, bounce, bytes);
+            }
+            r = 0;
+        }
+    } else if (r > 0) {
+        r = 0;
     }
 
-    qemu_aio_unref(acb);
-    return NULL;
+out:
+    qemu_vfree(bounce);
+    return r;
 }
 
-static BlockAIOCB *qemu_rbd_aio_preadv(BlockDriverState *bs,
-                                       uint64_t offset, uint64_t bytes,
-                                       QEMUIOVector *qiov, int flags,
-                                       BlockCompletionFunc *cb,
-                                       void *opaque)
+static int coroutine_fn qemu_rbd_co_preadv(BlockDriverState *bs,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov, int flags)
 {
-    return rbd_start_aio(bs, offset, qiov, bytes, cb, opaque,
-                         RBD_AIO_READ);
+    return qemu_rbd_start_co(bs, offset, bytes, qiov, RBD_AIO_READ);
 }
 
-static BlockAIOCB *qemu_rbd_aio_pwritev(BlockDriverState *bs,
-                                        uint64_t offset, uint64_t bytes,
-                                        QEMUIOVector *qiov, int flags,
-                                        BlockCompletionFunc *cb,
-                                        void *opaque)
+static int coroutine_fn qemu_rbd_co_pwritev(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
 {
-    return rbd_start_aio(bs, offset, qiov, bytes, cb, opaque,
-                         RBD_AIO_WRITE);
+    return qemu_rbd_start_co(bs, offset, bytes, qiov, RBD_AIO_WRITE);
 }
 
 #ifdef LIBRBD_SUPPORTS_AIO_FLUSH
-static BlockAIOCB *qemu_rbd_aio_flush(BlockDriverState *bs,
-                                      BlockCompletionFunc *cb,
-                                      void *opaque)
+static int coroutine_fn qemu_rbd_co_flush(BlockDriverState *bs)
 {
-    return rbd_start_aio(bs, 0, NULL, 0, cb, opaque, RBD_AIO_FLUSH);
+    return qemu_rbd_start_co(bs, 0, 0, NULL, RBD_AIO_FLUSH);
 }
 
 #else
 
-static int qemu_rbd_co_flush(BlockDriverState *bs)
+static int coroutine_fn qemu_rbd_co_flush(BlockDriverState *bs)
 {
 #if LIBRBD_VERSION_CODE >= LIBRBD_VERSION(0, 1, 1)
     /* rbd_flush added in 0.1.1 */
@@ -1199,14 +1208,10 @@ static int qemu_rbd_snap_list(BlockDriverState *bs,
 }
 
 #ifdef LIBRBD_SUPPORTS_DISCARD
-static BlockAIOCB *qemu_rbd_aio_pdiscard(BlockDriverState *bs,
-                                         int64_t offset,
-                                         int bytes,
-                                         BlockCompletionFunc *cb,
-                                         void *opaque)
+static int coroutine_fn qemu_rbd_co_pdiscard(BlockDriverState *bs,
+                                             int64_t offset, int bytes)
 {
-    return rbd_start_aio(bs, offset, NULL, bytes, cb, opaque,
-                         RBD_AIO_DISCARD);
+    return qemu_rbd_start_co(bs, offset, bytes, NULL, RBD_AIO_DISCARD);
 }
 #endif
 
@@ -1275,17 +1280,15 @@ static BlockDriver bdrv_rbd = {
     .bdrv_co_truncate       = qemu_rbd_co_truncate,
     .protocol_name          = "rbd",
 
-    .bdrv_aio_preadv        = qemu_rbd_aio_preadv,
-    .bdrv_aio_pwritev       = qemu_rbd_aio_pwritev,
+    .bdrv_detach_aio_context = qemu_rbd_detach_aio_context,
+    .bdrv_attach_aio_context = qemu_rbd_attach_aio_context,
 
-#ifdef LIBRBD_SUPPORTS_AIO_FLUSH
-    .bdrv_aio_flush         = qemu_rbd_aio_flush,
-#else
+    .bdrv_co_preadv         = qemu_rbd_co_preadv,
+    .bdrv_co_pwritev        = qemu_rbd_co_pwritev,
     .bdrv_co_flush_to_disk  = qemu_rbd_co_flush,
-#endif
 
 #ifdef LIBRBD_SUPPORTS_DISCARD
-    .bdrv_aio_pdiscard      = qemu_rbd_aio_pdiscard,
+    .bdrv_co_pdiscard       = qemu_rbd_co_pdiscard,
 #endif
 
     .bdrv_snapshot_create   = qemu_rbd_snap_create,
@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/block_int.h"
 #include "block/blockjob_int.h"
 #include "qapi/error.h"
@@ -27,8 +28,13 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Upper limit for the max-workers option */
+    STREAM_MAX_WORKERS = 64,
 };
 
+typedef struct StreamTask StreamTask;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockDriverState *base_overlay; /* COW overlay (stream from this) */
@@ -37,8 +43,19 @@ typedef struct StreamBlockJob {
     char *backing_file_str;
     bool bs_read_only;
     bool chain_frozen;
+    int max_workers;
+    /* Chunks whose copy failed and that still need an on-error decision */
+    QSIMPLEQ_HEAD(, StreamTask) failed_tasks;
 } StreamBlockJob;
 
+struct StreamTask {
+    AioTask task;
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    QSIMPLEQ_ENTRY(StreamTask) next;
+};
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -48,6 +65,73 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
                          BDRV_REQ_COPY_ON_READ | BDRV_REQ_PREFETCH);
 }
 
+static int coroutine_fn stream_task_entry(AioTask *task)
+{
+    StreamTask *t = container_of(task, StreamTask, task);
+    StreamBlockJob *s = t->s;
+    int ret;
+
+    ret = stream_populate(s->common.blk, t->offset, t->bytes);
+    if (ret < 0) {
+        /*
+         * Leave the error to stream_run(), which decides on the on-error
+         * action; keep the pool status clean so that other tasks go on.
+         */
+        t->task.ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->failed_tasks, t, next);
+        return 0;
+    }
+
+    job_progress_update(&s->common.job, t->bytes);
+    g_free(t);
+    return 0;
+}
+
+/*
+ * Wait for all running copies and apply the on-error policy to the ones
+ * that failed: 'stop' retries the chunk synchronously once the job is
+ * resumed, 'ignore' skips it and 'report' gives up.  The first error is
+ * stored in @error.  Returns true if the job must stop.
+ */
+static bool coroutine_fn stream_handle_failed(StreamBlockJob *s,
+                                              AioTaskPool *pool, int *error)
+{
+    StreamTask *t;
+    int ret;
+
+    aio_task_pool_wait_all(pool);
+
+    while ((t = QSIMPLEQ_FIRST(&s->failed_tasks)) != NULL) {
+        BlockErrorAction action =
+            block_job_error_action(&s->common, s->on_error, true,
+                                   -t->task.ret);
+        if (action == BLOCK_ERROR_ACTION_STOP) {
+            job_sleep_ns(&s->common.job, 0);
+            if (job_is_cancelled(&s->common.job)) {
+                return true;
+            }
+            ret = stream_populate(s->common.blk, t->offset, t->bytes);
+            if (ret < 0) {
+                t->task.ret = ret;
+                continue;
+            }
+        } else {
+            if (*error == 0) {
+                *error = t->task.ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                return true;
+            }
+        }
+
+        job_progress_update(&s->common.job, t->bytes);
+        QSIMPLEQ_REMOVE_HEAD(&s->failed_tasks, next);
+        g_free(t);
+    }
+
+    return false;
+}
+
 static void stream_abort(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -118,6 +202,12 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
     uint64_t delay_ns = 0;
     int error = 0;
     int64_t n = 0; /* bytes */
+    int64_t extent_end = 0;
+    bool extent_copy = false;
+    AioTaskPool *pool;
+    StreamTask *t;
+
+    QSIMPLEQ_INIT(&s->failed_tasks);
 
     if (unfiltered_bs == s->base_overlay) {
         /* Nothing to stream */
@@ -139,8 +229,9 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
         bdrv_enable_copy_on_read(bs);
     }
 
+    pool = aio_task_pool_new(s->max_workers);
+
     for ( ; offset < len; offset += n) {
-        bool copy;
         int ret;
 
         /* Note that even when no rate limit is applied we need to yield
@@ -151,50 +242,90 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             break;
         }
 
-        copy = false;
-
-        ret = bdrv_is_allocated(unfiltered_bs, offset, STREAM_CHUNK, &n);
-        if (ret == 1) {
-            /* Allocated in the top, no need to copy.  */
-        } else if (ret >= 0) {
-            /* Copy if allocated in the intermediate images.  Limit to the
-             * known-unallocated area [offset, offset+n*BDRV_SECTOR_SIZE).  */
-            ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
-                                          s->base_overlay, true,
-                                          offset, n, &n);
-            /* Finish early if end of backing file has been reached */
-            if (ret == 0 && n == 0) {
-                n = len - offset;
-            }
-
-            copy = (ret == 1);
-        }
-        trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(blk, offset, n);
+        if (!QSIMPLEQ_EMPTY(&s->failed_tasks) &&
+            stream_handle_failed(s, pool, &error))
+        {
+            break;
         }
-        if (ret < 0) {
-            BlockErrorAction action =
-                block_job_error_action(&s->common, s->on_error, true, -ret);
-            if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
-                continue;
-            }
-            if (error == 0) {
-                error = ret;
+
+        /*
+         * Query the allocation status of the whole remaining image at once
+         * and then work through the returned extent chunk by chunk.
+         */
+        if (offset >= extent_end) {
+            extent_copy = false;
+            ret = bdrv_is_allocated(unfiltered_bs, offset, len - offset, &n);
+            if (ret == 1) {
+                /* Allocated in the top, no need to copy.  */
+            } else if (ret >= 0) {
+                /* Copy if allocated in the intermediate images.  Limit to
+                 * the known-unallocated area [offset, offset+n).  */
+                ret = bdrv_is_allocated_above(bdrv_cow_bs(unfiltered_bs),
+                                              s->base_overlay, true,
+                                              offset, n, &n);
+                /* Finish early if end of backing file has been reached */
+                if (ret == 0 && n == 0) {
+                    n = len - offset;
+                }
+
+                extent_copy = (ret == 1);
             }
-            if (action == BLOCK_ERROR_ACTION_REPORT) {
-                break;
+            trace_stream_one_iteration(s, offset, n, ret);
+
+            if (ret < 0) {
+                BlockErrorAction action =
+                    block_job_error_action(&s->common, s->on_error, true,
+                                           -ret);
+                if (action == BLOCK_ERROR_ACTION_STOP) {
+                    n = 0;
+                    continue;
+                }
+                if (error == 0) {
+                    error = ret;
+                }
+                if (action == BLOCK_ERROR_ACTION_REPORT) {
+                    break;
+                }
+                /* Skip one chunk and try again after it */
+                n = MIN(len - offset, STREAM_CHUNK);
+                job_progress_update(&s->common.job, n);
+                delay_ns = 0;
+                continue;
             }
+
+            extent_end = offset + n;
         }
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
-        if (copy) {
-            delay_ns = block_job_ratelimit_get_delay(&s->common, n);
-        } else {
+        if (!extent_copy) {
+            n = extent_end - offset;
+            job_progress_update(&s->common.job, n);
             delay_ns = 0;
+            continue;
         }
+
+        n = MIN(extent_end - offset, STREAM_CHUNK);
+
+        aio_task_pool_wait_slot(pool);
+        t = g_new(StreamTask, 1);
+        *t = (StreamTask) {
+            .task.func  = stream_task_entry,
+            .s          = s,
+            .offset     = offset,
+            .bytes      = n,
+        };
+        aio_task_pool_start_task(pool, &t->task);
+
+        delay_ns = block_job_ratelimit_get_delay(&s->common, n);
+    }
+
+    if (!job_is_cancelled(&s->common.job)) {
+        stream_handle_failed(s, pool, &error);
+    }
+    aio_task_pool_wait_all(pool);
+    aio_task_pool_free(pool);
+    while ((t = QSIMPLEQ_FIRST(&s->failed_tasks)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed_tasks, next);
+        g_free(t);
     }
 
     if (enable_cor) {
@@ -221,7 +352,7 @@ static const BlockJobDriver stream_job_driver = {
 void stream_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, const char *backing_file_str,
                   int creation_flags, int64_t speed,
-                  BlockdevOnError on_error, Error **errp)
+                  BlockdevOnError on_error, int max_workers, Error **errp)
 {
     StreamBlockJob *s;
     BlockDriverState *iter;
@@ -230,6 +361,12 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     BlockDriverState *base_overlay = bdrv_find_overlay(bs, base);
     BlockDriverState *above_base;
 
+    if (max_workers < 1 || max_workers > STREAM_MAX_WORKERS) {
+        error_setg(errp, "max-workers must be between 1 and %d",
+                   STREAM_MAX_WORKERS);
+        return;
+    }
+
     if (!base_overlay) {
         error_setg(errp, "'%s' is not in the backing chain of '%s'",
                    base->node_name, bs->node_name);
@@ -297,6 +434,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     s->chain_frozen = true;
 
     s->on_error = on_error;
+    s->max_workers = max_workers;
     trace_stream_start(bs, base, s);
     job_start(&s->common.job);
     return;
@@ -62,6 +62,14 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * To keep the lock off the I/O path when requests are not being
+ * throttled, each ThrottleGroupMember holds some credit that has already
+ * been accounted in the group's buckets (see throttle_reserve_credit()).
+ * While it lasts, and nobody in the group waits for a request of the same
+ * type, requests are let through after checking any_timer_armed and
+ * pending_reqs locklessly.  Writers of those fields therefore still hold
+ * the lock but use atomic operations.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -286,7 +294,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     /* If a timer just got armed, set tgm as the current token */
     if (must_wait) {
         tg->tokens[is_write] = tgm;
-        tg->any_timer_armed[is_write] = true;
+        qatomic_set(&tg->any_timer_armed[is_write], true);
     }
 
     return must_wait;
@@ -343,16 +351,114 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
             ThrottleTimers *tt = &token->throttle_timers;
             int64_t now = qemu_clock_get_ns(tg->clock_type);
             timer_mod(tt->timers[is_write], now);
-            tg->any_timer_armed[is_write] = true;
+            qatomic_set(&tg->any_timer_armed[is_write], true);
         }
         tg->tokens[is_write] = token;
     }
 }
 
+/* Spend part of the credit of a ThrottleGroupMember on an I/O request.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ * @ret:       whether there was enough credit to cover the request
+ */
+static bool throttle_group_spend_credit(ThrottleGroupMember *tgm,
+                                        unsigned int bytes,
+                                        bool is_write)
+{
+    unsigned int op_size = qatomic_read(&tgm->credit_op_size);
+    int credit;
+
+    /* Requests larger than op_size count as several operations */
+    if (bytes > INT_MAX || (op_size && bytes > op_size)) {
+        return false;
+    }
+
+    do {
+        credit = qatomic_read(&tgm->credit_bytes[is_write]);
+        if (credit < (int)bytes) {
+            return false;
+        }
+    } while (qatomic_cmpxchg(&tgm->credit_bytes[is_write],
+                             credit, credit - bytes) != credit);
+
+    do {
+        credit = qatomic_read(&tgm->credit_ops[is_write]);
+        if (credit < 1) {
+            qatomic_add(&tgm->credit_bytes[is_write], bytes);
+            return false;
+        }
+    } while (qatomic_cmpxchg(&tgm->credit_ops[is_write],
+                             credit, credit - 1) != credit);
+
+    return true;
+}
+
+static void throttle_group_add_credit(int *credit, unsigned int units)
+{
+    int old, new;
+
+    do {
+        old = qatomic_read(credit);
+        new = MIN((int64_t)old + units, INT_MAX);
+    } while (qatomic_cmpxchg(credit, old, new) != old);
+}
+
+/* Reserve more credit for a ThrottleGroupMember if nobody in the group is
+ * waiting, so that its next requests can skip the lock.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_refill_credit(ThrottleGroupMember *tgm,
+                                         bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    unsigned int bytes, ops;
+
+    if (qatomic_read(&tgm->io_limits_disabled) ||
+        tg->any_timer_armed[is_write] || tgm->pending_reqs[is_write]) {
+        return;
+    }
+
+    if (throttle_reserve_credit(ts, is_write, qemu_clock_get_ns(tg->clock_type),
+                                &bytes, &ops)) {
+        qatomic_set(&tgm->credit_op_size, MIN(ts->cfg.op_size, UINT_MAX));
+        throttle_group_add_credit(&tgm->credit_bytes[is_write], bytes);
+        throttle_group_add_credit(&tgm->credit_ops[is_write], ops);
+    }
+}
+
+/* Drop the credit of all members of a group, e.g. because the limits
+ * have changed.  Credit that was reserved but not spent is lost.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_revoke_credit(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    int i;
+
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (i = 0; i < 2; i++) {
+            qatomic_set(&tgm->credit_bytes[i], 0);
+            qatomic_set(&tgm->credit_ops[i], 0);
+        }
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
  *
+ * Requests covered by the member's credit go through without taking
+ * tg->lock, as long as no request of the same type is waiting.
+ *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
  * @is_write:  the type of operation (read/write)
@@ -364,6 +470,15 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     bool must_wait;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    /* Fast path: the I/O has already been accounted for */
+    if (!qatomic_read(&tgm->io_limits_disabled) &&
+        !qatomic_read(&tgm->pending_reqs[is_write]) &&
+        !qatomic_read(&tg->any_timer_armed[is_write]) &&
+        throttle_group_spend_credit(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -372,14 +487,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
-        tgm->pending_reqs[is_write]++;
+        qatomic_inc(&tgm->pending_reqs[is_write]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[is_write],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[is_write]--;
+        qatomic_dec(&tgm->pending_reqs[is_write]);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -388,6 +503,8 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
+    throttle_group_refill_credit(tgm, is_write);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -472,6 +589,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_revoke_credit(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -506,7 +624,7 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write)
 
     /* The timer has just been fired, so we can update the flag */
     qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[is_write] = false;
+    qatomic_set(&tg->any_timer_armed[is_write], false);
     qemu_mutex_unlock(&tg->lock);
 
     /* Run the request that was waiting for this timer */
@@ -545,6 +663,10 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    for (i = 0; i < 2; i++) {
+        qatomic_set(&tgm->credit_bytes[i], 0);
+        qatomic_set(&tgm->credit_ops[i], 0);
+    }
 
     qemu_mutex_lock(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -641,7 +763,7 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     qemu_mutex_lock(&tg->lock);
     for (i = 0; i < 2; i++) {
         if (timer_pending(tt->timers[i])) {
-            tg->any_timer_armed[i] = false;
+            qatomic_set(&tg->any_timer_armed[i], false);
             schedule_next_request(tgm, i);
         }
     }
@@ -1178,8 +1178,11 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    qemu_co_mutex_lock(&s->lock);
-
+    /*
+     * Reads do not take s->lock: the BAT is looked up without yielding, a
+     * payload block never moves once present, and vhdx_co_writev() marks
+     * new blocks present only after writing them.
+     */
     while (nb_sectors > 0) {
         /* We are a differencing file, so we need to inspect the sector bitmap
          * to see if we have the data or not */
@@ -1204,11 +1207,9 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
                 qemu_iovec_memset(&hd_qiov, 0, 0, sinfo.bytes_avail);
                 break;
             case PAYLOAD_BLOCK_FULLY_PRESENT:
-                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_preadv(bs->file, sinfo.file_offset,
                                      sinfo.sectors_avail * BDRV_SECTOR_SIZE,
                                      &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto exit;
                 }
@@ -1228,7 +1229,6 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
     }
     ret = 0;
 exit:
-    qemu_co_mutex_unlock(&s->lock);
     qemu_iovec_destroy(&hd_qiov);
     return ret;
 }
@@ -1334,7 +1334,7 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
     struct iovec iov2 = { 0 };
     int sectors_to_write;
     int bat_state;
-    uint64_t bat_prior_offset = 0;
+    uint64_t new_block_offset = 0;
     bool bat_update = false;
 
     assert(!flags);
@@ -1372,20 +1372,16 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
             case PAYLOAD_BLOCK_UNMAPPED:
             case PAYLOAD_BLOCK_UNMAPPED_v095:
             case PAYLOAD_BLOCK_UNDEFINED:
-                bat_prior_offset = sinfo.file_offset;
                 ret = vhdx_allocate_block(bs, s, &sinfo.file_offset,
                                           &use_zero_buffers);
                 if (ret < 0) {
                     goto exit;
                 }
                 /*
-                 * once we support differencing files, this may also be
-                 * partially present
+                 * The BAT entry is updated below, once the block is written:
+                 * readers do not take the lock and must not see it earlier.
                  */
-                /* update block state to the newly specified state */
-                vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
-                                            &bat_entry_offset,
-                                            PAYLOAD_BLOCK_FULLY_PRESENT);
+                new_block_offset = sinfo.file_offset;
                 bat_update = true;
                 /*
                  * Since we just allocated a block, file_offset is the
@@ -1431,21 +1427,29 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
                  * there is a problem */
                 if (sinfo.file_offset < (1 * MiB)) {
                     ret = -EFAULT;
-                    goto error_bat_restore;
+                    goto exit;
                 }
 
                 if (!use_zero_buffers) {
                     qemu_iovec_concat(&hd_qiov, qiov,  bytes_done,
                                       sinfo.bytes_avail);
                 }
-                /* block exists, so we can just overwrite it */
-                qemu_co_mutex_unlock(&s->lock);
+                /*
+                 * Overwrites of present blocks drop the lock.  A new block
+                 * keeps it until it is present in the BAT, so that another
+                 * write to it does not allocate it a second time.
+                 */
+                if (!bat_update) {
+                    qemu_co_mutex_unlock(&s->lock);
+                }
                 ret = bdrv_co_pwritev(bs->file, sinfo.file_offset,
                                       sectors_to_write * BDRV_SECTOR_SIZE,
                                       &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
+                if (!bat_update) {
+                    qemu_co_mutex_lock(&s->lock);
+                }
                 if (ret < 0) {
-                    goto error_bat_restore;
+                    goto exit;
                 }
                 break;
             case PAYLOAD_BLOCK_PARTIALLY_PRESENT:
@@ -1458,6 +1462,14 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
             }
 
             if (bat_update) {
+                /*
+                 * once we support differencing files, this may also be
+                 * partially present
+                 */
+                sinfo.file_offset = new_block_offset;
+                vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
+                                            &bat_entry_offset,
+                                            PAYLOAD_BLOCK_FULLY_PRESENT);
                 /* this will update the BAT entry into the log journal, and
                  * then flush the log journal out to disk */
                 ret =  vhdx_log_write_and_flush(bs, s, &bat_entry,
@@ -1475,16 +1487,6 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
         }
     }
 
-    goto exit;
-
-error_bat_restore:
-    if (bat_update) {
-        /* keep metadata in sync, and restore the bat entry state
-         * if error. */
-        sinfo.file_offset = bat_prior_offset;
-        vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
-                                    &bat_entry_offset, bat_state);
-    }
 exit:
     qemu_vfree(iov1.iov_base);
     qemu_vfree(iov2.iov_base);
@@ -58,6 +58,8 @@
 /* Cluster not allocated */
 #define VMDK_UNALLOC (-2)
 #define VMDK_ZEROED  (-3)
+/* Grain table not in the cache, and @cached_only was given */
+#define VMDK_NOT_CACHED (-4)
 
 #define BLOCK_OPT_ZEROED_GRAIN "zeroed_grain"
 
@@ -1486,8 +1488,13 @@ static int vmdk_L2update(VmdkExtent *extent, VmdkMetaData *m_data,
  * [@skip_start_sector, @skip_end_sector) passed in by caller, because caller
  * has new data to write there.
  *
+ * Unless @cached_only is true, the caller must hold s->lock.  With
+ * @cached_only, the lookup fails rather than load a grain table into the
+ * cache; it then does not yield and can be done without the lock.
+ *
  * Returns: VMDK_OK if cluster exists and mapped in the image.
  *          VMDK_UNALLOC if cluster is not mapped and @allocate is false.
+ *          VMDK_NOT_CACHED if @cached_only and the grain table is not cached.
  *          VMDK_ERROR if failed.
  */
 static int get_cluster_offset(BlockDriverState *bs,
@@ -1495,6 +1502,7 @@ static int get_cluster_offset(BlockDriverState *bs,
                               VmdkMetaData *m_data,
                               uint64_t offset,
                               bool allocate,
+                              bool cached_only,
                               uint64_t *cluster_offset,
                               uint64_t skip_start_bytes,
                               uint64_t skip_end_bytes)
@@ -1508,6 +1516,7 @@ static int get_cluster_offset(BlockDriverState *bs,
     int64_t cluster_sector;
     unsigned int l2_size_bytes = extent->l2_size * extent->entry_size;
 
+    assert(!(allocate && cached_only));
     if (m_data) {
         m_data->new_allocation = false;
     }
@@ -1567,6 +1576,9 @@ static int get_cluster_offset(BlockDriverState *bs,
         }
     }
     /* not found: load a new entry in the least used one */
+    if (cached_only) {
+        return VMDK_NOT_CACHED;
+    }
     min_index = 0;
     min_count = 0xffffffff;
     for (i = 0; i < L2_CACHE_SIZE; i++) {
@@ -1576,6 +1588,8 @@ static int get_cluster_offset(BlockDriverState *bs,
         }
     }
     l2_table = (char *)extent->l2_cache + (min_index * l2_size_bytes);
+    /* Lookups without the lock must not find the entry while it is loaded */
+    extent->l2_cache_offsets[min_index] = 0;
     BLKDBG_EVENT(extent->file, BLKDBG_L2_LOAD);
     if (bdrv_pread(extent->file,
                 (int64_t)l2_offset * 512,
@@ -1705,10 +1719,14 @@ static int coroutine_fn vmdk_co_block_status(BlockDriverState *bs,
     if (!extent) {
         return -EIO;
     }
-    qemu_co_mutex_lock(&s->lock);
-    ret = get_cluster_offset(bs, extent, NULL, offset, false, &cluster_offset,
-                             0, 0);
-    qemu_co_mutex_unlock(&s->lock);
+    ret = get_cluster_offset(bs, extent, NULL, offset, false, true,
+                             &cluster_offset, 0, 0);
+    if (ret == VMDK_NOT_CACHED) {
+        qemu_co_mutex_lock(&s->lock);
+        ret = get_cluster_offset(bs, extent, NULL, offset, false, false,
+                                 &cluster_offset, 0, 0);
+        qemu_co_mutex_unlock(&s->lock);
+    }
 
     index_in_cluster = vmdk_find_offset_in_cluster(extent, offset);
     switch (ret) {
@@ -1898,10 +1916,16 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     QEMUIOVector local_qiov;
     uint64_t cluster_offset;
     uint64_t bytes_done = 0;
+    bool cid_valid;
 
     qemu_iovec_init(&local_qiov, qiov->niov);
-    qemu_co_mutex_lock(&s->lock);
 
+    /*
+     * Reads run without s->lock, except to load grain tables into the cache.
+     * A grain never moves once allocated, and allocating writes only make it
+     * visible in the cache after writing its data, so whatever the lookup
+     * returns stays valid while the data is read.
+     */
     while (bytes > 0) {
         extent = find_extent(s, offset >> BDRV_SECTOR_BITS, extent);
         if (!extent) {
@@ -1909,7 +1933,13 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto fail;
         }
         ret = get_cluster_offset(bs, extent, NULL,
-                                 offset, false, &cluster_offset, 0, 0);
+                                 offset, false, true, &cluster_offset, 0, 0);
+        if (ret == VMDK_NOT_CACHED) {
+            qemu_co_mutex_lock(&s->lock);
+            ret = get_cluster_offset(bs, extent, NULL, offset, false, false,
+                                     &cluster_offset, 0, 0);
+            qemu_co_mutex_unlock(&s->lock);
+        }
         offset_in_cluster = vmdk_find_offset_in_cluster(extent, offset);
 
         n_bytes = MIN(bytes, extent->cluster_sectors * BDRV_SECTOR_SIZE
@@ -1918,7 +1948,10 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
         if (ret != VMDK_OK) {
             /* if not allocated, try to read from parent image, if exist */
             if (bs->backing && ret != VMDK_ZEROED) {
-                if (!vmdk_is_cid_valid(bs)) {
+                qemu_co_mutex_lock(&s->lock);
+                cid_valid = vmdk_is_cid_valid(bs);
+                qemu_co_mutex_unlock(&s->lock);
+                if (!cid_valid) {
                     ret = -EINVAL;
                     goto fail;
                 }
@@ -1953,7 +1986,6 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
     ret = 0;
 fail:
-    qemu_co_mutex_unlock(&s->lock);
     qemu_iovec_destroy(&local_qiov);
 
     return ret;
@@ -2001,7 +2033,7 @@ static int vmdk_pwritev(BlockDriverState *bs, uint64_t offset,
                              - offset_in_cluster);
 
         ret = get_cluster_offset(bs, extent, &m_data, offset,
-                                 !(extent->compressed || zeroed),
+                                 !(extent->compressed || zeroed), false,
                                  &cluster_offset, offset_in_cluster,
                                  offset_in_cluster + n_bytes);
         if (extent->compressed) {
@@ -2013,7 +2045,7 @@ static int vmdk_pwritev(BlockDriverState *bs, uint64_t offset,
             } else if (!zeroed) {
                 /* allocate */
                 ret = get_cluster_offset(bs, extent, &m_data, offset,
-                                         true, &cluster_offset, 0, 0);
+                                         true, false, &cluster_offset, 0, 0);
             }
         }
         if (ret == VMDK_ERROR) {
@@ -2891,7 +2923,7 @@ static int coroutine_fn vmdk_co_check(BlockDriverState *bs,
         }
         ret = get_cluster_offset(bs, extent, NULL,
                                  sector_num << BDRV_SECTOR_BITS,
-                                 false, &cluster_offset, 0, 0);
+                                 false, false, &cluster_offset, 0, 0);
         if (ret == VMDK_ERROR) {
             fprintf(stderr,
                     "ERROR: could not get cluster_offset for sector %"
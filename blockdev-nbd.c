@@ -212,6 +212,10 @@ void qmp_nbd_server_add(NbdServerAddOptions *arg, Error **errp)
             .description        = g_strdup(arg->description),
             .has_bitmap         = arg->has_bitmap,
             .bitmap             = g_strdup(arg->bitmap),
+            .has_multi_conn     = arg->has_multi_conn,
+            .multi_conn         = arg->multi_conn,
+            .has_zero_copy      = arg->has_zero_copy,
+            .zero_copy          = arg->zero_copy,
         },
     };
 
@@ -2066,6 +2066,11 @@ static void block_dirty_bitmap_clear_prepare(BlkActionState *common,
         return;
     }
 
+    /* The backup must hold the stored bits for .abort to restore them */
+    if (bdrv_dirty_bitmap_load(state->bitmap, errp) < 0) {
+        return;
+    }
+
     bdrv_clear_dirty_bitmap(state->bitmap, &state->backup);
 }
 
@@ -2438,6 +2443,10 @@ BlockDirtyBitmapSha256 *qmp_x_debug_block_dirty_bitmap_sha256(const char *node,
         return NULL;
     }
 
+    if (bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+        return NULL;
+    }
+
     sha256 = bdrv_dirty_bitmap_sha256(bitmap, errp);
     if (sha256 == NULL) {
         return NULL;
@@ -2501,6 +2510,7 @@ void qmp_block_stream(bool has_job_id, const char *job_id, const char *device,
                       bool has_on_error, BlockdevOnError on_error,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
+                      bool has_max_workers, int64_t max_workers,
                       Error **errp)
 {
     BlockDriverState *bs, *iter;
@@ -2580,8 +2590,18 @@ void qmp_block_stream(bool has_job_id, const char *job_id, const char *device,
         job_flags |= JOB_MANUAL_DISMISS;
     }
 
+    if (!has_max_workers) {
+        max_workers = 1;
+    }
+    /* stream_start() checks its own, tighter limit */
+    if (max_workers < 1 || max_workers > INT_MAX) {
+        error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
+        goto out;
+    }
+
     stream_start(has_job_id ? job_id : NULL, bs, base_bs, base_name,
-                 job_flags, has_speed ? speed : 0, on_error, &local_err);
+                 job_flags, has_speed ? speed : 0, on_error,
+                 max_workers, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         goto out;
@@ -2604,6 +2624,7 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
                       bool has_filter_node_name, const char *filter_node_name,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
+                      bool has_max_workers, int64_t max_workers,
                       Error **errp)
 {
     BlockDriverState *bs;
@@ -2620,6 +2641,9 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
     if (!has_on_error) {
         on_error = BLOCKDEV_ON_ERROR_REPORT;
     }
+    if (!has_max_workers) {
+        max_workers = 1;
+    }
     if (!has_filter_node_name) {
         filter_node_name = NULL;
     }
@@ -2651,6 +2675,12 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
     aio_context = bdrv_get_aio_context(bs);
     aio_context_acquire(aio_context);
 
+    /* commit_start() checks its own, tighter limit */
+    if (max_workers < 1 || max_workers > INT_MAX) {
+        error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
+        goto out;
+    }
+
     if (bdrv_op_is_blocked(bs, BLOCK_OP_TYPE_COMMIT_SOURCE, errp)) {
         goto out;
     }
@@ -2768,7 +2798,7 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
         }
         commit_start(has_job_id ? job_id : NULL, bs, base_bs, top_bs, job_flags,
                      speed, on_error, has_backing_file ? backing_file : NULL,
-                     filter_node_name, &local_err);
+                     filter_node_name, max_workers, &local_err);
     }
     if (local_err != NULL) {
         error_propagate(errp, local_err);
@@ -2887,6 +2917,7 @@ static BlockJob *do_backup_common(BackupCommon *backup,
                             backup->filter_node_name,
                             backup->on_source_error,
                             backup->on_target_error,
+                            backup->has_x_perf ? backup->x_perf : NULL,
                             job_flags, NULL, NULL, txn, errp);
     return job;
 }
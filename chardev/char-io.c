@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/iov.h"
 #include "chardev/char-io.h"
 
 typedef struct IOWatchPoll {
@@ -109,19 +110,30 @@ void remove_fd_in_watch(Chardev *chr)
     }
 }
 
-int io_channel_send_full(QIOChannel *ioc,
-                         const void *buf, size_t len,
-                         int *fds, size_t nfds)
+int io_channel_sendv_full(QIOChannel *ioc,
+                          const struct iovec *iov, size_t niov,
+                          int *fds, size_t nfds)
 {
+    g_autofree struct iovec *local = NULL;
+    const struct iovec *cur = iov;
+    size_t curcnt = niov;
+    size_t len = iov_size(iov, niov);
     size_t offset = 0;
 
     while (offset < len) {
         ssize_t ret = 0;
-        struct iovec iov = { .iov_base = (char *)buf + offset,
-                             .iov_len = len - offset };
+
+        /* After a short write, go on from where the channel stopped */
+        if (offset) {
+            if (!local) {
+                local = g_new(struct iovec, niov);
+            }
+            curcnt = iov_copy(local, niov, iov, niov, offset, len - offset);
+            cur = local;
+        }
 
         ret = qio_channel_writev_full(
-            ioc, &iov, 1,
+            ioc, cur, curcnt,
             fds, nfds, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
             if (offset) {
@@ -141,6 +153,15 @@ int io_channel_send_full(QIOChannel *ioc,
     return offset;
 }
 
+int io_channel_send_full(QIOChannel *ioc,
+                         const void *buf, size_t len,
+                         int *fds, size_t nfds)
+{
+    struct iovec iov = { .iov_base = (char *)buf, .iov_len = len };
+
+    return io_channel_sendv_full(ioc, &iov, 1, fds, nfds);
+}
+
 int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
 {
     return io_channel_send_full(ioc, buf, len, NULL, 0);
@@ -30,6 +30,7 @@
 #include "io/net-listener.h"
 #include "qemu/error-report.h"
 #include "qemu/module.h"
+#include "qemu/units.h"
 #include "qemu/option.h"
 #include "qapi/error.h"
 #include "qapi/clone-visitor.h"
@@ -43,6 +44,9 @@
 
 #define TCP_MAX_FDS 16
 
+/* Largest read buffer a busy connection grows to */
+#define CHR_SOCKET_READ_BUF_MAX (64 * KiB)
+
 typedef struct {
     char buf[21];
     size_t buflen;
@@ -64,6 +68,8 @@ struct SocketChardev {
     char *tls_authz;
     TCPChardevState state;
     int max_size;
+    uint8_t *read_buf;
+    size_t read_buf_size;
     int do_telnetopt;
     int do_nodelay;
     int *read_msgfds;
@@ -158,14 +164,14 @@ static int tcp_chr_read_poll(void *opaque);
 static void tcp_chr_disconnect_locked(Chardev *chr);
 
 /* Called with chr_write_lock held.  */
-static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+static int tcp_chr_writev(Chardev *chr, const struct iovec *iov, int iovcnt)
 {
     SocketChardev *s = SOCKET_CHARDEV(chr);
 
     if (s->state == TCP_CHARDEV_STATE_CONNECTED) {
-        int ret =  io_channel_send_full(s->ioc, buf, len,
-                                        s->write_msgfds,
-                                        s->write_msgfds_num);
+        int ret =  io_channel_sendv_full(s->ioc, iov, iovcnt,
+                                         s->write_msgfds,
+                                         s->write_msgfds_num);
 
         /* free the written msgfds in any cases
          * other than ret < 0 && errno == EAGAIN
@@ -192,6 +198,14 @@ static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
     }
 }
 
+/* Called with chr_write_lock held.  */
+static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    struct iovec iov = { .iov_base = (uint8_t *)buf, .iov_len = len };
+
+    return tcp_chr_writev(chr, &iov, 1);
+}
+
 static int tcp_chr_read_poll(void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
@@ -508,14 +522,20 @@ static gboolean tcp_chr_read(QIOChannel *chan, GIOCondition cond, void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
     SocketChardev *s = SOCKET_CHARDEV(opaque);
-    uint8_t buf[CHR_READ_BUF_LEN];
+    uint8_t *buf;
     int len, size;
+    bool full;
 
     if ((s->state != TCP_CHARDEV_STATE_CONNECTED) ||
         s->max_size <= 0) {
         return TRUE;
     }
-    len = sizeof(buf);
+    if (!s->read_buf) {
+        s->read_buf_size = CHR_READ_BUF_LEN;
+        s->read_buf = g_malloc(s->read_buf_size);
+    }
+    buf = s->read_buf;
+    len = s->read_buf_size;
     if (len > s->max_size) {
         len = s->max_size;
     }
@@ -524,12 +544,24 @@ static gboolean tcp_chr_read(QIOChannel *chan, GIOCondition cond, void *opaque)
         /* connection closed */
         tcp_chr_disconnect(chr);
     } else if (size > 0) {
+        full = size == s->read_buf_size;
         if (s->do_telnetopt) {
             tcp_chr_process_IAC_bytes(chr, s, buf, &size);
         }
         if (size > 0) {
             qemu_chr_be_write(chr, buf, size);
         }
+
+        /*
+         * A full buffer means more data is probably waiting: read it in
+         * bigger chunks from now on.  Growing only when the buffer fills
+         * up keeps interactive connections at CHR_READ_BUF_LEN.
+         */
+        if (full && s->read_buf_size < CHR_SOCKET_READ_BUF_MAX) {
+            s->read_buf_size *= 2;
+            g_free(s->read_buf);
+            s->read_buf = g_malloc(s->read_buf_size);
+        }
     }
 
     return TRUE;
@@ -1063,6 +1095,7 @@ static void char_socket_finalize(Object *obj)
     qapi_free_SocketAddress(s->addr);
     tcp_chr_telnet_destroy(s);
     g_free(s->telnet_init);
+    g_free(s->read_buf);
     if (s->listener) {
         qio_net_listener_set_client_func_full(s->listener, NULL, NULL,
                                               NULL, chr->gcontext);
@@ -1489,6 +1522,7 @@ static void char_socket_class_init(ObjectClass *oc, void *data)
     cc->open = qmp_chardev_open_socket;
     cc->chr_wait_connected = tcp_chr_wait_connected;
     cc->chr_write = tcp_chr_write;
+    cc->chr_writev = tcp_chr_writev;
     cc->chr_sync_read = tcp_chr_sync_read;
     cc->chr_disconnect = tcp_chr_disconnect;
     cc->get_msgfds = tcp_get_msgfds;
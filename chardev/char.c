@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/iov.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
@@ -182,6 +183,28 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    g_autofree uint8_t *buf = NULL;
+    size_t len;
+    int res;
+
+    /* Replay and the log file work on a linear buffer */
+    if (!cc->chr_writev || qemu_chr_replay(s) || s->logfd >= 0) {
+        len = MIN(iov_size(iov, iovcnt), INT_MAX);
+        buf = g_malloc(len);
+        iov_to_buf(iov, iovcnt, 0, buf, len);
+        return qemu_chr_write(s, buf, len, false);
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    res = cc->chr_writev(s, iov, iovcnt);
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return res;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
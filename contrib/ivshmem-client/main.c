@@ -7,14 +7,20 @@
  */
 
 #include "qemu/osdep.h"
+#include <poll.h>
+#include "qemu/timer.h"
 
 #include "ivshmem-client.h"
 
 #define IVSHMEM_CLIENT_DEFAULT_VERBOSE        0
 #define IVSHMEM_CLIENT_DEFAULT_UNIX_SOCK_PATH "/tmp/ivshmem_socket"
 
+/* how long "bench" waits for each answer before giving up, in ms */
+#define IVSHMEM_CLIENT_BENCH_TIMEOUT 1000
+
 typedef struct IvshmemClientArgs {
     bool verbose;
+    bool echo;
     const char *unix_sock_path;
 } IvshmemClientArgs;
 
@@ -25,6 +31,8 @@ ivshmem_client_usage(const char *name, int code)
     fprintf(stderr, "%s [opts]\n", name);
     fprintf(stderr, "  -h: show this help\n");
     fprintf(stderr, "  -v: verbose mode\n");
+    fprintf(stderr, "  -e: echo mode, send each notification received\n"
+                    "     back to the other peers\n");
     fprintf(stderr, "  -S <unix_sock_path>: path to the unix socket\n"
                     "     to connect to.\n"
                     "     default=%s\n", IVSHMEM_CLIENT_DEFAULT_UNIX_SOCK_PATH);
@@ -40,6 +48,7 @@ ivshmem_client_parse_args(IvshmemClientArgs *args, int argc, char *argv[])
     while ((c = getopt(argc, argv,
                        "h"  /* help */
                        "v"  /* verbose */
+                       "e"  /* echo */
                        "S:" /* unix_sock_path */
                       )) != -1) {
 
@@ -52,6 +61,10 @@ ivshmem_client_parse_args(IvshmemClientArgs *args, int argc, char *argv[])
             args->verbose = 1;
             break;
 
+        case 'e': /* echo */
+            args->echo = 1;
+            break;
+
         case 'S': /* unix_sock_path */
             args->unix_sock_path = optarg;
             break;
@@ -70,7 +83,64 @@ ivshmem_client_cmdline_help(void)
     printf("dump: dump peers (including us)\n"
            "int <peer> <vector>: notify one vector on a peer\n"
            "int <peer> all: notify all vectors of a peer\n"
-           "int all: notify all vectors of all peers (excepting us)\n");
+           "int all: notify all vectors of all peers (excepting us)\n"
+           "bench <peer> <count>: measure the round trip of <count>\n"
+           "    notifications to a peer running in echo mode\n");
+}
+
+static int
+ivshmem_client_cmp_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* ping-pong vector 0 with an echoing peer and print latency statistics */
+static void
+ivshmem_client_bench(IvshmemClient *client, IvshmemClientPeer *peer,
+                     int count)
+{
+    struct pollfd pfd = { .fd = client->local.vectors[0], .events = POLLIN };
+    int64_t *ns, start, total = 0;
+    uint64_t kick;
+    int i, ret;
+
+    if (client->local.vectors_count == 0 || peer->vectors_count == 0) {
+        printf("bench needs at least one vector\n");
+        return;
+    }
+
+    ns = g_new(int64_t, count);
+    for (i = 0; i < count; i++) {
+        start = get_clock();
+        if (ivshmem_client_notify(client, peer, 0) < 0) {
+            break;
+        }
+        do {
+            ret = poll(&pfd, 1, IVSHMEM_CLIENT_BENCH_TIMEOUT);
+        } while (ret < 0 && errno == EINTR);
+        if (ret <= 0) {
+            printf("no answer from peer_id = %" PRId64 ", is it in echo "
+                   "mode?\n", peer->id);
+            break;
+        }
+        if (read(pfd.fd, &kick, sizeof(kick)) != sizeof(kick)) {
+            printf("cannot read our eventfd: %s\n", strerror(errno));
+            break;
+        }
+        ns[i] = get_clock() - start;
+        total += ns[i];
+    }
+
+    if (i) {
+        qsort(ns, i, sizeof(ns[0]), ivshmem_client_cmp_ns);
+        printf("%d round trips: min %.1f us, avg %.1f us, median %.1f us, "
+               "99%% %.1f us, max %.1f us\n", i, ns[0] / 1000.0,
+               total / 1000.0 / i, ns[i / 2] / 1000.0,
+               ns[(int64_t)i * 99 / 100] / 1000.0, ns[i - 1] / 1000.0);
+    }
+    g_free(ns);
 }
 
 /* read stdin and handle commands */
@@ -81,7 +151,7 @@ ivshmem_client_handle_stdin_command(IvshmemClient *client)
     char buf[128];
     char *s, *token;
     int ret;
-    int peer_id, vector;
+    int peer_id, vector, count;
 
     memset(buf, 0, sizeof(buf));
     ret = read(0, buf, sizeof(buf) - 1);
@@ -110,6 +180,17 @@ ivshmem_client_handle_stdin_command(IvshmemClient *client)
                 continue;
             }
             ivshmem_client_notify(client, peer, vector);
+        } else if (sscanf(token, "bench %d %d", &peer_id, &count) == 2) {
+            peer = ivshmem_client_search_peer(client, peer_id);
+            if (peer == NULL) {
+                printf("cannot find peer_id = %d\n", peer_id);
+                continue;
+            }
+            if (count <= 0) {
+                printf("invalid count %d\n", count);
+                continue;
+            }
+            ivshmem_client_bench(client, peer, count);
         } else if (sscanf(token, "int %d all", &peer_id) == 1) {
             peer = ivshmem_client_search_peer(client, peer_id);
             if (peer == NULL) {
@@ -183,6 +264,22 @@ ivshmem_client_notification_cb(const IvshmemClient *client,
            peer->id, vect);
 }
 
+/* callback in echo mode: an eventfd does not tell who rang it, so ring
+ * all the other peers back on the same vector */
+static void
+ivshmem_client_echo_cb(const IvshmemClient *client,
+                       const IvshmemClientPeer *peer,
+                       unsigned vect, void *arg)
+{
+    IvshmemClientPeer *other;
+
+    (void)peer;
+    (void)arg;
+    QTAILQ_FOREACH(other, &client->peer_list, next) {
+        ivshmem_client_notify(client, other, vect);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -211,6 +308,7 @@ main(int argc, char *argv[])
     fflush(stdout);
 
     if (ivshmem_client_init(&client, args.unix_sock_path,
+                            args.echo ? ivshmem_client_echo_cb :
                             ivshmem_client_notification_cb, NULL,
                             args.verbose) < 0) {
         fprintf(stderr, "cannot init client\n");
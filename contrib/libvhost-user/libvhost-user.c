@@ -473,6 +473,32 @@ vu_log_write(VuDev *dev, uint64_t address, uint64_t length)
     vu_log_kick(dev);
 }
 
+/*
+ * Look for new requests for up to vq->poll_budget rounds with guest
+ * notifications disabled, so that a busy guest need not kick, and we
+ * need not wake up, for each of them.
+ */
+static void
+vu_queue_poll(VuDev *dev, VuVirtq *vq, int index)
+{
+    unsigned int round;
+
+    vu_queue_set_notification(dev, vq, 0);
+    for (round = 0; round < vq->poll_budget && vq->handler; round++) {
+        if (!vu_queue_empty(dev, vq)) {
+            vq->handler(dev, index);
+        }
+        /* the guest updates the avail ring behind our back */
+        barrier();
+    }
+    vu_queue_set_notification(dev, vq, 1);
+
+    /* Pick up what was queued before notifications were enabled again */
+    if (vq->handler && !vu_queue_empty(dev, vq)) {
+        vq->handler(dev, index);
+    }
+}
+
 static void
 vu_kick_cb(VuDev *dev, int condition, void *data)
 {
@@ -491,6 +517,9 @@ vu_kick_cb(VuDev *dev, int condition, void *data)
                kick_data, vq->handler, index);
         if (vq->handler) {
             vq->handler(dev, index);
+            if (vq->poll_budget) {
+                vu_queue_poll(dev, vq, index);
+            }
         }
     }
 }
@@ -1206,7 +1235,14 @@ vu_check_queue_inflights(VuDev *dev, VuVirtq *vq)
     vq->counter = 0;
 
     if (unlikely(vq->inflight->used_idx != vq->used_idx)) {
-        vq->inflight->desc[vq->inflight->last_batch_head].inflight = 0;
+        uint16_t batch = vq->used_idx - vq->inflight->used_idx;
+        uint16_t desc_idx = vq->inflight->last_batch_head;
+
+        /* The last batch made it to the used ring but was not retired */
+        for (i = 0; i < batch; i++) {
+            vq->inflight->desc[desc_idx].inflight = 0;
+            desc_idx = vq->inflight->desc[desc_idx].next;
+        }
 
         barrier();
 
@@ -1308,6 +1344,11 @@ void vu_set_queue_handler(VuDev *dev, VuVirtq *vq,
     }
 }
 
+void vu_set_queue_poll_budget(VuDev *dev, VuVirtq *vq, unsigned int budget)
+{
+    vq->poll_budget = budget;
+}
+
 bool vu_set_queue_host_notifier(VuDev *dev, VuVirtq *vq, int fd,
                                 int size, int offset)
 {
@@ -2590,14 +2631,19 @@ vu_queue_inflight_pre_put(VuDev *dev, VuVirtq *vq, int desc_idx)
         return -1;
     }
 
+    /* Chain the elements of a batch, last filled first */
+    vq->inflight->desc[desc_idx].next = vq->inflight->last_batch_head;
     vq->inflight->last_batch_head = desc_idx;
 
     return 0;
 }
 
 static int
-vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, int desc_idx)
+vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, unsigned int count)
 {
+    uint16_t desc_idx;
+    unsigned int i;
+
     if (!vu_has_protocol_feature(dev, VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD)) {
         return 0;
     }
@@ -2608,7 +2654,11 @@ vu_queue_inflight_post_put(VuDev *dev, VuVirtq *vq, int desc_idx)
 
     barrier();
 
-    vq->inflight->desc[desc_idx].inflight = 0;
+    desc_idx = vq->inflight->last_batch_head;
+    for (i = 0; i < count; i++) {
+        vq->inflight->desc[desc_idx].inflight = 0;
+        desc_idx = vq->inflight->desc[desc_idx].next;
+    }
 
     barrier();
 
@@ -2788,6 +2838,7 @@ vu_queue_fill(VuDev *dev, VuVirtq *vq,
     }
 
     vu_log_queue_fill(dev, vq, elem, len);
+    vu_queue_inflight_pre_put(dev, vq, elem->index);
 
     idx = (idx + vq->used_idx) % vq->vring.num;
 
@@ -2827,6 +2878,7 @@ vu_queue_flush(VuDev *dev, VuVirtq *vq, unsigned int count)
     if (unlikely((int16_t)(new - vq->signalled_used) < (uint16_t)(new - old))) {
         vq->signalled_used_valid = false;
     }
+    vu_queue_inflight_post_put(dev, vq, count);
 }
 
 void
@@ -2834,7 +2886,5 @@ vu_queue_push(VuDev *dev, VuVirtq *vq,
               const VuVirtqElement *elem, unsigned int len)
 {
     vu_queue_fill(dev, vq, elem, len, 0);
-    vu_queue_inflight_pre_put(dev, vq, elem->index);
     vu_queue_flush(dev, vq, 1);
-    vu_queue_inflight_post_put(dev, vq, elem->index);
 }
@@ -342,6 +342,9 @@ typedef struct VuVirtq {
 
     vu_queue_handler_cb handler;
 
+    /* Rounds to poll for more requests after a kick, 0 to not poll */
+    unsigned int poll_budget;
+
     int call_fd;
     int kick_fd;
     int err_fd;
@@ -487,6 +490,20 @@ VuVirtq *vu_get_queue(VuDev *dev, int qidx);
 void vu_set_queue_handler(VuDev *dev, VuVirtq *vq,
                           vu_queue_handler_cb handler);
 
+/**
+ * vu_set_queue_poll_budget:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @budget: number of rounds to poll, 0 to disable polling
+ *
+ * After the queue handler has run for a kick, keep checking the queue
+ * for @budget rounds with guest notifications disabled, and run the
+ * handler again whenever it has new requests.  This saves the guest a
+ * kick, and the device a wakeup, for requests that arrive while the
+ * queue is busy, at the cost of spinning.
+ */
+void vu_set_queue_poll_budget(VuDev *dev, VuVirtq *vq, unsigned int budget);
+
 /**
  * vu_set_queue_host_notifier:
  * @dev: a VuDev context
@@ -605,7 +622,9 @@ bool vu_queue_rewind(VuDev *dev, VuVirtq *vq, unsigned int num);
  * @len: length in bytes to write
  * @idx: optional offset for the used ring index (0 in general)
  *
- * Fill the used ring with @elem element.
+ * Fill the used ring with @elem element.  To complete a batch of
+ * elements, fill them with @idx 0, 1, 2... and then make them visible
+ * to the guest with a single vu_queue_flush().
  */
 void vu_queue_fill(VuDev *dev, VuVirtq *vq,
                    const VuVirtqElement *elem,
@@ -41,6 +41,9 @@ typedef struct VubDev {
     bool enable_ro;
     char *blk_name;
     GMainLoop *loop;
+    unsigned int poll_budget;
+    /* requests filled into the used ring since the last flush */
+    unsigned int nr_completed;
 } VubDev;
 
 typedef struct VubReq {
@@ -99,13 +102,12 @@ static void vub_panic_cb(VuDev *vu_dev, const char *buf)
 
 static void vub_req_complete(VubReq *req)
 {
-    VugDev *gdev = &req->vdev_blk->parent;
-    VuDev *vu_dev = &gdev->parent;
+    VubDev *vdev_blk = req->vdev_blk;
+    VuDev *vu_dev = &vdev_blk->parent.parent;
 
-    /* IO size with 1 extra status byte */
-    vu_queue_push(vu_dev, req->vq, req->elem,
-                  req->size + 1);
-    vu_queue_notify(vu_dev, req->vq);
+    /* IO size with 1 extra status byte; vub_process_vq() flushes */
+    vu_queue_fill(vu_dev, req->vq, req->elem,
+                  req->size + 1, vdev_blk->nr_completed++);
 
     if (req->elem) {
         free(req->elem);
@@ -351,6 +353,13 @@ static void vub_process_vq(VuDev *vu_dev, int idx)
             break;
         }
     }
+
+    /* Requests complete synchronously: publish them all at once */
+    if (vdev_blk->nr_completed) {
+        vu_queue_flush(vu_dev, vq, vdev_blk->nr_completed);
+        vu_queue_notify(vu_dev, vq);
+        vdev_blk->nr_completed = 0;
+    }
 }
 
 static void vub_queue_set_started(VuDev *vu_dev, int idx, bool started)
@@ -361,6 +370,12 @@ static void vub_queue_set_started(VuDev *vu_dev, int idx, bool started)
 
     vq = vu_get_queue(vu_dev, idx);
     vu_set_queue_handler(vu_dev, vq, started ? vub_process_vq : NULL);
+    if (started) {
+        VugDev *gdev = container_of(vu_dev, VugDev, parent);
+        VubDev *vdev_blk = container_of(gdev, VubDev, parent);
+
+        vu_set_queue_poll_budget(vu_dev, vq, vdev_blk->poll_budget);
+    }
 }
 
 static uint64_t
@@ -579,6 +594,7 @@ static char *opt_socket_path;
 static char *opt_blk_file;
 static gboolean opt_print_caps;
 static gboolean opt_read_only;
+static int opt_poll_budget;
 
 static GOptionEntry entries[] = {
     { "print-capabilities", 'c', 0, G_OPTION_ARG_NONE, &opt_print_caps,
@@ -590,7 +606,9 @@ static GOptionEntry entries[] = {
     {"blk-file", 'b', 0, G_OPTION_ARG_FILENAME, &opt_blk_file,
      "block device or file path", "PATH"},
     { "read-only", 'r', 0, G_OPTION_ARG_NONE, &opt_read_only,
-      "Enable read-only", NULL }
+      "Enable read-only", NULL },
+    { "poll-budget", 'p', 0, G_OPTION_ARG_INT, &opt_poll_budget,
+      "Poll the queues for up to N rounds after a kick", "N" }
 };
 
 int main(int argc, char **argv)
@@ -647,6 +665,11 @@ int main(int argc, char **argv)
     if (opt_read_only) {
         vdev_blk->enable_ro = true;
     }
+    if (opt_poll_budget < 0) {
+        g_printerr("Invalid poll budget %d\n", opt_poll_budget);
+        exit(EXIT_FAILURE);
+    }
+    vdev_blk->poll_budget = opt_poll_budget;
 
     if (!vug_init(&vdev_blk->parent, VHOST_USER_BLK_MAX_QUEUES, csock,
                   vub_panic_cb, &vub_iface)) {
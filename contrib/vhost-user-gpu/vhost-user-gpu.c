@@ -920,6 +920,7 @@ vg_handle_cursor(VuDev *dev, int qidx)
     VuVirtqElement *elem;
     size_t len;
     struct virtio_gpu_update_cursor cursor;
+    unsigned int count = 0;
 
     for (;;) {
         elem = vu_queue_pop(dev, vq, sizeof(VuVirtqElement));
@@ -937,10 +938,14 @@ vg_handle_cursor(VuDev *dev, int qidx)
             virtio_gpu_bswap_32(&cursor, sizeof(cursor));
             vg_process_cursor_cmd(g, &cursor);
         }
-        vu_queue_push(dev, vq, elem, 0);
-        vu_queue_notify(dev, vq);
+        vu_queue_fill(dev, vq, elem, 0, count++);
         free(elem);
     }
+
+    if (count) {
+        vu_queue_flush(dev, vq, count);
+        vu_queue_notify(dev, vq);
+    }
 }
 
 static void
@@ -76,10 +76,11 @@ static void vi_input_send(VuInput *vi, struct virtio_input_event *event)
         elem = vi->queue[i].elem;
         len = iov_from_buf(elem->in_sg, elem->in_num,
                            0, &vi->queue[i].event, sizeof(virtio_input_event));
-        vu_queue_push(dev, vq, elem, len);
+        vu_queue_fill(dev, vq, elem, len, i);
         free(elem);
     }
 
+    vu_queue_flush(dev, vq, vi->qindex);
     vu_queue_notify(&vi->dev.parent, vq);
     vi->qindex = 0;
 }
@@ -138,6 +139,7 @@ static void vi_handle_sts(VuDev *dev, int qidx)
     VuVirtq *vq = vu_get_queue(dev, qidx);
     virtio_input_event event;
     VuVirtqElement *elem;
+    unsigned int count = 0;
     int len;
 
     g_debug("%s", G_STRFUNC);
@@ -152,10 +154,11 @@ static void vi_handle_sts(VuDev *dev, int qidx)
         len = iov_to_buf(elem->out_sg, elem->out_num,
                          0, &event, sizeof(event));
         vi_handle_status(vi, &event);
-        vu_queue_push(dev, vq, elem, len);
+        vu_queue_fill(dev, vq, elem, len, count++);
         free(elem);
     }
 
+    vu_queue_flush(dev, vq, count);
     vu_queue_notify(&vi->dev.parent, vq);
 }
 
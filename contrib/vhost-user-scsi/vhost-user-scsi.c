@@ -232,6 +232,7 @@ static void vus_proc_req(VuDev *vu_dev, int idx)
     VugDev *gdev;
     VusDev *vdev_scsi;
     VuVirtq *vq;
+    unsigned int count = 0;
 
     assert(vu_dev);
 
@@ -283,11 +284,16 @@ static void vus_proc_req(VuDev *vu_dev, int idx)
             break;
         }
 
-        vu_queue_push(vu_dev, vq, elem, 0);
-        vu_queue_notify(vu_dev, vq);
+        vu_queue_fill(vu_dev, vq, elem, 0, count++);
 
         free(elem);
     }
+
+    /* Complete everything that was processed with one used index update */
+    if (count) {
+        vu_queue_flush(vu_dev, vq, count);
+        vu_queue_notify(vu_dev, vq);
+    }
 }
 
 static void vus_queue_set_started(VuDev *vu_dev, int idx, bool started)
@@ -1279,6 +1279,9 @@ qcrypto_block_luks_open(QCryptoBlock *block,
         if (qcrypto_block_init_cipher(block,
                                       luks->cipher_alg,
                                       luks->cipher_mode,
+                                      options->u.luks.has_cipher_backend ?
+                                      options->u.luks.cipher_backend :
+                                      QCRYPTO_CIPHER_BACKEND_AUTO,
                                       masterkey,
                                       luks->header.master_key_len,
                                       n_threads,
@@ -1471,8 +1474,12 @@ qcrypto_block_luks_create(QCryptoBlock *block,
 
 
     /* Setup the block device payload encryption objects */
+    if (!luks_opts.has_cipher_backend) {
+        luks_opts.cipher_backend = QCRYPTO_CIPHER_BACKEND_AUTO;
+    }
     if (qcrypto_block_init_cipher(block, luks_opts.cipher_alg,
-                                  luks_opts.cipher_mode, masterkey,
+                                  luks_opts.cipher_mode,
+                                  luks_opts.cipher_backend, masterkey,
                                   luks->header.master_key_len, 1, errp) < 0) {
         goto error;
     }
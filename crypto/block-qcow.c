@@ -74,6 +74,7 @@ qcrypto_block_qcow_init(QCryptoBlock *block,
 
     ret = qcrypto_block_init_cipher(block, QCRYPTO_CIPHER_ALG_AES_128,
                                     QCRYPTO_CIPHER_MODE_CBC,
+                                    QCRYPTO_CIPHER_BACKEND_AUTO,
                                     keybuf, G_N_ELEMENTS(keybuf),
                                     n_threads, errp);
     if (ret < 0) {
@@ -262,6 +262,7 @@ static void qcrypto_block_push_cipher(QCryptoBlock *block,
 int qcrypto_block_init_cipher(QCryptoBlock *block,
                               QCryptoCipherAlgorithm alg,
                               QCryptoCipherMode mode,
+                              QCryptoCipherBackend backend,
                               const uint8_t *key, size_t nkey,
                               size_t n_threads, Error **errp)
 {
@@ -272,7 +273,8 @@ int qcrypto_block_init_cipher(QCryptoBlock *block,
     block->ciphers = g_new0(QCryptoCipher *, n_threads);
 
     for (i = 0; i < n_threads; i++) {
-        block->ciphers[i] = qcrypto_cipher_new(alg, mode, key, nkey, errp);
+        block->ciphers[i] = qcrypto_cipher_new_backend(alg, mode, backend,
+                                                       key, nkey, errp);
         if (!block->ciphers[i]) {
             qcrypto_block_free_cipher(block);
             return -1;
@@ -348,10 +350,15 @@ void qcrypto_block_free(QCryptoBlock *block)
 
 
 typedef int (*QCryptoCipherEncDecFunc)(QCryptoCipher *cipher,
-                                        const void *in,
-                                        void *out,
-                                        size_t len,
-                                        Error **errp);
+                                       const uint8_t *ivs, size_t niv,
+                                       size_t sectorsize,
+                                       const void *in,
+                                       void *out,
+                                       size_t len,
+                                       Error **errp);
+
+/* Sectors whose IVs are computed and handed to the cipher at once */
+#define QCRYPTO_BLOCK_BATCH_SECTORS 32
 
 static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           size_t niv,
@@ -364,20 +371,33 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
                                           QCryptoCipherEncDecFunc func,
                                           Error **errp)
 {
-    g_autofree uint8_t *iv = niv ? g_new0(uint8_t, niv) : NULL;
+    g_autofree uint8_t *ivs = NULL;
     int ret = -1;
     uint64_t startsector = offset / sectorsize;
 
     assert(QEMU_IS_ALIGNED(offset, sectorsize));
     assert(QEMU_IS_ALIGNED(len, sectorsize));
 
+    if (niv) {
+        ivs = g_new0(uint8_t, niv * QCRYPTO_BLOCK_BATCH_SECTORS);
+    }
+
     while (len > 0) {
-        size_t nbytes;
+        size_t i, nsectors = MIN(len / sectorsize,
+                                 QCRYPTO_BLOCK_BATCH_SECTORS);
+        size_t nbytes = nsectors * sectorsize;
+
         if (niv) {
             if (ivgen_mutex) {
                 qemu_mutex_lock(ivgen_mutex);
             }
-            ret = qcrypto_ivgen_calculate(ivgen, startsector, iv, niv, errp);
+            for (i = 0; i < nsectors; i++) {
+                ret = qcrypto_ivgen_calculate(ivgen, startsector + i,
+                                              ivs + i * niv, niv, errp);
+                if (ret < 0) {
+                    break;
+                }
+            }
             if (ivgen_mutex) {
                 qemu_mutex_unlock(ivgen_mutex);
             }
@@ -385,20 +405,13 @@ static int do_qcrypto_block_cipher_encdec(QCryptoCipher *cipher,
             if (ret < 0) {
                 return -1;
             }
-
-            if (qcrypto_cipher_setiv(cipher,
-                                     iv, niv,
-                                     errp) < 0) {
-                return -1;
-            }
         }
 
-        nbytes = len > sectorsize ? sectorsize : len;
-        if (func(cipher, buf, buf, nbytes, errp) < 0) {
+        if (func(cipher, ivs, niv, sectorsize, buf, buf, nbytes, errp) < 0) {
             return -1;
         }
 
-        startsector++;
+        startsector += nsectors;
         buf += nbytes;
         len -= nbytes;
     }
@@ -418,7 +431,7 @@ int qcrypto_block_cipher_decrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_decrypt, errp);
+                                          qcrypto_cipher_decrypt_sectors, errp);
 }
 
 
@@ -433,7 +446,7 @@ int qcrypto_block_cipher_encrypt_helper(QCryptoCipher *cipher,
 {
     return do_qcrypto_block_cipher_encdec(cipher, niv, ivgen, NULL, sectorsize,
                                           offset, buf, len,
-                                          qcrypto_cipher_encrypt, errp);
+                                          qcrypto_cipher_encrypt_sectors, errp);
 }
 
 int qcrypto_block_decrypt_helper(QCryptoBlock *block,
@@ -448,7 +461,8 @@ int qcrypto_block_decrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_decrypt, errp);
+                                         len, qcrypto_cipher_decrypt_sectors,
+                                         errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -467,7 +481,8 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
 
     ret = do_qcrypto_block_cipher_encdec(cipher, block->niv, block->ivgen,
                                          &block->mutex, sectorsize, offset, buf,
-                                         len, qcrypto_cipher_encrypt, errp);
+                                         len, qcrypto_cipher_encrypt_sectors,
+                                         errp);
 
     qcrypto_block_push_cipher(block, cipher);
 
@@ -127,6 +127,7 @@ int qcrypto_block_encrypt_helper(QCryptoBlock *block,
 int qcrypto_block_init_cipher(QCryptoBlock *block,
                               QCryptoCipherAlgorithm alg,
                               QCryptoCipherMode mode,
+                              QCryptoCipherBackend backend,
                               const uint8_t *key, size_t nkey,
                               size_t n_threads, Error **errp);
 
@@ -158,16 +158,39 @@ qcrypto_cipher_munge_des_rfb_key(const uint8_t *key,
 #include "cipher-builtin.c.inc"
 #endif
 
-QCryptoCipher *qcrypto_cipher_new(QCryptoCipherAlgorithm alg,
-                                  QCryptoCipherMode mode,
-                                  const uint8_t *key, size_t nkey,
-                                  Error **errp)
+QCryptoCipher *qcrypto_cipher_new_backend(QCryptoCipherAlgorithm alg,
+                                          QCryptoCipherMode mode,
+                                          QCryptoCipherBackend backend,
+                                          const uint8_t *key, size_t nkey,
+                                          Error **errp)
 {
     QCryptoCipher *cipher = NULL;
 
+    switch (backend) {
+    case QCRYPTO_CIPHER_BACKEND_AUTO:
 #ifdef CONFIG_AF_ALG
-    cipher = qcrypto_afalg_cipher_ctx_new(alg, mode, key, nkey, NULL);
+        cipher = qcrypto_afalg_cipher_ctx_new(alg, mode, key, nkey, NULL);
 #endif
+        break;
+
+    case QCRYPTO_CIPHER_BACKEND_AFALG:
+#ifdef CONFIG_AF_ALG
+        cipher = qcrypto_afalg_cipher_ctx_new(alg, mode, key, nkey, errp);
+        if (!cipher) {
+            return NULL;
+        }
+#else
+        error_setg(errp, "QEMU was built without AF_ALG support");
+        return NULL;
+#endif
+        break;
+
+    case QCRYPTO_CIPHER_BACKEND_LIBRARY:
+        break;
+
+    default:
+        g_assert_not_reached();
+    }
 
     if (!cipher) {
         cipher = qcrypto_cipher_ctx_new(alg, mode, key, nkey, errp);
@@ -183,6 +206,16 @@ QCryptoCipher *qcrypto_cipher_new(QCryptoCipherAlgorithm alg,
 }
 
 
+QCryptoCipher *qcrypto_cipher_new(QCryptoCipherAlgorithm alg,
+                                  QCryptoCipherMode mode,
+                                  const uint8_t *key, size_t nkey,
+                                  Error **errp)
+{
+    return qcrypto_cipher_new_backend(alg, mode, QCRYPTO_CIPHER_BACKEND_AUTO,
+                                      key, nkey, errp);
+}
+
+
 int qcrypto_cipher_encrypt(QCryptoCipher *cipher,
                            const void *in,
                            void *out,
@@ -214,6 +247,83 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
 }
 
 
+static int qcrypto_cipher_encdec_sectors(QCryptoCipher *cipher,
+                                         bool encrypt,
+                                         const uint8_t *ivs, size_t niv,
+                                         size_t sectorsize,
+                                         const void *in,
+                                         void *out,
+                                         size_t len,
+                                         Error **errp)
+{
+    const QCryptoCipherDriver *drv = cipher->driver;
+
+    if (!sectorsize || len % sectorsize) {
+        error_setg(errp, "Length %zu must be a multiple of sector size %zu",
+                   len, sectorsize);
+        return -1;
+    }
+
+    if (encrypt && drv->cipher_encrypt_sectors) {
+        return drv->cipher_encrypt_sectors(cipher, ivs, niv, sectorsize,
+                                           in, out, len, errp);
+    }
+    if (!encrypt && drv->cipher_decrypt_sectors) {
+        return drv->cipher_decrypt_sectors(cipher, ivs, niv, sectorsize,
+                                           in, out, len, errp);
+    }
+
+    while (len) {
+        int ret;
+
+        if (niv && drv->cipher_setiv(cipher, ivs, niv, errp) < 0) {
+            return -1;
+        }
+        if (encrypt) {
+            ret = drv->cipher_encrypt(cipher, in, out, sectorsize, errp);
+        } else {
+            ret = drv->cipher_decrypt(cipher, in, out, sectorsize, errp);
+        }
+        if (ret < 0) {
+            return -1;
+        }
+
+        ivs += niv;
+        in += sectorsize;
+        out += sectorsize;
+        len -= sectorsize;
+    }
+
+    return 0;
+}
+
+
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp)
+{
+    return qcrypto_cipher_encdec_sectors(cipher, true, ivs, niv, sectorsize,
+                                         in, out, len, errp);
+}
+
+
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp)
+{
+    return qcrypto_cipher_encdec_sectors(cipher, false, ivs, niv, sectorsize,
+                                         in, out, len, errp);
+}
+
+
 void qcrypto_cipher_free(QCryptoCipher *cipher)
 {
     if (cipher) {
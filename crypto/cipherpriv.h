@@ -34,6 +34,27 @@ struct QCryptoCipherDriver {
                         const uint8_t *iv, size_t niv,
                         Error **errp);
 
+    /*
+     * Optional: process several sectors with one IV each.  @len is
+     * a multiple of @sectorsize.  Without these, the sectors are run
+     * through cipher_setiv and cipher_encrypt/cipher_decrypt in turn.
+     */
+    int (*cipher_encrypt_sectors)(QCryptoCipher *cipher,
+                                  const uint8_t *ivs, size_t niv,
+                                  size_t sectorsize,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  Error **errp);
+
+    int (*cipher_decrypt_sectors)(QCryptoCipher *cipher,
+                                  const uint8_t *ivs, size_t niv,
+                                  size_t sectorsize,
+                                  const void *in,
+                                  void *out,
+                                  size_t len,
+                                  Error **errp);
+
     void (*cipher_free)(QCryptoCipher *cipher);
 };
 
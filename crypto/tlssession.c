@@ -32,6 +32,19 @@
 
 #include <gnutls/x509.h>
 
+#if defined(CONFIG_LINUX_KTLS) && GNUTLS_VERSION_NUMBER >= 0x030400
+#define QCRYPTO_TLS_SESSION_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -548,6 +561,154 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef QCRYPTO_TLS_SESSION_KTLS
+typedef union {
+    struct tls_crypto_info info;
+    struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+#ifdef TLS_CIPHER_AES_GCM_256
+    struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+} QCryptoTLSSessionKernelInfo;
+
+#define QCRYPTO_TLS_KTLS_CIPHER(name, field)                    \
+    do {                                                        \
+        ci->info.cipher_type = TLS_CIPHER_##name;               \
+        ci_iv = ci->field.iv;                                   \
+        ci_key = ci->field.key;                                 \
+        ci_salt = ci->field.salt;                               \
+        ci_seq = ci->field.rec_seq;                             \
+        iv_size = TLS_CIPHER_##name##_IV_SIZE;                  \
+        key_size = TLS_CIPHER_##name##_KEY_SIZE;                \
+        salt_size = TLS_CIPHER_##name##_SALT_SIZE;              \
+        *len = sizeof(ci->field);                               \
+    } while (0)
+
+/*
+ * Fill @ci with the record state of @session in the receive direction
+ * if @read is true or in the send direction otherwise.  Returns false
+ * if the kernel cannot take over the negotiated protocol and cipher.
+ */
+static bool
+qcrypto_tls_session_kernel_info(QCryptoTLSSession *session,
+                                bool read,
+                                QCryptoTLSSessionKernelInfo *ci,
+                                socklen_t *len)
+{
+    gnutls_datum_t mac, iv, key;
+    unsigned char seq[8];
+    unsigned char *ci_iv, *ci_key, *ci_salt, *ci_seq;
+    size_t iv_size, key_size, salt_size;
+
+    memset(ci, 0, sizeof(*ci));
+    switch (gnutls_protocol_get_version(session->handle)) {
+    case GNUTLS_TLS1_2:
+        ci->info.version = TLS_1_2_VERSION;
+        break;
+#ifdef TLS_1_3_VERSION
+    case GNUTLS_TLS1_3:
+        ci->info.version = TLS_1_3_VERSION;
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    switch (gnutls_cipher_get(session->handle)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        QCRYPTO_TLS_KTLS_CIPHER(AES_GCM_128, aes_gcm_128);
+        break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM:
+        QCRYPTO_TLS_KTLS_CIPHER(AES_GCM_256, aes_gcm_256);
+        break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case GNUTLS_CIPHER_CHACHA20_POLY1305:
+        QCRYPTO_TLS_KTLS_CIPHER(CHACHA20_POLY1305, chacha20_poly1305);
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    if (gnutls_record_get_state(session->handle, read, &mac, &iv, &key,
+                                seq) < 0 ||
+        key.size != key_size) {
+        return false;
+    }
+
+    if (iv.size == salt_size) {
+        /* TLS 1.2 AES-GCM, the rest of the nonce is sent in each record */
+        memcpy(ci_iv, seq, iv_size);
+    } else if (iv.size == salt_size + iv_size) {
+        memcpy(ci_iv, iv.data + salt_size, iv_size);
+    } else {
+        return false;
+    }
+    memcpy(ci_salt, iv.data, salt_size);
+    memcpy(ci_key, key.data, key_size);
+    memcpy(ci_seq, seq, sizeof(seq));
+    return true;
+}
+
+
+void
+qcrypto_tls_session_offload(QCryptoTLSSession *session,
+                            int fd,
+                            bool *tx,
+                            bool *rx)
+{
+    QCryptoTLSSessionKernelInfo ci;
+    socklen_t len;
+
+    *tx = *rx = false;
+    if (!session->handshakeComplete) {
+        return;
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        trace_qcrypto_tls_session_offload_fail(session, errno);
+        return;
+    }
+
+    if (qcrypto_tls_session_kernel_info(session, false, &ci, &len) &&
+        setsockopt(fd, SOL_TLS, TLS_TX, &ci, len) == 0) {
+        *tx = true;
+    }
+
+    /*
+     * A TLS 1.3 peer can send session tickets and key updates at any
+     * time, and GnuTLS has to see them, so only TLS 1.2 is received by
+     * the kernel.  Records that GnuTLS has already read stay with it.
+     */
+    if (gnutls_protocol_get_version(session->handle) == GNUTLS_TLS1_2 &&
+        !gnutls_record_check_pending(session->handle) &&
+        qcrypto_tls_session_kernel_info(session, true, &ci, &len) &&
+        setsockopt(fd, SOL_TLS, TLS_RX, &ci, len) == 0) {
+        *rx = true;
+    }
+
+    memset(&ci, 0, sizeof(ci));
+    trace_qcrypto_tls_session_offload(session, *tx, *rx);
+}
+
+#else /* ! QCRYPTO_TLS_SESSION_KTLS */
+
+void
+qcrypto_tls_session_offload(QCryptoTLSSession *session G_GNUC_UNUSED,
+                            int fd G_GNUC_UNUSED,
+                            bool *tx,
+                            bool *rx)
+{
+    *tx = *rx = false;
+}
+
+#endif /* ! QCRYPTO_TLS_SESSION_KTLS */
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -639,4 +800,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+void
+qcrypto_tls_session_offload(QCryptoTLSSession *sess G_GNUC_UNUSED,
+                            int fd G_GNUC_UNUSED,
+                            bool *tx,
+                            bool *rx)
+{
+    *tx = *rx = false;
+}
+
 #endif
@@ -27,6 +27,15 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/*
+ * Number of blocks passed to the cipher function at once.  Backends
+ * such as gcrypt and nettle have a sizeable per-call overhead and can
+ * pipeline several independent blocks through AES-NI, so feeding them
+ * one block at a time wastes most of their throughput.  32 blocks are
+ * one 512 byte sector.
+ */
+#define XTS_BATCH_BLOCKS 32
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -71,6 +80,33 @@ static void xts_mult_x(xts_uint128 *I)
 }
 
 
+/*
+ * Store the tweaks of @n consecutive blocks starting at @iv into @tweaks,
+ * and advance @iv past them.  The tweak is kept in host order between
+ * blocks and the multiplication by x is branchless, so each block only
+ * costs a few shifts.
+ */
+static void xts_compute_tweaks(xts_uint128 *tweaks, unsigned long n,
+                               xts_uint128 *iv)
+{
+    uint64_t lo = le64_to_cpu(iv->u[0]);
+    uint64_t hi = le64_to_cpu(iv->u[1]);
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        uint64_t carry = -(hi >> 63) & 0x87;
+
+        tweaks[i].u[0] = cpu_to_le64(lo);
+        tweaks[i].u[1] = cpu_to_le64(hi);
+        hi = (hi << 1) | (lo >> 63);
+        lo = (lo << 1) ^ carry;
+    }
+
+    iv->u[0] = cpu_to_le64(lo);
+    iv->u[1] = cpu_to_le64(hi);
+}
+
+
 /**
  * xts_tweak_encdec:
  * @param ctxt: the cipher context
@@ -99,6 +135,59 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_tweak_encdec_batch:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @nblocks * XTS_BLOCK_SIZE bytes
+ * @dst: buffer to output the output text of @nblocks * XTS_BLOCK_SIZE bytes
+ * @nblocks: number of blocks to process
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ *
+ * Encrypt/decrypt consecutive blocks with a tweak, calling @func on
+ * up to XTS_BATCH_BLOCKS blocks at a time.  This is equivalent to
+ * calling xts_tweak_encdec() @nblocks times.
+ */
+static void xts_tweak_encdec_batch(const void *ctx,
+                                   xts_cipher_func *func,
+                                   const uint8_t *src,
+                                   uint8_t *dst,
+                                   unsigned long nblocks,
+                                   xts_uint128 *iv)
+{
+    xts_uint128 tweaks[XTS_BATCH_BLOCKS];
+    xts_uint128 bounce[XTS_BATCH_BLOCKS];
+    bool aligned = QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
+                   QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t));
+
+    while (nblocks) {
+        unsigned long i, n = MIN(nblocks, XTS_BATCH_BLOCKS);
+        xts_uint128 *D = aligned ? (xts_uint128 *)dst : bounce;
+
+        xts_compute_tweaks(tweaks, n, iv);
+        for (i = 0; i < n; i++) {
+            xts_uint128 S;
+
+            memcpy(&S, src + i * XTS_BLOCK_SIZE, XTS_BLOCK_SIZE);
+            xts_uint128_xor(&D[i], &S, &tweaks[i]);
+        }
+
+        func(ctx, n * XTS_BLOCK_SIZE, D->b, D->b);
+
+        for (i = 0; i < n; i++) {
+            xts_uint128_xor(&D[i], &D[i], &tweaks[i]);
+        }
+        if (!aligned) {
+            memcpy(dst, bounce, n * XTS_BLOCK_SIZE);
+        }
+
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
+        nblocks -= n;
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -127,24 +216,9 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_batch(datactx, decfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -203,25 +277,9 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_tweak_encdec_batch(datactx, encfunc, src, dst, lim, &T);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -248,3 +306,72 @@ void xts_encrypt(const void *datactx,
     /* Decrypt the iv back */
     decfunc(tweakctx, XTS_BLOCK_SIZE, iv, T.b);
 }
+
+
+/*
+ * The initial tweaks of up to XTS_BATCH_BLOCKS sectors are encrypted
+ * with one call of @encfunc, then each sector goes through the batched
+ * block path.
+ */
+static void xts_encdec_sectors(const void *datactx,
+                               const void *tweakctx,
+                               xts_cipher_func *encfunc,
+                               xts_cipher_func *func,
+                               const uint8_t *ivs,
+                               size_t sectorsize,
+                               size_t length,
+                               uint8_t *dst,
+                               const uint8_t *src)
+{
+    xts_uint128 T[XTS_BATCH_BLOCKS];
+    size_t nsectors = length / sectorsize;
+
+    g_assert(sectorsize && !(sectorsize % XTS_BLOCK_SIZE));
+    g_assert(!(length % sectorsize));
+
+    while (nsectors) {
+        size_t i, n = MIN(nsectors, XTS_BATCH_BLOCKS);
+
+        encfunc(tweakctx, n * XTS_BLOCK_SIZE, T[0].b, ivs);
+
+        for (i = 0; i < n; i++) {
+            xts_tweak_encdec_batch(datactx, func, src, dst,
+                                   sectorsize / XTS_BLOCK_SIZE, &T[i]);
+            src += sectorsize;
+            dst += sectorsize;
+        }
+
+        ivs += n * XTS_BLOCK_SIZE;
+        nsectors -= n;
+    }
+}
+
+
+void xts_decrypt_sectors(const void *datactx,
+                         const void *tweakctx,
+                         xts_cipher_func *encfunc,
+                         xts_cipher_func *decfunc,
+                         const uint8_t *ivs,
+                         size_t sectorsize,
+                         size_t length,
+                         uint8_t *dst,
+                         const uint8_t *src)
+{
+    xts_encdec_sectors(datactx, tweakctx, encfunc, decfunc,
+                       ivs, sectorsize, length, dst, src);
+}
+
+
+void xts_encrypt_sectors(const void *datactx,
+                         const void *tweakctx,
+                         xts_cipher_func *encfunc,
+                         xts_cipher_func *decfunc,
+                         const uint8_t *ivs,
+                         size_t sectorsize,
+                         size_t length,
+                         uint8_t *dst,
+                         const uint8_t *src)
+{
+    xts_encdec_sectors(datactx, tweakctx, encfunc, encfunc,
+                       ivs, sectorsize, length, dst, src);
+}
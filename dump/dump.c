@@ -42,6 +42,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -847,6 +850,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -959,6 +967,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1286,6 +1299,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1298,20 +1316,308 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * Pages are compressed by a pool of worker threads, in batches of
+ * DUMP_BATCH_PAGES, while the dumping thread writes the batches out in
+ * the order it queued them.  The page descriptors must follow pfn order
+ * and the page data offsets are only known once the previous pages have
+ * been compressed, so all writes stay in the dumping thread.
+ */
+#define DUMP_BATCH_PAGES    64
+#define DUMP_MAX_THREADS    16
+
+typedef struct DumpBatch {
+    size_t nr_pages;
+    uint8_t *pages[DUMP_BATCH_PAGES];
+    /* compression format of each page, 0 if it is stored as is */
+    uint32_t flags[DUMP_BATCH_PAGES];
+    /* size of each page in the vmcore, 0 for zero pages */
+    size_t sizes[DUMP_BATCH_PAGES];
+    uint8_t *buf_out;           /* DUMP_BATCH_PAGES * len_buf_out bytes */
+    bool done;
+} DumpBatch;
+
+typedef struct DumpCompressor {
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressor;
+
+typedef struct DumpWorkers {
+    DumpState *s;
+    size_t len_buf_out;
+    DumpBatch *batches;
+    unsigned nr_batches;
+    unsigned nr_threads;
+    QemuThread *threads;
+    /* used instead of the threads if there are none */
+    DumpCompressor compressor;
+
+    QemuMutex lock;
+    QemuCond job_cond;          /* a batch was queued, or quit was set */
+    QemuCond done_cond;         /* a batch was compressed */
+    uint64_t queued;            /* batches queued by the dumping thread */
+    uint64_t taken;             /* batches picked up by the workers */
+    bool quit;
+} DumpWorkers;
+
+static void dump_compressor_init(DumpCompressor *c)
+{
+#ifdef CONFIG_LZO
+    c->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    c->zstd = ZSTD_createCCtx();
+#endif
+}
+
+static void dump_compressor_cleanup(DumpCompressor *c)
+{
+#ifdef CONFIG_LZO
+    g_free(c->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(c->zstd);
+#endif
+}
+
+/*
+ * Compress the page at @buf into @buf_out, which has room for
+ * @len_buf_out bytes.  Returns the format that was used, or 0 if the page
+ * does not shrink and must be saved in plaintext.
+ */
+static uint32_t dump_compress_page(DumpState *s, DumpCompressor *c,
+                                   const uint8_t *buf, uint8_t *buf_out,
+                                   size_t len_buf_out, size_t *size_out)
+{
+    size_t page_size = s->dump_info.page_size;
+    size_t size = len_buf_out;
+
+    switch (s->flag_compress) {
+    case DUMP_DH_COMPRESSED_ZLIB: {
+        uLongf zlib_size = len_buf_out;
+
+        if (compress2(buf_out, &zlib_size, buf, page_size,
+                      Z_BEST_SPEED) != Z_OK) {
+            return 0;
+        }
+        size = zlib_size;
+        break;
+    }
+
+#ifdef CONFIG_LZO
+    case DUMP_DH_COMPRESSED_LZO: {
+        lzo_uint lzo_size = len_buf_out;
+
+        if (lzo1x_1_compress(buf, page_size, buf_out, &lzo_size,
+                             c->wrkmem) != LZO_E_OK) {
+            return 0;
+        }
+        size = lzo_size;
+        break;
+    }
+#endif
+
+#ifdef CONFIG_SNAPPY
+    case DUMP_DH_COMPRESSED_SNAPPY:
+        if (snappy_compress((const char *)buf, page_size, (char *)buf_out,
+                            &size) != SNAPPY_OK) {
+            return 0;
+        }
+        break;
+#endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        if (!c->zstd) {
+            return 0;
+        }
+        size = ZSTD_compressCCtx(c->zstd, buf_out, len_buf_out, buf,
+                                 page_size, 1);
+        if (ZSTD_isError(size)) {
+            return 0;
+        }
+        break;
+#endif
+
+    default:
+        return 0;
+    }
+
+    if (size >= page_size) {
+        return 0;
+    }
+    *size_out = size;
+    return s->flag_compress;
+}
+
+static void dump_compress_batch(DumpWorkers *w, DumpCompressor *c,
+                                DumpBatch *b)
+{
+    size_t page_size = w->s->dump_info.page_size;
+    size_t i;
+
+    for (i = 0; i < b->nr_pages; i++) {
+        if (is_zero_page(b->pages[i], page_size)) {
+            b->flags[i] = 0;
+            b->sizes[i] = 0;
+            continue;
+        }
+        b->flags[i] = dump_compress_page(w->s, c, b->pages[i],
+                                         b->buf_out + i * w->len_buf_out,
+                                         w->len_buf_out, &b->sizes[i]);
+        if (!b->flags[i]) {
+            b->sizes[i] = page_size;
+        }
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpWorkers *w = opaque;
+    DumpCompressor c;
+    DumpBatch *b;
+
+    dump_compressor_init(&c);
+
+    qemu_mutex_lock(&w->lock);
+    while (true) {
+        while (!w->quit && w->taken == w->queued) {
+            qemu_cond_wait(&w->job_cond, &w->lock);
+        }
+        if (w->quit) {
+            break;
+        }
+        b = &w->batches[w->taken++ % w->nr_batches];
+        qemu_mutex_unlock(&w->lock);
+
+        dump_compress_batch(w, &c, b);
+
+        qemu_mutex_lock(&w->lock);
+        b->done = true;
+        qemu_cond_broadcast(&w->done_cond);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    dump_compressor_cleanup(&c);
+    return NULL;
+}
+
+static void dump_workers_start(DumpWorkers *w, DumpState *s,
+                               size_t len_buf_out)
+{
+    long nr_cpus = 1;
+    unsigned i;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    memset(w, 0, sizeof(*w));
+    w->s = s;
+    w->len_buf_out = len_buf_out;
+
+    /* on a single CPU, compress in the dumping thread */
+    w->nr_threads = nr_cpus > 1 ? MIN(nr_cpus, DUMP_MAX_THREADS) : 0;
+    w->nr_batches = MAX(w->nr_threads * 2, 1);
+    w->batches = g_new0(DumpBatch, w->nr_batches);
+    for (i = 0; i < w->nr_batches; i++) {
+        w->batches[i].buf_out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+    }
+
+    if (!w->nr_threads) {
+        dump_compressor_init(&w->compressor);
+        return;
+    }
+
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->job_cond);
+    qemu_cond_init(&w->done_cond);
+    w->threads = g_new(QemuThread, w->nr_threads);
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_thread_create(&w->threads[i], "dump_compress",
+                           dump_compress_thread, w, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_workers_stop(DumpWorkers *w)
+{
+    unsigned i;
+
+    if (!w->nr_threads) {
+        dump_compressor_cleanup(&w->compressor);
+    } else {
+        qemu_mutex_lock(&w->lock);
+        w->quit = true;
+        qemu_cond_broadcast(&w->job_cond);
+        qemu_mutex_unlock(&w->lock);
+
+        for (i = 0; i < w->nr_threads; i++) {
+            qemu_thread_join(&w->threads[i]);
+        }
+        g_free(w->threads);
+        qemu_cond_destroy(&w->done_cond);
+        qemu_cond_destroy(&w->job_cond);
+        qemu_mutex_destroy(&w->lock);
+    }
+
+    for (i = 0; i < w->nr_batches; i++) {
+        g_free(w->batches[i].buf_out);
+    }
+    g_free(w->batches);
+}
+
+/* Hand the batch that was just filled in over to the workers */
+static void dump_workers_queue(DumpWorkers *w)
+{
+    DumpBatch *b = &w->batches[w->queued % w->nr_batches];
+
+    if (!w->nr_threads) {
+        dump_compress_batch(w, &w->compressor, b);
+        b->done = true;
+        w->queued++;
+        return;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    b->done = false;
+    w->queued++;
+    qemu_cond_signal(&w->job_cond);
+    qemu_mutex_unlock(&w->lock);
+}
+
+/* Wait until the @seq-th queued batch is compressed */
+static DumpBatch *dump_workers_wait(DumpWorkers *w, uint64_t seq)
+{
+    DumpBatch *b = &w->batches[seq % w->nr_batches];
+
+    if (w->nr_threads) {
+        qemu_mutex_lock(&w->lock);
+        while (!b->done) {
+            qemu_cond_wait(&w->done_cond, &w->lock);
+        }
+        qemu_mutex_unlock(&w->lock);
+    }
+    return b;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    DumpWorkers workers;
+    DumpBatch *b;
+    size_t len_buf_out, i;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    uint64_t written = 0;
+    bool more = true;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1324,11 +1630,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    dump_workers_start(&workers, s, len_buf_out);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1352,97 +1654,64 @@ static void write_dump_pages(DumpState *s, Error **errp)
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (true) {
+        /* keep the workers busy while there are pages left */
+        while (more && workers.queued - written < workers.nr_batches) {
+            b = &workers.batches[workers.queued % workers.nr_batches];
+            b->nr_pages = 0;
+            while (b->nr_pages < DUMP_BATCH_PAGES &&
+                   (more = get_next_page(&block_iter, &pfn_iter, &buf, s))) {
+                b->pages[b->nr_pages++] = buf;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
+            if (b->nr_pages == 0) {
+                break;
+            }
+            dump_workers_queue(&workers);
+        }
+        if (written == workers.queued) {
+            break;
+        }
+
+        b = dump_workers_wait(&workers, written++);
+        for (i = 0; i < b->nr_pages; i++) {
+            if (b->sizes[i] == 0) {
+                ret = write_cache(&page_desc, &pd_zero,
+                                  sizeof(PageDescriptor), false);
                 if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
+                    error_setg(errp, "dump: failed to write page desc");
                     goto out;
                 }
+                s->written_size += s->dump_info.page_size;
+                continue;
+            }
+
+            /*
+             * the page is stored compressed if that made it smaller, in
+             * plaintext otherwise
+             */
+            ret = write_cache(&page_data,
+                              b->flags[i] ? b->buf_out + i * len_buf_out
+                                          : b->pages[i],
+                              b->sizes[i], false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                goto out;
             }
 
             /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, b->flags[i]);
+            pd.size = cpu_to_dump32(s, b->sizes[i]);
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+            offset_data += b->sizes[i];
 
             ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
             if (ret < 0) {
                 error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
+            s->written_size += s->dump_info.page_size;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1457,14 +1726,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_workers_stop(&workers);
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1805,6 +2069,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1962,7 +2230,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -1977,6 +2245,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #ifndef TARGET_X86_64
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP) {
         error_setg(errp, "Windows dump is only available for x86-64");
@@ -2058,6 +2333,13 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
+    item = item->next;
+    item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+#endif
+
     /* Windows dump is available only if target is x86_64 */
 #ifdef TARGET_X86_64
     item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
@@ -444,8 +444,10 @@ static MemoryRegionSection address_space_translate_iommu(IOMMUMemoryRegion *iomm
             iommu_idx = imrc->attrs_to_index(iommu_mr, attrs);
         }
 
-        iotlb = imrc->translate(iommu_mr, addr, is_write ?
-                                IOMMU_WO : IOMMU_RO, iommu_idx);
+        iotlb = memory_region_iommu_translate_cached(iommu_mr, addr,
+                                                     is_write ? IOMMU_WO
+                                                              : IOMMU_RO,
+                                                     iommu_idx);
 
         if (!(iotlb.perm & (1 << is_write))) {
             goto unassigned;
@@ -873,6 +875,9 @@ void cpu_exec_unrealizefn(CPUState *cpu)
 
     tlb_destroy(cpu);
     cpu_list_remove(cpu);
+    if (tcg_enabled()) {
+        tb_jmp_cache_destroy(cpu);
+    }
 
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
@@ -917,6 +922,9 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     CPUClass *cc = CPU_GET_CLASS(cpu);
     static bool tcg_target_initialized;
 
+    if (tcg_enabled()) {
+        tb_jmp_cache_init(cpu);
+    }
     cpu_list_add(cpu);
 
     if (tcg_enabled() && !tcg_target_initialized) {
@@ -973,6 +981,7 @@ void tb_invalidate_phys_addr(target_ulong addr)
 {
     mmap_lock();
     tb_invalidate_phys_page_range(addr, addr + 1);
+    tb_revive_forget();
     mmap_unlock();
 }
 
@@ -999,6 +1008,7 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs)
     }
     ram_addr = memory_region_get_ram_addr(mr) + addr;
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1);
+    tb_revive_forget();
 }
 
 static void breakpoint_invalidate(CPUState *cpu, target_ulong pc)
@@ -1244,10 +1254,18 @@ static RAMBlock *qemu_get_ram_block(ram_addr_t addr)
 {
     RAMBlock *block;
 
+    IntervalTreeNode *node;
+
     block = qatomic_rcu_read(&ram_list.mru_block);
     if (block && addr - block->offset < block->max_length) {
         return block;
     }
+    node = interval_tree_iter_first(&ram_list.offset_tree, addr, addr);
+    if (node) {
+        block = container_of(node, RAMBlock, offset_node);
+        goto found;
+    }
+    /* The tree can miss a block while it is being updated */
     RAMBLOCK_FOREACH(block) {
         if (addr - block->offset < block->max_length) {
             goto found;
@@ -1832,6 +1850,7 @@ static void *file_ram_alloc(RAMBlock *block,
                             bool truncate,
                             Error **errp)
 {
+    bool map_sync;
     void *area;
 
     block->page_size = qemu_fd_getpagesize(fd);
@@ -1880,12 +1899,16 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     area = qemu_ram_mmap(fd, memory, block->mr->align,
-                         block->flags & RAM_SHARED, block->flags & RAM_PMEM);
+                         block->flags & RAM_SHARED, block->flags & RAM_PMEM,
+                         &map_sync);
     if (area == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "unable to map backing store for guest RAM");
         return NULL;
     }
+    if (map_sync) {
+        block->flags |= RAM_SYNC;
+    }
 
     block->fd = fd;
     return area;
@@ -2000,6 +2023,11 @@ bool qemu_ram_is_shared(RAMBlock *rb)
     return rb->flags & RAM_SHARED;
 }
 
+bool qemu_ram_is_map_sync(RAMBlock *rb)
+{
+    return rb->flags & RAM_SYNC;
+}
+
 /* Note: Only set at the start of postcopy */
 bool qemu_ram_is_uf_zeroable(RAMBlock *rb)
 {
@@ -2225,6 +2253,39 @@ static void dirty_memory_extend(ram_addr_t old_ram_size,
     }
 }
 
+/*
+ * Index @block by ram_addr_t and by host address.  Xen maps blocks
+ * lazily and looks host addresses up in its map cache instead.
+ * Called with the ramlist lock held.
+ */
+static void ram_block_insert_nodes(RAMBlock *block)
+{
+    if (!block->max_length) {
+        return;
+    }
+    block->offset_node.start = block->offset;
+    block->offset_node.last = block->offset + block->max_length - 1;
+    interval_tree_insert(&block->offset_node, &ram_list.offset_tree);
+
+    if (!xen_enabled() && block->host) {
+        block->host_node.start = (uintptr_t)block->host;
+        block->host_node.last = (uintptr_t)block->host + block->max_length - 1;
+        interval_tree_insert(&block->host_node, &ram_list.host_tree);
+    }
+}
+
+/* Called with the ramlist lock held */
+static void ram_block_remove_nodes(RAMBlock *block)
+{
+    if (!block->max_length) {
+        return;
+    }
+    interval_tree_remove(&block->offset_node, &ram_list.offset_tree);
+    if (!xen_enabled() && block->host) {
+        interval_tree_remove(&block->host_node, &ram_list.host_tree);
+    }
+}
+
 static void ram_block_add(RAMBlock *new_block, Error **errp, bool shared)
 {
     RAMBlock *block;
@@ -2282,6 +2343,7 @@ static void ram_block_add(RAMBlock *new_block, Error **errp, bool shared)
     } else { /* list is empty */
         QLIST_INSERT_HEAD_RCU(&ram_list.blocks, new_block, next);
     }
+    ram_block_insert_nodes(new_block);
     ram_list.mru_block = NULL;
 
     /* Write list before version */
@@ -2498,6 +2560,7 @@ void qemu_ram_free(RAMBlock *block)
 
     qemu_mutex_lock_ramlist();
     QLIST_REMOVE_RCU(block, next);
+    ram_block_remove_nodes(block);
     ram_list.mru_block = NULL;
     /* Write list before version */
     smp_wmb();
@@ -2650,6 +2713,7 @@ RAMBlock *qemu_ram_block_from_host(void *ptr, bool round_offset,
                                    ram_addr_t *offset)
 {
     RAMBlock *block;
+    IntervalTreeNode *node;
     uint8_t *host = ptr;
 
     if (xen_enabled()) {
@@ -2669,6 +2733,14 @@ RAMBlock *qemu_ram_block_from_host(void *ptr, bool round_offset,
         goto found;
     }
 
+    node = interval_tree_iter_first(&ram_list.host_tree, (uintptr_t)host,
+                                    (uintptr_t)host);
+    if (node) {
+        block = container_of(node, RAMBlock, host_node);
+        goto found;
+    }
+
+    /* The tree can miss a block while it is being updated */
     RAMBLOCK_FOREACH(block) {
         /* This case append when the block is not mapped. */
         if (block->host == NULL) {
@@ -3405,53 +3477,48 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
-typedef struct {
+typedef struct BounceBuffer {
     MemoryRegion *mr;
     void *buffer;
     hwaddr addr;
     hwaddr len;
-    bool in_use;
+    QLIST_ENTRY(BounceBuffer) link;
 } BounceBuffer;
 
-static BounceBuffer bounce;
-
-typedef struct MapClient {
+typedef struct AddressSpaceMapClient {
     QEMUBH *bh;
-    QLIST_ENTRY(MapClient) link;
-} MapClient;
-
-QemuMutex map_client_list_lock;
-static QLIST_HEAD(, MapClient) map_client_list
-    = QLIST_HEAD_INITIALIZER(map_client_list);
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+} AddressSpaceMapClient;
 
-static void cpu_unregister_map_client_do(MapClient *client)
+static void
+address_space_unregister_map_client_do(AddressSpaceMapClient *client)
 {
     QLIST_REMOVE(client, link);
     g_free(client);
 }
 
-static void cpu_notify_map_clients_locked(void)
+static void address_space_notify_map_clients_locked(AddressSpace *as)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    while (!QLIST_EMPTY(&map_client_list)) {
-        client = QLIST_FIRST(&map_client_list);
+    while (!QLIST_EMPTY(&as->map_client_list)) {
+        client = QLIST_FIRST(&as->map_client_list);
         qemu_bh_schedule(client->bh);
-        cpu_unregister_map_client_do(client);
+        address_space_unregister_map_client_do(client);
     }
 }
 
-void cpu_register_map_client(QEMUBH *bh)
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client = g_malloc(sizeof(*client));
+    AddressSpaceMapClient *client = g_malloc(sizeof(*client));
 
-    qemu_mutex_lock(&map_client_list_lock);
+    qemu_mutex_lock(&as->bounce_lock);
     client->bh = bh;
-    QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!qatomic_read(&bounce.in_use)) {
-        cpu_notify_map_clients_locked();
+    QLIST_INSERT_HEAD(&as->map_client_list, client, link);
+    if (qatomic_read(&as->bounce_buffer_size) < as->max_bounce_buffer_size) {
+        address_space_notify_map_clients_locked(as);
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->bounce_lock);
 }
 
 void cpu_exec_init_all(void)
@@ -3467,28 +3534,75 @@ void cpu_exec_init_all(void)
     finalize_target_page_bits();
     io_mem_init();
     memory_map_init();
-    qemu_mutex_init(&map_client_list_lock);
 }
 
-void cpu_unregister_map_client(QEMUBH *bh)
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh)
 {
-    MapClient *client;
+    AddressSpaceMapClient *client;
 
-    qemu_mutex_lock(&map_client_list_lock);
-    QLIST_FOREACH(client, &map_client_list, link) {
+    qemu_mutex_lock(&as->bounce_lock);
+    QLIST_FOREACH(client, &as->map_client_list, link) {
         if (client->bh == bh) {
-            cpu_unregister_map_client_do(client);
+            address_space_unregister_map_client_do(client);
             break;
         }
     }
-    qemu_mutex_unlock(&map_client_list_lock);
+    qemu_mutex_unlock(&as->bounce_lock);
 }
 
-static void cpu_notify_map_clients(void)
+/*
+ * Reserve up to @len bytes of @as's bounce buffer budget.  Returns the
+ * number of bytes reserved, zero if the budget is exhausted.
+ */
+static hwaddr address_space_reserve_bounce(AddressSpace *as, hwaddr len)
 {
-    qemu_mutex_lock(&map_client_list_lock);
-    cpu_notify_map_clients_locked();
-    qemu_mutex_unlock(&map_client_list_lock);
+    size_t used = qatomic_read(&as->bounce_buffer_size);
+    size_t old;
+
+    do {
+        if (used >= as->max_bounce_buffer_size) {
+            return 0;
+        }
+        len = MIN(len, as->max_bounce_buffer_size - used);
+        old = used;
+        used = qatomic_cmpxchg(&as->bounce_buffer_size, old, old + len);
+    } while (used != old);
+
+    return len;
+}
+
+/* Returns the bounce buffer of @as whose host address is @buffer, if any */
+static BounceBuffer *address_space_take_bounce(AddressSpace *as, void *buffer)
+{
+    BounceBuffer *bounce;
+
+    /* Only pay for the lookup while bounce buffers are outstanding */
+    if (!qatomic_read(&as->bounce_buffer_size)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&as->bounce_lock);
+    QLIST_FOREACH(bounce, &as->bounce_buffers, link) {
+        if (bounce->buffer == buffer) {
+            QLIST_REMOVE(bounce, link);
+            break;
+        }
+    }
+    qemu_mutex_unlock(&as->bounce_lock);
+    return bounce;
+}
+
+static void address_space_release_bounce(AddressSpace *as,
+                                         BounceBuffer *bounce)
+{
+    qemu_vfree(bounce->buffer);
+    memory_region_unref(bounce->mr);
+
+    qemu_mutex_lock(&as->bounce_lock);
+    qatomic_sub(&as->bounce_buffer_size, bounce->len);
+    address_space_notify_map_clients_locked(as);
+    qemu_mutex_unlock(&as->bounce_lock);
+    g_free(bounce);
 }
 
 static bool flatview_access_valid(FlatView *fv, hwaddr addr, hwaddr len,
@@ -3582,25 +3696,32 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (qatomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *bounce;
+
+        /* Avoid unbounded allocations */
+        l = address_space_reserve_bounce(as, l);
+        if (!l) {
             *plen = 0;
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        bounce = g_new(BounceBuffer, 1);
+        bounce->buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
+        bounce->addr = addr;
+        bounce->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                               bounce->buffer, l);
         }
 
+        qemu_mutex_lock(&as->bounce_lock);
+        QLIST_INSERT_HEAD(&as->bounce_buffers, bounce, link);
+        qemu_mutex_unlock(&as->bounce_lock);
+
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3619,7 +3740,9 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *bounce = address_space_take_bounce(as, buffer);
+
+    if (!bounce) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3635,14 +3758,10 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
-    }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    qatomic_mb_set(&bounce.in_use, false);
-    cpu_notify_map_clients();
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
+    }
+    address_space_release_bounce(as, bounce);
 }
 
 void *cpu_physical_memory_map(hwaddr addr,
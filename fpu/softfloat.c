@@ -268,6 +268,7 @@ typedef bool (*f64_check_fn)(union_float64 a, union_float64 b);
 
 typedef float32 (*soft_f32_op2_fn)(float32 a, float32 b, float_status *s);
 typedef float64 (*soft_f64_op2_fn)(float64 a, float64 b, float_status *s);
+typedef bfloat16 (*soft_bf16_op2_fn)(bfloat16 a, bfloat16 b, float_status *s);
 typedef float   (*hard_f32_op2_fn)(float a, float b);
 typedef double  (*hard_f64_op2_fn)(double a, double b);
 
@@ -401,6 +402,54 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * bfloat16 has no host type, but its values are float32 values with the
+ * low 16 bits of the fraction clear.  Compute in float32 and round the
+ * result to bfloat16: the double rounding is innocuous for the basic
+ * operations, because float32 has more than twice as many fraction bits
+ * as bfloat16 plus two.  Results that overflow in either format go to
+ * softfloat so that it raises the flags.
+ */
+static inline bfloat16
+bfloat16_gen2(bfloat16 xa, bfloat16 xb, float_status *s,
+              hard_f32_op2_fn hard, soft_bf16_op2_fn soft,
+              f32_check_fn pre, f32_check_fn post)
+{
+    union_float32 ua, ub, ur;
+    uint32_t r;
+
+    ua.s = make_float32((uint32_t)bfloat16_val(xa) << 16);
+    ub.s = make_float32((uint32_t)bfloat16_val(xb) << 16);
+
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float32_input_flush2(&ua.s, &ub.s, s);
+    if (unlikely(!pre(ua, ub))) {
+        goto soft;
+    }
+
+    ur.h = hard(ua.h, ub.h);
+    if (unlikely(f32_is_inf(ur))) {
+        goto soft;
+    } else if (unlikely(fabsf(ur.h) <= FLT_MIN) && post(ua, ub)) {
+        goto soft;
+    }
+
+    /* Round to nearest even */
+    r = float32_val(ur.s);
+    r += 0x7fff + ((r >> 16) & 1);
+    if (unlikely((r & 0x7f800000) == 0x7f800000)) {
+        goto soft;
+    }
+    return make_bfloat16(r >> 16);
+
+ soft:
+    return soft(make_bfloat16(float32_val(ua.s) >> 16),
+                make_bfloat16(float32_val(ub.s) >> 16), s);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the single-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -1186,22 +1235,38 @@ float64_sub(float64 a, float64 b, float_status *s)
  * Returns the result of adding or subtracting the bfloat16
  * values `a' and `b'.
  */
-bfloat16 QEMU_FLATTEN bfloat16_add(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_addsub(bfloat16 a, bfloat16 b, bool subtract, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, false, status);
+    FloatParts pr = addsub_floats(pa, pb, subtract, status);
 
     return bfloat16_round_pack_canonical(pr, status);
 }
 
-bfloat16 QEMU_FLATTEN bfloat16_sub(bfloat16 a, bfloat16 b, float_status *status)
+static inline bfloat16 soft_bf16_add(bfloat16 a, bfloat16 b,
+                                     float_status *status)
 {
-    FloatParts pa = bfloat16_unpack_canonical(a, status);
-    FloatParts pb = bfloat16_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, true, status);
+    return soft_bf16_addsub(a, b, false, status);
+}
 
-    return bfloat16_round_pack_canonical(pr, status);
+static inline bfloat16 soft_bf16_sub(bfloat16 a, bfloat16 b,
+                                     float_status *status)
+{
+    return soft_bf16_addsub(a, b, true, status);
+}
+
+bfloat16 QEMU_FLATTEN bfloat16_add(bfloat16 a, bfloat16 b, float_status *status)
+{
+    return bfloat16_gen2(a, b, status, hard_f32_add, soft_bf16_add,
+                         f32_is_zon2, f32_addsubmul_post);
+}
+
+bfloat16 QEMU_FLATTEN bfloat16_sub(bfloat16 a, bfloat16 b, float_status *status)
+{
+    return bfloat16_gen2(a, b, status, hard_f32_sub, soft_bf16_sub,
+                         f32_is_zon2, f32_addsubmul_post);
 }
 
 /*
@@ -1311,7 +1376,8 @@ float64_mul(float64 a, float64 b, float_status *s)
  * values `a' and `b'.
  */
 
-bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_mul(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
@@ -1320,6 +1386,12 @@ bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
     return bfloat16_round_pack_canonical(pr, status);
 }
 
+bfloat16 QEMU_FLATTEN bfloat16_mul(bfloat16 a, bfloat16 b, float_status *status)
+{
+    return bfloat16_gen2(a, b, status, hard_f32_mul, soft_bf16_mul,
+                         f32_is_zon2, f32_addsubmul_post);
+}
+
 /*
  * Returns the result of multiplying the floating-point values `a' and
  * `b' then adding 'c', with no intermediate rounding step after the
@@ -1890,7 +1962,8 @@ float64_div(float64 a, float64 b, float_status *s)
  * value `a' by the corresponding value `b'.
  */
 
-bfloat16 bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
+static bfloat16 QEMU_SOFTFLOAT_ATTR
+soft_bf16_div(bfloat16 a, bfloat16 b, float_status *status)
 {
     FloatParts pa = bfloat16_unpack_canonical(a, status);
     FloatParts pb = bfloat16_unpack_canonical(b, status);
@@ -1899,6 +1972,13 @@ bfloat16 bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
     return bfloat16_round_pack_canonical(pr, status);
 }
 
+bfloat16 QEMU_FLATTEN
+bfloat16_div(bfloat16 a, bfloat16 b, float_status *status)
+{
+    return bfloat16_gen2(a, b, status, hard_f32_div, soft_bf16_div,
+                         f32_div_pre, f32_div_post);
+}
+
 /*
  * Float to Float conversions
  *
@@ -2007,13 +2087,41 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(pr, s, fmt16);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts p = float64_unpack_canonical(a, s);
     FloatParts pr = float_to_float(p, &float32_params, s);
     return float32_round_pack_canonical(pr, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    /* Narrowing can be inexact, overflow or underflow */
+    float64_input_flush1(&ua.s, s);
+    if (likely(float64_is_zero_or_normal(ua.s))) {
+        ur.h = ua.h;
+        if (unlikely(f32_is_inf(ur))) {
+            goto soft;
+        } else if (unlikely(fabsf(ur.h) <= FLT_MIN) &&
+                   !float64_is_zero(ua.s)) {
+            goto soft;
+        }
+        return ur.s;
+    }
+
+ soft:
+    return soft_float64_to_float32(ua.s, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts p = bfloat16_unpack_canonical(a, s);
@@ -2157,20 +2265,64 @@ float16 float16_round_to_int(float16 a, float_status *s)
     return float16_round_pack_canonical(pr, s);
 }
 
-float32 float32_round_to_int(float32 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_round_to_int(float32 a, float_status *s)
 {
     FloatParts pa = float32_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float32_round_pack_canonical(pr, s);
 }
 
-float64 float64_round_to_int(float64 a, float_status *s)
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_round_to_int(float64 a, float_status *s)
 {
     FloatParts pa = float64_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float64_round_pack_canonical(pr, s);
 }
 
+/*
+ * The host rounds to nearest even, like can_use_fpu() requires of the
+ * guest, and rounding to an integer raises at most inexact.
+ */
+float32 QEMU_FLATTEN float32_round_to_int(float32 a, float_status *s)
+{
+    union_float32 ua, ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float32_input_flush1(&ua.s, s);
+    if (likely(float32_is_zero_or_normal(ua.s))) {
+        ur.h = rintf(ua.h);
+        return ur.s;
+    }
+
+ soft:
+    return soft_f32_round_to_int(ua.s, s);
+}
+
+float64 QEMU_FLATTEN float64_round_to_int(float64 a, float_status *s)
+{
+    union_float64 ua, ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float64_input_flush1(&ua.s, s);
+    if (likely(float64_is_zero_or_normal(ua.s))) {
+        ur.h = rint(ua.h);
+        return ur.s;
+    }
+
+ soft:
+    return soft_f64_round_to_int(ua.s, s);
+}
+
 /*
  * Rounds the bfloat16 value `a' to an integer, and returns the
  * result as a bfloat16 value.
@@ -2335,13 +2487,54 @@ int16_t float32_to_int16(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
+/*
+ * Hardfloat conversions to integer.  Within range, the host conversion
+ * raises at most inexact, which can_use_fpu() checks is already set;
+ * NaNs and values out of range are left to softfloat.  The bounds are
+ * chosen so that they are exact in the source format, and so that the
+ * rounded result cannot exceed the destination type.
+ */
+static inline bool f32_to_int_in_range(float32 *a, float min, float max,
+                                       float_status *s)
+{
+    union_float32 ua;
+
+    if (unlikely(!can_use_fpu(s))) {
+        return false;
+    }
+    float32_input_flush1(a, s);
+    ua.s = *a;
+    return likely(isgreaterequal(ua.h, min) && isless(ua.h, max));
+}
+
+static inline bool f64_to_int_in_range(float64 *a, double min, double max,
+                                       float_status *s)
+{
+    union_float64 ua;
+
+    if (unlikely(!can_use_fpu(s))) {
+        return false;
+    }
+    float64_input_flush1(a, s);
+    ua.s = *a;
+    return likely(isgreaterequal(ua.h, min) && isless(ua.h, max));
+}
+
 int32_t float32_to_int32(float32 a, float_status *s)
 {
+    if (f32_to_int_in_range(&a, -0x1p31f, 0x1p31f, s)) {
+        union_float32 ua = { .s = a };
+        return rintf(ua.h);
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
+    if (f32_to_int_in_range(&a, -0x1p63f, 0x1p63f, s)) {
+        union_float32 ua = { .s = a };
+        return rintf(ua.h);
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2352,11 +2545,19 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
+    if (f64_to_int_in_range(&a, -0x1p31, 0x1p31 - 1, s)) {
+        union_float64 ua = { .s = a };
+        return rint(ua.h);
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
+    if (f64_to_int_in_range(&a, -0x1p63, 0x1p63, s)) {
+        union_float64 ua = { .s = a };
+        return rint(ua.h);
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -2382,11 +2583,19 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    if (f32_to_int_in_range(&a, -0x1p31f, 0x1p31f, s)) {
+        union_float32 ua = { .s = a };
+        return ua.h;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    if (f32_to_int_in_range(&a, -0x1p63f, 0x1p63f, s)) {
+        union_float32 ua = { .s = a };
+        return ua.h;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2397,11 +2606,19 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    if (f64_to_int_in_range(&a, -0x1p31, 0x1p31, s)) {
+        union_float64 ua = { .s = a };
+        return ua.h;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    if (f64_to_int_in_range(&a, -0x1p63, 0x1p63, s)) {
+        union_float64 ua = { .s = a };
+        return ua.h;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -2827,13 +3044,28 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float32_scalbn(a, scale, status);
 }
 
+/*
+ * Hardfloat conversions from integer.  They can only raise inexact, so
+ * they need can_use_fpu() unless every value of the source type is
+ * exactly representable.
+ */
 float32 int64_to_float32(int64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float32_scalbn(a, 0, status);
 }
 
@@ -2860,12 +3092,20 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
 
 float64 int64_to_float64(int64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float64 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    /* Always exact */
+    union_float64 ur;
+    ur.h = a;
+    return ur.s;
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
@@ -2994,11 +3234,21 @@ float32 uint16_to_float32_scalbn(uint16_t a, int scale, float_status *status)
 
 float32 uint64_to_float32(uint64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float32_scalbn(a, 0, status);
 }
 
 float32 uint32_to_float32(uint32_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float32 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float32_scalbn(a, 0, status);
 }
 
@@ -3025,12 +3275,20 @@ float64 uint16_to_float64_scalbn(uint16_t a, int scale, float_status *status)
 
 float64 uint64_to_float64(uint64_t a, float_status *status)
 {
+    if (likely(can_use_fpu(status))) {
+        union_float64 ur;
+        ur.h = a;
+        return ur.s;
+    }
     return uint64_to_float64_scalbn(a, 0, status);
 }
 
 float64 uint32_to_float64(uint32_t a, float_status *status)
 {
-    return uint64_to_float64_scalbn(a, 0, status);
+    /* Always exact */
+    union_float64 ur;
+    ur.h = a;
+    return ur.s;
 }
 
 float64 uint16_to_float64(uint16_t a, float_status *status)
@@ -3179,6 +3437,105 @@ MINMAX(16, max, false, false, false)
 MINMAX(16, maxnum, false, true, false)
 MINMAX(16, maxnummag, false, true, true)
 
+#undef MINMAX
+
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_minmax(float32 a, float32 b, bool ismin, bool ieee, bool ismag,
+                float_status *s)
+{
+    FloatParts pa = float32_unpack_canonical(a, s);
+    FloatParts pb = float32_unpack_canonical(b, s);
+    FloatParts pr = minmax_floats(pa, pb, ismin, ieee, ismag, s);
+
+    return float32_round_pack_canonical(pr, s);
+}
+
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_minmax(float64 a, float64 b, bool ismin, bool ieee, bool ismag,
+                float_status *s)
+{
+    FloatParts pa = float64_unpack_canonical(a, s);
+    FloatParts pb = float64_unpack_canonical(b, s);
+    FloatParts pr = minmax_floats(pa, pb, ismin, ieee, ismag, s);
+
+    return float64_round_pack_canonical(pr, s);
+}
+
+/*
+ * When the inputs are ordered and different, the result is one of them
+ * and no flag is raised, so the inexact flag does not matter.  NaNs,
+ * equal values (including -0 and +0) and denormals, which may have to
+ * be flushed on output, are left to softfloat.
+ */
+static inline float32
+f32_minmax(float32 xa, float32 xb, bool ismin, bool ieee, bool ismag,
+           float_status *s)
+{
+    union_float32 ua, ub;
+    float fa, fb;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+
+    float32_input_flush2(&ua.s, &ub.s, s);
+    if (unlikely(float32_is_denormal(ua.s) || float32_is_denormal(ub.s))) {
+        goto soft;
+    }
+    fa = ismag ? fabsf(ua.h) : ua.h;
+    fb = ismag ? fabsf(ub.h) : ub.h;
+    if (isless(fa, fb)) {
+        return ismin ? ua.s : ub.s;
+    }
+    if (isgreater(fa, fb)) {
+        return ismin ? ub.s : ua.s;
+    }
+
+ soft:
+    return soft_f32_minmax(ua.s, ub.s, ismin, ieee, ismag, s);
+}
+
+static inline float64
+f64_minmax(float64 xa, float64 xb, bool ismin, bool ieee, bool ismag,
+           float_status *s)
+{
+    union_float64 ua, ub;
+    double fa, fb;
+
+    ua.s = xa;
+    ub.s = xb;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+
+    float64_input_flush2(&ua.s, &ub.s, s);
+    if (unlikely(float64_is_denormal(ua.s) || float64_is_denormal(ub.s))) {
+        goto soft;
+    }
+    fa = ismag ? fabs(ua.h) : ua.h;
+    fb = ismag ? fabs(ub.h) : ub.h;
+    if (isless(fa, fb)) {
+        return ismin ? ua.s : ub.s;
+    }
+    if (isgreater(fa, fb)) {
+        return ismin ? ub.s : ua.s;
+    }
+
+ soft:
+    return soft_f64_minmax(ua.s, ub.s, ismin, ieee, ismag, s);
+}
+
+#define MINMAX(sz, name, ismin, isiee, ismag)                           \
+float ## sz QEMU_FLATTEN                                                \
+float ## sz ## _ ## name(float ## sz a, float ## sz b, float_status *s) \
+{                                                                       \
+    return f ## sz ## _minmax(a, b, ismin, isiee, ismag, s);            \
+}
+
 MINMAX(32, min, true, false, false)
 MINMAX(32, minnum, true, true, false)
 MINMAX(32, minnummag, true, true, true)
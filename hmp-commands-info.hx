@@ -322,6 +322,11 @@ SRST
     When different objects that share the same call site are coalesced,
     the "Object" field shows---enclosed in brackets---the number of objects
     being coalesced.
+
+    Besides mutexes and condition variables, coroutine mutexes and rwlocks
+    (``co_mutex``, ``co_rwlock``) and ``QemuLockCnt`` are profiled.  For
+    coroutine locks, the wait time includes the time the coroutine was
+    suspended waiting for the lock.
 ERST
 
     {
@@ -955,23 +955,6 @@ static int stat_to_qid(V9fsPDU *pdu, const struct stat *stbuf, V9fsQID *qidp)
     return 0;
 }
 
-static int coroutine_fn fid_to_qid(V9fsPDU *pdu, V9fsFidState *fidp,
-                                   V9fsQID *qidp)
-{
-    struct stat stbuf;
-    int err;
-
-    err = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
-    if (err < 0) {
-        return err;
-    }
-    err = stat_to_qid(pdu, &stbuf, qidp);
-    if (err < 0) {
-        return err;
-    }
-    return 0;
-}
-
 V9fsPDU *pdu_alloc(V9fsState *s)
 {
     V9fsPDU *pdu = NULL;
@@ -1384,6 +1367,7 @@ static void coroutine_fn v9fs_attach(void *opaque)
     size_t offset = 7;
     V9fsQID qid;
     ssize_t err;
+    struct stat stbuf;
 
     v9fs_string_init(&uname);
     v9fs_string_init(&aname);
@@ -1406,7 +1390,13 @@ static void coroutine_fn v9fs_attach(void *opaque)
         clunk_fid(s, fid);
         goto out;
     }
-    err = fid_to_qid(pdu, fidp, &qid);
+    err = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    if (err < 0) {
+        err = -EINVAL;
+        clunk_fid(s, fid);
+        goto out;
+    }
+    err = stat_to_qid(pdu, &stbuf, &qid);
     if (err < 0) {
         err = -EINVAL;
         clunk_fid(s, fid);
@@ -1439,6 +1429,7 @@ static void coroutine_fn v9fs_attach(void *opaque)
     err += offset;
 
     memcpy(&s->root_qid, &qid, sizeof(qid));
+    memcpy(&s->root_st, &stbuf, sizeof(stbuf));
     trace_v9fs_attach_return(pdu->tag, pdu->id,
                              qid.type, qid.version, qid.path);
 out:
@@ -1689,12 +1680,51 @@ static bool name_is_illegal(const char *name)
     return !*name || strchr(name, '/') != NULL;
 }
 
-static bool not_same_qid(const V9fsQID *qid1, const V9fsQID *qid2)
+static bool same_stat_id(const struct stat *a, const struct stat *b)
 {
-    return
-        qid1->type != qid2->type ||
-        qid1->version != qid2->version ||
-        qid1->path != qid2->path;
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+/*
+ * This is solely executed on a background IO thread.
+ *
+ * Resolves and stats the @nwnames components of a Twalk request below
+ * @dpath, so that a whole walk costs a single worker round trip instead of
+ * one per component.  @stbufs[i] receives the stat of the i-th component
+ * and @path is left pointing to the last one.
+ */
+static int do_walk(V9fsPDU *pdu, V9fsPath *dpath, V9fsPath *path,
+                   V9fsString *wnames, uint16_t nwnames,
+                   struct stat *stbufs)
+{
+    V9fsState *s = pdu->s;
+    struct stat stbuf;
+    int i, err;
+
+    err = s->ops->lstat(&s->ctx, dpath, &stbuf);
+    if (err < 0) {
+        return -errno;
+    }
+    for (i = 0; i < nwnames; i++) {
+        if (v9fs_request_cancelled(pdu)) {
+            return -EINTR;
+        }
+        /* ".." at the export root stays at the root */
+        if (!same_stat_id(&s->root_st, &stbuf) ||
+            strcmp("..", wnames[i].data)) {
+            err = s->ops->name_to_path(&s->ctx, dpath, wnames[i].data, path);
+            if (err < 0) {
+                return -errno;
+            }
+            err = s->ops->lstat(&s->ctx, path, &stbuf);
+            if (err < 0) {
+                return -errno;
+            }
+            v9fs_path_copy(dpath, path);
+        }
+        stbufs[i] = stbuf;
+    }
+    return 0;
 }
 
 static void coroutine_fn v9fs_walk(void *opaque)
@@ -1704,7 +1734,6 @@ static void coroutine_fn v9fs_walk(void *opaque)
     int i, err = 0;
     V9fsPath dpath, path;
     uint16_t nwnames;
-    struct stat stbuf;
     size_t offset = 7;
     int32_t fid, newfid;
     V9fsString *wnames = NULL;
@@ -1712,7 +1741,7 @@ static void coroutine_fn v9fs_walk(void *opaque)
     V9fsFidState *newfidp = NULL;
     V9fsPDU *pdu = opaque;
     V9fsState *s = pdu->s;
-    V9fsQID qid;
+    struct stat *stbufs = NULL;
 
     err = pdu_unmarshal(pdu, offset, "ddw", &fid, &newfid, &nwnames);
     if (err < 0) {
@@ -1726,6 +1755,7 @@ static void coroutine_fn v9fs_walk(void *opaque)
     if (nwnames && nwnames <= P9_MAXWELEM) {
         wnames = g_new0(V9fsString, nwnames);
         qids   = g_new0(V9fsQID, nwnames);
+        stbufs = g_new0(struct stat, nwnames);
         for (i = 0; i < nwnames; i++) {
             err = pdu_unmarshal(pdu, offset, "s", &wnames[i]);
             if (err < 0) {
@@ -1750,37 +1780,32 @@ static void coroutine_fn v9fs_walk(void *opaque)
     v9fs_path_init(&dpath);
     v9fs_path_init(&path);
 
-    err = fid_to_qid(pdu, fidp, &qid);
-    if (err < 0) {
-        goto out;
-    }
-
     /*
      * Both dpath and path initially poin to fidp.
      * Needed to handle request with nwnames == 0
      */
     v9fs_path_copy(&dpath, &fidp->path);
     v9fs_path_copy(&path, &fidp->path);
-    for (name_idx = 0; name_idx < nwnames; name_idx++) {
-        if (not_same_qid(&pdu->s->root_qid, &qid) ||
-            strcmp("..", wnames[name_idx].data)) {
-            err = v9fs_co_name_to_path(pdu, &dpath, wnames[name_idx].data,
-                                       &path);
-            if (err < 0) {
-                goto out;
-            }
 
-            err = v9fs_co_lstat(pdu, &path, &stbuf);
-            if (err < 0) {
-                goto out;
-            }
-            err = stat_to_qid(pdu, &stbuf, &qid);
-            if (err < 0) {
-                goto out;
-            }
-            v9fs_path_copy(&dpath, &path);
+    if (v9fs_request_cancelled(pdu)) {
+        err = -EINTR;
+        goto out;
+    }
+    v9fs_path_read_lock(s);
+    v9fs_co_run_in_worker({
+        err = do_walk(pdu, &dpath, &path, wnames, nwnames, stbufs);
+    });
+    v9fs_path_unlock(s);
+    if (err < 0) {
+        goto out;
+    }
+
+    /* the qid tables are only accessed from the main thread */
+    for (name_idx = 0; name_idx < nwnames; name_idx++) {
+        err = stat_to_qid(pdu, &stbufs[name_idx], &qids[name_idx]);
+        if (err < 0) {
+            goto out;
         }
-        memcpy(&qids[name_idx], &qid, sizeof(qid));
     }
     if (fid == newfid) {
         if (fidp->fid_type != P9_FID_NONE) {
@@ -1816,6 +1841,7 @@ out_nofid:
         }
         g_free(wnames);
         g_free(qids);
+        g_free(stbufs);
     }
 }
 
@@ -2138,6 +2164,18 @@ static int v9fs_xattr_read(V9fsState *s, V9fsPDU *pdu, V9fsFidState *fidp,
     return offset;
 }
 
+static void v9fs_free_dirents(struct V9fsDirEnt *e)
+{
+    struct V9fsDirEnt *next = NULL;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e->st);
+        g_free(e);
+    }
+}
+
 static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
                                                   V9fsFidState *fidp,
                                                   uint32_t max_count)
@@ -2146,9 +2184,8 @@ static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
     V9fsStat v9stat;
     int len, err = 0;
     int32_t count = 0;
-    struct stat stbuf;
     off_t saved_dir_pos;
-    struct dirent *dent;
+    struct V9fsDirEnt *entries = NULL, *e;
 
     /* save the directory position */
     saved_dir_pos = v9fs_co_telldir(pdu, fidp);
@@ -2156,57 +2193,55 @@ static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
         return saved_dir_pos;
     }
 
-    while (1) {
-        v9fs_path_init(&path);
-
-        v9fs_readdir_lock(&fidp->fs.dir);
+    /*
+     * Fetch and stat the entries with a single worker round trip.  The
+     * size budget of v9fs_co_readdir_many() is based on the (smaller)
+     * 9P2000.L entries, so it may return more entries than fit here: the
+     * directory is then set back to the first entry that was not sent.
+     */
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, saved_dir_pos, max_count,
+                               true);
+    if (err < 0) {
+        goto out;
+    }
+    err = 0;
 
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
-        err = v9fs_co_name_to_path(pdu, &fidp->path, dent->d_name, &path);
-        if (err < 0) {
-            break;
-        }
-        err = v9fs_co_lstat(pdu, &path, &stbuf);
+    for (e = entries; e; e = e->next) {
+        v9fs_path_init(&path);
+        err = v9fs_co_name_to_path(pdu, &fidp->path, e->dent->d_name, &path);
         if (err < 0) {
+            v9fs_path_free(&path);
             break;
         }
-        err = stat_to_v9stat(pdu, &path, dent->d_name, &stbuf, &v9stat);
+        err = stat_to_v9stat(pdu, &path, e->dent->d_name, e->st, &v9stat);
+        v9fs_path_free(&path);
         if (err < 0) {
             break;
         }
         if ((count + v9stat.size + 2) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+            /* Ran out of buffer */
             v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return count;
+            break;
         }
 
         /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
         len = pdu_marshal(pdu, 11 + count, "S", &v9stat);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
-
+        v9fs_stat_free(&v9stat);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_stat_free(&v9stat);
-        v9fs_path_free(&path);
-        saved_dir_pos = dent->d_off;
+        saved_dir_pos = e->dent->d_off;
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
+    if (e) {
+        /* Set dir back to the position after the last entry sent */
+        v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+    }
 
-    v9fs_path_free(&path);
+out:
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -2320,18 +2355,6 @@ size_t v9fs_readdir_response_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
-static void v9fs_free_dirents(struct V9fsDirEnt *e)
-{
-    struct V9fsDirEnt *next = NULL;
-
-    for (; e; e = next) {
-        next = e->next;
-        g_free(e->dent);
-        g_free(e->st);
-        g_free(e);
-    }
-}
-
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
                                         off_t offset, int32_t max_count)
 {
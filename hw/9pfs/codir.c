@@ -39,24 +39,6 @@ static int do_readdir(V9fsPDU *pdu, V9fsFidState *fidp, struct dirent **dent)
     return err;
 }
 
-/*
- * TODO: This will be removed for performance reasons.
- * Use v9fs_co_readdir_many() instead.
- */
-int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
-                                 struct dirent **dent)
-{
-    int err;
-
-    if (v9fs_request_cancelled(pdu)) {
-        return -EINTR;
-    }
-    v9fs_co_run_in_worker({
-        err = do_readdir(pdu, fidp, dent);
-    });
-    return err;
-}
-
 /*
  * This is solely executed on a background IO thread.
  *
@@ -58,7 +58,6 @@
 
 void co_run_in_worker_bh(void *);
 int coroutine_fn v9fs_co_readlink(V9fsPDU *, V9fsPath *, V9fsString *);
-int coroutine_fn v9fs_co_readdir(V9fsPDU *, V9fsFidState *, struct dirent **);
 int coroutine_fn v9fs_co_readdir_many(V9fsPDU *, V9fsFidState *,
                                       struct V9fsDirEnt **, off_t, int32_t,
                                       bool);
@@ -21,6 +21,7 @@
 #include "qemu/error-report.h"
 #include "hw/virtio/virtio-access.h"
 #include "hw/virtio/virtio-blk.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "virtio-blk.h"
 #include "block/aio.h"
 #include "hw/virtio/virtio-bus.h"
@@ -43,6 +44,13 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /* IOThreads from the iothread-vq-mapping property */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+
+    /* AioContext handling each virtqueue's host notifier */
+    AioContext **vq_aio_context;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -88,10 +96,11 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread || conf->num_iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,13 +128,38 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
-
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
+
+    if (conf->num_iothread_vq_mapping) {
+        if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping,
+                                       conf->num_iothread_vq_mapping,
+                                       conf->num_queues, &s->vq_iothreads,
+                                       &s->num_vq_iothreads, errp)) {
+            g_free(s->vq_aio_context);
+            g_free(s);
+            return false;
+        }
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] =
+                iothread_vq_mapping_get_aio_context(s->vq_iothreads,
+                                                    s->num_vq_iothreads, i);
+        }
+        /*
+         * The BlockBackend lives in the first mapped IOThread.  Requests
+         * from other virtqueues are submitted under its AioContext lock.
+         */
+        s->ctx = s->vq_aio_context[0];
     } else {
-        s->ctx = qemu_get_aio_context();
+        if (conf->iothread) {
+            s->iothread = conf->iothread;
+            object_ref(OBJECT(s->iothread));
+            s->ctx = iothread_get_aio_context(s->iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
@@ -151,6 +185,8 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    iothread_vq_mapping_cleanup(&s->vq_iothreads, &s->num_vq_iothreads);
+    g_free(s->vq_aio_context);
     g_free(s);
 }
 
@@ -231,14 +267,15 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -255,18 +292,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
 
 /* Stop notifications for new requests from guest.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread that handles @opaque's virtqueue
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
+    VirtQueue *vq = opaque;
 
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
-    }
+    virtio_queue_aio_set_host_notifier_handler(vq,
+            qemu_get_current_aio_context(), NULL);
 }
 
 /* Context: QEMU global mutex held */
@@ -292,8 +325,16 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_vq_bh, vq);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
@@ -0,0 +1,567 @@
+/*
+ * QEMU NVM Express Zoned Namespace Command Set
+ *
+ * Zone state machine and the file the zone states are persisted in.  The
+ * commands themselves are implemented in nvme.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "sysemu/block-backend.h"
+#include "trace.h"
+#include "nvme.h"
+
+/*
+ * The zone state file starts with a header describing the zone geometry,
+ * followed by one entry per zone.  All fields are little endian.
+ */
+#define NVME_ZNS_STATE_MAGIC    "QEMUZNS1"
+#define NVME_ZNS_STATE_VERSION  1
+
+typedef struct QEMU_PACKED NvmeZnsStateHeader {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    num_zones;
+    uint64_t    zone_size;
+    uint64_t    zone_capacity;
+    uint8_t     rsvd32[32];
+} NvmeZnsStateHeader;
+
+typedef struct QEMU_PACKED NvmeZnsStateEntry {
+    uint8_t     zs;
+    uint8_t     rsvd1[7];
+    uint64_t    wp;
+} NvmeZnsStateEntry;
+
+static inline bool nvme_zns_state_is_open(uint8_t state)
+{
+    return state == NVME_ZONE_STATE_IMPLICITLY_OPEN ||
+           state == NVME_ZONE_STATE_EXPLICITLY_OPEN;
+}
+
+static inline bool nvme_zns_state_is_active(uint8_t state)
+{
+    return nvme_zns_state_is_open(state) || state == NVME_ZONE_STATE_CLOSED;
+}
+
+/* Move @zone to @state, keeping the open and active zone accounting */
+static void nvme_zns_set_state(NvmeNamespace *ns, NvmeZone *zone,
+                               uint8_t state)
+{
+    trace_pci_nvme_zns_set_state(zone->zslba, zone->state, state);
+
+    if (zone->state == NVME_ZONE_STATE_IMPLICITLY_OPEN) {
+        QTAILQ_REMOVE(&ns->imp_open_zones, zone, entry);
+    }
+    if (nvme_zns_state_is_open(zone->state)) {
+        ns->nr_open_zones--;
+    }
+    if (nvme_zns_state_is_active(zone->state)) {
+        ns->nr_active_zones--;
+    }
+
+    zone->state = state;
+
+    if (state == NVME_ZONE_STATE_IMPLICITLY_OPEN) {
+        QTAILQ_INSERT_TAIL(&ns->imp_open_zones, zone, entry);
+    }
+    if (nvme_zns_state_is_open(state)) {
+        ns->nr_open_zones++;
+    }
+    if (nvme_zns_state_is_active(state)) {
+        ns->nr_active_zones++;
+    }
+
+    zone->dirty = true;
+}
+
+/*
+ * Check that a zone can be made active, and open if @open.  To make room
+ * for a new open zone, the oldest implicitly opened zone is closed.
+ */
+static uint16_t nvme_zns_check_resources(NvmeNamespace *ns, bool activate,
+                                         bool open)
+{
+    if (activate && ns->max_active &&
+        ns->nr_active_zones >= ns->max_active) {
+        return NVME_ZONE_TOO_MANY_ACTIVE | NVME_DNR;
+    }
+
+    if (open && ns->max_open && ns->nr_open_zones >= ns->max_open) {
+        NvmeZone *victim = QTAILQ_FIRST(&ns->imp_open_zones);
+
+        if (!victim) {
+            return NVME_ZONE_TOO_MANY_OPEN | NVME_DNR;
+        }
+        nvme_zns_set_state(ns, victim, NVME_ZONE_STATE_CLOSED);
+    }
+
+    return NVME_SUCCESS;
+}
+
+uint16_t nvme_zns_check_write(NvmeNamespace *ns, NvmeZone *zone,
+                              uint64_t slba, uint32_t nlb)
+{
+    switch (zone->state) {
+    case NVME_ZONE_STATE_EMPTY:
+    case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+    case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+    case NVME_ZONE_STATE_CLOSED:
+        break;
+    case NVME_ZONE_STATE_FULL:
+        return NVME_ZONE_FULL | NVME_DNR;
+    case NVME_ZONE_STATE_READ_ONLY:
+        return NVME_ZONE_READ_ONLY | NVME_DNR;
+    case NVME_ZONE_STATE_OFFLINE:
+        return NVME_ZONE_OFFLINE | NVME_DNR;
+    default:
+        return NVME_INTERNAL_DEV_ERROR;
+    }
+
+    if (slba != zone->wp) {
+        return NVME_ZONE_INVALID_WRITE | NVME_DNR;
+    }
+
+    if (slba + nlb > zone->zslba + ns->zone_capacity) {
+        return NVME_ZONE_BOUNDARY_ERROR | NVME_DNR;
+    }
+
+    return NVME_SUCCESS;
+}
+
+uint16_t nvme_zns_auto_open(NvmeNamespace *ns, NvmeZone *zone)
+{
+    uint16_t status;
+
+    switch (zone->state) {
+    case NVME_ZONE_STATE_EMPTY:
+        status = nvme_zns_check_resources(ns, true, true);
+        break;
+    case NVME_ZONE_STATE_CLOSED:
+        status = nvme_zns_check_resources(ns, false, true);
+        break;
+    default:
+        return NVME_SUCCESS;
+    }
+
+    if (status) {
+        return status;
+    }
+
+    nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_IMPLICITLY_OPEN);
+    return NVME_SUCCESS;
+}
+
+void nvme_zns_advance_wp(NvmeNamespace *ns, NvmeZone *zone, uint32_t nlb)
+{
+    zone->wp += nlb;
+    zone->dirty = true;
+
+    if (zone->wp == zone->zslba + ns->zone_capacity) {
+        nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_FULL);
+    }
+}
+
+static uint16_t nvme_zns_open(NvmeNamespace *ns, NvmeZone *zone)
+{
+    uint16_t status;
+
+    switch (zone->state) {
+    case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+        return NVME_SUCCESS;
+    case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+        break;
+    case NVME_ZONE_STATE_EMPTY:
+        status = nvme_zns_check_resources(ns, true, true);
+        if (status) {
+            return status;
+        }
+        break;
+    case NVME_ZONE_STATE_CLOSED:
+        status = nvme_zns_check_resources(ns, false, true);
+        if (status) {
+            return status;
+        }
+        break;
+    default:
+        return NVME_ZONE_INVAL_TRANSITION;
+    }
+
+    nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_EXPLICITLY_OPEN);
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_zns_close(NvmeNamespace *ns, NvmeZone *zone)
+{
+    switch (zone->state) {
+    case NVME_ZONE_STATE_CLOSED:
+        return NVME_SUCCESS;
+    case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+    case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+        break;
+    default:
+        return NVME_ZONE_INVAL_TRANSITION;
+    }
+
+    /* a zone that was opened but never written goes back to empty */
+    nvme_zns_set_state(ns, zone, zone->wp == zone->zslba ?
+                       NVME_ZONE_STATE_EMPTY : NVME_ZONE_STATE_CLOSED);
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_zns_finish(NvmeNamespace *ns, NvmeZone *zone)
+{
+    uint16_t status;
+
+    switch (zone->state) {
+    case NVME_ZONE_STATE_FULL:
+        return NVME_SUCCESS;
+    case NVME_ZONE_STATE_EMPTY:
+        status = nvme_zns_check_resources(ns, true, false);
+        if (status) {
+            return status;
+        }
+        break;
+    case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+    case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+    case NVME_ZONE_STATE_CLOSED:
+        break;
+    default:
+        return NVME_ZONE_INVAL_TRANSITION;
+    }
+
+    zone->wp = zone->zslba + ns->zone_capacity;
+    nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_FULL);
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_zns_reset(NvmeNamespace *ns, NvmeZone *zone)
+{
+    switch (zone->state) {
+    case NVME_ZONE_STATE_EMPTY:
+        return NVME_SUCCESS;
+    case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+    case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+    case NVME_ZONE_STATE_CLOSED:
+    case NVME_ZONE_STATE_FULL:
+        break;
+    default:
+        return NVME_ZONE_INVAL_TRANSITION;
+    }
+
+    zone->wp = zone->zslba;
+    nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_EMPTY);
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_zns_offline(NvmeNamespace *ns, NvmeZone *zone)
+{
+    switch (zone->state) {
+    case NVME_ZONE_STATE_OFFLINE:
+        return NVME_SUCCESS;
+    case NVME_ZONE_STATE_READ_ONLY:
+        break;
+    default:
+        return NVME_ZONE_INVAL_TRANSITION;
+    }
+
+    nvme_zns_set_state(ns, zone, NVME_ZONE_STATE_OFFLINE);
+    return NVME_SUCCESS;
+}
+
+uint16_t nvme_zns_zone_action(NvmeNamespace *ns, NvmeZone *zone,
+                              uint8_t action)
+{
+    switch (action) {
+    case NVME_ZONE_ACTION_OPEN:
+        return nvme_zns_open(ns, zone);
+    case NVME_ZONE_ACTION_CLOSE:
+        return nvme_zns_close(ns, zone);
+    case NVME_ZONE_ACTION_FINISH:
+        return nvme_zns_finish(ns, zone);
+    case NVME_ZONE_ACTION_RESET:
+        return nvme_zns_reset(ns, zone);
+    case NVME_ZONE_ACTION_OFFLINE:
+        return nvme_zns_offline(ns, zone);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
+/* The zone states that Select All applies an action to */
+bool nvme_zns_select_all_applies(NvmeZone *zone, uint8_t action)
+{
+    switch (action) {
+    case NVME_ZONE_ACTION_OPEN:
+        return zone->state == NVME_ZONE_STATE_CLOSED;
+    case NVME_ZONE_ACTION_CLOSE:
+        return nvme_zns_state_is_open(zone->state);
+    case NVME_ZONE_ACTION_FINISH:
+        return nvme_zns_state_is_active(zone->state);
+    case NVME_ZONE_ACTION_RESET:
+        return nvme_zns_state_is_active(zone->state) ||
+               zone->state == NVME_ZONE_STATE_FULL;
+    case NVME_ZONE_ACTION_OFFLINE:
+        return zone->state == NVME_ZONE_STATE_READ_ONLY;
+    default:
+        return false;
+    }
+}
+
+static int nvme_zns_write_entries(NvmeNamespace *ns)
+{
+    NvmeZnsStateEntry entry;
+    uint32_t i;
+
+    for (i = 0; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+        off_t off = sizeof(NvmeZnsStateHeader) + i * sizeof(entry);
+
+        if (!zone->dirty) {
+            continue;
+        }
+
+        memset(&entry, 0x0, sizeof(entry));
+        entry.zs = zone->state;
+        entry.wp = cpu_to_le64(zone->wp);
+
+        if (lseek(ns->zone_state_fd, off, SEEK_SET) != off ||
+            qemu_write_full(ns->zone_state_fd, &entry,
+                            sizeof(entry)) != sizeof(entry)) {
+            return -errno;
+        }
+        zone->dirty = false;
+    }
+
+    return 0;
+}
+
+/* Write back the zones that changed since the last call */
+int nvme_zns_sync(NvmeNamespace *ns)
+{
+    int ret;
+
+    if (!ns->zoned || ns->zone_state_fd < 0) {
+        return 0;
+    }
+
+    ret = nvme_zns_write_entries(ns);
+    if (ret < 0 || qemu_fdatasync(ns->zone_state_fd) < 0) {
+        ret = ret < 0 ? ret : -errno;
+        error_report("nvme: failed to write zone state: %s", strerror(-ret));
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Open zones do not survive a controller reset or power loss: close them
+ * all and make sure the zone state file is up to date.
+ */
+void nvme_zns_shutdown(NvmeNamespace *ns)
+{
+    uint32_t i;
+
+    if (!ns->zoned) {
+        return;
+    }
+
+    for (i = 0; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+
+        if (nvme_zns_state_is_open(zone->state)) {
+            nvme_zns_close(ns, zone);
+        }
+    }
+
+    nvme_zns_sync(ns);
+}
+
+static void nvme_zns_load_state(NvmeNamespace *ns, Error **errp)
+{
+    NvmeZnsStateHeader hdr;
+    NvmeZnsStateEntry entry;
+    uint32_t i;
+    ssize_t ret;
+
+    ret = read(ns->zone_state_fd, &hdr, sizeof(hdr));
+    if (ret == 0) {
+        /* new file: every zone is empty */
+        memset(&hdr, 0x0, sizeof(hdr));
+        memcpy(hdr.magic, NVME_ZNS_STATE_MAGIC, sizeof(hdr.magic));
+        hdr.version = cpu_to_le32(NVME_ZNS_STATE_VERSION);
+        hdr.num_zones = cpu_to_le32(ns->num_zones);
+        hdr.zone_size = cpu_to_le64(ns->zone_size);
+        hdr.zone_capacity = cpu_to_le64(ns->zone_capacity);
+
+        if (qemu_write_full(ns->zone_state_fd, &hdr,
+                            sizeof(hdr)) != sizeof(hdr)) {
+            error_setg_errno(errp, errno, "could not write zone state file");
+            return;
+        }
+        for (i = 0; i < ns->num_zones; i++) {
+            ns->zone_array[i].dirty = true;
+        }
+        if (nvme_zns_sync(ns) < 0) {
+            error_setg(errp, "could not write zone state file");
+        }
+        return;
+    }
+
+    if (ret != sizeof(hdr) ||
+        memcmp(hdr.magic, NVME_ZNS_STATE_MAGIC, sizeof(hdr.magic)) ||
+        le32_to_cpu(hdr.version) != NVME_ZNS_STATE_VERSION) {
+        error_setg(errp, "invalid zone state file");
+        return;
+    }
+
+    if (le32_to_cpu(hdr.num_zones) != ns->num_zones ||
+        le64_to_cpu(hdr.zone_size) != ns->zone_size ||
+        le64_to_cpu(hdr.zone_capacity) != ns->zone_capacity) {
+        error_setg(errp, "zone state file does not match the zone geometry "
+                   "(%" PRIu32 " zones of %" PRIu64 " LBAs, capacity %"
+                   PRIu64 ")", le32_to_cpu(hdr.num_zones),
+                   le64_to_cpu(hdr.zone_size),
+                   le64_to_cpu(hdr.zone_capacity));
+        return;
+    }
+
+    for (i = 0; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+        uint64_t wp;
+
+        if (read(ns->zone_state_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+            error_setg(errp, "truncated zone state file");
+            return;
+        }
+
+        wp = le64_to_cpu(entry.wp);
+        if (wp < zone->zslba || wp > zone->zslba + ns->zone_capacity) {
+            error_setg(errp, "invalid write pointer for zone %" PRIu32, i);
+            return;
+        }
+
+        switch (entry.zs) {
+        case NVME_ZONE_STATE_EMPTY:
+        case NVME_ZONE_STATE_FULL:
+        case NVME_ZONE_STATE_READ_ONLY:
+        case NVME_ZONE_STATE_OFFLINE:
+            zone->wp = wp;
+            zone->state = entry.zs;
+            break;
+        case NVME_ZONE_STATE_IMPLICITLY_OPEN:
+        case NVME_ZONE_STATE_EXPLICITLY_OPEN:
+        case NVME_ZONE_STATE_CLOSED:
+            /* zones open at power loss come back closed */
+            zone->wp = wp;
+            nvme_zns_set_state(ns, zone, wp == zone->zslba ?
+                               NVME_ZONE_STATE_EMPTY :
+                               NVME_ZONE_STATE_CLOSED);
+            break;
+        default:
+            error_setg(errp, "invalid state for zone %" PRIu32, i);
+            return;
+        }
+    }
+}
+
+void nvme_zns_init(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
+{
+    Error *local_err = NULL;
+    NvmeParams *params = &n->params;
+    NvmeIdNsZoned *id_ns_z = &ns->id_ns_zoned;
+    uint8_t lbads = nvme_ns_lbads(ns);
+    uint64_t lba_size = 1 << lbads;
+    uint64_t capacity = params->zone_capacity ?: params->zone_size;
+    uint32_t i;
+
+    if (!params->zone_size || params->zone_size % lba_size ||
+        capacity % lba_size) {
+        error_setg(errp, "zone_size and zone_capacity must be multiples of "
+                   "the logical block size (%" PRIu64 ")", lba_size);
+        return;
+    }
+    if (capacity > params->zone_size) {
+        error_setg(errp, "zone_capacity must not exceed zone_size");
+        return;
+    }
+    if (params->max_open_zones > params->max_active_zones &&
+        params->max_active_zones) {
+        error_setg(errp, "max_open_zones must not exceed max_active_zones");
+        return;
+    }
+
+    ns->zone_size = params->zone_size >> lbads;
+    ns->zone_capacity = capacity >> lbads;
+    ns->num_zones = n->ns_size / params->zone_size;
+    if (!ns->num_zones) {
+        error_setg(errp, "the drive is smaller than a zone");
+        return;
+    }
+    ns->max_open = params->max_open_zones;
+    ns->max_active = params->max_active_zones;
+
+    ns->zone_array = g_new0(NvmeZone, ns->num_zones);
+    QTAILQ_INIT(&ns->imp_open_zones);
+    for (i = 0; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+
+        zone->zslba = i * ns->zone_size;
+        zone->wp = zone->zslba;
+        zone->state = NVME_ZONE_STATE_EMPTY;
+    }
+
+    /* mar and mor are 0's based, with 0xffffffff meaning no limit */
+    id_ns_z->mar = cpu_to_le32(ns->max_active - 1);
+    id_ns_z->mor = cpu_to_le32(ns->max_open - 1);
+    id_ns_z->ozcs = cpu_to_le16(NVME_ID_NS_ZONED_OZCS_RAZB);
+    id_ns_z->lbafe[0].zsze = cpu_to_le64(ns->zone_size);
+
+    ns->zone_state_fd = -1;
+    if (params->zone_state_file) {
+        ns->zone_state_fd = qemu_open_old(params->zone_state_file,
+                                          O_RDWR | O_CREAT | O_BINARY, 0644);
+        if (ns->zone_state_fd < 0) {
+            error_setg_file_open(errp, errno, params->zone_state_file);
+            g_free(ns->zone_array);
+            ns->zone_array = NULL;
+            return;
+        }
+
+        nvme_zns_load_state(ns, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            qemu_close(ns->zone_state_fd);
+            ns->zone_state_fd = -1;
+            g_free(ns->zone_array);
+            ns->zone_array = NULL;
+            return;
+        }
+    }
+
+    ns->zoned = true;
+}
+
+void nvme_zns_cleanup(NvmeNamespace *ns)
+{
+    if (!ns->zoned) {
+        return;
+    }
+
+    nvme_zns_shutdown(ns);
+
+    if (ns->zone_state_fd >= 0) {
+        qemu_close(ns->zone_state_fd);
+        ns->zone_state_fd = -1;
+    }
+    g_free(ns->zone_array);
+    ns->zone_array = NULL;
+    ns->zoned = false;
+}
@@ -22,7 +22,11 @@
  *              [pmrdev=<mem_backend_file_id>,] \
  *              max_ioqpairs=<N[optional]>, \
  *              aerl=<N[optional]>, aer_max_queued=<N[optional]>, \
- *              mdts=<N[optional]>
+ *              mdts=<N[optional]>, iothread=<iothread_id[optional]>, \
+ *              zoned=<bool[optional]>, zone_size=<N[optional]>, \
+ *              zone_capacity=<N[optional]>, max_open_zones=<N[optional]>, \
+ *              max_active_zones=<N[optional]>, zasl=<N[optional]>, \
+ *              zone_state_file=<file[optional]>
  *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
@@ -48,6 +52,31 @@
  *   completion when there are no oustanding AERs. When the maximum number of
  *   enqueued events are reached, subsequent events will be dropped.
  *
+ * - `iothread`
+ *   Process the I/O queues in the given IOThread rather than in the main
+ *   loop.  Once the host has set up shadow doorbells, submission queue
+ *   doorbells are served there through ioeventfds.
+ *
+ * - `zoned`
+ *   Expose the namespace with the Zoned Namespace Command Set. It is only
+ *   active when the host selects all supported I/O Command Sets in CC.CSS.
+ *
+ * - `zone_size`, `zone_capacity`
+ *   The size and writable capacity of each zone, in bytes. The capacity
+ *   defaults to the zone size. Space at the end of the drive that does not
+ *   fill a whole zone is not used.
+ *
+ * - `max_open_zones`, `max_active_zones`
+ *   Limits on the number of open and active zones. 0 means no limit.
+ *
+ * - `zasl`
+ *   The Zone Append Size Limit, as a power of two multiple of the minimum
+ *   memory page size. 0 means the same limit as `mdts`.
+ *
+ * - `zone_state_file`
+ *   File the zone states and write pointers are kept in across restarts.
+ *   It is created if it does not exist. Without it, all zones start empty.
+ *
  */
 
 #include "qemu/osdep.h"
@@ -63,10 +92,12 @@
 #include "qapi/visitor.h"
 #include "sysemu/hostmem.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 #include "exec/memory.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 #include "trace.h"
 #include "nvme.h"
 
@@ -105,11 +136,14 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_TEMPERATURE_THRESHOLD]    = NVME_FEAT_CAP_CHANGE,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
 };
 
 static void nvme_process_sq(void *opaque);
+static void nvme_sq_notifier(EventNotifier *e);
 
 static uint16_t nvme_cid(NvmeRequest *req)
 {
@@ -196,7 +230,7 @@ static void nvme_irq_check(NvmeCtrl *n)
     }
 }
 
-static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
+static void nvme_irq_do_assert(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
         if (msix_enabled(&(n->parent_obj))) {
@@ -213,6 +247,80 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static void nvme_assert_notifier_read(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, assert_notifier);
+    NvmeCtrl *n = cq->ctrl;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    /* The host may have consumed the entries in the meantime */
+    aio_context_acquire(n->ctx);
+    if (cq->tail != cq->head) {
+        nvme_irq_do_assert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
+static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->cqid && n->iothread) {
+        /* Interrupt delivery needs the BQL, which IOThreads do not hold */
+        event_notifier_set(&cq->assert_notifier);
+        return;
+    }
+
+    nvme_irq_do_assert(n, cq);
+}
+
+/*
+ * Interrupt Coalescing: the interrupt of an I/O completion queue is held
+ * back until more than THR entries are posted or TIME * 100us have passed,
+ * unless coalescing is disabled for its vector.  A TIME of 0 means no
+ * delay, i.e. no coalescing.
+ */
+static bool nvme_irq_coalescing(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    return cq->cqid && NVME_INTC_TIME(n->features.int_coalescing) &&
+        !(n->features.int_vector_config[cq->vector] & NVME_INTVC_NOCOALESCING);
+}
+
+static void nvme_irq_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    if (cq->irq_pending) {
+        cq->irq_pending = 0;
+        nvme_irq_assert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
+static void nvme_irq_post(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint32_t intc = n->features.int_coalescing;
+
+    if (!nvme_irq_coalescing(n, cq)) {
+        cq->irq_pending = 0;
+        nvme_irq_assert(n, cq);
+        return;
+    }
+
+    cq->irq_pending += posted;
+    if (cq->irq_pending > NVME_INTC_THR(intc)) {
+        timer_del(cq->irq_timer);
+        cq->irq_pending = 0;
+        nvme_irq_assert(n, cq);
+    } else if (cq->irq_pending && !timer_pending(cq->irq_timer)) {
+        timer_mod(cq->irq_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  NVME_INTC_TIME(intc) * 100 * SCALE_US);
+    }
+}
+
 static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
@@ -256,6 +364,18 @@ static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
+    if (iov->niov) {
+        struct iovec *last = &iov->iov[iov->niov - 1];
+
+        /* extend the previous chunk if this one follows it */
+        if ((uint8_t *)last->iov_base + last->iov_len ==
+            nvme_addr_to_cmb(n, addr)) {
+            last->iov_len += len;
+            iov->size += len;
+            return NVME_SUCCESS;
+        }
+    }
+
     qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
 
     return NVME_SUCCESS;
@@ -294,6 +414,20 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, QEMUSGList *qsg, QEMUIOVector *iov,
         pci_dma_sglist_init(qsg, &n->parent_obj, 1);
     }
 
+    /*
+     * Guests usually hand out physically contiguous pages, so merging
+     * keeps the list, and the number of dma_memory_map() calls, short.
+     */
+    if (qsg->nsg) {
+        ScatterGatherEntry *last = &qsg->sg[qsg->nsg - 1];
+
+        if (last->base + last->len == addr) {
+            last->len += len;
+            qsg->size += len;
+            return NVME_SUCCESS;
+        }
+    }
+
     qemu_sglist_add(qsg, addr, len);
 
     return NVME_SUCCESS;
@@ -398,17 +532,12 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, uint64_t prp1, uint64_t prp2,
     return NVME_SUCCESS;
 }
 
-static uint16_t nvme_dma_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
-                             uint64_t prp1, uint64_t prp2, DMADirection dir,
-                             NvmeRequest *req)
+/* Copy between @ptr and the guest memory already mapped for @req */
+static uint16_t nvme_tx(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
+                        DMADirection dir, NvmeRequest *req)
 {
     uint16_t status = NVME_SUCCESS;
 
-    status = nvme_map_prp(n, prp1, prp2, len, req);
-    if (status) {
-        return status;
-    }
-
     /* assert that only one of qsg and iov carries data */
     assert((req->qsg.nsg > 0) != (req->iov.niov > 0));
 
@@ -443,13 +572,254 @@ static uint16_t nvme_dma_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     return status;
 }
 
+static uint16_t nvme_dma_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
+                             uint64_t prp1, uint64_t prp2, DMADirection dir,
+                             NvmeRequest *req)
+{
+    uint16_t status;
+
+    status = nvme_map_prp(n, prp1, prp2, len, req);
+    if (status) {
+        return status;
+    }
+
+    return nvme_tx(n, ptr, len, dir, req);
+}
+
+/*
+ * Map the Data Block descriptors of a segment; Segment and Last Segment
+ * descriptors are only allowed as the last descriptor of a segment and are
+ * handled by the caller.
+ */
+static uint16_t nvme_map_sgl_data(NvmeCtrl *n, NvmeSglDescriptor *segment,
+                                  uint32_t nsgld, size_t *len,
+                                  NvmeRequest *req)
+{
+    uint64_t addr;
+    uint32_t dlen;
+    size_t trans_len;
+    uint16_t status;
+    uint32_t i;
+
+    for (i = 0; i < nsgld; i++) {
+        uint8_t type = NVME_SGL_TYPE(segment[i].type);
+
+        switch (type) {
+        case NVME_SGL_DESCR_TYPE_DATA_BLOCK:
+            break;
+        case NVME_SGL_DESCR_TYPE_SEGMENT:
+        case NVME_SGL_DESCR_TYPE_LAST_SEGMENT:
+            return NVME_INVALID_NUM_SGL_DESCRS | NVME_DNR;
+        default:
+            trace_pci_nvme_err_invalid_sgl_descr_type(type);
+            return NVME_SGL_DESCR_TYPE_INVALID | NVME_DNR;
+        }
+
+        dlen = le32_to_cpu(segment[i].len);
+        if (!dlen) {
+            continue;
+        }
+
+        /* the SGL describes more data than the command transfers */
+        if (!*len) {
+            return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        }
+
+        addr = le64_to_cpu(segment[i].addr);
+        if (UINT64_MAX - addr < dlen) {
+            return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        }
+
+        trans_len = MIN(*len, dlen);
+        status = nvme_map_addr(n, &req->qsg, &req->iov, addr, trans_len);
+        if (status) {
+            return status;
+        }
+
+        *len -= trans_len;
+    }
+
+    return NVME_SUCCESS;
+}
+
+static uint16_t nvme_map_sgl(NvmeCtrl *n, NvmeSglDescriptor sgl, size_t len,
+                             NvmeRequest *req)
+{
+    /*
+     * Segments are read a page worth of descriptors at a time so that a
+     * huge SGL does not need a huge buffer.
+     */
+    NvmeSglDescriptor segment[256], *sgld, *last_sgld;
+    uint32_t nsgld, seg_len;
+    uint16_t status;
+    uint64_t addr;
+
+    trace_pci_nvme_map_sgl(nvme_cid(req), NVME_SGL_TYPE(sgl.type), len);
+
+    sgld = &sgl;
+    addr = le64_to_cpu(sgl.addr);
+
+    /* the whole transfer may be described by a single Data Block */
+    if (NVME_SGL_TYPE(sgl.type) == NVME_SGL_DESCR_TYPE_DATA_BLOCK) {
+        status = nvme_map_sgl_data(n, sgld, 1, &len, req);
+        if (status) {
+            return status;
+        }
+        goto out;
+    }
+
+    for (;;) {
+        switch (NVME_SGL_TYPE(sgld->type)) {
+        case NVME_SGL_DESCR_TYPE_SEGMENT:
+        case NVME_SGL_DESCR_TYPE_LAST_SEGMENT:
+            break;
+        default:
+            return NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+        }
+
+        seg_len = le32_to_cpu(sgld->len);
+        if (!seg_len || seg_len & (sizeof(NvmeSglDescriptor) - 1)) {
+            return NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+        }
+
+        if (UINT64_MAX - addr < seg_len) {
+            return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+        }
+
+        nsgld = seg_len / sizeof(NvmeSglDescriptor);
+
+        while (nsgld > ARRAY_SIZE(segment)) {
+            nvme_addr_read(n, addr, segment, sizeof(segment));
+
+            status = nvme_map_sgl_data(n, segment, ARRAY_SIZE(segment), &len,
+                                       req);
+            if (status) {
+                return status;
+            }
+
+            nsgld -= ARRAY_SIZE(segment);
+            addr += sizeof(segment);
+        }
+
+        nvme_addr_read(n, addr, segment, nsgld * sizeof(NvmeSglDescriptor));
+
+        last_sgld = &segment[nsgld - 1];
+
+        /* a segment that ends with a Data Block ends the SGL */
+        if (NVME_SGL_TYPE(last_sgld->type) == NVME_SGL_DESCR_TYPE_DATA_BLOCK) {
+            status = nvme_map_sgl_data(n, segment, nsgld, &len, req);
+            if (status) {
+                return status;
+            }
+            goto out;
+        }
+
+        /* nothing may follow a Last Segment */
+        if (NVME_SGL_TYPE(sgld->type) == NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+            return NVME_INVALID_SGL_SEG_DESCR | NVME_DNR;
+        }
+
+        /* the last descriptor points to the next segment */
+        status = nvme_map_sgl_data(n, segment, nsgld - 1, &len, req);
+        if (status) {
+            return status;
+        }
+
+        sgl = *last_sgld;
+        sgld = &sgl;
+        addr = le64_to_cpu(sgl.addr);
+    }
+
+out:
+    /* the SGL describes less data than the command transfers */
+    if (len) {
+        return NVME_DATA_SGL_LEN_INVALID | NVME_DNR;
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_map_dptr(NvmeCtrl *n, size_t len, NvmeRequest *req)
 {
     NvmeCmd *cmd = &req->cmd;
-    uint64_t prp1 = le64_to_cpu(cmd->dptr.prp1);
-    uint64_t prp2 = le64_to_cpu(cmd->dptr.prp2);
+    uint64_t prp1, prp2;
+
+    switch (NVME_CMD_FLAGS_PSDT(cmd->flags)) {
+    case PSDT_PRP:
+        prp1 = le64_to_cpu(cmd->dptr.prp1);
+        prp2 = le64_to_cpu(cmd->dptr.prp2);
+
+        return nvme_map_prp(n, prp1, prp2, len, req);
+    case PSDT_SGL_MPTR_CONTIGUOUS:
+    case PSDT_SGL_MPTR_SGL:
+        /* SGLs are not allowed for admin commands on PCIe controllers */
+        if (!req->sq->sqid) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
 
-    return nvme_map_prp(n, prp1, prp2, len, req);
+        return nvme_map_sgl(n, cmd->dptr.sgl, len, req);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
+/* Like nvme_dma_prp(), for commands that may use either PRPs or SGLs */
+static uint16_t nvme_dma(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
+                         DMADirection dir, NvmeRequest *req)
+{
+    uint16_t status;
+
+    status = nvme_map_dptr(n, len, req);
+    if (status) {
+        return status;
+    }
+
+    return nvme_tx(n, ptr, len, dir, req);
+}
+
+/*
+ * Shadow doorbells (Doorbell Buffer Config): once the host has set up the
+ * buffers, it writes new SQ tails and CQ heads of the I/O queues to guest
+ * memory and only rings the MMIO doorbell when the value passes the
+ * EventIdx we publish, so most doorbell writes never trap.
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+
+    /* A bogus value would make us fetch past the end of the queue */
+    if (likely(v < sq->size)) {
+        sq->tail = v;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &v, sizeof(v));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t v;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+
+    if (likely(v < cq->size)) {
+        cq->head = v;
+    }
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &v, sizeof(v));
 }
 
 static void nvme_post_cqes(void *opaque)
@@ -457,11 +827,19 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
+    uint32_t posted = 0;
+
+    aio_context_acquire(n->ctx);
 
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (cq->db_addr) {
+            nvme_update_cq_eventidx(cq);
+            nvme_update_cq_head(cq);
+        }
+
         if (nvme_cq_full(cq)) {
             break;
         }
@@ -477,10 +855,13 @@ static void nvme_post_cqes(void *opaque)
             sizeof(req->cqe));
         nvme_req_exit(req);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
     }
     if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+        nvme_irq_post(n, cq, posted);
     }
+
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -490,7 +871,7 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
                                           req->status);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    qemu_bh_schedule(cq->bh);
 }
 
 static void nvme_process_aers(void *opaque)
@@ -615,8 +996,67 @@ static void nvme_rw_cb(void *opaque, int ret)
     nvme_enqueue_req_completion(cq, req);
 }
 
+/*
+ * Zoned namespaces are only visible once the host has enabled the
+ * controller with the I/O Command Set selected through CC.CSS.
+ */
+static bool nvme_ns_is_active(NvmeCtrl *n, NvmeNamespace *ns)
+{
+    return !ns->zoned || NVME_CC_CSS(n->bar.cc) == NVME_CC_CSS_CSI;
+}
+
+/* Without a volatile write cache, zone state changes are written through */
+static void nvme_zns_commit(NvmeCtrl *n, NvmeNamespace *ns)
+{
+    if (!blk_enable_write_cache(n->conf.blk)) {
+        nvme_zns_sync(ns);
+    }
+}
+
+/*
+ * Check a write to a zoned namespace and move the write pointer past it.
+ * For Zone Append, @slba is the start of the zone on entry and the LBA the
+ * data is written to on return.
+ */
+static uint16_t nvme_zns_write(NvmeCtrl *n, NvmeRequest *req, uint64_t *slba,
+                               uint32_t nlb, bool append)
+{
+    NvmeNamespace *ns = req->ns;
+    NvmeZone *zone = nvme_zns_get_zone(ns, *slba);
+    uint16_t status;
+
+    if (append) {
+        if (*slba != zone->zslba) {
+            trace_pci_nvme_err_zone_append_not_at_start(*slba, zone->zslba);
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+        *slba = zone->wp;
+    }
+
+    status = nvme_zns_check_write(ns, zone, *slba, nlb);
+    if (status) {
+        trace_pci_nvme_err_zone_write(nvme_cid(req), *slba, zone->wp,
+                                      status);
+        return status;
+    }
+
+    status = nvme_zns_auto_open(ns, zone);
+    if (status) {
+        return status;
+    }
+
+    nvme_zns_advance_wp(ns, zone, nlb);
+    nvme_zns_commit(n, ns);
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeRequest *req)
 {
+    if (req->ns->zoned) {
+        nvme_zns_sync(req->ns);
+    }
+
     block_acct_start(blk_get_stats(n->conf.blk), &req->acct, 0,
          BLOCK_ACCT_FLUSH);
     req->aiocb = blk_aio_flush(n->conf.blk, nvme_rw_cb, req);
@@ -644,6 +1084,13 @@ static uint16_t nvme_write_zeroes(NvmeCtrl *n, NvmeRequest *req)
         return status;
     }
 
+    if (ns->zoned) {
+        status = nvme_zns_write(n, req, &slba, nlb, false);
+        if (status) {
+            return status;
+        }
+    }
+
     block_acct_start(blk_get_stats(n->conf.blk), &req->acct, 0,
                      BLOCK_ACCT_WRITE);
     req->aiocb = blk_aio_pwrite_zeroes(n->conf.blk, offset, count,
@@ -661,51 +1108,294 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeRequest *req)
     uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
     uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
     uint64_t data_size = (uint64_t)nlb << data_shift;
-    uint64_t data_offset = slba << data_shift;
-    int is_write = rw->opcode == NVME_CMD_WRITE ? 1 : 0;
+    uint64_t data_offset;
+    bool append = rw->opcode == NVME_CMD_ZONE_APPEND;
+    int is_write = rw->opcode != NVME_CMD_READ ? 1 : 0;
     enum BlockAcctType acct = is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ;
     uint16_t status;
 
-    trace_pci_nvme_rw(is_write ? "write" : "read", nlb, data_size, slba);
+    trace_pci_nvme_rw(is_write ? "write" : "read", nlb, data_size, slba);
+
+    status = nvme_check_mdts(n, data_size);
+    if (status) {
+        trace_pci_nvme_err_mdts(nvme_cid(req), data_size);
+        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        return status;
+    }
+
+    status = nvme_check_bounds(n, ns, slba, nlb);
+    if (status) {
+        trace_pci_nvme_err_invalid_lba_range(slba, nlb, ns->id_ns.nsze);
+        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        return status;
+    }
+
+    /* Zone Append is limited by ZASL rather than MDTS */
+    if (append && n->params.zasl &&
+        data_size > (uint64_t)n->page_size << n->params.zasl) {
+        trace_pci_nvme_err_mdts(nvme_cid(req), data_size);
+        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    status = nvme_map_dptr(n, data_size, req);
+    if (status) {
+        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        return status;
+    }
+
+    /* reads may cross zone boundaries (RAZB), writes are checked here */
+    if (ns->zoned && is_write) {
+        status = nvme_zns_write(n, req, &slba, nlb, append);
+        if (status) {
+            block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+            return status;
+        }
+    }
+
+    if (append) {
+        req->cqe.result = cpu_to_le32(slba);
+        req->cqe.dw1 = cpu_to_le32(slba >> 32);
+    }
+
+    data_offset = slba << data_shift;
+
+    if (req->qsg.nsg > 0) {
+        block_acct_start(blk_get_stats(n->conf.blk), &req->acct, req->qsg.size,
+                         acct);
+        req->aiocb = is_write ?
+            dma_blk_write(n->conf.blk, &req->qsg, data_offset, BDRV_SECTOR_SIZE,
+                          nvme_rw_cb, req) :
+            dma_blk_read(n->conf.blk, &req->qsg, data_offset, BDRV_SECTOR_SIZE,
+                         nvme_rw_cb, req);
+    } else {
+        block_acct_start(blk_get_stats(n->conf.blk), &req->acct, req->iov.size,
+                         acct);
+        req->aiocb = is_write ?
+            blk_aio_pwritev(n->conf.blk, data_offset, &req->iov, 0, nvme_rw_cb,
+                            req) :
+            blk_aio_preadv(n->conf.blk, data_offset, &req->iov, 0, nvme_rw_cb,
+                           req);
+    }
+
+    return NVME_NO_COMPLETE;
+}
+
+typedef struct NvmeZoneReset {
+    NvmeRequest     *req;
+    /* zones whose data is left to be zeroed */
+    unsigned long   *zones;
+    uint32_t        idx;
+    int64_t         offset;
+    int64_t         bytes;
+} NvmeZoneReset;
+
+/* Zero the data of the reset zones, one chunk at a time */
+static void nvme_zone_reset_cb(void *opaque, int ret)
+{
+    NvmeZoneReset *zr = opaque;
+    NvmeRequest *req = zr->req;
+    NvmeNamespace *ns = req->ns;
+    NvmeCtrl *n = req->sq->ctrl;
+    uint8_t lbads = nvme_ns_lbads(ns);
+    int64_t len;
+
+    if (ret < 0) {
+        req->status = NVME_INTERNAL_DEV_ERROR;
+        goto done;
+    }
+
+    if (!zr->bytes) {
+        zr->idx = find_next_bit(zr->zones, ns->num_zones, zr->idx);
+        if (zr->idx == ns->num_zones) {
+            req->status = NVME_SUCCESS;
+            goto done;
+        }
+
+        zr->offset = ns->zone_array[zr->idx].zslba << lbads;
+        zr->bytes = ns->zone_size << lbads;
+        zr->idx++;
+    }
+
+    len = MIN(zr->bytes, BDRV_REQUEST_MAX_BYTES);
+    req->aiocb = blk_aio_pwrite_zeroes(n->conf.blk, zr->offset, len,
+                                       BDRV_REQ_MAY_UNMAP, nvme_zone_reset_cb,
+                                       zr);
+    zr->offset += len;
+    zr->bytes -= len;
+    return;
+
+done:
+    g_free(zr->zones);
+    g_free(zr);
+    nvme_enqueue_req_completion(n->cq[req->sq->cqid], req);
+}
+
+static uint16_t nvme_zone_mgmt_send(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeCmd *cmd = &req->cmd;
+    NvmeNamespace *ns = req->ns;
+    uint64_t slba = ((uint64_t)le32_to_cpu(cmd->cdw11) << 32) |
+                    le32_to_cpu(cmd->cdw10);
+    uint32_t dw13 = le32_to_cpu(cmd->cdw13);
+    uint8_t action = NVME_ZONE_SEND_ACTION(dw13);
+    bool all = NVME_ZONE_SEND_SELECT_ALL(dw13);
+    unsigned long *zones = NULL;
+    NvmeZoneReset *zr;
+    uint16_t status = NVME_SUCCESS;
+    uint32_t i;
+
+    trace_pci_nvme_zone_mgmt_send(nvme_cid(req), slba, action, all);
+
+    /* no zone descriptor extensions */
+    if (action == NVME_ZONE_ACTION_SET_ZD_EXT) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    if (!all) {
+        status = nvme_check_bounds(n, ns, slba, 1);
+        if (status) {
+            trace_pci_nvme_err_invalid_lba_range(slba, 1, ns->id_ns.nsze);
+            return status;
+        }
+        if (slba % ns->zone_size) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+    }
+
+    if (action == NVME_ZONE_ACTION_RESET) {
+        zones = bitmap_new(ns->num_zones);
+    }
+
+    for (i = all ? 0 : slba / ns->zone_size; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+        bool empty = zone->state == NVME_ZONE_STATE_EMPTY;
+
+        if (!all || nvme_zns_select_all_applies(zone, action)) {
+            status = nvme_zns_zone_action(ns, zone, action);
+            if (status) {
+                break;
+            }
+            if (zones && !empty) {
+                set_bit(i, zones);
+            }
+        }
+
+        if (!all) {
+            break;
+        }
+    }
+
+    nvme_zns_commit(n, ns);
+
+    if (status || !zones || bitmap_empty(zones, ns->num_zones)) {
+        g_free(zones);
+        return status;
+    }
+
+    zr = g_new0(NvmeZoneReset, 1);
+    zr->req = req;
+    zr->zones = zones;
+    nvme_zone_reset_cb(zr, 0);
+
+    return NVME_NO_COMPLETE;
+}
+
+static bool nvme_zone_matches_filter(NvmeZone *zone, uint8_t filter)
+{
+    switch (filter) {
+    case NVME_ZONE_REPORT_ALL:
+        return true;
+    case NVME_ZONE_REPORT_EMPTY:
+        return zone->state == NVME_ZONE_STATE_EMPTY;
+    case NVME_ZONE_REPORT_IMPLICITLY_OPEN:
+        return zone->state == NVME_ZONE_STATE_IMPLICITLY_OPEN;
+    case NVME_ZONE_REPORT_EXPLICITLY_OPEN:
+        return zone->state == NVME_ZONE_STATE_EXPLICITLY_OPEN;
+    case NVME_ZONE_REPORT_CLOSED:
+        return zone->state == NVME_ZONE_STATE_CLOSED;
+    case NVME_ZONE_REPORT_FULL:
+        return zone->state == NVME_ZONE_STATE_FULL;
+    case NVME_ZONE_REPORT_READ_ONLY:
+        return zone->state == NVME_ZONE_STATE_READ_ONLY;
+    case NVME_ZONE_REPORT_OFFLINE:
+        return zone->state == NVME_ZONE_STATE_OFFLINE;
+    default:
+        return false;
+    }
+}
+
+static uint16_t nvme_zone_mgmt_recv(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeCmd *cmd = &req->cmd;
+    NvmeNamespace *ns = req->ns;
+    uint64_t slba = ((uint64_t)le32_to_cpu(cmd->cdw11) << 32) |
+                    le32_to_cpu(cmd->cdw10);
+    uint32_t len = (le32_to_cpu(cmd->cdw12) + 1) << 2;
+    uint32_t dw13 = le32_to_cpu(cmd->cdw13);
+    uint8_t action = NVME_ZONE_RECV_ACTION(dw13);
+    uint8_t filter = NVME_ZONE_RECV_FILTER(dw13);
+    bool partial = NVME_ZONE_RECV_PARTIAL(dw13);
+    NvmeZoneReportHeader *hdr;
+    NvmeZoneDescr *descr;
+    uint64_t nr_zones = 0;
+    size_t max_descrs;
+    uint8_t *buf;
+    uint16_t status;
+    uint32_t i;
+
+    trace_pci_nvme_zone_mgmt_recv(nvme_cid(req), slba, len, action, filter,
+                                  partial);
 
-    status = nvme_check_mdts(n, data_size);
+    if (action != NVME_ZONE_REPORT_ZONES ||
+        filter > NVME_ZONE_REPORT_OFFLINE ||
+        len < sizeof(NvmeZoneReportHeader)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    status = nvme_check_bounds(n, ns, slba, 1);
     if (status) {
-        trace_pci_nvme_err_mdts(nvme_cid(req), data_size);
-        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        trace_pci_nvme_err_invalid_lba_range(slba, 1, ns->id_ns.nsze);
         return status;
     }
 
-    status = nvme_check_bounds(n, ns, slba, nlb);
+    status = nvme_check_mdts(n, len);
     if (status) {
-        trace_pci_nvme_err_invalid_lba_range(slba, nlb, ns->id_ns.nsze);
-        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
+        trace_pci_nvme_err_mdts(nvme_cid(req), len);
         return status;
     }
 
-    if (nvme_map_dptr(n, data_size, req)) {
-        block_acct_invalid(blk_get_stats(n->conf.blk), acct);
-        return NVME_INVALID_FIELD | NVME_DNR;
-    }
+    buf = g_malloc0(len);
+    hdr = (NvmeZoneReportHeader *)buf;
+    descr = (NvmeZoneDescr *)(buf + sizeof(*hdr));
+    max_descrs = (len - sizeof(*hdr)) / sizeof(*descr);
 
-    if (req->qsg.nsg > 0) {
-        block_acct_start(blk_get_stats(n->conf.blk), &req->acct, req->qsg.size,
-                         acct);
-        req->aiocb = is_write ?
-            dma_blk_write(n->conf.blk, &req->qsg, data_offset, BDRV_SECTOR_SIZE,
-                          nvme_rw_cb, req) :
-            dma_blk_read(n->conf.blk, &req->qsg, data_offset, BDRV_SECTOR_SIZE,
-                         nvme_rw_cb, req);
-    } else {
-        block_acct_start(blk_get_stats(n->conf.blk), &req->acct, req->iov.size,
-                         acct);
-        req->aiocb = is_write ?
-            blk_aio_pwritev(n->conf.blk, data_offset, &req->iov, 0, nvme_rw_cb,
-                            req) :
-            blk_aio_preadv(n->conf.blk, data_offset, &req->iov, 0, nvme_rw_cb,
-                           req);
+    for (i = slba / ns->zone_size; i < ns->num_zones; i++) {
+        NvmeZone *zone = &ns->zone_array[i];
+
+        if (!nvme_zone_matches_filter(zone, filter)) {
+            continue;
+        }
+
+        if (nr_zones < max_descrs) {
+            descr->zt = NVME_ZONE_TYPE_SEQ_WRITE;
+            descr->zs = NVME_ZONE_DESCR_SET_ZS(zone->state);
+            descr->zcap = cpu_to_le64(ns->zone_capacity);
+            descr->zslba = cpu_to_le64(zone->zslba);
+            descr->wp = cpu_to_le64(zone->wp);
+            descr++;
+        } else if (partial) {
+            break;
+        }
+        nr_zones++;
     }
 
-    return NVME_NO_COMPLETE;
+    hdr->nr_zones = cpu_to_le64(nr_zones);
+
+    status = nvme_dma(n, buf, len, DMA_DIRECTION_FROM_DEVICE, req);
+    g_free(buf);
+
+    return status;
 }
 
 static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
@@ -721,6 +1411,11 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     }
 
     req->ns = &n->namespaces[nsid - 1];
+    if (unlikely(!nvme_ns_is_active(n, req->ns))) {
+        trace_pci_nvme_err_inactive_ns(nsid);
+        return NVME_INVALID_NSID | NVME_DNR;
+    }
+
     switch (req->cmd.opcode) {
     case NVME_CMD_FLUSH:
         return nvme_flush(n, req);
@@ -729,17 +1424,69 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     case NVME_CMD_WRITE:
     case NVME_CMD_READ:
         return nvme_rw(n, req);
+    case NVME_CMD_ZONE_APPEND:
+        if (!req->ns->zoned) {
+            break;
+        }
+        return nvme_rw(n, req);
+    case NVME_CMD_ZONE_MGMT_SEND:
+        if (!req->ns->zoned) {
+            break;
+        }
+        return nvme_zone_mgmt_send(n, req);
+    case NVME_CMD_ZONE_MGMT_RECV:
+        if (!req->ns->zoned) {
+            break;
+        }
+        return nvme_zone_mgmt_recv(n, req);
     default:
-        trace_pci_nvme_err_invalid_opc(req->cmd.opcode);
-        return NVME_INVALID_OPCODE | NVME_DNR;
+        break;
+    }
+
+    trace_pci_nvme_err_invalid_opc(req->cmd.opcode);
+    return NVME_INVALID_OPCODE | NVME_DNR;
+}
+
+/*
+ * With shadow doorbells the tail is read from the buffer, so submission
+ * queue doorbell writes can be turned into plain ioeventfd kicks.
+ */
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    uint16_t offset = sq->sqid << 3;
+    int ret;
+
+    if (sq->ioeventfd_enabled) {
+        return;
+    }
+
+    ret = event_notifier_init(&sq->notifier, 0);
+    if (ret < 0) {
+        /* Keep using the MMIO doorbell */
+        return;
     }
+
+    aio_set_event_notifier(n->ctx, &sq->notifier, true,
+                           nvme_sq_notifier, NULL);
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              &sq->notifier);
+    sq->ioeventfd_enabled = true;
 }
 
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
+    uint16_t offset = sq->sqid << 3;
+
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                                  &sq->notifier);
+        aio_set_event_notifier(n->ctx, &sq->notifier, true, NULL, NULL);
+        event_notifier_cleanup(&sq->notifier);
+        sq->ioeventfd_enabled = false;
+    }
+    qemu_bh_delete(sq->bh);
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -762,6 +1509,10 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    if (n->iothread) {
+        /* blk_aio_cancel() cannot poll an IOThread; wait for the requests */
+        blk_drain(n->conf.blk);
+    }
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         r = QTAILQ_FIRST(&sq->out_req_list);
         assert(r->aiocb);
@@ -798,13 +1549,28 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     sq->head = sq->tail = 0;
     sq->io_req = g_new0(NvmeRequest, sq->size);
 
+    /* CAP.DSTRD is 0, so the doorbells of queue pair i are 8 bytes apart */
+    if (sqid && n->dbbuf_enabled) {
+        sq->db_addr = n->dbbuf_dbs + (sqid << 3);
+        sq->ei_addr = n->dbbuf_eis + (sqid << 3);
+    } else {
+        sq->db_addr = sq->ei_addr = 0;
+    }
+
     QTAILQ_INIT(&sq->req_list);
     QTAILQ_INIT(&sq->out_req_list);
     for (i = 0; i < sq->size; i++) {
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    if (sqid) {
+        sq->bh = aio_bh_new(n->ctx, nvme_process_sq, sq);
+    } else {
+        sq->bh = qemu_bh_new(nvme_process_sq, sq);
+    }
+    if (sq->db_addr && n->iothread) {
+        nvme_init_sq_ioeventfd(sq);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
@@ -871,10 +1637,12 @@ static uint16_t nvme_smart_info(NvmeCtrl *n, uint8_t rae, uint32_t buf_len,
 
     s = blk_get_stats(n->conf.blk);
 
-    units_read = s->nr_bytes[BLOCK_ACCT_READ] >> BDRV_SECTOR_BITS;
-    units_written = s->nr_bytes[BLOCK_ACCT_WRITE] >> BDRV_SECTOR_BITS;
-    read_commands = s->nr_ops[BLOCK_ACCT_READ];
-    write_commands = s->nr_ops[BLOCK_ACCT_WRITE];
+    units_read = stat64_get(&s->nr_bytes[BLOCK_ACCT_READ]) >>
+                 BDRV_SECTOR_BITS;
+    units_written = stat64_get(&s->nr_bytes[BLOCK_ACCT_WRITE]) >>
+                    BDRV_SECTOR_BITS;
+    read_commands = stat64_get(&s->nr_ops[BLOCK_ACCT_READ]);
+    write_commands = stat64_get(&s->nr_ops[BLOCK_ACCT_WRITE]);
 
     if (off > sizeof(smart)) {
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -957,6 +1725,60 @@ static uint16_t nvme_error_info(NvmeCtrl *n, uint8_t rae, uint32_t buf_len,
                         DMA_DIRECTION_FROM_DEVICE, req);
 }
 
+static uint16_t nvme_cmd_effects(NvmeCtrl *n, uint8_t csi, uint32_t buf_len,
+                                 uint64_t off, NvmeRequest *req)
+{
+    NvmeCmd *cmd = &req->cmd;
+    uint64_t prp1 = le64_to_cpu(cmd->dptr.prp1);
+    uint64_t prp2 = le64_to_cpu(cmd->dptr.prp2);
+    NvmeEffectsLog log = {};
+    uint32_t trans_len;
+
+    if (off > sizeof(log)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    log.acs[NVME_ADM_CMD_DELETE_SQ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_CREATE_SQ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_GET_LOG_PAGE] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_DELETE_CQ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_CREATE_CQ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_IDENTIFY] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_ABORT] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_SET_FEATURES] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_GET_FEATURES] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_ASYNC_EV_REQ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+    log.acs[NVME_ADM_CMD_DBBUF_CONFIG] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+
+    switch (csi) {
+    case NVME_CSI_ZONED:
+        if (!n->params.zoned) {
+            break;
+        }
+        log.iocs[NVME_CMD_ZONE_APPEND] =
+            cpu_to_le32(NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC);
+        log.iocs[NVME_CMD_ZONE_MGMT_SEND] =
+            cpu_to_le32(NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC);
+        log.iocs[NVME_CMD_ZONE_MGMT_RECV] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+        /* fall through */
+    case NVME_CSI_NVM:
+        log.iocs[NVME_CMD_FLUSH] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+        log.iocs[NVME_CMD_WRITE] =
+            cpu_to_le32(NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC);
+        log.iocs[NVME_CMD_READ] = cpu_to_le32(NVME_CMD_EFF_CSUPP);
+        log.iocs[NVME_CMD_WRITE_ZEROES] =
+            cpu_to_le32(NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC);
+        break;
+    default:
+        break;
+    }
+
+    trans_len = MIN(sizeof(log) - off, buf_len);
+
+    return nvme_dma_prp(n, (uint8_t *)&log + off, trans_len, prp1, prp2,
+                        DMA_DIRECTION_FROM_DEVICE, req);
+}
+
 static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeCmd *cmd = &req->cmd;
@@ -965,9 +1787,11 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     uint32_t dw11 = le32_to_cpu(cmd->cdw11);
     uint32_t dw12 = le32_to_cpu(cmd->cdw12);
     uint32_t dw13 = le32_to_cpu(cmd->cdw13);
+    uint32_t dw14 = le32_to_cpu(cmd->cdw14);
     uint8_t  lid = dw10 & 0xff;
     uint8_t  lsp = (dw10 >> 8) & 0xf;
     uint8_t  rae = (dw10 >> 15) & 0x1;
+    uint8_t  csi = dw14 >> 24;
     uint32_t numdl, numdu;
     uint64_t off, lpol, lpou;
     size_t   len;
@@ -1000,6 +1824,8 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
         return nvme_smart_info(n, rae, len, off, req);
     case NVME_LOG_FW_SLOT_INFO:
         return nvme_fw_log_info(n, len, off, req);
+    case NVME_LOG_CMD_EFFECTS:
+        return nvme_cmd_effects(n, csi, len, off, req);
     default:
         trace_pci_nvme_err_invalid_log_page(nvme_cid(req), lid);
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -1009,8 +1835,16 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    qemu_bh_delete(cq->bh);
+    if (cq->irq_timer) {
+        timer_del(cq->irq_timer);
+        timer_free(cq->irq_timer);
+        cq->irq_timer = NULL;
+    }
+    if (cq->cqid && n->iothread) {
+        event_notifier_set_handler(&cq->assert_notifier, NULL);
+        event_notifier_cleanup(&cq->assert_notifier);
+    }
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -1054,10 +1888,29 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
     cq->head = cq->tail = 0;
+    if (cqid && n->dbbuf_enabled) {
+        cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
+        cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
+    } else {
+        cq->db_addr = cq->ei_addr = 0;
+    }
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->irq_pending = 0;
+    if (cqid) {
+        cq->bh = aio_bh_new(n->ctx, nvme_post_cqes, cq);
+        cq->irq_timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                      nvme_irq_timer, cq);
+    } else {
+        cq->bh = qemu_bh_new(nvme_post_cqes, cq);
+    }
+    if (cqid && n->iothread) {
+        ret = event_notifier_init(&cq->assert_notifier, 0);
+        assert(ret == 0);
+        event_notifier_set_handler(&cq->assert_notifier,
+                                   nvme_assert_notifier_read);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -1123,6 +1976,71 @@ static uint16_t nvme_identify_ctrl(NvmeCtrl *n, NvmeRequest *req)
                         prp2, DMA_DIRECTION_FROM_DEVICE, req);
 }
 
+/* For namespaces and command sets without a data structure to return */
+static uint16_t nvme_identify_zeroes(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
+    uint64_t prp1 = le64_to_cpu(c->prp1);
+    uint64_t prp2 = le64_to_cpu(c->prp2);
+    uint8_t *buf;
+    uint16_t ret;
+
+    buf = g_malloc0(NVME_IDENTIFY_DATA_SIZE);
+    ret = nvme_dma_prp(n, buf, NVME_IDENTIFY_DATA_SIZE, prp1, prp2,
+                       DMA_DIRECTION_FROM_DEVICE, req);
+    g_free(buf);
+    return ret;
+}
+
+static uint16_t nvme_identify_cs_ctrl(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
+    uint64_t prp1 = le64_to_cpu(c->prp1);
+    uint64_t prp2 = le64_to_cpu(c->prp2);
+    NvmeIdCtrlZoned id = {};
+
+    trace_pci_nvme_identify_cs_ctrl(c->csi);
+
+    switch (c->csi) {
+    case NVME_CSI_NVM:
+        return nvme_identify_zeroes(n, req);
+    case NVME_CSI_ZONED:
+        if (!n->params.zoned) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        id.zasl = n->params.zasl;
+        return nvme_dma_prp(n, (uint8_t *)&id, sizeof(id), prp1, prp2,
+                            DMA_DIRECTION_FROM_DEVICE, req);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
+static uint16_t nvme_identify_io_command_set(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
+    uint64_t prp1 = le64_to_cpu(c->prp1);
+    uint64_t prp2 = le64_to_cpu(c->prp2);
+    uint64_t *vectors;
+    uint16_t ret;
+
+    trace_pci_nvme_identify_io_command_set();
+
+    /* a single I/O Command Set combination, at index 0 */
+    vectors = g_malloc0(NVME_IDENTIFY_DATA_SIZE);
+    NVME_SET_CSI(vectors[0], NVME_CSI_NVM);
+    if (n->params.zoned) {
+        NVME_SET_CSI(vectors[0], NVME_CSI_ZONED);
+    }
+    vectors[0] = cpu_to_le64(vectors[0]);
+
+    ret = nvme_dma_prp(n, (uint8_t *)vectors, NVME_IDENTIFY_DATA_SIZE, prp1,
+                       prp2, DMA_DIRECTION_FROM_DEVICE, req);
+    g_free(vectors);
+    return ret;
+}
+
 static uint16_t nvme_identify_ns(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeNamespace *ns;
@@ -1139,11 +2057,48 @@ static uint16_t nvme_identify_ns(NvmeCtrl *n, NvmeRequest *req)
     }
 
     ns = &n->namespaces[nsid - 1];
+    if (!nvme_ns_is_active(n, ns)) {
+        return nvme_identify_zeroes(n, req);
+    }
 
     return nvme_dma_prp(n, (uint8_t *)&ns->id_ns, sizeof(ns->id_ns), prp1,
                         prp2, DMA_DIRECTION_FROM_DEVICE, req);
 }
 
+static uint16_t nvme_identify_cs_ns(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeNamespace *ns;
+    NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
+    uint32_t nsid = le32_to_cpu(c->nsid);
+    uint64_t prp1 = le64_to_cpu(c->prp1);
+    uint64_t prp2 = le64_to_cpu(c->prp2);
+
+    trace_pci_nvme_identify_cs_ns(nsid, c->csi);
+
+    if (unlikely(nsid == 0 || nsid > n->num_namespaces)) {
+        trace_pci_nvme_err_invalid_ns(nsid, n->num_namespaces);
+        return NVME_INVALID_NSID | NVME_DNR;
+    }
+
+    ns = &n->namespaces[nsid - 1];
+
+    switch (c->csi) {
+    case NVME_CSI_NVM:
+        /* the NVM Command Set has no I/O Command Set specific data */
+        return nvme_identify_zeroes(n, req);
+    case NVME_CSI_ZONED:
+        if (!ns->zoned || !nvme_ns_is_active(n, ns)) {
+            return nvme_identify_zeroes(n, req);
+        }
+
+        return nvme_dma_prp(n, (uint8_t *)&ns->id_ns_zoned,
+                            sizeof(ns->id_ns_zoned), prp1, prp2,
+                            DMA_DIRECTION_FROM_DEVICE, req);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
 static uint16_t nvme_identify_nslist(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
@@ -1169,7 +2124,7 @@ static uint16_t nvme_identify_nslist(NvmeCtrl *n, NvmeRequest *req)
 
     list = g_malloc0(data_len);
     for (i = 0; i < n->num_namespaces; i++) {
-        if (i < min_nsid) {
+        if (i < min_nsid || !nvme_ns_is_active(n, &n->namespaces[i])) {
             continue;
         }
         list[j++] = cpu_to_le32(i + 1);
@@ -1197,6 +2152,10 @@ static uint16_t nvme_identify_ns_descr_list(NvmeCtrl *n, NvmeRequest *req)
             NvmeIdNsDescr hdr;
             uint8_t v[16];
         } uuid;
+        struct {
+            NvmeIdNsDescr hdr;
+            uint8_t v;
+        } csi;
     };
 
     struct data *ns_descrs = (struct data *)list;
@@ -1220,6 +2179,11 @@ static uint16_t nvme_identify_ns_descr_list(NvmeCtrl *n, NvmeRequest *req)
     ns_descrs->uuid.hdr.nidl = NVME_NIDT_UUID_LEN;
     stl_be_p(&ns_descrs->uuid.v, nsid);
 
+    ns_descrs->csi.hdr.nidt = NVME_NIDT_CSI;
+    ns_descrs->csi.hdr.nidl = NVME_NIDT_CSI_LEN;
+    ns_descrs->csi.v = n->namespaces[nsid - 1].zoned ?
+        NVME_CSI_ZONED : NVME_CSI_NVM;
+
     return nvme_dma_prp(n, list, NVME_IDENTIFY_DATA_SIZE, prp1, prp2,
                         DMA_DIRECTION_FROM_DEVICE, req);
 }
@@ -1228,7 +2192,7 @@ static uint16_t nvme_identify(NvmeCtrl *n, NvmeRequest *req)
 {
     NvmeIdentify *c = (NvmeIdentify *)&req->cmd;
 
-    switch (le32_to_cpu(c->cns)) {
+    switch (c->cns) {
     case NVME_ID_CNS_NS:
         return nvme_identify_ns(n, req);
     case NVME_ID_CNS_CTRL:
@@ -1237,8 +2201,14 @@ static uint16_t nvme_identify(NvmeCtrl *n, NvmeRequest *req)
         return nvme_identify_nslist(n, req);
     case NVME_ID_CNS_NS_DESCR_LIST:
         return nvme_identify_ns_descr_list(n, req);
+    case NVME_ID_CNS_CS_NS:
+        return nvme_identify_cs_ns(n, req);
+    case NVME_ID_CNS_CS_CTRL:
+        return nvme_identify_cs_ctrl(n, req);
+    case NVME_ID_CNS_IO_COMMAND_SET:
+        return nvme_identify_io_command_set(n, req);
     default:
-        trace_pci_nvme_err_invalid_identify_cns(le32_to_cpu(c->cns));
+        trace_pci_nvme_err_invalid_identify_cns(c->cns);
         return NVME_INVALID_FIELD | NVME_DNR;
     }
 }
@@ -1382,6 +2352,17 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->params.max_ioqpairs + 1 || iv >= n->params.msix_qsize) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = n->features.int_vector_config[iv];
+        goto out;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, req);
     default:
@@ -1456,6 +2437,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint32_t nsid = le32_to_cpu(cmd->nsid);
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
+    int i;
 
     trace_pci_nvme_setfeat(nvme_cid(req), fid, save, dw11);
 
@@ -1513,6 +2495,9 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_VOLATILE_WRITE_CACHE:
         if (!(dw11 & 0x1) && blk_enable_write_cache(n->conf.blk)) {
             blk_flush(n->conf.blk);
+            for (i = 0; i < n->num_namespaces; i++) {
+                nvme_zns_sync(&n->namespaces[i]);
+            }
         }
 
         blk_set_enable_write_cache(n->conf.blk, dw11 & 1);
@@ -1540,6 +2525,26 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
+    case NVME_INTERRUPT_COALESCING:
+        trace_pci_nvme_setfeat_intc(NVME_INTC_THR(dw11), NVME_INTC_TIME(dw11));
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF: {
+        uint16_t iv = dw11 & 0xffff;
+
+        if (iv >= n->params.max_ioqpairs + 1 || iv >= n->params.msix_qsize) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        /* Coalescing never applies to the admin completion queue */
+        if (iv == n->admin_cq.vector) {
+            dw11 |= NVME_INTVC_NOCOALESCING;
+        }
+
+        n->features.int_vector_config[iv] = dw11 & (0xffff |
+                                                    NVME_INTVC_NOCOALESCING);
+        break;
+    }
     case NVME_TIMESTAMP:
         return nvme_set_feature_timestamp(n, req);
     default:
@@ -1567,6 +2572,57 @@ static uint16_t nvme_aer(NvmeCtrl *n, NvmeRequest *req)
     return NVME_NO_COMPLETE;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    if (unlikely((dbs_addr | eis_addr) & (n->page_size - 1))) {
+        trace_pci_nvme_err_invalid_dbbuf_addr(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    /*
+     * The admin queue keeps using the MMIO doorbells: hosts (e.g. Linux)
+     * only shadow the I/O queues, and a stale shadow value would otherwise
+     * override what they write to the register.
+     */
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        /* Seed the shadow doorbells with the current register values */
+        if (sq) {
+            uint32_t v = cpu_to_le32(sq->tail);
+
+            sq->db_addr = dbs_addr + (i << 3);
+            sq->ei_addr = eis_addr + (i << 3);
+            pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+
+            if (n->iothread) {
+                nvme_init_sq_ioeventfd(sq);
+            }
+        }
+
+        if (cq) {
+            uint32_t v = cpu_to_le32(cq->head);
+
+            cq->db_addr = dbs_addr + (i << 3) + (1 << 2);
+            cq->ei_addr = eis_addr + (i << 3) + (1 << 2);
+            pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode);
@@ -1592,6 +2648,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_get_feature(n, req);
     case NVME_ADM_CMD_ASYNC_EV_REQ:
         return nvme_aer(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     default:
         trace_pci_nvme_err_invalid_admin_opc(req->cmd.opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -1609,6 +2667,15 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+
+    /* Let the AIO back end submit the commands of this pass together */
+    blk_io_plug(n->conf.blk);
+
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
@@ -1627,6 +2694,28 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        /*
+         * Tell the host how far we got, then pick up whatever it queued in
+         * the meantime without waiting for a doorbell write.
+         */
+        if (sq->db_addr) {
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
+        }
+    }
+
+    blk_io_unplug(n->conf.blk);
+
+    aio_context_release(n->ctx);
+}
+
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
     }
 }
 
@@ -1657,6 +2746,14 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     n->outstanding_aers = 0;
     n->qs_created = false;
 
+    n->dbbuf_enabled = false;
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+
+    for (i = 0; i < n->num_namespaces; i++) {
+        nvme_zns_shutdown(&n->namespaces[i]);
+    }
+
     blk_flush(n->conf.blk);
     n->bar.cc = 0;
 }
@@ -1740,6 +2837,12 @@ static int nvme_start_ctrl(NvmeCtrl *n)
         trace_pci_nvme_err_startfail_acqent_sz_zero();
         return -1;
     }
+    if (unlikely(NVME_CC_CSS(n->bar.cc) != NVME_CC_CSS_NVM &&
+                 !(NVME_CC_CSS(n->bar.cc) == NVME_CC_CSS_CSI &&
+                   NVME_CAP_CSS(n->bar.cap) & NVME_CAP_CSS_CSI_SUPP))) {
+        trace_pci_nvme_err_startfail_css(NVME_CC_CSS(n->bar.cc));
+        return -1;
+    }
 
     n->page_bits = page_bits;
     n->page_size = page_size;
@@ -2020,12 +3123,18 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
         cq->head = new_head;
+        if (cq->db_addr) {
+            /* The shadow doorbell is what we read from now on */
+            uint32_t v = cpu_to_le32(new_head);
+
+            pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+        }
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                qemu_bh_schedule(sq->bh);
             }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+            qemu_bh_schedule(cq->bh);
         }
 
         if (cq->tail == cq->head) {
@@ -2073,7 +3182,12 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        if (sq->db_addr) {
+            uint32_t v = cpu_to_le32(new_tail);
+
+            pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+        }
+        qemu_bh_schedule(sq->bh);
     }
 }
 
@@ -2084,11 +3198,14 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 
     trace_pci_nvme_mmio_write(addr, data);
 
+    /* Both can touch the I/O queues and the BlockBackend */
+    aio_context_acquire(n->ctx);
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else {
         nvme_process_db(n, addr, data);
     }
+    aio_context_release(n->ctx);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -2173,10 +3290,18 @@ static void nvme_check_constraints(NvmeCtrl *n, Error **errp)
 
         host_memory_backend_set_mapped(n->pmrdev, true);
     }
+
+    if (params->zoned && params->zasl && params->mdts &&
+        params->zasl > params->mdts) {
+        error_setg(errp, "zasl must not exceed mdts");
+        return;
+    }
 }
 
 static void nvme_init_state(NvmeCtrl *n)
 {
+    int i;
+
     n->num_namespaces = 1;
     /* add one to max_ioqpairs to account for the admin queue pair */
     n->reg_size = pow2ceil(sizeof(NvmeBar) +
@@ -2188,6 +3313,12 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+
+    n->features.int_vector_config = g_new(uint32_t, n->params.msix_qsize);
+    for (i = 0; i < n->params.msix_qsize; i++) {
+        n->features.int_vector_config[i] = i;
+    }
+    n->features.int_vector_config[0] |= NVME_INTVC_NOCOALESCING;
 }
 
 static void nvme_init_blk(NvmeCtrl *n, Error **errp)
@@ -2195,8 +3326,20 @@ static void nvme_init_blk(NvmeCtrl *n, Error **errp)
     if (!blkconf_blocksizes(&n->conf, errp)) {
         return;
     }
-    blkconf_apply_backend_options(&n->conf, blk_is_read_only(n->conf.blk),
-                                  false, errp);
+    if (!blkconf_apply_backend_options(&n->conf,
+                                       blk_is_read_only(n->conf.blk),
+                                       false, errp)) {
+        return;
+    }
+
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        aio_context_acquire(n->ctx);
+        blk_set_aio_context(n->conf.blk, n->ctx, errp);
+        aio_context_release(n->ctx);
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
 }
 
 static void nvme_init_namespace(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
@@ -2213,6 +3356,14 @@ static void nvme_init_namespace(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
     n->ns_size = bs_size;
 
     id_ns->lbaf[0].ds = BDRV_SECTOR_BITS;
+
+    if (n->params.zoned) {
+        nvme_zns_init(n, ns, errp);
+        if (!ns->zoned) {
+            return;
+        }
+    }
+
     id_ns->nsze = cpu_to_le64(nvme_ns_nlbas(n, ns));
 
     /* no thin provisioning */
@@ -2332,7 +3483,7 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
     id->ieee[2] = 0xb3;
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
 
     /*
      * Because the controller always completes the Abort command immediately,
@@ -2348,7 +3499,7 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
     id->acl = 3;
     id->aerl = n->params.aerl;
     id->frmw = (NVME_NUM_FW_SLOTS << 1) | NVME_FRMW_SLOT1_RO;
-    id->lpa = NVME_LPA_EXTENDED;
+    id->lpa = NVME_LPA_CSE | NVME_LPA_EXTENDED;
 
     /* recommended default value (~70 C) */
     id->wctemp = cpu_to_le16(NVME_TEMPERATURE_WARNING);
@@ -2357,6 +3508,7 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
     id->sqes = (0x6 << 4) | 0x6;
     id->cqes = (0x4 << 4) | 0x4;
     id->nn = cpu_to_le32(n->num_namespaces);
+    id->sgls = cpu_to_le32(NVME_CTRL_SGLS_SUPPORT_NO_ALIGN);
     id->oncs = cpu_to_le16(NVME_ONCS_WRITE_ZEROES | NVME_ONCS_TIMESTAMP |
                            NVME_ONCS_FEATURES);
 
@@ -2375,7 +3527,10 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
     NVME_CAP_SET_MQES(n->bar.cap, 0x7ff);
     NVME_CAP_SET_CQR(n->bar.cap, 1);
     NVME_CAP_SET_TO(n->bar.cap, 0xf);
-    NVME_CAP_SET_CSS(n->bar.cap, 1);
+    NVME_CAP_SET_CSS(n->bar.cap, NVME_CAP_CSS_NVM);
+    if (n->params.zoned) {
+        NVME_CAP_SET_CSS(n->bar.cap, NVME_CAP_CSS_CSI_SUPP);
+    }
     NVME_CAP_SET_MPSMAX(n->bar.cap, 4);
 
     n->bar.vs = NVME_SPEC_VER;
@@ -2422,12 +3577,24 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
+    int i;
 
+    aio_context_acquire(n->ctx);
     nvme_clear_ctrl(n);
+    for (i = 0; i < n->num_namespaces; i++) {
+        nvme_zns_cleanup(&n->namespaces[i]);
+    }
+    if (n->iothread) {
+        /* If other users keep the BlockBackend in the iothread, that's ok */
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context(), NULL);
+    }
+    aio_context_release(n->ctx);
+
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.int_vector_config);
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmbuf);
@@ -2451,6 +3618,16 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("aerl", NvmeCtrl, params.aerl, 3),
     DEFINE_PROP_UINT32("aer_max_queued", NvmeCtrl, params.aer_max_queued, 64),
     DEFINE_PROP_UINT8("mdts", NvmeCtrl, params.mdts, 7),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_BOOL("zoned", NvmeCtrl, params.zoned, false),
+    DEFINE_PROP_SIZE("zone_size", NvmeCtrl, params.zone_size, 128 * MiB),
+    DEFINE_PROP_SIZE("zone_capacity", NvmeCtrl, params.zone_capacity, 0),
+    DEFINE_PROP_UINT32("max_open_zones", NvmeCtrl, params.max_open_zones, 0),
+    DEFINE_PROP_UINT32("max_active_zones", NvmeCtrl,
+                       params.max_active_zones, 0),
+    DEFINE_PROP_UINT8("zasl", NvmeCtrl, params.zasl, 0),
+    DEFINE_PROP_STRING("zone_state_file", NvmeCtrl, params.zone_state_file),
     DEFINE_PROP_END_OF_LIST(),
 };
 
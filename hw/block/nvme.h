@@ -2,6 +2,8 @@
 #define HW_NVME_H
 
 #include "block/nvme.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeParams {
     char     *serial;
@@ -12,6 +14,14 @@ typedef struct NvmeParams {
     uint8_t  aerl;
     uint32_t aer_max_queued;
     uint8_t  mdts;
+
+    bool     zoned;
+    uint64_t zone_size;
+    uint64_t zone_capacity;
+    uint32_t max_open_zones;
+    uint32_t max_active_zones;
+    uint8_t  zasl;
+    char     *zone_state_file;
 } NvmeParams;
 
 typedef struct NvmeAsyncEvent {
@@ -40,7 +50,11 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    QEMUBH      *bh;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -57,13 +71,44 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    QEMUBH      *bh;
+    /* Raises the interrupt from the main loop for IOThread queues */
+    EventNotifier assert_notifier;
+    /* Entries posted since the last interrupt, with coalescing enabled */
+    uint32_t    irq_pending;
+    QEMUTimer   *irq_timer;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
 
+typedef struct NvmeZone {
+    uint8_t     state;
+    uint64_t    zslba;
+    uint64_t    wp;
+    /* changed since the zone state file was last written */
+    bool        dirty;
+    QTAILQ_ENTRY(NvmeZone) entry;
+} NvmeZone;
+
 typedef struct NvmeNamespace {
     NvmeIdNs        id_ns;
+
+    /* Zoned Namespace Command Set; sizes are in logical blocks */
+    bool            zoned;
+    NvmeIdNsZoned   id_ns_zoned;
+    NvmeZone        *zone_array;
+    uint32_t        num_zones;
+    uint64_t        zone_size;
+    uint64_t        zone_capacity;
+    uint32_t        max_open;
+    uint32_t        max_active;
+    uint32_t        nr_open_zones;
+    uint32_t        nr_active_zones;
+    /* implicitly opened zones, oldest first */
+    QTAILQ_HEAD(, NvmeZone) imp_open_zones;
+    int             zone_state_fd;
 } NvmeNamespace;
 
 static inline NvmeLBAF *nvme_ns_lbaf(NvmeNamespace *ns)
@@ -87,6 +132,8 @@ typedef struct NvmeFeatureVal {
         uint16_t temp_thresh_low;
     };
     uint32_t    async_config;
+    uint32_t    int_coalescing;
+    uint32_t    *int_vector_config;
 } NvmeFeatureVal;
 
 typedef struct NvmeCtrl {
@@ -115,8 +162,17 @@ typedef struct NvmeCtrl {
     uint64_t    starttime_ms;
     uint16_t    temperature;
 
+    /* Doorbell Buffer Config: shadow doorbell and EventIdx buffers */
+    bool        dbbuf_enabled;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
+
     HostMemoryBackend *pmrdev;
 
+    /* I/O queues are processed here; the admin queue stays in the main loop */
+    IOThread    *iothread;
+    AioContext  *ctx;
+
     uint8_t     aer_mask;
     NvmeRequest **aer_reqs;
     QTAILQ_HEAD(, NvmeAsyncEvent) aer_queue;
@@ -134,7 +190,28 @@ typedef struct NvmeCtrl {
 /* calculate the number of LBAs that the namespace can accomodate */
 static inline uint64_t nvme_ns_nlbas(NvmeCtrl *n, NvmeNamespace *ns)
 {
+    if (ns->zoned) {
+        return ns->num_zones * ns->zone_size;
+    }
+
     return n->ns_size >> nvme_ns_lbads(ns);
 }
 
+static inline NvmeZone *nvme_zns_get_zone(NvmeNamespace *ns, uint64_t slba)
+{
+    return &ns->zone_array[slba / ns->zone_size];
+}
+
+void nvme_zns_init(NvmeCtrl *n, NvmeNamespace *ns, Error **errp);
+void nvme_zns_cleanup(NvmeNamespace *ns);
+void nvme_zns_shutdown(NvmeNamespace *ns);
+int nvme_zns_sync(NvmeNamespace *ns);
+uint16_t nvme_zns_check_write(NvmeNamespace *ns, NvmeZone *zone,
+                              uint64_t slba, uint32_t nlb);
+uint16_t nvme_zns_auto_open(NvmeNamespace *ns, NvmeZone *zone);
+void nvme_zns_advance_wp(NvmeNamespace *ns, NvmeZone *zone, uint32_t nlb);
+uint16_t nvme_zns_zone_action(NvmeNamespace *ns, NvmeZone *zone,
+                              uint8_t action);
+bool nvme_zns_select_all_applies(NvmeZone *zone, uint8_t action);
+
 #endif /* HW_NVME_H */
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "chardev/char-fe.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/module.h"
 #include "trace.h"
 #include "hw/qdev-properties.h"
@@ -49,9 +50,10 @@ static gboolean chr_write_unblocked(GIOChannel *chan, GIOCondition cond,
 
 /* Callback function that's called when the guest sends us data */
 static ssize_t flush_buf(VirtIOSerialPort *port,
-                         const uint8_t *buf, ssize_t len)
+                         const struct iovec *iov, int iovcnt)
 {
     VirtConsole *vcon = VIRTIO_CONSOLE(port);
+    ssize_t len = iov_size(iov, iovcnt);
     ssize_t ret;
 
     if (!qemu_chr_fe_backend_connected(&vcon->chr)) {
@@ -59,7 +61,7 @@ static ssize_t flush_buf(VirtIOSerialPort *port,
         return len;
     }
 
-    ret = qemu_chr_fe_write(&vcon->chr, buf, len);
+    ret = qemu_chr_fe_writev(&vcon->chr, iov, iovcnt);
     trace_virtio_console_flush_buf(port->id, len, ret);
 
     if (ret < len) {
@@ -285,7 +287,7 @@ static void virtserialport_class_init(ObjectClass *klass, void *data)
 
     k->realize = virtconsole_realize;
     k->unrealize = virtconsole_unrealize;
-    k->have_data = flush_buf;
+    k->have_datav = flush_buf;
     k->set_guest_connected = set_guest_connected;
     k->enable_backend = virtconsole_enable_backend;
     k->guest_writable = guest_writable;
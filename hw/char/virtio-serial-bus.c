@@ -33,6 +33,9 @@
 #include "hw/virtio/virtio-serial.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Elements handed to a port's have_datav() at once */
+#define VIRTIO_SERIAL_FLUSH_BATCH 64
+
 static struct VirtIOSerialDevices {
     QLIST_HEAD(, VirtIOSerial) devices;
 } vserdevices;
@@ -158,6 +161,116 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/*
+ * Move the position in port->elem forward by up to @len bytes; returns
+ * how many it moved.  The element is done when iov_idx reaches out_num.
+ */
+static size_t advance_elem(VirtIOSerialPort *port, size_t len)
+{
+    VirtQueueElement *elem = port->elem;
+    size_t done = 0;
+    size_t n;
+
+    while (port->iov_idx < elem->out_num) {
+        n = MIN(len - done,
+                elem->out_sg[port->iov_idx].iov_len - port->iov_offset);
+        port->iov_offset += n;
+        done += n;
+        if (port->iov_offset < elem->out_sg[port->iov_idx].iov_len) {
+            break;
+        }
+        port->iov_idx++;
+        port->iov_offset = 0;
+    }
+    return done;
+}
+
+/*
+ * Hand the data of up to VIRTIO_SERIAL_FLUSH_BATCH elements to the port
+ * at once.  The element being written stays in port->elem like in
+ * do_flush_queued_data(), the ones queued behind it in @elems.
+ */
+static void do_flush_queued_datav(VirtIOSerialPort *port, VirtQueue *vq,
+                                  VirtIODevice *vdev)
+{
+    VirtIOSerialPortClass *vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    VirtQueueElement *elems[VIRTIO_SERIAL_FLUSH_BATCH];
+    struct iovec iov[VIRTQUEUE_MAX_SIZE];
+    VirtQueueElement *elem;
+    unsigned int nelems, niov, i;
+    ssize_t ret;
+    size_t len;
+
+    while (!port->throttled) {
+        if (!port->elem) {
+            port->elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+            if (!port->elem) {
+                break;
+            }
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+
+        /* What is left of the current element, then the next ones */
+        elems[0] = port->elem;
+        nelems = 1;
+        niov = 0;
+        for (i = port->iov_idx; i < port->elem->out_num; i++) {
+            iov[niov] = port->elem->out_sg[i];
+            if (i == port->iov_idx) {
+                iov[niov].iov_base += port->iov_offset;
+                iov[niov].iov_len -= port->iov_offset;
+            }
+            niov++;
+        }
+        while (nelems < VIRTIO_SERIAL_FLUSH_BATCH) {
+            elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+            if (!elem) {
+                break;
+            }
+            if (niov + elem->out_num > ARRAY_SIZE(iov)) {
+                virtqueue_unpop(vq, elem, 0);
+                g_free(elem);
+                break;
+            }
+            memcpy(&iov[niov], elem->out_sg,
+                   elem->out_num * sizeof(struct iovec));
+            niov += elem->out_num;
+            elems[nelems++] = elem;
+        }
+
+        ret = vsc->have_datav(port, iov, niov);
+        if (!port->elem) { /* bail if we got disconnected */
+            for (i = 1; i < nelems; i++) {
+                virtqueue_detach_element(vq, elems[i], 0);
+                g_free(elems[i]);
+            }
+            return;
+        }
+
+        /* Unless throttled, the port took (or dropped) everything */
+        len = port->throttled ? MAX(ret, 0) : SIZE_MAX;
+        for (i = 0; i < nelems; i++) {
+            len -= advance_elem(port, len);
+            if (port->iov_idx < port->elem->out_num) {
+                break;
+            }
+            virtqueue_push(vq, port->elem, 0);
+            g_free(port->elem);
+            port->elem = i + 1 < nelems ? elems[i + 1] : NULL;
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+
+        /* Give back the elements after the one left off mid-way */
+        while (nelems > i + 1) {
+            virtqueue_unpop(vq, elems[--nelems], 0);
+            g_free(elems[nelems]);
+        }
+    }
+    virtio_notify(vdev, vq);
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -167,6 +280,10 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
     assert(virtio_queue_ready(vq));
 
     vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    if (vsc->have_datav) {
+        do_flush_queued_datav(port, vq, vdev);
+        return;
+    }
 
     while (!port->throttled) {
         unsigned int i;
@@ -175,6 +175,11 @@ CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
                                           -1, &error_abort);
     CPUState *cpu;
 
+    /*
+     * This runs without the BQL.  CPUs are removed from the list before
+     * they are unrealized, so holding the list lock keeps them alive.
+     */
+    cpu_list_lock();
     CPU_FOREACH(cpu) {
         CpuInfoFastList *info = g_malloc0(sizeof(*info));
         info->value = g_malloc0(sizeof(*info->value));
@@ -204,7 +209,30 @@ CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
             cur_item = info;
         }
     }
+    cpu_list_unlock();
+
+    return head;
+}
 
+HaltPollInfoList *qmp_x_query_halt_poll(Error **errp)
+{
+    HaltPollInfoList *head = NULL, **prev = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        HaltPollInfoList *elem = g_new0(HaltPollInfoList, 1);
+        HaltPollInfo *info = g_new0(HaltPollInfo, 1);
+
+        info->cpu_index = cpu->cpu_index;
+        info->window_ns = cpu->halt_poll_ns;
+        info->hits = cpu->halt_poll_hits;
+        info->misses = cpu->halt_poll_misses;
+        info->poll_ns = cpu->halt_poll_total_ns;
+
+        elem->value = info;
+        *prev = elem;
+        prev = &elem->next;
+    }
     return head;
 }
 
@@ -27,11 +27,14 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/clone-visitor.h"
 #include "qapi/qapi-events-qdev.h"
+#include "qapi/qapi-visit-machine.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "hw/hotplug.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
@@ -39,9 +42,15 @@
 #include "hw/sysbus.h"
 #include "hw/qdev-clock.h"
 #include "migration/vmstate.h"
+#include "sysemu/sysemu.h"
 #include "trace.h"
 
 bool qdev_hotplug = false;
+
+/* Realize times of the devices created before machine init is done */
+static DeviceRealizeTimeInfoList *startup_realize_times;
+static DeviceRealizeTimeInfoList **startup_realize_times_tail =
+    &startup_realize_times;
 static bool qdev_hot_added = false;
 bool qdev_hot_removed = false;
 
@@ -821,6 +830,37 @@ static bool check_only_migratable(Object *obj, Error **errp)
     return true;
 }
 
+static void qdev_record_realize_time(DeviceState *dev, int64_t start_ns)
+{
+    int64_t duration_ns = get_clock() - start_ns;
+    DeviceRealizeTimeInfoList *elem;
+    DeviceRealizeTimeInfo *info;
+
+    trace_qdev_realize_time(dev, object_get_typename(OBJECT(dev)),
+                            duration_ns);
+
+    if (machine_init_done) {
+        return;
+    }
+
+    info = g_new0(DeviceRealizeTimeInfo, 1);
+    info->type = g_strdup(object_get_typename(OBJECT(dev)));
+    info->has_id = !!dev->id;
+    info->id = g_strdup(dev->id);
+    info->start_ns = start_ns;
+    info->duration_ns = duration_ns;
+
+    elem = g_new0(DeviceRealizeTimeInfoList, 1);
+    elem->value = info;
+    *startup_realize_times_tail = elem;
+    startup_realize_times_tail = &elem->next;
+}
+
+DeviceRealizeTimeInfoList *qdev_get_startup_realize_times(void)
+{
+    return QAPI_CLONE(DeviceRealizeTimeInfoList, startup_realize_times);
+}
+
 static void device_set_realized(Object *obj, bool value, Error **errp)
 {
     DeviceState *dev = DEVICE(obj);
@@ -861,10 +901,13 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         }
 
         if (dc->realize) {
+            int64_t start_ns = get_clock();
+
             dc->realize(dev, &local_err);
             if (local_err != NULL) {
                 goto fail;
             }
+            qdev_record_realize_time(dev, start_ns);
         }
 
         DEVICE_LISTENER_CALL(realize, Forward, dev);
@@ -145,6 +145,14 @@ virtio_gpu_base_device_realize(DeviceState *qdev,
             return false;
         }
     }
+    if (virtio_gpu_blob_enabled(g->conf)) {
+        error_setg(&g->migration_blocker,
+                   "blob resources are not yet migratable");
+        if (migrate_add_blocker(g->migration_blocker, errp) < 0) {
+            error_free(g->migration_blocker);
+            return false;
+        }
+    }
 
     g->virtio_config.num_scanouts = cpu_to_le32(g->conf.max_outputs);
     virtio_init(VIRTIO_DEVICE(g), "virtio-gpu", VIRTIO_ID_GPU,
@@ -188,6 +196,9 @@ virtio_gpu_base_get_features(VirtIODevice *vdev, uint64_t features,
     if (virtio_gpu_edid_enabled(g->conf)) {
         features |= (1 << VIRTIO_GPU_F_EDID);
     }
+    if (virtio_gpu_blob_enabled(g->conf)) {
+        features |= (1 << VIRTIO_GPU_F_RESOURCE_BLOB);
+    }
 
     return features;
 }
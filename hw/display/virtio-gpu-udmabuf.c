@@ -0,0 +1,102 @@
+/*
+ * Virtio GPU Device: udmabuf support for blob resources
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "qemu/memfd.h"
+#include "exec/memory.h"
+#include "hw/virtio/virtio-gpu.h"
+#include "trace.h"
+
+#include <linux/udmabuf.h>
+
+static int udmabuf_dev = -1;
+
+bool virtio_gpu_have_udmabuf(void)
+{
+    static bool probed;
+
+    if (!probed) {
+        udmabuf_dev = open("/dev/udmabuf", O_RDWR);
+        probed = true;
+    }
+    return udmabuf_dev >= 0;
+}
+
+/*
+ * udmabuf only takes memfd-backed RAM; each entry of the backing becomes
+ * an item of the list, with its offset in the memfd of its RAMBlock.
+ */
+static int virtio_gpu_create_udmabuf(struct virtio_gpu_simple_resource *res)
+{
+    g_autofree struct udmabuf_create_list *list = NULL;
+    MemoryRegion *mr;
+    ram_addr_t offset;
+    int i, fd;
+
+    list = g_malloc0(sizeof(*list) +
+                     sizeof(struct udmabuf_create_item) * res->iov_cnt);
+    for (i = 0; i < res->iov_cnt; i++) {
+        rcu_read_lock();
+        mr = memory_region_from_host(res->iov[i].iov_base, &offset);
+        fd = mr ? memory_region_get_fd(mr) : -1;
+        rcu_read_unlock();
+
+        if (fd < 0 || (fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK) == 0) {
+            return -1;
+        }
+        if (!QEMU_IS_ALIGNED(offset | res->iov[i].iov_len,
+                             qemu_real_host_page_size)) {
+            return -1;
+        }
+        list->list[i].memfd = fd;
+        list->list[i].offset = offset;
+        list->list[i].size = res->iov[i].iov_len;
+    }
+    list->count = res->iov_cnt;
+    list->flags = UDMABUF_FLAGS_CLOEXEC;
+
+    return ioctl(udmabuf_dev, UDMABUF_CREATE_LIST, list);
+}
+
+void virtio_gpu_init_udmabuf(struct virtio_gpu_simple_resource *res)
+{
+    void *map;
+
+    if (!virtio_gpu_have_udmabuf()) {
+        return;
+    }
+
+    res->dmabuf_fd = virtio_gpu_create_udmabuf(res);
+    if (res->dmabuf_fd < 0) {
+        trace_virtio_gpu_udmabuf_failed(res->resource_id);
+        res->dmabuf_fd = -1;
+        return;
+    }
+
+    map = mmap(NULL, res->blob_size, PROT_READ, MAP_SHARED,
+               res->dmabuf_fd, 0);
+    if (map == MAP_FAILED) {
+        trace_virtio_gpu_udmabuf_failed(res->resource_id);
+        close(res->dmabuf_fd);
+        res->dmabuf_fd = -1;
+        return;
+    }
+    res->remapped = map;
+}
+
+void virtio_gpu_fini_udmabuf(struct virtio_gpu_simple_resource *res)
+{
+    if (res->remapped) {
+        munmap(res->remapped, res->blob_size);
+        res->remapped = NULL;
+    }
+    if (res->dmabuf_fd >= 0) {
+        close(res->dmabuf_fd);
+        res->dmabuf_fd = -1;
+    }
+}
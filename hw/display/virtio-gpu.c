@@ -25,6 +25,7 @@
 #include "hw/virtio/virtio-gpu-pixman.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/display/edid.h"
+#include "standard-headers/drm/drm_fourcc.h"
 #include "hw/qdev-properties.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
@@ -62,21 +63,28 @@ static void update_cursor_data_simple(VirtIOGPU *g,
 {
     struct virtio_gpu_simple_resource *res;
     uint32_t pixels;
+    void *data;
 
     res = virtio_gpu_find_resource(g, resource_id);
     if (!res) {
         return;
     }
 
-    if (pixman_image_get_width(res->image)  != s->current_cursor->width ||
-        pixman_image_get_height(res->image) != s->current_cursor->height) {
-        return;
+    pixels = s->current_cursor->width * s->current_cursor->height;
+    if (res->blob_size) {
+        if (!res->blob || res->blob_size < pixels * sizeof(uint32_t)) {
+            return;
+        }
+        data = res->blob;
+    } else {
+        if (pixman_image_get_width(res->image)  != s->current_cursor->width ||
+            pixman_image_get_height(res->image) != s->current_cursor->height) {
+            return;
+        }
+        data = pixman_image_get_data(res->image);
     }
 
-    pixels = s->current_cursor->width * s->current_cursor->height;
-    memcpy(s->current_cursor->data,
-           pixman_image_get_data(res->image),
-           pixels * sizeof(uint32_t));
+    memcpy(s->current_cursor->data, data, pixels * sizeof(uint32_t));
 }
 
 #ifdef CONFIG_VIRGL
@@ -321,6 +329,15 @@ static void virtio_gpu_resource_create_2d(VirtIOGPU *g,
     g->hostmem += res->hostmem;
 }
 
+static void virtio_gpu_release_dmabuf(VirtIOGPU *g, int scanout_id)
+{
+    if (g->dmabuf_scanouts & (1 << scanout_id)) {
+        dpy_gl_release_dmabuf(g->parent_obj.scanout[scanout_id].con,
+                              &g->dmabuf[scanout_id]);
+        g->dmabuf_scanouts &= ~(1 << scanout_id);
+    }
+}
+
 static void virtio_gpu_disable_scanout(VirtIOGPU *g, int scanout_id)
 {
     struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[scanout_id];
@@ -342,6 +359,7 @@ static void virtio_gpu_disable_scanout(VirtIOGPU *g, int scanout_id)
                                          scanout->height ?: 480,
                                          "Guest disabled display.");
     }
+    virtio_gpu_release_dmabuf(g, scanout_id);
     dpy_gfx_replace_surface(scanout->con, ds);
     scanout->resource_id = 0;
     scanout->ds = NULL;
@@ -362,7 +380,15 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
         }
     }
 
-    pixman_image_unref(res->image);
+    if (res->image) {
+        pixman_image_unref(res->image);
+    }
+    if (res->blob_size) {
+        virtio_gpu_fini_udmabuf(res);
+        if (res->blob_shadow) {
+            g_free(res->blob);
+        }
+    }
     virtio_gpu_cleanup_mapping(g, res);
     QTAILQ_REMOVE(&g->reslist, res, next);
     g->hostmem -= res->hostmem;
@@ -389,6 +415,38 @@ static void virtio_gpu_resource_unref(VirtIOGPU *g,
     virtio_gpu_resource_destroy(g, res);
 }
 
+/*
+ * Only the shadow copy of a blob needs updating; otherwise the display
+ * reads the guest memory directly.
+ */
+static void
+virtio_gpu_transfer_to_blob(struct virtio_gpu_simple_resource *res,
+                            struct virtio_gpu_transfer_to_host_2d *t2d)
+{
+    uint64_t src_offset;
+    uint32_t len = t2d->r.width * sizeof(uint32_t);
+    int h;
+
+    if (!res->blob_shadow) {
+        return;
+    }
+
+    if (!res->blob_stride) {
+        /* Not scanned out yet, so the layout is unknown */
+        iov_to_buf(res->iov, res->iov_cnt, 0, res->blob, res->blob_size);
+        return;
+    }
+
+    for (h = 0; h < t2d->r.height; h++) {
+        src_offset = t2d->offset + (uint64_t)res->blob_stride * h;
+        if (src_offset + len > res->blob_size) {
+            break;
+        }
+        iov_to_buf(res->iov, res->iov_cnt, src_offset,
+                   (uint8_t *)res->blob + src_offset, len);
+    }
+}
+
 static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
                                            struct virtio_gpu_ctrl_command *cmd)
 {
@@ -411,6 +469,11 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
         return;
     }
 
+    if (res->blob_size) {
+        virtio_gpu_transfer_to_blob(res, &t2d);
+        return;
+    }
+
     if (t2d.r.x > res->width ||
         t2d.r.y > res->height ||
         t2d.r.width > res->width ||
@@ -503,10 +566,17 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
         pixman_region_translate(&finalregion, -scanout->x, -scanout->y);
         extents = pixman_region_extents(&finalregion);
         /* work out the area we need to update for each console */
-        dpy_gfx_update(g->parent_obj.scanout[i].con,
-                       extents->x1, extents->y1,
-                       extents->x2 - extents->x1,
-                       extents->y2 - extents->y1);
+        if (g->dmabuf_scanouts & (1 << i)) {
+            dpy_gl_update(g->parent_obj.scanout[i].con,
+                          extents->x1, extents->y1,
+                          extents->x2 - extents->x1,
+                          extents->y2 - extents->y1);
+        } else {
+            dpy_gfx_update(g->parent_obj.scanout[i].con,
+                           extents->x1, extents->y1,
+                           extents->x2 - extents->x1,
+                           extents->y2 - extents->y1);
+        }
 
         pixman_region_fini(&region);
         pixman_region_fini(&finalregion);
@@ -549,7 +619,7 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
 
     /* create a surface for this scanout */
     res = virtio_gpu_find_resource(g, ss.resource_id);
-    if (!res) {
+    if (!res || res->blob_size) {
         qemu_log_mask(LOG_GUEST_ERROR, "%s: illegal resource specified %d\n",
                       __func__, ss.resource_id);
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
@@ -595,6 +665,7 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
             return;
         }
         pixman_image_unref(rect);
+        virtio_gpu_release_dmabuf(g, ss.scanout_id);
         dpy_gfx_replace_surface(g->parent_obj.scanout[ss.scanout_id].con,
                                 scanout->ds);
     }
@@ -612,8 +683,262 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
     scanout->height = ss.r.height;
 }
 
+/*
+ * Give the blob a linear view for the display: a udmabuf of the backing
+ * if the guest RAM is in memfds, else the backing itself if it is a
+ * single range, else a shadow copy updated on TRANSFER_TO_HOST_2D.
+ */
+static bool virtio_gpu_init_blob(VirtIOGPU *g,
+                                 struct virtio_gpu_simple_resource *res)
+{
+    virtio_gpu_init_udmabuf(res);
+    if (res->remapped) {
+        res->blob = res->remapped;
+        return true;
+    }
+
+    if (res->iov_cnt == 1) {
+        res->blob = res->iov[0].iov_base;
+        return true;
+    }
+
+    if (res->blob_size + g->hostmem >= g->conf_max_hostmem) {
+        return false;
+    }
+    res->blob = g_try_malloc(res->blob_size);
+    if (!res->blob) {
+        return false;
+    }
+    res->blob_shadow = true;
+    res->hostmem = res->blob_size;
+    iov_to_buf(res->iov, res->iov_cnt, 0, res->blob, res->blob_size);
+    return true;
+}
+
+static void virtio_gpu_resource_create_blob(VirtIOGPU *g,
+                                            struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_create_blob cblob;
+    int ret;
+
+    VIRTIO_GPU_FILL_CMD(cblob);
+    virtio_gpu_create_blob_bswap(&cblob);
+    trace_virtio_gpu_cmd_res_create_blob(cblob.resource_id, cblob.size);
+
+    if (cblob.resource_id == 0) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource id 0 is not allowed\n",
+                      __func__);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    /* Host memory blobs need a 3D renderer */
+    if (cblob.blob_mem != VIRTIO_GPU_BLOB_MEM_GUEST || cblob.size == 0) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: invalid blob memory %d\n",
+                      __func__, cblob.blob_mem);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    res = virtio_gpu_find_resource(g, cblob.resource_id);
+    if (res) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource already exists %d\n",
+                      __func__, cblob.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    res = g_new0(struct virtio_gpu_simple_resource, 1);
+    res->resource_id = cblob.resource_id;
+    res->blob_size = cblob.size;
+    res->dmabuf_fd = -1;
+
+    ret = virtio_gpu_create_mapping_iov(g, cblob.nr_entries, sizeof(cblob),
+                                        cmd, &res->addrs, &res->iov);
+    if (ret != 0) {
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        g_free(res);
+        return;
+    }
+    res->iov_cnt = cblob.nr_entries;
+
+    if (iov_size(res->iov, res->iov_cnt) < res->blob_size) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: backing smaller than blob %d\n",
+                      __func__, cblob.resource_id);
+        virtio_gpu_cleanup_mapping(g, res);
+        g_free(res);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    if (!virtio_gpu_init_blob(g, res)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: resource creation failed %d\n",
+                      __func__, cblob.resource_id);
+        virtio_gpu_cleanup_mapping(g, res);
+        g_free(res);
+        cmd->error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+        return;
+    }
+
+    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+    g->hostmem += res->hostmem;
+}
+
+static uint32_t virtio_gpu_get_drm_format(uint32_t virtio_gpu_format)
+{
+    switch (virtio_gpu_format) {
+    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+        return DRM_FORMAT_XRGB8888;
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+        return DRM_FORMAT_ARGB8888;
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        return DRM_FORMAT_XBGR8888;
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+        return DRM_FORMAT_ABGR8888;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Hand the udmabuf of the blob to GL displays.  QemuDmaBuf has no offset,
+ * so this only works if the scanout is the whole buffer.
+ */
+static bool virtio_gpu_scanout_dmabuf(VirtIOGPU *g,
+                                      struct virtio_gpu_simple_resource *res,
+                                      struct virtio_gpu_set_scanout_blob *ss)
+{
+    QemuConsole *con = g->parent_obj.scanout[ss->scanout_id].con;
+    QemuDmaBuf *dmabuf = &g->dmabuf[ss->scanout_id];
+    uint32_t fourcc = virtio_gpu_get_drm_format(ss->format);
+
+    if (res->dmabuf_fd < 0 || !fourcc || !console_has_gl_dmabuf(con) ||
+        ss->offsets[0] || ss->r.x || ss->r.y ||
+        ss->r.width != ss->width || ss->r.height != ss->height) {
+        return false;
+    }
+
+    virtio_gpu_release_dmabuf(g, ss->scanout_id);
+    memset(dmabuf, 0, sizeof(*dmabuf));
+    dmabuf->fd = res->dmabuf_fd;
+    dmabuf->width = ss->width;
+    dmabuf->height = ss->height;
+    dmabuf->stride = ss->strides[0];
+    dmabuf->fourcc = fourcc;
+    dpy_gl_scanout_dmabuf(con, dmabuf);
+    g->dmabuf_scanouts |= 1 << ss->scanout_id;
+    return true;
+}
+
+static void virtio_gpu_set_scanout_blob(VirtIOGPU *g,
+                                        struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res, *ores;
+    struct virtio_gpu_scanout *scanout;
+    struct virtio_gpu_set_scanout_blob ss;
+    pixman_format_code_t format;
+    uint64_t fbend;
+
+    VIRTIO_GPU_FILL_CMD(ss);
+    virtio_gpu_bswap_32(&ss, sizeof(ss));
+    trace_virtio_gpu_cmd_set_scanout_blob(ss.scanout_id, ss.resource_id,
+                                          ss.r.width, ss.r.height,
+                                          ss.r.x, ss.r.y);
+
+    if (ss.scanout_id >= g->parent_obj.conf.max_outputs) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: illegal scanout id specified %d",
+                      __func__, ss.scanout_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID;
+        return;
+    }
+
+    g->parent_obj.enable = 1;
+    if (ss.resource_id == 0) {
+        virtio_gpu_disable_scanout(g, ss.scanout_id);
+        return;
+    }
+
+    res = virtio_gpu_find_resource(g, ss.resource_id);
+    if (!res || !res->blob_size) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: illegal resource specified %d\n",
+                      __func__, ss.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    format = virtio_gpu_get_pixman_format(ss.format);
+    if (!format) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: host couldn't handle guest format %d\n",
+                      __func__, ss.format);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    /* All the supported formats have 4 bytes per pixel */
+    fbend = ss.offsets[0] + (uint64_t)ss.strides[0] * (ss.height - 1) +
+            (uint64_t)ss.width * sizeof(uint32_t);
+    if (ss.width < 16 || ss.height < 16 ||
+        ss.strides[0] < ss.width * sizeof(uint32_t) ||
+        fbend > res->blob_size ||
+        ss.r.x > ss.width ||
+        ss.r.y > ss.height ||
+        ss.r.width < 16 ||
+        ss.r.height < 16 ||
+        ss.r.width > ss.width ||
+        ss.r.height > ss.height ||
+        ss.r.x + ss.r.width > ss.width ||
+        ss.r.y + ss.r.height > ss.height) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: illegal scanout %d bounds for"
+                      " blob %d, (%d,%d)+%d,%d in %dx%d\n",
+                      __func__, ss.scanout_id, ss.resource_id, ss.r.x, ss.r.y,
+                      ss.r.width, ss.r.height, ss.width, ss.height);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    /* The framebuffer layout, for flushes and shadow updates */
+    res->width = ss.width;
+    res->height = ss.height;
+    res->format = ss.format;
+    res->blob_stride = ss.strides[0];
+
+    scanout = &g->parent_obj.scanout[ss.scanout_id];
+
+    if (!virtio_gpu_scanout_dmabuf(g, res, &ss)) {
+        pixman_image_t *rect;
+        uint8_t *ptr = (uint8_t *)res->blob + ss.offsets[0] +
+                       ss.r.y * ss.strides[0] + ss.r.x * sizeof(uint32_t);
+
+        /* Scan out from the blob itself, without copying it */
+        rect = pixman_image_create_bits(format, ss.r.width, ss.r.height,
+                                        (uint32_t *)ptr, ss.strides[0]);
+        scanout->ds = qemu_create_displaysurface_pixman(rect);
+        pixman_image_unref(rect);
+        if (!scanout->ds) {
+            cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+            return;
+        }
+        virtio_gpu_release_dmabuf(g, ss.scanout_id);
+        dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    }
+
+    ores = virtio_gpu_find_resource(g, scanout->resource_id);
+    if (ores) {
+        ores->scanout_bitmask &= ~(1 << ss.scanout_id);
+    }
+
+    res->scanout_bitmask |= (1 << ss.scanout_id);
+    scanout->resource_id = ss.resource_id;
+    scanout->x = ss.r.x;
+    scanout->y = ss.r.y;
+    scanout->width = ss.r.width;
+    scanout->height = ss.r.height;
+}
+
 int virtio_gpu_create_mapping_iov(VirtIOGPU *g,
-                                  struct virtio_gpu_resource_attach_backing *ab,
+                                  uint32_t nr_entries, uint32_t offset,
                                   struct virtio_gpu_ctrl_command *cmd,
                                   uint64_t **addr, struct iovec **iov)
 {
@@ -621,17 +946,17 @@ int virtio_gpu_create_mapping_iov(VirtIOGPU *g,
     size_t esize, s;
     int i;
 
-    if (ab->nr_entries > 16384) {
+    if (nr_entries > 16384) {
         qemu_log_mask(LOG_GUEST_ERROR,
                       "%s: nr_entries is too big (%d > 16384)\n",
-                      __func__, ab->nr_entries);
+                      __func__, nr_entries);
         return -1;
     }
 
-    esize = sizeof(*ents) * ab->nr_entries;
+    esize = sizeof(*ents) * nr_entries;
     ents = g_malloc(esize);
     s = iov_to_buf(cmd->elem.out_sg, cmd->elem.out_num,
-                   sizeof(*ab), ents, esize);
+                   offset, ents, esize);
     if (s != esize) {
         qemu_log_mask(LOG_GUEST_ERROR,
                       "%s: command data size incorrect %zu vs %zu\n",
@@ -640,11 +965,11 @@ int virtio_gpu_create_mapping_iov(VirtIOGPU *g,
         return -1;
     }
 
-    *iov = g_malloc0(sizeof(struct iovec) * ab->nr_entries);
+    *iov = g_malloc0(sizeof(struct iovec) * nr_entries);
     if (addr) {
-        *addr = g_malloc0(sizeof(uint64_t) * ab->nr_entries);
+        *addr = g_malloc0(sizeof(uint64_t) * nr_entries);
     }
-    for (i = 0; i < ab->nr_entries; i++) {
+    for (i = 0; i < nr_entries; i++) {
         uint64_t a = le64_to_cpu(ents[i].addr);
         uint32_t l = le32_to_cpu(ents[i].length);
         hwaddr len = l;
@@ -656,8 +981,7 @@ int virtio_gpu_create_mapping_iov(VirtIOGPU *g,
         }
         if (!(*iov)[i].iov_base || len != l) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: failed to map MMIO memory for"
-                          " resource %d element %d\n",
-                          __func__, ab->resource_id, i);
+                          " element %d\n", __func__, i);
             if ((*iov)[i].iov_base) {
                 i++; /* cleanup the 'i'th map */
             }
@@ -724,7 +1048,8 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
         return;
     }
 
-    ret = virtio_gpu_create_mapping_iov(g, &ab, cmd, &res->addrs, &res->iov);
+    ret = virtio_gpu_create_mapping_iov(g, ab.nr_entries, sizeof(ab), cmd,
+                                        &res->addrs, &res->iov);
     if (ret != 0) {
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         return;
@@ -745,7 +1070,7 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
     trace_virtio_gpu_cmd_res_back_detach(detach.resource_id);
 
     res = virtio_gpu_find_resource(g, detach.resource_id);
-    if (!res || !res->iov) {
+    if (!res || !res->iov || res->blob_size) {
         qemu_log_mask(LOG_GUEST_ERROR, "%s: illegal resource specified %d\n",
                       __func__, detach.resource_id);
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
@@ -788,6 +1113,20 @@ static void virtio_gpu_simple_process_cmd(VirtIOGPU *g,
     case VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING:
         virtio_gpu_resource_detach_backing(g, cmd);
         break;
+    case VIRTIO_GPU_CMD_RESOURCE_CREATE_BLOB:
+        if (!virtio_gpu_blob_enabled(g->parent_obj.conf)) {
+            cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+            break;
+        }
+        virtio_gpu_resource_create_blob(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_SET_SCANOUT_BLOB:
+        if (!virtio_gpu_blob_enabled(g->parent_obj.conf)) {
+            cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+            break;
+        }
+        virtio_gpu_set_scanout_blob(g, cmd);
+        break;
     default:
         cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
         break;
@@ -980,6 +1319,10 @@ static int virtio_gpu_save(QEMUFile *f, void *opaque, size_t size,
     assert(QTAILQ_EMPTY(&g->cmdq));
 
     QTAILQ_FOREACH(res, &g->reslist, next) {
+        /* Blob resources come with a migration blocker */
+        if (res->blob_size) {
+            continue;
+        }
         qemu_put_be32(f, res->resource_id);
         qemu_put_be32(f, res->width);
         qemu_put_be32(f, res->height);
@@ -1127,6 +1470,12 @@ static void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
 #endif
     }
 
+    if (virtio_gpu_virgl_enabled(g->parent_obj.conf) &&
+        virtio_gpu_blob_enabled(g->parent_obj.conf)) {
+        error_setg(errp, "blob resources are not supported with virgl");
+        return;
+    }
+
     if (!virtio_gpu_base_device_realize(qdev,
                                         virtio_gpu_handle_ctrl_cb,
                                         virtio_gpu_handle_cursor_cb,
@@ -1237,6 +1586,8 @@ static Property virtio_gpu_properties[] = {
     VIRTIO_GPU_BASE_PROPERTIES(VirtIOGPU, parent_obj.conf),
     DEFINE_PROP_SIZE("max_hostmem", VirtIOGPU, conf_max_hostmem,
                      256 * MiB),
+    DEFINE_PROP_BIT("blob", VirtIOGPU, parent_obj.conf.flags,
+                    VIRTIO_GPU_FLAG_BLOB_ENABLED, false),
 #ifdef CONFIG_VIRGL
     DEFINE_PROP_BIT("virgl", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_VIRGL_ENABLED, true),
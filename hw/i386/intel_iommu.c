@@ -1495,6 +1495,18 @@ static int vtd_sync_shadow_page_table(VTDAddressSpace *vtd_as)
         return ret;
     }
 
+    if (!vtd_as_has_map_notifier(vtd_as)) {
+        /*
+         * UNMAP-only notifiers have no shadow page table to sync, but
+         * may have cached any translation of the device, so drop them
+         * all like vtd_iotlb_page_invalidate_notify() does for a range.
+         */
+        IOMMU_NOTIFIER_FOREACH(n, &vtd_as->iommu) {
+            vtd_address_space_unmap(vtd_as, n);
+        }
+        return 0;
+    }
+
     return vtd_sync_shadow_page_table_range(vtd_as, &ce, 0, UINT64_MAX);
 }
 
@@ -3086,6 +3098,8 @@ static Property vtd_properties[] = {
     DEFINE_PROP_BOOL("caching-mode", IntelIOMMUState, caching_mode, FALSE),
     DEFINE_PROP_BOOL("x-scalable-mode", IntelIOMMUState, scalable_mode, FALSE),
     DEFINE_PROP_BOOL("dma-drain", IntelIOMMUState, dma_drain, true),
+    DEFINE_PROP_BOOL("x-dma-translation-cache", IntelIOMMUState,
+                     dma_translation_cache, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3423,6 +3437,11 @@ VTDAddressSpace *vtd_find_add_as(IntelIOMMUState *s, PCIBus *bus, int devfn)
         memory_region_add_subregion_overlap(MEMORY_REGION(&vtd_dev_as->iommu),
                                             VTD_INTERRUPT_ADDR_FIRST,
                                             &vtd_dev_as->iommu_ir, 1);
+        if (s->dma_translation_cache) {
+            /* Every invalidation reaches UNMAP notifiers, see below */
+            memory_region_iommu_enable_tlb_cache(&vtd_dev_as->iommu,
+                                                 &error_abort);
+        }
 
         /*
          * Hook both the containers under the root container, we
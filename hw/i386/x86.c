@@ -134,6 +134,19 @@ void x86_cpus_init(X86MachineState *x86ms, int default_cpu_version)
     x86ms->apic_id_limit = x86_cpu_apic_id_from_index(x86ms,
                                                       ms->smp.max_cpus - 1) + 1;
     possible_cpus = mc->possible_cpu_arch_ids(ms);
+    if (kvm_enabled()) {
+        /*
+         * Each vCPU thread would otherwise create its vCPU in turn, which
+         * takes a while for big guests.  The KVM vCPU id is the APIC ID.
+         */
+        g_autofree unsigned long *vcpu_ids = g_new(unsigned long,
+                                                   ms->smp.cpus);
+
+        for (i = 0; i < ms->smp.cpus; i++) {
+            vcpu_ids[i] = possible_cpus->cpus[i].arch_id;
+        }
+        kvm_precreate_vcpus(vcpu_ids, ms->smp.cpus);
+    }
     for (i = 0; i < ms->smp.cpus; i++) {
         x86_cpu_new(x86ms, possible_cpus->cpus[i].arch_id, &error_fatal);
     }
@@ -175,12 +175,29 @@ static uint32_t ahci_port_read(AHCIState *s, int port, int offset)
     return val;
 }
 
+/*
+ * Interrupts cannot be raised without the BQL, which the IOThread does not
+ * take, so completions there leave it to the main loop.
+ */
+static bool ahci_irq_defer(AHCIState *s)
+{
+    if (s->iothread && !qemu_mutex_iothread_locked()) {
+        event_notifier_set(&s->irq_notifier);
+        return true;
+    }
+    return false;
+}
+
 static void ahci_irq_raise(AHCIState *s)
 {
     DeviceState *dev_state = s->container;
     PCIDevice *pci_dev = (PCIDevice *) object_dynamic_cast(OBJECT(dev_state),
                                                            TYPE_PCI_DEVICE);
 
+    if (ahci_irq_defer(s)) {
+        return;
+    }
+
     trace_ahci_irq_raise(s);
 
     if (pci_dev && msi_enabled(pci_dev)) {
@@ -196,6 +213,10 @@ static void ahci_irq_lower(AHCIState *s)
     PCIDevice *pci_dev = (PCIDevice *) object_dynamic_cast(OBJECT(dev_state),
                                                            TYPE_PCI_DEVICE);
 
+    if (ahci_irq_defer(s)) {
+        return;
+    }
+
     trace_ahci_irq_lower(s);
 
     if (!pci_dev || !msi_enabled(pci_dev)) {
@@ -224,6 +245,17 @@ static void ahci_check_irq(AHCIState *s)
     }
 }
 
+static void ahci_irq_notifier_read(EventNotifier *e)
+{
+    AHCIState *s = container_of(e, AHCIState, irq_notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        aio_context_acquire(s->ctx);
+        ahci_check_irq(s);
+        aio_context_release(s->ctx);
+    }
+}
+
 static void ahci_trigger_irq(AHCIState *s, AHCIDevice *d,
                              enum AHCIPortIRQ irqbit)
 {
@@ -433,12 +465,17 @@ static uint64_t ahci_mem_read_32(void *opaque, hwaddr addr)
  */
 static uint64_t ahci_mem_read(void *opaque, hwaddr addr, unsigned size)
 {
+    AHCIState *s = opaque;
     hwaddr aligned = addr & ~0x3;
     int ofst = addr - aligned;
-    uint64_t lo = ahci_mem_read_32(opaque, aligned);
+    uint64_t lo;
     uint64_t hi;
     uint64_t val;
 
+    aio_context_acquire(s->ctx);
+
+    lo = ahci_mem_read_32(opaque, aligned);
+
     /* if < 8 byte read does not cross 4 byte boundary */
     if (ofst + size <= 4) {
         val = lo >> (ofst * 8);
@@ -451,6 +488,8 @@ static uint64_t ahci_mem_read(void *opaque, hwaddr addr, unsigned size)
         val = (hi << 32 | lo) >> (ofst * 8);
     }
 
+    aio_context_release(s->ctx);
+
     trace_ahci_mem_read(opaque, size, addr, val);
     return val;
 }
@@ -470,6 +509,8 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
         return;
     }
 
+    aio_context_acquire(s->ctx);
+
     if (addr < AHCI_GENERIC_HOST_CONTROL_REGS_MAX_ADDR) {
         enum AHCIHostReg regnum = addr / 4;
         assert(regnum < AHCI_HOST_REG__COUNT);
@@ -518,6 +559,8 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
                       addr, val);
         trace_ahci_mem_write_unimpl(s, size, addr, val);
     }
+
+    aio_context_release(s->ctx);
 }
 
 static const MemoryRegionOps ahci_mem_ops = {
@@ -584,26 +627,39 @@ static void ahci_reg_init(AHCIState *s)
 static void check_cmd(AHCIState *s, int port)
 {
     AHCIPortRegs *pr = &s->dev[port].port_regs;
+    BlockBackend *blk = s->dev[port].port.ifs[0].blk;
     uint8_t slot;
 
     if ((pr->cmd & PORT_CMD_START) && pr->cmd_issue) {
+        /* Submit the NCQ commands issued together as one batch */
+        if (blk) {
+            blk_io_plug(blk);
+        }
         for (slot = 0; (slot < 32) && pr->cmd_issue; slot++) {
             if ((pr->cmd_issue & (1U << slot)) &&
                 !handle_cmd(s, port, slot)) {
                 pr->cmd_issue &= ~(1U << slot);
             }
         }
+        if (blk) {
+            blk_io_unplug(blk);
+        }
     }
 }
 
 static void ahci_check_cmd_bh(void *opaque)
 {
     AHCIDevice *ad = opaque;
+    AioContext *ctx = ad->hba->ctx;
+
+    aio_context_acquire(ctx);
 
     qemu_bh_delete(ad->check_bh);
     ad->check_bh = NULL;
 
     check_cmd(ad->hba, ad->port_no);
+
+    aio_context_release(ctx);
 }
 
 static void ahci_init_d2h(AHCIDevice *ad)
@@ -1538,6 +1594,14 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
     qemu_irq *irqs;
     int i;
 
+    if (s->iothread) {
+        s->ctx = iothread_get_aio_context(s->iothread);
+        event_notifier_init(&s->irq_notifier, 0);
+        event_notifier_set_handler(&s->irq_notifier, ahci_irq_notifier_read);
+    } else {
+        s->ctx = qemu_get_aio_context();
+    }
+
     s->as = as;
     s->ports = ports;
     s->dev = g_new0(AHCIDevice, ports);
@@ -1565,6 +1629,14 @@ void ahci_uninit(AHCIState *s)
     for (i = 0; i < s->ports; i++) {
         AHCIDevice *ad = &s->dev[i];
 
+        if (s->iothread && ad->port.ifs[0].blk) {
+            /* If other users keep the BlockBackend in the iothread, ok */
+            aio_context_acquire(s->ctx);
+            blk_set_aio_context(ad->port.ifs[0].blk, qemu_get_aio_context(),
+                                NULL);
+            aio_context_release(s->ctx);
+        }
+
         for (j = 0; j < 2; j++) {
             IDEState *s = &ad->port.ifs[j];
 
@@ -1573,9 +1645,42 @@ void ahci_uninit(AHCIState *s)
         object_unparent(OBJECT(&ad->port));
     }
 
+    if (s->iothread) {
+        event_notifier_set_handler(&s->irq_notifier, NULL);
+        event_notifier_cleanup(&s->irq_notifier);
+    }
+
     g_free(s->dev);
 }
 
+/*
+ * Drives are attached to the ports after the HBA is realized, so they are
+ * moved to the IOThread when the machine is reset.  A drive that cannot
+ * move keeps being served from the main loop.
+ */
+static void ahci_attach_aio_context(AHCIState *s)
+{
+    Error *local_err = NULL;
+    int i;
+
+    for (i = 0; i < s->ports; i++) {
+        BlockBackend *blk = s->dev[i].port.ifs[0].blk;
+
+        if (!blk || blk_get_aio_context(blk) == s->ctx) {
+            continue;
+        }
+
+        aio_context_acquire(s->ctx);
+        blk_set_aio_context(blk, s->ctx, &local_err);
+        aio_context_release(s->ctx);
+        if (local_err) {
+            error_reportf_err(local_err, "ahci: port %d cannot use the "
+                              "iothread: ", i);
+            local_err = NULL;
+        }
+    }
+}
+
 void ahci_reset(AHCIState *s)
 {
     AHCIPortRegs *pr;
@@ -1583,6 +1688,12 @@ void ahci_reset(AHCIState *s)
 
     trace_ahci_reset(s);
 
+    if (s->iothread) {
+        ahci_attach_aio_context(s);
+    }
+
+    aio_context_acquire(s->ctx);
+
     s->control_regs.irqstatus = 0;
     /* AHCI Enable (AE)
      * The implementation of this bit is dependent upon the value of the
@@ -1602,6 +1713,8 @@ void ahci_reset(AHCIState *s)
         pr->cmd = PORT_CMD_SPIN_UP | PORT_CMD_POWER_ON;
         ahci_reset_port(s, i);
     }
+
+    aio_context_release(s->ctx);
 }
 
 static const VMStateDescription vmstate_ncq_tfs = {
@@ -429,8 +429,12 @@ static const AIOCBInfo trim_aiocb_info = {
 static void ide_trim_bh_cb(void *opaque)
 {
     TrimAIOCB *iocb = opaque;
+    AioContext *ctx = blk_get_aio_context(iocb->s->blk);
 
+    /* the BH runs in the main loop even if the drive is in an IOThread */
+    aio_context_acquire(ctx);
     iocb->common.cb(iocb->common.opaque, iocb->ret);
+    aio_context_release(ctx);
 
     qemu_bh_delete(iocb->bh);
     iocb->bh = NULL;
@@ -2629,16 +2633,12 @@ static void ide_restart_dma(IDEState *s, enum ide_dma_cmd dma_cmd)
     ide_start_dma(s, ide_dma_cb);
 }
 
-static void ide_restart_bh(void *opaque)
+static void ide_restart_bh_locked(IDEBus *bus)
 {
-    IDEBus *bus = opaque;
     IDEState *s;
     bool is_read;
     int error_status;
 
-    qemu_bh_delete(bus->bh);
-    bus->bh = NULL;
-
     error_status = bus->error_status;
     if (bus->error_status == 0) {
         return;
@@ -2679,6 +2679,21 @@ static void ide_restart_bh(void *opaque)
     }
 }
 
+static void ide_restart_bh(void *opaque)
+{
+    IDEBus *bus = opaque;
+    IDEState *s = idebus_active_if(bus);
+    AioContext *ctx = s->blk ? blk_get_aio_context(s->blk) :
+                               qemu_get_aio_context();
+
+    qemu_bh_delete(bus->bh);
+    bus->bh = NULL;
+
+    aio_context_acquire(ctx);
+    ide_restart_bh_locked(bus);
+    aio_context_release(ctx);
+}
+
 static void ide_restart_cb(void *opaque, int running, RunState state)
 {
     IDEBus *bus = opaque;
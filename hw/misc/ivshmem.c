@@ -31,6 +31,7 @@
 #include "qemu/error-report.h"
 #include "qemu/event_notifier.h"
 #include "qemu/module.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "chardev/char-fe.h"
 #include "sysemu/hostmem.h"
@@ -83,6 +84,8 @@ typedef struct MSIVector {
     PCIDevice *pdev;
     int virq;
     bool unmasked;
+    QEMUTimer *coalesce_timer;  /* raises a doorbell held back */
+    int64_t next_irq;           /* no interrupt before then */
 } MSIVector;
 
 struct IVShmemState {
@@ -113,6 +116,8 @@ struct IVShmemState {
     MSIVector *msi_vectors;
     uint64_t msg_buf;           /* buffer for receiving server messages */
     int msg_buffered_bytes;     /* #bytes in @msg_buf */
+    bool poll;                  /* guest polls, no interrupts at all */
+    uint32_t coalesce_us;       /* minimum interval between interrupts */
 
     /* migration stuff */
     OnOffAuto master;
@@ -250,6 +255,30 @@ static const MemoryRegionOps ivshmem_mmio_ops = {
     },
 };
 
+static void ivshmem_vector_raise(IVShmemState *s, int vector)
+{
+    PCIDevice *pdev = PCI_DEVICE(s);
+
+    IVSHMEM_DPRINTF("interrupt on vector %p %d\n", pdev, vector);
+    if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
+        if (msix_enabled(pdev)) {
+            msix_notify(pdev, vector);
+        }
+    } else {
+        ivshmem_IntrStatus_write(s, 1);
+    }
+}
+
+static void ivshmem_vector_coalesce_timer(void *opaque)
+{
+    MSIVector *entry = opaque;
+    IVShmemState *s = IVSHMEM_COMMON(entry->pdev);
+
+    entry->next_irq = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      (int64_t)s->coalesce_us * SCALE_US;
+    ivshmem_vector_raise(s, entry - s->msi_vectors);
+}
+
 static void ivshmem_vector_notify(void *opaque)
 {
     MSIVector *entry = opaque;
@@ -257,19 +286,28 @@ static void ivshmem_vector_notify(void *opaque)
     IVShmemState *s = IVSHMEM_COMMON(pdev);
     int vector = entry - s->msi_vectors;
     EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
+    int64_t now;
 
     if (!event_notifier_test_and_clear(n)) {
         return;
     }
 
-    IVSHMEM_DPRINTF("interrupt on vector %p %d\n", pdev, vector);
-    if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
-        if (msix_enabled(pdev)) {
-            msix_notify(pdev, vector);
+    /*
+     * With coalescing, doorbells that come in less than coalesce_us
+     * after an interrupt share a single one at the end of the interval.
+     */
+    if (s->coalesce_us) {
+        now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        if (now < entry->next_irq) {
+            if (!timer_pending(entry->coalesce_timer)) {
+                timer_mod(entry->coalesce_timer, entry->next_irq);
+            }
+            return;
         }
-    } else {
-        ivshmem_IntrStatus_write(s, 1);
+        entry->next_irq = now + (int64_t)s->coalesce_us * SCALE_US;
     }
+
+    ivshmem_vector_raise(s, vector);
 }
 
 static int ivshmem_vector_unmask(PCIDevice *dev, unsigned vector,
@@ -439,14 +477,29 @@ static void ivshmem_add_kvm_msi_virq(IVShmemState *s, int vector,
     s->msi_vectors[vector].pdev = pdev;
 }
 
+/* Coalescing needs to see each doorbell, so it is done without irqfd */
+static bool ivshmem_use_irqfd(IVShmemState *s)
+{
+    return kvm_msi_via_irqfd_enabled() &&
+        ivshmem_has_feature(s, IVSHMEM_MSI) && !s->coalesce_us;
+}
+
 static void setup_interrupt(IVShmemState *s, int vector, Error **errp)
 {
     EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
-    bool with_irqfd = kvm_msi_via_irqfd_enabled() &&
-        ivshmem_has_feature(s, IVSHMEM_MSI);
+    bool with_irqfd = ivshmem_use_irqfd(s);
     PCIDevice *pdev = PCI_DEVICE(s);
     Error *err = NULL;
 
+    /*
+     * In polling mode nobody listens to our eventfds: doorbells from the
+     * peers only bump their counters, and do not even wake up QEMU.
+     */
+    if (s->poll) {
+        IVSHMEM_DPRINTF("polling, no interrupt for vector: %d\n", vector);
+        return;
+    }
+
     IVSHMEM_DPRINTF("setting up interrupt for vector: %d\n", vector);
 
     if (!with_irqfd) {
@@ -727,9 +780,20 @@ static void ivshmem_reset(DeviceState *d)
 
 static int ivshmem_setup_interrupts(IVShmemState *s, Error **errp)
 {
+    int i;
+
     /* allocate QEMU callback data for receiving interrupts */
     s->msi_vectors = g_malloc0(s->vectors * sizeof(MSIVector));
 
+    if (s->coalesce_us) {
+        for (i = 0; i < s->vectors; i++) {
+            s->msi_vectors[i].coalesce_timer =
+                timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                             ivshmem_vector_coalesce_timer,
+                             &s->msi_vectors[i]);
+        }
+    }
+
     if (ivshmem_has_feature(s, IVSHMEM_MSI)) {
         if (msix_init_exclusive_bar(PCI_DEVICE(s), s->vectors, 1, errp)) {
             return -1;
@@ -820,7 +884,7 @@ static void ivshmem_write_config(PCIDevice *pdev, uint32_t address,
     pci_default_write_config(pdev, address, val, len);
     is_enabled = msix_enabled(pdev);
 
-    if (kvm_msi_via_irqfd_enabled()) {
+    if (ivshmem_use_irqfd(s) && !s->poll) {
         if (!was_enabled && is_enabled) {
             ivshmem_enable_irqfd(s);
         } else if (was_enabled && !is_enabled) {
@@ -956,6 +1020,12 @@ static void ivshmem_exit(PCIDevice *dev)
         msix_uninit_exclusive_bar(dev);
     }
 
+    for (i = 0; s->msi_vectors && i < s->vectors; i++) {
+        if (s->msi_vectors[i].coalesce_timer) {
+            timer_del(s->msi_vectors[i].coalesce_timer);
+            timer_free(s->msi_vectors[i].coalesce_timer);
+        }
+    }
     g_free(s->msi_vectors);
 }
 
@@ -1085,6 +1155,8 @@ static Property ivshmem_doorbell_properties[] = {
     DEFINE_PROP_BIT("ioeventfd", IVShmemState, features, IVSHMEM_IOEVENTFD,
                     true),
     DEFINE_PROP_ON_OFF_AUTO("master", IVShmemState, master, ON_OFF_AUTO_OFF),
+    DEFINE_PROP_BOOL("poll", IVShmemState, poll, false),
+    DEFINE_PROP_UINT32("coalesce-us", IVShmemState, coalesce_us, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -1103,6 +1175,10 @@ static void ivshmem_doorbell_realize(PCIDevice *dev, Error **errp)
         error_setg(errp, "You must specify a 'chardev'");
         return;
     }
+    if (s->poll && s->coalesce_us) {
+        error_setg(errp, "'coalesce-us' has no effect with 'poll'");
+        return;
+    }
 
     ivshmem_common_realize(dev, errp);
 }
@@ -52,6 +52,7 @@
 #define E1000E_MIN_XITR     (500) /* No more then 7813 interrupts per
                                      second according to spec 10.2.4.2 */
 #define E1000E_MAX_TX_FRAGS (64)
+#define E1000E_DESC_BATCH   (16)  /* Descriptors fetched with one DMA */
 
 static inline void
 e1000e_set_interrupt_cause(E1000ECore *core, uint32_t val);
@@ -774,9 +775,14 @@ e1000e_rx_wb_interrupt_cause(E1000ECore *core, int queue_idx,
     return (queue_idx == 0) ? E1000_ICR_RXQ0 : E1000_ICR_RXQ1;
 }
 
+/*
+ * Sets the DD bit of @dp if it has to be written back, which is left to the
+ * caller.  Returns the interrupt causes, which are nonzero iff @dp has to be
+ * written back.
+ */
 static uint32_t
-e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
-                        struct e1000_tx_desc *dp, bool *ide, int queue_idx)
+e1000e_txdesc_writeback(E1000ECore *core, struct e1000_tx_desc *dp,
+                        bool *ide, int queue_idx)
 {
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
@@ -790,8 +796,6 @@ e1000e_txdesc_writeback(E1000ECore *core, dma_addr_t base,
     txd_upper = le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD;
 
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(core->owner, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
     return e1000e_tx_wb_interrupt_cause(core, queue_idx);
 }
 
@@ -855,6 +859,26 @@ e1000e_ring_free_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
     return 0;
 }
 
+/*
+ * Number of 16-byte descriptor slots from the head to the tail or to the
+ * end of the ring, whichever comes first, i.e. how many can be accessed
+ * with a single DMA.  Must only be called on a non-empty ring.
+ */
+static inline uint32_t
+e1000e_ring_contig_descr_num(E1000ECore *core, const E1000E_RingInfo *r)
+{
+    uint32_t ring_size = core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    if (core->mac[r->dh] < core->mac[r->dt]) {
+        return core->mac[r->dt] - core->mac[r->dh];
+    }
+    if (core->mac[r->dh] < ring_size) {
+        return ring_size - core->mac[r->dh];
+    }
+    /* Bogus head; access one descriptor at a time as it wraps around */
+    return 1;
+}
+
 static inline bool
 e1000e_ring_enabled(E1000ECore *core, const E1000E_RingInfo *r)
 {
@@ -913,10 +937,11 @@ static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
-    struct e1000_tx_desc desc;
+    struct e1000_tx_desc desc[E1000E_DESC_BATCH];
     bool ide = false;
     const E1000E_RingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
+    uint32_t n, i, wb_first, wb_last, wb_cause;
 
     if (!(core->mac[TCTL] & E1000_TCTL_EN)) {
         trace_e1000e_tx_disabled();
@@ -925,16 +950,38 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
+        n = MIN(e1000e_ring_contig_descr_num(core, txi), E1000E_DESC_BATCH);
+
+        pci_dma_read(core->owner, base, desc, n * sizeof(desc[0]));
+
+        wb_first = n;
+        wb_last = 0;
+        for (i = 0; i < n; i++) {
+            trace_e1000e_tx_descr((void *)(intptr_t)desc[i].buffer_addr,
+                                  desc[i].lower.data, desc[i].upper.data);
+
+            e1000e_process_tx_desc(core, txr->tx, &desc[i], txi->idx);
+            wb_cause = e1000e_txdesc_writeback(core, &desc[i], &ide,
+                                               txi->idx);
+            if (wb_cause) {
+                cause |= wb_cause;
+                wb_first = MIN(wb_first, i);
+                wb_last = i;
+            }
+        }
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
-
-        trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
-                              desc.lower.data, desc.upper.data);
-
-        e1000e_process_tx_desc(core, txr->tx, &desc, txi->idx);
-        cause |= e1000e_txdesc_writeback(core, base, &desc, &ide, txi->idx);
+        /*
+         * Write the status of the batch back at once.  Descriptors in the
+         * range that need no write back are still owned by the device and
+         * unchanged, so writing them is harmless.
+         */
+        if (wb_first < n) {
+            pci_dma_write(core->owner, base + wb_first * sizeof(desc[0]),
+                          &desc[wb_first],
+                          (wb_last - wb_first + 1) * sizeof(desc[0]));
+        }
 
-        e1000e_ring_advance(core, txi, 1);
+        e1000e_ring_advance(core, txi, n);
     }
 
     if (!ide || !e1000e_intrmgr_delay_tx_causes(core, &cause)) {
@@ -1499,6 +1546,10 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
     PCIDevice *d = core->owner;
     dma_addr_t base;
     uint8_t desc[E1000_MAX_RX_DESC_LEN];
+    /* Descriptors prefetched from the head of the ring */
+    uint8_t desc_cache[E1000E_DESC_BATCH * E1000_MAX_RX_DESC_LEN];
+    uint32_t desc_cached = 0, desc_next = 0;
+    uint32_t desc_slots = core->rx_desc_len / E1000_MIN_RX_DESC_LEN;
     size_t desc_size;
     size_t desc_offset = 0;
     size_t iov_ofs = 0;
@@ -1530,7 +1581,20 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
 
         base = e1000e_ring_head_descr(core, rxi);
 
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+        if (desc_next == desc_cached) {
+            /* Fetch the descriptors the rest of the packet needs at once */
+            desc_cached = DIV_ROUND_UP(total_size - desc_offset,
+                                       core->rx_desc_buf_size);
+            desc_cached = MIN(desc_cached,
+                              e1000e_ring_contig_descr_num(core, rxi) /
+                              desc_slots);
+            desc_cached = MAX(MIN(desc_cached, E1000E_DESC_BATCH), 1);
+            desc_next = 0;
+            pci_dma_read(d, base, desc_cache,
+                         desc_cached * core->rx_desc_len);
+        }
+        memcpy(desc, desc_cache + desc_next++ * core->rx_desc_len,
+               core->rx_desc_len);
 
         trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
 
@@ -1608,8 +1672,7 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                            rss_info, do_ps ? ps_hdr_len : 0, &bastate.written);
         pci_dma_write(d, base, &desc, core->rx_desc_len);
 
-        e1000e_ring_advance(core, rxi,
-                            core->rx_desc_len / E1000_MIN_RX_DESC_LEN);
+        e1000e_ring_advance(core, rxi, desc_slots);
 
     } while (desc_offset < total_size);
 
@@ -27,10 +27,12 @@
 #include "qemu/config-file.h"
 #include "qapi/qmp/qdict.h"
 #include "hw/virtio/virtio-net.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/qdev-properties.h"
 #include "qapi/qapi-types-migration.h"
@@ -44,6 +46,8 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "block/aio.h"
+#include "block/aio-wait.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -54,6 +58,18 @@
 #define VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE 256
 #define VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE 256
 
+/* TX buffers popped from the virtqueue at once */
+#define VIRTIO_NET_TX_MAX_POP 32
+
+/*
+ * With tx=adaptive, kicks wait for the TX timer when at least this many
+ * packets are expected to arrive meanwhile
+ */
+#define VIRTIO_NET_TX_COALESCE_MIN 8
+
+/* Packets RSS may steer to a queue pair in another IOThread before dropping */
+#define VIRTIO_NET_RX_BACKLOG_MAX 256
+
 /* for now, only allow larger queues; with virtio-1, guest can downsize */
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
@@ -117,6 +133,58 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+typedef struct VirtIONetRxPacket {
+    QSIMPLEQ_ENTRY(VirtIONetRxPacket) next;
+    size_t size;
+    uint8_t data[];
+} VirtIONetRxPacket;
+
+/*
+ * Queue pairs that run in IOThreads raise interrupts through the guest
+ * notifier, the main loop one is not thread-safe.
+ */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    if (n->iothreads_started) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(n), vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(n), vq);
+    }
+}
+
+/* The bottom half that flushes the TX virtqueue of @q */
+static QEMUBH *virtio_net_tx_bh_of(VirtIONetQueue *q)
+{
+    return q->n->iothreads_started ? q->iothread_tx_bh : q->tx_bh;
+}
+
+/*
+ * Keep the queue pairs' IOThreads out while the main loop touches state
+ * they use.  IOThreads only ever hold their own AioContext, so taking all
+ * of them here cannot deadlock.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_net_iothreads_acquire(VirtIONet *n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n->num_vq_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->vq_iothreads[i]));
+    }
+}
+
+static void virtio_net_iothreads_release(VirtIONet *n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n->num_vq_iothreads; i++) {
+        aio_context_release(iothread_get_aio_context(n->vq_iothreads[i]));
+    }
+}
+
+static void virtio_net_iothread_status(VirtIONet *n, uint8_t status);
+
 /* TODO
  * - we could suppress RX interrupt if we were so inclined.
  */
@@ -232,6 +300,8 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     NetClientState *nc = qemu_get_queue(n->nic);
     int queues = n->multiqueue ? n->max_queues : 1;
+    int cvq = virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ) ?
+              n->max_ncs - n->max_queues : 0;
 
     if (!get_vhost_net(nc->peer)) {
         return;
@@ -273,14 +343,14 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
         }
 
         n->vhost_started = 1;
-        r = vhost_net_start(vdev, n->nic->ncs, queues);
+        r = vhost_net_start(vdev, n->nic->ncs, queues, cvq);
         if (r < 0) {
             error_report("unable to start vhost net: %d: "
                          "falling back on userspace virtio", -r);
             n->vhost_started = 0;
         }
     } else {
-        vhost_net_stop(vdev, n->nic->ncs, queues);
+        vhost_net_stop(vdev, n->nic->ncs, queues, cvq);
         n->vhost_started = 0;
     }
 }
@@ -342,7 +412,7 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
@@ -355,7 +425,9 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
+    virtio_net_iothread_status(n, status);
 
+    virtio_net_iothreads_acquire(n);
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -378,17 +450,18 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         }
 
         if (queue_started) {
-            if (q->tx_timer) {
+            if (q->tx_bh) {
+                qemu_bh_schedule(virtio_net_tx_bh_of(q));
+            } else {
                 timer_mod(q->tx_timer,
                                qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
-            } else {
-                qemu_bh_schedule(q->tx_bh);
             }
         } else {
             if (q->tx_timer) {
                 timer_del(q->tx_timer);
-            } else {
-                qemu_bh_cancel(q->tx_bh);
+            }
+            if (q->tx_bh) {
+                qemu_bh_cancel(virtio_net_tx_bh_of(q));
             }
             if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
                 (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
@@ -401,6 +474,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    virtio_net_iothreads_release(n);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -1032,6 +1106,45 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static int virtio_net_handle_coal(VirtIONet *n, uint8_t cmd,
+                                  struct iovec *iov, unsigned int iov_cnt)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_ctrl_coal_rx rx;
+    struct virtio_net_ctrl_coal_tx tx;
+    int i;
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL)) {
+        return VIRTIO_NET_ERR;
+    }
+
+    if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_RX_SET) {
+        if (iov_to_buf(iov, iov_cnt, 0, &rx, sizeof(rx)) != sizeof(rx)) {
+            return VIRTIO_NET_ERR;
+        }
+        for (i = 0; i < n->max_queues; i++) {
+            virtio_queue_set_coalescing(n->vqs[i].rx_vq,
+                                        le32_to_cpu(rx.rx_max_packets),
+                                        le32_to_cpu(rx.rx_usecs),
+                                        vdev->coalesce_adaptive);
+        }
+    } else if (cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET) {
+        if (iov_to_buf(iov, iov_cnt, 0, &tx, sizeof(tx)) != sizeof(tx)) {
+            return VIRTIO_NET_ERR;
+        }
+        for (i = 0; i < n->max_queues; i++) {
+            virtio_queue_set_coalescing(n->vqs[i].tx_vq,
+                                        le32_to_cpu(tx.tx_max_packets),
+                                        le32_to_cpu(tx.tx_usecs),
+                                        vdev->coalesce_adaptive);
+        }
+    } else {
+        return VIRTIO_NET_ERR;
+    }
+
+    return VIRTIO_NET_OK;
+}
+
 static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
                                  struct iovec *iov, unsigned int iov_cnt)
 {
@@ -1375,6 +1488,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         iov2 = iov = g_memdup(elem->out_sg, sizeof(struct iovec) * elem->out_num);
         s = iov_to_buf(iov, iov_cnt, 0, &ctrl, sizeof(ctrl));
         iov_discard_front(&iov, &iov_cnt, sizeof(ctrl));
+        virtio_net_iothreads_acquire(n);
         if (s != sizeof(ctrl)) {
             status = VIRTIO_NET_ERR;
         } else if (ctrl.class == VIRTIO_NET_CTRL_RX) {
@@ -1389,7 +1503,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             status = virtio_net_handle_mq(n, ctrl.cmd, iov, iov_cnt);
         } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
             status = virtio_net_handle_offloads(n, ctrl.cmd, iov, iov_cnt);
+        } else if (ctrl.class == VIRTIO_NET_CTRL_NOTF_COAL) {
+            status = virtio_net_handle_coal(n, ctrl.cmd, iov, iov_cnt);
         }
+        virtio_net_iothreads_release(n);
 
         s = iov_from_buf(elem->in_sg, elem->in_num, 0, &status, sizeof(status));
         assert(s == sizeof(status));
@@ -1663,6 +1780,32 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/*
+ * Hand a packet that RSS steered to @q over to the IOThread that owns @q.
+ * Like a full RX ring, a backlog that is too long drops the packet.
+ */
+static ssize_t virtio_net_rx_forward(VirtIONetQueue *q, const uint8_t *buf,
+                                     size_t size)
+{
+    VirtIONetRxPacket *pkt = g_malloc(sizeof(*pkt) + size);
+
+    pkt->size = size;
+    memcpy(pkt->data, buf, size);
+
+    qemu_mutex_lock(&q->rx_backlog_lock);
+    if (q->rx_backlog_len >= VIRTIO_NET_RX_BACKLOG_MAX) {
+        qemu_mutex_unlock(&q->rx_backlog_lock);
+        g_free(pkt);
+        return size;
+    }
+    QSIMPLEQ_INSERT_TAIL(&q->rx_backlog, pkt, next);
+    q->rx_backlog_len++;
+    qemu_mutex_unlock(&q->rx_backlog_lock);
+
+    qemu_bh_schedule(q->rx_bh);
+    return size;
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1682,6 +1825,10 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
+
+            if (n->iothreads_started && n->vqs[index].ctx != q->ctx) {
+                return virtio_net_rx_forward(&n->vqs[index], buf, size);
+            }
             return virtio_net_receive_rcu(nc2, buf, size, true);
         }
     }
@@ -1775,7 +1922,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
 
     return size;
 }
@@ -2399,10 +2546,9 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2411,12 +2557,74 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     virtio_net_flush_tx(q);
 }
 
+/* Return the first @count elements of @elems to the guest, at once */
+static void virtio_net_tx_push(VirtIONetQueue *q, VirtQueueElement **elems,
+                               unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+    virtqueue_push_batch(q->tx_vq, elems, NULL, count);
+    virtio_net_notify(q->n, q->tx_vq);
+    for (i = 0; i < count; i++) {
+        g_free(elems[i]);
+    }
+}
+
+/* Put back @count popped elements that were not looked at */
+static void virtio_net_tx_unpop(VirtIONetQueue *q, VirtQueueElement **elems,
+                                unsigned int count)
+{
+    while (count--) {
+        virtqueue_unpop(q->tx_vq, elems[count], 0);
+        g_free(elems[count]);
+    }
+}
+
+/* Feed the packet rate estimate that tx=adaptive decides on */
+static void virtio_net_tx_account(VirtIONetQueue *q, int32_t num_packets)
+{
+    VirtIONetTxStats *stats = &q->tx_stats;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t delta = now - q->tx_last_flush;
+
+    stats->flushes++;
+    stats->packets += num_packets;
+    if (delta > 0) {
+        uint64_t rate = muldiv64(num_packets, NANOSECONDS_PER_SECOND, delta);
+
+        stats->rate = stats->rate - stats->rate / 8 + rate / 8;
+    }
+    q->tx_last_flush = now;
+    q->tx_last_batch = num_packets;
+}
+
+/*
+ * Coalesce kicks while enough packets are expected within tx_timeout to
+ * make a batch.  If the last flush already found a full burst waiting,
+ * the ring is backed up and waiting would only add latency.
+ */
+static bool virtio_net_tx_should_coalesce(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+
+    if (q->tx_last_batch >= n->tx_burst) {
+        return false;
+    }
+    return q->tx_stats.rate * n->tx_timeout >=
+           (uint64_t)VIRTIO_NET_TX_COALESCE_MIN * NANOSECONDS_PER_SECOND;
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elems[VIRTIO_NET_TX_MAX_POP];
     VirtQueueElement *elem;
+    unsigned int i = 0, popped = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2434,27 +2642,34 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (i == popped) {
+            /* All sent, complete them before looking at the ring again */
+            virtio_net_tx_push(q, elems, popped);
+            if (num_packets >= n->tx_burst) {
+                break;
+            }
+            popped = MIN(VIRTIO_NET_TX_MAX_POP, n->tx_burst - num_packets);
+            popped = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                         (void **)elems, popped);
+            i = 0;
+            if (!popped) {
+                break;
+            }
         }
+        elem = elems[i];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
         if (out_num < 1) {
             virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
+            goto err;
         }
 
         if (n->has_vnet_hdr) {
             if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
                 n->guest_hdr_len) {
                 virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
+                goto err;
             }
             if (n->needs_vnet_hdr_swap) {
                 virtio_net_hdr_swap(vdev, (void *) &mhdr);
@@ -2492,19 +2707,26 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_unpop(q, elems + i + 1, popped - i - 1);
+            virtio_net_tx_push(q, elems, i);
             return -EBUSY;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
-        }
+        i++;
+        num_packets++;
+    }
+    if (n->tx_adaptive && num_packets) {
+        virtio_net_tx_account(q, num_packets);
     }
     return num_packets;
+
+err:
+    virtio_net_tx_unpop(q, elems + i + 1, popped - i - 1);
+    virtqueue_detach_element(q->tx_vq, elem, 0);
+    g_free(elem);
+    virtio_net_tx_push(q, elems, i);
+    return -EINVAL;
 }
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -2557,7 +2779,36 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
     virtio_queue_set_notification(vq, 0);
-    qemu_bh_schedule(q->tx_bh);
+    qemu_bh_schedule(virtio_net_tx_bh_of(q));
+}
+
+static void virtio_net_handle_tx_adaptive(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    if (unlikely((n->status & VIRTIO_NET_S_LINK_UP) == 0)) {
+        virtio_net_drop_tx_queue_data(vdev, vq);
+        return;
+    }
+
+    if (unlikely(q->tx_waiting)) {
+        return;
+    }
+    q->tx_waiting = 1;
+    /* This happens when device was stopped but VCPU wasn't. */
+    if (!vdev->vm_running) {
+        return;
+    }
+    virtio_queue_set_notification(vq, 0);
+    if (virtio_net_tx_should_coalesce(q)) {
+        q->tx_stats.coalesced++;
+        timer_mod(q->tx_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+    } else {
+        q->tx_stats.immediate++;
+        qemu_bh_schedule(q->tx_bh);
+    }
 }
 
 static void virtio_net_tx_timer(void *opaque)
@@ -2613,7 +2864,7 @@ static void virtio_net_tx_bh(void *opaque)
     /* If we flush a full burst of packets, assume there are
      * more coming and immediately reschedule */
     if (ret >= n->tx_burst) {
-        qemu_bh_schedule(q->tx_bh);
+        qemu_bh_schedule(virtio_net_tx_bh_of(q));
         q->tx_waiting = 1;
         return;
     }
@@ -2627,11 +2878,319 @@ static void virtio_net_tx_bh(void *opaque)
         return;
     } else if (ret > 0) {
         virtio_queue_set_notification(q->tx_vq, 0);
-        qemu_bh_schedule(q->tx_bh);
+        qemu_bh_schedule(virtio_net_tx_bh_of(q));
         q->tx_waiting = 1;
     }
 }
 
+/*
+ * Deliver the packets that RSS steered to @q from other IOThreads.
+ *
+ * Context: IOThread that owns @q, with its AioContext acquired
+ */
+static void virtio_net_rx_backlog_flush(VirtIONetQueue *q)
+{
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+    VirtIONetRxPacket *pkt;
+    ssize_t ret;
+
+    RCU_READ_LOCK_GUARD();
+
+    for (;;) {
+        qemu_mutex_lock(&q->rx_backlog_lock);
+        pkt = QSIMPLEQ_FIRST(&q->rx_backlog);
+        qemu_mutex_unlock(&q->rx_backlog_lock);
+        if (!pkt) {
+            break;
+        }
+
+        ret = virtio_net_receive_rcu(nc, pkt->data, pkt->size, true);
+        if (ret == 0) {
+            /* Out of RX buffers, the guest will kick us when it adds some */
+            break;
+        }
+
+        qemu_mutex_lock(&q->rx_backlog_lock);
+        QSIMPLEQ_REMOVE_HEAD(&q->rx_backlog, next);
+        q->rx_backlog_len--;
+        qemu_mutex_unlock(&q->rx_backlog_lock);
+        g_free(pkt);
+    }
+}
+
+static void virtio_net_rx_backlog_purge(VirtIONetQueue *q)
+{
+    VirtIONetRxPacket *pkt;
+
+    qemu_mutex_lock(&q->rx_backlog_lock);
+    while ((pkt = QSIMPLEQ_FIRST(&q->rx_backlog))) {
+        QSIMPLEQ_REMOVE_HEAD(&q->rx_backlog, next);
+        g_free(pkt);
+    }
+    q->rx_backlog_len = 0;
+    qemu_mutex_unlock(&q->rx_backlog_lock);
+}
+
+static void virtio_net_iothread_rx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    aio_context_acquire(q->ctx);
+    virtio_net_rx_backlog_flush(q);
+    aio_context_release(q->ctx);
+}
+
+static void virtio_net_iothread_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    aio_context_acquire(q->ctx);
+    virtio_net_tx_bh(q);
+    aio_context_release(q->ctx);
+}
+
+static bool virtio_net_iothread_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_rx_backlog_flush(q);
+    qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    aio_context_release(q->ctx);
+    return true;
+}
+
+static bool virtio_net_iothread_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    virtio_net_handle_tx_bh(vdev, vq);
+    aio_context_release(q->ctx);
+    return true;
+}
+
+/*
+ * Assign the queue pairs to the IOThreads named in the iothread-vq-mapping
+ * property.
+ *
+ * Context: QEMU global mutex held
+ */
+static bool virtio_net_map_iothreads(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(n)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    virtio_net_conf *conf = &n->net_conf;
+    unsigned int i;
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp, "device is incompatible with iothread-vq-mapping "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread-vq-mapping");
+        return false;
+    }
+    if (n->tx_adaptive || (conf->tx && !strcmp(conf->tx, "timer"))) {
+        error_setg(errp, "iothread-vq-mapping requires tx=bh");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothread-vq-mapping is incompatible with "
+                   "guest_rsc_ext");
+        return false;
+    }
+    for (i = 0; i < n->max_queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (peer && !qemu_has_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' cannot run in an IOThread",
+                       peer->name);
+            return false;
+        }
+    }
+
+    if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping,
+                                   conf->num_iothread_vq_mapping,
+                                   n->max_queues, &n->vq_iothreads,
+                                   &n->num_vq_iothreads, errp)) {
+        return false;
+    }
+    for (i = 0; i < n->max_queues; i++) {
+        n->vqs[i].ctx = iothread_vq_mapping_get_aio_context(n->vq_iothreads,
+                                                            n->num_vq_iothreads,
+                                                            i);
+    }
+    return true;
+}
+
+/*
+ * Move the queue pairs and their backends to the IOThreads.  The control
+ * virtqueue stays in the main loop.  On failure the device keeps running
+ * in the main loop.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_net_iothread_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(n)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int nvqs = queues * 2 + 1;
+    int i, r;
+
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r < 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set; "
+                     "falling back on main loop virtio-net", r);
+        return;
+    }
+
+    r = virtio_device_grab_ioeventfd(vdev);
+    if (r < 0) {
+        error_report("virtio-net failed to grab ioeventfd (%d); "
+                     "falling back on main loop virtio-net", r);
+        goto fail_grab;
+    }
+
+    for (i = 0; i < queues * 2; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r < 0) {
+            error_report("virtio-net failed to set host notifier (%d); "
+                         "falling back on main loop virtio-net", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+            }
+            goto fail_host_notifiers;
+        }
+    }
+
+    n->iothreads_started = true;
+    trace_virtio_net_iothread_start(n, queues);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        aio_context_acquire(q->ctx);
+        qemu_set_aio_context(nc->peer, q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx,
+                virtio_net_iothread_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx,
+                virtio_net_iothread_handle_tx);
+        aio_context_release(q->ctx);
+
+        /* Pick up whatever the guest queued before we got here */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    return;
+
+fail_host_notifiers:
+    virtio_device_release_ioeventfd(vdev);
+fail_grab:
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+}
+
+/*
+ * Stop taking kicks and backend events for @opaque's queue pair.
+ *
+ * Context: BH in the IOThread that owns @opaque
+ */
+static void virtio_net_iothread_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    NetClientState *nc = qemu_get_subqueue(q->n->nic, q - q->n->vqs);
+
+    virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx, NULL);
+    virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx, NULL);
+    qemu_set_aio_context(nc->peer, NULL);
+}
+
+/*
+ * Cancel work queued for @opaque's queue pair.  tx_waiting is left alone
+ * so that virtio_net_set_status() reschedules TX in the main loop.
+ *
+ * Context: BH in the IOThread that owns @opaque
+ */
+static void virtio_net_iothread_cancel_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    qemu_bh_cancel(q->iothread_tx_bh);
+    qemu_bh_cancel(q->rx_bh);
+    virtio_net_rx_backlog_purge(q);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_iothread_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(n)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    trace_virtio_net_iothread_stop(n);
+
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        aio_wait_bh_oneshot(q->ctx, virtio_net_iothread_stop_bh, q);
+        aio_context_release(q->ctx);
+    }
+
+    /*
+     * Only now can no IOThread steer packets to another queue pair, so
+     * the backlogs stay empty after this.
+     */
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        aio_wait_bh_oneshot(q->ctx, virtio_net_iothread_cancel_bh, q);
+        aio_context_release(q->ctx);
+    }
+
+    n->iothreads_started = false;
+
+    for (i = 0; i < queues * 2; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+    virtio_device_release_ioeventfd(vdev);
+
+    k->set_guest_notifiers(qbus->parent, queues * 2 + 1, false);
+}
+
+/* IOThreads are only used for backends that QEMU itself drives */
+static void virtio_net_iothread_status(VirtIONet *n, uint8_t status)
+{
+    NetClientState *nc = qemu_get_queue(n->nic);
+
+    if (!n->num_vq_iothreads || get_vhost_net(nc->peer)) {
+        return;
+    }
+
+    if (virtio_net_started(n, status) == n->iothreads_started) {
+        return;
+    }
+    if (!n->iothreads_started) {
+        virtio_net_iothread_start(n);
+    } else {
+        virtio_net_iothread_stop(n);
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2646,6 +3205,15 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
                                               virtio_net_tx_timer,
                                               &n->vqs[index]);
+    } else if (n->tx_adaptive) {
+        n->vqs[index].tx_vq =
+            virtio_add_queue(vdev, n->net_conf.tx_queue_size,
+                             virtio_net_handle_tx_adaptive);
+        /* When the timer fires, the flush continues like the bottom half */
+        n->vqs[index].tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                              virtio_net_tx_bh,
+                                              &n->vqs[index]);
+        n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     } else {
         n->vqs[index].tx_vq =
             virtio_add_queue(vdev, n->net_conf.tx_queue_size,
@@ -2653,6 +3221,16 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    if (n->vqs[index].ctx) {
+        VirtIONetQueue *q = &n->vqs[index];
+
+        q->iothread_tx_bh = aio_bh_new(q->ctx, virtio_net_iothread_tx_bh, q);
+        q->rx_bh = aio_bh_new(q->ctx, virtio_net_iothread_rx_bh, q);
+        qemu_mutex_init(&q->rx_backlog_lock);
+        QSIMPLEQ_INIT(&q->rx_backlog);
+        q->rx_backlog_len = 0;
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2670,10 +3248,19 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         timer_del(q->tx_timer);
         timer_free(q->tx_timer);
         q->tx_timer = NULL;
-    } else {
+    }
+    if (q->tx_bh) {
         qemu_bh_delete(q->tx_bh);
         q->tx_bh = NULL;
     }
+    if (q->ctx) {
+        qemu_bh_delete(q->iothread_tx_bh);
+        q->iothread_tx_bh = NULL;
+        qemu_bh_delete(q->rx_bh);
+        q->rx_bh = NULL;
+        virtio_net_rx_backlog_purge(q);
+        qemu_mutex_destroy(&q->rx_backlog_lock);
+    }
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
 }
@@ -3059,10 +3646,26 @@ static NetClientInfo net_virtio_info = {
     .announce = virtio_net_announce,
 };
 
+/*
+ * Without VIRTIO_NET_F_MQ the control virtqueue is at index 2, but a
+ * backend that handles it still does so through the peer that follows
+ * all of the queue pairs.
+ */
+static NetClientState *virtio_net_get_notifier_nc(VirtIONet *n, int idx)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) &&
+        virtio_vdev_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ) && idx == 2) {
+        return qemu_get_subqueue(n->nic, n->max_queues);
+    }
+    return qemu_get_subqueue(n->nic, vq2q(idx));
+}
+
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
-    NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
+    NetClientState *nc = virtio_net_get_notifier_nc(n, idx);
     assert(n->vhost_started);
     return vhost_net_virtqueue_pending(get_vhost_net(nc->peer), idx);
 }
@@ -3071,7 +3674,7 @@ static void virtio_net_guest_notifier_mask(VirtIODevice *vdev, int idx,
                                            bool mask)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
-    NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
+    NetClientState *nc = virtio_net_get_notifier_nc(n, idx);
     assert(n->vhost_started);
     vhost_net_virtqueue_mask(get_vhost_net(nc->peer),
                              vdev, idx, mask);
@@ -3328,7 +3931,19 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
-    n->max_queues = MAX(n->nic_conf.peers.queues, 1);
+    n->max_ncs = MAX(n->nic_conf.peers.queues, 1);
+
+    /*
+     * Only the datapath peers are queue pairs: the backend may provide
+     * the control virtqueue through a peer as well.
+     */
+    n->max_queues = 0;
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        if (n->nic_conf.peers.ncs[i]->is_datapath) {
+            n->max_queues++;
+        }
+    }
+    n->max_queues = MAX(n->max_queues, 1);
     if (n->max_queues * 2 + 1 > VIRTIO_QUEUE_MAX) {
         error_setg(errp, "Invalid number of queues (= %" PRIu32 "), "
                    "must be a positive integer less than %d.",
@@ -3341,16 +3956,26 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->tx_timeout = n->net_conf.txtimer;
 
     if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
-                       && strcmp(n->net_conf.tx, "bh")) {
+                       && strcmp(n->net_conf.tx, "bh")
+                       && strcmp(n->net_conf.tx, "adaptive")) {
         warn_report("virtio-net: "
-                    "Unknown option tx=%s, valid options: \"timer\" \"bh\"",
+                    "Unknown option tx=%s, valid options: "
+                    "\"timer\" \"bh\" \"adaptive\"",
                     n->net_conf.tx);
         error_printf("Defaulting to \"bh\"");
     }
+    n->tx_adaptive = n->net_conf.tx && !strcmp(n->net_conf.tx, "adaptive");
 
     n->net_conf.tx_queue_size = MIN(virtio_net_max_tx_queue_size(n),
                                     n->net_conf.tx_queue_size);
 
+    if (n->net_conf.num_iothread_vq_mapping &&
+        !virtio_net_map_iothreads(n, errp)) {
+        g_free(n->vqs);
+        virtio_cleanup(vdev);
+        return;
+    }
+
     for (i = 0; i < n->max_queues; i++) {
         virtio_net_add_queue(n, i);
     }
@@ -3438,6 +4063,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_del_queue(vdev, max_queues * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
     g_free(n->vqs);
+    iothread_vq_mapping_cleanup(&n->vq_iothreads, &n->num_vq_iothreads);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
@@ -3445,6 +4071,42 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_cleanup(vdev);
 }
 
+static void virtio_net_get_tx_stats(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    VirtIONet *n = VIRTIO_NET(obj);
+    int queues = n->vqs ? (n->multiqueue ? n->max_queues : 1) : 0;
+    Error *err = NULL;
+    int i;
+
+    if (!visit_start_list(v, name, NULL, 0, errp)) {
+        return;
+    }
+    for (i = 0; i < queues; i++) {
+        VirtIONetTxStats stats = n->vqs[i].tx_stats;
+
+        if (!visit_start_struct(v, NULL, NULL, 0, &err)) {
+            goto out;
+        }
+        if (visit_type_uint64(v, "immediate", &stats.immediate, &err) &&
+            visit_type_uint64(v, "coalesced", &stats.coalesced, &err) &&
+            visit_type_uint64(v, "flushes", &stats.flushes, &err) &&
+            visit_type_uint64(v, "packets", &stats.packets, &err) &&
+            visit_type_uint64(v, "rate", &stats.rate, &err)) {
+            visit_check_struct(v, &err);
+        }
+        visit_end_struct(v, NULL);
+        if (err) {
+            goto out;
+        }
+    }
+    visit_check_list(v, &err);
+out:
+    visit_end_list(v, NULL);
+    error_propagate(errp, err);
+}
+
 static void virtio_net_instance_init(Object *obj)
 {
     VirtIONet *n = VIRTIO_NET(obj);
@@ -3457,6 +4119,8 @@ static void virtio_net_instance_init(Object *obj)
     device_add_bootindex_property(obj, &n->nic_conf.bootindex,
                                   "bootindex", "/ethernet-phy@0",
                                   DEVICE(n));
+    object_property_add(obj, "tx-stats", "VirtIONetTxStats",
+                        virtio_net_get_tx_stats, NULL, NULL, NULL);
 }
 
 static int virtio_net_pre_save(void *opaque)
@@ -3549,6 +4213,10 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
+    DEFINE_PROP_BIT64("in_order", VirtIONet, host_features,
+                    VIRTIO_F_IN_ORDER, false),
+    DEFINE_PROP_BIT64("notf_coal", VirtIONet, host_features,
+                    VIRTIO_NET_F_NOTF_COAL, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
@@ -3556,6 +4224,9 @@ static Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_ARRAY("iothread-vq-mapping", VirtIONet,
+                      net_conf.num_iothread_vq_mapping,
+                      net_conf.iothread_vq_mapping, qdev_prop_string, char *),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -19,6 +19,7 @@
 #include "hw/pci/msix.h"
 #include "hw/pci/pci.h"
 #include "hw/xen/xen.h"
+#include "sysemu/kvm.h"
 #include "sysemu/xen.h"
 #include "migration/qemu-file-types.h"
 #include "migration/vmstate.h"
@@ -168,10 +169,13 @@ void msix_write_config(PCIDevice *dev, uint32_t addr,
         return;
     }
 
+    /* vector notifiers may update KVM routes; commit them once */
+    kvm_irqchip_begin_route_changes(kvm_state);
     for (vector = 0; vector < dev->msix_entries_nr; ++vector) {
         msix_handle_mask_update(dev, vector,
                                 msix_vector_masked(dev, vector, was_masked));
     }
+    kvm_irqchip_end_route_changes(kvm_state);
 }
 
 static uint64_t msix_table_mmio_read(void *opaque, hwaddr addr,
@@ -462,9 +466,11 @@ void msix_load(PCIDevice *dev, QEMUFile *f)
     qemu_get_buffer(f, dev->msix_pba, DIV_ROUND_UP(n, 8));
     msix_update_function_masked(dev);
 
+    kvm_irqchip_begin_route_changes(kvm_state);
     for (vector = 0; vector < n; vector++) {
         msix_handle_mask_update(dev, vector, true);
     }
+    kvm_irqchip_end_route_changes(kvm_state);
 }
 
 /* Does device support MSI-X? */
@@ -591,12 +597,14 @@ int msix_set_vector_notifiers(PCIDevice *dev,
 
     if ((dev->config[dev->msix_cap + MSIX_CONTROL_OFFSET] &
         (MSIX_ENABLE_MASK | MSIX_MASKALL_MASK)) == MSIX_ENABLE_MASK) {
+        kvm_irqchip_begin_route_changes(kvm_state);
         for (vector = 0; vector < dev->msix_entries_nr; vector++) {
             ret = msix_set_notifier_for_vector(dev, vector);
             if (ret < 0) {
                 goto undo;
             }
         }
+        kvm_irqchip_end_route_changes(kvm_state);
     }
     if (dev->msix_vector_poll_notifier) {
         dev->msix_vector_poll_notifier(dev, 0, dev->msix_entries_nr);
@@ -607,6 +615,7 @@ undo:
     while (--vector >= 0) {
         msix_unset_notifier_for_vector(dev, vector);
     }
+    kvm_irqchip_end_route_changes(kvm_state);
     dev->msix_vector_use_notifier = NULL;
     dev->msix_vector_release_notifier = NULL;
     return ret;
@@ -14,12 +14,14 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "hw/virtio/virtio-scsi.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qemu/error-report.h"
 #include "sysemu/block-backend.h"
 #include "hw/scsi/scsi.h"
 #include "scsi/constants.h"
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
+#include "block/aio-wait.h"
 
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
@@ -28,8 +30,21 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread && vs->conf.num_iothread_vq_mapping) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                   "cannot be set at the same time");
+        return;
+    }
+    if (vs->conf.num_iothread_vq_mapping > vs->conf.num_queues) {
+        error_setg(errp, "iothread-vq-mapping has %" PRIu32 " entries, "
+                   "but there are only %" PRIu32 " request virtqueues",
+                   vs->conf.num_iothread_vq_mapping, vs->conf.num_queues);
+        return;
+    }
+
+    if (vs->conf.iothread || vs->conf.num_iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -40,15 +55,53 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
-        s->ctx = iothread_get_aio_context(vs->conf.iothread);
-    } else {
-        if (!virtio_device_ioeventfd_enabled(vdev)) {
+    } else if (!virtio_device_ioeventfd_enabled(vdev)) {
+        return;
+    }
+
+    s->vq_aio_context = g_new(AioContext *, vs->conf.num_queues);
+
+    if (vs->conf.num_iothread_vq_mapping) {
+        if (!iothread_vq_mapping_apply(vs->conf.iothread_vq_mapping,
+                                       vs->conf.num_iothread_vq_mapping,
+                                       vs->conf.num_queues, &s->vq_iothreads,
+                                       &s->num_vq_iothreads, errp)) {
+            virtio_scsi_dataplane_cleanup(s);
             return;
         }
-        s->ctx = qemu_get_aio_context();
+        for (i = 0; i < vs->conf.num_queues; i++) {
+            s->vq_aio_context[i] =
+                iothread_vq_mapping_get_aio_context(s->vq_iothreads,
+                                                    s->num_vq_iothreads, i);
+        }
+        /*
+         * The SCSI devices' BlockBackends live in the first mapped
+         * IOThread, so does the handling of the ctrl and event virtqueues.
+         * Requests from other virtqueues are submitted under its AioContext
+         * lock, which also keeps TMFs and resets serialized against them.
+         */
+        s->ctx = s->vq_aio_context[0];
+    } else {
+        if (vs->conf.iothread) {
+            s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < vs->conf.num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
 }
 
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    iothread_vq_mapping_cleanup(&s->vq_iothreads, &s->num_vq_iothreads);
+    g_free(s->vq_aio_context);
+    s->vq_aio_context = NULL;
+    s->ctx = NULL;
+}
+
 static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
                                               VirtQueue *vq)
 {
@@ -89,7 +142,7 @@ static bool virtio_scsi_data_plane_handle_event(VirtIODevice *vdev,
 }
 
 static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
-                                  VirtIOHandleAIOOutput fn)
+                                  AioContext *ctx, VirtIOHandleAIOOutput fn)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s)));
     int rc;
@@ -103,21 +156,38 @@ static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
         return rc;
     }
 
-    virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, fn);
+    aio_context_acquire(ctx);
+    virtio_queue_aio_set_host_notifier_handler(vq, ctx, fn);
+    aio_context_release(ctx);
     return 0;
 }
 
-/* Context: BH in IOThread */
-static void virtio_scsi_dataplane_stop_bh(void *opaque)
+/* Context: BH in the IOThread that handles @opaque's virtqueue */
+static void virtio_scsi_dataplane_stop_vq_bh(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    virtio_queue_aio_set_host_notifier_handler(vq,
+            qemu_get_current_aio_context(), NULL);
+}
+
+static void virtio_scsi_dataplane_stop_vq(VirtQueue *vq, AioContext *ctx)
+{
+    aio_context_acquire(ctx);
+    aio_wait_bh_oneshot(ctx, virtio_scsi_dataplane_stop_vq_bh, vq);
+    aio_context_release(ctx);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_scsi_dataplane_stop_vqs(VirtIOSCSI *s)
 {
-    VirtIOSCSI *s = opaque;
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
     int i;
 
-    virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, s->ctx, NULL);
-    virtio_queue_aio_set_host_notifier_handler(vs->event_vq, s->ctx, NULL);
+    virtio_scsi_dataplane_stop_vq(vs->ctrl_vq, s->ctx);
+    virtio_scsi_dataplane_stop_vq(vs->event_vq, s->ctx);
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx, NULL);
+        virtio_scsi_dataplane_stop_vq(vs->cmd_vqs[i], s->vq_aio_context[i]);
     }
 }
 
@@ -148,18 +218,19 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
     }
 
     aio_context_acquire(s->ctx);
-    rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0,
+    rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0, s->ctx,
                                 virtio_scsi_data_plane_handle_ctrl);
     if (rc) {
         goto fail_vrings;
     }
-    rc = virtio_scsi_vring_init(s, vs->event_vq, 1,
+    rc = virtio_scsi_vring_init(s, vs->event_vq, 1, s->ctx,
                                 virtio_scsi_data_plane_handle_event);
     if (rc) {
         goto fail_vrings;
     }
     for (i = 0; i < vs->conf.num_queues; i++) {
         rc = virtio_scsi_vring_init(s, vs->cmd_vqs[i], i + 2,
+                                    s->vq_aio_context[i],
                                     virtio_scsi_data_plane_handle_cmd);
         if (rc) {
             goto fail_vrings;
@@ -172,8 +243,8 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
     return 0;
 
 fail_vrings:
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
     aio_context_release(s->ctx);
+    virtio_scsi_dataplane_stop_vqs(s);
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
@@ -207,9 +278,7 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
-    aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_stop_vqs(s);
 
     blk_drain_all(); /* ensure there are no in-flight requests */
 
@@ -21,6 +21,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/timer.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/queue.h"
 #include "migration/vmstate.h"
@@ -294,6 +295,9 @@ struct XHCIEPContext {
     unsigned int interval;
     int64_t mfindex_last;
     QEMUTimer *kick_timer;
+
+    /* one kick for a batch of completions, see xhci_complete */
+    QEMUBH *kick_bh;
 };
 
 typedef struct XHCIEvRingSeg {
@@ -1036,6 +1040,15 @@ static void xhci_ep_kick_timer(void *opaque)
     xhci_kick_epctx(epctx, 0);
 }
 
+static void xhci_ep_kick_bh(void *opaque)
+{
+    XHCIEPContext *epctx = opaque;
+
+    if (!epctx->kick_active) {
+        xhci_kick_epctx(epctx, 0);
+    }
+}
+
 static XHCIEPContext *xhci_alloc_epctx(XHCIState *xhci,
                                        unsigned int slotid,
                                        unsigned int epid)
@@ -1049,6 +1062,7 @@ static XHCIEPContext *xhci_alloc_epctx(XHCIState *xhci,
 
     QTAILQ_INIT(&epctx->transfers);
     epctx->kick_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_ep_kick_timer, epctx);
+    epctx->kick_bh = qemu_bh_new(xhci_ep_kick_bh, epctx);
 
     return epctx;
 }
@@ -1202,6 +1216,7 @@ static int xhci_ep_nuke_xfers(XHCIState *xhci, unsigned int slotid,
         }
         xhci_ep_free_xfer(xfer);
     }
+    qemu_bh_cancel(epctx->kick_bh);
 
     ep = xhci_epid_to_usbep(epctx);
     if (ep) {
@@ -1241,6 +1256,7 @@ static TRBCCode xhci_disable_ep(XHCIState *xhci, unsigned int slotid,
     }
 
     timer_free(epctx->kick_timer);
+    qemu_bh_delete(epctx->kick_bh);
     g_free(epctx);
     slot->eps[epid-1] = NULL;
 
@@ -3200,7 +3216,15 @@ static void xhci_complete(USBPort *port, USBPacket *packet)
         return;
     }
     xhci_try_complete_packet(xfer);
-    xhci_kick_epctx(xfer->epctx, xfer->streamid);
+    if (xfer->epctx->nr_pstreams) {
+        xhci_kick_epctx(xfer->epctx, xfer->streamid);
+    } else {
+        /*
+         * Pipelined devices complete several packets in a row, e.g. all
+         * those of a combined transfer.  Look at the ring once for all.
+         */
+        qemu_bh_schedule(xfer->epctx->kick_bh);
+    }
     if (xfer->complete) {
         xhci_ep_free_xfer(xfer);
     }
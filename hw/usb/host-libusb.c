@@ -132,6 +132,7 @@ struct USBHostRequest {
     unsigned char                    *cbuf;
     unsigned int                     clen;
     bool                             usb3ep0quirk;
+    bool                             unsubmitted;
     QTAILQ_ENTRY(USBHostRequest)     next;
 };
 
@@ -468,11 +469,17 @@ static void usb_host_req_abort(USBHostRequest *r)
                                     r->p->status, r->p->actual_length);
         if (r->p->ep->nr == 0) {
             usb_generic_async_ctrl_complete(USB_DEVICE(s), r->p);
+        } else if (usb_host_use_combining(r->p->ep)) {
+            usb_combined_input_packet_complete(USB_DEVICE(s), r->p);
         } else {
             usb_packet_complete(USB_DEVICE(s), r->p);
         }
         r->p = NULL;
+    }
 
+    if (r->unsubmitted) {
+        usb_host_req_free(r);
+    } else {
         libusb_cancel_transfer(r->xfer);
     }
 }
@@ -811,6 +818,29 @@ static void usb_host_speed_compat(USBHostDevice *s)
     }
 }
 
+/*
+ * Let the HCD queue several packets on bulk endpoints, so that several
+ * transfers are in flight.  Input packets are combined into transfers
+ * as large as the guest allows, except on endpoints with streams where
+ * each stream has its own packets.
+ */
+static void usb_host_set_pipeline(USBHostDevice *s, USBEndpoint *uep)
+{
+    if (!(s->options & (1 << USB_HOST_OPT_PIPELINE))) {
+        return;
+    }
+    if (uep->type != USB_ENDPOINT_XFER_BULK) {
+        return;
+    }
+    if (uep->pid == USB_TOKEN_OUT) {
+        uep->pipeline = true;
+    }
+    if (uep->pid == USB_TOKEN_IN && uep->max_packet_size != 0 &&
+        uep->max_streams == 0) {
+        uep->pipeline = true;
+    }
+}
+
 static void usb_host_ep_update(USBHostDevice *s)
 {
     static const char *tname[] = {
@@ -880,6 +910,7 @@ static void usb_host_ep_update(USBHostDevice *s)
                 libusb_free_ss_endpoint_companion_descriptor(endp_ss_comp);
             }
 #endif
+            usb_host_set_pipeline(s, usb_ep_get(udev, pid, ep));
         }
     }
 
@@ -1550,7 +1581,16 @@ static void usb_host_handle_data(USBDevice *udev, USBPacket *p)
     }
 
     rc = libusb_submit_transfer(r->xfer);
-    if (rc != 0) {
+    if (rc != 0 && usb_host_use_combining(p->ep)) {
+        /*
+         * usb_ep_combine_input_packets() needs the packet to go async.
+         * Close the device, which completes it with USB_RET_NODEV.
+         */
+        usb_host_libusb_error("libusb_submit_transfer [bulk]", rc);
+        r->unsubmitted = true;
+        usb_host_nodev(s);
+    } else if (rc != 0) {
+        usb_host_req_free(r);
         p->status = USB_RET_NODEV;
         trace_usb_host_req_complete(s->bus_num, s->addr, p,
                                     p->status, p->actual_length);
@@ -33,6 +33,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/thread.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
 #include "trace.h"
@@ -498,6 +499,32 @@ out:
     rcu_read_unlock();
 }
 
+static void vfio_listener_fail(VFIOContainer *container, MemoryRegion *mr,
+                               Error *err)
+{
+    if (memory_region_is_ram_device(mr)) {
+        error_free(err);
+        error_report("failed to vfio_dma_map. pci p2p may not work");
+        return;
+    }
+    /*
+     * On the initfn path, store the first error in the container so we
+     * can gracefully fail.  Runtime, there's not much we can do other
+     * than throw a hardware error.
+     */
+    if (!container->initialized) {
+        if (!container->error) {
+            error_propagate_prepend(&container->error, err,
+                                    "Region %s: ", memory_region_name(mr));
+        } else {
+            error_free(err);
+        }
+    } else {
+        error_report_err(err);
+        hw_error("vfio: DMA mapping failed, unable to continue");
+    }
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -671,44 +698,32 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (!memory_region_is_ram_device(section->mr)) {
+        VFIODMAPending *pending = g_new(VFIODMAPending, 1);
+
+        pending->iova = iova;
+        pending->size = int128_get64(llsize);
+        pending->vaddr = vaddr;
+        pending->readonly = section->readonly;
+        pending->mr = section->mr;
+        QSIMPLEQ_INSERT_TAIL(&container->pending_maps, pending, next);
+        return;
+    }
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
         error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
                    "0x%"HWADDR_PRIx", %p) = %d (%m)",
                    container, iova, int128_get64(llsize), vaddr, ret);
-        if (memory_region_is_ram_device(section->mr)) {
-            /* Allow unexpected mappings not to be fatal for RAM devices */
-            error_report_err(err);
-            return;
-        }
-        goto fail;
+        /* Allow unexpected mappings not to be fatal for RAM devices */
+        error_report_err(err);
     }
 
     return;
 
 fail:
-    if (memory_region_is_ram_device(section->mr)) {
-        error_report("failed to vfio_dma_map. pci p2p may not work");
-        return;
-    }
-    /*
-     * On the initfn path, store the first error in the container so we
-     * can gracefully fail.  Runtime, there's not much we can do other
-     * than throw a hardware error.
-     */
-    if (!container->initialized) {
-        if (!container->error) {
-            error_propagate_prepend(&container->error, err,
-                                    "Region %s: ",
-                                    memory_region_name(section->mr));
-        } else {
-            error_free(err);
-        }
-    } else {
-        error_report_err(err);
-        hw_error("vfio: DMA mapping failed, unable to continue");
-    }
+    vfio_listener_fail(container, section->mr, err);
 }
 
 static void vfio_listener_region_del(MemoryListener *listener,
@@ -812,9 +827,138 @@ static void vfio_listener_region_del(MemoryListener *listener,
     }
 }
 
+/*
+ * Mappings of guest RAM are not issued from region_add but when the
+ * transaction commits, once the memory they cover has been faulted in
+ * by several threads.  VFIO_IOMMU_MAP_DMA pins the pages one by one and
+ * the type1 backend serializes the maps of a container, so populating
+ * the memory is the only part of the job that can be spread across host
+ * CPUs; pinning pages that are already present is then much cheaper.
+ */
+#define VFIO_PREFAULT_CHUNK     (1ULL << 30)
+#define VFIO_PREFAULT_THREADS   16
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ      22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE     23
+#endif
+
+typedef struct VFIOPrefaultChunk {
+    void *vaddr;
+    size_t size;
+    bool readonly;
+} VFIOPrefaultChunk;
+
+typedef struct VFIOPrefault {
+    VFIOPrefaultChunk *chunks;
+    unsigned nr_chunks;
+    unsigned next;
+} VFIOPrefault;
+
+static void *vfio_prefault_thread(void *opaque)
+{
+    VFIOPrefault *p = opaque;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&p->next)) < p->nr_chunks) {
+        VFIOPrefaultChunk *chunk = &p->chunks[i];
+
+        /*
+         * Failures are not fatal: VFIO_IOMMU_MAP_DMA faults in whatever
+         * is left and reports the errors.
+         */
+        if (madvise(chunk->vaddr, chunk->size,
+                    chunk->readonly ? MADV_POPULATE_READ
+                                    : MADV_POPULATE_WRITE) &&
+            errno == EINVAL) {
+            /* not supported by the host kernel */
+            qatomic_set(&p->next, p->nr_chunks);
+        }
+    }
+    return NULL;
+}
+
+static void vfio_prefault_pending(VFIOContainer *container)
+{
+    VFIODMAPending *pending;
+    VFIOPrefault p = { };
+    QemuThread *threads;
+    uint64_t total = 0;
+    long nr_threads;
+    ram_addr_t off;
+    unsigned i;
+
+    QSIMPLEQ_FOREACH(pending, &container->pending_maps, next) {
+        total += pending->size;
+        p.nr_chunks += DIV_ROUND_UP(pending->size, VFIO_PREFAULT_CHUNK);
+    }
+
+    nr_threads = MIN(sysconf(_SC_NPROCESSORS_ONLN), VFIO_PREFAULT_THREADS);
+    nr_threads = MIN(nr_threads, p.nr_chunks);
+    if (nr_threads < 2) {
+        return;
+    }
+
+    p.chunks = g_new(VFIOPrefaultChunk, p.nr_chunks);
+    i = 0;
+    QSIMPLEQ_FOREACH(pending, &container->pending_maps, next) {
+        for (off = 0; off < pending->size; off += VFIO_PREFAULT_CHUNK) {
+            p.chunks[i].vaddr = pending->vaddr + off;
+            p.chunks[i].size = MIN(pending->size - off, VFIO_PREFAULT_CHUNK);
+            p.chunks[i].readonly = pending->readonly;
+            i++;
+        }
+    }
+
+    trace_vfio_listener_commit_prefault(total, nr_threads);
+    threads = g_new(QemuThread, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "vfio-prefault", vfio_prefault_thread,
+                           &p, QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+    g_free(p.chunks);
+}
+
+static void vfio_listener_commit(MemoryListener *listener)
+{
+    VFIOContainer *container = container_of(listener, VFIOContainer, listener);
+    VFIODMAPending *pending;
+    Error *err = NULL;
+    int ret;
+
+    if (QSIMPLEQ_EMPTY(&container->pending_maps)) {
+        return;
+    }
+
+    vfio_prefault_pending(container);
+
+    while ((pending = QSIMPLEQ_FIRST(&container->pending_maps))) {
+        QSIMPLEQ_REMOVE_HEAD(&container->pending_maps, next);
+
+        ret = vfio_dma_map(container, pending->iova, pending->size,
+                           pending->vaddr, pending->readonly);
+        if (ret) {
+            error_setg(&err, "vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
+                       "0x%"HWADDR_PRIx", %p) = %d (%m)",
+                       container, pending->iova, pending->size,
+                       pending->vaddr, ret);
+            vfio_listener_fail(container, pending->mr, err);
+            err = NULL;
+        }
+        g_free(pending);
+    }
+}
+
 static const MemoryListener vfio_memory_listener = {
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
+    .commit = vfio_listener_commit,
 };
 
 static void vfio_listener_release(VFIOContainer *container)
@@ -1275,6 +1419,7 @@ static int vfio_connect_container(VFIOGroup *group, AddressSpace *as,
     container->error = NULL;
     QLIST_INIT(&container->giommu_list);
     QLIST_INIT(&container->hostwin_list);
+    QSIMPLEQ_INIT(&container->pending_maps);
 
     ret = vfio_init_container(container, group->fd, errp);
     if (ret) {
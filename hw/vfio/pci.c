@@ -607,6 +607,8 @@ static void vfio_msi_enable(VFIOPCIDevice *vdev)
 retry:
     vdev->msi_vectors = g_new0(VFIOMSIVector, vdev->nr_vectors);
 
+    /* commit the routes of all vectors at once */
+    kvm_irqchip_begin_route_changes(kvm_state);
     for (i = 0; i < vdev->nr_vectors; i++) {
         VFIOMSIVector *vector = &vdev->msi_vectors[i];
 
@@ -627,6 +629,7 @@ retry:
          */
         vfio_add_kvm_msi_virq(vdev, vector, i, false);
     }
+    kvm_irqchip_end_route_changes(kvm_state);
 
     /* Set interrupt type prior to possible interrupts */
     vdev->interrupt = VFIO_INT_MSI;
@@ -0,0 +1,61 @@
+/*
+ * Mapping of virtqueues to IOThreads (iothread-vq-mapping property)
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/virtio/iothread-vq-mapping.h"
+
+bool iothread_vq_mapping_apply(char **ids, uint32_t num_ids,
+                               uint32_t num_queues, IOThread ***iothreads,
+                               unsigned *num_iothreads, Error **errp)
+{
+    IOThread **array;
+    unsigned i;
+
+    *iothreads = NULL;
+    *num_iothreads = 0;
+
+    if (num_ids > num_queues) {
+        error_setg(errp, "iothread-vq-mapping has %" PRIu32 " entries, "
+                   "but there are only %" PRIu32 " queues to map",
+                   num_ids, num_queues);
+        return false;
+    }
+
+    array = g_new0(IOThread *, num_ids);
+
+    for (i = 0; i < num_ids; i++) {
+        IOThread *iothread = ids[i] ? iothread_by_id(ids[i]) : NULL;
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" not found in "
+                       "iothread-vq-mapping", ids[i] ? ids[i] : "");
+            iothread_vq_mapping_cleanup(&array, &i);
+            return false;
+        }
+
+        object_ref(OBJECT(iothread));
+        array[i] = iothread;
+    }
+
+    *iothreads = array;
+    *num_iothreads = num_ids;
+    return true;
+}
+
+void iothread_vq_mapping_cleanup(IOThread ***iothreads,
+                                 unsigned *num_iothreads)
+{
+    unsigned i;
+
+    for (i = 0; i < *num_iothreads; i++) {
+        object_unref(OBJECT((*iothreads)[i]));
+    }
+    g_free(*iothreads);
+    *iothreads = NULL;
+    *num_iothreads = 0;
+}
@@ -12,14 +12,17 @@
  */
 
 #include "qemu/osdep.h"
+#include "qapi/error.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/vhost-user-fs.h"
+#include "standard-headers/linux/virtio_fs.h"
 #include "virtio-pci.h"
 #include "qom/object.h"
 
 struct VHostUserFSPCI {
     VirtIOPCIProxy parent_obj;
     VHostUserFS vdev;
+    MemoryRegion cachebar;
 };
 
 typedef struct VHostUserFSPCI VHostUserFSPCI;
@@ -35,17 +38,43 @@ static Property vhost_user_fs_pci_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+/* BAR 2 is only used by virtio-pci for modern-pio-notify */
+#define VIRTIO_FS_PCI_CACHE_BAR 2
+
 static void vhost_user_fs_pci_realize(VirtIOPCIProxy *vpci_dev, Error **errp)
 {
     VHostUserFSPCI *dev = VHOST_USER_FS_PCI(vpci_dev);
     DeviceState *vdev = DEVICE(&dev->vdev);
+    uint64_t cache_size = dev->vdev.conf.cache_size;
 
     if (vpci_dev->nvectors == DEV_NVECTORS_UNSPECIFIED) {
         /* Also reserve config change and hiprio queue vectors */
         vpci_dev->nvectors = dev->vdev.conf.num_request_queues + 2;
     }
 
-    qdev_realize(vdev, BUS(&vpci_dev->bus), errp);
+    if (cache_size &&
+        (vpci_dev->flags & VIRTIO_PCI_FLAG_MODERN_PIO_NOTIFY)) {
+        error_setg(errp, "cache-size cannot be used with modern-pio-notify");
+        return;
+    }
+
+    if (!qdev_realize(vdev, BUS(&vpci_dev->bus), errp)) {
+        return;
+    }
+
+    if (cache_size) {
+        /* cache-size is a power of 2, so it can be the size of the BAR */
+        memory_region_init(&dev->cachebar, OBJECT(vpci_dev),
+                           "vhost-user-fs-pci-cachebar", cache_size);
+        memory_region_add_subregion(&dev->cachebar, 0, &dev->vdev.cache);
+        virtio_pci_add_shm_cap(vpci_dev, VIRTIO_FS_PCI_CACHE_BAR, 0,
+                               cache_size, VIRTIO_FS_SHMCAP_ID_CACHE);
+        pci_register_bar(&vpci_dev->pci_dev, VIRTIO_FS_PCI_CACHE_BAR,
+                         PCI_BASE_ADDRESS_SPACE_MEMORY |
+                         PCI_BASE_ADDRESS_MEM_PREFETCH |
+                         PCI_BASE_ADDRESS_MEM_TYPE_64,
+                         &dev->cachebar);
+    }
 }
 
 static void vhost_user_fs_pci_class_init(ObjectClass *klass, void *data)
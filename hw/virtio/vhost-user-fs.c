@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "standard-headers/linux/virtio_fs.h"
 #include "qapi/error.h"
 #include "hw/qdev-properties.h"
@@ -22,6 +23,141 @@
 #include "hw/virtio/vhost-user-fs.h"
 #include "monitor/monitor.h"
 
+/*
+ * Replace [@offset, @offset + @len) of the DAX cache window with an
+ * inaccessible anonymous mapping, dropping whatever file was mapped there.
+ */
+static int vuf_cache_clear(VHostUserFS *fs, uint64_t offset, uint64_t len)
+{
+    void *ptr = memory_region_get_ram_ptr(&fs->cache) + offset;
+
+    if (mmap(ptr, len, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+             -1, 0) != ptr) {
+        return -errno;
+    }
+    return 0;
+}
+
+static VHostUserFS *vuf_from_vhost_dev(struct vhost_dev *dev)
+{
+    VHostUserFS *fs;
+
+    if (!dev->vdev) {
+        return NULL;
+    }
+    fs = (VHostUserFS *)object_dynamic_cast(OBJECT(dev->vdev),
+                                            TYPE_VHOST_USER_FS);
+    if (!fs || !fs->conf.cache_size) {
+        return NULL;
+    }
+    return fs;
+}
+
+static bool vuf_cache_range_valid(VHostUserFS *fs, uint64_t offset,
+                                  uint64_t len)
+{
+    return offset < fs->conf.cache_size &&
+           len <= fs->conf.cache_size - offset;
+}
+
+int vhost_user_fs_slave_map(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm,
+                            int fd)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    void *cache_host;
+    unsigned int i;
+
+    if (!fs) {
+        error_report("vhost-user-fs: map request without a DAX cache window");
+        return -1;
+    }
+    if (fd < 0) {
+        error_report("vhost-user-fs: map request without a file descriptor");
+        return -1;
+    }
+
+    cache_host = memory_region_get_ram_ptr(&fs->cache);
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        int prot = 0;
+        void *ptr;
+
+        if (!sm->len[i]) {
+            continue;
+        }
+        if (!vuf_cache_range_valid(fs, sm->c_offset[i], sm->len[i])) {
+            error_report("vhost-user-fs: map of [0x%" PRIx64 ", +0x%" PRIx64
+                         ") is outside the DAX cache window",
+                         sm->c_offset[i], sm->len[i]);
+            break;
+        }
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_R) {
+            prot |= PROT_READ;
+        }
+        if (sm->flags[i] & VHOST_USER_FS_FLAG_MAP_W) {
+            prot |= PROT_WRITE;
+        }
+
+        ptr = mmap(cache_host + sm->c_offset[i], sm->len[i], prot,
+                   MAP_SHARED | MAP_FIXED, fd, sm->fd_offset[i]);
+        if (ptr != cache_host + sm->c_offset[i]) {
+            error_report("vhost-user-fs: map of [0x%" PRIx64 ", +0x%" PRIx64
+                         ") failed: %s", sm->c_offset[i], sm->len[i],
+                         strerror(errno));
+            break;
+        }
+    }
+
+    if (i < VHOST_USER_FS_SLAVE_ENTRIES) {
+        /* Do not leave a half-applied request behind */
+        vhost_user_fs_slave_unmap(dev, sm);
+        return -1;
+    }
+    return 0;
+}
+
+int vhost_user_fs_slave_unmap(struct vhost_dev *dev, VhostUserFSSlaveMsg *sm)
+{
+    VHostUserFS *fs = vuf_from_vhost_dev(dev);
+    unsigned int i;
+    int ret = 0;
+
+    if (!fs) {
+        error_report("vhost-user-fs: unmap request without a DAX cache "
+                     "window");
+        return -1;
+    }
+
+    for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES; i++) {
+        uint64_t offset = sm->c_offset[i];
+        uint64_t len = sm->len[i];
+        int err;
+
+        if (!len) {
+            continue;
+        }
+        if (len == UINT64_MAX) {
+            /* Special case meaning the whole window */
+            offset = 0;
+            len = fs->conf.cache_size;
+        }
+        if (!vuf_cache_range_valid(fs, offset, len)) {
+            error_report("vhost-user-fs: unmap of [0x%" PRIx64 ", +0x%" PRIx64
+                         ") is outside the DAX cache window", offset, len);
+            ret = -1;
+            continue;
+        }
+
+        err = vuf_cache_clear(fs, offset, len);
+        if (err < 0) {
+            error_report("vhost-user-fs: unmap of [0x%" PRIx64 ", +0x%" PRIx64
+                         ") failed: %s", offset, len, strerror(-err));
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
 static void vuf_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VHostUserFS *fs = VHOST_USER_FS(vdev);
@@ -97,6 +233,14 @@ static void vuf_stop(VirtIODevice *vdev)
 
     vhost_dev_stop(&fs->vhost_dev, vdev);
 
+    /* The daemon's mappings do not survive it being stopped */
+    if (fs->conf.cache_size) {
+        ret = vuf_cache_clear(fs, 0, fs->conf.cache_size);
+        if (ret < 0) {
+            error_report("Error clearing DAX cache window: %d", -ret);
+        }
+    }
+
     ret = k->set_guest_notifiers(qbus->parent, fs->vhost_dev.nvqs, false);
     if (ret < 0) {
         error_report("vhost guest notifier cleanup failed: %d", ret);
@@ -161,6 +305,7 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VHostUserFS *fs = VHOST_USER_FS(dev);
+    void *cache_ptr;
     unsigned int i;
     size_t len;
     int ret;
@@ -201,6 +346,14 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (fs->conf.cache_size &&
+        (!is_power_of_2(fs->conf.cache_size) ||
+         fs->conf.cache_size < qemu_real_host_page_size)) {
+        error_setg(errp, "cache-size property must be a power of 2 "
+                   "no smaller than the page size");
+        return;
+    }
+
     if (!vhost_user_init(&fs->vhost_user, &fs->conf.chardev, errp)) {
         return;
     }
@@ -227,8 +380,26 @@ static void vuf_device_realize(DeviceState *dev, Error **errp)
         goto err_virtio;
     }
 
+    if (fs->conf.cache_size) {
+        /*
+         * The DAX cache window starts out inaccessible; the daemon maps
+         * host files into it on request.
+         */
+        cache_ptr = mmap(NULL, fs->conf.cache_size, PROT_NONE,
+                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (cache_ptr == MAP_FAILED) {
+            error_setg_errno(errp, errno, "Unable to mmap DAX cache window");
+            goto err_vhost;
+        }
+        memory_region_init_ram_device_ptr(&fs->cache, OBJECT(vdev),
+                                          "virtio-fs-cache",
+                                          fs->conf.cache_size, cache_ptr);
+    }
+
     return;
 
+err_vhost:
+    vhost_dev_cleanup(&fs->vhost_dev);
 err_virtio:
     vhost_user_cleanup(&fs->vhost_user);
     virtio_delete_queue(fs->hiprio_vq);
@@ -262,6 +433,10 @@ static void vuf_device_unrealize(DeviceState *dev)
     virtio_cleanup(vdev);
     g_free(fs->vhost_dev.vqs);
     fs->vhost_dev.vqs = NULL;
+
+    if (fs->conf.cache_size) {
+        munmap(memory_region_get_ram_ptr(&fs->cache), fs->conf.cache_size);
+    }
 }
 
 static const VMStateDescription vuf_vmstate = {
@@ -275,6 +450,7 @@ static Property vuf_properties[] = {
     DEFINE_PROP_UINT16("num-request-queues", VHostUserFS,
                        conf.num_request_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VHostUserFS, conf.queue_size, 128),
+    DEFINE_PROP_SIZE("cache-size", VHostUserFS, conf.cache_size, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
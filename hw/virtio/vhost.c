@@ -463,11 +463,12 @@ static void vhost_commit(MemoryListener *listener)
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
     MemoryRegionSection *old_sections;
+    struct vhost_memory *old_mem = NULL;
     int n_old_sections;
     uint64_t log_size;
     size_t regions_size;
     int r;
-    int i;
+    int i, j;
     bool changed = false;
 
     /* Note we can be called before the device is started, but then
@@ -498,10 +499,12 @@ static void vhost_commit(MemoryListener *listener)
     }
 
     /* Rebuild the regions list from the new sections list */
+    old_mem = dev->mem;
     regions_size = offsetof(struct vhost_memory, regions) +
                        dev->n_mem_sections * sizeof dev->mem->regions[0];
-    dev->mem = g_realloc(dev->mem, regions_size);
+    dev->mem = g_malloc(regions_size);
     dev->mem->nregions = dev->n_mem_sections;
+    dev->mem->padding = 0;
     used_memslots = dev->mem->nregions;
     for (i = 0; i < dev->n_mem_sections; i++) {
         struct vhost_memory_region *cur_vmr = dev->mem->regions + i;
@@ -515,15 +518,40 @@ static void vhost_commit(MemoryListener *listener)
         cur_vmr->flags_padding   = 0;
     }
 
+    /*
+     * Sections can change without changing what the backend sees, e.g.
+     * when a MemoryRegion is replaced by an alias of the same RAM.
+     */
+    if (old_mem && old_mem->nregions == dev->mem->nregions &&
+        !memcmp(old_mem->regions, dev->mem->regions,
+                dev->mem->nregions * sizeof dev->mem->regions[0])) {
+        trace_vhost_commit_same_table(dev->mem->nregions);
+        goto out;
+    }
+
     if (!dev->started) {
         goto out;
     }
 
-    for (i = 0; i < dev->mem->nregions; i++) {
+    /*
+     * Regions that were already in the table were checked when they were
+     * added; both tables are sorted by guest address.
+     */
+    for (i = 0, j = 0; i < dev->mem->nregions; i++) {
+        struct vhost_memory_region *reg = dev->mem->regions + i;
+
+        while (old_mem && j < old_mem->nregions &&
+               old_mem->regions[j].guest_phys_addr < reg->guest_phys_addr) {
+            j++;
+        }
+        if (old_mem && j < old_mem->nregions &&
+            !memcmp(&old_mem->regions[j], reg, sizeof(*reg))) {
+            continue;
+        }
         if (vhost_verify_ring_mappings(dev,
-                       (void *)(uintptr_t)dev->mem->regions[i].userspace_addr,
-                       dev->mem->regions[i].guest_phys_addr,
-                       dev->mem->regions[i].memory_size)) {
+                       (void *)(uintptr_t)reg->userspace_addr,
+                       reg->guest_phys_addr,
+                       reg->memory_size)) {
             error_report("Verify ring failure on region %d", i);
             abort();
         }
@@ -562,6 +590,7 @@ out:
         memory_region_unref(old_sections[n_old_sections].mr);
     }
     g_free(old_sections);
+    g_free(old_mem);
     return;
 }
 
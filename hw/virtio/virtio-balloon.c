@@ -320,14 +320,159 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/*
+ * Free page reports are discarded by report_thread, one batch of
+ * elements at a time: the ranges of a batch are sorted and merged first,
+ * so that the guest's reports of adjacent blocks (typically 2 MiB or
+ * 4 MiB each) become a single madvise() or fallocate() call that can
+ * drop whole huge pages.  The elements only go back to the guest once
+ * their memory has been discarded, from report_bh in the main loop.
+ */
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+    bool discarded;
+} BalloonReportRange;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Sort the ranges of the batch and merge the adjacent ones */
+static void balloon_report_merge_ranges(GArray *ranges)
+{
+    BalloonReportRange *prev, *cur;
+    guint i, n = 0;
+
+    g_array_sort(ranges, balloon_report_range_cmp);
+    for (i = 0; i < ranges->len; i++) {
+        cur = &g_array_index(ranges, BalloonReportRange, i);
+        prev = n ? &g_array_index(ranges, BalloonReportRange, n - 1) : NULL;
+        if (prev && prev->rb == cur->rb &&
+            prev->offset + prev->size >= cur->offset) {
+            prev->size = MAX(prev->size, cur->offset + cur->size - prev->offset);
+            continue;
+        }
+        g_array_index(ranges, BalloonReportRange, n++) = *cur;
+    }
+    g_array_set_size(ranges, n);
+}
+
+static void *virtio_balloon_report_thread(void *opaque)
+{
+    VirtIOBalloon *dev = opaque;
+    BalloonReportRange *range;
+    guint i;
+
+    qemu_mutex_lock(&dev->report_lock);
+    while (true) {
+        while (!dev->report_queued && !dev->report_quit) {
+            qemu_cond_wait(&dev->report_cond, &dev->report_lock);
+        }
+        if (dev->report_quit) {
+            break;
+        }
+        qemu_mutex_unlock(&dev->report_lock);
+
+        for (i = 0; i < dev->report_ranges->len; i++) {
+            range = &g_array_index(dev->report_ranges, BalloonReportRange, i);
+            trace_virtio_balloon_report_discard(range->offset, range->size);
+            range->discarded = !ram_block_discard_range(range->rb,
+                                                        range->offset,
+                                                        range->size);
+        }
+
+        qemu_mutex_lock(&dev->report_lock);
+        dev->report_queued = false;
+        qemu_cond_broadcast(&dev->report_cond);
+        qemu_bh_schedule(dev->report_bh);
+    }
+    qemu_mutex_unlock(&dev->report_lock);
+    return NULL;
+}
+
+/*
+ * Give the elements of the batch back to the guest, once report_thread
+ * is done with it.
+ */
+static void virtio_balloon_report_complete(VirtIOBalloon *dev)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    BalloonReportRange *range;
+    guint i;
+
+    if (!dev->report_busy) {
+        return;
+    }
+
+    qemu_mutex_lock(&dev->report_lock);
+    while (dev->report_queued) {
+        qemu_cond_wait(&dev->report_cond, &dev->report_lock);
+    }
+    qemu_mutex_unlock(&dev->report_lock);
+
+    if (qatomic_read(&dev->free_page_report_migrating)) {
+        for (i = 0; i < dev->report_ranges->len; i++) {
+            range = &g_array_index(dev->report_ranges, BalloonReportRange, i);
+            if (range->discarded) {
+                qemu_guest_free_page_report(qemu_ram_get_host_addr(range->rb) +
+                                            range->offset, range->size);
+            }
+        }
+    }
+    g_array_set_size(dev->report_ranges, 0);
+
+    for (i = 0; i < dev->report_elems->len; i++) {
+        VirtQueueElement *elem = g_ptr_array_index(dev->report_elems, i);
+
+        virtqueue_push(dev->reporting_vq, elem, 0);
+        g_free(elem);
+    }
+    g_ptr_array_set_size(dev->report_elems, 0);
+    virtio_notify(vdev, dev->reporting_vq);
+    dev->report_busy = false;
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_bh(void *opaque)
+{
+    VirtIOBalloon *dev = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+
+    virtio_balloon_report_complete(dev);
+
+    /* pick up the reports that arrived in the meantime */
+    if (vdev->vm_running) {
+        virtio_balloon_handle_report(vdev, dev->reporting_vq);
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
 
+    /* virtio_balloon_report_bh() comes back here when the batch is done */
+    if (dev->report_busy) {
+        return;
+    }
+
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(dev->report_elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -336,14 +481,14 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
-            size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
+            BalloonReportRange range = {
+                .size = elem->in_sg[i].iov_len,
+            };
 
             /*
              * There is no need to check the memory section to see if
@@ -356,8 +501,8 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * will return NULL after the first bounce buffer and fail
              * to map any resources.
              */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
+            range.rb = qemu_ram_block_from_host(addr, false, &range.offset);
+            if (!range.rb) {
                 trace_virtio_balloon_bad_addr(elem->in_addr[i]);
                 continue;
             }
@@ -366,19 +511,32 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * For now we will simply ignore unaligned memory regions, or
              * regions that overrun the end of the RAMBlock.
              */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            if (!QEMU_IS_ALIGNED(range.offset | range.size,
+                                 qemu_ram_pagesize(range.rb)) ||
+                (range.offset + range.size) >
+                qemu_ram_get_used_length(range.rb)) {
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            g_array_append_val(dev->report_ranges, range);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!dev->report_elems->len) {
+        return;
+    }
+
+    dev->report_busy = true;
+    if (!dev->report_ranges->len) {
+        virtio_balloon_report_complete(dev);
+        return;
     }
+
+    balloon_report_merge_ranges(dev->report_ranges);
+    qemu_mutex_lock(&dev->report_lock);
+    dev->report_queued = true;
+    qemu_cond_signal(&dev->report_cond);
+    qemu_mutex_unlock(&dev->report_lock);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -690,6 +848,43 @@ virtio_balloon_free_page_hint_notify(NotifierWithReturn *n, void *data)
     return 0;
 }
 
+/*
+ * Reported pages read back as zeroes, which the guest doesn't mind unless
+ * it poisons free pages.  As long as it doesn't, reported pages need not
+ * be migrated at all: whatever the destination has is as good.
+ */
+static bool virtio_balloon_free_page_report_support(VirtIOBalloon *dev)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+
+    return virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_REPORTING) &&
+           !virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_PAGE_POISON);
+}
+
+static int
+virtio_balloon_free_page_report_notify(NotifierWithReturn *n, void *data)
+{
+    VirtIOBalloon *dev = container_of(n, VirtIOBalloon,
+                                      free_page_report_notify);
+    PrecopyNotifyData *pnd = data;
+
+    switch (pnd->reason) {
+    case PRECOPY_NOTIFY_SETUP:
+        if (virtio_balloon_free_page_report_support(dev)) {
+            precopy_enable_free_page_optimization();
+            qatomic_set(&dev->free_page_report_migrating, true);
+        }
+        break;
+    case PRECOPY_NOTIFY_CLEANUP:
+        qatomic_set(&dev->free_page_report_migrating, false);
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
 static size_t virtio_balloon_config_size(VirtIOBalloon *s)
 {
     uint64_t features = s->host_features;
@@ -918,6 +1113,17 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     if (virtio_has_feature(s->host_features, VIRTIO_BALLOON_F_REPORTING)) {
         s->reporting_vq = virtio_add_queue(vdev, 32,
                                            virtio_balloon_handle_report);
+        precopy_add_notifier(&s->free_page_report_notify);
+
+        s->report_elems = g_ptr_array_new();
+        s->report_ranges = g_array_new(false, false,
+                                       sizeof(BalloonReportRange));
+        s->report_bh = qemu_bh_new(virtio_balloon_report_bh, s);
+        qemu_mutex_init(&s->report_lock);
+        qemu_cond_init(&s->report_cond);
+        qemu_thread_create(&s->report_thread, "balloon-report",
+                           virtio_balloon_report_thread, s,
+                           QEMU_THREAD_JOINABLE);
     }
 
     reset_stats(s);
@@ -944,6 +1150,19 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
         virtio_delete_queue(s->free_page_vq);
     }
     if (s->reporting_vq) {
+        virtio_balloon_report_complete(s);
+        qemu_mutex_lock(&s->report_lock);
+        s->report_quit = true;
+        qemu_cond_signal(&s->report_cond);
+        qemu_mutex_unlock(&s->report_lock);
+        qemu_thread_join(&s->report_thread);
+        qemu_cond_destroy(&s->report_cond);
+        qemu_mutex_destroy(&s->report_lock);
+        qemu_bh_delete(s->report_bh);
+        g_array_free(s->report_ranges, true);
+        g_ptr_array_free(s->report_elems, true);
+
+        precopy_remove_notifier(&s->free_page_report_notify);
         virtio_delete_queue(s->reporting_vq);
     }
     virtio_cleanup(vdev);
@@ -957,6 +1176,10 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         virtio_balloon_free_page_stop(s);
     }
 
+    if (s->reporting_vq) {
+        virtio_balloon_report_complete(s);
+    }
+
     if (s->stats_vq_elem != NULL) {
         virtqueue_unpop(s->svq, s->stats_vq_elem, 0);
         g_free(s->stats_vq_elem);
@@ -977,6 +1200,11 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
         virtio_balloon_receive_stats(vdev, s->svq);
     }
 
+    /* Do not leave reports in flight while the device state is saved */
+    if (!vdev->vm_running && s->reporting_vq) {
+        virtio_balloon_report_complete(s);
+    }
+
     if (virtio_balloon_free_page_support(s)) {
         /*
          * The VM is woken up and the iothread was blocked, so signal it to
@@ -1006,6 +1234,7 @@ static void virtio_balloon_instance_init(Object *obj)
     qemu_cond_init(&s->free_page_cond);
     s->free_page_hint_cmd_id = VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN;
     s->free_page_hint_notify.notify = virtio_balloon_free_page_hint_notify;
+    s->free_page_report_notify.notify = virtio_balloon_free_page_report_notify;
 
     object_property_add(obj, "guest-stats", "guest statistics",
                         balloon_stats_get_all, NULL, NULL, s);
@@ -12,14 +12,18 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 
+#include "block/aio-wait.h"
 #include "hw/virtio/virtio.h"
+#include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-crypto.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "hw/qdev-properties.h"
 #include "hw/virtio/virtio-access.h"
 #include "standard-headers/linux/virtio_ids.h"
@@ -37,6 +41,37 @@ static inline int virtio_crypto_vq2q(int queue_index)
     return queue_index;
 }
 
+static VirtIOCryptoQueue *virtio_crypto_get_queue(VirtIOCrypto *vcrypto,
+                                                  VirtQueue *vq)
+{
+    return &vcrypto->vqs[virtio_crypto_vq2q(virtio_get_queue_index(vq))];
+}
+
+/*
+ * Keep the data queues' IOThreads out while the main loop touches the
+ * sessions they use.  IOThreads only ever hold their own AioContext, so
+ * taking all of them here cannot deadlock.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_crypto_iothreads_acquire(VirtIOCrypto *vcrypto)
+{
+    unsigned int i;
+
+    for (i = 0; i < vcrypto->num_vq_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(vcrypto->vq_iothreads[i]));
+    }
+}
+
+static void virtio_crypto_iothreads_release(VirtIOCrypto *vcrypto)
+{
+    unsigned int i;
+
+    for (i = 0; i < vcrypto->num_vq_iothreads; i++) {
+        aio_context_release(iothread_get_aio_context(vcrypto->vq_iothreads[i]));
+    }
+}
+
 static int
 virtio_crypto_cipher_session_helper(VirtIODevice *vdev,
            CryptoDevBackendSymSessionInfo *info,
@@ -227,6 +262,8 @@ static void virtio_crypto_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     uint8_t status;
     size_t s;
 
+    virtio_crypto_iothreads_acquire(vcrypto);
+
     for (;;) {
         g_autofree struct iovec *out_iov_copy = NULL;
 
@@ -327,6 +364,8 @@ static void virtio_crypto_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
         g_free(elem);
     } /* end for loop */
+
+    virtio_crypto_iothreads_release(vcrypto);
 }
 
 static void virtio_crypto_init_request(VirtIOCrypto *vcrypto, VirtQueue *vq,
@@ -397,6 +436,23 @@ virtio_crypto_sym_input_data_helper(VirtIODevice *vdev,
     }
 }
 
+/*
+ * Data queues that run in IOThreads raise interrupts through the guest
+ * notifier, the main loop one is not thread-safe.
+ */
+static void virtio_crypto_notify(VirtIOCryptoQueue *q)
+{
+    VirtIOCrypto *vcrypto = q->vcrypto;
+
+    if (q->batching) {
+        q->notify_pending = true;
+    } else if (vcrypto->iothreads_started) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(vcrypto), q->dataq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(vcrypto), q->dataq);
+    }
+}
+
 static void virtio_crypto_req_complete(VirtIOCryptoReq *req, uint8_t status)
 {
     VirtIOCrypto *vcrypto = req->vcrypto;
@@ -408,7 +464,20 @@ static void virtio_crypto_req_complete(VirtIOCryptoReq *req, uint8_t status)
     }
     stb_p(&req->in->status, status);
     virtqueue_push(req->vq, &req->elem, req->in_len);
-    virtio_notify(vdev, req->vq);
+    virtio_crypto_notify(virtio_crypto_get_queue(vcrypto, req->vq));
+}
+
+/* Context: the AioContext of the request's data queue */
+static void virtio_crypto_sym_op_done(void *opaque, int ret)
+{
+    VirtIOCryptoReq *req = opaque;
+    VirtIOCryptoQueue *q = virtio_crypto_get_queue(req->vcrypto, req->vq);
+
+    virtio_crypto_req_complete(req, ret < 0 ? -ret : ret);
+    virtio_crypto_free_request(req);
+
+    qatomic_dec(&q->inflight);
+    aio_wait_kick();
 }
 
 static VirtIOCryptoReq *
@@ -585,6 +654,7 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
     VirtIODevice *vdev = VIRTIO_DEVICE(vcrypto);
     VirtQueueElement *elem = &request->elem;
     int queue_index = virtio_crypto_vq2q(virtio_get_queue_index(request->vq));
+    VirtIOCryptoQueue *q = &vcrypto->vqs[queue_index];
     struct virtio_crypto_op_data_req req;
     int ret;
     g_autofree struct iovec *in_iov_copy = NULL;
@@ -660,18 +730,22 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
             /* Set request's parameter */
             request->flags = CRYPTODEV_BACKEND_ALG_SYM;
             request->u.sym_op_info = sym_op_info;
+
+            /* The backend may complete the request before returning */
+            qatomic_inc(&q->inflight);
             ret = cryptodev_backend_crypto_operation(vcrypto->cryptodev,
-                                    request, queue_index, &local_err);
+                                    request, queue_index,
+                                    virtio_crypto_sym_op_done, request,
+                                    &local_err);
             if (ret < 0) {
+                qatomic_dec(&q->inflight);
                 status = -ret;
                 if (local_err) {
                     error_report_err(local_err);
                 }
-            } else { /* ret == VIRTIO_CRYPTO_OK */
-                status = ret;
+                virtio_crypto_req_complete(request, status);
+                virtio_crypto_free_request(request);
             }
-            virtio_crypto_req_complete(request, status);
-            virtio_crypto_free_request(request);
         }
         break;
     case VIRTIO_CRYPTO_HASH:
@@ -718,6 +792,11 @@ static void virtio_crypto_dataq_bh(void *opaque)
         return;
     }
 
+    /*
+     * Submit everything the guest queued before raising a single
+     * interrupt for the requests that completed meanwhile.
+     */
+    q->batching = true;
     for (;;) {
         virtio_crypto_handle_dataq(vdev, q->dataq);
         virtio_queue_set_notification(q->dataq, 1);
@@ -729,6 +808,24 @@ static void virtio_crypto_dataq_bh(void *opaque)
 
         virtio_queue_set_notification(q->dataq, 0);
     }
+    q->batching = false;
+
+    if (q->notify_pending) {
+        q->notify_pending = false;
+        virtio_crypto_notify(q);
+    }
+}
+
+static bool virtio_crypto_iothread_handle_dataq(VirtIODevice *vdev,
+                                                VirtQueue *vq)
+{
+    VirtIOCryptoQueue *q = virtio_crypto_get_queue(VIRTIO_CRYPTO(vdev), vq);
+
+    aio_context_acquire(q->ctx);
+    virtio_queue_set_notification(vq, 0);
+    virtio_crypto_dataq_bh(q);
+    aio_context_release(q->ctx);
+    return true;
 }
 
 static void
@@ -746,6 +843,176 @@ virtio_crypto_handle_dataq_bh(VirtIODevice *vdev, VirtQueue *vq)
     qemu_bh_schedule(q->dataq_bh);
 }
 
+/*
+ * Assign the data queues to the IOThreads named in the iothread-vq-mapping
+ * property.
+ *
+ * Context: QEMU global mutex held
+ */
+static bool virtio_crypto_map_iothreads(VirtIOCrypto *vcrypto, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vcrypto);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vcrypto)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    VirtIOCryptoConf *conf = &vcrypto->conf;
+    unsigned int i;
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp, "device is incompatible with iothread-vq-mapping "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread-vq-mapping");
+        return false;
+    }
+
+    if (!iothread_vq_mapping_apply(conf->iothread_vq_mapping,
+                                   conf->num_iothread_vq_mapping,
+                                   vcrypto->max_queues,
+                                   &vcrypto->vq_iothreads,
+                                   &vcrypto->num_vq_iothreads, errp)) {
+        return false;
+    }
+    for (i = 0; i < vcrypto->max_queues; i++) {
+        vcrypto->vqs[i].ctx =
+            iothread_vq_mapping_get_aio_context(vcrypto->vq_iothreads,
+                                                vcrypto->num_vq_iothreads, i);
+    }
+    return true;
+}
+
+/*
+ * Move the data queues to the IOThreads.  The control virtqueue stays in
+ * the main loop.  On failure the device keeps running in the main loop.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_crypto_iothread_start(VirtIOCrypto *vcrypto)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vcrypto);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vcrypto)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = vcrypto->max_queues;
+    int i, r;
+
+    /* The guest notifier mask hooks are only for vhost */
+    vdev->use_guest_notifier_mask = false;
+
+    r = k->set_guest_notifiers(qbus->parent, queues + 1, true);
+    if (r < 0) {
+        vdev->use_guest_notifier_mask = true;
+        error_report("virtio-crypto failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set; "
+                     "falling back on main loop virtio-crypto", r);
+        return;
+    }
+
+    r = virtio_device_grab_ioeventfd(vdev);
+    if (r < 0) {
+        error_report("virtio-crypto failed to grab ioeventfd (%d); "
+                     "falling back on main loop virtio-crypto", r);
+        goto fail_grab;
+    }
+
+    for (i = 0; i < queues; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r < 0) {
+            error_report("virtio-crypto failed to set host notifier (%d); "
+                         "falling back on main loop virtio-crypto", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+            }
+            goto fail_host_notifiers;
+        }
+    }
+
+    vcrypto->iothreads_started = true;
+
+    for (i = 0; i < queues; i++) {
+        VirtIOCryptoQueue *q = &vcrypto->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        virtio_queue_aio_set_host_notifier_handler(q->dataq, q->ctx,
+                virtio_crypto_iothread_handle_dataq);
+        aio_context_release(q->ctx);
+
+        /* Pick up whatever the guest queued before we got here */
+        event_notifier_set(virtio_queue_get_host_notifier(q->dataq));
+    }
+    return;
+
+fail_host_notifiers:
+    virtio_device_release_ioeventfd(vdev);
+fail_grab:
+    k->set_guest_notifiers(qbus->parent, queues + 1, false);
+    vdev->use_guest_notifier_mask = true;
+}
+
+/* Context: BH in the IOThread that owns @opaque */
+static void virtio_crypto_iothread_stop_bh(void *opaque)
+{
+    VirtIOCryptoQueue *q = opaque;
+
+    virtio_queue_aio_set_host_notifier_handler(q->dataq, q->ctx, NULL);
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_crypto_iothread_stop(VirtIOCrypto *vcrypto)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vcrypto);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vcrypto)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = vcrypto->max_queues;
+    int i;
+
+    for (i = 0; i < queues; i++) {
+        VirtIOCryptoQueue *q = &vcrypto->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        aio_wait_bh_oneshot(q->ctx, virtio_crypto_iothread_stop_bh, q);
+        /* Completions still need the guest notifier */
+        AIO_WAIT_WHILE(q->ctx, qatomic_read(&q->inflight) > 0);
+        aio_context_release(q->ctx);
+    }
+
+    vcrypto->iothreads_started = false;
+
+    for (i = 0; i < queues; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+    virtio_device_release_ioeventfd(vdev);
+
+    k->set_guest_notifiers(qbus->parent, queues + 1, false);
+    vdev->use_guest_notifier_mask = true;
+}
+
+static bool virtio_crypto_started(VirtIOCrypto *c, uint8_t status);
+
+/* IOThreads are only used for backends that QEMU itself drives */
+static void virtio_crypto_iothread_status(VirtIOCrypto *vcrypto,
+                                          uint8_t status)
+{
+    CryptoDevBackend *b = vcrypto->cryptodev;
+
+    if (!vcrypto->num_vq_iothreads ||
+        cryptodev_get_vhost(b->conf.peers.ccs[0], b, 0)) {
+        return;
+    }
+
+    if (virtio_crypto_started(vcrypto, status) ==
+        vcrypto->iothreads_started) {
+        return;
+    }
+    if (!vcrypto->iothreads_started) {
+        virtio_crypto_iothread_start(vcrypto);
+    } else {
+        virtio_crypto_iothread_stop(vcrypto);
+    }
+}
+
 static uint64_t virtio_crypto_get_features(VirtIODevice *vdev,
                                            uint64_t features,
                                            Error **errp)
@@ -756,6 +1023,13 @@ static uint64_t virtio_crypto_get_features(VirtIODevice *vdev,
 static void virtio_crypto_reset(VirtIODevice *vdev)
 {
     VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(vdev);
+    int i;
+
+    /* Wait for the backend to hand back the requests it still has */
+    for (i = 0; i < vcrypto->max_queues; i++) {
+        AIO_WAIT_WHILE(NULL, qatomic_read(&vcrypto->vqs[i].inflight) > 0);
+    }
+
     /* multiqueue is disabled by default */
     vcrypto->curr_queues = 1;
     if (!cryptodev_backend_is_ready(vcrypto->cryptodev)) {
@@ -819,6 +1093,18 @@ static void virtio_crypto_device_realize(DeviceState *dev, Error **errp)
         vcrypto->vqs[i].dataq_bh =
                  qemu_bh_new(virtio_crypto_dataq_bh, &vcrypto->vqs[i]);
         vcrypto->vqs[i].vcrypto = vcrypto;
+        vcrypto->vqs[i].ctx = qemu_get_aio_context();
+    }
+
+    if (vcrypto->conf.num_iothread_vq_mapping &&
+        !virtio_crypto_map_iothreads(vcrypto, errp)) {
+        for (i = 0; i < vcrypto->max_queues; i++) {
+            virtio_delete_queue(vcrypto->vqs[i].dataq);
+            qemu_bh_delete(vcrypto->vqs[i].dataq_bh);
+        }
+        g_free(vcrypto->vqs);
+        virtio_cleanup(vdev);
+        return;
     }
 
     vcrypto->ctrl_vq = virtio_add_queue(vdev, 64, virtio_crypto_handle_ctrl);
@@ -848,6 +1134,8 @@ static void virtio_crypto_device_unrealize(DeviceState *dev)
 
     g_free(vcrypto->vqs);
     virtio_delete_queue(vcrypto->ctrl_vq);
+    iothread_vq_mapping_cleanup(&vcrypto->vq_iothreads,
+                                    &vcrypto->num_vq_iothreads);
 
     virtio_cleanup(vdev);
     cryptodev_backend_set_used(vcrypto->cryptodev, false);
@@ -867,6 +1155,9 @@ static const VMStateDescription vmstate_virtio_crypto = {
 static Property virtio_crypto_properties[] = {
     DEFINE_PROP_LINK("cryptodev", VirtIOCrypto, conf.cryptodev,
                      TYPE_CRYPTODEV_BACKEND, CryptoDevBackend *),
+    DEFINE_PROP_ARRAY("iothread-vq-mapping", VirtIOCrypto,
+                      conf.num_iothread_vq_mapping,
+                      conf.iothread_vq_mapping, qdev_prop_string, char *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -938,6 +1229,7 @@ static void virtio_crypto_set_status(VirtIODevice *vdev, uint8_t status)
     VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(vdev);
 
     virtio_crypto_vhost_status(vcrypto, status);
+    virtio_crypto_iothread_status(vcrypto, status);
 }
 
 static void virtio_crypto_guest_notifier_mask(VirtIODevice *vdev, int idx,
@@ -990,11 +1282,20 @@ static void virtio_crypto_instance_init(Object *obj)
     vcrypto->config_size = sizeof(struct virtio_crypto_config);
 }
 
+static void virtio_crypto_instance_finalize(Object *obj)
+{
+    VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(obj);
+
+    /* The array elements are freed by the string property release hook */
+    g_free(vcrypto->conf.iothread_vq_mapping);
+}
+
 static const TypeInfo virtio_crypto_info = {
     .name = TYPE_VIRTIO_CRYPTO,
     .parent = TYPE_VIRTIO_DEVICE,
     .instance_size = sizeof(VirtIOCrypto),
     .instance_init = virtio_crypto_instance_init,
+    .instance_finalize = virtio_crypto_instance_finalize,
     .class_init = virtio_crypto_class_init,
 };
 
@@ -16,6 +16,7 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/units.h"
+#include "qemu/main-loop.h"
 #include "sysemu/numa.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/reset.h"
@@ -142,30 +143,198 @@ static bool virtio_mem_valid_range(VirtIOMEM *vmem, uint64_t gpa, uint64_t size)
     return true;
 }
 
+/*
+ * Preallocating plugged blocks and discarding unplugged ones is done by
+ * worker_thread, in the order the jobs are queued, so that big requests
+ * do not stall the main loop.  Unplug requests are acknowledged right
+ * away, as the guest no longer uses the memory.  Plug requests are only
+ * acknowledged once the memory is usable: after its preallocation if the
+ * memory backend asks for it, and after the discards queued before them,
+ * which must not zap memory that the guest uses again.
+ */
+typedef struct VirtIOMEMJob {
+    bool plug;
+    uint64_t offset;
+    uint64_t size;
+    /* plug request to answer once the job is done */
+    VirtQueueElement *elem;
+    int ret;
+    QSIMPLEQ_ENTRY(VirtIOMEMJob) next;
+} VirtIOMEMJob;
+
+static int virtio_mem_do_job(VirtIOMEM *vmem, bool plug, uint64_t offset,
+                             uint64_t size)
+{
+    RAMBlock *rb = vmem->memdev->mr.ram_block;
+    Error *local_err = NULL;
+    int ret;
+
+    trace_virtio_mem_do_job(plug, offset, size);
+    if (plug) {
+        if (!vmem->memdev->prealloc) {
+            return 0;
+        }
+        host_memory_backend_prealloc_range(vmem->memdev, offset, size,
+                                           &local_err);
+        if (!local_err) {
+            return 0;
+        }
+        error_report_err(local_err);
+        /* give back what could be allocated, the blocks stay unplugged */
+        ram_block_discard_range(rb, offset, size);
+        return -ENOMEM;
+    }
+
+    ret = ram_block_discard_range(rb, offset, size);
+    if (ret) {
+        error_report("Unexpected error discarding RAM: %s", strerror(-ret));
+    }
+    return ret;
+}
+
+static void *virtio_mem_worker(void *opaque)
+{
+    VirtIOMEM *vmem = opaque;
+    QSIMPLEQ_HEAD(, VirtIOMEMJob) batch = QSIMPLEQ_HEAD_INITIALIZER(batch);
+    VirtIOMEMJob *job, *last, *tmp;
+    uint64_t end;
+    int ret;
+
+    qemu_mutex_lock(&vmem->worker_lock);
+    while (true) {
+        while (QSIMPLEQ_EMPTY(&vmem->jobs) && !vmem->worker_quit) {
+            qemu_cond_wait(&vmem->worker_cond, &vmem->worker_lock);
+        }
+        if (QSIMPLEQ_EMPTY(&vmem->jobs)) {
+            break;
+        }
+        QSIMPLEQ_CONCAT(&batch, &vmem->jobs);
+        vmem->worker_busy = true;
+        qemu_mutex_unlock(&vmem->worker_lock);
+
+        /* jobs of the same kind on adjacent blocks are done at once */
+        for (job = QSIMPLEQ_FIRST(&batch); job; job = QSIMPLEQ_NEXT(last, next)) {
+            end = job->offset + job->size;
+            last = job;
+            while ((tmp = QSIMPLEQ_NEXT(last, next)) &&
+                   tmp->plug == job->plug && tmp->offset == end) {
+                end += tmp->size;
+                last = tmp;
+            }
+
+            ret = virtio_mem_do_job(vmem, job->plug, job->offset,
+                                    end - job->offset);
+            for (tmp = job; tmp != QSIMPLEQ_NEXT(last, next);
+                 tmp = QSIMPLEQ_NEXT(tmp, next)) {
+                tmp->ret = ret;
+            }
+        }
+
+        qemu_mutex_lock(&vmem->worker_lock);
+        QSIMPLEQ_CONCAT(&vmem->done_jobs, &batch);
+        vmem->worker_busy = false;
+        qemu_cond_broadcast(&vmem->worker_cond);
+        qemu_bh_schedule(vmem->worker_bh);
+    }
+    qemu_mutex_unlock(&vmem->worker_lock);
+    return NULL;
+}
+
+static void virtio_mem_queue_job(VirtIOMEM *vmem, bool plug, uint64_t offset,
+                                 uint64_t size, VirtQueueElement *elem)
+{
+    VirtIOMEMJob *job = g_new0(VirtIOMEMJob, 1);
+
+    job->plug = plug;
+    job->offset = offset;
+    job->size = size;
+    job->elem = elem;
+    vmem->nr_jobs++;
+
+    qemu_mutex_lock(&vmem->worker_lock);
+    QSIMPLEQ_INSERT_TAIL(&vmem->jobs, job, next);
+    qemu_cond_signal(&vmem->worker_cond);
+    qemu_mutex_unlock(&vmem->worker_lock);
+}
+
+/* Wait until the worker is done with all queued jobs; any thread */
+static void virtio_mem_wait_jobs(VirtIOMEM *vmem)
+{
+    qemu_mutex_lock(&vmem->worker_lock);
+    while (!QSIMPLEQ_EMPTY(&vmem->jobs) || vmem->worker_busy) {
+        qemu_cond_wait(&vmem->worker_cond, &vmem->worker_lock);
+    }
+    qemu_mutex_unlock(&vmem->worker_lock);
+}
+
+static void virtio_mem_complete_jobs(VirtIOMEM *vmem)
+{
+    QSIMPLEQ_HEAD(, VirtIOMEMJob) done = QSIMPLEQ_HEAD_INITIALIZER(done);
+    VirtIOMEMJob *job;
+
+    qemu_mutex_lock(&vmem->worker_lock);
+    QSIMPLEQ_CONCAT(&done, &vmem->done_jobs);
+    qemu_mutex_unlock(&vmem->worker_lock);
+
+    while ((job = QSIMPLEQ_FIRST(&done))) {
+        QSIMPLEQ_REMOVE_HEAD(&done, next);
+        vmem->nr_jobs--;
+
+        if (job->plug && job->ret) {
+            virtio_mem_set_bitmap(vmem, vmem->addr + job->offset, job->size,
+                                  false);
+            vmem->size -= job->size;
+            notifier_list_notify(&vmem->size_change_notifiers, &vmem->size);
+        }
+        if (job->elem) {
+            virtio_mem_send_response_simple(vmem, job->elem,
+                                            job->ret ? VIRTIO_MEM_RESP_BUSY :
+                                                       VIRTIO_MEM_RESP_ACK);
+            g_free(job->elem);
+        }
+        g_free(job);
+    }
+}
+
+static void virtio_mem_worker_bh(void *opaque)
+{
+    virtio_mem_complete_jobs(VIRTIO_MEM(opaque));
+}
+
+/* Finish all queued jobs and answer their requests */
+static void virtio_mem_flush_jobs(VirtIOMEM *vmem)
+{
+    if (vmem->nr_jobs) {
+        virtio_mem_wait_jobs(vmem);
+        virtio_mem_complete_jobs(vmem);
+    }
+}
+
 static int virtio_mem_set_block_state(VirtIOMEM *vmem, uint64_t start_gpa,
-                                      uint64_t size, bool plug)
+                                      uint64_t size, bool plug,
+                                      VirtQueueElement *elem)
 {
     const uint64_t offset = start_gpa - vmem->addr;
-    int ret;
 
     if (virtio_mem_is_busy()) {
         return -EBUSY;
     }
 
+    virtio_mem_set_bitmap(vmem, start_gpa, size, plug);
     if (!plug) {
-        ret = ram_block_discard_range(vmem->memdev->mr.ram_block, offset, size);
-        if (ret) {
-            error_report("Unexpected error discarding RAM: %s",
-                         strerror(-ret));
-            return -EBUSY;
-        }
+        virtio_mem_queue_job(vmem, false, offset, size, NULL);
+    } else if (vmem->memdev->prealloc || vmem->nr_jobs) {
+        /* @elem is answered by virtio_mem_complete_jobs() */
+        virtio_mem_queue_job(vmem, true, offset, size, elem);
+        return -EINPROGRESS;
     }
-    virtio_mem_set_bitmap(vmem, start_gpa, size, plug);
     return 0;
 }
 
-static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
-                                           uint16_t nb_blocks, bool plug)
+static int virtio_mem_state_change_request(VirtIOMEM *vmem,
+                                           VirtQueueElement *elem,
+                                           uint64_t gpa, uint16_t nb_blocks,
+                                           bool plug, bool *deferred)
 {
     const uint64_t size = nb_blocks * vmem->block_size;
     int ret;
@@ -183,10 +352,11 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
         return VIRTIO_MEM_RESP_ERROR;
     }
 
-    ret = virtio_mem_set_block_state(vmem, gpa, size, plug);
-    if (ret) {
+    ret = virtio_mem_set_block_state(vmem, gpa, size, plug, elem);
+    if (ret == -EBUSY) {
         return VIRTIO_MEM_RESP_BUSY;
     }
+    *deferred = ret == -EINPROGRESS;
     if (plug) {
         vmem->size += size;
     } else {
@@ -196,16 +366,22 @@ static int virtio_mem_state_change_request(VirtIOMEM *vmem, uint64_t gpa,
     return VIRTIO_MEM_RESP_ACK;
 }
 
-static void virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
+/* Returns true if the request is answered later */
+static bool virtio_mem_plug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
                                     struct virtio_mem_req *req)
 {
     const uint64_t gpa = le64_to_cpu(req->u.plug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.plug.nb_blocks);
+    bool deferred = false;
     uint16_t type;
 
     trace_virtio_mem_plug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, true);
-    virtio_mem_send_response_simple(vmem, elem, type);
+    type = virtio_mem_state_change_request(vmem, elem, gpa, nb_blocks, true,
+                                           &deferred);
+    if (!deferred) {
+        virtio_mem_send_response_simple(vmem, elem, type);
+    }
+    return deferred;
 }
 
 static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
@@ -213,10 +389,12 @@ static void virtio_mem_unplug_request(VirtIOMEM *vmem, VirtQueueElement *elem,
 {
     const uint64_t gpa = le64_to_cpu(req->u.unplug.addr);
     const uint16_t nb_blocks = le16_to_cpu(req->u.unplug.nb_blocks);
+    bool deferred = false;
     uint16_t type;
 
     trace_virtio_mem_unplug_request(gpa, nb_blocks);
-    type = virtio_mem_state_change_request(vmem, gpa, nb_blocks, false);
+    type = virtio_mem_state_change_request(vmem, elem, gpa, nb_blocks, false,
+                                           &deferred);
     virtio_mem_send_response_simple(vmem, elem, type);
 }
 
@@ -242,17 +420,14 @@ static void virtio_mem_resize_usable_region(VirtIOMEM *vmem,
 static int virtio_mem_unplug_all(VirtIOMEM *vmem)
 {
     RAMBlock *rb = vmem->memdev->mr.ram_block;
-    int ret;
 
     if (virtio_mem_is_busy()) {
         return -EBUSY;
     }
 
-    ret = ram_block_discard_range(rb, 0, qemu_ram_get_used_length(rb));
-    if (ret) {
-        error_report("Unexpected error discarding RAM: %s", strerror(-ret));
-        return -EBUSY;
-    }
+    /* plugs that fail must not be rolled back after this */
+    virtio_mem_flush_jobs(vmem);
+    virtio_mem_queue_job(vmem, false, 0, qemu_ram_get_used_length(rb), NULL);
     bitmap_clear(vmem->bitmap, 0, vmem->bitmap_size);
     if (vmem->size) {
         vmem->size = 0;
@@ -336,7 +511,10 @@ static void virtio_mem_handle_request(VirtIODevice *vdev, VirtQueue *vq)
         type = le16_to_cpu(req.type);
         switch (type) {
         case VIRTIO_MEM_REQ_PLUG:
-            virtio_mem_plug_request(vmem, elem, &req);
+            if (virtio_mem_plug_request(vmem, elem, &req)) {
+                /* freed by virtio_mem_complete_jobs() */
+                continue;
+            }
             break;
         case VIRTIO_MEM_REQ_UNPLUG:
             virtio_mem_unplug_request(vmem, elem, &req);
@@ -373,6 +551,19 @@ static void virtio_mem_get_config(VirtIODevice *vdev, uint8_t *config_data)
     config->usable_region_size = cpu_to_le64(vmem->usable_region_size);
 }
 
+static void virtio_mem_reset(VirtIODevice *vdev)
+{
+    virtio_mem_flush_jobs(VIRTIO_MEM(vdev));
+}
+
+static void virtio_mem_set_status(VirtIODevice *vdev, uint8_t status)
+{
+    /* Do not leave requests in flight while the device state is saved */
+    if (!vdev->vm_running) {
+        virtio_mem_flush_jobs(VIRTIO_MEM(vdev));
+    }
+}
+
 static uint64_t virtio_mem_get_features(VirtIODevice *vdev, uint64_t features,
                                         Error **errp)
 {
@@ -479,6 +670,14 @@ static void virtio_mem_device_realize(DeviceState *dev, Error **errp)
                 sizeof(struct virtio_mem_config));
     vmem->vq = virtio_add_queue(vdev, 128, virtio_mem_handle_request);
 
+    QSIMPLEQ_INIT(&vmem->jobs);
+    QSIMPLEQ_INIT(&vmem->done_jobs);
+    qemu_mutex_init(&vmem->worker_lock);
+    qemu_cond_init(&vmem->worker_cond);
+    vmem->worker_bh = qemu_bh_new(virtio_mem_worker_bh, vmem);
+    qemu_thread_create(&vmem->worker_thread, "virtio-mem", virtio_mem_worker,
+                       vmem, QEMU_THREAD_JOINABLE);
+
     host_memory_backend_set_mapped(vmem->memdev, true);
     vmstate_register_ram(&vmem->memdev->mr, DEVICE(vmem));
     qemu_register_reset(virtio_mem_system_reset, vmem);
@@ -492,6 +691,17 @@ static void virtio_mem_device_unrealize(DeviceState *dev)
 
     precopy_remove_notifier(&vmem->precopy_notifier);
     qemu_unregister_reset(virtio_mem_system_reset, vmem);
+
+    virtio_mem_flush_jobs(vmem);
+    qemu_mutex_lock(&vmem->worker_lock);
+    vmem->worker_quit = true;
+    qemu_cond_signal(&vmem->worker_cond);
+    qemu_mutex_unlock(&vmem->worker_lock);
+    qemu_thread_join(&vmem->worker_thread);
+    qemu_bh_delete(vmem->worker_bh);
+    qemu_cond_destroy(&vmem->worker_cond);
+    qemu_mutex_destroy(&vmem->worker_lock);
+
     vmstate_unregister_ram(&vmem->memdev->mr, DEVICE(vmem));
     host_memory_backend_set_mapped(vmem->memdev, false);
     virtio_del_queue(vdev, 0);
@@ -797,6 +1007,8 @@ static int virtio_mem_precopy_notify(NotifierWithReturn *n, void *data)
 
     switch (pnd->reason) {
     case PRECOPY_NOTIFY_SETUP:
+        /* no discard must run concurrently with migration */
+        virtio_mem_wait_jobs(vmem);
         precopy_enable_free_page_optimization();
         break;
     case PRECOPY_NOTIFY_AFTER_BITMAP_SYNC:
@@ -849,6 +1061,8 @@ static void virtio_mem_class_init(ObjectClass *klass, void *data)
     vdc->unrealize = virtio_mem_device_unrealize;
     vdc->get_config = virtio_mem_get_config;
     vdc->get_features = virtio_mem_get_features;
+    vdc->reset = virtio_mem_reset;
+    vdc->set_status = virtio_mem_set_status;
     vdc->vmsd = &vmstate_virtio_mem_device;
 
     vmc->fill_device_info = virtio_mem_fill_device_info;
@@ -723,6 +723,8 @@ static int kvm_virtio_pci_vector_use(VirtIOPCIProxy *proxy, int nvqs)
     unsigned int vector;
     int ret, queue_no;
 
+    /* commit the routes of all queues at once */
+    kvm_irqchip_begin_route_changes(kvm_state);
     for (queue_no = 0; queue_no < nvqs; queue_no++) {
         if (!virtio_queue_get_num(vdev, queue_no)) {
             break;
@@ -746,6 +748,7 @@ static int kvm_virtio_pci_vector_use(VirtIOPCIProxy *proxy, int nvqs)
             }
         }
     }
+    kvm_irqchip_end_route_changes(kvm_state);
     return 0;
 
 undo:
@@ -759,6 +762,7 @@ undo:
         }
         kvm_virtio_pci_vq_vector_release(proxy, vector);
     }
+    kvm_irqchip_end_route_changes(kvm_state);
     return ret;
 }
 
@@ -1136,6 +1140,24 @@ static int virtio_pci_add_mem_cap(VirtIOPCIProxy *proxy,
     return offset;
 }
 
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy, uint8_t bar,
+                           uint64_t offset, uint64_t length, uint8_t id)
+{
+    struct virtio_pci_cap64 cap = {
+        .cap.cap_len = sizeof cap,
+        .cap.cfg_type = VIRTIO_PCI_CAP_SHARED_MEMORY_CFG,
+    };
+
+    cap.cap.bar = bar;
+    cap.cap.id = id;
+    cap.cap.length = cpu_to_le32(length);
+    cap.length_hi = cpu_to_le32(length >> 32);
+    cap.cap.offset = cpu_to_le32(offset);
+    cap.offset_hi = cpu_to_le32(offset >> 32);
+
+    return virtio_pci_add_mem_cap(proxy, &cap.cap);
+}
+
 static uint64_t virtio_pci_common_read(void *opaque, hwaddr addr,
                                        unsigned size)
 {
@@ -234,6 +234,22 @@ typedef struct VirtioPCIDeviceTypeInfo {
 /* Register virtio-pci type(s).  @t must be static. */
 void virtio_pci_types_register(const VirtioPCIDeviceTypeInfo *t);
 
+/**
+ * virtio_pci_add_shm_cap:
+ * @proxy: the virtio-pci device
+ * @bar: BAR the shared memory region lives in
+ * @offset: offset of the region within @bar
+ * @length: length of the region
+ * @id: device specific id of the region
+ *
+ * Adds a VIRTIO_PCI_CAP_SHARED_MEMORY_CFG capability describing a shared
+ * memory region to @proxy.  Registering @bar is up to the caller.
+ *
+ * Returns: the offset of the capability in config space.
+ */
+int virtio_pci_add_shm_cap(VirtIOPCIProxy *proxy, uint8_t bar,
+                           uint64_t offset, uint64_t length, uint8_t id);
+
 /**
  * virtio_pci_optimal_num_queues:
  * @fixed_queues: number of queues that are always present
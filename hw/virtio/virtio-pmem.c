@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu-common.h"
+#include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "hw/virtio/virtio-pmem.h"
@@ -27,64 +28,135 @@
 
 typedef struct VirtIODeviceRequest {
     VirtQueueElement elem;
-    int fd;
     VirtIOPMEM *pmem;
     VirtIODevice *vdev;
     struct virtio_pmem_req req;
     struct virtio_pmem_resp resp;
+    QSIMPLEQ_ENTRY(VirtIODeviceRequest) next;
 } VirtIODeviceRequest;
 
+/* One flush of the backing file, on behalf of all requests in @reqs */
+typedef struct VirtIOPMEMFlush {
+    VirtIOPMEM *pmem;
+    int fd;
+    void *addr;
+    size_t len;
+    int err;
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) reqs;
+} VirtIOPMEMFlush;
+
 static int worker_cb(void *opaque)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int err = 0;
+    VirtIOPMEMFlush *flush = opaque;
 
-    /* flush raw backing image */
-    err = fsync(req_data->fd);
-    if (err != 0) {
-        err = 1;
+    /*
+     * Write back the range the device maps, rather than fsync() the
+     * whole file: on Linux, msync(MS_SYNC) is a ranged fdatasync().
+     */
+    if (flush->fd < 0 || qemu_msync(flush->addr, flush->len, flush->fd)) {
+        flush->err = 1;
     }
 
-    virtio_stw_p(req_data->vdev, &req_data->resp.ret, err);
-
     return 0;
 }
 
-static void done_cb(void *opaque, int ret)
+static void virtio_pmem_complete(VirtIODeviceRequest *req_data, int err)
 {
-    VirtIODeviceRequest *req_data = opaque;
-    int len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
-                              &req_data->resp, sizeof(struct virtio_pmem_resp));
+    int len;
 
-    /* Callbacks are serialized, so no need to use atomic ops. */
+    virtio_stw_p(req_data->vdev, &req_data->resp.ret, err);
+    len = iov_from_buf(req_data->elem.in_sg, req_data->elem.in_num, 0,
+                       &req_data->resp, sizeof(struct virtio_pmem_resp));
     virtqueue_push(req_data->pmem->rq_vq, &req_data->elem, len);
-    virtio_notify((VirtIODevice *)req_data->pmem, req_data->pmem->rq_vq);
     g_free(req_data);
 }
 
-static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem);
+
+static void done_cb(void *opaque, int ret)
 {
+    VirtIOPMEMFlush *flush = opaque;
+    VirtIOPMEM *pmem = flush->pmem;
     VirtIODeviceRequest *req_data;
-    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
+
+    /* Callbacks are serialized, so no need to use atomic ops. */
+    while ((req_data = QSIMPLEQ_FIRST(&flush->reqs))) {
+        QSIMPLEQ_REMOVE_HEAD(&flush->reqs, next);
+        virtio_pmem_complete(req_data, flush->err);
+    }
+    virtio_notify(VIRTIO_DEVICE(pmem), pmem->rq_vq);
+    g_free(flush);
+
+    pmem->flush_in_flight = false;
+    virtio_pmem_start_flush(pmem);
+}
+
+/*
+ * Requests that come in while a flush runs may have written data after
+ * it started, so they wait for the next one; that one then serves all
+ * of them at once.
+ */
+static void virtio_pmem_start_flush(VirtIOPMEM *pmem)
+{
     HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
     ThreadPool *pool = aio_get_thread_pool(qemu_get_aio_context());
+    VirtIOPMEMFlush *flush;
 
-    req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
-    if (!req_data) {
-        virtio_error(vdev, "virtio-pmem missing request data");
+    if (pmem->flush_in_flight || QSIMPLEQ_EMPTY(&pmem->flush_waiting)) {
         return;
     }
 
-    if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
-        virtio_error(vdev, "virtio-pmem request not proper");
-        virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
-        g_free(req_data);
-        return;
+    flush = g_new0(VirtIOPMEMFlush, 1);
+    flush->pmem = pmem;
+    flush->fd = memory_region_get_fd(&backend->mr);
+    flush->addr = memory_region_get_ram_ptr(&backend->mr);
+    flush->len = memory_region_size(&backend->mr);
+    QSIMPLEQ_INIT(&flush->reqs);
+    QSIMPLEQ_CONCAT(&flush->reqs, &pmem->flush_waiting);
+
+    pmem->flush_in_flight = true;
+    thread_pool_submit_aio(pool, worker_cb, flush, done_cb, flush);
+}
+
+static void virtio_pmem_flush(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIODeviceRequest *req_data;
+    VirtIOPMEM *pmem = VIRTIO_PMEM(vdev);
+    HostMemoryBackend *backend = MEMORY_BACKEND(pmem->memdev);
+    bool map_sync = qemu_ram_is_map_sync(backend->mr.ram_block);
+    bool done = false;
+
+    for (;;) {
+        req_data = virtqueue_pop(vq, sizeof(VirtIODeviceRequest));
+        if (!req_data) {
+            break;
+        }
+
+        if (req_data->elem.out_num < 1 || req_data->elem.in_num < 1) {
+            virtio_error(vdev, "virtio-pmem request not proper");
+            virtqueue_detach_element(vq, (VirtQueueElement *)req_data, 0);
+            g_free(req_data);
+            return;
+        }
+        req_data->pmem = pmem;
+        req_data->vdev = vdev;
+
+        /*
+         * With MAP_SYNC on a DAX file system, the guest's cache flushes
+         * already made its writes durable, and there is nothing to do.
+         */
+        if (map_sync) {
+            virtio_pmem_complete(req_data, 0);
+            done = true;
+        } else {
+            QSIMPLEQ_INSERT_TAIL(&pmem->flush_waiting, req_data, next);
+        }
+    }
+
+    if (done) {
+        virtio_notify(vdev, vq);
     }
-    req_data->fd   = memory_region_get_fd(&backend->mr);
-    req_data->pmem = pmem;
-    req_data->vdev = vdev;
-    thread_pool_submit_aio(pool, worker_cb, req_data, done_cb, req_data);
+    virtio_pmem_start_flush(pmem);
 }
 
 static void virtio_pmem_get_config(VirtIODevice *vdev, uint8_t *config)
@@ -119,6 +191,7 @@ static void virtio_pmem_realize(DeviceState *dev, Error **errp)
     }
 
     host_memory_backend_set_mapped(pmem->memdev, true);
+    QSIMPLEQ_INIT(&pmem->flush_waiting);
     virtio_init(vdev, TYPE_VIRTIO_PMEM, VIRTIO_ID_PMEM,
                 sizeof(struct virtio_pmem_config));
     pmem->rq_vq = virtio_add_queue(vdev, 128, virtio_pmem_flush);
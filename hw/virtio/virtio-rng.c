@@ -258,6 +258,9 @@ static Property virtio_rng_properties[] = {
     DEFINE_PROP_UINT64("max-bytes", VirtIORNG, conf.max_bytes, INT64_MAX),
     DEFINE_PROP_UINT32("period", VirtIORNG, conf.period_ms, 1 << 16),
     DEFINE_PROP_LINK("rng", VirtIORNG, conf.rng, TYPE_RNG_BACKEND, RngBackend *),
+    /* buffers are filled one at a time, in the order they were popped */
+    DEFINE_PROP_BIT64("in_order", VirtIORNG, parent_obj.host_features,
+                      VIRTIO_F_IN_ORDER, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
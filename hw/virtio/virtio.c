@@ -130,6 +130,17 @@ struct VirtQueue
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
     bool host_notifier_enabled;
+    /* recycles popped elements, see virtio_queue_set_element_pool() */
+    VirtQueueElementPool *elem_pool;
+
+    /* interrupt coalescing, see virtio_queue_set_coalescing() */
+    uint32_t coalesce_frames;
+    uint32_t coalesce_usecs;
+    bool coalesce_adaptive;
+    /* interrupts held back since the last one sent */
+    uint32_t coalesce_pending;
+    int64_t coalesce_last_irq;
+    QEMUTimer *coalesce_timer;
     QLIST_ENTRY(VirtQueue) node;
 };
 
@@ -897,6 +908,33 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
     }
 }
 
+/*
+ * With VIRTIO_F_IN_ORDER, a used descriptor also tells the driver that
+ * all the buffers made available before it are used, so only the last
+ * buffer of the batch is written back, and the used index skips over
+ * the others.
+ */
+static void virtqueue_packed_flush_in_order(VirtQueue *vq, unsigned int count)
+{
+    unsigned int i, ndescs = 0;
+
+    if (unlikely(!vq->vring.desc)) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        ndescs += vq->used_elems[i].ndescs;
+    }
+    virtqueue_packed_fill_desc(vq, &vq->used_elems[count - 1], 0, true);
+
+    vq->inuse -= ndescs;
+    vq->used_idx += ndescs;
+    if (vq->used_idx >= vq->vring.num) {
+        vq->used_idx -= vq->vring.num;
+        vq->used_wrap_counter ^= 1;
+    }
+}
+
 void virtqueue_flush(VirtQueue *vq, unsigned int count)
 {
     if (virtio_device_disabled(vq->vdev)) {
@@ -919,6 +957,40 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+/* virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: Elements to return to the guest
+ * @lens: Number of bytes written to each element, or NULL if none
+ * @count: Number of elements
+ *
+ * Like virtqueue_push() for each element, but the used ring index is only
+ * published once.  The caller still has to notify the guest.
+ *
+ * Without @lens, and if VIRTIO_F_IN_ORDER was negotiated for a packed
+ * ring, only the last element is written back to the ring.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    if (!lens && count > 1 && !virtio_device_disabled(vq->vdev) &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED) &&
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_F_IN_ORDER)) {
+        virtqueue_packed_flush_in_order(vq, count);
+    } else {
+        virtqueue_flush(vq, count);
+    }
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1388,29 +1460,169 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
+/*
+ * Returns the size of an element of @sz bytes followed by its address and
+ * sg arrays; if @elem is not NULL, also points these arrays into it.
+ */
+static size_t virtqueue_layout_element(VirtQueueElement *elem, size_t sz,
+                                       unsigned out_num, unsigned in_num)
+{
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(hwaddr));
+    size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(hwaddr);
+    size_t out_addr_end = out_addr_ofs + out_num * sizeof(hwaddr);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(struct iovec));
+    size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(struct iovec);
+    size_t out_sg_end = out_sg_ofs + out_num * sizeof(struct iovec);
+
+    if (elem) {
+        elem->out_num = out_num;
+        elem->in_num = in_num;
+        elem->in_addr = (void *)elem + in_addr_ofs;
+        elem->out_addr = (void *)elem + out_addr_ofs;
+        elem->in_sg = (void *)elem + in_sg_ofs;
+        elem->out_sg = (void *)elem + out_sg_ofs;
+        elem->pool = NULL;
+    }
+    return out_sg_end;
+}
+
 static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
-    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
-    size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
-    size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
-    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
-    size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
-    size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    elem = g_malloc(virtqueue_layout_element(NULL, sz, out_num, in_num));
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
-    elem->out_num = out_num;
-    elem->in_num = in_num;
-    elem->in_addr = (void *)elem + in_addr_ofs;
-    elem->out_addr = (void *)elem + out_addr_ofs;
-    elem->in_sg = (void *)elem + in_sg_ofs;
-    elem->out_sg = (void *)elem + out_sg_ofs;
+    virtqueue_layout_element(elem, sz, out_num, in_num);
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Element pools recycle the elements popped from a virtqueue instead of
+ * going through malloc for each request.  All slots have room for the
+ * device's request struct and max_sg descriptors; bigger requests are
+ * allocated as usual.  The pool only grows up to the number of requests
+ * that were in flight at once, so it is never trimmed.
+ *
+ * Slots are taken by the thread that pops from the virtqueue, from
+ * @free; virtqueue_element_free() can run in any thread and gives them
+ * back to @returned, which the popping thread takes over once @free is
+ * empty.  Each element in flight holds a reference to the pool, so that
+ * it can outlive the virtqueue.
+ */
+typedef struct VirtQueuePoolSlot {
+    QSLIST_ENTRY(VirtQueuePoolSlot) next;
+} VirtQueuePoolSlot;
+
+struct VirtQueueElementPool {
+    size_t sz;
+    unsigned int max_sg;
+    size_t slot_size;
+    int refcnt;
+    QSLIST_HEAD(, VirtQueuePoolSlot) free;
+    QSLIST_HEAD(, VirtQueuePoolSlot) returned;
+};
+
+static void virtqueue_pool_unref(VirtQueueElementPool *pool)
+{
+    VirtQueuePoolSlot *slot;
+
+    if (qatomic_fetch_dec(&pool->refcnt) != 1) {
+        return;
+    }
+    while ((slot = QSLIST_FIRST(&pool->free))) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+        g_free(slot);
+    }
+    while ((slot = QSLIST_FIRST(&pool->returned))) {
+        QSLIST_REMOVE_HEAD(&pool->returned, next);
+        g_free(slot);
+    }
+    g_free(pool);
+}
+
+static void *virtqueue_pool_alloc(VirtQueue *vq, size_t sz, unsigned out_num,
+                                  unsigned in_num)
+{
+    VirtQueueElementPool *pool = vq->elem_pool;
+    VirtQueuePoolSlot *slot;
+    VirtQueueElement *elem;
+
+    if (!pool || pool->sz != sz || out_num + in_num > pool->max_sg) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    if (QSLIST_EMPTY(&pool->free)) {
+        QSLIST_MOVE_ATOMIC(&pool->free, &pool->returned);
+    }
+    slot = QSLIST_FIRST(&pool->free);
+    if (slot) {
+        QSLIST_REMOVE_HEAD(&pool->free, next);
+    } else {
+        slot = g_malloc(pool->slot_size);
+    }
+    qatomic_inc(&pool->refcnt);
+
+    elem = (VirtQueueElement *)slot;
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    virtqueue_layout_element(elem, sz, out_num, in_num);
+    elem->pool = pool;
+    return elem;
+}
+
+/* virtqueue_element_free:
+ * @opaque: Element returned by virtqueue_pop(), or NULL
+ *
+ * Free an element, or give it back to the pool it was taken from.  Devices
+ * that call virtio_queue_set_element_pool() must free their elements with
+ * this instead of g_free().  Can be called from any thread.
+ */
+void virtqueue_element_free(void *opaque)
+{
+    VirtQueueElement *elem = opaque;
+    VirtQueueElementPool *pool;
+
+    if (!elem) {
+        return;
+    }
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->returned, (VirtQueuePoolSlot *)elem, next);
+    virtqueue_pool_unref(pool);
+}
+
+/* virtio_queue_set_element_pool:
+ * @vq: The #VirtQueue
+ * @sz: Size of the elements the device pops, as passed to virtqueue_pop()
+ * @max_sg: Number of descriptors a pooled element has room for
+ *
+ * Recycle the elements popped from @vq.  Elements must then be freed
+ * with virtqueue_element_free().
+ */
+void virtio_queue_set_element_pool(VirtQueue *vq, size_t sz,
+                                   unsigned int max_sg)
+{
+    VirtQueueElementPool *pool = g_new0(VirtQueueElementPool, 1);
+
+    assert(sz >= sizeof(VirtQueueElement));
+    pool->sz = sz;
+    pool->max_sg = max_sg;
+    pool->slot_size = virtqueue_layout_element(NULL, sz, 0, max_sg);
+    pool->refcnt = 1;
+    QSLIST_INIT(&pool->free);
+    QSLIST_INIT(&pool->returned);
+
+    if (vq->elem_pool) {
+        virtqueue_pool_unref(vq->elem_pool);
+    }
+    vq->elem_pool = pool;
+}
+
+/* Called within rcu_read_lock().  */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1425,7 +1637,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_empty_rcu(vq)) {
         goto done;
     }
@@ -1522,7 +1733,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_pool_alloc(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1547,6 +1758,30 @@ err_undo_map:
     goto done;
 }
 
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+{
+    RCU_READ_LOCK_GUARD();
+    return virtqueue_split_pop_rcu(vq, sz);
+}
+
+/* Called within rcu_read_lock().  */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
+{
+    unsigned int n = 0;
+
+    /* Reads avail->idx at most once, the pops below use the shadow copy */
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+    max = MIN(max, (uint16_t)(vq->shadow_avail_idx - vq->last_avail_idx));
+
+    while (n < max && (elems[n] = virtqueue_split_pop_rcu(vq, sz))) {
+        n++;
+    }
+    return n;
+}
+
 static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 {
     unsigned int i, max;
@@ -1648,7 +1883,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_pool_alloc(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1695,6 +1930,39 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     }
 }
 
+/* virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: Size of each element, as for virtqueue_pop()
+ * @elems: Array that receives the elements
+ * @max: Size of @elems
+ *
+ * Pop up to @max elements at once.  The available ring index is only read
+ * from guest memory once, so elements made available by the guest in the
+ * meantime are left for the next call.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
+        while (n < max && (elems[n] = virtqueue_packed_pop(vq, sz))) {
+            n++;
+        }
+    } else {
+        RCU_READ_LOCK_GUARD();
+        n = virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2028,6 +2296,13 @@ void virtio_reset(void *opaque)
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
+        /* drop held back interrupts, the driver no longer expects them */
+        vdev->vq[i].coalesce_pending = 0;
+        if (vdev->vq[i].vring.num_default || vdev->vq[i].coalesce_timer) {
+            virtio_queue_set_coalescing(&vdev->vq[i], vdev->coalesce_frames,
+                                        vdev->coalesce_usecs,
+                                        vdev->coalesce_adaptive);
+        }
     }
 }
 
@@ -2425,6 +2700,15 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    vq->coalesce_pending = 0;
+    if (vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    if (vq->elem_pool) {
+        virtqueue_pool_unref(vq->elem_pool);
+        vq->elem_pool = NULL;
+    }
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2559,6 +2843,88 @@ static void virtio_irq(VirtQueue *vq)
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
+static void virtio_queue_coalesce_fire(VirtQueue *vq)
+{
+    trace_virtio_queue_coalesce_fire(vq, vq->coalesce_pending);
+    vq->coalesce_pending = 0;
+    vq->coalesce_last_irq = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
+    if (vq->coalesce_timer) {
+        timer_del(vq->coalesce_timer);
+    }
+    virtio_irq(vq);
+}
+
+static void virtio_queue_coalesce_timer(void *opaque)
+{
+    virtio_queue_coalesce_fire(opaque);
+}
+
+/*
+ * Returns true if the interrupt for @vq is held back.  It is sent once
+ * coalesce_frames interrupts were held back, or coalesce_usecs after the
+ * first one.  In adaptive mode, a queue that did not interrupt for
+ * coalesce_usecs interrupts right away, so that coalescing only adds
+ * latency when the interrupt rate is high.
+ */
+static bool virtio_queue_coalesce(VirtQueue *vq)
+{
+    int64_t now;
+
+    if (!vq->coalesce_timer) {
+        return false;
+    }
+
+    now = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
+    if (!vq->coalesce_pending && vq->coalesce_adaptive &&
+        now - vq->coalesce_last_irq >= vq->coalesce_usecs) {
+        vq->coalesce_last_irq = now;
+        return false;
+    }
+
+    vq->coalesce_pending++;
+    if (vq->coalesce_frames && vq->coalesce_pending >= vq->coalesce_frames) {
+        timer_del(vq->coalesce_timer);
+        vq->coalesce_pending = 0;
+        vq->coalesce_last_irq = now;
+        return false;
+    }
+    if (vq->coalesce_pending == 1) {
+        timer_mod(vq->coalesce_timer, now + vq->coalesce_usecs);
+    }
+    return true;
+}
+
+/* virtio_queue_set_coalescing:
+ * @vq: The #VirtQueue
+ * @frames: Send an interrupt at the latest after this many, 0 for no limit
+ * @usecs: Hold back interrupts for at most this long, 0 to disable
+ * @adaptive: Only coalesce while the queue interrupts often
+ *
+ * Coalesce the interrupts sent by virtio_notify() for @vq.  Coalescing is
+ * disabled if @usecs is 0 or @frames is 1.
+ */
+void virtio_queue_set_coalescing(VirtQueue *vq, uint32_t frames,
+                                 uint32_t usecs, bool adaptive)
+{
+    bool enable = usecs && frames != 1;
+
+    if (vq->coalesce_pending) {
+        virtio_queue_coalesce_fire(vq);
+    }
+
+    if (enable && !vq->coalesce_timer) {
+        vq->coalesce_timer = timer_new_us(QEMU_CLOCK_VIRTUAL,
+                                          virtio_queue_coalesce_timer, vq);
+    } else if (!enable && vq->coalesce_timer) {
+        timer_free(vq->coalesce_timer);
+        vq->coalesce_timer = NULL;
+    }
+    vq->coalesce_frames = frames;
+    vq->coalesce_usecs = usecs;
+    vq->coalesce_adaptive = adaptive;
+    trace_virtio_queue_set_coalescing(vq, frames, usecs, adaptive);
+}
+
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
@@ -2567,6 +2933,10 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (virtio_queue_coalesce(vq)) {
+        return;
+    }
+
     trace_virtio_notify(vdev, vq);
     virtio_irq(vq);
 }
@@ -3210,8 +3580,19 @@ static void virtio_vmstate_change(void *opaque, int running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
+    int i;
+
     vdev->vm_running = running;
 
+    /* Held back interrupts are not migrated, send them now */
+    if (!running) {
+        for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+            if (vdev->vq[i].coalesce_pending) {
+                virtio_queue_coalesce_fire(&vdev->vq[i]);
+            }
+        }
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3719,6 +4100,10 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("x-coalesce-frames", VirtIODevice, coalesce_frames, 0),
+    DEFINE_PROP_UINT32("x-coalesce-usecs", VirtIODevice, coalesce_usecs, 0),
+    DEFINE_PROP_BOOL("x-coalesce-adaptive", VirtIODevice, coalesce_adaptive,
+                     false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
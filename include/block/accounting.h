@@ -27,6 +27,7 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-builtin-types.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
@@ -71,22 +72,30 @@ typedef struct BlockLatencyHistogram {
      *
      * So, for example above, histogram intervals are:
      * [0, 10), [10, 50), [50, 100), [100, +inf)
+     *
+     * The bins are updated without locking, while @nbins and @boundaries
+     * only change when no requests are being accounted.
      */
     int nbins;
     uint64_t *boundaries; /* @nbins-1 numbers here
                              (all boundaries, except 0 and +inf) */
-    uint64_t *bins;
+    Stat64 *bins;
 } BlockLatencyHistogram;
 
+/*
+ * The counters are updated locklessly on every request completion and
+ * read with stat64_get().  @lock only protects @intervals, so requests
+ * don't take it unless "stats-intervals" has been configured.
+ */
 struct BlockAcctStats {
     QemuMutex lock;
-    uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
-    uint64_t nr_ops[BLOCK_MAX_IOTYPE];
-    uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
-    uint64_t failed_ops[BLOCK_MAX_IOTYPE];
-    uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
-    uint64_t merged[BLOCK_MAX_IOTYPE];
-    int64_t last_access_time_ns;
+    Stat64 nr_bytes[BLOCK_MAX_IOTYPE];
+    Stat64 nr_ops[BLOCK_MAX_IOTYPE];
+    Stat64 invalid_ops[BLOCK_MAX_IOTYPE];
+    Stat64 failed_ops[BLOCK_MAX_IOTYPE];
+    Stat64 total_time_ns[BLOCK_MAX_IOTYPE];
+    Stat64 merged[BLOCK_MAX_IOTYPE];
+    Stat64 last_access_time_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
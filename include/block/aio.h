@@ -20,6 +20,7 @@
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qemu/timer.h"
 
 typedef struct BlockAIOCB BlockAIOCB;
@@ -195,6 +196,8 @@ struct AioContext {
      * Has its own locking.
      */
     struct ThreadPool *thread_pool;
+    int thread_pool_min;    /* see aio_context_set_thread_pool_params() */
+    int thread_pool_max;
 
 #ifdef CONFIG_LINUX_AIO
     /*
@@ -213,6 +216,7 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_multishot; /* IORING_POLL_ADD_MULTI is supported */
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -242,6 +246,11 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /* Userspace polling statistics, see aio_context_get_poll_stats() */
+    Stat64 poll_hits;
+    Stat64 poll_misses;
+    Stat64 poll_evictions;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
 
@@ -480,14 +489,36 @@ GSource *aio_get_g_source(AioContext *ctx);
 /* Return the ThreadPool bound to this AioContext */
 struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 
+/*
+ * Return the ThreadPool bound to this AioContext if it has been created.
+ * May be called from any thread.
+ */
+struct ThreadPool *aio_peek_thread_pool(AioContext *ctx);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of worker threads kept around even when idle
+ * @max: maximum number of worker threads
+ *
+ * Set the limits on the worker threads of @ctx's thread pool.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
 /* Setup the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/*
+ * Setup the LuringState bound to this AioContext.  @sqpoll and @sq_cpu only
+ * take effect when the LuringState is created, @sq_cpu is -1 to let the kernel
+ * choose where the submission queue polling thread runs.
+ */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, bool sqpoll,
+                                             int sq_cpu, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
@@ -717,4 +748,19 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+typedef struct AioPollStats {
+    uint64_t hits;      /* events found by userspace polling */
+    uint64_t misses;    /* events found by the fd monitor on polled handlers */
+    uint64_t evictions; /* handlers no longer polled for their low hit rate */
+} AioPollStats;
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: filled in with the polling statistics of @ctx
+ *
+ * May be called from any thread.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats);
+
 #endif
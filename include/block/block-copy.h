@@ -18,6 +18,8 @@
 #include "block/block.h"
 #include "qemu/co-shared-resource.h"
 
+#define BLOCK_COPY_MAX_WORKERS 64
+
 typedef void (*ProgressBytesCallbackFunc)(int64_t bytes, void *opaque);
 typedef struct BlockCopyState BlockCopyState;
 
@@ -33,6 +35,9 @@ void block_copy_set_progress_callback(
 
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
+void block_copy_set_perf(BlockCopyState *s, int max_workers, int64_t max_chunk);
+int64_t block_copy_preferred_bytes(BlockCopyState *s);
+
 void block_copy_state_free(BlockCopyState *s);
 
 int64_t block_copy_reset_unallocated(BlockCopyState *s,
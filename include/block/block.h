@@ -35,6 +35,11 @@ typedef struct BlockDriverInfo {
      * True if this block driver only supports compressed writes
      */
     bool needs_compressed_writes;
+    /*
+     * True if the driver lays out concurrent compressed writes in guest
+     * offset order by itself, so callers need not serialize them
+     */
+    bool orders_compressed_writes;
 } BlockDriverInfo;
 
 typedef struct BlockFragInfo {
@@ -16,6 +16,13 @@ typedef enum BitmapCheckFlags {
 
 #define BDRV_BITMAP_MAX_NAME_SIZE 1023
 
+/*
+ * Reads the stored contents of a lazily loaded bitmap into @bitmap, which is
+ * an empty, disabled bitmap with the same size and granularity.
+ */
+typedef int BdrvDirtyBitmapLoadFunc(BdrvDirtyBitmap *bitmap, void *opaque,
+                                    Error **errp);
+
 bool bdrv_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
                                           uint32_t granularity,
@@ -40,6 +47,11 @@ void bdrv_disable_dirty_bitmap(BdrvDirtyBitmap *bitmap);
 void bdrv_enable_dirty_bitmap(BdrvDirtyBitmap *bitmap);
 void bdrv_enable_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap);
 BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs);
+void bdrv_dirty_bitmap_set_lazy_load(BdrvDirtyBitmap *bitmap,
+                                     BdrvDirtyBitmapLoadFunc *load,
+                                     void *opaque);
+bool bdrv_dirty_bitmap_lazy(const BdrvDirtyBitmap *bitmap);
+int bdrv_dirty_bitmap_load(BdrvDirtyBitmap *bitmap, Error **errp);
 uint32_t bdrv_get_default_bitmap_granularity(BlockDriverState *bs);
 uint32_t bdrv_dirty_bitmap_granularity(const BdrvDirtyBitmap *bitmap);
 bool bdrv_dirty_bitmap_enabled(BdrvDirtyBitmap *bitmap);
@@ -60,14 +60,21 @@ void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, int sq_cpu, Error **errp);
+bool luring_uses_sqpoll(LuringState *s);
 void luring_cleanup(LuringState *s);
 int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
                                 uint64_t offset, QEMUIOVector *qiov, int type);
+int coroutine_fn luring_co_submit_discard(BlockDriverState *bs,
+                                          LuringState *s, int fd,
+                                          uint64_t offset, uint64_t bytes);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 void luring_io_plug(BlockDriverState *bs, LuringState *s);
 void luring_io_unplug(BlockDriverState *bs, LuringState *s);
+int luring_register_file(LuringState *s, int fd);
+void luring_unregister_file(LuringState *s, int fd);
+void luring_enable_fixed_buffers(LuringState *s);
 #endif
 
 #ifdef _WIN32
@@ -24,8 +24,23 @@ typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+/* Default limits on the worker threads of a pool */
+#define THREAD_POOL_MIN_THREADS_DEFAULT 0
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
+
+typedef struct ThreadPoolStats {
+    int threads;                /* worker threads */
+    int max_queue_depth;        /* most requests waiting for a worker */
+    uint64_t requests;          /* requests completed by the workers */
+    uint64_t queue_ns;          /* total time requests waited for a worker */
+    uint64_t run_ns;            /* total time workers spent on requests */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
+void thread_pool_set_params(ThreadPool *pool, int min_threads,
+                            int max_threads);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
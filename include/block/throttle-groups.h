@@ -49,9 +49,21 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Credit reserved in the group's buckets with throttle_reserve_credit()
+     * that requests from this member can spend without taking the
+     * ThrottleGroup lock.  It is only spent from the member's AioContext
+     * but is revoked by other threads, so it is accessed with atomic
+     * operations.  credit_op_size caches the group's op_size (0 if unset).
+     */
+    int          credit_bytes[2];
+    int          credit_ops[2];
+    unsigned int credit_op_size;
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
-     * throttle_state tells us if I/O limits are configured. */
+     * throttle_state tells us if I/O limits are configured.
+     * pending_reqs is also read without the lock, so it is written with
+     * atomic operations. */
     ThrottleState *throttle_state;
     ThrottleTimers throttle_timers;
     unsigned       pending_reqs[2];
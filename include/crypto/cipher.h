@@ -161,6 +161,27 @@ QCryptoCipher *qcrypto_cipher_new(QCryptoCipherAlgorithm alg,
                                   const uint8_t *key, size_t nkey,
                                   Error **errp);
 
+/**
+ * qcrypto_cipher_new_backend:
+ * @alg: the symmetric cipher algorithm
+ * @mode: the cipher usage mode
+ * @backend: the implementation to use
+ * @key: the private key bytes
+ * @nkey: the length of @key
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qcrypto_cipher_new(), but with an explicit choice of
+ * implementation.  With QCRYPTO_CIPHER_BACKEND_AFALG, it is
+ * an error if the kernel crypto API cannot provide the cipher.
+ *
+ * Returns: a new cipher object, or NULL on error
+ */
+QCryptoCipher *qcrypto_cipher_new_backend(QCryptoCipherAlgorithm alg,
+                                          QCryptoCipherMode mode,
+                                          QCryptoCipherBackend backend,
+                                          const uint8_t *key, size_t nkey,
+                                          Error **errp);
+
 /**
  * qcrypto_cipher_free:
  * @cipher: the cipher object
@@ -235,4 +256,59 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * qcrypto_cipher_encrypt_sectors:
+ * @cipher: the cipher object
+ * @ivs: the initialization vectors, @niv bytes for each sector
+ * @niv: the length of each initialization vector
+ * @sectorsize: the size of each sector
+ * @in: buffer holding the plain text input data
+ * @out: buffer to fill with the cipher text output data
+ * @len: the length of @in and @out buffers, a multiple of @sectorsize
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Encrypts @len bytes of data as consecutive sectors, each
+ * with its own initialization vector.  The result is the
+ * same as calling qcrypto_cipher_setiv() and
+ * qcrypto_cipher_encrypt() for each sector in turn, but
+ * backends that can work on several sectors at once, such
+ * as XTS, are given the whole buffer.  The initialization
+ * vector that was set on @cipher is not used and may be
+ * changed by this call.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_encrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp);
+
+/**
+ * qcrypto_cipher_decrypt_sectors:
+ * @cipher: the cipher object
+ * @ivs: the initialization vectors, @niv bytes for each sector
+ * @niv: the length of each initialization vector
+ * @sectorsize: the size of each sector
+ * @in: buffer holding the cipher text input data
+ * @out: buffer to fill with the plain text output data
+ * @len: the length of @in and @out buffers, a multiple of @sectorsize
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Decrypts @len bytes of data as consecutive sectors, each
+ * with its own initialization vector, like
+ * qcrypto_cipher_encrypt_sectors() does for encryption.
+ *
+ * Returns: 0 on success, or -1 on error
+ */
+int qcrypto_cipher_decrypt_sectors(QCryptoCipher *cipher,
+                                   const uint8_t *ivs, size_t niv,
+                                   size_t sectorsize,
+                                   const void *in,
+                                   void *out,
+                                   size_t len,
+                                   Error **errp);
+
 #endif /* QCRYPTO_CIPHER_H */
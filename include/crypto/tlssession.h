@@ -321,4 +321,25 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_offload:
+ * @sess: the TLS session object
+ * @fd: the TCP socket that carries the session
+ * @tx: set to whether the kernel now encrypts what is written to @fd
+ * @rx: set to whether the kernel now decrypts what is read from @fd
+ *
+ * Hand the record protocol of a session whose handshake has
+ * completed to the kernel TLS implementation, if the host, the
+ * negotiated protocol version and the cipher allow it.  Each
+ * direction is handled separately: once it is offloaded, payload
+ * data must be written to, or read from, @fd directly instead of
+ * going through qcrypto_tls_session_write() or
+ * qcrypto_tls_session_read().  Directions that are not offloaded
+ * keep working as before, so failures are not errors.
+ */
+void qcrypto_tls_session_offload(QCryptoTLSSession *sess,
+                                 int fd,
+                                 bool *tx,
+                                 bool *rx);
+
 #endif /* QCRYPTO_TLSSESSION_H */
@@ -78,5 +78,55 @@ void xts_encrypt(const void *datactx,
                  uint8_t *dst,
                  const uint8_t *src);
 
+/**
+ * xts_decrypt_sectors:
+ * @datactx: the cipher context for data decryption
+ * @tweakctx: the cipher context for tweak encryption
+ * @encfunc: the cipher function for encryption
+ * @decfunc: the cipher function for decryption
+ * @ivs: the initialization vector tweaks, XTS_BLOCK_SIZE bytes per sector
+ * @sectorsize: the size of each sector, a multiple of XTS_BLOCK_SIZE
+ * @length: the length of @dst and @src, a multiple of @sectorsize
+ * @dst: buffer to hold the decrypted plaintext
+ * @src: buffer providing the ciphertext
+ *
+ * Decrypts @src into @dst as consecutive sectors, each with its own
+ * tweak; the result is the same as calling xts_decrypt() on each sector.
+ */
+void xts_decrypt_sectors(const void *datactx,
+                         const void *tweakctx,
+                         xts_cipher_func *encfunc,
+                         xts_cipher_func *decfunc,
+                         const uint8_t *ivs,
+                         size_t sectorsize,
+                         size_t length,
+                         uint8_t *dst,
+                         const uint8_t *src);
+
+/**
+ * xts_encrypt_sectors:
+ * @datactx: the cipher context for data encryption
+ * @tweakctx: the cipher context for tweak encryption
+ * @encfunc: the cipher function for encryption
+ * @decfunc: the cipher function for decryption
+ * @ivs: the initialization vector tweaks, XTS_BLOCK_SIZE bytes per sector
+ * @sectorsize: the size of each sector, a multiple of XTS_BLOCK_SIZE
+ * @length: the length of @dst and @src, a multiple of @sectorsize
+ * @dst: buffer to hold the encrypted ciphertext
+ * @src: buffer providing the plaintext
+ *
+ * Encrypts @src into @dst as consecutive sectors, each with its own
+ * tweak; the result is the same as calling xts_encrypt() on each sector.
+ */
+void xts_encrypt_sectors(const void *datactx,
+                         const void *tweakctx,
+                         xts_cipher_func *encfunc,
+                         xts_cipher_func *decfunc,
+                         const uint8_t *ivs,
+                         size_t sectorsize,
+                         size_t length,
+                         uint8_t *dst,
+                         const uint8_t *src);
+
 
 #endif /* QCRYPTO_XTS_H */
@@ -410,6 +410,7 @@ static inline bool tlb_hit(target_ulong tlb_addr, target_ulong addr)
 #ifdef CONFIG_TCG
 void dump_drift_info(void);
 void dump_exec_info(void);
+void dump_exec_info_at_exit(void);
 void dump_opcount_info(void);
 #endif /* CONFIG_TCG */
 
@@ -211,6 +211,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Lookups that missed the fast path table, and hit the victim TLB */
+    size_t miss_count;
+    size_t victim_hit_count;
 } CPUTLBCommon;
 
 /*
@@ -220,6 +220,60 @@ void tlb_flush_page_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
  */
 void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *cpu, target_ulong addr,
                                               uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: start of the range of virtual addresses to be flushed
+ * @len: length of the range
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush every page that overlaps the range from the TLB of the
+ * specified CPU, for the specified MMU indexes.  This is a single
+ * operation, and a single cross-vCPU work item, for the whole range;
+ * ranges larger than the TLB flush the specified MMU indexes entirely.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: start of the range of virtual addresses to be flushed
+ * @len: length of the range
+ *
+ * Like tlb_flush_range_by_mmuidx, for all MMU indexes.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @cpu: Originating CPU of the flush
+ * @addr: start of the range of virtual addresses to be flushed
+ * @len: length of the range
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the specified
+ * MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap);
+void tlb_flush_range_all_cpus(CPUState *src, target_ulong addr,
+                              target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @addr: start of the range of virtual addresses to be flushed
+ * @len: length of the range
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Like tlb_flush_range_by_mmuidx_all_cpus except the source vCPUs
+ * work is scheduled as safe work, see
+ * tlb_flush_page_by_mmuidx_all_cpus_synced.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap);
+void tlb_flush_range_all_cpus_synced(CPUState *src, target_ulong addr,
+                                     target_ulong len);
 /**
  * tlb_flush_by_mmuidx:
  * @cpu: CPU whose TLB should be flushed
@@ -337,6 +391,37 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                        uint16_t idxmap)
 {
 }
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu,
+                                             target_ulong addr,
+                                             target_ulong len,
+                                             uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu,
+                                                      target_ulong addr,
+                                                      target_ulong len,
+                                                      uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_all_cpus(CPUState *src, target_ulong addr,
+                                            target_ulong len)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                             target_ulong addr,
+                                                             target_ulong len,
+                                                             uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_all_cpus_synced(CPUState *src,
+                                                   target_ulong addr,
+                                                   target_ulong len)
+{
+}
 #endif
 /**
  * probe_access:
@@ -483,6 +568,20 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Number of times the TB was entered, incremented by the generated
+     * code if tb_exec_count_enabled.  Updates from several vCPUs are not
+     * atomic, so this is only an estimate with MTTCG.
+     */
+    uint64_t exec_count;
+
+    /*
+     * Copy of the guest code the TB was translated from, kept after the
+     * search data if tb_revive_enabled, or NULL.  Once invalidated, the
+     * TB can be linked again as long as the guest code matches the copy.
+     */
+    const uint8_t *guest_code;
 };
 
 extern bool parallel_cpus;
@@ -508,6 +607,14 @@ void tb_invalidate_phys_range(target_ulong start, target_ulong end);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 #endif
 void tb_flush(CPUState *cpu);
+/* Jump cache size of the vCPUs realized from now on, in bits of index */
+extern unsigned int tb_jmp_cache_bits;
+void tb_jmp_cache_init(CPUState *cpu);
+void tb_jmp_cache_destroy(CPUState *cpu);
+/* Count the executions of the TBs translated from now on */
+extern bool tb_exec_count_enabled;
+/* Reuse invalidated TBs whose guest code turns out to be unchanged */
+extern bool tb_revive_enabled;
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    target_ulong cs_base, uint32_t flags,
@@ -631,6 +738,8 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr);
 
 /* exec.c */
 void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr);
+void tb_flush_jmp_cache_range(CPUState *cpu, target_ulong addr,
+                              target_ulong len);
 
 MemoryRegionSection *
 address_space_translate_for_iotlb(CPUState *cpu, int asidx, hwaddr addr,
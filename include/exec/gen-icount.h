@@ -69,6 +69,17 @@ static inline void gen_tb_start(TranslationBlock *tb)
     }
 
     tcg_temp_free_i32(count);
+
+    if (tb_exec_count_enabled) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+        TCGv_i64 exec_count = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(exec_count, ptr, 0);
+        tcg_gen_addi_i64(exec_count, exec_count, 1);
+        tcg_gen_st_i64(exec_count, ptr, 0);
+        tcg_temp_free_i64(exec_count);
+        tcg_temp_free_ptr(ptr);
+    }
 }
 
 static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
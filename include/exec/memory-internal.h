@@ -49,5 +49,10 @@ void address_space_dispatch_free(AddressSpaceDispatch *d);
 
 void mtree_print_dispatch(struct AddressSpaceDispatch *d,
                           MemoryRegion *root);
+
+IOMMUTLBEntry memory_region_iommu_translate_cached(IOMMUMemoryRegion *iommu_mr,
+                                                   hwaddr addr,
+                                                   IOMMUAccessFlags flag,
+                                                   int iommu_idx);
 #endif
 #endif
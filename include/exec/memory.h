@@ -124,6 +124,16 @@ typedef struct IOMMUNotifier IOMMUNotifier;
 /* RAM is a persistent kind memory */
 #define RAM_PMEM (1 << 5)
 
+/* RAM is registered for userfaultfd write protection, during a
+ * background snapshot
+ */
+#define RAM_UF_WRITEPROTECT (1 << 6)
+
+/* RAM is persistent memory mapped with MAP_SYNC: flushing the CPU caches
+ * is enough to make stores durable, without fsync() (set by QEMU)
+ */
+#define RAM_SYNC (1 << 7)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -426,17 +436,24 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    /* aliases whose @alias is this region */
+    QTAILQ_HEAD(, MemoryRegion) alias_users;
+    QTAILQ_ENTRY(MemoryRegion) alias_users_link;
     QTAILQ_HEAD(, CoalescedMemoryRange) coalesced;
     const char *name;
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
 };
 
+typedef struct IOMMUTLBCache IOMMUTLBCache;
+
 struct IOMMUMemoryRegion {
     MemoryRegion parent_obj;
 
     QLIST_HEAD(, IOMMUNotifier) iommu_notify;
     IOMMUNotifierFlag iommu_notify_flags;
+    /* See memory_region_iommu_enable_tlb_cache(); accessed via RCU */
+    IOMMUTLBCache *tlb_cache;
 };
 
 #define IOMMU_NOTIFIER_FOREACH(n, mr) \
@@ -559,6 +576,17 @@ struct MemoryListener {
      */
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
 
+    /**
+     * @log_sync_global:
+     *
+     * This is the global version of @log_sync, for listeners that can
+     * only synchronize the whole dirty log at once.  A listener sets
+     * either @log_sync or @log_sync_global, never both.
+     *
+     * @listener: The #MemoryListener.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
+
     /**
      * @log_clear:
      *
@@ -680,6 +708,9 @@ struct MemoryListener {
     QTAILQ_ENTRY(MemoryListener) link_as;
 };
 
+/* One page, what address_space_map() could always bounce at once */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
 /**
  * struct AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
@@ -696,6 +727,15 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Bounce buffers handed out by address_space_map() */
+    size_t max_bounce_buffer_size;
+    /* Total size of the bounce buffers in use, accessed atomically */
+    size_t bounce_buffer_size;
+    /* Protects @bounce_buffers and @map_client_list */
+    QemuMutex bounce_lock;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1332,6 +1372,25 @@ void memory_region_notify_one(IOMMUNotifier *notifier,
 int memory_region_register_iommu_notifier(MemoryRegion *mr,
                                           IOMMUNotifier *n, Error **errp);
 
+/**
+ * memory_region_iommu_enable_tlb_cache: cache the translations of an IOMMU
+ *
+ * Lets the memory core remember the entries returned by the @translate
+ * callback of @iommu_mr, so that repeated DMA to the same pages does not
+ * go through the IOMMU model every time.  Cached entries are dropped when
+ * the IOMMU sends an IOMMU_NOTIFIER_UNMAP notification covering them, so
+ * only IOMMUs that notify every invalidation of a translation, like they
+ * must for vhost's device IOTLB, may enable the cache.
+ *
+ * Returns 0 on success, or a negative errno if the IOMMU refused the
+ * notifier needed by the cache.
+ *
+ * @iommu_mr: the IOMMU memory region whose translations are cached
+ * @errp: pointer to Error*, to store an error if it happens.
+ */
+int memory_region_iommu_enable_tlb_cache(IOMMUMemoryRegion *iommu_mr,
+                                         Error **errp);
+
 /**
  * memory_region_iommu_replay: replay existing IOMMU translations to
  * a notifier with the minimum page granularity returned by
@@ -2328,10 +2387,12 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  *
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
- * the mapping are exhausted.
+ * the mapping are exhausted.  Regions that are not directly accessible RAM
+ * go through bounce buffers, of which @as has at most
+ * @max_bounce_buffer_size bytes in use at any time.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2356,6 +2417,23 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len);
 
+/* address_space_register_map_client: get notified when a map may succeed
+ *
+ * Schedules @bh once @as has bounce buffer space available again, which
+ * may be right away.  The registration is dropped after @bh is scheduled.
+ *
+ * @as: #AddressSpace that address_space_map() failed on
+ * @bh: bottom half to schedule
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: cancel a map client registration
+ *
+ * @as: #AddressSpace passed to address_space_register_map_client()
+ * @bh: bottom half passed to address_space_register_map_client()
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
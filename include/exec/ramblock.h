@@ -21,6 +21,7 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "cpu-common.h"
+#include "qemu/interval-tree.h"
 
 struct RAMBlock {
     struct rcu_head rcu;
@@ -36,6 +37,9 @@ struct RAMBlock {
     char idstr[256];
     /* RCU-enabled, writes protected by the ramlist lock */
     QLIST_ENTRY(RAMBlock) next;
+    /* In ram_list.offset_tree and ram_list.host_tree, same protection */
+    IntervalTreeNode offset_node;
+    IntervalTreeNode host_node;
     QLIST_HEAD(, RAMBlockNotifier) ramblock_notifiers;
     int fd;
     size_t page_size;
@@ -59,6 +63,16 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * With the mapped-ram capability every page of the block has a
+     * fixed place in the migration file, starting at @pages_offset.
+     * @file_bmap tracks which of them hold data, it is stored at
+     * @bitmap_offset at the end of migration.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 #endif
 #endif
@@ -5,6 +5,7 @@
 #include "qemu/thread.h"
 #include "qemu/rcu.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/interval-tree.h"
 
 typedef struct RAMBlockNotifier RAMBlockNotifier;
 
@@ -49,6 +50,12 @@ typedef struct RAMList {
     RAMBlock *mru_block;
     /* RCU-enabled, writes protected by the ramlist lock. */
     QLIST_HEAD(, RAMBlock) blocks;
+    /*
+     * The blocks by ram_addr_t range and by host address range, for
+     * lookups that do not want to walk the list.  Same protection.
+     */
+    IntervalTreeRoot offset_tree;
+    IntervalTreeRoot host_tree;
     DirtyMemoryBlocks *dirty_memory[DIRTY_MEMORY_NUM];
     uint32_t version;
     QLIST_HEAD(, RAMBlockNotifier) ramblock_notifiers;
@@ -22,6 +22,7 @@
 
 #include "qemu/thread.h"
 #include "qemu/qht.h"
+#include "qemu/stats64.h"
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
@@ -32,9 +33,20 @@ typedef struct TBContext TBContext;
 struct TBContext {
 
     struct qht htable;
+    /* invalidated TBs that may be revived, if tb_revive_enabled */
+    struct qht dead_htable;
 
     /* statistics */
     unsigned tb_flush_count;
+    /* TBs translated, and host ticks spent in tb_gen_code() for them */
+    size_t gen_count;
+    Stat64 gen_ticks;
+    /* invalidated TBs linked again instead of being translated */
+    size_t revive_count;
+    /* writes to pages holding translated code */
+    size_t smc_write_count;
+    /* ... of which the code bitmap showed that no TB was hit */
+    size_t smc_bitmap_skip_count;
 };
 
 extern TBContext tb_ctx;
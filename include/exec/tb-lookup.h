@@ -16,35 +16,69 @@
 #include "exec/exec-all.h"
 #include "exec/tb-hash.h"
 
+static inline TBJmpCacheSet *tb_jmp_cache_set(CPUState *cpu, target_ulong pc)
+{
+    return &cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc,
+                                                     cpu->tb_jmp_cache_bits)];
+}
+
+/* Make @tb the most recently used entry of its set, demoting the old one */
+static inline void tb_jmp_cache_insert(TBJmpCacheSet *set,
+                                       TranslationBlock *tb)
+{
+    qatomic_set(&set->tb[1], qatomic_read(&set->tb[0]));
+    qatomic_set(&set->tb[0], tb);
+}
+
+static inline void tb_jmp_cache_count(size_t *counter)
+{
+    qatomic_set(counter, *counter + 1);
+}
+
+static inline bool tb_jmp_cache_match(CPUState *cpu,
+                                      const TranslationBlock *tb,
+                                      target_ulong pc, target_ulong cs_base,
+                                      uint32_t flags, uint32_t cf_mask)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask;
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *
 tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
                      uint32_t *flags, uint32_t cf_mask)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
+    TBJmpCacheSet *set;
     TranslationBlock *tb;
-    uint32_t hash;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
-    hash = tb_jmp_cache_hash_func(*pc);
-    tb = qatomic_rcu_read(&cpu->tb_jmp_cache[hash]);
+    set = tb_jmp_cache_set(cpu, *pc);
+    tb = qatomic_rcu_read(&set->tb[0]);
 
     cf_mask &= ~CF_CLUSTER_MASK;
     cf_mask |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
-    if (likely(tb &&
-               tb->pc == *pc &&
-               tb->cs_base == *cs_base &&
-               tb->flags == *flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
+    if (likely(tb_jmp_cache_match(cpu, tb, *pc, *cs_base, *flags, cf_mask))) {
+        tb_jmp_cache_count(&cpu->tb_jmp_cache_hits[0]);
         return tb;
     }
-    tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
-    if (tb == NULL) {
-        return NULL;
+    tb = qatomic_rcu_read(&set->tb[1]);
+    if (tb_jmp_cache_match(cpu, tb, *pc, *cs_base, *flags, cf_mask)) {
+        tb_jmp_cache_count(&cpu->tb_jmp_cache_hits[1]);
+    } else {
+        tb_jmp_cache_count(&cpu->tb_jmp_cache_misses);
+        tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
+        if (tb == NULL) {
+            return NULL;
+        }
     }
-    qatomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_insert(set, tb);
     return tb;
 }
 
@@ -274,12 +274,33 @@ typedef struct SavedIOTLB {
 #endif
 
 struct KVMState;
+struct KVMVcpuStats;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 struct hax_vcpu_state;
 
+/*
+ * Default, minimum and maximum number of bits of the jump cache index;
+ * the size is set with -accel tcg,jmp-cache-size.  The maximum keeps
+ * the page part of the softmmu hash within TARGET_PAGE_BITS.
+ */
 #define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_BITS_MIN 6
+#define TB_JMP_CACHE_BITS_MAX 20
+
+/*
+ * The jump cache is two-way set associative.  Way 0 holds the TB found
+ * most recently for a hash, way 1 the TB that it replaced: guests with
+ * many indirect branches, such as interpreters and JITs, often
+ * alternate between two targets that hash to the same set, and would
+ * otherwise go to the qht on every branch.
+ */
+#define TB_JMP_CACHE_WAYS 2
+
+typedef struct TBJmpCacheSet {
+    struct TranslationBlock *tb[TB_JMP_CACHE_WAYS];
+} TBJmpCacheSet;
 
 /* work queue */
 
@@ -345,6 +366,7 @@ struct qemu_work_item;
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_vcpu_stats: Exit statistics of the vCPU, for KVM.
  * @work_mutex: Lock to prevent multiple access to @work_list.
  * @work_list: List of pending asynchronous work.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -373,6 +395,12 @@ struct CPUState {
     bool running, has_waiter;
     struct QemuCond *halt_cond;
     bool thread_kicked;
+    /* Userspace halt polling, see qemu_wait_io_event() */
+    bool halt_poll_kicked;
+    uint64_t halt_poll_ns;
+    uint64_t halt_poll_hits;
+    uint64_t halt_poll_misses;
+    uint64_t halt_poll_total_ns;
     bool created;
     bool stop;
     bool stopped;
@@ -405,7 +433,11 @@ struct CPUState {
     IcountDecr *icount_decr_ptr;
 
     /* Accessed in parallel; all accesses must be atomic */
-    struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    TBJmpCacheSet *tb_jmp_cache;
+    unsigned int tb_jmp_cache_bits;
+    /* Only written by the vCPU thread, read with qatomic_read */
+    size_t tb_jmp_cache_hits[TB_JMP_CACHE_WAYS];
+    size_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -428,6 +460,14 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    struct KVMVcpuStats *kvm_vcpu_stats;
+    /*
+     * Pages dirtied by the vCPU, as far as the KVM dirty ring tells.
+     * Protected by the iothread lock.
+     */
+    uint64_t dirty_pages;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -455,6 +495,8 @@ struct CPUState {
      * autoconverge
      */
     bool throttle_thread_scheduled;
+    /* Throttle percentage of this vCPU alone, see cpu_throttle_set_vcpu() */
+    int throttle_percentage;
 
     bool ignore_memory_transaction_failures;
 
@@ -479,10 +521,15 @@ extern __thread CPUState *current_cpu;
 
 static inline void cpu_tb_jmp_cache_clear(CPUState *cpu)
 {
-    unsigned int i;
+    unsigned int i, j;
 
-    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
-        qatomic_set(&cpu->tb_jmp_cache[i], NULL);
+    if (!cpu->tb_jmp_cache) {
+        return;
+    }
+    for (i = 0; i < (1u << cpu->tb_jmp_cache_bits); i++) {
+        for (j = 0; j < TB_JMP_CACHE_WAYS; j++) {
+            qatomic_set(&cpu->tb_jmp_cache[i].tb[j], NULL);
+        }
     }
 }
 
@@ -25,7 +25,9 @@
 #define HW_IDE_AHCI_H
 
 #include "hw/sysbus.h"
+#include "qemu/event_notifier.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 typedef struct AHCIDevice AHCIDevice;
 
@@ -49,6 +51,12 @@ typedef struct AHCIState {
     int32_t ports;
     qemu_irq irq;
     AddressSpace *as;
+
+    /* Drives are served here; MMIO and BHs of the main loop take the lock */
+    IOThread *iothread;
+    AioContext *ctx;
+    /* Updates the interrupt from the main loop for the IOThread */
+    EventNotifier irq_notifier;
 } AHCIState;
 
 
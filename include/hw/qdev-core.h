@@ -6,6 +6,7 @@
 #include "qom/object.h"
 #include "hw/hotplug.h"
 #include "hw/resettable.h"
+#include "qapi/qapi-types-machine.h"
 
 enum {
     DEV_NVECTORS_UNSPECIFIED = -1,
@@ -419,6 +420,12 @@ void qdev_unplug(DeviceState *dev, Error **errp);
 void qdev_simple_device_unplug_cb(HotplugHandler *hotplug_dev,
                                   DeviceState *dev, Error **errp);
 void qdev_machine_creation_done(void);
+
+/*
+ * Returns how long the devices realized before machine init was done took
+ * to realize, with their start times in get_clock() time.
+ */
+DeviceRealizeTimeInfoList *qdev_get_startup_realize_times(void);
 bool qdev_machine_modified(void);
 
 /**
@@ -65,6 +65,16 @@ typedef struct VFIOAddressSpace {
 
 struct VFIOGroup;
 
+/* A mapping of guest RAM, issued when the memory transaction commits */
+typedef struct VFIODMAPending {
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    MemoryRegion *mr;
+    QSIMPLEQ_ENTRY(VFIODMAPending) next;
+} VFIODMAPending;
+
 typedef struct VFIOContainer {
     VFIOAddressSpace *space;
     int fd; /* /dev/vfio/vfio, empowered by the attached groups */
@@ -77,6 +87,7 @@ typedef struct VFIOContainer {
     QLIST_HEAD(, VFIOGuestIOMMU) giommu_list;
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
+    QSIMPLEQ_HEAD(, VFIODMAPending) pending_maps;
     QLIST_ENTRY(VFIOContainer) next;
 } VFIOContainer;
 
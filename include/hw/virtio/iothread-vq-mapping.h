@@ -0,0 +1,63 @@
+/*
+ * Mapping of virtqueues to IOThreads (iothread-vq-mapping property)
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_VIRTIO_IOTHREAD_VQ_MAPPING_H
+#define HW_VIRTIO_IOTHREAD_VQ_MAPPING_H
+
+#include "sysemu/iothread.h"
+
+/**
+ * iothread_vq_mapping_apply:
+ * @ids: IOThread ids from the iothread-vq-mapping property
+ * @num_ids: number of elements in @ids
+ * @num_queues: number of queues that are assigned to the IOThreads
+ * @iothreads: set to a new array of references to the IOThreads
+ * @num_iothreads: set to the number of elements in @iothreads
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Look up the IOThreads named in the iothread-vq-mapping property of a
+ * device.  Queues are assigned to them round-robin, see
+ * iothread_vq_mapping_get_aio_context().  On failure, @iothreads and
+ * @num_iothreads are left empty.
+ *
+ * Context: QEMU global mutex held
+ *
+ * Returns: true on success, false on failure
+ */
+bool iothread_vq_mapping_apply(char **ids, uint32_t num_ids,
+                               uint32_t num_queues, IOThread ***iothreads,
+                               unsigned *num_iothreads, Error **errp);
+
+/**
+ * iothread_vq_mapping_cleanup:
+ * @iothreads: the array set by iothread_vq_mapping_apply()
+ * @num_iothreads: the number of elements in @iothreads
+ *
+ * Drop the references taken by iothread_vq_mapping_apply(), and free and
+ * clear the array.
+ *
+ * Context: QEMU global mutex held
+ */
+void iothread_vq_mapping_cleanup(IOThread ***iothreads,
+                                 unsigned *num_iothreads);
+
+/**
+ * iothread_vq_mapping_get_aio_context:
+ * @iothreads: the array set by iothread_vq_mapping_apply()
+ * @num_iothreads: the number of elements in @iothreads
+ * @queue: index of the queue
+ *
+ * Returns: the AioContext of the IOThread that handles @queue
+ */
+static inline AioContext *
+iothread_vq_mapping_get_aio_context(IOThread **iothreads,
+                                    unsigned num_iothreads, unsigned queue)
+{
+    return iothread_get_aio_context(iothreads[queue % num_iothreads]);
+}
+
+#endif
@@ -16,6 +16,8 @@
 
 typedef struct vhost_vdpa {
     int device_fd;
+    /* position of this vhost_dev among those sharing @device_fd */
+    int index;
     uint32_t msg_type;
     MemoryListener listener;
     struct vhost_dev *dev;
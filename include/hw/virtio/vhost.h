@@ -74,6 +74,8 @@ struct vhost_dev {
     int nvqs;
     /* the first virtqueue which would be used by this vhost dev */
     int vq_index;
+    /* one past the last vq index of the virtio device (not vhost) */
+    int vq_index_end;
     uint64_t features;
     uint64_t acked_features;
     uint64_t backend_features;
@@ -65,6 +65,20 @@ struct VirtIOBalloon {
      */
     bool block_iothread;
     NotifierWithReturn free_page_hint_notify;
+    NotifierWithReturn free_page_report_notify;
+    /* Set while free page reports are passed on to migration */
+    bool free_page_report_migrating;
+    /* Free page reports being discarded by report_thread */
+    GPtrArray *report_elems;
+    GArray *report_ranges;
+    bool report_busy;           /* report_elems is not empty */
+    QemuThread report_thread;
+    QEMUBH *report_bh;
+    /* Protects report_queued and report_quit */
+    QemuMutex report_lock;
+    QemuCond report_cond;
+    bool report_queued;         /* report_thread has work to do */
+    bool report_quit;
     int64_t stats_last_update;
     int64_t stats_poll_interval;
     uint32_t host_features;
@@ -36,6 +36,8 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    uint32_t num_iothread_vq_mapping;
+    char **iothread_vq_mapping;     /* IOThread ids, assigned round-robin */
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
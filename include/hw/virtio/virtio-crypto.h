@@ -57,6 +57,9 @@ typedef struct VirtIOCryptoConf {
     uint32_t max_auth_key_len;
     /* Maximum size of each crypto request's content */
     uint64_t max_size;
+
+    uint32_t num_iothread_vq_mapping;
+    char **iothread_vq_mapping;     /* IOThread ids, assigned round-robin */
 } VirtIOCryptoConf;
 
 struct VirtIOCrypto;
@@ -80,6 +83,13 @@ typedef struct VirtIOCryptoQueue {
     VirtQueue *dataq;
     QEMUBH *dataq_bh;
     struct VirtIOCrypto *vcrypto;
+    /* Where the queue is served when IOThreads are started */
+    AioContext *ctx;
+    /* Requests submitted to the backend and not completed yet */
+    unsigned int inflight;
+    /* Completions only mark the interrupt pending while popping requests */
+    bool batching;
+    bool notify_pending;
 } VirtIOCryptoQueue;
 
 struct VirtIOCrypto {
@@ -97,6 +107,11 @@ struct VirtIOCrypto {
     uint32_t curr_queues;
     size_t config_size;
     uint8_t vhost_started;
+
+    /* IOThreads from the iothread-vq-mapping property */
+    IOThread **vq_iothreads;
+    unsigned int num_vq_iothreads;
+    bool iothreads_started;
 };
 
 #endif /* QEMU_VIRTIO_CRYPTO_H */
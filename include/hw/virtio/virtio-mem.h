@@ -67,6 +67,18 @@ struct VirtIOMEM {
 
     /* don't migrate unplugged memory */
     NotifierWithReturn precopy_notifier;
+
+    /* preallocation and discards, done by worker_thread */
+    QemuThread worker_thread;
+    QemuMutex worker_lock;
+    QemuCond worker_cond;
+    QSIMPLEQ_HEAD(, VirtIOMEMJob) jobs;
+    QSIMPLEQ_HEAD(, VirtIOMEMJob) done_jobs;
+    bool worker_busy;
+    bool worker_quit;
+    QEMUBH *worker_bh;
+    /* jobs that were not completed yet, only used by the main loop */
+    unsigned int nr_jobs;
 };
 
 struct VirtIOMEMClass {
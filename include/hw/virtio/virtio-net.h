@@ -19,6 +19,8 @@
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
 #include "qemu/option_int.h"
+#include "qemu/thread.h"
+#include "sysemu/iothread.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
@@ -45,6 +47,8 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    uint32_t num_iothread_vq_mapping;
+    char **iothread_vq_mapping;     /* IOThread ids, assigned round-robin */
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -139,16 +143,37 @@ typedef struct VirtioNetRssData {
     uint16_t default_queue;
 } VirtioNetRssData;
 
+/* Per-queue TX statistics, collected with tx=adaptive */
+typedef struct VirtIONetTxStats {
+    uint64_t immediate;         /* kicks flushed by the bottom half */
+    uint64_t coalesced;         /* kicks that waited for the TX timer */
+    uint64_t flushes;
+    uint64_t packets;
+    uint64_t rate;              /* packets per second, moving average */
+} VirtIONetTxStats;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     uint32_t tx_waiting;
+    int64_t tx_last_flush;
+    int32_t tx_last_batch;
+    VirtIONetTxStats tx_stats;
     struct {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+
+    /* IOThread that owns the queue pair, NULL if it stays in the main loop */
+    AioContext *ctx;
+    QEMUBH *iothread_tx_bh;
+    QEMUBH *rx_bh;
+    /* Packets steered here by RSS from queue pairs in other IOThreads */
+    QemuMutex rx_backlog_lock;
+    QSIMPLEQ_HEAD(, VirtIONetRxPacket) rx_backlog;
+    unsigned int rx_backlog_len;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -163,6 +188,7 @@ struct VirtIONet {
     QTAILQ_HEAD(, VirtioNetRscChain) rsc_chains;
     uint32_t tx_timeout;
     int32_t tx_burst;
+    bool tx_adaptive;
     uint32_t has_vnet_hdr;
     size_t host_hdr_len;
     size_t guest_hdr_len;
@@ -179,6 +205,10 @@ struct VirtIONet {
     uint8_t nouni;
     uint8_t nobcast;
     uint8_t vhost_started;
+    /* IOThreads from the iothread-vq-mapping property */
+    IOThread **vq_iothreads;
+    unsigned int num_vq_iothreads;
+    bool iothreads_started;
     struct {
         uint32_t in_use;
         uint32_t first_multi;
@@ -191,6 +221,8 @@ struct VirtIONet {
     NICConf nic_conf;
     DeviceState *qdev;
     int multiqueue;
+    /* peers, including one for the control virtqueue if the backend has it */
+    uint16_t max_ncs;
     uint16_t max_queues;
     uint16_t curr_queues;
     size_t config_size;
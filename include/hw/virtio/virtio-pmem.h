@@ -15,6 +15,7 @@
 #define HW_VIRTIO_PMEM_H
 
 #include "hw/virtio/virtio.h"
+#include "qemu/queue.h"
 #include "qapi/qapi-types-machine.h"
 #include "qom/object.h"
 
@@ -32,6 +33,10 @@ struct VirtIOPMEM {
     VirtQueue *rq_vq;
     uint64_t start;
     HostMemoryBackend *memdev;
+
+    /* flush requests waiting for the flush in flight to end */
+    QSIMPLEQ_HEAD(, VirtIODeviceRequest) flush_waiting;
+    bool flush_in_flight;
 };
 
 struct VirtIOPMEMClass {
@@ -62,6 +62,8 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    uint32_t num_iothread_vq_mapping;
+    char **iothread_vq_mapping;     /* IOThread ids, assigned round-robin */
 };
 
 struct VirtIOSCSI;
@@ -85,7 +87,14 @@ struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* of the SCSI devices, and the ctrl and event vqs */
+
+    /* IOThreads from the iothread-vq-mapping property */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+
+    /* AioContext handling each request virtqueue's host notifier */
+    AioContext **vq_aio_context;
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -160,6 +169,7 @@ void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
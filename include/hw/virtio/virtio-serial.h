@@ -80,6 +80,13 @@ struct VirtIOSerialPortClass {
      */
     ssize_t (*have_data)(VirtIOSerialPort *port, const uint8_t *buf,
                          ssize_t len);
+
+    /*
+     * Like have_data, but gets the data of several guest buffers at
+     * once.  If set, it is used instead of have_data.
+     */
+    ssize_t (*have_datav)(VirtIOSerialPort *port, const struct iovec *iov,
+                          int iovcnt);
 };
 
 /*
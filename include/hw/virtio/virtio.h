@@ -50,6 +50,8 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+typedef struct VirtQueueElementPool VirtQueueElementPool;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -61,6 +63,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* pool to give the element back to, or NULL if allocated with malloc */
+    VirtQueueElementPool *pool;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -102,6 +106,10 @@ struct VirtIODevice
     bool started;
     bool start_on_kick; /* when virtio 1.0 feature has not been negotiated */
     bool disable_legacy_check;
+    /* interrupt coalescing of the queues after reset */
+    uint32_t coalesce_frames;
+    uint32_t coalesce_usecs;
+    bool coalesce_adaptive;
     VMChangeStateEntry *vmstate;
     char *bus_name;
     uint8_t device_endian;
@@ -186,6 +194,8 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -197,6 +207,13 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
+void virtqueue_element_free(void *elem);
+void virtio_queue_set_element_pool(VirtQueue *vq, size_t sz,
+                                   unsigned int max_sg);
+void virtio_queue_set_coalescing(VirtQueue *vq, uint32_t frames,
+                                 uint32_t usecs, bool adaptive);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -40,6 +40,10 @@ OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelSocket, QIO_CHANNEL_SOCKET)
  * parameters and getting socket address strings.
  */
 
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define QEMU_MSG_ZEROCOPY
+#endif
+
 struct QIOChannelSocket {
     QIOChannel parent;
     int fd;
@@ -47,6 +51,9 @@ struct QIOChannelSocket {
     socklen_t localAddrLen;
     struct sockaddr_storage remoteAddr;
     socklen_t remoteAddrLen;
+    bool zero_copy_enabled;
+    uint64_t zero_copy_queued; /* number of MSG_ZEROCOPY sendmsg() calls */
+    uint64_t zero_copy_sent;   /* ...of which the kernel reported completion */
 };
 
 
@@ -260,4 +267,69 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_set_zero_copy:
+ * @ioc: the socket channel object
+ * @enabled: whether to enable zero-copy sends
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Set SO_ZEROCOPY on the socket, which is required before
+ * qio_channel_socket_writev_all_zero_copy() can be used.
+ * This is only supported on Linux TCP sockets.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp);
+
+/**
+ * qio_channel_socket_writev_all_zero_copy:
+ * @ioc: the socket channel object
+ * @iov: the array of memory regions to write data from
+ * @niov: the length of the @iov array
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like qio_channel_writev_all(), but send the data with MSG_ZEROCOPY,
+ * so the kernel transmits straight from the caller's pages.  Each
+ * sendmsg() call made increments @ioc->zero_copy_queued; the memory
+ * regions must not be modified or freed until @ioc->zero_copy_sent
+ * has caught up with the value @ioc->zero_copy_queued had on return.
+ * Completions are collected by qio_channel_socket_zero_copy_reap().
+ *
+ * Returns: 0 if all bytes were written, or -1 on error
+ */
+int
+qio_channel_socket_writev_all_zero_copy(QIOChannelSocket *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp);
+
+/**
+ * qio_channel_socket_zero_copy_reap:
+ * @ioc: the socket channel object
+ *
+ * Collect the zero-copy completion notifications queued on the socket's
+ * error queue without blocking, and advance @ioc->zero_copy_sent.
+ */
+void
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc);
+
+/**
+ * qio_channel_socket_zero_copy_flush:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Block until the kernel has reported completion of every zero-copy
+ * send made on @ioc so far, i.e. until none of the memory passed to
+ * qio_channel_socket_writev_all_zero_copy() is referenced any more.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
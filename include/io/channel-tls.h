@@ -48,6 +48,9 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    /* directions whose records are handled by kernel TLS on @master */
+    bool tx_offload;
+    bool rx_offload;
 };
 
 /**
@@ -41,6 +41,7 @@ void precopy_enable_free_page_optimization(void);
 
 void ram_mig_init(void);
 void qemu_guest_free_page_hint(void *addr, size_t len);
+void qemu_guest_free_page_report(void *addr, size_t len);
 
 /* migration/block.c */
 
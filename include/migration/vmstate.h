@@ -190,6 +190,14 @@ struct VMStateDescription {
     bool (*needed)(void *opaque);
     bool (*dev_unplug_pending)(void *opaque);
 
+    /*
+     * The state may be saved from another thread, in parallel with the
+     * other devices of the same priority that allow it.  The BQL is held
+     * by the thread that saves the VM state, so the device must not
+     * rely on it for anything but its state being stable.
+     */
+    bool parallel_save;
+
     const VMStateField *fields;
     const VMStateDescription **subsections;
 };
@@ -62,6 +62,19 @@ ssize_t qemu_net_queue_send(NetQueue *queue,
                             size_t size,
                             NetPacketSent *sent_cb);
 
+/*
+ * Like qemu_net_queue_send(), but @data must have been allocated with
+ * g_malloc() and the queue takes ownership of it: if the packet has to be
+ * queued, @data is kept instead of copied.  @data is freed once the packet
+ * is delivered or dropped.
+ */
+ssize_t qemu_net_queue_send_owned(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  uint8_t *data,
+                                  size_t size,
+                                  NetPacketSent *sent_cb);
+
 ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 NetClientState *sender,
                                 unsigned flags,
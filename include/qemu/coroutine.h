@@ -15,6 +15,7 @@
 #ifndef QEMU_COROUTINE_H
 #define QEMU_COROUTINE_H
 
+#include "qemu/atomic.h"
 #include "qemu/queue.h"
 #include "qemu/timer.h"
 
@@ -122,6 +123,31 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Grow the coroutine pool by @additional_pool_size coroutines.  Devices
+ * call this with the number of requests they can have in flight, so that
+ * coroutines are reused rather than freed and created again.
+ */
+void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
+
+/**
+ * Undo qemu_coroutine_inc_pool_size()
+ */
+void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size);
+
+typedef struct CoroutinePoolStats {
+    unsigned int batch_size;    /* see qemu_coroutine_inc_pool_size() */
+    uint64_t created;           /* calls to qemu_coroutine_create() */
+    uint64_t allocated;         /* ... that had to allocate a coroutine */
+    uint64_t freed;             /* coroutines freed instead of pooled */
+} CoroutinePoolStats;
+
+/**
+ * Get the coroutine pool statistics.  Creations of other threads are
+ * counted as they refill their pools, so they may lag a little behind.
+ */
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
@@ -158,8 +184,34 @@ void qemu_co_mutex_init(CoMutex *mutex);
 /**
  * Locks the mutex. If the lock cannot be taken immediately, control is
  * transferred to the caller of the current coroutine.
- */
-void coroutine_fn qemu_co_mutex_lock(CoMutex *mutex);
+ *
+ * Use qemu_co_mutex_lock(); the _impl function is called through
+ * qemu_co_mutex_lock_func so that QSP can profile the call sites.
+ */
+void coroutine_fn qemu_co_mutex_lock_impl(CoMutex *mutex, const char *file,
+                                          int line);
+
+typedef void (*QemuCoMutexLockFunc)(CoMutex *m, const char *f, int l);
+extern QemuCoMutexLockFunc qemu_co_mutex_lock_func;
+
+/* bypass the profiler */
+#define qemu_co_mutex_lock__raw(m)                      \
+        qemu_co_mutex_lock_impl(m, __FILE__, __LINE__)
+
+#ifdef __COVERITY__
+#define qemu_co_mutex_lock(m)                                           \
+            qemu_co_mutex_lock_impl(m, __FILE__, __LINE__)
+#else
+#define qemu_co_mutex_lock(m) ({                                              \
+            QemuCoMutexLockFunc _f = qatomic_read(&qemu_co_mutex_lock_func);  \
+            _f(m, __FILE__, __LINE__);                                        \
+        })
+#endif
+
+static inline void coroutine_fn (qemu_co_mutex_lock)(CoMutex *mutex)
+{
+    qemu_co_mutex_lock(mutex);
+}
 
 /**
  * Unlocks the mutex and schedules the next coroutine that was waiting for this
@@ -255,7 +307,7 @@ void qemu_co_rwlock_init(CoRwlock *lock);
  * of a parallel writer, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_rdlock(CoRwlock *lock);
+void qemu_co_rwlock_rdlock_impl(CoRwlock *lock, const char *file, int line);
 
 /**
  * Write Locks the CoRwlock from a reader.  This is a bit more efficient than
@@ -265,7 +317,7 @@ void qemu_co_rwlock_rdlock(CoRwlock *lock);
  * only overrides CoRwlock fairness if there are no concurrent readers, so
  * another writer might run while @qemu_co_rwlock_upgrade blocks.
  */
-void qemu_co_rwlock_upgrade(CoRwlock *lock);
+void qemu_co_rwlock_upgrade_impl(CoRwlock *lock, const char *file, int line);
 
 /**
  * Downgrades a write-side critical section to a reader.  Downgrading with
@@ -280,7 +332,37 @@ void qemu_co_rwlock_downgrade(CoRwlock *lock);
  * of a parallel reader, control is transferred to the caller of the current
  * coroutine.
  */
-void qemu_co_rwlock_wrlock(CoRwlock *lock);
+void qemu_co_rwlock_wrlock_impl(CoRwlock *lock, const char *file, int line);
+
+typedef void (*QemuCoRwlockLockFunc)(CoRwlock *l, const char *f, int line);
+extern QemuCoRwlockLockFunc qemu_co_rwlock_rdlock_func;
+extern QemuCoRwlockLockFunc qemu_co_rwlock_upgrade_func;
+extern QemuCoRwlockLockFunc qemu_co_rwlock_wrlock_func;
+
+#ifdef __COVERITY__
+#define qemu_co_rwlock_rdlock(l)                                        \
+            qemu_co_rwlock_rdlock_impl(l, __FILE__, __LINE__)
+#define qemu_co_rwlock_upgrade(l)                                       \
+            qemu_co_rwlock_upgrade_impl(l, __FILE__, __LINE__)
+#define qemu_co_rwlock_wrlock(l)                                        \
+            qemu_co_rwlock_wrlock_impl(l, __FILE__, __LINE__)
+#else
+#define qemu_co_rwlock_rdlock(l) ({                                     \
+            QemuCoRwlockLockFunc _f;                                    \
+            _f = qatomic_read(&qemu_co_rwlock_rdlock_func);             \
+            _f(l, __FILE__, __LINE__);                                  \
+        })
+#define qemu_co_rwlock_upgrade(l) ({                                    \
+            QemuCoRwlockLockFunc _f;                                    \
+            _f = qatomic_read(&qemu_co_rwlock_upgrade_func);            \
+            _f(l, __FILE__, __LINE__);                                  \
+        })
+#define qemu_co_rwlock_wrlock(l) ({                                     \
+            QemuCoRwlockLockFunc _f;                                    \
+            _f = qatomic_read(&qemu_co_rwlock_wrlock_func);             \
+            _f(l, __FILE__, __LINE__);                                  \
+        })
+#endif
 
 /**
  * Unlocks the read/write lock and schedules the next coroutine that was
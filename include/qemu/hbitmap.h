@@ -349,4 +349,13 @@ bool hbitmap_next_dirty_area(const HBitmap *hb, int64_t start, int64_t end,
  */
 int64_t hbitmap_iter_next(HBitmapIter *hbi);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch to the next slower implementation of the vectorized scan, count
+ * and merge helpers.  Return false if the last one was already in use.
+ * Only meant for tests and benchmarks.
+ */
+bool test_hbitmap_next_accel(void);
+
 #endif
@@ -0,0 +1,87 @@
+/*
+ * Interval tree of closed [start, last] ranges, as an augmented red-black
+ * tree keyed by @start.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/**
+ * struct IntervalTreeNode - a range in an interval tree
+ * @start: first value of the range
+ * @last: last value of the range, inclusive
+ *
+ * @start and @last must not change while the node is in a tree.
+ * Embed the node in a larger struct and use container_of() to get
+ * to it from the lookup functions.
+ */
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *parent;
+    struct IntervalTreeNode *left;
+    struct IntervalTreeNode *right;
+    bool red;
+    uint64_t start;
+    uint64_t last;
+    /* largest @last in the subtree rooted here */
+    uint64_t subtree_last;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+} IntervalTreeRoot;
+
+/*
+ * Updates must be serialized by the caller.
+ *
+ * interval_tree_iter_first() can run concurrently with updates, provided
+ * that removed nodes are freed after an RCU grace period: it never returns
+ * a node that does not intersect the range it is given, but may fail to
+ * find one that does while the tree is being rebalanced.  Callers that
+ * cannot live with such false negatives must retry with updates excluded.
+ * interval_tree_iter_next() follows parent pointers and must only be
+ * used with updates excluded.
+ */
+
+/**
+ * interval_tree_insert - insert a node
+ * @node: node to insert, with @start and @last set
+ * @root: tree to insert into
+ *
+ * Overlapping ranges are allowed.
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove - remove a node
+ * @node: node to remove
+ * @root: tree @node is in
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first - find the first node intersecting a range
+ * @root: tree to search
+ * @start: first value of the range
+ * @last: last value of the range, inclusive
+ *
+ * Returns the node with the lowest @start that intersects [@start, @last],
+ * or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next - find the next node intersecting a range
+ * @node: node returned by a previous lookup of the same range
+ * @start: first value of the range
+ * @last: last value of the range, inclusive
+ *
+ * Returns the node after @node, in @start order, that intersects
+ * [@start, @last], or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+#endif /* QEMU_INTERVAL_TREE_H */
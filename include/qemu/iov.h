@@ -153,6 +153,9 @@ size_t iov_discard_front_undoable(struct iovec **iov, unsigned int *iov_cnt,
 size_t iov_discard_back_undoable(struct iovec *iov, unsigned int *iov_cnt,
                                  size_t bytes, IOVDiscardUndo *undo);
 
+/* Number of entries a growable QEMUIOVector holds without allocating */
+#define QEMU_IOVEC_INLINE 4
+
 typedef struct QEMUIOVector {
     struct iovec *iov;
     int niov;
@@ -160,7 +163,9 @@ typedef struct QEMUIOVector {
     /*
      * For external @iov (qemu_iovec_init_external()) or allocated @iov
      * (qemu_iovec_init()), @size is the cumulative size of iovecs and
-     * @local_iov is invalid and unused.
+     * @local_iov is invalid and unused.  Allocated @iov starts out as
+     * @inline_iov when it has room enough, and moves to the heap when
+     * it grows beyond it.
      *
      * For embedded @iov (QEMU_IOVEC_INIT_BUF() or qemu_iovec_init_buf()),
      * @iov is equal to &@local_iov, and @size is valid, as it has same
@@ -181,6 +186,12 @@ typedef struct QEMUIOVector {
             size_t size;
         };
     };
+
+    /*
+     * Short vectors are kept here; like embedded ones, a QEMUIOVector
+     * using it must not be moved in memory.
+     */
+    struct iovec inline_iov[QEMU_IOVEC_INLINE];
 } QEMUIOVector;
 
 QEMU_BUILD_BUG_ON(offsetof(QEMUIOVector, size) !=
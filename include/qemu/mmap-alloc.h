@@ -16,6 +16,9 @@ size_t qemu_mempath_getpagesize(const char *mem_path);
  *          otherwise, the alignment in use will be determined by QEMU.
  *  @shared: map has RAM_SHARED flag.
  *  @is_pmem: map has RAM_PMEM flag.
+ *  @map_sync: if not NULL, set to whether the area could be mapped with
+ *             MAP_SYNC, i.e. whether CPU cache flushes alone make writes to
+ *             it persistent.
  *
  * Return:
  *  On success, return a pointer to the mapped area.
@@ -25,7 +28,8 @@ void *qemu_ram_mmap(int fd,
                     size_t size,
                     size_t align,
                     bool shared,
-                    bool is_pmem);
+                    bool is_pmem,
+                    bool *map_sync);
 
 void qemu_ram_munmap(int fd, void *ptr, size_t size);
 
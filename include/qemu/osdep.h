@@ -611,8 +611,41 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @smp_cpus: maximum number of threads to use
+ * @host_nodes: host NUMA nodes that @area is bound to, or %NULL
+ * @maxnode: number of bits in @host_nodes
+ * @async: return before the memory is populated
+ * @errp: pointer to Error*, to store an error if it happens.
+ *
+ * Fault in every page of @area, with threads that run on the CPUs of
+ * @host_nodes where the host supports it.
+ *
+ * If @async is true and os_mem_prealloc_finish() has not been called yet,
+ * the preallocation continues in the background and its failure is
+ * reported by os_mem_prealloc_finish().  @area must not be accessed
+ * until then.
+ *
+ * Can be called from any thread.
+ */
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
-                     Error **errp);
+                     const unsigned long *host_nodes, unsigned long maxnode,
+                     bool async, Error **errp);
+
+/**
+ * os_mem_prealloc_finish:
+ * @errp: pointer to Error*, to store an error if it happens.
+ *
+ * Wait for the asynchronous os_mem_prealloc() calls to complete.  Later
+ * calls to os_mem_prealloc() are synchronous.
+ *
+ * Returns: %true if all memory could be preallocated.
+ */
+bool os_mem_prealloc_finish(Error **errp);
 
 /**
  * qemu_get_pid_name:
@@ -68,9 +68,22 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_INLINE_PER_VCPU,
     PLUGIN_N_CB_SUBTYPES,
 };
 
+/*
+ * Per-vCPU storage of a plugin: one @element_size slot per vCPU index.
+ * @data must stay the first field: the code generated for per-vCPU
+ * inline ops loads it at run-time, so that the slots can be moved
+ * when a vCPU with a larger index shows up.
+ */
+struct qemu_plugin_scoreboard {
+    void *data;
+    size_t element_size;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -88,6 +101,8 @@ struct qemu_plugin_dyn_cb {
         struct {
             enum qemu_plugin_op op;
             uint64_t imm;
+            /* offset in each slot of the scoreboard in @userp (per-vCPU) */
+            size_t offset;
         } inline_insn;
     };
 };
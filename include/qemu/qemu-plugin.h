@@ -279,6 +279,82 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                                                 enum qemu_plugin_op op,
                                                 void *ptr, uint64_t imm);
 
+/**
+ * struct qemu_plugin_scoreboard - per-vCPU storage
+ *
+ * A scoreboard holds one element per vCPU, indexed by vcpu_index.
+ * Inline ops that update a scoreboard only ever touch the element of
+ * the vCPU that executes them, so they need neither atomics nor locks
+ * even when vCPUs run in parallel.
+ */
+struct qemu_plugin_scoreboard;
+
+/**
+ * qemu_plugin_scoreboard_new() - allocate a new scoreboard
+ * @element_size: size of the element of each vCPU, zero-initialized
+ *
+ * Elements are allocated for every vCPU, including ones created after
+ * this call.
+ */
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size);
+
+/**
+ * qemu_plugin_scoreboard_free() - free a scoreboard
+ * @score: scoreboard to free
+ *
+ * No translated code must refer to @score anymore, e.g. because this
+ * is called from the atexit callback.
+ */
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+/**
+ * qemu_plugin_scoreboard_find() - get the element of a vCPU
+ * @score: scoreboard to look into
+ * @vcpu_index: index of the vCPU
+ *
+ * The pointer is valid until the next vCPU is created.
+ */
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_scoreboard_u64_sum() - sum a counter over all vCPUs
+ * @score: scoreboard holding the counter
+ * @offset: offset of the uint64_t counter in each element
+ */
+uint64_t qemu_plugin_scoreboard_u64_sum(struct qemu_plugin_scoreboard *score,
+                                        size_t offset);
+
+/**
+ * qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu() - per-vCPU inline op
+ * @tb: the opaque qemu_plugin_tb handle for the translation
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @score: the scoreboard to update
+ * @offset: offset of the uint64_t target in the element of each vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_tb_exec_inline(), but the op applies
+ * to the element of @score of the vCPU executing the translated unit.
+ */
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    struct qemu_plugin_scoreboard *score, size_t offset, uint64_t imm);
+
+/**
+ * qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu() - per-vCPU inline op
+ * @insn: the opaque qemu_plugin_insn handle for an instruction
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @score: the scoreboard to update
+ * @offset: offset of the uint64_t target in the element of each vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_insn_exec_inline(), but the op applies
+ * to the element of @score of the vCPU executing the instruction.
+ */
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    struct qemu_plugin_scoreboard *score, size_t offset, uint64_t imm);
+
 /*
  * Helpers to query information about the instructions in a block
  */
@@ -351,6 +427,86 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
                                           enum qemu_plugin_op op, void *ptr,
                                           uint64_t imm);
 
+/**
+ * qemu_plugin_register_vcpu_mem_inline_per_vcpu() - per-vCPU inline mem op
+ * @insn: handle for instruction to instrument
+ * @rw: apply to reads, writes or both
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @score: the scoreboard to update
+ * @offset: offset of the uint64_t target in the element of each vCPU
+ * @imm: the op data (e.g. 1)
+ *
+ * Like qemu_plugin_register_vcpu_mem_inline(), but the op applies to
+ * the element of @score of the vCPU performing the access.
+ */
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, struct qemu_plugin_scoreboard *score,
+    size_t offset, uint64_t imm);
+
+/**
+ * struct qemu_plugin_mem_record - a memory access recorded in a buffer
+ * @vaddr: virtual address of the access
+ * @info: meminfo of the access
+ *
+ * qemu_plugin_get_hwaddr() cannot be used on records, since the access
+ * has completed by the time they are handed to the plugin.
+ */
+struct qemu_plugin_mem_record {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+};
+
+typedef void
+(*qemu_plugin_vcpu_mem_batch_cb_t)(unsigned int vcpu_index,
+                                   const struct qemu_plugin_mem_record *records,
+                                   size_t n_records, void *userdata);
+
+/**
+ * struct qemu_plugin_mem_buffer - per-vCPU buffer of memory accesses
+ *
+ * Each vCPU appends its sampled accesses to its own buffer, and the
+ * buffer is handed to the plugin when it fills up.  This saves a call
+ * into the plugin, and whatever locking the plugin does, per access.
+ */
+struct qemu_plugin_mem_buffer;
+
+/**
+ * qemu_plugin_mem_buffer_new() - allocate a memory access buffer
+ * @n_records: number of records buffered per vCPU
+ * @period: record one access out of @period (0 or 1 record them all)
+ * @cb: called from the vCPU thread with the records of a full buffer
+ * @userdata: any plugin data to pass to @cb
+ */
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records, uint64_t period,
+                           qemu_plugin_vcpu_mem_batch_cb_t cb, void *userdata);
+
+/**
+ * qemu_plugin_mem_buffer_flush() - hand partially filled buffers to the cb
+ * @buf: buffer to flush
+ *
+ * Meant to be called once vCPUs have stopped, e.g. from the atexit
+ * callback.
+ */
+void qemu_plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_mem_buffer_free() - free a memory access buffer
+ * @buf: buffer to free; records that were not flushed are dropped
+ */
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+/**
+ * qemu_plugin_register_vcpu_mem_buffered() - record accesses in a buffer
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @buf: the buffer to record to
+ */
+void qemu_plugin_register_vcpu_mem_buffered(struct qemu_plugin_insn *insn,
+                                            enum qemu_plugin_mem_rw rw,
+                                            struct qemu_plugin_mem_buffer *buf);
+
 
 
 typedef void
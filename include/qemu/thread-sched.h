@@ -0,0 +1,46 @@
+/*
+ * CPU affinity and scheduling policy of QEMU threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_THREAD_SCHED_H
+#define QEMU_THREAD_SCHED_H
+
+/*
+ * Placement of a thread, as configured by the user.  Threads apply it
+ * to themselves when they start, before doing any work.
+ */
+typedef struct ThreadSchedParams {
+    char *cpus;             /* host CPU list, e.g. "0-3,8", or NULL */
+    int32_t numa_node;      /* host NUMA node to run on, or -1 */
+    char *policy;           /* "other", "batch", "idle", "fifo", "rr" */
+    int32_t priority;       /* for the "fifo" and "rr" policies */
+} ThreadSchedParams;
+
+/**
+ * thread_sched_check:
+ * @params: the parameters to check
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Check that @params are valid on this host, without applying them.
+ *
+ * Returns: true on success, false on error.
+ */
+bool thread_sched_check(const ThreadSchedParams *params, Error **errp);
+
+/**
+ * thread_sched_apply:
+ * @params: the parameters to apply
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Move the calling thread to the CPUs in @params and switch it to the
+ * scheduling policy in @params.  Does nothing for the parameters that
+ * are not set.
+ *
+ * Returns: true on success, false on error.
+ */
+bool thread_sched_apply(const ThreadSchedParams *params, Error **errp);
+
+#endif /* QEMU_THREAD_SCHED_H */
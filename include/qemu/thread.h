@@ -319,7 +319,7 @@ void qemu_lockcnt_destroy(QemuLockCnt *lockcnt);
  *            qemu_lockcnt_inc(&lc2);
  *                                          qemu_lockcnt_inc(&lc1);
  */
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt);
+void qemu_lockcnt_inc_impl(QemuLockCnt *lockcnt, const char *file, int line);
 
 /**
  * qemu_lockcnt_dec: decrement a QemuLockCnt's counter
@@ -355,7 +355,31 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt);
  * also zero.  You can use qemu_lockcnt_count to check for this inside a
  * critical section.
  */
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt);
+void qemu_lockcnt_lock_impl(QemuLockCnt *lockcnt, const char *file, int line);
+
+/*
+ * qemu_lockcnt_inc and qemu_lockcnt_lock can block, so they are called
+ * through function pointers that QSP can redirect.
+ */
+typedef void (*QemuLockCntFunc)(QemuLockCnt *lc, const char *f, int l);
+extern QemuLockCntFunc qemu_lockcnt_inc_func;
+extern QemuLockCntFunc qemu_lockcnt_lock_func;
+
+#ifdef __COVERITY__
+#define qemu_lockcnt_inc(lc)                                            \
+            qemu_lockcnt_inc_impl(lc, __FILE__, __LINE__)
+#define qemu_lockcnt_lock(lc)                                           \
+            qemu_lockcnt_lock_impl(lc, __FILE__, __LINE__)
+#else
+#define qemu_lockcnt_inc(lc) ({                                         \
+            QemuLockCntFunc _f = qatomic_read(&qemu_lockcnt_inc_func);  \
+            _f(lc, __FILE__, __LINE__);                                 \
+        })
+#define qemu_lockcnt_lock(lc) ({                                        \
+            QemuLockCntFunc _f = qatomic_read(&qemu_lockcnt_lock_func); \
+            _f(lc, __FILE__, __LINE__);                                 \
+        })
+#endif
 
 /**
  * qemu_lockcnt_unlock: release a QemuLockCnt's mutex.
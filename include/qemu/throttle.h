@@ -30,6 +30,9 @@
 
 #define THROTTLE_VALUE_MAX 1000000000000000LL
 
+/* Credit is handed out in chunks of 1/THROTTLE_CREDIT_PER_SECOND of the rate */
+#define THROTTLE_CREDIT_PER_SECOND 100
+
 typedef enum {
     THROTTLE_BPS_TOTAL,
     THROTTLE_BPS_READ,
@@ -152,6 +155,9 @@ bool throttle_schedule_timer(ThrottleState *ts,
                              bool is_write);
 
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size);
+
+bool throttle_reserve_credit(ThrottleState *ts, bool is_write, int64_t now,
+                             unsigned int *bytes, unsigned int *ops);
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
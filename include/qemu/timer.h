@@ -86,7 +86,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* arming order, breaks expire_time ties */
+    size_t heap_index;          /* position in the timer_list heap */
     int attributes;
     int scale;
 };
@@ -29,6 +29,10 @@
 typedef struct AccelState {
     /*< private >*/
     Object parent_obj;
+    /*< public >*/
+
+    /* Longest time an idle vCPU spins before going to sleep, 0 to never */
+    uint64_t halt_poll_max_ns;
 } AccelState;
 
 typedef struct AccelClass {
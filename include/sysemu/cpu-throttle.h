@@ -42,10 +42,22 @@ void cpu_throttle_init(void);
  */
 void cpu_throttle_set(int new_throttle_pct);
 
+/**
+ * cpu_throttle_set_vcpu:
+ * @cpu: The vCPU to throttle.
+ * @new_throttle_pct: Percent of sleep time. Valid range is 1 to 99, or 0
+ * to stop throttling @cpu.
+ *
+ * Like cpu_throttle_set, but only for @cpu.  The vCPU sleeps for the
+ * higher of its own percentage and the one set with cpu_throttle_set.
+ */
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct);
+
 /**
  * cpu_throttle_stop:
  *
- * Stops the vcpu throttling started by cpu_throttle_set.
+ * Stops the vcpu throttling started by cpu_throttle_set and
+ * cpu_throttle_set_vcpu.
  */
 void cpu_throttle_stop(void);
 
@@ -65,4 +77,13 @@ bool cpu_throttle_active(void);
  */
 int cpu_throttle_get_percentage(void);
 
+/**
+ * cpu_throttle_get_vcpu_percentage:
+ * @cpu: The vCPU to query.
+ *
+ * Returns: The throttle percentage set with cpu_throttle_set_vcpu for
+ * @cpu, 0 if none.
+ */
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu);
+
 #endif /* SYSEMU_CPU_THROTTLE_H */
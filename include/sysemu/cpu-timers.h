@@ -55,6 +55,8 @@ void icount_configure(QemuOpts *opts, Error **errp);
 
 /* used by tcg vcpu thread to calc icount budget */
 int64_t icount_round(int64_t count);
+/* instructions until the next timer deadline, or the next replay event */
+int64_t icount_get_limit(void);
 
 /* if the CPUs are idle, start accounting real time to virtual clock. */
 void icount_start_warp_timer(void);
@@ -138,6 +138,15 @@ typedef struct CryptoDevBackendSymOpInfo {
     uint8_t data[];
 } CryptoDevBackendSymOpInfo;
 
+/**
+ * CryptoDevCompletionFunc:
+ * @opaque: the opaque pointer given with the operation
+ * @ret: VIRTIO_CRYPTO_OK on success, or -VIRTIO_CRYPTO_* on error
+ *
+ * Called once when an operation submitted to a backend has finished.
+ */
+typedef void CryptoDevCompletionFunc(void *opaque, int ret);
+
 struct CryptoDevBackendClass {
     ObjectClass parent_class;
 
@@ -150,9 +159,16 @@ struct CryptoDevBackendClass {
     int (*close_session)(CryptoDevBackend *backend,
                            uint64_t session_id,
                            uint32_t queue_index, Error **errp);
+    /*
+     * Returns 0 if @cb will be called, which may happen before do_sym_op
+     * returns.  Backends that finish the operation elsewhere must call
+     * @cb in the AioContext it was submitted from.
+     */
     int (*do_sym_op)(CryptoDevBackend *backend,
                      CryptoDevBackendSymOpInfo *op_info,
-                     uint32_t queue_index, Error **errp);
+                     uint32_t queue_index,
+                     CryptoDevCompletionFunc *cb, void *opaque,
+                     Error **errp);
 };
 
 typedef enum CryptoDevBackendOptionsType {
@@ -284,18 +300,25 @@ int cryptodev_backend_sym_close_session(
  * @backend: the cryptodev backend object
  * @opaque: pointer to a VirtIOCryptoReq object
  * @queue_index: queue index of cryptodev backend client
+ * @cb: function called when the operation has finished
+ * @cb_opaque: opaque pointer passed to @cb
  * @errp: pointer to a NULL-initialized error object
  *
- * Do crypto operation, such as encryption and
- * decryption
+ * Start a crypto operation, such as encryption and
+ * decryption.  On success @cb is called exactly once with
+ * the status of the operation, possibly before this function
+ * returns, and always in the current AioContext.  Several
+ * operations can be in flight on one queue.
  *
- * Returns: VIRTIO_CRYPTO_OK on success,
+ * Returns: 0 if @cb will be called,
  *         or -VIRTIO_CRYPTO_* on error
  */
 int cryptodev_backend_crypto_operation(
                  CryptoDevBackend *backend,
                  void *opaque,
-                 uint32_t queue_index, Error **errp);
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *cb_opaque,
+                 Error **errp);
 
 /**
  * cryptodev_backend_set_used:
@@ -79,5 +79,9 @@ void host_memory_backend_set_mapped(HostMemoryBackend *backend, bool mapped);
 bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
+/* Preallocate part of the backend's memory, from any thread */
+void host_memory_backend_prealloc_range(HostMemoryBackend *backend,
+                                        uint64_t offset, uint64_t size,
+                                        Error **errp);
 
 #endif
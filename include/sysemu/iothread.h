@@ -15,6 +15,7 @@
 #define IOTHREAD_H
 
 #include "block/aio.h"
+#include "qemu/thread-sched.h"
 #include "qemu/thread.h"
 #include "qom/object.h"
 
@@ -37,6 +38,14 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Thread pool parameters */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
+    /* CPU affinity and scheduling policy, applied when the thread starts */
+    ThreadSchedParams sched;
+    Error *sched_err;           /* why the thread failed to apply them */
 };
 typedef struct IOThread IOThread;
 
@@ -213,6 +213,23 @@ typedef struct Notifier Notifier;
 /* external API */
 
 bool kvm_has_free_slot(MachineState *ms);
+
+/**
+ * kvm_dirty_ring_enabled:
+ *
+ * Returns: true if KVM tracks dirty pages with the per-vCPU dirty
+ * rings, and CPUState.dirty_pages is therefore counted.
+ */
+bool kvm_dirty_ring_enabled(void);
+
+/**
+ * kvm_dirty_log_pages:
+ *
+ * Returns: the number of host pages that KVM has reported dirty so far,
+ * from its dirty bitmaps or from the dirty rings, while dirty logging was
+ * enabled.  Must be called with the iothread lock held.
+ */
+uint64_t kvm_dirty_log_pages(void);
 bool kvm_has_sync_mmu(void);
 int kvm_has_vcpu_events(void);
 int kvm_has_robust_singlestep(void);
@@ -234,6 +251,19 @@ int kvm_has_intx_set_mask(void);
  */
 bool kvm_arm_supports_user_irq(void);
 
+/**
+ * kvm_precreate_vcpus - create several vCPUs in parallel
+ * @vcpu_ids: KVM_CREATE_VCPU ids of the vCPUs, as kvm_arch_vcpu_id()
+ *            will return them for the CPUs the machine is about to create
+ * @nr: number of entries in @vcpu_ids
+ *
+ * Issues the KVM_CREATE_VCPU ioctls from a pool of threads and returns
+ * once all of them completed.  The vCPUs are parked, so that
+ * kvm_init_vcpu() picks them up instead of creating them one at a time
+ * from each vCPU thread.  Failures are left for kvm_init_vcpu() to report.
+ */
+void kvm_precreate_vcpus(const unsigned long *vcpu_ids, int nr);
+
 /**
  * kvm_memcrypt_enabled - return boolean indicating whether memory encryption
  *                        is enabled
@@ -502,6 +532,27 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg,
 void kvm_irqchip_commit_routes(KVMState *s);
 void kvm_irqchip_release_virq(KVMState *s, int virq);
 
+/**
+ * kvm_irqchip_begin_route_changes - defer routing table commits
+ * @s: KVM state
+ *
+ * Until the matching kvm_irqchip_end_route_changes(),
+ * kvm_irqchip_commit_routes() does nothing, so that a series of route
+ * changes reaches KVM as a single KVM_SET_GSI_ROUTING.  Calls can nest.
+ * Routes updated in the meantime keep their old target in KVM, so the
+ * batch must not span a return to the guest.
+ */
+void kvm_irqchip_begin_route_changes(KVMState *s);
+
+/**
+ * kvm_irqchip_end_route_changes - commit deferred routing table changes
+ * @s: KVM state
+ *
+ * Ends a batch started by kvm_irqchip_begin_route_changes(), committing
+ * the routing table if this was the outermost one and it changed.
+ */
+void kvm_irqchip_end_route_changes(KVMState *s);
+
 int kvm_irqchip_add_adapter_route(KVMState *s, AdapterInfo *adapter);
 int kvm_irqchip_add_hv_sint_route(KVMState *s, uint32_t vcpu, uint32_t sint);
 
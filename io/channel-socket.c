@@ -26,6 +26,12 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#include "qemu/iov.h"
+
+#ifdef QEMU_MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#include <poll.h>
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -502,6 +508,10 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
         if (errno == EAGAIN) {
+            /* Pending completions keep POLLERR, and so us, awake */
+            if (sioc->zero_copy_enabled) {
+                qio_channel_socket_zero_copy_reap(sioc);
+            }
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -561,6 +571,9 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
     ret = sendmsg(sioc->fd, &msg, 0);
     if (ret <= 0) {
         if (errno == EAGAIN) {
+            if (sioc->zero_copy_enabled) {
+                qio_channel_socket_zero_copy_reap(sioc);
+            }
             return QIO_CHANNEL_ERR_BLOCK;
         }
         if (errno == EINTR) {
@@ -658,6 +671,185 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 }
 #endif /* WIN32 */
 
+#ifdef QEMU_MSG_ZEROCOPY
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp)
+{
+    int v = enabled;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0) {
+        error_setg_errno(errp, errno, "Unable to set SO_ZEROCOPY");
+        return -1;
+    }
+    ioc->zero_copy_enabled = enabled;
+    return 0;
+}
+
+int
+qio_channel_socket_writev_all_zero_copy(QIOChannelSocket *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp)
+{
+    int ret = -1;
+    struct iovec *local_iov = g_new(struct iovec, niov);
+    struct iovec *local_iov_head = local_iov;
+    unsigned int nlocal_iov = niov;
+    int sflags = MSG_ZEROCOPY;
+
+    assert(ioc->zero_copy_enabled);
+
+    nlocal_iov = iov_copy(local_iov, nlocal_iov,
+                          iov, niov,
+                          0, iov_size(iov, niov));
+
+    while (nlocal_iov > 0) {
+        struct msghdr msg = {
+            .msg_iov = local_iov,
+            .msg_iovlen = nlocal_iov,
+        };
+        ssize_t len;
+
+        len = sendmsg(ioc->fd, &msg, sflags);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                qio_channel_socket_zero_copy_reap(ioc);
+                if (qemu_in_coroutine()) {
+                    qio_channel_yield(QIO_CHANNEL(ioc), G_IO_OUT);
+                } else {
+                    qio_channel_wait(QIO_CHANNEL(ioc), G_IO_OUT);
+                }
+                continue;
+            }
+            if (errno == ENOBUFS && sflags) {
+                /* Out of optmem for notifications, copy the rest instead */
+                sflags = 0;
+                continue;
+            }
+            error_setg_errno(errp, errno, "Unable to write to socket");
+            goto cleanup;
+        }
+
+        if (sflags) {
+            ioc->zero_copy_queued++;
+        }
+        iov_discard_front(&local_iov, &nlocal_iov, len);
+    }
+
+    ret = 0;
+ cleanup:
+    g_free(local_iov_head);
+    return ret;
+}
+
+void
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc)
+{
+    while (ioc->zero_copy_sent < ioc->zero_copy_queued) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        struct sock_extended_err *serr;
+        struct cmsghdr *cm;
+
+        if (recvmsg(ioc->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* EAGAIN: nothing more to collect for now */
+            return;
+        }
+
+        cm = CMSG_FIRSTHDR(&msg);
+        if (!cm ||
+            !((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+            continue;
+        }
+
+        serr = (struct sock_extended_err *)CMSG_DATA(cm);
+        if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+        }
+
+        /* [ee_info, ee_data] is the range of completed sendmsg() calls */
+        ioc->zero_copy_sent += serr->ee_data - serr->ee_info + 1;
+        trace_qio_channel_socket_zero_copy_reap(ioc, serr->ee_info,
+                                                serr->ee_data,
+                                                serr->ee_code &
+                                                SO_EE_CODE_ZEROCOPY_COPIED);
+    }
+}
+
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp)
+{
+    qio_channel_socket_zero_copy_reap(ioc);
+
+    while (ioc->zero_copy_sent < ioc->zero_copy_queued) {
+        /* Completions are signalled as POLLERR, which needs no event bit */
+        struct pollfd pfd = { .fd = ioc->fd };
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_setg_errno(errp, errno,
+                             "Unable to wait for zero-copy completions");
+            return -1;
+        }
+        if (pfd.revents & POLLNVAL) {
+            error_setg(errp, "Socket closed with zero-copy sends pending");
+            return -1;
+        }
+        qio_channel_socket_zero_copy_reap(ioc);
+    }
+
+    return 0;
+}
+#else /* QEMU_MSG_ZEROCOPY */
+int
+qio_channel_socket_set_zero_copy(QIOChannelSocket *ioc,
+                                 bool enabled,
+                                 Error **errp)
+{
+    if (!enabled) {
+        return 0;
+    }
+    error_setg(errp, "Zero-copy sends are not supported on this host");
+    return -1;
+}
+
+int
+qio_channel_socket_writev_all_zero_copy(QIOChannelSocket *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        Error **errp)
+{
+    g_assert_not_reached();
+}
+
+void
+qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc)
+{
+}
+
+int
+qio_channel_socket_zero_copy_flush(QIOChannelSocket *ioc,
+                                   Error **errp)
+{
+    return 0;
+}
+#endif /* QEMU_MSG_ZEROCOPY */
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
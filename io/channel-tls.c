@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 
 
@@ -32,6 +33,16 @@ static ssize_t qio_channel_tls_write_handler(const char *buf,
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(opaque);
     ssize_t ret;
 
+    /*
+     * The kernel encrypts everything written to the socket now, so
+     * records from GnuTLS, such as the answer to a TLS 1.3 key update,
+     * can't be sent anymore.
+     */
+    if (tioc->tx_offload) {
+        errno = EIO;
+        return -1;
+    }
+
     ret = qio_channel_write(tioc->master, buf, len, NULL);
     if (ret == QIO_CHANNEL_ERR_BLOCK) {
         errno = EAGAIN;
@@ -151,6 +162,22 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+/*
+ * Let kernel TLS handle the records of a TCP master channel, so that
+ * payload data is plain socket I/O.
+ */
+static void qio_channel_tls_offload(QIOChannelTLS *ioc)
+{
+    if (!object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+
+    qcrypto_tls_session_offload(ioc->session,
+                                QIO_CHANNEL_SOCKET(ioc->master)->fd,
+                                &ioc->tx_offload, &ioc->rx_offload);
+    trace_qio_channel_tls_offload(ioc, ioc->tx_offload, ioc->rx_offload);
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -174,6 +201,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_offload(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -265,6 +293,11 @@ static ssize_t qio_channel_tls_readv(QIOChannel *ioc,
     size_t i;
     ssize_t got = 0;
 
+    if (tioc->rx_offload) {
+        return qio_channel_readv_full(tioc->master, iov, niov, NULL, NULL,
+                                      errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_read(tioc->session,
                                                iov[i].iov_base,
@@ -305,6 +338,11 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->tx_offload) {
+        return qio_channel_writev_full(tioc->master, iov, niov, NULL, 0,
+                                       errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
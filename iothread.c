@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
@@ -57,6 +58,12 @@ static void *iothread_run(void *opaque)
      */
     g_main_context_push_thread_default(iothread->worker_context);
     my_iothread = iothread;
+
+    /* Do not run the event loop anywhere else, even briefly */
+    if (!thread_sched_apply(&iothread->sched, &iothread->sched_err)) {
+        iothread->running = false;
+    }
+
     iothread->thread_id = qemu_get_thread_id();
     qemu_sem_post(&iothread->init_done_sem);
 
@@ -113,7 +120,10 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_min = THREAD_POOL_MIN_THREADS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
+    iothread->sched.numa_node = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
     qatomic_set(&iothread->run_gcontext, 0);
@@ -146,6 +156,8 @@ static void iothread_instance_finalize(Object *obj)
         iothread->main_loop = NULL;
     }
     qemu_sem_destroy(&iothread->init_done_sem);
+    g_free(iothread->sched.cpus);
+    g_free(iothread->sched.policy);
 }
 
 static void iothread_init_gcontext(IOThread *iothread)
@@ -165,6 +177,10 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
     IOThread *iothread = IOTHREAD(obj);
     char *thread_name;
 
+    if (!thread_sched_check(&iothread->sched, errp)) {
+        return;
+    }
+
     iothread->stopping = false;
     iothread->running = true;
     iothread->ctx = aio_context_new(errp);
@@ -183,6 +199,12 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
                                 &local_error);
+    if (!local_error) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_error);
+    }
     if (local_error) {
         error_propagate(errp, local_error);
         aio_context_unref(iothread->ctx);
@@ -190,8 +212,8 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
-    /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+    /* Unless cpu-affinity or numa-node are set, this assumes we are called
+     * from a thread with useful CPU affinity for us to inherit.
      */
     thread_name = g_strdup_printf("IO %s",
                         object_get_canonical_path_component(OBJECT(obj)));
@@ -203,28 +225,50 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
     while (iothread->thread_id == -1) {
         qemu_sem_wait(&iothread->init_done_sem);
     }
+
+    if (iothread->sched_err) {
+        qemu_thread_join(&iothread->thread);
+        error_propagate(errp, iothread->sched_err);
+        iothread->sched_err = NULL;
+        iothread->thread_id = -1;
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+    }
 }
 
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
-} PollParamInfo;
+} IOThreadParamInfo;
 
-static PollParamInfo poll_max_ns_info = {
+static IOThreadParamInfo poll_max_ns_info = {
     "poll-max-ns", offsetof(IOThread, poll_max_ns),
 };
-static PollParamInfo poll_grow_info = {
+static IOThreadParamInfo poll_grow_info = {
     "poll-grow", offsetof(IOThread, poll_grow),
 };
-static PollParamInfo poll_shrink_info = {
+static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static IOThreadParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
 
-static void iothread_get_poll_param(Object *obj, Visitor *v,
+static IOThreadParamInfo numa_node_info = {
+    "numa-node", offsetof(IOThread, sched.numa_node),
+};
+static IOThreadParamInfo sched_priority_info = {
+    "sched-priority", offsetof(IOThread, sched.priority),
+};
+
+static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
 
     visit_type_int64(v, name, field, errp);
@@ -234,7 +278,7 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
     int64_t value;
 
@@ -259,23 +303,142 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    int64_t old, value;
+    Error *local_err = NULL;
+
+    if (!visit_type_int64(v, name, &value, errp)) {
+        return;
+    }
+
+    old = *field;
+    *field = value;
+
+    /* Limits are checked together, when the thread is running */
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            *field = old;
+        }
+    }
+}
+
+static void iothread_get_sched_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int32_t *field = (void *)iothread + info->offset;
+
+    visit_type_int32(v, name, field, errp);
+}
+
+static bool iothread_check_not_started(IOThread *iothread, const char *name,
+                                       Error **errp)
+{
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed once the thread is running",
+                   name);
+        return false;
+    }
+    return true;
+}
+
+static void iothread_set_sched_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int32_t *field = (void *)iothread + info->offset;
+    int32_t value;
+
+    if (!iothread_check_not_started(iothread, info->name, errp) ||
+        !visit_type_int32(v, name, &value, errp)) {
+        return;
+    }
+    *field = value;
+}
+
+static char *iothread_get_cpu_affinity(Object *obj, Error **errp)
+{
+    return g_strdup(IOTHREAD(obj)->sched.cpus);
+}
+
+static void iothread_set_cpu_affinity(Object *obj, const char *value,
+                                      Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread_check_not_started(iothread, "cpu-affinity", errp)) {
+        g_free(iothread->sched.cpus);
+        iothread->sched.cpus = g_strdup(value);
+    }
+}
+
+static char *iothread_get_sched_policy(Object *obj, Error **errp)
+{
+    return g_strdup(IOTHREAD(obj)->sched.policy);
+}
+
+static void iothread_set_sched_policy(Object *obj, const char *value,
+                                      Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread_check_not_started(iothread, "sched-policy", errp)) {
+        g_free(iothread->sched.policy);
+        iothread->sched.policy = g_strdup(value);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
     ucc->complete = iothread_complete;
 
     object_class_property_add(klass, "poll-max-ns", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_max_ns_info);
     object_class_property_add(klass, "poll-grow", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_grow_info);
     object_class_property_add(klass, "poll-shrink", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info);
+    object_class_property_add_str(klass, "cpu-affinity",
+                                  iothread_get_cpu_affinity,
+                                  iothread_set_cpu_affinity);
+    object_class_property_add(klass, "numa-node", "int32",
+                              iothread_get_sched_param,
+                              iothread_set_sched_param,
+                              NULL, &numa_node_info);
+    object_class_property_add_str(klass, "sched-policy",
+                                  iothread_get_sched_policy,
+                                  iothread_set_sched_policy);
+    object_class_property_add(klass, "sched-priority", "int32",
+                              iothread_get_sched_param,
+                              iothread_set_sched_param,
+                              NULL, &sched_priority_info);
 }
 
 static const TypeInfo iothread_info = {
@@ -314,6 +477,9 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList *elem;
     IOThreadInfo *info;
     IOThread *iothread;
+    AioPollStats stats;
+    ThreadPoolStats pool_stats = { };
+    ThreadPool *pool;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -327,6 +493,21 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
 
+    aio_context_get_poll_stats(iothread->ctx, &stats);
+    info->poll_hits = stats.hits;
+    info->poll_misses = stats.misses;
+    info->poll_evictions = stats.evictions;
+
+    pool = aio_peek_thread_pool(iothread->ctx);
+    if (pool) {
+        thread_pool_get_stats(pool, &pool_stats);
+    }
+    info->thread_pool_threads = pool_stats.threads;
+    info->thread_pool_requests = pool_stats.requests;
+    info->thread_pool_max_queue_depth = pool_stats.max_queue_depth;
+    info->thread_pool_queue_ns = pool_stats.queue_ns;
+    info->thread_pool_run_ns = pool_stats.run_ns;
+
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
     elem->next = NULL;
@@ -18,6 +18,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu.h"
+#include "accel/tcg/perf.h"
 #ifdef CONFIG_GPROF
 #include <sys/gmon.h>
 #endif
@@ -36,4 +37,6 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(env, code);
         qemu_plugin_atexit_cb();
+        perf_exit();
+        dump_exec_info_at_exit();
 }
@@ -3142,6 +3142,12 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          abi_ulong count, int copy)
 {
+    /*
+     * Without DEBUG_REMAP, lock_user() hands out pointers straight into
+     * guest memory and there is nothing to copy back, so do not re-read
+     * and re-validate the guest's iovec array.
+     */
+#ifdef DEBUG_REMAP
     struct target_iovec *target_vec;
     int i;
 
@@ -3158,7 +3164,7 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         }
         unlock_user(target_vec, target_addr, 0);
     }
-
+#endif
     g_free(vec);
 }
 
@@ -53,6 +53,21 @@
  * [ be64: buffer size  ] \ ! (flags & ZEROES)
  * [ n bytes: buffer    ] /
  *
+ * A ZEROES chunk may cover any number of whole chunks of CHUNK_SIZE bytes
+ * of bitmap data.
+ *
+ * # Extents chunk of bitmap migration (flags & BITS and flags & EXTENTS)
+ * header
+ * be64: start sector
+ * be32: number of sectors
+ * be32: number of extents, at most DBM_MAX_EXTENTS
+ * [ be64: offset ] \ for each extent, in bytes, in increasing order and
+ * [ be64: length ] / within the chunk
+ *
+ * The extents are the dirty areas of the chunk, which is otherwise clean.
+ * Extents chunks are only sent with the dirty-bitmaps-extents capability,
+ * as EXTENTS needs two bytes of flags.
+ *
  * The last chunk in stream should contain flags & EOS. The chunk may skip
  * device and/or bitmap names, assuming them to be the same with the previous
  * chunk.
@@ -78,6 +93,7 @@
 #include "trace.h"
 
 #define CHUNK_SIZE     (1 << 10)
+#define DBM_MAX_EXTENTS 1024
 
 /* Flags occupy one, two or four bytes (Big Endian). The size is determined as
  * follows:
@@ -97,6 +113,8 @@
 
 #define DIRTY_BITMAP_MIG_EXTRA_FLAGS        0x80
 
+#define DIRTY_BITMAP_MIG_FLAG_EXTENTS       0x100
+
 #define DIRTY_BITMAP_MIG_START_FLAG_ENABLED          0x01
 #define DIRTY_BITMAP_MIG_START_FLAG_PERSISTENT       0x02
 /* 0x04 was "AUTOLOAD" flags on older versions, now it is ignored */
@@ -353,7 +371,7 @@ bool check_dirty_bitmap_mig_alias_map(const BitmapMigrationNodeAliasList *bbm,
 
 static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 {
-    uint8_t flags = qemu_get_byte(f);
+    uint32_t flags = qemu_get_byte(f);
     if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
         flags = flags << 8 | qemu_get_byte(f);
         if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
@@ -366,10 +384,15 @@ static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 
 static void qemu_put_bitmap_flags(QEMUFile *f, uint32_t flags)
 {
-    /* The code currently does not send flags as more than one byte */
-    assert(!(flags & (0xffffff00 | DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
+    /* The code currently does not send flags as more than two bytes */
+    assert(!(flags & (0xffff0000 | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8 |
+                      DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
 
-    qemu_put_byte(f, flags);
+    if (flags & 0xff00) {
+        qemu_put_be16(f, flags | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8);
+    } else {
+        qemu_put_byte(f, flags);
+    }
 }
 
 static void send_bitmap_header(QEMUFile *f, DBMSaveState *s,
@@ -419,24 +442,31 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
                              SaveBitmapState *dbms,
                              uint64_t start_sector, uint32_t nr_sectors)
 {
-    /* align for buffer_is_zero() */
+    /* keep the padding that the stream has always had */
     uint64_t align = 4 * sizeof(long);
     uint64_t unaligned_size =
         bdrv_dirty_bitmap_serialization_size(
             dbms->bitmap, start_sector << BDRV_SECTOR_BITS,
             (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
     uint64_t buf_size = QEMU_ALIGN_UP(unaligned_size, align);
-    uint8_t *buf = g_malloc0(buf_size);
+    uint8_t *buf = NULL;
     uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS;
 
-    bdrv_dirty_bitmap_serialize_part(
-        dbms->bitmap, buf, start_sector << BDRV_SECTOR_BITS,
-        (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
-
-    if (buffer_is_zero(buf, buf_size)) {
-        g_free(buf);
-        buf = NULL;
+    /*
+     * Most chunks of a typical bitmap are clean; find out from the bitmap
+     * itself instead of serializing them and scanning the result.
+     */
+    if (bdrv_dirty_bitmap_next_dirty(dbms->bitmap,
+                                     start_sector << BDRV_SECTOR_BITS,
+                                     (uint64_t)nr_sectors << BDRV_SECTOR_BITS)
+        < 0)
+    {
         flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+    } else {
+        buf = g_malloc0(buf_size);
+        bdrv_dirty_bitmap_serialize_part(
+            dbms->bitmap, buf, start_sector << BDRV_SECTOR_BITS,
+            (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -459,6 +489,69 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
     g_free(buf);
 }
 
+/*
+ * Send the dirty areas of the bitmap from @start_sector on as extents, in
+ * a chunk that covers whole chunks of CHUNK_SIZE bytes of bitmap data and
+ * at most @max_sectors.  The chunk ends before the extent that would make
+ * it larger than the same chunks sent as bits, or than DBM_MAX_EXTENTS.
+ * Returns the number of sectors sent, or 0 if the first chunk is smaller
+ * as bits.
+ */
+static uint64_t send_bitmap_extents(QEMUFile *f, DBMSaveState *s,
+                                    SaveBitmapState *dbms,
+                                    uint64_t start_sector,
+                                    uint64_t max_sectors)
+{
+    int64_t chunk_bytes = dbms->sectors_per_chunk << BDRV_SECTOR_BITS;
+    int64_t start = start_sector << BDRV_SECTOR_BITS;
+    int64_t end = (start_sector + max_sectors) << BDRV_SECTOR_BITS;
+    int64_t pos = start, offset, bytes;
+    g_autofree int64_t *extents = g_new(int64_t, 2 * DBM_MAX_EXTENTS);
+    uint32_t nr_sectors, n = 0, i;
+
+    while (bdrv_dirty_bitmap_next_dirty_area(dbms->bitmap, pos, end,
+                                             INT64_MAX, &offset, &bytes)) {
+        uint64_t bits_size = DIV_ROUND_UP(offset + bytes - start,
+                                          chunk_bytes) * CHUNK_SIZE;
+
+        if (n == DBM_MAX_EXTENTS ||
+            (n + 1) * 2 * sizeof(uint64_t) > bits_size) {
+            /* End the chunk before the extent that does not fit */
+            end = QEMU_ALIGN_DOWN(offset, chunk_bytes);
+            if (end <= start) {
+                return 0;
+            }
+            while (n > 0 && extents[2 * (n - 1)] >= end) {
+                n--;
+            }
+            if (n > 0) {
+                extents[2 * n - 1] = MIN(extents[2 * n - 1],
+                                         end - extents[2 * (n - 1)]);
+            }
+            break;
+        }
+        extents[2 * n] = offset;
+        extents[2 * n + 1] = bytes;
+        n++;
+        pos = offset + bytes;
+    }
+
+    nr_sectors = (end - start) >> BDRV_SECTOR_BITS;
+    trace_send_bitmap_extents(start_sector, nr_sectors, n);
+
+    send_bitmap_header(f, s, dbms, DIRTY_BITMAP_MIG_FLAG_BITS |
+                                   DIRTY_BITMAP_MIG_FLAG_EXTENTS);
+
+    qemu_put_be64(f, start_sector);
+    qemu_put_be32(f, nr_sectors);
+    qemu_put_be32(f, n);
+    for (i = 0; i < 2 * n; i++) {
+        qemu_put_be64(f, extents[i]);
+    }
+
+    return nr_sectors;
+}
+
 /* Called with iothread lock taken.  */
 static void dirty_bitmap_do_save_cleanup(DBMSaveState *s)
 {
@@ -537,6 +630,11 @@ static int add_bitmaps_to_list(DBMSaveState *s, BlockDriverState *bs,
             return -1;
         }
 
+        if (bdrv_dirty_bitmap_load(bitmap, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+
         if (bitmap_aliases) {
             bitmap_alias = g_hash_table_lookup(bitmap_aliases, bitmap_name);
             if (!bitmap_alias) {
@@ -667,12 +765,33 @@ fail:
 static void bulk_phase_send_chunk(QEMUFile *f, DBMSaveState *s,
                                   SaveBitmapState *dbms)
 {
-    uint32_t nr_sectors = MIN(dbms->total_sectors - dbms->cur_sector,
-                             dbms->sectors_per_chunk);
+    uint64_t start = dbms->cur_sector;
+    uint64_t spc = dbms->sectors_per_chunk;
+    /* As many whole chunks as the be32 sector count of a chunk can hold */
+    uint64_t max_sectors = MIN(dbms->total_sectors - start,
+                               MAX(QEMU_ALIGN_DOWN(UINT32_MAX, spc), spc));
+    uint64_t nr_sectors = MIN(dbms->total_sectors - start, spc);
+    uint64_t sent = 0;
+    int64_t dirty = bdrv_dirty_bitmap_next_dirty(dbms->bitmap,
+                                                 start << BDRV_SECTOR_BITS,
+                                                 max_sectors <<
+                                                 BDRV_SECTOR_BITS);
+
+    if (dirty < 0) {
+        /* Send the clean part in one ZEROES chunk */
+        nr_sectors = max_sectors;
+    } else if ((dirty >> BDRV_SECTOR_BITS) - start >= spc) {
+        nr_sectors = QEMU_ALIGN_DOWN((dirty >> BDRV_SECTOR_BITS) - start, spc);
+    } else if (migrate_dirty_bitmaps_extents()) {
+        sent = send_bitmap_extents(f, s, dbms, start, max_sectors);
+    }
 
-    send_bitmap_bits(f, s, dbms, dbms->cur_sector, nr_sectors);
+    if (!sent) {
+        send_bitmap_bits(f, s, dbms, start, nr_sectors);
+        sent = nr_sectors;
+    }
 
-    dbms->cur_sector += nr_sectors;
+    dbms->cur_sector += sent;
     if (dbms->cur_sector >= dbms->total_sectors) {
         dbms->bulk_completed = true;
     }
@@ -939,6 +1058,52 @@ static void dirty_bitmap_load_complete(QEMUFile *f, DBMLoadState *s)
     }
 }
 
+static int dirty_bitmap_load_extents(QEMUFile *f, DBMLoadState *s,
+                                     uint64_t first_byte, uint64_t nr_bytes)
+{
+    uint32_t n = qemu_get_be32(f);
+    uint64_t prev_end = first_byte;
+    g_autofree uint64_t *extents = NULL;
+    uint32_t i;
+
+    trace_dirty_bitmap_load_extents(n);
+
+    if (n > DBM_MAX_EXTENTS) {
+        error_report("Too many extents in bitmap migration stream chunk");
+        return -EIO;
+    }
+
+    extents = g_new(uint64_t, 2 * n);
+    for (i = 0; i < 2 * n; i++) {
+        extents[i] = qemu_get_be64(f);
+    }
+
+    if (s->cancelled) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        uint64_t offset = extents[2 * i], bytes = extents[2 * i + 1];
+
+        if (offset < prev_end || offset >= first_byte + nr_bytes ||
+            bytes == 0 || bytes > first_byte + nr_bytes - offset) {
+            error_report("Invalid extent in migrated dirty bitmap '%s'",
+                         bdrv_dirty_bitmap_name(s->bitmap));
+            cancel_incoming_locked(s);
+            return 0;
+        }
+        prev_end = offset + bytes;
+    }
+
+    bdrv_dirty_bitmap_deserialize_zeroes(s->bitmap, first_byte, nr_bytes,
+                                         false);
+    for (i = 0; i < n; i++) {
+        bdrv_set_dirty_bitmap(s->bitmap, extents[2 * i], extents[2 * i + 1]);
+    }
+
+    return 0;
+}
+
 static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
 {
     uint64_t first_byte = qemu_get_be64(f) << BDRV_SECTOR_BITS;
@@ -946,7 +1111,9 @@ static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
     trace_dirty_bitmap_load_bits_enter(first_byte >> BDRV_SECTOR_BITS,
                                        nr_bytes >> BDRV_SECTOR_BITS);
 
-    if (s->flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
+    if (s->flags & DIRTY_BITMAP_MIG_FLAG_EXTENTS) {
+        return dirty_bitmap_load_extents(f, s, first_byte, nr_bytes);
+    } else if (s->flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
         trace_dirty_bitmap_load_bits_zeroes();
         if (!s->cancelled) {
             bdrv_dirty_bitmap_deserialize_zeroes(s->bitmap, first_byte,
@@ -19,7 +19,11 @@
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "qemu/rcu_queue.h"
+#include "qemu/main-loop.h"
 #include "qapi/qapi-commands-migration.h"
+#include "hw/core/cpu.h"
+#include "migration/misc.h"
+#include "sysemu/kvm.h"
 #include "migration.h"
 #include "ram.h"
 #include "trace.h"
@@ -27,6 +31,7 @@
 
 static int CalculatingState = DIRTY_RATE_STATUS_UNSTARTED;
 static struct DirtyRateStat DirtyStat;
+static struct DirtyRateMonitor DirtyMonitor;
 
 static int64_t set_sample_page_period(int64_t msec, int64_t initial_time)
 {
@@ -75,44 +80,65 @@ static struct DirtyRateInfo *query_dirty_rate_info(void)
     }
 
     info->status = CalculatingState;
-    info->start_time = DirtyStat.start_time;
-    info->calc_time = DirtyStat.calc_time;
+    info->start_time = DirtyStat.start_time / 1000;
+    info->calc_time = DirtyStat.calc_time / 1000;
+    info->mode = DirtyStat.mode;
+
+    if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURED &&
+        DirtyStat.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        DirtyRateVcpuList *head = NULL, *entry;
+        int i;
+
+        for (i = DirtyStat.nvcpu - 1; i >= 0; i--) {
+            entry = g_new0(DirtyRateVcpuList, 1);
+            entry->value = g_memdup(&DirtyStat.vcpu_dirty_rate[i],
+                                    sizeof(DirtyRateVcpu));
+            entry->next = head;
+            head = entry;
+        }
+        info->has_vcpu_dirty_rate = true;
+        info->vcpu_dirty_rate = head;
+    }
 
     trace_query_dirty_rate_info(DirtyRateStatus_str(CalculatingState));
 
     return info;
 }
 
-static void reset_dirtyrate_stat(void)
+static void reset_dirtyrate_stat(struct DirtyRateStat *stat)
 {
-    DirtyStat.total_dirty_samples = 0;
-    DirtyStat.total_sample_count = 0;
-    DirtyStat.total_block_mem_MB = 0;
-    DirtyStat.dirty_rate = -1;
-    DirtyStat.start_time = 0;
-    DirtyStat.calc_time = 0;
+    stat->total_dirty_samples = 0;
+    stat->total_sample_count = 0;
+    stat->total_block_mem_MB = 0;
+    stat->dirty_rate = -1;
+    stat->start_time = 0;
+    stat->calc_time = 0;
+    stat->nvcpu = 0;
+    g_free(stat->vcpu_dirty_rate);
+    stat->vcpu_dirty_rate = NULL;
 }
 
-static void update_dirtyrate_stat(struct RamblockDirtyInfo *info)
+static void update_dirtyrate_stat(struct DirtyRateStat *stat,
+                                  struct RamblockDirtyInfo *info)
 {
-    DirtyStat.total_dirty_samples += info->sample_dirty_count;
-    DirtyStat.total_sample_count += info->sample_pages_count;
+    stat->total_dirty_samples += info->sample_dirty_count;
+    stat->total_sample_count += info->sample_pages_count;
     /* size of total pages in MB */
-    DirtyStat.total_block_mem_MB += (info->ramblock_pages *
-                                     TARGET_PAGE_SIZE) >> 20;
+    stat->total_block_mem_MB += (info->ramblock_pages *
+                                 TARGET_PAGE_SIZE) >> 20;
 }
 
-static void update_dirtyrate(uint64_t msec)
+static void update_dirtyrate(struct DirtyRateStat *stat, uint64_t msec)
 {
     uint64_t dirtyrate;
-    uint64_t total_dirty_samples = DirtyStat.total_dirty_samples;
-    uint64_t total_sample_count = DirtyStat.total_sample_count;
-    uint64_t total_block_mem_MB = DirtyStat.total_block_mem_MB;
+    uint64_t total_dirty_samples = stat->total_dirty_samples;
+    uint64_t total_sample_count = stat->total_sample_count;
+    uint64_t total_block_mem_MB = stat->total_block_mem_MB;
 
     dirtyrate = total_dirty_samples * total_block_mem_MB *
                 1000 / (total_sample_count * msec);
 
-    DirtyStat.dirty_rate = dirtyrate;
+    stat->dirty_rate = dirtyrate;
 }
 
 /*
@@ -302,8 +328,9 @@ find_block_matched(RAMBlock *block, int count,
     return matched;
 }
 
-static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
-                                  int block_count)
+static bool compare_page_hash_info(struct DirtyRateStat *stat,
+                                   struct RamblockDirtyInfo *info,
+                                   int block_count)
 {
     struct RamblockDirtyInfo *block_dinfo = NULL;
     RAMBlock *block = NULL;
@@ -317,17 +344,129 @@ static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
             continue;
         }
         calc_page_dirty_rate(block_dinfo);
-        update_dirtyrate_stat(block_dinfo);
+        update_dirtyrate_stat(stat, block_dinfo);
     }
 
-    if (DirtyStat.total_sample_count == 0) {
+    if (stat->total_sample_count == 0) {
         return false;
     }
 
     return true;
 }
 
-static void calculate_dirtyrate(struct DirtyRateConfig config)
+/*
+ * Count the pages dirtied by each vCPU with the KVM dirty ring.  Unlike
+ * page sampling this is exact, and tells which vCPUs dirty memory.
+ */
+static void calculate_dirtyrate_dirty_ring(struct DirtyRateConfig config,
+                                           struct DirtyRateStat *stat)
+{
+    CPUState *cpu;
+    uint64_t *dirty_pages_start;
+    uint64_t total_pages = 0;
+    int64_t msec, initial_time;
+    int nvcpu = 0, i;
+    bool start_log;
+
+    qemu_mutex_lock_iothread();
+    start_log = !global_dirty_log;
+    if (start_log) {
+        memory_global_dirty_log_start();
+    }
+    /*
+     * Harvest the rings so that what was dirtied before the start is
+     * not accounted to the period.
+     */
+    memory_global_dirty_log_sync();
+    CPU_FOREACH(cpu) {
+        nvcpu++;
+    }
+    dirty_pages_start = g_new0(uint64_t, nvcpu);
+    stat->vcpu_dirty_rate = g_new0(DirtyRateVcpu, nvcpu);
+    i = 0;
+    CPU_FOREACH(cpu) {
+        stat->vcpu_dirty_rate[i].id = cpu->cpu_index;
+        dirty_pages_start[i++] = cpu->dirty_pages;
+    }
+    stat->nvcpu = nvcpu;
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_mutex_unlock_iothread();
+
+    msec = set_sample_page_period(config.sample_period_ms, initial_time);
+    stat->start_time = initial_time;
+    stat->calc_time = msec;
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_sync();
+    CPU_FOREACH(cpu) {
+        /* vCPUs plugged in meanwhile are not measured */
+        for (i = 0; i < nvcpu; i++) {
+            DirtyRateVcpu *rate = &stat->vcpu_dirty_rate[i];
+            uint64_t pages;
+
+            if (rate->id != cpu->cpu_index) {
+                continue;
+            }
+            pages = cpu->dirty_pages - dirty_pages_start[i];
+            rate->dirty_rate = (pages * qemu_real_host_page_size * 1000 /
+                                msec) >> 20;
+            total_pages += pages;
+            trace_dirtyrate_vcpu(rate->id, rate->dirty_rate);
+            break;
+        }
+    }
+    /* Leave the dirty log alone if migration started meanwhile */
+    if (start_log && migration_is_idle()) {
+        memory_global_dirty_log_stop();
+    }
+    qemu_mutex_unlock_iothread();
+
+    stat->dirty_rate = (total_pages * qemu_real_host_page_size * 1000 /
+                        msec) >> 20;
+    g_free(dirty_pages_start);
+}
+
+/*
+ * Count the pages that KVM reports dirty, from its dirty bitmaps or its
+ * dirty rings.  Unlike page sampling this is exact and only costs the
+ * dirty logging, which is enabled for the period only.
+ */
+static void calculate_dirtyrate_dirty_log(struct DirtyRateConfig config,
+                                          struct DirtyRateStat *stat)
+{
+    uint64_t pages;
+    int64_t msec, initial_time;
+    bool start_log;
+
+    qemu_mutex_lock_iothread();
+    start_log = !global_dirty_log;
+    if (start_log) {
+        memory_global_dirty_log_start();
+    }
+    /* Collect what was dirtied before the start, as for the dirty ring */
+    memory_global_dirty_log_sync();
+    pages = kvm_dirty_log_pages();
+    initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_mutex_unlock_iothread();
+
+    msec = set_sample_page_period(config.sample_period_ms, initial_time);
+    stat->start_time = initial_time;
+    stat->calc_time = msec;
+
+    qemu_mutex_lock_iothread();
+    memory_global_dirty_log_sync();
+    pages = kvm_dirty_log_pages() - pages;
+    /* Leave the dirty log alone if migration started meanwhile */
+    if (start_log && migration_is_idle()) {
+        memory_global_dirty_log_stop();
+    }
+    qemu_mutex_unlock_iothread();
+
+    stat->dirty_rate = (pages * qemu_real_host_page_size * 1000 / msec) >> 20;
+}
+
+static void calculate_dirtyrate(struct DirtyRateConfig config,
+                                struct DirtyRateStat *stat)
 {
     struct RamblockDirtyInfo *block_dinfo = NULL;
     int block_count = 0;
@@ -335,7 +474,18 @@ static void calculate_dirtyrate(struct DirtyRateConfig config)
     int64_t initial_time;
 
     rcu_register_thread();
-    reset_dirtyrate_stat();
+    reset_dirtyrate_stat(stat);
+    stat->mode = config.mode;
+    if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING) {
+        calculate_dirtyrate_dirty_ring(config, stat);
+        rcu_unregister_thread();
+        return;
+    }
+    if (config.mode == DIRTY_RATE_MEASURE_MODE_DIRTY_LOG) {
+        calculate_dirtyrate_dirty_log(config, stat);
+        rcu_unregister_thread();
+        return;
+    }
     rcu_read_lock();
     initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     if (!record_ramblock_hash_info(&block_dinfo, config, &block_count)) {
@@ -343,17 +493,16 @@ static void calculate_dirtyrate(struct DirtyRateConfig config)
     }
     rcu_read_unlock();
 
-    msec = config.sample_period_seconds * 1000;
-    msec = set_sample_page_period(msec, initial_time);
-    DirtyStat.start_time = initial_time / 1000;
-    DirtyStat.calc_time = msec / 1000;
+    msec = set_sample_page_period(config.sample_period_ms, initial_time);
+    stat->start_time = initial_time;
+    stat->calc_time = msec;
 
     rcu_read_lock();
-    if (!compare_page_hash_info(block_dinfo, block_count)) {
+    if (!compare_page_hash_info(stat, block_dinfo, block_count)) {
         goto out;
     }
 
-    update_dirtyrate(msec);
+    update_dirtyrate(stat, msec);
 
 out:
     rcu_read_unlock();
@@ -373,7 +522,7 @@ void *get_dirtyrate_thread(void *arg)
         return NULL;
     }
 
-    calculate_dirtyrate(config);
+    calculate_dirtyrate(config, &DirtyStat);
 
     ret = dirtyrate_set_state(&CalculatingState, DIRTY_RATE_STATUS_MEASURING,
                               DIRTY_RATE_STATUS_MEASURED);
@@ -383,7 +532,24 @@ void *get_dirtyrate_thread(void *arg)
     return NULL;
 }
 
-void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
+static bool is_mode_valid(DirtyRateMeasureMode mode, Error **errp)
+{
+    if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_RING &&
+        !kvm_dirty_ring_enabled()) {
+        error_setg(errp, "mode dirty-ring requires the KVM dirty ring, "
+                   "see the dirty-ring-size property of the kvm accelerator");
+        return false;
+    }
+    if (mode == DIRTY_RATE_MEASURE_MODE_DIRTY_LOG && !kvm_enabled()) {
+        error_setg(errp, "mode dirty-log requires the kvm accelerator");
+        return false;
+    }
+
+    return true;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, bool has_mode,
+                         DirtyRateMeasureMode mode, Error **errp)
 {
     static struct DirtyRateConfig config;
     QemuThread thread;
@@ -404,6 +570,22 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
         return;
     }
 
+    if (!has_mode) {
+        mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+    }
+    if (!is_mode_valid(mode, errp)) {
+        return;
+    }
+
+    /*
+     * The monitor may start and stop the dirty log, and so may we.
+     */
+    if (DirtyMonitor.running) {
+        error_setg(errp, "the dirty rate monitor is running, "
+                   "see query-dirty-rate-monitor");
+        return;
+    }
+
     /*
      * Init calculation state as unstarted.
      */
@@ -414,8 +596,9 @@ void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
         return;
     }
 
-    config.sample_period_seconds = calc_time;
+    config.sample_period_ms = calc_time * 1000;
     config.sample_pages_per_gigabytes = DIRTYRATE_DEFAULT_SAMPLE_PAGES;
+    config.mode = mode;
     qemu_thread_create(&thread, "get_dirtyrate", get_dirtyrate_thread,
                        (void *)&config, QEMU_THREAD_DETACHED);
 }
@@ -424,3 +607,163 @@ struct DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
 {
     return query_dirty_rate_info();
 }
+
+static void *dirtyrate_monitor_thread(void *opaque)
+{
+    struct DirtyRateMonitor *mon = opaque;
+    struct DirtyRateStat stat = { 0 };
+    DirtyRateSample *sample;
+    int64_t start, elapsed;
+
+    do {
+        start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+        calculate_dirtyrate(mon->config, &stat);
+        trace_dirtyrate_monitor_sample(stat.dirty_rate);
+
+        qemu_mutex_lock(&mon->lock);
+        sample = &mon->history[mon->history_next];
+        sample->start_time = stat.start_time;
+        sample->calc_time = stat.calc_time;
+        sample->dirty_rate = stat.dirty_rate;
+        mon->history_next = (mon->history_next + 1) % mon->history_size;
+        if (mon->history_len < mon->history_size) {
+            mon->history_len++;
+        }
+        qemu_mutex_unlock(&mon->lock);
+
+        /* Sleep for the rest of the interval, or until stopped */
+        elapsed = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start;
+    } while (qemu_sem_timedwait(&mon->stop_sem,
+                                MAX(mon->interval_ms - elapsed, 0)) < 0);
+
+    reset_dirtyrate_stat(&stat);
+    return NULL;
+}
+
+void qmp_start_dirty_rate_monitor(int64_t interval, int64_t calc_time,
+                                  bool has_mode, DirtyRateMeasureMode mode,
+                                  bool has_history_size, int64_t history_size,
+                                  Error **errp)
+{
+    struct DirtyRateMonitor *mon = &DirtyMonitor;
+
+    if (mon->running) {
+        error_setg(errp, "the dirty rate monitor is already running");
+        return;
+    }
+    if (qatomic_read(&CalculatingState) == DIRTY_RATE_STATUS_MEASURING) {
+        error_setg(errp, "the dirty rate is being measured");
+        return;
+    }
+
+    if (calc_time < MIN_DIRTYRATE_MONITOR_CALC_TIME_MS ||
+        calc_time > interval) {
+        error_setg(errp, "calc-time must be at least %d ms and no more "
+                   "than interval", MIN_DIRTYRATE_MONITOR_CALC_TIME_MS);
+        return;
+    }
+    if (interval > MAX_DIRTYRATE_MONITOR_INTERVAL_MS) {
+        error_setg(errp, "interval is out of range[%d, %d]",
+                   MIN_DIRTYRATE_MONITOR_CALC_TIME_MS,
+                   MAX_DIRTYRATE_MONITOR_INTERVAL_MS);
+        return;
+    }
+    if (!has_history_size) {
+        history_size = DEFAULT_DIRTYRATE_MONITOR_HISTORY;
+    }
+    if (history_size < 1 || history_size > MAX_DIRTYRATE_MONITOR_HISTORY) {
+        error_setg(errp, "history-size is out of range[1, %d]",
+                   MAX_DIRTYRATE_MONITOR_HISTORY);
+        return;
+    }
+
+    if (!has_mode) {
+        mode = DIRTY_RATE_MEASURE_MODE_PAGE_SAMPLING;
+    }
+    if (!is_mode_valid(mode, errp)) {
+        return;
+    }
+
+    mon->config.sample_period_ms = calc_time;
+    mon->config.sample_pages_per_gigabytes = DIRTYRATE_DEFAULT_SAMPLE_PAGES;
+    mon->config.mode = mode;
+    mon->interval_ms = interval;
+
+    /* The lock outlives each run, for queries after stop */
+    if (!mon->history) {
+        qemu_mutex_init(&mon->lock);
+    }
+    g_free(mon->history);
+    mon->history = g_new0(DirtyRateSample, history_size);
+    mon->history_size = history_size;
+    mon->history_len = 0;
+    mon->history_next = 0;
+
+    qemu_sem_init(&mon->stop_sem, 0);
+    mon->running = true;
+    qemu_thread_create(&mon->thread, "dirtyrate_mon",
+                       dirtyrate_monitor_thread, mon, QEMU_THREAD_JOINABLE);
+}
+
+void qmp_stop_dirty_rate_monitor(Error **errp)
+{
+    struct DirtyRateMonitor *mon = &DirtyMonitor;
+
+    if (!mon->running) {
+        error_setg(errp, "the dirty rate monitor is not running");
+        return;
+    }
+
+    qemu_sem_post(&mon->stop_sem);
+    /* The thread takes the iothread lock to sync the dirty log */
+    qemu_mutex_unlock_iothread();
+    qemu_thread_join(&mon->thread);
+    qemu_mutex_lock_iothread();
+
+    mon->running = false;
+    qemu_sem_destroy(&mon->stop_sem);
+}
+
+DirtyRateMonitorInfo *qmp_query_dirty_rate_monitor(Error **errp)
+{
+    struct DirtyRateMonitor *mon = &DirtyMonitor;
+    DirtyRateMonitorInfo *info = g_new0(DirtyRateMonitorInfo, 1);
+    DirtyRateSampleList *head = NULL, *entry;
+    int64_t total = 0;
+    int i, n = 0;
+
+    info->active = mon->running;
+    if (!mon->history) {
+        info->dirty_rate = -1;
+        return info;
+    }
+
+    info->has_mode = true;
+    info->mode = mon->config.mode;
+    info->has_interval = true;
+    info->interval = mon->interval_ms;
+    info->has_calc_time = true;
+    info->calc_time = mon->config.sample_period_ms;
+
+    /* Walk back from the newest sample, so that the list is oldest first */
+    qemu_mutex_lock(&mon->lock);
+    for (i = 1; i <= mon->history_len; i++) {
+        DirtyRateSample *sample = &mon->history[(mon->history_next - i +
+                                                 mon->history_size) %
+                                                mon->history_size];
+
+        if (sample->dirty_rate >= 0) {
+            total += sample->dirty_rate;
+            n++;
+        }
+        entry = g_new0(DirtyRateSampleList, 1);
+        entry->value = g_memdup(sample, sizeof(*sample));
+        entry->next = head;
+        head = entry;
+    }
+    qemu_mutex_unlock(&mon->lock);
+
+    info->samples = head;
+    info->dirty_rate = n ? total / n : -1;
+    return info;
+}
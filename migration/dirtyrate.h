@@ -13,6 +13,9 @@
 #ifndef QEMU_MIGRATION_DIRTYRATE_H
 #define QEMU_MIGRATION_DIRTYRATE_H
 
+#include "qemu/thread.h"
+#include "qapi/qapi-types-migration.h"
+
 /*
  * Sample 512 pages per GB as default.
  * TODO: Make it configurable.
@@ -35,9 +38,19 @@
 #define MIN_FETCH_DIRTYRATE_TIME_SEC              1
 #define MAX_FETCH_DIRTYRATE_TIME_SEC              60
 
+/*
+ * Limits of the dirty rate monitor: measurements of at least 10ms, at
+ * most once per hour, and up to one day of history at one per minute.
+ */
+#define MIN_DIRTYRATE_MONITOR_CALC_TIME_MS        10
+#define MAX_DIRTYRATE_MONITOR_INTERVAL_MS         (3600 * 1000)
+#define DEFAULT_DIRTYRATE_MONITOR_HISTORY         60
+#define MAX_DIRTYRATE_MONITOR_HISTORY             1440
+
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
-    int64_t sample_period_seconds; /* time duration between two sampling */
+    int64_t sample_period_ms; /* time duration between two sampling */
+    DirtyRateMeasureMode mode; /* how to measure the dirty rate */
 };
 
 /*
@@ -61,8 +74,29 @@ struct DirtyRateStat {
     uint64_t total_sample_count; /* total sampled pages */
     uint64_t total_block_mem_MB; /* size of total sampled pages in MB */
     int64_t dirty_rate; /* dirty rate in MB/s */
-    int64_t start_time; /* calculation start time in units of second */
-    int64_t calc_time; /* time duration of two sampling in units of second */
+    int64_t start_time; /* calculation start time in milliseconds */
+    int64_t calc_time; /* time duration of two sampling in milliseconds */
+    DirtyRateMeasureMode mode; /* how the dirty rate was measured */
+    int nvcpu; /* number of vCPUs in vcpu_dirty_rate */
+    DirtyRateVcpu *vcpu_dirty_rate; /* dirty rate of each vCPU in MB/s */
+};
+
+/*
+ * The dirty rate monitor measures the dirty rate for calc_time_ms out of
+ * every interval_ms, in the background, and keeps the last measurements.
+ */
+struct DirtyRateMonitor {
+    QemuThread thread;
+    QemuSemaphore stop_sem;
+    bool running;
+    struct DirtyRateConfig config;
+    int64_t interval_ms;
+
+    QemuMutex lock; /* protects the history */
+    DirtyRateSample *history; /* ring of history_size samples */
+    int history_size;
+    int history_len; /* number of valid samples */
+    int history_next; /* where the next sample goes */
 };
 
 void *get_dirtyrate_thread(void *arg);
@@ -24,6 +24,7 @@
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -49,6 +50,7 @@
 #include "trace.h"
 #include "exec/target_page.h"
 #include "io/channel-buffer.h"
+#include "io/channel-socket.h"
 #include "migration/colo.h"
 #include "hw/boards.h"
 #include "hw/qdev-properties.h"
@@ -233,6 +235,16 @@ void migration_incoming_state_destroy(void)
         qemu_fclose(mis->from_src_file);
         mis->from_src_file = NULL;
     }
+    if (mis->postcopy_qemufile_dst) {
+        if (mis->have_preempt_thread) {
+            /* Only left running if postcopy failed */
+            qemu_file_shutdown(mis->postcopy_qemufile_dst);
+            qemu_thread_join(&mis->preempt_thread);
+            mis->have_preempt_thread = false;
+        }
+        qemu_fclose(mis->postcopy_qemufile_dst);
+        mis->postcopy_qemufile_dst = NULL;
+    }
     if (mis->postcopy_remote_fds) {
         g_array_free(mis->postcopy_remote_fds, TRUE);
         mis->postcopy_remote_fds = NULL;
@@ -628,7 +640,14 @@ void migration_fd_process_incoming(QEMUFile *f, Error **errp)
         }
         return;
     }
-    migration_incoming_process();
+
+    /*
+     * Multifd channels connect after the main one, the last of them
+     * starts the migration in migration_ioc_process_incoming().
+     */
+    if (migration_has_all_channels()) {
+        migration_incoming_process();
+    }
 }
 
 void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
@@ -658,14 +677,20 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
          * right now.  Multifd needs more than one channel, we wait.
          */
         start_migration = !migrate_use_multifd();
-    } else {
+    } else if (migrate_use_multifd()) {
         /* Multiple connections */
-        assert(migrate_use_multifd());
         start_migration = multifd_recv_new_channel(ioc, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
         }
+    } else if (migrate_postcopy_preempt() && !mis->postcopy_qemufile_dst) {
+        /* The second connection is the postcopy-preempt channel */
+        postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+        return;
+    } else {
+        error_setg(errp, "Unexpected additional migration connection");
+        return;
     }
 
     if (start_migration) {
@@ -685,6 +710,9 @@ bool migration_has_all_channels(void)
     bool all_channels;
 
     all_channels = multifd_recv_all_channels_created();
+    if (migrate_postcopy_preempt() && !mis->postcopy_qemufile_dst) {
+        all_channels = false;
+    }
 
     return all_channels && mis->from_src_file != NULL;
 }
@@ -941,8 +969,30 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     }
 }
 
+/*
+ * Take the BQL for a query-migrate from QMP, which does not hold it;
+ * "info migrate" does.  Returns whether it has to be released.
+ */
+static bool query_lock_iothread(void)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
+static void query_unlock_iothread(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void populate_ram_info(MigrationInfo *info, MigrationState *s)
 {
+    bool locked;
+
     info->has_ram = true;
     info->ram = g_malloc0(sizeof(*info->ram));
     info->ram->transferred = ram_counters.transferred;
@@ -960,6 +1010,26 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->multifd_bytes = ram_counters.multifd_bytes;
     info->ram->pages_per_second = s->pages_per_second;
 
+    info->has_phases = true;
+    info->phases = g_malloc0(sizeof(*info->phases));
+    info->phases->bitmap_sync_time =
+        stat64_get(&phase_counters.bitmap_sync_ns) / SCALE_US;
+    info->phases->zero_page_time =
+        stat64_get(&phase_counters.zero_page_ns) / SCALE_US;
+    info->phases->write_wait_time = s->write_wait_time;
+    info->phases->multifd_wait_time =
+        stat64_get(&phase_counters.multifd_wait_ns) / SCALE_US;
+
+    if (migrate_use_multifd()) {
+        info->multifd_channels = multifd_send_channel_stats();
+        info->has_multifd_channels = !!info->multifd_channels;
+    }
+
+    locked = query_lock_iothread();
+    info->device_downtime = qemu_savevm_downtime_list();
+    query_unlock_iothread(locked);
+    info->has_device_downtime = !!info->device_downtime;
+
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
@@ -967,6 +1037,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->bytes = xbzrle_counters.bytes;
         info->xbzrle_cache->pages = xbzrle_counters.pages;
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
+        info->xbzrle_cache->cache_evictions = xbzrle_counters.cache_evictions;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
@@ -1006,9 +1077,15 @@ static void populate_disk_info(MigrationInfo *info)
     }
 }
 
+/*
+ * query-migrate runs without the BQL.  The counters are written by the
+ * migration thread without it anyway; the lists of devices, which
+ * hotplug can change, are read with the BQL taken just for them.
+ */
 static void fill_source_migration_info(MigrationInfo *info)
 {
     MigrationState *s = migrate_get_current();
+    bool locked;
 
     switch (s->state) {
     case MIGRATION_STATUS_NONE:
@@ -1029,7 +1106,9 @@ static void fill_source_migration_info(MigrationInfo *info)
         /* TODO add some postcopy stats */
         populate_time_info(info, s);
         populate_ram_info(info, s);
+        locked = query_lock_iothread();
         populate_disk_info(info);
+        query_unlock_iothread(locked);
         break;
     case MIGRATION_STATUS_COLO:
         info->has_status = true;
@@ -1041,10 +1120,12 @@ static void fill_source_migration_info(MigrationInfo *info)
         break;
     case MIGRATION_STATUS_FAILED:
         info->has_status = true;
+        qemu_mutex_lock(&s->error_mutex);
         if (s->error) {
             info->has_error_desc = true;
             info->error_desc = g_strdup(error_get_pretty(s->error));
         }
+        qemu_mutex_unlock(&s->error_mutex);
         break;
     case MIGRATION_STATUS_CANCELLED:
         info->has_status = true;
@@ -1065,6 +1146,28 @@ static void fill_source_migration_info(MigrationInfo *info)
  *
  * Returns true if check passed, otherwise false.
  */
+/* Capabilities that need a live source or a destination QEMU */
+static const MigrationCapability background_snapshot_incompatible[] = {
+    MIGRATION_CAPABILITY_XBZRLE,
+    MIGRATION_CAPABILITY_RDMA_PIN_ALL,
+    MIGRATION_CAPABILITY_AUTO_CONVERGE,
+    MIGRATION_CAPABILITY_COMPRESS,
+    MIGRATION_CAPABILITY_POSTCOPY_RAM,
+    MIGRATION_CAPABILITY_X_COLO,
+    MIGRATION_CAPABILITY_RELEASE_RAM,
+    MIGRATION_CAPABILITY_BLOCK,
+    MIGRATION_CAPABILITY_RETURN_PATH,
+    MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER,
+    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_DIRTY_BITMAPS,
+    MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME,
+    MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE,
+    MIGRATION_CAPABILITY_X_IGNORE_SHARED,
+    MIGRATION_CAPABILITY_VALIDATE_UUID,
+    MIGRATION_CAPABILITY_PER_VCPU_THROTTLE,
+    MIGRATION_CAPABILITY_MAPPED_RAM,
+};
+
 static bool migrate_caps_check(bool *cap_list,
                                MigrationCapabilityStatusList *params,
                                Error **errp)
@@ -1117,6 +1220,111 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+        /* The destination tells the extra channels apart by their order */
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy preempt is not compatible with multifd");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Postcopy preempt is not compatible with compress");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Capability multifd-zero-page requires multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_ZERO_COPY]) {
+#ifndef QEMU_MSG_ZEROCOPY
+        error_setg(errp, "Zero-copy sends are not supported on this host");
+        return false;
+#endif
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Capability multifd-zero-copy requires multifd");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY] &&
+        (!cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+         !cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM])) {
+        error_setg(errp, "Capability multifd-postcopy requires multifd "
+                   "and postcopy-ram");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_BITMAPS_EXTENTS] &&
+        !cap_list[MIGRATION_CAPABILITY_DIRTY_BITMAPS]) {
+        error_setg(errp, "Capability dirty-bitmaps-extents requires "
+                   "dirty-bitmaps");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MULTIFD_COMPRESSION_ADAPTIVE] &&
+        !cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+        error_setg(errp, "Capability multifd-compression-adaptive requires "
+                   "multifd");
+        return false;
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_PER_VCPU_THROTTLE]) {
+        if (!cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Capability per-vcpu-throttle requires "
+                       "auto-converge");
+            return false;
+        }
+        if (!kvm_dirty_ring_enabled()) {
+            error_setg(errp, "Capability per-vcpu-throttle requires "
+                       "the KVM dirty ring");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Capability mapped-ram is not compatible with "
+                       "multifd, xbzrle, compress, postcopy-ram and x-colo");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+        size_t i;
+
+        for (i = 0; i < ARRAY_SIZE(background_snapshot_incompatible); i++) {
+            MigrationCapability incomp = background_snapshot_incompatible[i];
+
+            if (cap_list[incomp]) {
+                error_setg(errp, "Capability background-snapshot is not "
+                           "compatible with %s",
+                           MigrationCapability_str(incomp));
+                return false;
+            }
+        }
+        if (!ram_write_tracking_available()) {
+            error_setg(errp, "Capability background-snapshot is not "
+                       "supported by the host kernel");
+            return false;
+        }
+        if (!ram_write_tracking_compatible()) {
+            error_setg(errp, "Capability background-snapshot is not "
+                       "compatible with the guest memory configuration");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -1682,6 +1890,10 @@ static void migrate_fd_cleanup(MigrationState *s)
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
         qemu_mutex_unlock(&s->qemu_file_lock);
+        if (s->postcopy_qemufile_src) {
+            qemu_fclose(s->postcopy_qemufile_src);
+            s->postcopy_qemufile_src = NULL;
+        }
         /*
          * Close the file handle without the lock to make sure the
          * critical section won't block for long.
@@ -1771,6 +1983,13 @@ static void migrate_fd_cancel(MigrationState *s)
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
     }
+    if (s->state == MIGRATION_STATUS_CANCELLING) {
+        qemu_mutex_lock(&s->qemu_file_lock);
+        if (s->postcopy_qemufile_src) {
+            qemu_file_shutdown(s->postcopy_qemufile_src);
+        }
+        qemu_mutex_unlock(&s->qemu_file_lock);
+    }
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
 
@@ -1885,6 +2104,7 @@ void migrate_init(MigrationState *s)
     s->rp_state.error = false;
     s->mbps = 0.0;
     s->pages_per_second = 0.0;
+    s->write_wait_time = 0;
     s->downtime = 0;
     s->expected_downtime = 0;
     s->setup_time = 0;
@@ -2095,6 +2315,7 @@ static bool migrate_prepare(MigrationState *s, bool blk, bool blk_inc,
      * new migration
      */
     memset(&ram_counters, 0, sizeof(ram_counters));
+    memset(&phase_counters, 0, sizeof(phase_counters));
 
     return true;
 }
@@ -2113,10 +2334,26 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         return;
     }
 
+    if (migrate_postcopy_preempt() &&
+        s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_setg(errp, "Postcopy preempt does not support TLS");
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        block_cleanup_parameters(s);
+        return;
+    }
+
     if (strstart(uri, "tcp:", &p) ||
         strstart(uri, "unix:", NULL) ||
         strstart(uri, "vsock:", NULL)) {
         socket_start_outgoing_migration(s, p ? p : uri, &local_err);
+    } else if (migrate_postcopy_preempt()) {
+        /* The preempt channel is opened like the main socket */
+        error_setg(errp, "Postcopy preempt requires a socket migration URI");
+        migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                          MIGRATION_STATUS_FAILED);
+        block_cleanup_parameters(s);
+        return;
 #ifdef CONFIG_RDMA
     } else if (strstart(uri, "rdma:", &p)) {
         rdma_start_outgoing_migration(s, p, &local_err);
@@ -2220,6 +2457,15 @@ bool migrate_postcopy_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -2234,6 +2480,33 @@ bool migrate_auto_converge(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_use_per_vcpu_throttle(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_PER_VCPU_THROTTLE];
+}
+
+bool migrate_use_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+}
+
 bool migrate_zero_blocks(void)
 {
     MigrationState *s;
@@ -2306,6 +2579,15 @@ bool migrate_dirty_bitmaps(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS];
 }
 
+bool migrate_dirty_bitmaps_extents(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS_EXTENTS];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s;
@@ -2342,6 +2624,43 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_multifd_zero_page(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE];
+}
+
+bool migrate_use_multifd_zero_copy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_ZERO_COPY];
+}
+
+bool migrate_use_multifd_postcopy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD_POSTCOPY];
+}
+
+bool migrate_use_multifd_compression_adaptive(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[
+        MIGRATION_CAPABILITY_MULTIFD_COMPRESSION_ADAPTIVE];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2762,6 +3081,10 @@ static int postcopy_start(MigrationState *ms)
     int64_t bandwidth = migrate_max_postcopy_bandwidth();
     bool restart_block = false;
     int cur_state = MIGRATION_STATUS_ACTIVE;
+
+    /* Requested pages go out on the preempt channel if it connected */
+    postcopy_preempt_wait_channel(ms);
+
     if (!migrate_pause_before_switchover()) {
         migrate_set_state(&ms->state, MIGRATION_STATUS_ACTIVE,
                           MIGRATION_STATUS_POSTCOPY_ACTIVE);
@@ -3150,6 +3473,9 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_file_shutdown(file);
         qemu_fclose(file);
 
+        /* A resumed migration sends everything on the main stream */
+        postcopy_preempt_shutdown_src(s);
+
         error_report("Detected IO failure for postcopy. "
                      "Migration paused.");
 
@@ -3260,6 +3586,7 @@ static void migration_calculate_complete(MigrationState *s)
     if (transfer_time) {
         s->mbps = ((double) bytes * 8.0) / transfer_time / 1000;
     }
+    s->write_wait_time = qemu_file_get_write_time(s->to_dst_file) / SCALE_US;
 }
 
 static void update_iteration_initial_status(MigrationState *s)
@@ -3297,6 +3624,7 @@ static void migration_update_counters(MigrationState *s,
                             s->iteration_initial_pages;
     s->pages_per_second = (double) transferred_pages /
                              (((double) time_spent / 1000.0));
+    s->write_wait_time = qemu_file_get_write_time(s->to_dst_file) / SCALE_US;
 
     /*
      * if we haven't sent anything, we don't want to
@@ -3455,6 +3783,21 @@ bool migration_rate_limit(void)
  * Master migration thread on the source VM.
  * It drives the migration and pumps the data down the outgoing channel.
  */
+/*
+ * Apply the x-thread-* properties to the calling migration or multifd
+ * thread.  They were checked at startup, so failing to apply them,
+ * e.g. for lack of privileges, does not fail the migration.
+ */
+void migration_thread_sched_apply(void)
+{
+    Error *local_err = NULL;
+
+    if (!thread_sched_apply(&migrate_get_current()->thread_sched,
+                            &local_err)) {
+        warn_report_err(local_err);
+    }
+}
+
 static void *migration_thread(void *opaque)
 {
     MigrationState *s = opaque;
@@ -3462,6 +3805,7 @@ static void *migration_thread(void *opaque)
     MigThrError thr_error;
     bool urgent = false;
 
+    migration_thread_sched_apply();
     rcu_register_thread();
 
     object_ref(OBJECT(s));
@@ -3547,12 +3891,175 @@ static void *migration_thread(void *opaque)
     }
 
     trace_migration_thread_after_loop();
+    /* Make sure no connection attempt outlives the migration */
+    postcopy_preempt_wait_channel(s);
     migration_iteration_finish(s);
     object_unref(OBJECT(s));
     rcu_unregister_thread();
     return NULL;
 }
 
+/*
+ * Completion of a background snapshot: all of RAM is saved, so follow
+ * it with the device state that was saved when the snapshot started.
+ */
+static void bg_migration_completion(MigrationState *s, QIOChannelBuffer *bioc)
+{
+    int current_active_state = s->state;
+
+    ram_write_tracking_stop();
+
+    if (s->state == MIGRATION_STATUS_ACTIVE) {
+        qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+        qemu_fflush(s->to_dst_file);
+    }
+
+    if (s->state != MIGRATION_STATUS_ACTIVE ||
+        qemu_file_get_error(s->to_dst_file)) {
+        trace_migration_completion_file_err();
+        migrate_set_state(&s->state, current_active_state,
+                          MIGRATION_STATUS_FAILED);
+        return;
+    }
+
+    migrate_set_state(&s->state, current_active_state,
+                      MIGRATION_STATUS_COMPLETED);
+}
+
+static void bg_migration_iteration_finish(MigrationState *s)
+{
+    qemu_mutex_lock_iothread();
+    switch (s->state) {
+    case MIGRATION_STATUS_COMPLETED:
+        migration_calculate_complete(s);
+        break;
+
+    case MIGRATION_STATUS_ACTIVE:
+    case MIGRATION_STATUS_FAILED:
+    case MIGRATION_STATUS_CANCELLED:
+    case MIGRATION_STATUS_CANCELLING:
+        break;
+
+    default:
+        error_report("%s: Unknown ending state %d", __func__, s->state);
+        break;
+    }
+
+    migrate_fd_cleanup_schedule(s);
+    qemu_mutex_unlock_iothread();
+}
+
+/*
+ * The VM is restarted from a bottom half: the notifiers that vm_start()
+ * calls can write to guest RAM, and the write faults are only resolved
+ * while the migration thread is running.
+ */
+static void bg_migration_vm_start_bh(void *opaque)
+{
+    MigrationState *s = opaque;
+
+    if (s->vm_was_running) {
+        vm_start();
+    }
+    s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->downtime_start;
+}
+
+/*
+ * Migration thread for background-snapshot.  The device state is saved
+ * to a buffer with the VM stopped, then RAM is write-protected and the
+ * VM restarted; the RAM pages go to the stream while the VM runs, the
+ * ones that the guest tries to write first, and the buffered device
+ * state follows them.
+ */
+static void *bg_migration_thread(void *opaque)
+{
+    MigrationState *s = opaque;
+    int64_t setup_start = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+    bool early_fail = true;
+
+    rcu_register_thread();
+    object_ref(OBJECT(s));
+
+    qemu_file_set_rate_limit(s->to_dst_file, INT64_MAX);
+
+    bioc = qio_channel_buffer_new(512 * 1024);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "vmstate-buffer");
+    fb = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+
+    update_iteration_initial_status(s);
+
+    qemu_savevm_state_header(s->to_dst_file);
+    qemu_savevm_state_setup(s->to_dst_file);
+    ram_write_tracking_prepare();
+
+    migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+    s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
+
+    trace_migration_thread_setup_complete();
+    s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    qemu_mutex_lock_iothread();
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER, NULL);
+    s->vm_was_running = runstate_is_running();
+
+    if (global_state_store() || vm_stop_force_state(RUN_STATE_PAUSED)) {
+        goto fail;
+    }
+    cpu_synchronize_all_states();
+    if (qemu_savevm_state_complete_precopy_non_iterable(fb, false, false)) {
+        goto fail;
+    }
+    /* bioc->data is read directly, so flush fb first */
+    qemu_fflush(fb);
+
+    if (ram_write_tracking_start()) {
+        goto fail;
+    }
+    early_fail = false;
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            bg_migration_vm_start_bh, s);
+    qemu_mutex_unlock_iothread();
+
+    while (migration_is_active(s)) {
+        int res = qemu_savevm_state_iterate(s->to_dst_file, false);
+
+        if (res > 0) {
+            bg_migration_completion(s, bioc);
+            break;
+        }
+        if (migration_detect_error(s) == MIG_THR_ERR_FATAL) {
+            break;
+        }
+        migration_update_counters(s, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    }
+
+    trace_migration_thread_after_loop();
+
+fail:
+    if (early_fail) {
+        migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                          MIGRATION_STATUS_FAILED);
+        if (s->vm_was_running && !runstate_is_running()) {
+            vm_start();
+        }
+        qemu_mutex_unlock_iothread();
+    }
+    /* No vCPU may stay blocked on a write fault once we are gone */
+    ram_write_tracking_stop();
+
+    bg_migration_iteration_finish(s);
+
+    qemu_fclose(fb);
+    object_unref(OBJECT(bioc));
+    object_unref(OBJECT(s));
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
     Error *local_err = NULL;
@@ -3616,8 +4123,14 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         migrate_fd_cleanup(s);
         return;
     }
-    qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
-                       QEMU_THREAD_JOINABLE);
+    postcopy_preempt_setup(s);
+    if (migrate_background_snapshot()) {
+        qemu_thread_create(&s->thread, "bg_snapshot",
+                           bg_migration_thread, s, QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
     s->migration_thread_running = true;
 }
 
@@ -3654,6 +4167,20 @@ static Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-dirty-sync-threads", MigrationState,
+                      dirty_sync_threads, 1),
+    DEFINE_PROP_UINT8("x-load-threads", MigrationState,
+                      load_threads, 1),
+    DEFINE_PROP_UINT8("x-vmstate-save-threads", MigrationState,
+                      vmstate_save_threads, 1),
+    DEFINE_PROP_STRING("x-thread-cpu-affinity", MigrationState,
+                       thread_sched.cpus),
+    DEFINE_PROP_INT32("x-thread-numa-node", MigrationState,
+                      thread_sched.numa_node, -1),
+    DEFINE_PROP_STRING("x-thread-sched-policy", MigrationState,
+                       thread_sched.policy),
+    DEFINE_PROP_INT32("x-thread-sched-priority", MigrationState,
+                      thread_sched.priority, 0),
 
     /* Migration parameters */
     DEFINE_PROP_UINT8("x-compress-level", MigrationState,
@@ -3728,11 +4255,28 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-compress", MIGRATION_CAPABILITY_COMPRESS),
     DEFINE_PROP_MIG_CAP("x-events", MIGRATION_CAPABILITY_EVENTS),
     DEFINE_PROP_MIG_CAP("x-postcopy-ram", MIGRATION_CAPABILITY_POSTCOPY_RAM),
+    DEFINE_PROP_MIG_CAP("x-postcopy-preempt",
+                        MIGRATION_CAPABILITY_POSTCOPY_PREEMPT),
     DEFINE_PROP_MIG_CAP("x-colo", MIGRATION_CAPABILITY_X_COLO),
     DEFINE_PROP_MIG_CAP("x-release-ram", MIGRATION_CAPABILITY_RELEASE_RAM),
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-page",
+                        MIGRATION_CAPABILITY_MULTIFD_ZERO_PAGE),
+    DEFINE_PROP_MIG_CAP("x-multifd-zero-copy",
+                        MIGRATION_CAPABILITY_MULTIFD_ZERO_COPY),
+    DEFINE_PROP_MIG_CAP("x-multifd-postcopy",
+                        MIGRATION_CAPABILITY_MULTIFD_POSTCOPY),
+    DEFINE_PROP_MIG_CAP("x-multifd-compression-adaptive",
+                        MIGRATION_CAPABILITY_MULTIFD_COMPRESSION_ADAPTIVE),
+    DEFINE_PROP_MIG_CAP("x-per-vcpu-throttle",
+                        MIGRATION_CAPABILITY_PER_VCPU_THROTTLE),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-background-snapshot",
+                        MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-dirty-bitmaps-extents",
+                        MIGRATION_CAPABILITY_DIRTY_BITMAPS_EXTENTS),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -3759,6 +4303,7 @@ static void migration_instance_finalize(Object *obj)
     qemu_sem_destroy(&ms->pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_sem);
     qemu_sem_destroy(&ms->postcopy_pause_rp_sem);
+    qemu_sem_destroy(&ms->postcopy_qemufile_src_sem);
     qemu_sem_destroy(&ms->rp_state.rp_sem);
     error_free(ms->error);
 }
@@ -3803,6 +4348,7 @@ static void migration_instance_init(Object *obj)
 
     qemu_sem_init(&ms->postcopy_pause_sem, 0);
     qemu_sem_init(&ms->postcopy_pause_rp_sem, 0);
+    qemu_sem_init(&ms->postcopy_qemufile_src_sem, 0);
     qemu_sem_init(&ms->rp_state.rp_sem, 0);
     qemu_sem_init(&ms->rate_limit_sem, 0);
     qemu_sem_init(&ms->wait_unplug_sem, 0);
@@ -3824,6 +4370,11 @@ static bool migration_object_check(MigrationState *ms, Error **errp)
         return false;
     }
 
+    if (!thread_sched_check(&ms->thread_sched, errp)) {
+        error_prepend(errp, "migration thread placement: ");
+        return false;
+    }
+
     for (i = 0; i < MIGRATION_CAPABILITY__MAX; i++) {
         if (ms->enabled_capabilities[i]) {
             head = migrate_cap_add(head, i, true);
@@ -18,6 +18,7 @@
 #include "hw/qdev-core.h"
 #include "qapi/qapi-types-migration.h"
 #include "qemu/thread.h"
+#include "qemu/thread-sched.h"
 #include "qemu/coroutine_int.h"
 #include "io/channel.h"
 #include "net/announce.h"
@@ -44,6 +45,13 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/* The channels that RAM pages are received on during postcopy */
+enum {
+    RAM_CHANNEL_PRECOPY = 0,  /* the main migration stream */
+    RAM_CHANNEL_POSTCOPY,     /* the postcopy-preempt channel */
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -76,8 +84,16 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
-    void     *postcopy_tmp_page;
+    /* Temporary pages that host pages are assembled in, per channel */
+    void     *postcopy_tmp_pages[RAM_CHANNEL_MAX];
     void     *postcopy_tmp_zero_page;
+    /* RAMBlock of the last page received, per channel */
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
+
+    /* The postcopy-preempt channel and the thread that reads it */
+    QEMUFile      *postcopy_qemufile_dst;
+    bool           have_preempt_thread;
+    QemuThread     preempt_thread;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
 
@@ -140,6 +156,17 @@ struct MigrationState
      */
     QemuMutex qemu_file_lock;
 
+    /*
+     * The postcopy-preempt channel that pages requested by the
+     * destination are sent on; also protected by qemu_file_lock.
+     * postcopy_qemufile_src_sem is posted once the connection attempt
+     * has finished, whether it succeeded or not.
+     */
+    QEMUFile *postcopy_qemufile_src;
+    QemuSemaphore postcopy_qemufile_src_sem;
+    /* Set while postcopy_qemufile_src_sem is still to be waited for */
+    bool postcopy_preempt_connecting;
+
     /*
      * Used to allow urgent requests to override rate limiting.
      */
@@ -150,6 +177,8 @@ struct MigrationState
 
     /* pages transferred per second */
     double pages_per_second;
+    /* time (us) the migration thread blocked writing to to_dst_file */
+    uint64_t write_wait_time;
 
     /* bytes already send at the beginning of current iteration */
     uint64_t iteration_initial_bytes;
@@ -260,6 +289,34 @@ struct MigrationState
      */
     uint8_t clear_bitmap_shift;
 
+    /*
+     * Number of threads, the migration thread included, that share
+     * the sync of the dirty bitmap.  With 1, the migration thread syncs
+     * it alone.
+     */
+    uint8_t dirty_sync_threads;
+
+    /*
+     * Number of threads, the load thread included, that write incoming
+     * normal, zero and XBZRLE pages into guest memory, and that flush
+     * the RAM cache of a COLO secondary.  With 1, the load thread
+     * writes them alone.
+     */
+    uint8_t load_threads;
+
+    /*
+     * Number of threads, the migration thread included, that save the
+     * state of the devices that set parallel_save.  With 1, the
+     * migration thread saves them alone.
+     */
+    uint8_t vmstate_save_threads;
+
+    /*
+     * CPU affinity and scheduling policy of the migration thread and of
+     * the multifd threads, on both sides.
+     */
+    ThreadSchedParams thread_sched;
+
     /*
      * This save hostname when out-going migration starts
      */
@@ -294,13 +351,22 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
+bool migrate_dirty_bitmaps_extents(void);
 bool migrate_ignore_shared(void);
 bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
+bool migrate_use_per_vcpu_throttle(void);
+bool migrate_use_mapped_ram(void);
+bool migrate_background_snapshot(void);
 bool migrate_use_multifd(void);
+bool migrate_use_multifd_zero_page(void);
+bool migrate_use_multifd_zero_copy(void);
+bool migrate_use_multifd_postcopy(void);
+bool migrate_use_multifd_compression_adaptive(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
@@ -325,6 +391,7 @@ int migrate_compress_wait_thread(void);
 int migrate_decompress_threads(void);
 bool migrate_use_events(void);
 bool migrate_postcopy_blocktime(void);
+void migration_thread_sched_apply(void);
 
 /* Sending on the return path - generic and then for each message type */
 void migrate_send_rp_shut(MigrationIncomingState *mis,
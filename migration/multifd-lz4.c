@@ -0,0 +1,284 @@
+/*
+ * Multifd lz4 compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <lz4.h>
+#include "qemu/rcu.h"
+#include "qemu/bswap.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Every page is compressed on its own, the packet data is an array of
+ * @used big endian 32 bit compressed lengths followed by the compressed
+ * pages.  A length equal to the page size means that the page did not
+ * compress and is sent as is.
+ *
+ * LZ4 streaming mode is not used because it references the previous
+ * input instead of copying it, and guest pages can change under our
+ * feet while we are compressing.
+ */
+
+struct lz4_data {
+    /* compression state for LZ4_compress_fast_extState() */
+    void *state;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+/* Multifd lz4 compression */
+
+/**
+ * lz4_buff_len: size of the compressed buffer
+ *
+ * Room for the length table and for every page of a packet sent
+ * uncompressed.
+ */
+static uint32_t lz4_buff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return page_count * (sizeof(uint32_t) + qemu_target_page_size());
+}
+
+/**
+ * lz4_send_setup: setup send side
+ *
+ * Setup each channel with lz4 compression.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->state = g_try_malloc(LZ4_sizeofState());
+    z->zbuff_len = lz4_buff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->state || !z->zbuff) {
+        g_free(z->state);
+        g_free(z->zbuff);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_send_cleanup: cleanup send side
+ *
+ * Return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->state);
+    z->state = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_send_prepare: prepare date to be able to send
+ *
+ * Create a compressed buffer with all the pages that we are going to
+ * send.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int lz4_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct lz4_data *z = p->data;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t *lens = (uint32_t *)z->zbuff;
+    uint8_t *out = z->zbuff + used * sizeof(uint32_t);
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        /* Anything that doesn't save at least one byte is sent as is */
+        int ret = LZ4_compress_fast_extState(z->state, iov[i].iov_base,
+                                             (char *)out, page_size,
+                                             page_size - 1, 1);
+
+        if (ret <= 0) {
+            memcpy(out, iov[i].iov_base, page_size);
+            ret = page_size;
+        }
+        lens[i] = cpu_to_be32(ret);
+        out += ret;
+    }
+    p->next_packet_size = out - z->zbuff;
+    p->flags |= MULTIFD_FLAG_LZ4;
+
+    return 0;
+}
+
+/**
+ * lz4_send_write: do the actual write of the data
+ *
+ * Do the actual write of the comprresed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct lz4_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * lz4_recv_setup: setup receive side
+ *
+ * Create the compressed buffer.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int lz4_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct lz4_data *z = g_new0(struct lz4_data, 1);
+
+    z->zbuff_len = lz4_buff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * lz4_recv_cleanup: setup receive side
+ *
+ * Return memory.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void lz4_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct lz4_data *z = p->data;
+
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * lz4_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the compressed buffer, and uncompress it into the actual
+ * pages.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int lz4_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct lz4_data *z = p->data;
+    uint32_t *lens = (uint32_t *)z->zbuff;
+    uint32_t pos = used * sizeof(uint32_t);
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_LZ4) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_LZ4);
+        return -1;
+    }
+    if (in_size < pos || in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %d is invalid",
+                   p->id, in_size);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len = be32_to_cpu(lens[i]);
+
+        if (len == 0 || len > page_size || len > in_size - pos) {
+            error_setg(errp, "multifd %d: page %d has invalid size %d",
+                       p->id, i, len);
+            return -1;
+        }
+        if (len == page_size) {
+            memcpy(iov->iov_base, z->zbuff + pos, page_size);
+        } else {
+            ret = LZ4_decompress_safe((char *)z->zbuff + pos, iov->iov_base,
+                                      len, iov->iov_len);
+            if (ret != page_size) {
+                error_setg(errp, "multifd %d: decompress page %d returned %d",
+                           p->id, i, ret);
+                return -1;
+            }
+        }
+        pos += len;
+    }
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: packet size received %d size expected %d",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_lz4_ops = {
+    .send_setup = lz4_send_setup,
+    .send_cleanup = lz4_send_cleanup,
+    .send_prepare = lz4_send_prepare,
+    .send_write = lz4_send_write,
+    .recv_setup = lz4_recv_setup,
+    .recv_cleanup = lz4_recv_cleanup,
+    .recv_pages = lz4_recv_pages
+};
+
+static void multifd_lz4_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_LZ4, &multifd_lz4_ops);
+}
+
+migration_init(multifd_lz4_register);
@@ -0,0 +1,263 @@
+/*
+ * Multifd XBZRLE implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "qemu/bswap.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "ram.h"
+#include "xbzrle.h"
+#include "trace.h"
+#include "multifd.h"
+
+/*
+ * Used instead of the nocomp methods when the xbzrle capability is
+ * set.  The packet data is an array of @used big endian 32 bit lengths
+ * followed by the pages: a length of 0 means the page is unchanged and
+ * has no data, the page size means the page is sent as is, anything
+ * else is the size of its XBZRLE encoding against the contents that
+ * the destination already has.
+ */
+
+struct xbzrle_data {
+    /* copy of the page being encoded */
+    uint8_t *current_buf;
+    /* lengths and pages of the packet */
+    uint8_t *zbuff;
+    /* size of zbuff */
+    uint32_t zbuff_len;
+};
+
+/**
+ * xbzrle_buff_len: size of the packet buffer
+ *
+ * Room for the length table and for every page of a packet sent as is.
+ */
+static uint32_t xbzrle_buff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return page_count * (sizeof(uint32_t) + qemu_target_page_size());
+}
+
+static struct xbzrle_data *xbzrle_data_new(MultiFDSendParams *s,
+                                           MultiFDRecvParams *r,
+                                           Error **errp)
+{
+    struct xbzrle_data *z = g_new0(struct xbzrle_data, 1);
+
+    z->current_buf = g_try_malloc(qemu_target_page_size());
+    z->zbuff_len = xbzrle_buff_len();
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->current_buf || !z->zbuff) {
+        g_free(z->current_buf);
+        g_free(z->zbuff);
+        g_free(z);
+        error_setg(errp, "multifd %d: out of memory for zbuff",
+                   s ? s->id : r->id);
+        return NULL;
+    }
+    return z;
+}
+
+static void xbzrle_data_free(struct xbzrle_data *z)
+{
+    g_free(z->current_buf);
+    g_free(z->zbuff);
+    g_free(z);
+}
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    p->data = xbzrle_data_new(p, NULL, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    xbzrle_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode every page against the XBZRLE cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct xbzrle_data *z = p->data;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t *lens = (uint32_t *)z->zbuff;
+    uint8_t *out = z->zbuff + used * sizeof(uint32_t);
+    uint32_t i;
+
+    for (i = 0; i < used; i++) {
+        /* Keep encodings shorter than a page so they can be told apart */
+        int ret = xbzrle_multifd_encode_page(pages->block, pages->offset[i],
+                                             z->current_buf, out,
+                                             page_size - 1);
+
+        if (ret < 0) {
+            memcpy(out, z->current_buf, page_size);
+            ret = page_size;
+        }
+        lens[i] = cpu_to_be32(ret);
+        out += ret;
+    }
+    p->next_packet_size = out - z->zbuff;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_write: do the actual write of the data
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    p->data = xbzrle_data_new(NULL, p, errp);
+    return p->data ? 0 : -1;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    xbzrle_data_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Decode the XBZRLE pages on top of the current guest memory.
+ * Sources that don't use XBZRLE with multifd send plain pages, they
+ * are read as is.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @used: number of pages used
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = qemu_target_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct xbzrle_data *z = p->data;
+    uint32_t *lens = (uint32_t *)z->zbuff;
+    uint32_t pos = used * sizeof(uint32_t);
+    int ret;
+    int i;
+
+    if (flags == MULTIFD_FLAG_NOCOMP) {
+        return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
+    }
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %d: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size < pos || in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size received %d is invalid",
+                   p->id, in_size);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        uint32_t len = be32_to_cpu(lens[i]);
+
+        if (len > page_size || len > in_size - pos) {
+            error_setg(errp, "multifd %d: page %d has invalid size %d",
+                       p->id, i, len);
+            return -1;
+        }
+        if (len == page_size) {
+            memcpy(iov->iov_base, z->zbuff + pos, page_size);
+        } else if (len &&
+                   xbzrle_decode_buffer(z->zbuff + pos, len, iov->iov_base,
+                                        page_size) == -1) {
+            error_setg(errp, "multifd %d: failed to decode page %d",
+                       p->id, i);
+            return -1;
+        }
+        pos += len;
+    }
+    if (pos != in_size) {
+        error_setg(errp, "multifd %d: packet size received %d size expected %d",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+}
+
+MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .send_write = xbzrle_send_write,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
@@ -31,6 +31,8 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* compression level of the current frame */
+    int level;
 };
 
 /* Multifd zstd compression */
@@ -59,7 +61,10 @@ static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
         return -1;
     }
 
-    res = ZSTD_initCStream(z->zcs, migrate_multifd_zstd_level());
+    z->level = migrate_multifd_zstd_level();
+    p->compress_level = z->level;
+    p->compress_level_max = z->level;
+    res = ZSTD_initCStream(z->zcs, z->level);
     if (ZSTD_isError(res)) {
         ZSTD_freeCStream(z->zcs);
         g_free(z);
@@ -114,6 +119,8 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
     struct iovec *iov = p->pages->iov;
     struct zstd_data *z = p->data;
+    /* The level can only change at the start of a frame */
+    bool level_change = p->compress_level != z->level;
     int ret;
     uint32_t i;
 
@@ -125,7 +132,7 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
         if (i == used - 1) {
-            flush = ZSTD_e_flush;
+            flush = level_change ? ZSTD_e_end : ZSTD_e_flush;
         }
         z->in.src = iov[i].iov_base;
         z->in.size = iov[i].iov_len;
@@ -136,14 +143,16 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
          *
          * We need to loop while:
          * - return is > 0
-         * - there is input available
+         * - there is input available, or the frame is being ended
          * - there is output space free
          */
         do {
             ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, flush);
-        } while (ret > 0 && (z->in.size - z->in.pos > 0)
+        } while (ret > 0 && (z->in.size - z->in.pos > 0 ||
+                             flush == ZSTD_e_end)
                          && (z->out.size - z->out.pos > 0));
-        if (ret > 0 && (z->in.size - z->in.pos > 0)) {
+        if (ret > 0 && (z->in.size - z->in.pos > 0 ||
+                        flush == ZSTD_e_end)) {
             error_setg(errp, "multifd %d: compressStream buffer too small",
                        p->id);
             return -1;
@@ -154,6 +163,16 @@ static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used, Error **errp)
             return -1;
         }
     }
+    if (level_change) {
+        ret = ZSTD_CCtx_setParameter(z->zcs, ZSTD_c_compressionLevel,
+                                     p->compress_level);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: setting level %d failed with %s",
+                       p->id, p->compress_level, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        z->level = p->compress_level;
+    }
     p->next_packet_size = z->out.pos;
     p->flags |= MULTIFD_FLAG_ZSTD;
 
@@ -12,6 +12,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -20,10 +22,13 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "rdma.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "multifd.h"
+#include "io/channel-socket.h"
+#include "postcopy-ram.h"
 
 /* Multiple fd's */
 
@@ -101,6 +106,16 @@ static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
  */
 static int nocomp_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
 {
+    if (p->zero_copy) {
+        QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(p->c);
+        int ret;
+
+        ret = qio_channel_socket_writev_all_zero_copy(sioc, p->pages->iov,
+                                                      used, errp);
+        /* Keep the error queue short, this does not block */
+        qio_channel_socket_zero_copy_reap(sioc);
+        return ret;
+    }
     return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
 }
 
@@ -173,6 +188,17 @@ void multifd_register_ops(int method, MultiFDMethods *ops)
     multifd_ops[method] = ops;
 }
 
+static MultiFDMethods *multifd_get_ops(void)
+{
+    MultiFDCompression method = migrate_multifd_compression();
+
+    /* XBZRLE replaces sending the pages as is */
+    if (method == MULTIFD_COMPRESSION_NONE && migrate_use_xbzrle()) {
+        return &multifd_xbzrle_ops;
+    }
+    return multifd_ops[method];
+}
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg = {};
@@ -249,6 +275,7 @@ static MultiFDPages_t *multifd_pages_init(size_t size)
 static void multifd_pages_clear(MultiFDPages_t *pages)
 {
     pages->used = 0;
+    pages->zero = 0;
     pages->allocated = 0;
     pages->packet_num = 0;
     pages->block = NULL;
@@ -267,6 +294,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->pages_used = cpu_to_be32(p->pages->used);
+    packet->zero_pages = cpu_to_be32(p->pages->zero);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -274,7 +302,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
         strncpy(packet->ramblock, p->pages->block->idstr, 256);
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         /* there are architectures where ram_addr_t is 32 bit */
         uint64_t temp = p->pages->offset[i];
 
@@ -328,17 +356,20 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
     }
 
     p->pages->used = be32_to_cpu(packet->pages_used);
-    if (p->pages->used > packet->pages_alloc) {
+    p->pages->zero = be32_to_cpu(packet->zero_pages);
+    if (p->pages->used > packet->pages_alloc ||
+        p->pages->zero > packet->pages_alloc - p->pages->used) {
         error_setg(errp, "multifd: received packet "
-                   "with %d pages and expected maximum pages are %d",
-                   p->pages->used, packet->pages_alloc) ;
+                   "with %d pages and %d zero pages and expected maximum "
+                   "pages are %d",
+                   p->pages->used, p->pages->zero, packet->pages_alloc) ;
         return -1;
     }
 
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used == 0) {
+    if (p->pages->used + p->pages->zero == 0) {
         return 0;
     }
 
@@ -351,7 +382,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
-    for (i = 0; i < p->pages->used; i++) {
+    for (i = 0; i < p->pages->used + p->pages->zero; i++) {
         uint64_t offset = be64_to_cpu(packet->offset[i]);
 
         if (offset > (block->used_length - qemu_target_page_size())) {
@@ -363,6 +394,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->pages->iov[i].iov_base = block->host + offset;
         p->pages->iov[i].iov_len = qemu_target_page_size();
     }
+    p->pages->block = block;
 
     return 0;
 }
@@ -385,6 +417,27 @@ struct {
     MultiFDMethods *ops;
 } *multifd_send_state;
 
+/*
+ * Statistics of the send channels.  They are kept after
+ * multifd_save_cleanup() so that they can still be queried once the
+ * migration has finished, and are freed by the next multifd_save_setup().
+ */
+typedef struct {
+    /* bytes and packets written to the channel */
+    Stat64 bytes;
+    Stat64 packets;
+    /* size of the page data before and after compression */
+    Stat64 raw_bytes;
+    Stat64 wire_bytes;
+    /* time spent blocked in writes */
+    Stat64 stall_ns;
+} MultiFDChannelCounters;
+
+static struct {
+    MultiFDChannelCounters *chan;
+    int count;
+} multifd_channel_counters;
+
 /*
  * How we use multifd_send_state->pages and channel->pages?
  *
@@ -403,6 +456,67 @@ struct {
  * false.
  */
 
+/*
+ * The main thread accounts all queued pages as normal pages.  Fix this up
+ * for the zero pages that @p found since and did not send.  Called with
+ * p->mutex held.
+ */
+static void multifd_account_zero_pages(QEMUFile *f, MultiFDSendParams *p)
+{
+    uint64_t bytes = p->zero_pages_pending * qemu_target_page_size();
+
+    if (!p->zero_pages_pending) {
+        return;
+    }
+
+    ram_counters.duplicate += p->zero_pages_pending;
+    ram_counters.normal -= p->zero_pages_pending;
+    ram_counters.multifd_bytes -= bytes;
+    ram_counters.transferred -= bytes;
+    qemu_file_update_transfer(f, -bytes);
+    p->zero_pages_pending = 0;
+}
+
+/*
+ * Move the zero pages of p->pages to its end so that only the first
+ * p->pages->used pages have their data sent.  Called with p->mutex held.
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    size_t page_size = qemu_target_page_size();
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint32_t i, normal = 0;
+
+    for (i = 0; i < pages->used; i++) {
+        if (buffer_is_zero(pages->iov[i].iov_base, page_size)) {
+            continue;
+        }
+        if (i != normal) {
+            ram_addr_t offset = pages->offset[normal];
+            struct iovec iov = pages->iov[normal];
+
+            pages->offset[normal] = pages->offset[i];
+            pages->iov[normal] = pages->iov[i];
+            pages->offset[i] = offset;
+            pages->iov[i] = iov;
+        }
+        normal++;
+    }
+
+    pages->zero = pages->used - normal;
+    pages->used = normal;
+    p->zero_pages_pending += pages->zero;
+    stat64_add(&phase_counters.zero_page_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+
+    /* Don't let XBZRLE encode against what these pages contained before */
+    if (pages->zero && multifd_send_state->ops == &multifd_xbzrle_ops) {
+        xbzrle_multifd_cache_zero_pages(pages->block, pages->offset + normal,
+                                        pages->zero);
+    }
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -410,12 +524,16 @@ static int multifd_send_pages(QEMUFile *f)
     MultiFDSendParams *p = NULL; /* make happy gcc */
     MultiFDPages_t *pages = multifd_send_state->pages;
     uint64_t transferred;
+    int64_t start;
 
     if (qatomic_read(&multifd_send_state->exiting)) {
         return -1;
     }
 
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     qemu_sem_wait(&multifd_send_state->channels_ready);
+    stat64_add(&phase_counters.multifd_wait_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
     /*
      * next_channel can remain from a previous migration that was
      * using more channels, so ensure it doesn't overflow if the
@@ -441,6 +559,10 @@ static int multifd_send_pages(QEMUFile *f)
     assert(!p->pages->used);
     assert(!p->pages->block);
 
+    multifd_account_zero_pages(f, p);
+    if (migration_in_postcopy()) {
+        p->flags |= MULTIFD_FLAG_POSTCOPY;
+    }
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
@@ -485,6 +607,20 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
     return 1;
 }
 
+/*
+ * Whether a page may be sent through multifd during postcopy.  Pages the
+ * destination asked for go out on the main stream right away instead of
+ * waiting for a packet to fill up.  Other pages only if each target page
+ * is a host page of its own: the destination places whole host pages,
+ * and a packet may end in the middle of a larger one.
+ */
+bool multifd_postcopy_page_ok(RAMBlock *block, bool requested)
+{
+    return migrate_use_multifd_postcopy() && !requested &&
+           multifd_send_state->ops == &multifd_nocomp_ops &&
+           block->page_size == qemu_target_page_size();
+}
+
 static void multifd_send_terminate_threads(Error *err)
 {
     int i;
@@ -571,6 +707,36 @@ void multifd_save_cleanup(void)
     multifd_send_state = NULL;
 }
 
+/**
+ * multifd_send_channel_stats: statistics of the send channels
+ *
+ * Returns a list with one element per channel of the last outgoing
+ * migration that used multifd, NULL if there was none.
+ */
+MultiFDChannelStatsList *multifd_send_channel_stats(void)
+{
+    MultiFDChannelStatsList *list = NULL, *entry;
+    int i;
+
+    for (i = multifd_channel_counters.count - 1; i >= 0; i--) {
+        MultiFDChannelCounters *c = &multifd_channel_counters.chan[i];
+        uint64_t wire = stat64_get(&c->wire_bytes);
+
+        entry = g_new0(MultiFDChannelStatsList, 1);
+        entry->value = g_new0(MultiFDChannelStats, 1);
+        entry->value->id = i;
+        entry->value->bytes = stat64_get(&c->bytes);
+        entry->value->packets = stat64_get(&c->packets);
+        entry->value->stall_time = stat64_get(&c->stall_ns) / SCALE_US;
+        entry->value->compression_ratio =
+            wire ? (double)stat64_get(&c->raw_bytes) / wire : 1;
+        entry->next = list;
+        list = entry;
+    }
+
+    return list;
+}
+
 void multifd_send_sync_main(QEMUFile *f)
 {
     int i;
@@ -611,18 +777,110 @@ void multifd_send_sync_main(QEMUFile *f)
 
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_account_zero_pages(f, p);
+        qemu_mutex_unlock(&p->mutex);
     }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/* Compress one packet out of this many while compression is not used */
+#define MULTIFD_ADAPTIVE_PROBE 16
+
+/* Weight of the last sample in the moving averages of MultiFDAdaptive */
+#define MULTIFD_ADAPTIVE_WEIGHT 0.125
+
+static void multifd_adaptive_sample(double *avg, double sample)
+{
+    if (*avg == 0) {
+        *avg = sample;
+    } else {
+        *avg += (sample - *avg) * MULTIFD_ADAPTIVE_WEIGHT;
+    }
+}
+
+/**
+ * multifd_adaptive_compress: decide how to send the next packet
+ *
+ * Compressing a byte is worth it while it costs less time than writing
+ * the bytes that compression saves.  While that is true by a large
+ * margin, raise the compression level; when it is close to false lower
+ * it, and once the lowest level doesn't pay off send the packets
+ * uncompressed, trying compression again every MULTIFD_ADAPTIVE_PROBE
+ * packets to see if the data or the link have changed.
+ *
+ * Returns true if the packet is to be compressed.
+ *
+ * @p: Params for the channel that we are using
+ */
+static bool multifd_adaptive_compress(MultiFDSendParams *p)
+{
+    MultiFDAdaptive *a = &p->adaptive;
+    double headroom;
+    int level = p->compress_level;
+
+    if (!a->compress_ns || !a->write_ns) {
+        /* Nothing measured yet */
+        return true;
+    }
+
+    headroom = (1 - a->ratio) * a->write_ns / a->compress_ns;
+    if (p->compress_level_max > 1) {
+        if (headroom > 2 && level < p->compress_level_max) {
+            level++;
+        } else if (headroom < 1.25 && level > 1) {
+            level--;
+        }
+    }
+    if (level != p->compress_level) {
+        p->compress_level = level;
+        trace_multifd_adaptive_level(p->id, level);
+    }
+    if (headroom > 1 || level > 1) {
+        if (a->skipped) {
+            trace_multifd_adaptive_compress(p->id, true);
+        }
+        a->skipped = 0;
+        return true;
+    }
+    if (!a->skipped) {
+        trace_multifd_adaptive_compress(p->id, false);
+    }
+    if (++a->skipped % MULTIFD_ADAPTIVE_PROBE == 0) {
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Account a packet of @used pages whose write started at @start, in
+ * nanoseconds, to the statistics of its channel.
+ */
+static void multifd_send_account(MultiFDSendParams *p, uint32_t used,
+                                 int64_t start)
+{
+    MultiFDChannelCounters *c = &multifd_channel_counters.chan[p->id];
+    uint32_t data = used ? p->next_packet_size : 0;
+
+    stat64_add(&c->bytes, p->packet_len + data);
+    stat64_add(&c->packets, 1);
+    stat64_add(&c->raw_bytes, (uint64_t)used * qemu_target_page_size());
+    stat64_add(&c->wire_bytes, data);
+    stat64_add(&c->stall_ns, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
     Error *local_err = NULL;
     int ret = 0;
     uint32_t flags = 0;
+    bool adaptive = migrate_use_multifd_compression_adaptive() &&
+                    migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE;
 
     trace_multifd_send_thread_start(p->id);
+    migration_thread_sched_apply();
     rcu_register_thread();
 
     if (multifd_send_initial_packet(p, &local_err) < 0) {
@@ -641,29 +899,57 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
+            MultiFDMethods *ops = multifd_send_state->ops;
+            bool compress = false;
+            uint32_t used;
+            uint32_t zero;
             uint64_t packet_num = p->packet_num;
+            int64_t start, write_start;
+
+            if (p->pages->used && migrate_use_multifd_zero_page()) {
+                multifd_send_zero_page_detect(p);
+            }
+            used = p->pages->used;
+            zero = p->pages->zero;
+
+            if (used && adaptive) {
+                compress = multifd_adaptive_compress(p);
+                if (!compress) {
+                    ops = &multifd_nocomp_ops;
+                }
+            }
             flags = p->flags;
 
             if (used) {
-                ret = multifd_send_state->ops->send_prepare(p, used,
-                                                            &local_err);
+                start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+                ret = ops->send_prepare(p, used, &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
                 }
+                if (compress) {
+                    uint64_t len = (uint64_t)used * qemu_target_page_size();
+
+                    multifd_adaptive_sample(&p->adaptive.compress_ns,
+                        (double)(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 start) / len);
+                    multifd_adaptive_sample(&p->adaptive.ratio,
+                        (double)p->next_packet_size / len);
+                }
             }
             multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
-            p->num_pages += used;
+            p->num_pages += used + zero;
             p->pages->used = 0;
+            p->pages->zero = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags,
+            trace_multifd_send(p->id, packet_num, used, zero, flags,
                                p->next_packet_size);
 
+            write_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             ret = qio_channel_write_all(p->c, (void *)p->packet,
                                         p->packet_len, &local_err);
             if (ret != 0) {
@@ -671,7 +957,26 @@ static void *multifd_send_thread(void *opaque)
             }
 
             if (used) {
-                ret = multifd_send_state->ops->send_write(p, used, &local_err);
+                start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+                ret = ops->send_write(p, used, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                if (adaptive) {
+                    multifd_adaptive_sample(&p->adaptive.write_ns,
+                        (double)(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 start) / p->next_packet_size);
+                }
+            }
+            multifd_send_account(p, used, write_start);
+
+            /*
+             * The pages may be dirtied and queued again after the sync;
+             * make sure the kernel no longer reads their old contents.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) && p->zero_copy) {
+                ret = qio_channel_socket_zero_copy_flush(
+                    QIO_CHANNEL_SOCKET(p->c), &local_err);
                 if (ret != 0) {
                     break;
                 }
@@ -828,6 +1133,13 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
     } else {
         p->c = QIO_CHANNEL(sioc);
         qio_channel_set_delay(p->c, false);
+        if (migrate_use_multifd_zero_copy()) {
+            if (qio_channel_socket_set_zero_copy(QIO_CHANNEL_SOCKET(sioc),
+                                                 true, &local_err) < 0) {
+                goto cleanup;
+            }
+            p->zero_copy = true;
+        }
         p->running = true;
         if (multifd_channel_connect(p, sioc, local_err)) {
             goto cleanup;
@@ -839,6 +1151,17 @@ cleanup:
     multifd_new_send_channel_cleanup(p, sioc, local_err);
 }
 
+static void multifd_new_send_channel_create(MultiFDSendParams *p)
+{
+#ifdef CONFIG_RDMA
+    if (rdma_send_channel_available()) {
+        rdma_send_channel_create(multifd_new_send_channel_async, p);
+        return;
+    }
+#endif
+    socket_send_channel_create(multifd_new_send_channel_async, p);
+}
+
 int multifd_save_setup(Error **errp)
 {
     int thread_count;
@@ -850,13 +1173,31 @@ int multifd_save_setup(Error **errp)
         return 0;
     }
     s = migrate_get_current();
+    if (migrate_use_multifd_zero_copy()) {
+        if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "multifd-zero-copy does not support compression");
+            return -1;
+        }
+        if (migrate_use_xbzrle()) {
+            error_setg(errp, "multifd-zero-copy does not support xbzrle");
+            return -1;
+        }
+        if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+            error_setg(errp, "multifd-zero-copy does not support TLS");
+            return -1;
+        }
+    }
     thread_count = migrate_multifd_channels();
+    g_free(multifd_channel_counters.chan);
+    multifd_channel_counters.chan = g_new0(MultiFDChannelCounters,
+                                           thread_count);
+    multifd_channel_counters.count = thread_count;
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     qatomic_set(&multifd_send_state->exiting, 0);
-    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    multifd_send_state->ops = multifd_get_ops();
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -875,7 +1216,7 @@ int multifd_save_setup(Error **errp)
         p->packet->version = cpu_to_be32(MULTIFD_VERSION);
         p->name = g_strdup_printf("multifdsend_%d", i);
         p->tls_hostname = g_strdup(s->hostname);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        multifd_new_send_channel_create(p);
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -902,6 +1243,8 @@ struct {
     uint64_t packet_num;
     /* multifd ops */
     MultiFDMethods *ops;
+    /* set once postcopy pages can be placed */
+    QemuEvent postcopy_listening;
 } *multifd_recv_state;
 
 static void multifd_recv_terminate_threads(Error *err)
@@ -936,6 +1279,9 @@ static void multifd_recv_terminate_threads(Error *err)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+
+    /* Don't leave a thread waiting in multifd_recv_postcopy_pages() */
+    qemu_event_set(&multifd_recv_state->postcopy_listening);
 }
 
 int multifd_load_cleanup(Error **errp)
@@ -973,9 +1319,13 @@ int multifd_load_cleanup(Error **errp)
         p->packet_len = 0;
         g_free(p->packet);
         p->packet = NULL;
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf = NULL;
+        p->postcopy_buf_size = 0;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_event_destroy(&multifd_recv_state->postcopy_listening);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -1011,17 +1361,91 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+void multifd_recv_postcopy_listen(void)
+{
+    if (multifd_recv_state) {
+        qemu_event_set(&multifd_recv_state->postcopy_listening);
+    }
+}
+
+/*
+ * Receive the pages of a MULTIFD_FLAG_POSTCOPY packet.  Guest memory is
+ * registered with userfaultfd by now, so the data is read into a buffer
+ * and every page placed atomically; multifd_postcopy_page_ok() made sure
+ * each of them is a whole host page.
+ */
+static int multifd_recv_postcopy_pages(MultiFDRecvParams *p, uint32_t used,
+                                       uint32_t zero, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    size_t page_size = qemu_target_page_size();
+    RAMBlock *block = p->pages->block;
+    struct iovec *iov = p->pages->iov;
+    uint32_t i;
+    int ret;
+
+    if (!used && !zero) {
+        return 0;
+    }
+    if (flags != MULTIFD_FLAG_NOCOMP) {
+        error_setg(errp, "multifd %d: postcopy packet with flags 0x%x",
+                   p->id, flags);
+        return -1;
+    }
+    if (block->page_size != page_size) {
+        error_setg(errp, "multifd %d: postcopy packet for block %s, whose "
+                   "host pages are larger than target pages",
+                   p->id, block->idstr);
+        return -1;
+    }
+
+    if (p->postcopy_buf_size < used * page_size) {
+        qemu_vfree(p->postcopy_buf);
+        p->postcopy_buf_size = p->pages->allocated * page_size;
+        p->postcopy_buf = qemu_memalign(qemu_real_host_page_size,
+                                        p->postcopy_buf_size);
+    }
+    if (used && qio_channel_read_all(p->c, p->postcopy_buf,
+                                     used * page_size, errp)) {
+        return -1;
+    }
+
+    /* The source may be in postcopy before we have processed its LISTEN */
+    qemu_event_wait(&multifd_recv_state->postcopy_listening);
+
+    for (i = 0; i < used + zero; i++) {
+        if (i < used) {
+            ret = postcopy_place_page(mis, iov[i].iov_base,
+                                      p->postcopy_buf + i * page_size, block);
+        } else {
+            ret = postcopy_place_page_zero(mis, iov[i].iov_base, block);
+        }
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %d: failed to place page",
+                             p->id);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
     Error *local_err = NULL;
+    bool adaptive = migrate_use_multifd_compression_adaptive();
+    uint32_t i;
     int ret;
 
     trace_multifd_recv_thread_start(p->id);
+    migration_thread_sched_apply();
     rcu_register_thread();
 
     while (true) {
         uint32_t used;
+        uint32_t zero;
         uint32_t flags;
 
         if (p->quit) {
@@ -1045,20 +1469,41 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero = p->pages->zero;
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, used, flags,
+        trace_multifd_recv(p->id, p->packet_num, used, zero, flags,
                            p->next_packet_size);
         p->num_packets++;
-        p->num_pages += used;
+        p->num_pages += used + zero;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = multifd_recv_state->ops->recv_pages(p, used, &local_err);
+        if (flags & MULTIFD_FLAG_POSTCOPY) {
+            ret = multifd_recv_postcopy_pages(p, used, zero, &local_err);
             if (ret != 0) {
                 break;
             }
+        } else {
+            MultiFDMethods *ops = multifd_recv_state->ops;
+
+            /* multifd-compression-adaptive sends some packets as is */
+            if (adaptive && (flags & MULTIFD_FLAG_COMPRESSION_MASK) ==
+                            MULTIFD_FLAG_NOCOMP) {
+                ops = &multifd_nocomp_ops;
+            }
+            if (used) {
+                ret = ops->recv_pages(p, used, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+
+            for (i = used; i < used + zero; i++) {
+                /* Leaves pages that are still zero alone */
+                ram_handle_compressed(p->pages->iov[i].iov_base, 0,
+                                      qemu_target_page_size());
+            }
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
@@ -1095,7 +1540,8 @@ int multifd_load_setup(Error **errp)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     qatomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
-    multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
+    qemu_event_init(&multifd_recv_state->postcopy_listening, false);
+    multifd_recv_state->ops = multifd_get_ops();
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
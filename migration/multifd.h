@@ -15,6 +15,7 @@
 
 int multifd_save_setup(Error **errp);
 void multifd_save_cleanup(void);
+MultiFDChannelStatsList *multifd_send_channel_stats(void);
 int multifd_load_setup(Error **errp);
 int multifd_load_cleanup(Error **errp);
 bool multifd_recv_all_channels_created(void);
@@ -22,6 +23,8 @@ bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 void multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+bool multifd_postcopy_page_ok(RAMBlock *block, bool requested);
+void multifd_recv_postcopy_listen(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -32,6 +35,11 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_LZ4 (3 << 1)
+#define MULTIFD_FLAG_XBZRLE (4 << 1)
+
+/* The pages of the packet must be placed atomically, with UFFDIO_COPY */
+#define MULTIFD_FLAG_POSTCOPY (1 << 4)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -46,7 +54,13 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /*
+     * Number of zero pages; their offsets follow the pages_used offsets
+     * of the pages whose data is sent
+     */
+    uint32_t zero_pages;
+    uint32_t unused32;     /* Reserved for future use */
+    uint64_t unused[3];    /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -54,6 +68,11 @@ typedef struct {
 typedef struct {
     /* number of used pages */
     uint32_t used;
+    /*
+     * number of zero pages; they follow the @used pages in @offset and
+     * @iov and their data is not sent
+     */
+    uint32_t zero;
     /* number of allocated pages */
     uint32_t allocated;
     /* global number of generated multifd packets */
@@ -65,6 +84,18 @@ typedef struct {
     RAMBlock *block;
 } MultiFDPages_t;
 
+/* What multifd-compression-adaptive has measured on a channel */
+typedef struct {
+    /* nanoseconds spent compressing one byte */
+    double compress_ns;
+    /* compressed size divided by uncompressed size */
+    double ratio;
+    /* nanoseconds spent writing one byte to the channel */
+    double write_ns;
+    /* packets sent uncompressed since compression was last tried */
+    uint32_t skipped;
+} MultiFDAdaptive;
+
 typedef struct {
     /* this fields are not changed once the thread is created */
     /* channel number */
@@ -104,6 +135,18 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* send pages with MSG_ZEROCOPY */
+    bool zero_copy;
+    /* zero pages found that the main thread has not accounted for yet */
+    uint64_t zero_pages_pending;
+    /*
+     * compression level the method should use, between 1 and
+     * compress_level_max; methods without levels leave both at 0
+     */
+    int compress_level;
+    int compress_level_max;
+    /* only used by the channel thread */
+    MultiFDAdaptive adaptive;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
     /* used for compression methods */
@@ -145,6 +188,9 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* host-page aligned buffer that postcopy pages are received into */
+    void *postcopy_buf;
+    size_t postcopy_buf_size;
     /* used for de-compression methods */
     void *data;
 } MultiFDRecvParams;
@@ -168,5 +214,8 @@ typedef struct {
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
 
+/* Used instead of no compression when xbzrle is enabled */
+extern MultiFDMethods multifd_xbzrle_ops;
+
 #endif
 
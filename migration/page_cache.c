@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set associative, indexed by a hash of the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -30,6 +30,12 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * Pages map to a set of CACHE_WAYS items, so that two hot pages that
+ * hash to the same place don't keep evicting each other.
+ */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -38,11 +44,23 @@ struct CacheItem {
     uint8_t *it_data;
 };
 
+/*
+ * Pages that missed once, without their data.  A page is only cached
+ * the second time it misses, so that pages which are dirtied once
+ * don't push out the ones that keep being dirtied.
+ */
+typedef struct CacheGhost {
+    uint64_t addr;
+    uint64_t age;
+} CacheGhost;
+
 struct PageCache {
     CacheItem *page_cache;
+    CacheGhost *ghosts;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t num_ways;
 };
 
 PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
@@ -74,15 +92,20 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(CACHE_WAYS, num_pages);
 
     DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
                                      sizeof(*cache->page_cache));
-    if (!cache->page_cache) {
+    cache->ghosts = g_try_malloc((cache->max_num_items) *
+                                 sizeof(*cache->ghosts));
+    if (!cache->page_cache || !cache->ghosts) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
                    "Failed to allocate page cache");
+        g_free(cache->page_cache);
+        g_free(cache->ghosts);
         g_free(cache);
         return NULL;
     }
@@ -91,6 +114,8 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
         cache->page_cache[i].it_addr = -1;
+        cache->ghosts[i].addr = -1;
+        cache->ghosts[i].age = 0;
     }
 
     return cache;
@@ -109,31 +134,43 @@ void cache_fini(PageCache *cache)
 
     g_free(cache->page_cache);
     cache->page_cache = NULL;
+    g_free(cache->ghosts);
+    cache->ghosts = NULL;
     g_free(cache);
 }
 
+/* Index of the first item of the set that @address maps to */
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
+    size_t num_sets = cache->max_num_items / cache->num_ways;
+
     g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    return ((address / cache->page_size) & (num_sets - 1)) * cache->num_ways;
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set;
+    size_t i;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
-
-    return &cache->page_cache[pos];
+    set = &cache->page_cache[cache_get_cache_pos(cache, addr)];
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -143,7 +180,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
         return true;
@@ -151,20 +188,65 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
     return false;
 }
 
+/*
+ * Remember that @addr missed.  Returns true if it had already missed
+ * before, and so deserves a place in the cache.
+ */
+static bool cache_admit(PageCache *cache, uint64_t addr, uint64_t current_age)
+{
+    CacheGhost *set = &cache->ghosts[cache_get_cache_pos(cache, addr)];
+    CacheGhost *oldest = &set[0];
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].addr == addr) {
+            set[i].addr = -1;
+            set[i].age = 0;
+            return true;
+        }
+        if (set[i].age < oldest->age) {
+            oldest = &set[i];
+        }
+    }
+    oldest->addr = addr;
+    oldest->age = current_age;
+    return false;
+}
+
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
 
-    CacheItem *it;
+    CacheItem *it, *set;
+    bool evict;
+    size_t i;
 
-    /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
+    if (it) {
+        /* update of the cached page */
+        memcpy(it->it_data, pdata, cache->page_size);
+        it->it_age = current_age;
+        return 0;
+    }
+
+    /* pick a free item of the set, or the least recently used one */
+    set = &cache->page_cache[cache_get_cache_pos(cache, addr)];
+    it = &set[0];
+    for (i = 0; i < cache->num_ways && it->it_data; i++) {
+        if (!set[i].it_data || set[i].it_age < it->it_age) {
+            it = &set[i];
+        }
+    }
+    evict = it->it_data != NULL;
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
+    if (evict && it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+        /* the cache pages are fresh, don't replace them */
         return -1;
     }
+    if (!cache_admit(cache, addr, current_age)) {
+        return -1;
+    }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
@@ -180,5 +262,5 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     it->it_age = current_age;
     it->it_addr = addr;
 
-    return 0;
+    return evict ? 1 : 0;
 }
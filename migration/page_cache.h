@@ -61,7 +61,12 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
  * cache_insert: insert the page into the cache. the page cache
  * will dup the data on insert. the previous value will be overwritten
  *
- * Returns -1 when the page isn't inserted into cache
+ * A page that is not cached yet is only inserted the second time
+ * it is offered, pages that are dirtied once don't get to evict
+ * anything.
+ *
+ * Returns -1 when the page isn't inserted into cache, 1 when it took
+ * the place of another page and 0 otherwise
  *
  * @cache pointer to the PageCache struct
  * @addr: page address
@@ -30,6 +30,8 @@
 #include "qemu/error-report.h"
 #include "trace.h"
 #include "hw/boards.h"
+#include "socket.h"
+#include "qemu-file-channel.h"
 
 /* Arbitrary limit on size of each discard command,
  * keeps them around ~200 bytes
@@ -524,8 +526,20 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    int i;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    if (mis->have_preempt_thread) {
+        /*
+         * Requested pages may still be on their way; the source ends the
+         * channel after the last of them, so this does not wait forever.
+         */
+        trace_postcopy_preempt_thread_join();
+        qemu_thread_join(&mis->preempt_thread);
+        mis->have_preempt_thread = false;
+    }
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -560,9 +574,11 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
         }
     }
 
-    if (mis->postcopy_tmp_page) {
-        munmap(mis->postcopy_tmp_page, mis->largest_page_size);
-        mis->postcopy_tmp_page = NULL;
+    for (i = 0; i < RAM_CHANNEL_MAX; i++) {
+        if (mis->postcopy_tmp_pages[i]) {
+            munmap(mis->postcopy_tmp_pages[i], mis->largest_page_size);
+            mis->postcopy_tmp_pages[i] = NULL;
+        }
     }
     if (mis->postcopy_tmp_zero_page) {
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
@@ -1059,6 +1075,8 @@ retry:
 
 int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
 {
+    int i;
+
     /* Open the fd for the kernel to give us userfaults */
     mis->userfault_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
     if (mis->userfault_fd == -1) {
@@ -1097,14 +1115,20 @@ int postcopy_ram_incoming_setup(MigrationIncomingState *mis)
         return -1;
     }
 
-    mis->postcopy_tmp_page = mmap(NULL, mis->largest_page_size,
-                                  PROT_READ | PROT_WRITE, MAP_PRIVATE |
-                                  MAP_ANONYMOUS, -1, 0);
-    if (mis->postcopy_tmp_page == MAP_FAILED) {
-        mis->postcopy_tmp_page = NULL;
-        error_report("%s: Failed to map postcopy_tmp_page %s",
-                     __func__, strerror(errno));
-        return -1;
+    for (i = 0; i < RAM_CHANNEL_MAX; i++) {
+        void *page;
+
+        if (i == RAM_CHANNEL_POSTCOPY && !migrate_postcopy_preempt()) {
+            continue;
+        }
+        page = mmap(NULL, mis->largest_page_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
+            error_report("%s: Failed to map postcopy_tmp_page %s",
+                         __func__, strerror(errno));
+            return -1;
+        }
+        mis->postcopy_tmp_pages[i] = page;
     }
 
     /*
@@ -1227,6 +1251,137 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     }
 }
 
+/*
+ * Write-protect userfaults, used by the source of a background snapshot
+ * to copy out pages before the guest changes them.
+ */
+
+/* Returns true if the host can write-protect anonymous memory */
+bool uffd_write_protect_supported(void)
+{
+    uint64_t features;
+
+    if (!receive_ufd_features(&features)) {
+        return false;
+    }
+    return features & UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+}
+
+/*
+ * Opens a non-blocking userfaultfd that reports write-protect faults.
+ *
+ * Returns the file descriptor, or -1 on error
+ */
+int uffd_create_wp_fd(void)
+{
+    int ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+
+    if (ufd == -1) {
+        error_report("%s: syscall __NR_userfaultfd failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+    if (!request_ufd_features(ufd, UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        close(ufd);
+        return -1;
+    }
+    return ufd;
+}
+
+/*
+ * Registers [addr, addr + length) for write-protect faults.  Fails if
+ * the range can't be write-protected, e.g. because of its backend.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int uffd_register_wp_range(int ufd, void *addr, uint64_t length)
+{
+    struct uffdio_register reg_struct = {
+        .range.start = (uintptr_t)addr,
+        .range.len = length,
+        .mode = UFFDIO_REGISTER_MODE_WP,
+    };
+
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        error_report("%s: UFFDIO_REGISTER failed %p:%" PRIx64 ": %s",
+                     __func__, addr, length, strerror(errno));
+        return -1;
+    }
+    if (!(reg_struct.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+        error_report("%s: no UFFDIO_WRITEPROTECT for %p:%" PRIx64,
+                     __func__, addr, length);
+        uffd_unregister_range(ufd, addr, length);
+        return -1;
+    }
+    return 0;
+}
+
+int uffd_unregister_range(int ufd, void *addr, uint64_t length)
+{
+    struct uffdio_range range_struct = {
+        .start = (uintptr_t)addr,
+        .len = length,
+    };
+
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        error_report("%s: UFFDIO_UNREGISTER failed %p:%" PRIx64 ": %s",
+                     __func__, addr, length, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Sets or clears write protection on a registered range; clearing it
+ * wakes up the threads that faulted on the range.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int uffd_change_protection(int ufd, void *addr, uint64_t length, bool wp)
+{
+    struct uffdio_writeprotect wp_struct = {
+        .range.start = (uintptr_t)addr,
+        .range.len = length,
+        .mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0,
+    };
+
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        error_report("%s: UFFDIO_WRITEPROTECT failed %p:%" PRIx64 ": %s",
+                     __func__, addr, length, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads the next write-protect fault from @ufd, if any.
+ *
+ * Returns 1 and the faulting address in @addr, 0 if there is no
+ * pending fault, or -1 on error
+ */
+int uffd_read_wp_fault(int ufd, uint64_t *addr)
+{
+    struct uffd_msg msg;
+    ssize_t ret;
+
+    do {
+        ret = read(ufd, &msg, sizeof(msg));
+        if (ret < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        if (ret < 0 && errno != EINTR) {
+            error_report("%s: Failed to read full userfault message: %s",
+                         __func__, strerror(errno));
+            return -1;
+        }
+    } while (ret < 0 || msg.event != UFFD_EVENT_PAGEFAULT ||
+             !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP));
+
+    *addr = msg.arg.pagefault.address;
+    trace_uffd_read_wp_fault(*addr);
+    return 1;
+}
+
 #else
 /* No target OS support, stubs just fail */
 void fill_destination_postcopy_migration_info(MigrationInfo *info)
@@ -1291,6 +1446,41 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+bool uffd_write_protect_supported(void)
+{
+    return false;
+}
+
+int uffd_create_wp_fd(void)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_register_wp_range(int ufd, void *addr, uint64_t length)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_unregister_range(int ufd, void *addr, uint64_t length)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_change_protection(int ufd, void *addr, uint64_t length, bool wp)
+{
+    assert(0);
+    return -1;
+}
+
+int uffd_read_wp_fault(int ufd, uint64_t *addr)
+{
+    assert(0);
+    return -1;
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
@@ -1426,3 +1616,123 @@ void postcopy_unregister_shared_ufd(struct PostCopyFD *pcfd)
         }
     }
 }
+
+/*
+ * The postcopy-preempt channel: pages that the destination faulted on are
+ * sent on a connection of their own so they do not queue up behind the
+ * background pages on the main migration stream.
+ */
+static void postcopy_preempt_send_channel_new(QIOTask *task, gpointer opaque)
+{
+    MigrationState *s = opaque;
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        /* Requested pages will go out on the main stream instead */
+        warn_report_err(local_err);
+        object_unref(OBJECT(ioc));
+    } else {
+        qio_channel_set_name(ioc, "migration-postcopy-preempt");
+        qio_channel_set_delay(ioc, false);
+        s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+        object_unref(OBJECT(ioc));
+    }
+    trace_postcopy_preempt_new_channel_src(s->postcopy_qemufile_src != NULL);
+    qemu_sem_post(&s->postcopy_qemufile_src_sem);
+}
+
+void postcopy_preempt_setup(MigrationState *s)
+{
+    if (!migrate_postcopy_preempt()) {
+        return;
+    }
+    s->postcopy_preempt_connecting = true;
+    socket_send_channel_create(postcopy_preempt_send_channel_new, s);
+}
+
+void postcopy_preempt_wait_channel(MigrationState *s)
+{
+    if (!s->postcopy_preempt_connecting) {
+        return;
+    }
+    qemu_sem_wait(&s->postcopy_qemufile_src_sem);
+    s->postcopy_preempt_connecting = false;
+}
+
+void postcopy_preempt_shutdown_src(MigrationState *s)
+{
+    QEMUFile *file;
+
+    qemu_mutex_lock(&s->qemu_file_lock);
+    file = s->postcopy_qemufile_src;
+    s->postcopy_qemufile_src = NULL;
+    qemu_mutex_unlock(&s->qemu_file_lock);
+
+    if (file) {
+        qemu_file_shutdown(file);
+        qemu_fclose(file);
+    }
+}
+
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f)
+{
+    /* The channel is read by a thread of its own, not in a coroutine */
+    qemu_file_set_blocking(f, true);
+    mis->postcopy_qemufile_dst = f;
+    trace_postcopy_preempt_new_channel_dst();
+
+    /* The source may have started postcopy before we accepted it */
+    if (mis->have_listen_thread) {
+        postcopy_preempt_thread_start(mis);
+    }
+}
+
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    QEMUFile *f = mis->postcopy_qemufile_dst;
+    int ret = 0;
+
+    rcu_register_thread();
+    trace_postcopy_preempt_thread_entry();
+
+    while (!ret) {
+        int marker = qemu_get_byte(f);
+
+        ret = qemu_file_get_error(f);
+        if (ret || marker == POSTCOPY_PREEMPT_END) {
+            break;
+        }
+        if (marker != POSTCOPY_PREEMPT_PAGES) {
+            error_report("Unexpected postcopy-preempt marker %d", marker);
+            ret = -EINVAL;
+            break;
+        }
+        /* Drop the RCU lock between batches, they can be far apart */
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = ram_load_postcopy(f, RAM_CHANNEL_POSTCOPY);
+        }
+    }
+
+    if (ret) {
+        /*
+         * Not fatal on its own: the source falls back to the main stream,
+         * or the main stream fails as well and postcopy pauses.
+         */
+        error_report("Postcopy-preempt channel failed: %s", strerror(-ret));
+    }
+    trace_postcopy_preempt_thread_exit(ret);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void postcopy_preempt_thread_start(MigrationIncomingState *mis)
+{
+    if (!mis->postcopy_qemufile_dst || mis->have_preempt_thread) {
+        return;
+    }
+    mis->have_preempt_thread = true;
+    qemu_thread_create(&mis->preempt_thread, "postcopy/preempt",
+                       postcopy_preempt_thread, mis, QEMU_THREAD_JOINABLE);
+}
@@ -34,6 +34,25 @@ int postcopy_ram_incoming_init(MigrationIncomingState *mis);
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis);
 
+/*
+ * The postcopy-preempt channel carries batches of RAM pages, each
+ * introduced by POSTCOPY_PREEMPT_PAGES and ended by RAM_SAVE_FLAG_EOS.
+ * POSTCOPY_PREEMPT_END marks the end of the channel.
+ */
+#define POSTCOPY_PREEMPT_END    0
+#define POSTCOPY_PREEMPT_PAGES  1
+
+/* Source: start connecting the postcopy-preempt channel */
+void postcopy_preempt_setup(MigrationState *s);
+/* Source: wait until postcopy_preempt_setup() has finished connecting */
+void postcopy_preempt_wait_channel(MigrationState *s);
+/* Source: close the postcopy-preempt channel, if any */
+void postcopy_preempt_shutdown_src(MigrationState *s);
+/* Destination: a new connection is the postcopy-preempt channel */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f);
+/* Destination: start reading the postcopy-preempt channel once listening */
+void postcopy_preempt_thread_start(MigrationIncomingState *mis);
+
 /*
  * Userfault requires us to mark RAM as NOHUGEPAGE prior to discard
  * however leaving it until after precopy means that most of the precopy
@@ -179,4 +198,16 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/*
+ * Write-protect userfaults, for the source of a background snapshot.
+ * The fd from uffd_create_wp_fd() is non-blocking, and
+ * uffd_read_wp_fault() returns 0 when there is no pending fault.
+ */
+bool uffd_write_protect_supported(void);
+int uffd_create_wp_fd(void);
+int uffd_register_wp_range(int ufd, void *addr, uint64_t length);
+int uffd_unregister_range(int ufd, void *addr, uint64_t length);
+int uffd_change_protection(int ufd, void *addr, uint64_t length, bool wp);
+int uffd_read_wp_fault(int ufd, uint64_t *addr);
+
 #endif
@@ -99,6 +99,91 @@ static ssize_t channel_get_buffer(void *opaque,
 }
 
 
+static ssize_t channel_positional_io(QIOChannel *ioc,
+                                     struct iovec *iov,
+                                     int iovcnt,
+                                     off_t offset,
+                                     bool write,
+                                     Error **errp)
+{
+    ssize_t done = 0;
+    struct iovec *local_iov = g_new(struct iovec, iovcnt);
+    struct iovec *local_iov_head = local_iov;
+    unsigned int nlocal_iov = iovcnt;
+
+    nlocal_iov = iov_copy(local_iov, nlocal_iov,
+                          iov, iovcnt,
+                          0, iov_size(iov, iovcnt));
+
+    while (nlocal_iov > 0) {
+        ssize_t len;
+
+        if (write) {
+            len = qio_channel_pwritev(ioc, local_iov, nlocal_iov,
+                                      offset + done, errp);
+        } else {
+            len = qio_channel_preadv(ioc, local_iov, nlocal_iov,
+                                     offset + done, errp);
+        }
+        if (len == 0) {
+            error_setg(errp, "Unexpected end of file at offset %lld",
+                       (long long int)(offset + done));
+            len = -1;
+        }
+        if (len < 0) {
+            done = -EIO;
+            goto cleanup;
+        }
+
+        iov_discard_front(&local_iov, &nlocal_iov, len);
+        done += len;
+    }
+
+ cleanup:
+    g_free(local_iov_head);
+    return done;
+}
+
+
+static ssize_t channel_pwritev_buffer(void *opaque,
+                                      struct iovec *iov,
+                                      int iovcnt,
+                                      off_t offset,
+                                      Error **errp)
+{
+    return channel_positional_io(QIO_CHANNEL(opaque), iov, iovcnt, offset,
+                                 true, errp);
+}
+
+
+static ssize_t channel_preadv_buffer(void *opaque,
+                                     struct iovec *iov,
+                                     int iovcnt,
+                                     off_t offset,
+                                     Error **errp)
+{
+    return channel_positional_io(QIO_CHANNEL(opaque), iov, iovcnt, offset,
+                                 false, errp);
+}
+
+
+static off_t channel_seek(void *opaque,
+                          off_t offset,
+                          int whence,
+                          Error **errp)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+    off_t ret;
+
+    if (!qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "Channel does not support random access");
+        return -ENOTSUP;
+    }
+    ret = qio_channel_io_seek(ioc, offset, whence, errp);
+    return ret < 0 ? -EIO : ret;
+}
+
+
 static int channel_close(void *opaque, Error **errp)
 {
     int ret;
@@ -166,6 +251,8 @@ static const QEMUFileOps channel_input_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .preadv_buffer = channel_preadv_buffer,
+    .seek = channel_seek,
 };
 
 
@@ -175,6 +262,8 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .pwritev_buffer = channel_pwritev_buffer,
+    .seek = channel_seek,
 };
 
 
@@ -25,6 +25,7 @@
 #include <zlib.h>
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "qemu/timer.h"
 #include "migration.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -55,6 +56,8 @@ struct QEMUFile {
     Error *last_error_obj;
     /* has the file has been shutdown */
     bool shutdown;
+    /* nanoseconds spent in writev_buffer */
+    int64_t write_ns;
 };
 
 /*
@@ -228,9 +231,12 @@ void qemu_fflush(QEMUFile *f)
         return;
     }
     if (f->iovcnt > 0) {
+        int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
         expect = iov_size(f->iov, f->iovcnt);
         ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt, f->pos,
                                     &local_error);
+        f->write_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
         qemu_iovec_release_ram(f);
     }
@@ -657,6 +663,124 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+/*
+ * Returns true if the pages of the file can be accessed at fixed
+ * offsets with qemu_put_buffer_at() and qemu_get_buffer_at().
+ */
+bool qemu_file_is_seekable(QEMUFile *f)
+{
+    if (!f->ops->seek ||
+        !(qemu_file_is_writable(f) ? f->ops->pwritev_buffer
+                                   : f->ops->preadv_buffer)) {
+        return false;
+    }
+    return f->ops->seek(f->opaque, 0, SEEK_CUR, NULL) >= 0;
+}
+
+/*
+ * Write 'size' bytes of buf at offset 'pos' of the file, bypassing
+ * both the buffer and the stream position.  The data is written
+ * before returning, so buf can be reused straight away.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t size,
+                        off_t pos)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = size };
+    Error *local_error = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return;
+    }
+    if (!f->ops->pwritev_buffer) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return;
+    }
+
+    ret = f->ops->pwritev_buffer(f->opaque, &iov, 1, pos, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return;
+    }
+    f->bytes_xfer += size;
+}
+
+/*
+ * Read 'size' bytes at offset 'pos' of the file into buf, bypassing
+ * both the buffer and the stream position.
+ *
+ * Returns size, or 0 if there was an error.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t size, off_t pos)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    Error *local_error = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return 0;
+    }
+    if (!f->ops->preadv_buffer) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return 0;
+    }
+
+    ret = f->ops->preadv_buffer(f->opaque, &iov, 1, pos, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return 0;
+    }
+    return size;
+}
+
+/*
+ * Returns the offset in the underlying file that the next byte of the
+ * stream will be written to or read from, or -1 on error.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return -1;
+    }
+
+    qemu_fflush(f);
+    ret = f->ops->seek(f->opaque, 0, SEEK_CUR, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return -1;
+    }
+    /* Data in the buffer hasn't been consumed by the reader yet */
+    return ret - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Move the stream to offset 'off' of the underlying file.  Pending
+ * writes are flushed first, and data that was read ahead is dropped.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    if (!f->ops->seek) {
+        qemu_file_set_error(f, -ENOTSUP);
+        return;
+    }
+
+    qemu_fflush(f);
+    ret = f->ops->seek(f->opaque, off, SEEK_SET, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, ret, local_error);
+        return;
+    }
+    f->buf_index = 0;
+    f->buf_size = 0;
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (f->shutdown) {
@@ -676,6 +800,15 @@ int64_t qemu_file_get_rate_limit(QEMUFile *f)
     return f->xfer_limit;
 }
 
+/*
+ * Get the time in nanoseconds that writes to the file have blocked
+ * since it was opened
+ */
+int64_t qemu_file_get_write_time(QEMUFile *f)
+{
+    return f->write_ns;
+}
+
 void qemu_file_set_rate_limit(QEMUFile *f, int64_t limit)
 {
     f->xfer_limit = limit;
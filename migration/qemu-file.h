@@ -103,6 +103,24 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+/*
+ * Write or read an iovec at a fixed offset in the underlying file,
+ * without moving the position used by the streaming functions.  The
+ * handler must transfer all of the data or return a negative errno
+ * value; reading past the end of the file is an error.
+ */
+typedef ssize_t (QEMUFilePositionalFunc)(void *opaque, struct iovec *iov,
+                                         int iovcnt, off_t offset,
+                                         Error **errp);
+
+/*
+ * Move the position used by the streaming functions in the underlying
+ * file, the arguments are the same as for lseek().  Returns the new
+ * position or a negative errno value.
+ */
+typedef off_t (QEMUFileSeekFunc)(void *opaque, off_t offset, int whence,
+                                 Error **errp);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
     QEMUFileCloseFunc *close;
@@ -110,6 +128,10 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    /* Only set for files that support random access */
+    QEMUFilePositionalFunc *pwritev_buffer;
+    QEMUFilePositionalFunc *preadv_buffer;
+    QEMUFileSeekFunc *seek;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -133,6 +155,12 @@ void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, size_t size,
                            bool may_free);
 bool qemu_file_mode_is_not_valid(const char *mode);
 bool qemu_file_is_writable(QEMUFile *f);
+bool qemu_file_is_seekable(QEMUFile *f);
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t size,
+                        off_t pos);
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t size, off_t pos);
+off_t qemu_get_offset(QEMUFile *f);
+void qemu_set_offset(QEMUFile *f, off_t off);
 
 #include "migration/qemu-file-types.h"
 
@@ -154,6 +182,7 @@ void qemu_file_reset_rate_limit(QEMUFile *f);
 void qemu_file_update_transfer(QEMUFile *f, int64_t len);
 void qemu_file_set_rate_limit(QEMUFile *f, int64_t new_rate);
 int64_t qemu_file_get_rate_limit(QEMUFile *f);
+int64_t qemu_file_get_write_time(QEMUFile *f);
 int qemu_file_get_error_obj(QEMUFile *f, Error **errp);
 void qemu_file_set_error_obj(QEMUFile *f, int ret, Error *err);
 void qemu_file_set_error(QEMUFile *f, int ret);
@@ -88,6 +88,25 @@ void json_prop_str(QJSON *json, const char *name, const char *str)
     qstring_append_chr(json->str, '"');
 }
 
+/*
+ * Append the members of @part, a finished object, to the object that
+ * @json is building.
+ */
+void json_merge_object(QJSON *json, QJSON *part)
+{
+    const char *str = qstring_get_str(part->str);
+    size_t len = strlen(str);
+    g_autofree char *members = NULL;
+
+    /* Strip the "{ " and " }" around the members */
+    if (len <= 4) {
+        return;
+    }
+    members = g_strndup(str + 2, len - 4);
+    json_emit_element(json, NULL);
+    qstring_append(json->str, members);
+}
+
 const char *qjson_get_str(QJSON *json)
 {
     return qstring_get_str(json->str);
@@ -29,6 +29,7 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -76,12 +77,29 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * With the mapped-ram capability, the block list that follows
+ * RAM_SAVE_FLAG_MEM_SIZE has a header after the fields of each block:
+ *
+ *   be32 version, be64 page size, be64 bitmap offset, be64 pages offset
+ *
+ * The pages of the block are stored in the file at their offset in the
+ * block plus the pages offset, and the block has a little endian bitmap
+ * of the pages that hold data at the bitmap offset.  The file offsets
+ * are absolute, and the stream carries on after the pages of the
+ * block; no RAM_SAVE_FLAG_PAGE or RAM_SAVE_FLAG_ZERO records are sent.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_HDR_SIZE    (4 + 3 * 8)
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT (1 * MiB)
+
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
     return buffer_is_zero(p, size);
 }
 
 XBZRLECacheStats xbzrle_counters;
+RAMPhaseCounters phase_counters;
 
 /* struct contains XBZRLE cache and a static page
    used by the compression */
@@ -292,6 +310,8 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+typedef struct DirtySyncPool DirtySyncPool;
+
 /* State of RAM for migration */
 struct RAMState {
     /* QEMUFile used for this migration */
@@ -300,6 +320,8 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /* Last block sent on the postcopy-preempt channel */
+    RAMBlock *preempt_last_sent_block;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -345,6 +367,16 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Threads helping with the bitmap sync, NULL if it is done serially */
+    DirtySyncPool *dirty_sync_pool;
+    /*
+     * CPUState.dirty_pages of each vCPU at the end of the last period,
+     * indexed by cpu_index, for per-vcpu-throttle
+     */
+    uint64_t *vcpu_dirty_pages_prev;
+    unsigned int vcpu_dirty_pages_prev_len;
+    /* userfaultfd that write-protects RAM for background-snapshot, or -1 */
+    int uffdio_fd;
 };
 typedef struct RAMState RAMState;
 
@@ -401,6 +433,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* The page was requested by the destination during postcopy */
+    bool         postcopy_requested;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -643,6 +677,92 @@ static void mig_throttle_guest_down(uint64_t bytes_dirty_period,
     }
 }
 
+/* Marks the vCPUs that were not seen in a previous period yet */
+#define VCPU_DIRTY_PAGES_UNKNOWN  UINT64_MAX
+
+/**
+ * mig_throttle_vcpus: throttle the vCPUs that dirty memory fastest
+ *
+ * Every vCPU gets an equal share of @bytes_dirty_threshold.  The ones
+ * that dirtied more than that in the last period are throttled like
+ * mig_throttle_guest_down() throttles the whole guest, the ones that
+ * dirtied less than half of it are released step by step.
+ *
+ * Called with the iothread lock held.
+ *
+ * @rs: current RAM state
+ * @bytes_dirty_threshold: bytes that the guest may dirty in a period
+ */
+static void mig_throttle_vcpus(RAMState *rs, uint64_t bytes_dirty_threshold)
+{
+    MigrationState *s = migrate_get_current();
+    int pct_initial = s->parameters.cpu_throttle_initial;
+    int pct_increment = s->parameters.cpu_throttle_increment;
+    bool pct_tailslow = s->parameters.cpu_throttle_tailslow;
+    int pct_max = s->parameters.max_cpu_throttle;
+    uint64_t quota, bytes_dirty, *prev;
+    unsigned int nvcpu = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        nvcpu++;
+    }
+    if (!nvcpu) {
+        return;
+    }
+    quota = bytes_dirty_threshold / nvcpu;
+
+    CPU_FOREACH(cpu) {
+        int throttle_now = cpu_throttle_get_vcpu_percentage(cpu);
+        int throttle_new = throttle_now;
+
+        if ((unsigned int)cpu->cpu_index >= rs->vcpu_dirty_pages_prev_len) {
+            unsigned int len = cpu->cpu_index + 1, i;
+
+            rs->vcpu_dirty_pages_prev = g_renew(uint64_t,
+                                                rs->vcpu_dirty_pages_prev,
+                                                len);
+            for (i = rs->vcpu_dirty_pages_prev_len; i < len; i++) {
+                rs->vcpu_dirty_pages_prev[i] = VCPU_DIRTY_PAGES_UNKNOWN;
+            }
+            rs->vcpu_dirty_pages_prev_len = len;
+        }
+        prev = &rs->vcpu_dirty_pages_prev[cpu->cpu_index];
+        if (*prev == VCPU_DIRTY_PAGES_UNKNOWN) {
+            /* Nothing to compare with before the next period */
+            *prev = cpu->dirty_pages;
+            continue;
+        }
+        bytes_dirty = (cpu->dirty_pages - *prev) * qemu_real_host_page_size;
+        *prev = cpu->dirty_pages;
+
+        if (bytes_dirty > quota) {
+            if (!throttle_now) {
+                throttle_new = pct_initial;
+            } else {
+                int throttle_inc = pct_increment;
+
+                if (pct_tailslow) {
+                    /* Aim at the duty cycle that would match the quota */
+                    int cpu_now = 100 - throttle_now;
+                    int cpu_ideal = cpu_now * (quota * 1.0 / bytes_dirty);
+
+                    throttle_inc = MIN(cpu_now - cpu_ideal, pct_increment);
+                }
+                throttle_new = MIN(throttle_now + throttle_inc, pct_max);
+            }
+        } else if (throttle_now && bytes_dirty < quota / 2) {
+            throttle_new = MAX(throttle_now - pct_increment, 0);
+        }
+
+        if (throttle_new != throttle_now) {
+            trace_migration_throttle_vcpu(cpu->cpu_index, bytes_dirty, quota,
+                                          throttle_new);
+            cpu_throttle_set_vcpu(cpu, throttle_new);
+        }
+    }
+}
+
 /**
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
@@ -663,8 +783,10 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    if (cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+                     ram_counters.dirty_sync_count) == 1) {
+        xbzrle_counters.cache_evictions++;
+    }
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -694,14 +816,18 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
+            int ret = cache_insert(XBZRLE.cache, current_addr, *current_data,
+                                   ram_counters.dirty_sync_count);
+
+            if (ret == -1) {
                 return -1;
-            } else {
-                /* update *current_data when the page has been
-                   inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
             }
+            if (ret == 1) {
+                xbzrle_counters.cache_evictions++;
+            }
+            /* update *current_data when the page has been
+               inserted into cache */
+            *current_data = get_cached_data(XBZRLE.cache, current_addr);
         }
         return -1;
     }
@@ -770,6 +896,94 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
     return 1;
 }
 
+/**
+ * xbzrle_multifd_encode_page: XBZRLE encode a page for a multifd channel
+ *
+ * Like save_xbzrle_page(), but called from the multifd send threads,
+ * which build their packets themselves.  Unlike the main thread they
+ * don't skip the bulk stage, so the cache is already warm when the
+ * guest dirties the pages again.
+ *
+ * Returns: the size of the encoded page in @dst
+ *          0 means that page is identical to the one already sent
+ *          -1 means that the page has to be sent as is from @current_buf
+ *
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ * @current_buf: where to copy the page contents
+ * @dst: where to encode the page
+ * @dlen: size of @dst
+ */
+int xbzrle_multifd_encode_page(RAMBlock *block, ram_addr_t offset,
+                               uint8_t *current_buf, uint8_t *dst, int dlen)
+{
+    ram_addr_t current_addr = block->offset + offset;
+    uint64_t age = ram_counters.dirty_sync_count;
+    uint8_t *prev_cached_page;
+    int encoded_len;
+
+    /* The guest keeps running, work on a copy of the page */
+    memcpy(current_buf, block->host + offset, TARGET_PAGE_SIZE);
+
+    qemu_mutex_lock(&XBZRLE.lock);
+    if (!XBZRLE.cache) {
+        /* Migration is being cleaned up */
+        qemu_mutex_unlock(&XBZRLE.lock);
+        return -1;
+    }
+    if (!cache_is_cached(XBZRLE.cache, current_addr, age)) {
+        xbzrle_counters.cache_miss++;
+        if (cache_insert(XBZRLE.cache, current_addr, current_buf, age) == 1) {
+            xbzrle_counters.cache_evictions++;
+        }
+        qemu_mutex_unlock(&XBZRLE.lock);
+        return -1;
+    }
+
+    xbzrle_counters.pages++;
+    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    encoded_len = xbzrle_encode_buffer(prev_cached_page, current_buf,
+                                       TARGET_PAGE_SIZE, dst, dlen);
+    if (encoded_len != 0) {
+        memcpy(prev_cached_page, current_buf, TARGET_PAGE_SIZE);
+    }
+    if (encoded_len == -1) {
+        xbzrle_counters.overflow++;
+        xbzrle_counters.bytes += TARGET_PAGE_SIZE;
+    } else if (encoded_len > 0) {
+        xbzrle_counters.bytes += encoded_len;
+    }
+    qemu_mutex_unlock(&XBZRLE.lock);
+
+    return encoded_len;
+}
+
+/**
+ * xbzrle_multifd_cache_zero_pages: insert zero pages found by a multifd
+ * channel in the XBZRLE cache
+ *
+ * See xbzrle_cache_zero_page().
+ *
+ * @block: block that contains the pages
+ * @offset: offsets inside the block of the pages
+ * @num: number of pages
+ */
+void xbzrle_multifd_cache_zero_pages(RAMBlock *block, ram_addr_t *offset,
+                                     uint32_t num)
+{
+    uint32_t i;
+
+    qemu_mutex_lock(&XBZRLE.lock);
+    for (i = 0; XBZRLE.cache && i < num; i++) {
+        if (cache_insert(XBZRLE.cache, block->offset + offset[i],
+                         XBZRLE.zero_target_page,
+                         ram_counters.dirty_sync_count) == 1) {
+            xbzrle_counters.cache_evictions++;
+        }
+    }
+    qemu_mutex_unlock(&XBZRLE.lock);
+}
+
 /**
  * migration_bitmap_find_dirty: find the next dirty page from start
  *
@@ -858,6 +1072,189 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * With x-dirty-sync-threads > 1, the sync of the dirty bitmap is split
+ * into ranges of DIRTY_SYNC_RANGE_SIZE that are shared between a pool
+ * of threads and the migration thread.  Only the word aligned part of
+ * the blocks is split, because syncing it touches nothing but the
+ * bitmaps of the range; the rest may have to call the memory listeners
+ * and is left to the migration thread, which holds the iothread lock.
+ */
+#define DIRTY_SYNC_RANGE_SIZE  (1ULL << 30)
+
+typedef struct DirtySyncRange {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} DirtySyncRange;
+
+typedef struct DirtySyncWorker {
+    QemuThread thread;
+    DirtySyncPool *pool;
+    /* Newly dirtied pages found by the worker in the last sync */
+    uint64_t num_dirty;
+} DirtySyncWorker;
+
+struct DirtySyncPool {
+    DirtySyncWorker *workers;
+    int worker_count;
+    /* Posted once per worker to start a sync, or to quit */
+    QemuSemaphore start_sem;
+    /* Posted by each worker when it is done with the ranges */
+    QemuSemaphore done_sem;
+    bool quit;
+    /* Ranges of the sync in progress */
+    GArray *ranges;
+    /* Index of the next range to sync, atomic */
+    unsigned int next_range;
+};
+
+/* Called with RCU critical section */
+static uint64_t dirty_sync_pool_run_ranges(DirtySyncPool *pool)
+{
+    uint64_t num_dirty = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&pool->next_range)) < pool->ranges->len) {
+        DirtySyncRange *r = &g_array_index(pool->ranges, DirtySyncRange, i);
+
+        num_dirty += cpu_physical_memory_sync_dirty_bitmap(r->block, r->start,
+                                                           r->length);
+    }
+    return num_dirty;
+}
+
+static void *dirty_sync_worker_thread(void *opaque)
+{
+    DirtySyncWorker *w = opaque;
+    DirtySyncPool *pool = w->pool;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_wait(&pool->start_sem);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        WITH_RCU_READ_LOCK_GUARD() {
+            w->num_dirty = dirty_sync_pool_run_ranges(pool);
+        }
+        qemu_sem_post(&pool->done_sem);
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/* @threads counts the migration thread too */
+static DirtySyncPool *dirty_sync_pool_new(int threads)
+{
+    DirtySyncPool *pool = g_new0(DirtySyncPool, 1);
+    int i;
+
+    qemu_sem_init(&pool->start_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    pool->ranges = g_array_new(false, false, sizeof(DirtySyncRange));
+    pool->worker_count = threads - 1;
+    pool->workers = g_new0(DirtySyncWorker, pool->worker_count);
+    for (i = 0; i < pool->worker_count; i++) {
+        pool->workers[i].pool = pool;
+        qemu_thread_create(&pool->workers[i].thread, "dirtysync",
+                           dirty_sync_worker_thread, &pool->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    return pool;
+}
+
+static void dirty_sync_pool_free(DirtySyncPool *pool)
+{
+    int i;
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->worker_count; i++) {
+        qemu_sem_post(&pool->start_sem);
+    }
+    for (i = 0; i < pool->worker_count; i++) {
+        qemu_thread_join(&pool->workers[i].thread);
+    }
+    qemu_sem_destroy(&pool->start_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_array_free(pool->ranges, true);
+    g_free(pool->workers);
+    g_free(pool);
+}
+
+/*
+ * ramblock_sync_split_length: how much of @rb can be synced in ranges
+ *
+ * Returns the length of the part of the block, starting at its
+ * beginning, that cpu_physical_memory_sync_dirty_bitmap() can sync
+ * word by word in any number of DIRTY_SYNC_RANGE_SIZE pieces.
+ */
+static ram_addr_t ramblock_sync_split_length(RAMBlock *rb)
+{
+    if (!rb->clear_bmap ||
+        (rb->offset >> TARGET_PAGE_BITS) % BITS_PER_LONG) {
+        return 0;
+    }
+    return ROUND_DOWN(rb->used_length >> TARGET_PAGE_BITS, BITS_PER_LONG)
+           << TARGET_PAGE_BITS;
+}
+
+/* Called with RCU critical section and the iothread lock held */
+static void ram_sync_dirty_bitmaps(RAMState *rs)
+{
+    DirtySyncPool *pool = rs->dirty_sync_pool;
+    uint64_t new_dirty_pages = 0;
+    ram_addr_t split, start;
+    RAMBlock *block;
+    int i;
+
+    if (!pool) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    g_array_set_size(pool->ranges, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        split = ramblock_sync_split_length(block);
+        for (start = 0; start < split; start += DIRTY_SYNC_RANGE_SIZE) {
+            DirtySyncRange r = {
+                .block = block,
+                .start = start,
+                .length = MIN(DIRTY_SYNC_RANGE_SIZE, split - start),
+            };
+
+            g_array_append_val(pool->ranges, r);
+        }
+    }
+    qatomic_set(&pool->next_range, 0);
+    for (i = 0; i < pool->worker_count; i++) {
+        qemu_sem_post(&pool->start_sem);
+    }
+
+    /* What can't be split is synced while the workers run */
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        split = ramblock_sync_split_length(block);
+        if (split < block->used_length) {
+            new_dirty_pages += cpu_physical_memory_sync_dirty_bitmap(block,
+                                   split, block->used_length - split);
+        }
+    }
+    new_dirty_pages += dirty_sync_pool_run_ranges(pool);
+
+    for (i = 0; i < pool->worker_count; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+    for (i = 0; i < pool->worker_count; i++) {
+        new_dirty_pages += pool->workers[i].num_dirty;
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -950,6 +1347,11 @@ static void migration_trigger_throttle(RAMState *rs)
      * that ram migration makes no progress. Avoid this by disabling the
      * throttling logic during the bulk phase of block migration. */
     if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+        if (migrate_use_per_vcpu_throttle()) {
+            mig_throttle_vcpus(rs, bytes_dirty_threshold);
+            return;
+        }
+
         /* The following detection logic can be refined later. For now:
            Check to see if the ratio between dirtied bytes and the approx.
            amount of bytes that just got transferred since the last time
@@ -968,7 +1370,7 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs)
 {
-    RAMBlock *block;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int64_t end_time;
 
     ram_counters.dirty_sync_count++;
@@ -982,9 +1384,7 @@ static void migration_bitmap_sync(RAMState *rs)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
-        }
+        ram_sync_dirty_bitmaps(rs);
         ram_counters.remaining = ram_bytes_remaining();
     }
     qemu_mutex_unlock(&rs->bitmap_mutex);
@@ -992,6 +1392,8 @@ static void migration_bitmap_sync(RAMState *rs)
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
+    stat64_add(&phase_counters.bitmap_sync_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
@@ -1047,9 +1449,13 @@ static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
                                   RAMBlock *block, ram_addr_t offset)
 {
     uint8_t *p = block->host + offset;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    bool zero = is_zero_range(p, TARGET_PAGE_SIZE);
     int len = 0;
 
-    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+    stat64_add(&phase_counters.zero_page_ns,
+               qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    if (zero) {
         len += save_page_header(rs, file, block, offset | RAM_SAVE_FLAG_ZERO);
         qemu_put_byte(file, 0);
         len += 1;
@@ -1153,6 +1559,36 @@ static int save_normal_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
     return 1;
 }
 
+/*
+ * Write the page at its fixed place in the migration file
+ *
+ * Returns the number of pages written.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_page(RAMState *rs, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    /* Pages that are not in the file bitmap are zero on restore */
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    qemu_put_buffer_at(rs->f, p, TARGET_PAGE_SIZE,
+                       block->pages_offset + offset);
+    set_bit(page, block->file_bmap);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 /**
  * ram_save_page: send the given page to the stream
  *
@@ -1178,6 +1614,14 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
+    /*
+     * With background-snapshot, the page is unprotected as soon as it
+     * is saved, so it must be copied before the guest can change it
+     */
+    if (rs->uffdio_fd >= 0) {
+        send_async = false;
+    }
+
     XBZRLE_cache_lock();
     if (!rs->ram_bulk_stage && !migration_in_postcopy() &&
         migrate_use_xbzrle()) {
@@ -1415,12 +1859,20 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     if (!QSIMPLEQ_EMPTY(&rs->src_page_requests)) {
         struct RAMSrcPageRequest *entry =
                                 QSIMPLEQ_FIRST(&rs->src_page_requests);
+        ram_addr_t next;
+
         block = entry->rb;
         *offset = entry->offset;
 
-        if (entry->len > TARGET_PAGE_SIZE) {
-            entry->len -= TARGET_PAGE_SIZE;
-            entry->offset += TARGET_PAGE_SIZE;
+        /*
+         * The rest of the host page is sent along with this page, so
+         * don't go through its target pages one by one: that's up to a
+         * quarter million of them for a 1G huge page.
+         */
+        next = QEMU_ALIGN_UP(entry->offset + 1, qemu_ram_pagesize(block));
+        if (entry->offset + entry->len > next) {
+            entry->len -= next - entry->offset;
+            entry->offset = next;
         } else {
             memory_region_unref(block->mr);
             QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
@@ -1442,6 +1894,37 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
  * @rs: current RAM state
  * @pss: data about the state of the current dirty page scan
  */
+/**
+ * poll_fault_page: get the next page that the guest tried to write
+ *
+ * Returns the block of the page, or NULL if no vCPU is waiting for a
+ * page or background-snapshot is not running
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset within the RAMBlock
+ */
+static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
+{
+    RAMBlock *block;
+    uint64_t addr;
+
+    if (rs->uffdio_fd < 0) {
+        return NULL;
+    }
+
+    while (uffd_read_wp_fault(rs->uffdio_fd, &addr) > 0) {
+        block = qemu_ram_block_from_host((void *)(uintptr_t)addr, false,
+                                         offset);
+        if (block && (block->flags & RAM_UF_WRITEPROTECT)) {
+            trace_poll_fault_page(block->idstr, *offset);
+            return block;
+        }
+        error_report("%s: write fault at 0x%" PRIx64 " outside of the "
+                     "protected RAM", __func__, addr);
+    }
+    return NULL;
+}
+
 static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock  *block;
@@ -1471,6 +1954,14 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     } while (block && !dirty);
 
+    if (!block) {
+        /*
+         * With background-snapshot, vCPUs that wrote to a page that
+         * hasn't been saved yet are waiting for it.
+         */
+        block = poll_fault_page(rs, &offset);
+    }
+
     if (block) {
         /*
          * As soon as we start servicing pages out of order, then we have
@@ -1651,16 +2142,38 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
-    if (control_save_page(rs, block, offset, &res)) {
+    /* Over RDMA, multifd pages go through the multifd channels instead */
+    if (!migrate_use_multifd() && control_save_page(rs, block, offset, &res)) {
         return res;
     }
 
+    if (migrate_use_mapped_ram()) {
+        return ram_save_mapped_page(rs, block, offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
 
+    /*
+     * Do not use multifd for:
+     * 1. Compression as the first page in the new block should be posted out
+     *    before sending the compressed page
+     * 2. In postcopy as one whole host page should be placed, unless
+     *    multifd_postcopy_page_ok() says otherwise
+     */
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd() &&
+                  (!migration_in_postcopy() ||
+                   multifd_postcopy_page_ok(block, pss->postcopy_requested));
+
+    /* The multifd send threads look for zero pages themselves */
+    if (use_multifd && migrate_use_multifd_zero_page()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -1675,44 +2188,135 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
-    /*
-     * Do not use multifd for:
-     * 1. Compression as the first page in the new block should be posted out
-     *    before sending the compressed page
-     * 2. In postcopy as one whole host page should be placed
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
     return ram_save_page(rs, pss, last_stage);
 }
 
+static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
+                              bool last_stage);
+
+/*
+ * Returns the postcopy-preempt channel if pages requested by the
+ * destination should be sent on it, or NULL.
+ */
+static QEMUFile *postcopy_preempt_file(void)
+{
+    if (!migrate_postcopy_preempt() || !migration_in_postcopy()) {
+        return NULL;
+    }
+    return migrate_get_current()->postcopy_qemufile_src;
+}
+
 /**
- * ram_save_host_page: save a whole host page
- *
- * Starting at *offset send pages up to the end of the current host
- * page. It's valid for the initial offset to point into the middle of
- * a host page in which case the remainder of the hostpage is sent.
- * Only dirty target pages are sent. Note that the host page size may
- * be a huge page for this block.
- * The saving stops at the boundary of the used_length of the block
- * if the RAMBlock isn't a multiple of the host page size.
+ * ram_save_host_page_urgent: send a requested host page on the
+ * postcopy-preempt channel
  *
- * Returns the number of pages written or negative on error
+ * Like ram_save_host_page(), but the page goes out on @pf, which is
+ * flushed right away so that the page does not wait behind the
+ * background pages queued on the main stream.
  *
  * @rs: current RAM state
- * @ms: current migration state
  * @pss: data about the page we want to send
  * @last_stage: if we are at the completion stage
+ * @pf: the postcopy-preempt channel
  */
-static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
-                              bool last_stage)
+static int ram_save_host_page_urgent(RAMState *rs, PageSearchStatus *pss,
+                                     bool last_stage, QEMUFile *pf)
+{
+    QEMUFile *f = rs->f;
+    RAMBlock *last_sent_block = rs->last_sent_block;
+    int pages, ret;
+
+    trace_ram_save_host_page_urgent(pss->block->idstr, pss->page);
+
+    /* Each channel has its own RAM_SAVE_FLAG_CONTINUE context */
+    rs->f = pf;
+    rs->last_sent_block = rs->preempt_last_sent_block;
+
+    qemu_put_byte(pf, POSTCOPY_PREEMPT_PAGES);
+    pages = ram_save_host_page(rs, pss, last_stage);
+    qemu_put_be64(pf, RAM_SAVE_FLAG_EOS);
+    qemu_fflush(pf);
+
+    rs->preempt_last_sent_block = rs->last_sent_block;
+    rs->last_sent_block = last_sent_block;
+    rs->f = f;
+
+    ret = qemu_file_get_error(pf);
+    if (ret) {
+        /* Fail the main stream as well, so that postcopy pauses */
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+    return pages;
+}
+
+/**
+ * ram_save_urgent_pages: send the pages requested by the destination
+ * while a huge page is being sent on the main stream
+ *
+ * The destination assembles each host page from a single channel, so
+ * a request for the host page of @cur is left to the main stream,
+ * which is about to complete it anyway.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @cur: the page being sent on the main stream
+ * @last_stage: if we are at the completion stage
+ * @pf: the postcopy-preempt channel
+ */
+static int ram_save_urgent_pages(RAMState *rs, PageSearchStatus *cur,
+                                 bool last_stage, QEMUFile *pf)
+{
+    size_t pagesize_bits = qemu_ram_pagesize(cur->block) >> TARGET_PAGE_BITS;
+    PageSearchStatus pss = { };
+    int tmppages, pages = 0;
+
+    while (get_queued_page(rs, &pss)) {
+        if (pss.block == cur->block &&
+            pss.page / pagesize_bits == (cur->page - 1) / pagesize_bits) {
+            continue;
+        }
+        pss.postcopy_requested = true;
+        tmppages = ram_save_host_page_urgent(rs, &pss, last_stage, pf);
+        if (tmppages < 0) {
+            return tmppages;
+        }
+        pages += tmppages;
+    }
+    return pages;
+}
+
+/**
+ * ram_save_host_page: save a whole host page
+ *
+ * Starting at *offset send pages up to the end of the current host
+ * page. It's valid for the initial offset to point into the middle of
+ * a host page in which case the remainder of the hostpage is sent.
+ * Only dirty target pages are sent. Note that the host page size may
+ * be a huge page for this block.
+ * The saving stops at the boundary of the used_length of the block
+ * if the RAMBlock isn't a multiple of the host page size.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @ms: current migration state
+ * @pss: data about the page we want to send
+ * @last_stage: if we are at the completion stage
+ */
+static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
+                              bool last_stage)
 {
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
+    QEMUFile *pf = pss->postcopy_requested ? NULL : postcopy_preempt_file();
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
@@ -1735,12 +2339,31 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
         pss->page++;
         /* Allow rate limiting to happen in the middle of huge pages */
         migration_rate_limit();
+
+        /* Don't let faulting vCPUs wait for the rest of a huge page */
+        if (pf && pagesize_bits > 1) {
+            tmppages = ram_save_urgent_pages(rs, pss, last_stage, pf);
+            if (tmppages < 0) {
+                return tmppages;
+            }
+            pages += tmppages;
+        }
     } while ((pss->page & (pagesize_bits - 1)) &&
              offset_in_ramblock(pss->block,
                                 ((ram_addr_t)pss->page) << TARGET_PAGE_BITS));
 
     /* The offset we leave with is the last one we looked at */
     pss->page--;
+
+    /* Let the guest write to the pages that are saved now */
+    if (rs->uffdio_fd >= 0 && (pss->block->flags & RAM_UF_WRITEPROTECT) &&
+        uffd_change_protection(rs->uffdio_fd,
+                               pss->block->host +
+                               ((ram_addr_t)start_page << TARGET_PAGE_BITS),
+                               (ram_addr_t)(pss->page - start_page + 1) <<
+                               TARGET_PAGE_BITS, false)) {
+        return -EIO;
+    }
     return pages;
 }
 
@@ -1758,12 +2381,12 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
  * On systems where host-page-size > target-page-size it will send all the
  * pages in a host page that are dirty.
  */
-
 static int ram_find_and_save_block(RAMState *rs, bool last_stage)
 {
     PageSearchStatus pss;
+    QEMUFile *pf = postcopy_preempt_file();
     int pages = 0;
-    bool again, found;
+    bool again, found, urgent;
 
     /* No dirty page as there is zero RAM */
     if (!ram_bytes_total()) {
@@ -1781,6 +2404,8 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
     do {
         again = true;
         found = get_queued_page(rs, &pss);
+        urgent = found;
+        pss.postcopy_requested = urgent;
 
         if (!found) {
             /* priority queue empty, so just search for something dirty */
@@ -1788,7 +2413,11 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         }
 
         if (found) {
-            pages = ram_save_host_page(rs, &pss, last_stage);
+            if (urgent && pf) {
+                pages = ram_save_host_page_urgent(rs, &pss, last_stage, pf);
+            } else {
+                pages = ram_save_host_page(rs, &pss, last_stage);
+            }
         }
     } while (!pages && again);
 
@@ -1849,6 +2478,10 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        if ((*rsp)->dirty_sync_pool) {
+            dirty_sync_pool_free((*rsp)->dirty_sync_pool);
+        }
+        g_free((*rsp)->vcpu_dirty_pages_prev);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -1881,7 +2514,10 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against the migration bitmap
      */
-    memory_global_dirty_log_stop();
+    if (!migrate_background_snapshot()) {
+        memory_global_dirty_log_stop();
+    }
+    ram_write_tracking_stop();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
@@ -1890,6 +2526,11 @@ static void ram_save_cleanup(void *opaque)
         block->bmap = NULL;
     }
 
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+
     xbzrle_cleanup();
     compress_threads_save_cleanup();
     ram_state_cleanup(rsp);
@@ -2272,6 +2913,8 @@ err_out:
 
 static int ram_state_init(RAMState **rsp)
 {
+    MigrationState *ms = migrate_get_current();
+
     *rsp = g_try_new0(RAMState, 1);
 
     if (!*rsp) {
@@ -2282,6 +2925,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    (*rsp)->uffdio_fd = -1;
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2291,6 +2935,10 @@ static int ram_state_init(RAMState **rsp)
     (*rsp)->migration_dirty_pages = ram_bytes_total() >> TARGET_PAGE_BITS;
     ram_state_reset(*rsp);
 
+    if (ms->dirty_sync_threads > 1) {
+        (*rsp)->dirty_sync_pool = dirty_sync_pool_new(ms->dirty_sync_threads);
+    }
+
     return 0;
 }
 
@@ -2341,8 +2989,11 @@ static void ram_init_bitmaps(RAMState *rs)
 
     WITH_RCU_READ_LOCK_GUARD() {
         ram_list_init_bitmaps();
-        memory_global_dirty_log_start();
-        migration_bitmap_sync_precopy(rs);
+        /* A background snapshot saves every page once, as of its start */
+        if (!migrate_background_snapshot()) {
+            memory_global_dirty_log_start();
+            migration_bitmap_sync_precopy(rs);
+        }
     }
     qemu_mutex_unlock_ramlist();
     qemu_mutex_unlock_iothread();
@@ -2364,6 +3015,161 @@ static int ram_init_all(RAMState **rsp)
     return 0;
 }
 
+/* Nothing writes to read-only blocks, so they don't need protection */
+static bool ram_block_needs_write_tracking(RAMBlock *block)
+{
+    return !block->mr->readonly && !block->mr->rom_device;
+}
+
+/* Returns true if the host kernel supports background-snapshot */
+bool ram_write_tracking_available(void)
+{
+    return uffd_write_protect_supported();
+}
+
+/*
+ * Returns true if every RAMBlock that needs it can be write-protected,
+ * which depends on the memory backend
+ */
+bool ram_write_tracking_compatible(void)
+{
+    RAMBlock *block;
+    bool ret = true;
+    int ufd;
+
+    ufd = uffd_create_wp_fd();
+    if (ufd < 0) {
+        return false;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            if (!ram_block_needs_write_tracking(block)) {
+                continue;
+            }
+            if (uffd_register_wp_range(ufd, block->host, block->max_length)) {
+                ret = false;
+                break;
+            }
+            uffd_unregister_range(ufd, block->host, block->max_length);
+        }
+    }
+
+    close(ufd);
+    return ret;
+}
+
+/**
+ * ram_write_tracking_prepare: map every page of RAM
+ *
+ * Write protection only applies to pages that are mapped, so read a
+ * byte of each page; pages that were never written get the shared
+ * zero page.  This is slow for large guests, so it is done before
+ * the VM is stopped.
+ */
+void ram_write_tracking_prepare(void)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        size_t pagesize = qemu_ram_pagesize(block);
+        ram_addr_t offset;
+
+        if (!ram_block_needs_write_tracking(block)) {
+            continue;
+        }
+        for (offset = 0; offset < block->used_length; offset += pagesize) {
+            (void)*((volatile char *)block->host + offset);
+        }
+    }
+}
+
+static void ram_block_write_tracking_release(int ufd, RAMBlock *block)
+{
+    /* Removing the protection also wakes up the waiting vCPUs */
+    uffd_change_protection(ufd, block->host, block->used_length, false);
+    uffd_unregister_range(ufd, block->host, block->max_length);
+    block->flags &= ~RAM_UF_WRITEPROTECT;
+    memory_region_unref(block->mr);
+    trace_ram_write_tracking_ramblock_stop(block->idstr, block->max_length);
+}
+
+/**
+ * ram_write_tracking_start: write-protect guest RAM
+ *
+ * From now on, vCPUs that write to a page wait for it to be saved by
+ * ram_find_and_save_block().  Must be called with the VM stopped.
+ *
+ * Returns 0 for success or -1 for error
+ */
+int ram_write_tracking_start(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    int ufd;
+
+    ufd = uffd_create_wp_fd();
+    if (ufd < 0) {
+        return -1;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (!ram_block_needs_write_tracking(block)) {
+            continue;
+        }
+        if (uffd_register_wp_range(ufd, block->host, block->max_length)) {
+            goto fail;
+        }
+        block->flags |= RAM_UF_WRITEPROTECT;
+        memory_region_ref(block->mr);
+        trace_ram_write_tracking_ramblock_start(block->idstr,
+                                                block->max_length);
+        if (uffd_change_protection(ufd, block->host, block->used_length,
+                                   true)) {
+            goto fail;
+        }
+    }
+
+    rs->uffdio_fd = ufd;
+    return 0;
+
+fail:
+    error_report("Failed to write-protect guest RAM");
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->flags & RAM_UF_WRITEPROTECT) {
+            ram_block_write_tracking_release(ufd, block);
+        }
+    }
+    close(ufd);
+    return -1;
+}
+
+/* ram_write_tracking_stop: remove the write protection of guest RAM */
+void ram_write_tracking_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    if (!rs || rs->uffdio_fd < 0) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->flags & RAM_UF_WRITEPROTECT) {
+            ram_block_write_tracking_release(rs->uffdio_fd, block);
+        }
+    }
+
+    close(rs->uffdio_fd);
+    rs->uffdio_fd = -1;
+}
+
 static void ram_state_resume_prepare(RAMState *rs, QEMUFile *out)
 {
     RAMBlock *block;
@@ -2400,12 +3206,12 @@ static void ram_state_resume_prepare(RAMState *rs, QEMUFile *out)
 }
 
 /*
- * This function clears bits of the free pages reported by the caller from the
- * migration dirty bitmap. @addr is the host address corresponding to the
- * start of the continuous guest free pages, and @len is the total bytes of
- * those pages.
+ * Clear the guest free pages at @addr, @len bytes long, from the migration
+ * dirty bitmap.  With @reported, the guest doesn't touch the pages until we
+ * are done with them, so they are also dropped from the dirty log: what the
+ * guest wrote there before freeing them doesn't need to be sent either.
  */
-void qemu_guest_free_page_hint(void *addr, size_t len)
+static void ram_clear_free_pages(void *addr, size_t len, bool reported)
 {
     RAMBlock *block;
     ram_addr_t offset;
@@ -2439,6 +3245,11 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
         npages = used_len >> TARGET_PAGE_BITS;
 
         qemu_mutex_lock(&ram_state->bitmap_mutex);
+        if (reported) {
+            cpu_physical_memory_test_and_clear_dirty(block->offset + offset,
+                                                     used_len,
+                                                     DIRTY_MEMORY_MIGRATION);
+        }
         ram_state->migration_dirty_pages -=
                       bitmap_count_one_with_offset(block->bmap, start, npages);
         bitmap_clear(block->bmap, start, npages);
@@ -2446,6 +3257,38 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
+/*
+ * This function clears bits of the free pages reported by the caller from the
+ * migration dirty bitmap. @addr is the host address corresponding to the
+ * start of the continuous guest free pages, and @len is the total bytes of
+ * those pages.
+ */
+void qemu_guest_free_page_hint(void *addr, size_t len)
+{
+    ram_clear_free_pages(addr, len, false);
+}
+
+/*
+ * Like qemu_guest_free_page_hint(), for pages that the guest keeps away
+ * from its allocator until the report has been handled, as with virtio
+ * free page reporting.  Reports arrive at any time during precopy; they
+ * are taken into account between PRECOPY_NOTIFY_SETUP and
+ * PRECOPY_NOTIFY_CLEANUP.
+ */
+void qemu_guest_free_page_report(void *addr, size_t len)
+{
+    /*
+     * Reported pages may never have been sent, and the destination of a
+     * postcopy migration would wait forever for them after a fault.
+     */
+    if (!ram_state || migrate_postcopy_ram()) {
+        return;
+    }
+    ram_clear_free_pages(addr, len, true);
+}
+
+static void mapped_ram_setup_block(QEMUFile *f, RAMBlock *block);
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -2466,6 +3309,11 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    if (migrate_use_mapped_ram() && !qemu_file_is_seekable(f)) {
+        error_report("mapped-ram needs a migration file with random access");
+        return -1;
+    }
+
     if (compress_threads_save_setup()) {
         return -1;
     }
@@ -2493,6 +3341,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_use_mapped_ram()) {
+                mapped_ram_setup_block(f, block);
+            }
         }
     }
 
@@ -2506,6 +3357,64 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     return 0;
 }
 
+/* Size in the file of the bitmap of a block, in 64 bit words */
+static size_t mapped_ram_bitmap_size(unsigned long pages)
+{
+    return DIV_ROUND_UP(pages, 64) * sizeof(uint64_t);
+}
+
+/**
+ * mapped_ram_setup_block: place a block in the migration file
+ *
+ * Writes the mapped-ram header of @block and moves the stream past
+ * the space for its bitmap and pages.
+ *
+ * @f: QEMUFile where to send the data
+ * @block: block to place
+ */
+static void mapped_ram_setup_block(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    off_t header_offset = qemu_get_offset(f);
+
+    block->file_bmap = bitmap_new(pages);
+    block->bitmap_offset = header_offset + MAPPED_RAM_HDR_SIZE;
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(pages),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+    qemu_set_offset(f, block->pages_offset + block->used_length);
+
+    trace_mapped_ram_setup_block(block->idstr, block->bitmap_offset,
+                                 block->pages_offset);
+}
+
+/**
+ * mapped_ram_save_bitmaps: store the file bitmap of every block
+ *
+ * @f: QEMUFile where to send the data
+ */
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        /* Room for the padding to 64 bits on 32 bit hosts */
+        unsigned long *le_bitmap = bitmap_new(pages + BITS_PER_LONG);
+
+        bitmap_to_le(le_bitmap, block->file_bmap, pages);
+        qemu_put_buffer_at(f, (uint8_t *)le_bitmap,
+                           mapped_ram_bitmap_size(pages),
+                           block->bitmap_offset);
+        g_free(le_bitmap);
+    }
+}
+
 /**
  * ram_save_iterate: iterative stage for migration
  *
@@ -2654,10 +3563,19 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         }
 
         flush_compressed_data(rs);
+        if (ret >= 0 && migrate_use_mapped_ram()) {
+            mapped_ram_save_bitmaps(f);
+        }
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
     }
 
     if (ret >= 0) {
+        QEMUFile *pf = postcopy_preempt_file();
+
+        if (pf) {
+            qemu_put_byte(pf, POSTCOPY_PREEMPT_END);
+            qemu_fflush(pf);
+        }
         multifd_send_sync_main(rs->f);
         qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
         qemu_fflush(f);
@@ -2695,7 +3613,256 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
     }
 }
 
-static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+/*
+ * Load threads: the load thread reads normal, zero and XBZRLE pages off
+ * the stream and hands them in batches to a pool of workers, which do
+ * the copy or the decoding into guest memory.  A page always goes to
+ * the same worker, so two updates of a page are applied in the order
+ * they were received.
+ *
+ * The COLO secondary also uses them to flush its RAM cache.
+ */
+#define RAM_LOAD_BATCH_PAGES 64
+
+typedef enum {
+    RAM_LOAD_JOB_PAGE,
+    RAM_LOAD_JOB_ZERO,
+    RAM_LOAD_JOB_XBZRLE,
+    /* copy of @len pages from @data, which is not in the batch buffer */
+    RAM_LOAD_JOB_COPY,
+} RAMLoadJobType;
+
+typedef struct RAMLoadJob {
+    RAMLoadJobType type;
+    void *host;
+    /*
+     * fill byte for zero pages, encoded length for XBZRLE pages,
+     * number of pages for copies
+     */
+    unsigned int len;
+    /* page data, points inside the buffer of the batch */
+    uint8_t *data;
+} RAMLoadJob;
+
+typedef struct RAMLoadBatch {
+    RAMLoadJob jobs[RAM_LOAD_BATCH_PAGES];
+    unsigned int count;
+    /* RAM_LOAD_BATCH_PAGES pages of data */
+    uint8_t *buf;
+} RAMLoadBatch;
+
+typedef struct RAMLoadWorker {
+    QemuThread thread;
+    QemuMutex mutex;
+    QemuCond cond;
+    /* the load thread fills one batch while the worker loads the other */
+    RAMLoadBatch batch[2];
+    /* batch being filled, only accessed by the load thread */
+    RAMLoadBatch *filling;
+    /* batch given to the worker, NULL once it is loaded; protected by mutex */
+    RAMLoadBatch *pending;
+    bool quit;
+} RAMLoadWorker;
+
+static RAMLoadWorker *load_workers;
+static int load_workers_count;
+static QEMUFile *load_workers_file;
+
+static void ram_load_batch_run(RAMLoadBatch *batch)
+{
+    unsigned int i;
+
+    for (i = 0; i < batch->count; i++) {
+        RAMLoadJob *job = &batch->jobs[i];
+
+        switch (job->type) {
+        case RAM_LOAD_JOB_PAGE:
+            memcpy(job->host, job->data, TARGET_PAGE_SIZE);
+            break;
+        case RAM_LOAD_JOB_ZERO:
+            ram_handle_compressed(job->host, job->len, TARGET_PAGE_SIZE);
+            break;
+        case RAM_LOAD_JOB_XBZRLE:
+            if (xbzrle_decode_buffer(job->data, job->len, job->host,
+                                     TARGET_PAGE_SIZE) == -1) {
+                error_report("Failed to load XBZRLE page - decode error!");
+                qemu_file_set_error(load_workers_file, -EINVAL);
+            }
+            break;
+        case RAM_LOAD_JOB_COPY:
+            memcpy(job->host, job->data,
+                   (size_t)job->len << TARGET_PAGE_BITS);
+            break;
+        }
+    }
+    batch->count = 0;
+}
+
+static void *ram_load_worker_thread(void *opaque)
+{
+    RAMLoadWorker *worker = opaque;
+
+    qemu_mutex_lock(&worker->mutex);
+    while (!worker->quit) {
+        if (worker->pending) {
+            RAMLoadBatch *batch = worker->pending;
+
+            qemu_mutex_unlock(&worker->mutex);
+            ram_load_batch_run(batch);
+            qemu_mutex_lock(&worker->mutex);
+
+            worker->pending = NULL;
+            qemu_cond_signal(&worker->cond);
+        } else {
+            qemu_cond_wait(&worker->cond, &worker->mutex);
+        }
+    }
+    qemu_mutex_unlock(&worker->mutex);
+
+    return NULL;
+}
+
+/* Must be called with the worker mutex held */
+static void ram_load_worker_wait(RAMLoadWorker *worker)
+{
+    while (worker->pending) {
+        qemu_cond_wait(&worker->cond, &worker->mutex);
+    }
+}
+
+static void ram_load_worker_submit(RAMLoadWorker *worker)
+{
+    RAMLoadBatch *batch = worker->filling;
+
+    qemu_mutex_lock(&worker->mutex);
+    ram_load_worker_wait(worker);
+    worker->pending = batch;
+    qemu_cond_signal(&worker->cond);
+    qemu_mutex_unlock(&worker->mutex);
+
+    worker->filling = batch == &worker->batch[0] ? &worker->batch[1]
+                                                 : &worker->batch[0];
+}
+
+static RAMLoadJob *ram_load_queue_job_on(RAMLoadWorker *worker, void *host,
+                                         RAMLoadJobType type)
+{
+    RAMLoadBatch *batch;
+    RAMLoadJob *job;
+
+    if (worker->filling->count == RAM_LOAD_BATCH_PAGES) {
+        ram_load_worker_submit(worker);
+    }
+    batch = worker->filling;
+    job = &batch->jobs[batch->count];
+    job->type = type;
+    job->host = host;
+    job->data = batch->buf + batch->count * TARGET_PAGE_SIZE;
+    batch->count++;
+
+    return job;
+}
+
+/**
+ * ram_load_queue_job: queue a page for the load threads
+ *
+ * Returns the job, whose data buffer the caller fills for normal and
+ * XBZRLE pages.
+ *
+ * @host: host address of the page
+ * @type: how to load the page
+ */
+static RAMLoadJob *ram_load_queue_job(void *host, RAMLoadJobType type)
+{
+    uintptr_t page = (uintptr_t)host >> TARGET_PAGE_BITS;
+
+    return ram_load_queue_job_on(&load_workers[page % load_workers_count],
+                                 host, type);
+}
+
+/**
+ * ram_load_threads_flush: wait until every queued page is loaded
+ *
+ * Returns 0 for success or negative value for error
+ */
+static int ram_load_threads_flush(void)
+{
+    int i;
+
+    if (!load_workers) {
+        return 0;
+    }
+
+    for (i = 0; i < load_workers_count; i++) {
+        if (load_workers[i].filling->count) {
+            ram_load_worker_submit(&load_workers[i]);
+        }
+    }
+    for (i = 0; i < load_workers_count; i++) {
+        qemu_mutex_lock(&load_workers[i].mutex);
+        ram_load_worker_wait(&load_workers[i]);
+        qemu_mutex_unlock(&load_workers[i].mutex);
+    }
+    return qemu_file_get_error(load_workers_file);
+}
+
+static void ram_load_threads_cleanup(void)
+{
+    int i;
+
+    if (!load_workers) {
+        return;
+    }
+
+    for (i = 0; i < load_workers_count; i++) {
+        qemu_mutex_lock(&load_workers[i].mutex);
+        load_workers[i].quit = true;
+        qemu_cond_signal(&load_workers[i].cond);
+        qemu_mutex_unlock(&load_workers[i].mutex);
+    }
+    for (i = 0; i < load_workers_count; i++) {
+        qemu_thread_join(&load_workers[i].thread);
+        qemu_mutex_destroy(&load_workers[i].mutex);
+        qemu_cond_destroy(&load_workers[i].cond);
+        g_free(load_workers[i].batch[0].buf);
+        g_free(load_workers[i].batch[1].buf);
+    }
+    g_free(load_workers);
+    load_workers = NULL;
+    load_workers_count = 0;
+    load_workers_file = NULL;
+}
+
+static void ram_load_threads_setup(QEMUFile *f)
+{
+    int i, thread_count = migrate_get_current()->load_threads;
+
+    if (thread_count <= 1) {
+        return;
+    }
+
+    load_workers = g_new0(RAMLoadWorker, thread_count);
+    load_workers_count = thread_count;
+    load_workers_file = f;
+    for (i = 0; i < thread_count; i++) {
+        RAMLoadWorker *worker = &load_workers[i];
+
+        worker->batch[0].buf = g_malloc(RAM_LOAD_BATCH_PAGES *
+                                        TARGET_PAGE_SIZE);
+        worker->batch[1].buf = g_malloc(RAM_LOAD_BATCH_PAGES *
+                                        TARGET_PAGE_SIZE);
+        worker->filling = &worker->batch[0];
+        qemu_mutex_init(&worker->mutex);
+        qemu_cond_init(&worker->cond);
+        qemu_thread_create(&worker->thread, "ram-load",
+                           ram_load_worker_thread, worker,
+                           QEMU_THREAD_JOINABLE);
+    }
+    trace_ram_load_threads_setup(thread_count);
+}
+
+static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host,
+                       bool threaded)
 {
     unsigned int xh_len;
     int xh_flags;
@@ -2714,6 +3881,15 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
         error_report("Failed to load XBZRLE page - len overflow!");
         return -1;
     }
+
+    if (threaded) {
+        RAMLoadJob *job = ram_load_queue_job(host, RAM_LOAD_JOB_XBZRLE);
+
+        job->len = xh_len;
+        qemu_get_buffer(f, job->data, xh_len);
+        return 0;
+    }
+
     loaded_data = XBZRLE.decoded_buf;
     /* load data and decode */
     /* it can change loaded_data to point to an internal buffer */
@@ -2738,10 +3914,13 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel @f is, which tracks its own previous block
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block = NULL;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    RAMBlock *block = mis->last_recv_block[channel];
     char id[256];
     uint8_t len;
 
@@ -2758,6 +3937,7 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
     id[len] = 0;
 
     block = qemu_ram_block_by_name(id);
+    mis->last_recv_block[channel] = block;
     if (!block) {
         error_report("Can't find block %s", id);
         return NULL;
@@ -3083,6 +4263,7 @@ void colo_release_ram_cache(void)
 {
     RAMBlock *block;
 
+    ram_load_threads_cleanup();
     memory_global_dirty_log_stop();
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->bmap);
@@ -3116,6 +4297,7 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
 
     xbzrle_load_setup();
     ramblock_recv_map_init();
+    ram_load_threads_setup(f);
 
     return 0;
 }
@@ -3128,6 +4310,10 @@ static int ram_load_cleanup(void *opaque)
         qemu_ram_block_writeback(rb);
     }
 
+    /* The COLO secondary keeps them until it releases its RAM cache */
+    if (!migration_incoming_colo_enabled()) {
+        ram_load_threads_cleanup();
+    }
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
 
@@ -3160,19 +4346,21 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and for the postcopy-preempt
+ * channel by its thread.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: RAM_CHANNEL_* that @f is
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = mis->postcopy_tmp_page;
+    void *postcopy_host_page = mis->postcopy_tmp_pages[channel];
     void *this_host = NULL;
     bool all_zero = true;
     int target_pages = 0;
@@ -3203,7 +4391,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(f, flags, channel);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -3352,12 +4540,35 @@ static bool postcopy_is_running(void)
  * Flush content of RAM cache into SVM's memory.
  * Only flush the pages that be dirtied by PVM or SVM or both.
  */
+/*
+ * Flush the dirty pages of the RAM cache in runs of at most 1MB, so that
+ * a large run is spread over the load threads.
+ */
+#define COLO_FLUSH_RUN_PAGES (MiB >> TARGET_PAGE_BITS)
+
+static void colo_flush_ram_cache_run(RAMBlock *block, unsigned long start,
+                                     unsigned long npages)
+{
+    static unsigned int next_worker;
+    ram_addr_t offset = ((ram_addr_t)start) << TARGET_PAGE_BITS;
+    RAMLoadJob *job;
+
+    if (!load_workers) {
+        memcpy(block->host + offset, block->colo_cache + offset,
+               npages << TARGET_PAGE_BITS);
+        return;
+    }
+
+    job = ram_load_queue_job_on(&load_workers[next_worker++ %
+                                              load_workers_count],
+                                block->host + offset, RAM_LOAD_JOB_COPY);
+    job->data = block->colo_cache + offset;
+    job->len = npages;
+}
+
 void colo_flush_ram_cache(void)
 {
     RAMBlock *block = NULL;
-    void *dst_host;
-    void *src_host;
-    unsigned long offset = 0;
 
     memory_global_dirty_log_sync();
     WITH_RCU_READ_LOCK_GUARD() {
@@ -3368,28 +4579,87 @@ void colo_flush_ram_cache(void)
 
     trace_colo_flush_ram_cache_begin(ram_state->migration_dirty_pages);
     WITH_RCU_READ_LOCK_GUARD() {
-        block = QLIST_FIRST_RCU(&ram_list.blocks);
-
-        while (block) {
-            offset = migration_bitmap_find_dirty(ram_state, block, offset);
-
-            if (((ram_addr_t)offset) << TARGET_PAGE_BITS
-                >= block->used_length) {
-                offset = 0;
-                block = QLIST_NEXT_RCU(block, next);
-            } else {
-                migration_bitmap_clear_dirty(ram_state, block, offset);
-                dst_host = block->host
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                src_host = block->colo_cache
-                         + (((ram_addr_t)offset) << TARGET_PAGE_BITS);
-                memcpy(dst_host, src_host, TARGET_PAGE_SIZE);
+        qemu_mutex_lock(&ram_state->bitmap_mutex);
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+            unsigned long start = find_next_bit(block->bmap, pages, 0);
+
+            while (start < pages) {
+                unsigned long end = find_next_zero_bit(block->bmap, pages,
+                                                       start);
+
+                end = MIN(end, start + COLO_FLUSH_RUN_PAGES);
+                bitmap_clear(block->bmap, start, end - start);
+                ram_state->migration_dirty_pages -= end - start;
+                colo_flush_ram_cache_run(block, start, end - start);
+                start = find_next_bit(block->bmap, pages, end);
             }
         }
+        qemu_mutex_unlock(&ram_state->bitmap_mutex);
+        ram_load_threads_flush();
     }
     trace_colo_flush_ram_cache_end();
 }
 
+/**
+ * mapped_ram_load_block: load the pages of a block from the file
+ *
+ * Reads the mapped-ram header of @block, then every run of pages
+ * that hold data with a single read straight into guest memory, and
+ * moves the stream past the pages of the block.
+ *
+ * Returns 0 for success or a negative errno value
+ *
+ * @f: QEMUFile where to receive the data
+ * @block: block to load
+ */
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    uint32_t version = qemu_get_be32(f);
+    uint64_t page_size = qemu_get_be64(f);
+    off_t bitmap_offset = qemu_get_be64(f);
+    off_t pages_offset = qemu_get_be64(f);
+    unsigned long *le_bitmap, *bitmap;
+    unsigned long start, end, loaded = 0;
+
+    if (version != MAPPED_RAM_HDR_VERSION || page_size != TARGET_PAGE_SIZE) {
+        error_report("Unsupported mapped-ram header for block %s: "
+                     "version %" PRIu32 " page size %" PRIu64,
+                     block->idstr, version, page_size);
+        return -EINVAL;
+    }
+
+    le_bitmap = bitmap_new(pages + BITS_PER_LONG);
+    bitmap = bitmap_new(pages);
+    if (qemu_get_buffer_at(f, (uint8_t *)le_bitmap,
+                           mapped_ram_bitmap_size(pages), bitmap_offset)) {
+        bitmap_from_le(bitmap, le_bitmap, pages);
+    }
+
+    for (start = find_first_bit(bitmap, pages); start < pages;
+         start = find_next_bit(bitmap, pages, end)) {
+        ram_addr_t offset = (ram_addr_t)start << TARGET_PAGE_BITS;
+        void *host = host_from_ram_block_offset(block, offset);
+
+        end = find_next_zero_bit(bitmap, pages, start);
+        if (!qemu_get_buffer_at(f, host,
+                                (size_t)(end - start) << TARGET_PAGE_BITS,
+                                pages_offset + offset)) {
+            break;
+        }
+        ramblock_recv_bitmap_set_range(block, host, end - start);
+        loaded += end - start;
+    }
+    g_free(bitmap);
+    g_free(le_bitmap);
+
+    qemu_set_offset(f, pages_offset + block->used_length);
+    trace_mapped_ram_load_block(block->idstr, loaded);
+
+    return qemu_file_get_error(f);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3412,6 +4682,7 @@ static int ram_load_precopy(QEMUFile *f)
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
         void *host = NULL, *host_bak = NULL;
+        bool threaded;
         uint8_t ch;
 
         /*
@@ -3440,7 +4711,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -3478,6 +4750,9 @@ static int ram_load_precopy(QEMUFile *f)
             trace_ram_load_loop(block->idstr, (uint64_t)addr, flags, host);
         }
 
+        /* The COLO backup copy needs the page to be loaded right away */
+        threaded = load_workers && !host_bak;
+
         switch (flags & ~RAM_SAVE_FLAG_CONTINUE) {
         case RAM_SAVE_FLAG_MEM_SIZE:
             /* Synchronize RAM block list */
@@ -3529,6 +4804,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_use_mapped_ram()) {
+                        ret = mapped_ram_load_block(f, block);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -3543,11 +4821,21 @@ static int ram_load_precopy(QEMUFile *f)
 
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
-            ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            if (threaded) {
+                ram_load_queue_job(host, RAM_LOAD_JOB_ZERO)->len = ch;
+            } else {
+                ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            }
             break;
 
         case RAM_SAVE_FLAG_PAGE:
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (threaded) {
+                RAMLoadJob *job = ram_load_queue_job(host, RAM_LOAD_JOB_PAGE);
+
+                qemu_get_buffer(f, job->data, TARGET_PAGE_SIZE);
+            } else {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            }
             break;
 
         case RAM_SAVE_FLAG_COMPRESS_PAGE:
@@ -3561,7 +4849,7 @@ static int ram_load_precopy(QEMUFile *f)
             break;
 
         case RAM_SAVE_FLAG_XBZRLE:
-            if (load_xbzrle(f, addr, host) < 0) {
+            if (load_xbzrle(f, addr, host, threaded) < 0) {
                 error_report("Failed to decompress XBZRLE page at "
                              RAM_ADDR_FMT, addr);
                 ret = -EINVAL;
@@ -3589,6 +4877,7 @@ static int ram_load_precopy(QEMUFile *f)
         }
     }
 
+    ret |= ram_load_threads_flush();
     ret |= wait_for_decompress_done();
     return ret;
 }
@@ -3617,7 +4906,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
      */
     WITH_RCU_READ_LOCK_GUARD() {
         if (postcopy_running) {
-            ret = ram_load_postcopy(f);
+            ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
         } else {
             ret = ram_load_precopy(f);
         }
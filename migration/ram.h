@@ -32,11 +32,25 @@
 #include "qapi/qapi-types-migration.h"
 #include "exec/cpu-common.h"
 #include "io/channel.h"
+#include "qemu/stats64.h"
 
 extern MigrationStats ram_counters;
 extern XBZRLECacheStats xbzrle_counters;
 extern CompressionStats compression_counters;
 
+/*
+ * Time in nanoseconds spent in the phases of RAM migration that are
+ * reported in MigrationPhaseStats.  The compression and multifd threads
+ * update them too.
+ */
+typedef struct {
+    Stat64 bitmap_sync_ns;
+    Stat64 zero_page_ns;
+    Stat64 multifd_wait_ns;
+} RAMPhaseCounters;
+
+extern RAMPhaseCounters phase_counters;
+
 bool ramblock_is_ignored(RAMBlock *block);
 /* Should be holding either ram_list.mutex, or the RCU lock. */
 #define RAMBLOCK_FOREACH_NOT_IGNORED(block)            \
@@ -48,6 +62,10 @@ bool ramblock_is_ignored(RAMBlock *block);
         if (!qemu_ram_is_migratable(block)) {} else
 
 int xbzrle_cache_resize(int64_t new_size, Error **errp);
+int xbzrle_multifd_encode_page(RAMBlock *block, ram_addr_t offset,
+                               uint8_t *current_buf, uint8_t *dst, int dlen);
+void xbzrle_multifd_cache_zero_pages(RAMBlock *block, ram_addr_t *offset,
+                                     uint32_t num);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_total(void);
 
@@ -62,6 +80,7 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms);
 /* For incoming postcopy discard */
 int ram_discard_range(const char *block_name, uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
+int ram_load_postcopy(QEMUFile *f, int channel);
 
 void ram_handle_compressed(void *host, uint8_t ch, uint64_t size);
 
@@ -73,6 +92,13 @@ int64_t ramblock_recv_bitmap_send(QEMUFile *file,
                                   const char *block_name);
 int ram_dirty_bitmap_reload(MigrationState *s, RAMBlock *rb);
 
+/* Write tracking of guest RAM for background-snapshot */
+bool ram_write_tracking_available(void);
+bool ram_write_tracking_compatible(void);
+void ram_write_tracking_prepare(void);
+int ram_write_tracking_start(void);
+void ram_write_tracking_stop(void);
+
 /* ram cache */
 int colo_init_ram_cache(void);
 void colo_flush_ram_cache(void);
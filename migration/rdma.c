@@ -395,6 +395,11 @@ typedef struct RDMAContext {
     /* the RDMAContext for return path */
     struct RDMAContext *return_path;
     bool is_return_path;
+
+    /* destination side, the RDMAContext of the main channel for multifd */
+    struct RDMAContext *main_context;
+    /* destination side, multifd channels accepted so far on the main one */
+    int multifd_accepted;
 } RDMAContext;
 
 #define TYPE_QIO_CHANNEL_RDMA "qio-channel-rdma"
@@ -2311,6 +2316,11 @@ static void qemu_rdma_cleanup(RDMAContext *rdma)
 {
     int idx;
 
+    /* multifd channels share the listening channel until they are accepted */
+    if (rdma->main_context && rdma->channel == rdma->main_context->channel) {
+        rdma->channel = NULL;
+    }
+
     if (rdma->cm_id && rdma->connected) {
         if ((rdma->error_state ||
              migrate_get_current()->state == MIGRATION_STATUS_CANCELLING) &&
@@ -3231,6 +3241,7 @@ err:
 }
 
 static void rdma_accept_incoming_migration(void *opaque);
+static void rdma_accept_multifd_channel(void *opaque);
 
 static void rdma_cm_poll_handler(void *opaque)
 {
@@ -3265,6 +3276,36 @@ static void rdma_cm_poll_handler(void *opaque)
     }
 }
 
+/*
+ * Pick the handler for the next event on the listening channel.  The
+ * source connects the return path right after the main channel, then
+ * one channel per multifd thread.
+ */
+static void qemu_rdma_set_cm_handler(RDMAContext *rdma)
+{
+    RDMAContext *main_rdma = rdma;
+
+    if (rdma->is_return_path) {
+        main_rdma = rdma->return_path;
+    } else if (rdma->main_context) {
+        main_rdma = rdma->main_context;
+    }
+
+    if (migrate_postcopy() && rdma == main_rdma) {
+        /* Accept the second connection request for return path */
+        qemu_set_fd_handler(rdma->channel->fd, rdma_accept_incoming_migration,
+                            NULL,
+                            (void *)(intptr_t)rdma->return_path);
+    } else if (migrate_use_multifd() &&
+               main_rdma->multifd_accepted < migrate_multifd_channels()) {
+        qemu_set_fd_handler(rdma->channel->fd, rdma_accept_multifd_channel,
+                            NULL, main_rdma);
+    } else {
+        qemu_set_fd_handler(rdma->channel->fd, rdma_cm_poll_handler,
+                            NULL, rdma->main_context ? main_rdma : rdma);
+    }
+}
+
 static int qemu_rdma_accept(RDMAContext *rdma)
 {
     RDMACapabilities cap;
@@ -3359,15 +3400,7 @@ static int qemu_rdma_accept(RDMAContext *rdma)
         }
     }
 
-    /* Accept the second connection request for return path */
-    if (migrate_postcopy() && !rdma->is_return_path) {
-        qemu_set_fd_handler(rdma->channel->fd, rdma_accept_incoming_migration,
-                            NULL,
-                            (void *)(intptr_t)rdma->return_path);
-    } else {
-        qemu_set_fd_handler(rdma->channel->fd, rdma_cm_poll_handler,
-                            NULL, rdma);
-    }
+    qemu_rdma_set_cm_handler(rdma);
 
     ret = rdma_accept(rdma->cm_id, &conn_param);
     if (ret) {
@@ -4009,6 +4042,54 @@ static void rdma_accept_incoming_migration(void *opaque)
     }
 }
 
+/*
+ * A multifd channel carries its packets as SEND messages on a queue pair
+ * of its own.  Once accepted it moves to its own event channel, so that
+ * its multifd thread can wait for events without racing the main loop.
+ */
+static void rdma_accept_multifd_channel(void *opaque)
+{
+    RDMAContext *rdma = opaque;
+    RDMAContext *rdma_multifd = g_new0(RDMAContext, 1);
+    struct rdma_event_channel *channel;
+    QIOChannelRDMA *rioc;
+    Error *local_err = NULL;
+
+    rdma_multifd->current_index = -1;
+    rdma_multifd->current_chunk = -1;
+    rdma_multifd->channel = rdma->channel;
+    rdma_multifd->main_context = rdma;
+    rdma->multifd_accepted++;
+
+    trace_qemu_rdma_accept_multifd_channel(rdma->multifd_accepted);
+    if (qemu_rdma_accept(rdma_multifd)) {
+        error_report("RDMA ERROR: multifd channel initialization failed");
+        g_free(rdma_multifd);
+        return;
+    }
+
+    channel = rdma_create_event_channel();
+    if (!channel || rdma_migrate_id(rdma_multifd->cm_id, channel)) {
+        error_report("RDMA ERROR: could not create multifd event channel");
+        if (channel) {
+            rdma_destroy_event_channel(channel);
+        }
+        qemu_rdma_cleanup(rdma_multifd);
+        g_free(rdma_multifd);
+        return;
+    }
+    rdma_multifd->channel = channel;
+
+    rioc = QIO_CHANNEL_RDMA(object_new(TYPE_QIO_CHANNEL_RDMA));
+    rioc->rdmain = rdma_multifd;
+    qio_channel_set_name(QIO_CHANNEL(rioc), "multifd-rdma-incoming");
+    migration_ioc_process_incoming(QIO_CHANNEL(rioc), &local_err);
+    object_unref(OBJECT(rioc));
+    if (local_err) {
+        error_reportf_err(local_err, "RDMA ERROR:");
+    }
+}
+
 void rdma_start_incoming_migration(const char *host_port, Error **errp)
 {
     int ret;
@@ -4068,6 +4149,55 @@ err:
     g_free(rdma_return_path);
 }
 
+/*
+ * Where the multifd channels connect to.  Only set while
+ * rdma_start_outgoing_migration() starts the migration, which is when
+ * multifd creates its channels.
+ */
+static struct RDMAOutgoingArgs {
+    char *host_port;
+} rdma_outgoing_args;
+
+bool rdma_send_channel_available(void)
+{
+    return rdma_outgoing_args.host_port != NULL;
+}
+
+static void rdma_send_channel_complete(void *opaque)
+{
+    qio_task_complete(opaque);
+}
+
+void rdma_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(object_new(TYPE_QIO_CHANNEL_RDMA));
+    QIOTask *task = qio_task_new(OBJECT(rioc), f, data, NULL);
+    Error *local_err = NULL;
+    RDMAContext *rdma;
+
+    qio_channel_set_name(QIO_CHANNEL(rioc), "multifd-rdma-outgoing");
+    rdma = qemu_rdma_data_init(rdma_outgoing_args.host_port, &local_err);
+    if (rdma == NULL) {
+        goto out;
+    }
+
+    /* Guest memory is not written through multifd channels */
+    if (qemu_rdma_source_init(rdma, false, &local_err) ||
+        qemu_rdma_connect(rdma, &local_err)) {
+        g_free(rdma);
+        goto out;
+    }
+    rioc->rdmaout = rdma;
+
+out:
+    if (local_err) {
+        qio_task_set_error(task, local_err);
+    }
+    /* Like socket channels, report from the main loop once connected */
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            rdma_send_channel_complete, task);
+}
+
 void rdma_start_outgoing_migration(void *opaque,
                             const char *host_port, Error **errp)
 {
@@ -4082,6 +4212,17 @@ void rdma_start_outgoing_migration(void *opaque,
         return;
     }
 
+    if (migrate_use_multifd()) {
+        if (migrate_use_multifd_zero_copy()) {
+            error_setg(errp, "RDMA: multifd-zero-copy is not supported");
+            return;
+        }
+        if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+            error_setg(errp, "RDMA: multifd does not support TLS");
+            return;
+        }
+    }
+
     rdma = qemu_rdma_data_init(host_port, errp);
     if (rdma == NULL) {
         goto err;
@@ -4130,7 +4271,10 @@ void rdma_start_outgoing_migration(void *opaque,
     trace_rdma_start_outgoing_migration_after_rdma_connect();
 
     s->to_dst_file = qemu_fopen_rdma(rdma, "wb");
+    rdma_outgoing_args.host_port = g_strdup(host_port);
     migrate_fd_connect(s, NULL);
+    g_free(rdma_outgoing_args.host_port);
+    rdma_outgoing_args.host_port = NULL;
     return;
 return_path_err:
     qemu_rdma_cleanup(rdma);
@@ -17,9 +17,18 @@
 #ifndef QEMU_MIGRATION_RDMA_H
 #define QEMU_MIGRATION_RDMA_H
 
+#include "io/task.h"
+
 void rdma_start_outgoing_migration(void *opaque, const char *host_port,
                                    Error **errp);
 
 void rdma_start_incoming_migration(const char *host_port, Error **errp);
 
+/*
+ * Multifd channels of an outgoing RDMA migration, only available while
+ * rdma_start_outgoing_migration() starts it.
+ */
+bool rdma_send_channel_available(void);
+void rdma_send_channel_create(QIOTaskFunc f, void *data);
+
 #endif
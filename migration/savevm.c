@@ -40,6 +40,7 @@
 #include "qemu-file.h"
 #include "savevm.h"
 #include "postcopy-ram.h"
+#include "multifd.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-migration.h"
 #include "qapi/qapi-commands-misc.h"
@@ -246,6 +247,11 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    /*
+     * time in microseconds that the last save took once the guest was
+     * stopped, or -1 if it wasn't saved then
+     */
+    int64_t downtime;
 } SaveStateEntry;
 
 typedef struct SaveState {
@@ -272,6 +278,7 @@ static bool should_validate_capability(int capability)
     /* Validate only new capabilities to keep compatibility. */
     switch (capability) {
     case MIGRATION_CAPABILITY_X_IGNORE_SHARED:
+    case MIGRATION_CAPABILITY_MAPPED_RAM:
         return true;
     default:
         return false;
@@ -768,6 +775,7 @@ int register_savevm_live(const char *idstr,
     se = g_new0(SaveStateEntry, 1);
     se->version_id = version_id;
     se->section_id = savevm_state.global_section_id++;
+    se->downtime = -1;
     se->ops = ops;
     se->opaque = opaque;
     se->vmsd = NULL;
@@ -826,6 +834,7 @@ int vmstate_register_with_alias_id(VMStateIf *obj, uint32_t instance_id,
     se = g_new0(SaveStateEntry, 1);
     se->version_id = vmsd->version_id;
     se->section_id = savevm_state.global_section_id++;
+    se->downtime = -1;
     se->opaque = opaque;
     se->vmsd = vmsd;
     se->alias_id = alias_id;
@@ -1163,6 +1172,7 @@ void qemu_savevm_state_setup(QEMUFile *f)
 
     trace_savevm_state_setup();
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        se->downtime = -1;
         if (!se->ops || !se->ops->save_setup) {
             continue;
         }
@@ -1322,6 +1332,7 @@ static
 int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
 {
     SaveStateEntry *se;
+    int64_t start;
     int ret;
 
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
@@ -1339,9 +1350,11 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
         }
         trace_savevm_section_start(se->idstr, se->section_id);
 
+        start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_END);
 
         ret = se->ops->save_live_complete_precopy(f, se->opaque);
+        se->downtime = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start;
         trace_savevm_section_end(se->idstr, se->section_id, ret);
         save_section_footer(f, se);
         if (ret < 0) {
@@ -1353,19 +1366,153 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-static
+/*
+ * Devices that set parallel_save in their VMStateDescription are saved
+ * by a pool of threads, each into a buffer of its own, and the buffers
+ * are then written to the stream in the order of the handlers.  A batch
+ * of such devices ends at any other device, or when the priority
+ * changes, so the stream and the order between priorities are the same
+ * as when all devices are saved in turn.
+ */
+typedef struct SaveStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    QJSON *vmdesc;
+    int ret;
+} SaveStateJob;
+
+typedef struct SaveStateJobs {
+    SaveStateJob *job;
+    int count;
+    /* index of the next job to run */
+    int next;
+} SaveStateJobs;
+
+static bool vmstate_save_in_parallel(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->parallel_save &&
+           migrate_get_current()->vmstate_save_threads > 1;
+}
+
+static void vmstate_save_jobs_run(SaveStateJobs *jobs)
+{
+    int i;
+
+    while ((i = qatomic_fetch_inc(&jobs->next)) < jobs->count) {
+        SaveStateJob *job = &jobs->job[i];
+        int64_t start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+        job->bioc = qio_channel_buffer_new(4096);
+        job->f = qemu_fopen_channel_output(QIO_CHANNEL(job->bioc));
+        job->vmdesc = qjson_new();
+        job->ret = vmstate_save(job->f, job->se, job->vmdesc);
+        qemu_fflush(job->f);
+        if (!job->ret) {
+            job->ret = qemu_file_get_error(job->f);
+        }
+        qjson_finish(job->vmdesc);
+        job->se->downtime = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start;
+        trace_vmstate_downtime_save(job->se->idstr, job->se->instance_id,
+                                    job->se->downtime);
+    }
+}
+
+static void *vmstate_save_thread(void *opaque)
+{
+    rcu_register_thread();
+    vmstate_save_jobs_run(opaque);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/**
+ * vmstate_save_jobs_flush: save a batch of parallel_save devices
+ *
+ * Returns 0 for success or a negative errno value
+ *
+ * @f: QEMUFile where to write the device sections
+ * @jobs: the batch, empty on return
+ * @vmdesc: description of the devices written to @f
+ */
+static int vmstate_save_jobs_flush(QEMUFile *f, SaveStateJobs *jobs,
+                                   QJSON *vmdesc)
+{
+    int nthreads = MIN(migrate_get_current()->vmstate_save_threads,
+                       jobs->count);
+    g_autofree QemuThread *threads = NULL;
+    int i, ret = 0;
+
+    if (!jobs->count) {
+        return 0;
+    }
+
+    /* The calling thread takes its share of the jobs too */
+    threads = g_new(QemuThread, nthreads);
+    jobs->next = 0;
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_create(&threads[i], "vmstate-save", vmstate_save_thread,
+                           jobs, QEMU_THREAD_JOINABLE);
+    }
+    vmstate_save_jobs_run(jobs);
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < jobs->count; i++) {
+        SaveStateJob *job = &jobs->job[i];
+        SaveStateEntry *se = job->se;
+
+        if (!ret && job->ret) {
+            ret = job->ret;
+            qemu_file_set_error(f, ret);
+        }
+        if (!ret) {
+            trace_savevm_section_start(se->idstr, se->section_id);
+
+            json_start_object(vmdesc, NULL);
+            json_prop_str(vmdesc, "name", se->idstr);
+            json_prop_int(vmdesc, "instance_id", se->instance_id);
+            json_merge_object(vmdesc, job->vmdesc);
+
+            save_section_header(f, se, QEMU_VM_SECTION_FULL);
+            qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+            trace_savevm_section_end(se->idstr, se->section_id, 0);
+            save_section_footer(f, se);
+
+            json_end_object(vmdesc);
+        }
+        qemu_fclose(job->f);
+        object_unref(OBJECT(job->bioc));
+        qjson_destroy(job->vmdesc);
+    }
+    jobs->count = 0;
+
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
 {
     g_autoptr(QJSON) vmdesc = NULL;
+    g_autofree SaveStateJob *job = NULL;
+    SaveStateJobs jobs = { 0 };
     int vmdesc_len;
     SaveStateEntry *se;
+    int64_t start;
     int ret;
 
     vmdesc = qjson_new();
     json_prop_int(vmdesc, "page_size", qemu_target_page_size());
     json_start_array(vmdesc, "devices");
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        jobs.count++;
+    }
+    job = jobs.job = g_new0(SaveStateJob, jobs.count);
+    jobs.count = 0;
+
     QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
 
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
@@ -1376,23 +1523,43 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
             continue;
         }
 
+        if (jobs.count && (!vmstate_save_in_parallel(se) ||
+                           save_state_priority(jobs.job[0].se) !=
+                           save_state_priority(se))) {
+            ret = vmstate_save_jobs_flush(f, &jobs, vmdesc);
+            if (ret) {
+                return ret;
+            }
+        }
+        if (vmstate_save_in_parallel(se)) {
+            jobs.job[jobs.count++] = (SaveStateJob) { .se = se };
+            continue;
+        }
+
         trace_savevm_section_start(se->idstr, se->section_id);
 
         json_start_object(vmdesc, NULL);
         json_prop_str(vmdesc, "name", se->idstr);
         json_prop_int(vmdesc, "instance_id", se->instance_id);
 
+        start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         save_section_header(f, se, QEMU_VM_SECTION_FULL);
         ret = vmstate_save(f, se, vmdesc);
         if (ret) {
             qemu_file_set_error(f, ret);
             return ret;
         }
+        se->downtime = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start;
+        trace_vmstate_downtime_save(se->idstr, se->instance_id, se->downtime);
         trace_savevm_section_end(se->idstr, se->section_id, 0);
         save_section_footer(f, se);
 
         json_end_object(vmdesc);
     }
+    ret = vmstate_save_jobs_flush(f, &jobs, vmdesc);
+    if (ret) {
+        return ret;
+    }
 
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
@@ -1460,6 +1627,37 @@ flush:
     return 0;
 }
 
+/**
+ * qemu_savevm_downtime_list: time taken by each device once the guest
+ * was stopped
+ *
+ * Returns a list, in saving order, of the devices saved since the last
+ * qemu_savevm_state_setup() while the guest was stopped, with the time
+ * their last save took.
+ */
+DeviceDowntimeList *qemu_savevm_downtime_list(void)
+{
+    DeviceDowntimeList *list = NULL, **tail = &list;
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        DeviceDowntimeList *entry;
+
+        if (se->downtime < 0) {
+            continue;
+        }
+        entry = g_new0(DeviceDowntimeList, 1);
+        entry->value = g_new0(DeviceDowntime, 1);
+        entry->value->idstr = g_strdup(se->idstr);
+        entry->value->instance_id = se->instance_id;
+        entry->value->time = se->downtime;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return list;
+}
+
 /* Give an estimate of the amount left to be transferred,
  * the result is split into the amount for units that can and
  * for units that can't do postcopy.
@@ -1526,6 +1724,7 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
 
     migrate_init(ms);
     memset(&ram_counters, 0, sizeof(ram_counters));
+    memset(&phase_counters, 0, sizeof(phase_counters));
     ms->to_dst_file = f;
 
     qemu_mutex_unlock_iothread();
@@ -1947,6 +2146,9 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
     qemu_sem_wait(&mis->listen_thread_sem);
     qemu_sem_destroy(&mis->listen_thread_sem);
 
+    postcopy_preempt_thread_start(mis);
+    multifd_recv_postcopy_listen();
+
     return 0;
 }
 
@@ -2276,6 +2478,7 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
     char idstr[256];
+    int64_t start;
     int ret;
 
     /* Read section start */
@@ -2322,12 +2525,15 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
                      " device '%s'", instance_id, idstr);
         return ret;
     }
+    trace_vmstate_downtime_load(idstr, instance_id,
+                                qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start);
     if (!check_section_footer(f, se)) {
         return -EINVAL;
     }
@@ -2465,6 +2671,11 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
     qemu_fclose(mis->from_src_file);
     mis->from_src_file = NULL;
 
+    /* Stop the preempt thread; after recovery only the main stream is used */
+    if (mis->postcopy_qemufile_dst) {
+        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+    }
+
     assert(mis->to_src_file);
     qemu_file_shutdown(mis->to_src_file);
     qemu_mutex_lock(&mis->rp_mutex);
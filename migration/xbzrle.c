@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,8 +25,8 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -126,6 +127,127 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/*
+ * Return the index of the first byte at or after @i where the
+ * buffers are different (@equal) or the same (!@equal).
+ */
+static inline int xbzrle_run_end_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                      int i, int slen, bool equal)
+{
+    while (slen - i >= 32) {
+        __m256i o = _mm256_loadu_si256((__m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((__m256i *)(new_buf + i));
+        /* one bit per byte, set where the run goes on */
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (!equal) {
+            mask = ~mask;
+        }
+        if (mask != UINT32_MAX) {
+            return i + ctz32(~mask);
+        }
+        i += 32;
+    }
+    while (i < slen && (old_buf[i] == new_buf[i]) == equal) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Same encoding as xbzrle_encode_buffer_int(), byte for byte, but the
+ * runs are found 32 bytes at a time.
+ */
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    int d = 0, i = 0;
+
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    while (i < slen) {
+        int nzrun_start, zrun_len, nzrun_len;
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        nzrun_start = xbzrle_run_end_avx2(old_buf, new_buf, i, slen, true);
+        zrun_len = nzrun_start - i;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (nzrun_start == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        i = xbzrle_run_end_avx2(old_buf, new_buf, nzrun_start, slen, false);
+        nzrun_len = i - nzrun_start;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + nzrun_start, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+static int (*xbzrle_encode_accel)(uint8_t *, uint8_t *, int,
+                                  uint8_t *, int) = xbzrle_encode_buffer_int;
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) xbzrle_init_accel(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                xbzrle_encode_accel = xbzrle_encode_buffer_avx2;
+            }
+        }
+    }
+}
+#endif /* CONFIG_AVX2_OPT */
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
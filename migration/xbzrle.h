@@ -14,8 +14,15 @@
 #ifndef QEMU_MIGRATION_XBZRLE_H
 #define QEMU_MIGRATION_XBZRLE_H
 
+/*
+ * Encode the difference between @old_buf and @new_buf into @dst, using
+ * the fastest implementation that the host supports.
+ */
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
+/* Portable encoder, whose output every other implementation must match */
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 #endif
@@ -309,6 +309,8 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->encoding_rate);
         monitor_printf(mon, "xbzrle overflow: %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache evictions: %" PRIu64 " pages\n",
+                       info->xbzrle_cache->cache_evictions);
     }
 
     if (info->has_compression) {
@@ -324,6 +326,30 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->has_phases) {
+        monitor_printf(mon, "bitmap sync time: %" PRIu64 " us\n",
+                       info->phases->bitmap_sync_time);
+        monitor_printf(mon, "zero page time: %" PRIu64 " us\n",
+                       info->phases->zero_page_time);
+        monitor_printf(mon, "write wait time: %" PRIu64 " us\n",
+                       info->phases->write_wait_time);
+        monitor_printf(mon, "multifd wait time: %" PRIu64 " us\n",
+                       info->phases->multifd_wait_time);
+    }
+
+    if (info->has_multifd_channels) {
+        MultiFDChannelStatsList *chan;
+
+        for (chan = info->multifd_channels; chan; chan = chan->next) {
+            monitor_printf(mon, "multifd channel %" PRId64 ": %" PRIu64
+                           " kbytes, %" PRIu64 " packets, stall %" PRIu64
+                           " us, compression ratio %0.2f\n",
+                           chan->value->id, chan->value->bytes >> 10,
+                           chan->value->packets, chan->value->stall_time,
+                           chan->value->compression_ratio);
+        }
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
@@ -345,6 +371,16 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+    if (info->has_device_downtime) {
+        DeviceDowntimeList *dev;
+
+        monitor_printf(mon, "device downtime:\n");
+        for (dev = info->device_downtime; dev; dev = dev->next) {
+            monitor_printf(mon, "\t%s/%u: %" PRIu64 " us\n",
+                           dev->value->idstr, dev->value->instance_id,
+                           dev->value->time);
+        }
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
@@ -1921,6 +1957,20 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  poll-hits=%" PRIu64 "\n", value->poll_hits);
+        monitor_printf(mon, "  poll-misses=%" PRIu64 "\n", value->poll_misses);
+        monitor_printf(mon, "  poll-evictions=%" PRIu64 "\n",
+                       value->poll_evictions);
+        monitor_printf(mon, "  thread-pool-threads=%" PRId64 "\n",
+                       value->thread_pool_threads);
+        monitor_printf(mon, "  thread-pool-requests=%" PRIu64 "\n",
+                       value->thread_pool_requests);
+        monitor_printf(mon, "  thread-pool-max-queue-depth=%" PRId64 "\n",
+                       value->thread_pool_max_queue_depth);
+        monitor_printf(mon, "  thread-pool-queue-ns=%" PRIu64 "\n",
+                       value->thread_pool_queue_ns);
+        monitor_printf(mon, "  thread-pool-run-ns=%" PRIu64 "\n",
+                       value->thread_pool_run_ns);
     }
 
     qapi_free_IOThreadInfoList(info_list);
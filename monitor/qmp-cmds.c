@@ -17,6 +17,7 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/option.h"
+#include "qemu/coroutine.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
@@ -70,6 +71,19 @@ UuidInfo *qmp_query_uuid(Error **errp)
     return info;
 }
 
+CoroutinePoolInfo *qmp_query_coroutine_pool(Error **errp)
+{
+    CoroutinePoolInfo *info = g_malloc0(sizeof(*info));
+    CoroutinePoolStats stats;
+
+    qemu_coroutine_get_pool_stats(&stats);
+    info->batch_size = stats.batch_size;
+    info->created = stats.created;
+    info->allocated = stats.allocated;
+    info->freed = stats.freed;
+    return info;
+}
+
 void qmp_quit(Error **errp)
 {
     no_shutdown = 0;
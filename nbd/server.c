@@ -78,9 +78,30 @@ struct NBDRequestData {
     QSIMPLEQ_ENTRY(NBDRequestData) entry;
     NBDClient *client;
     uint8_t *data;
+    uint32_t len; /* size of @data */
     bool complete;
 };
 
+/*
+ * Read payloads of at least this size are sent with MSG_ZEROCOPY; below
+ * it, setting up the page pinning costs more than the copy it saves.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE      (64 * KiB)
+/* Stop sending zero-copy while this much memory waits for completions */
+#define NBD_ZERO_COPY_MAX_PENDING   (64 * MiB)
+
+/*
+ * A request buffer that may still be referenced by the kernel after a
+ * zero-copy send; it is freed once the socket has reported completion
+ * of every send up to @seq.
+ */
+typedef struct NBDZeroCopyBuf {
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) entry;
+    void *buf;
+    size_t size;
+    uint64_t seq;
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -96,6 +117,8 @@ struct NBDExport {
 
     BdrvDirtyBitmap *export_bitmap;
     char *export_bitmap_context;
+
+    bool zero_copy;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -138,6 +161,10 @@ struct NBDClient {
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
+
+    bool zero_copy; /* send large read payloads with MSG_ZEROCOPY */
+    QSIMPLEQ_HEAD(, NBDZeroCopyBuf) zero_copy_bufs;
+    size_t zero_copy_pending; /* total size of zero_copy_bufs */
 };
 
 static void nbd_client_receive_next_request(NBDClient *client);
@@ -1383,6 +1410,29 @@ void nbd_client_get(NBDClient *client)
     client->refcount++;
 }
 
+/*
+ * Free the buffers of zero-copy sends that the kernel is done with.  With
+ * @force, free all of them; only safe once nothing is being sent any more.
+ */
+static void nbd_zero_copy_release(NBDClient *client, bool force)
+{
+    NBDZeroCopyBuf *zbuf;
+
+    if (!force) {
+        qio_channel_socket_zero_copy_reap(client->sioc);
+    }
+
+    while ((zbuf = QSIMPLEQ_FIRST(&client->zero_copy_bufs))) {
+        if (!force && zbuf->seq > client->sioc->zero_copy_sent) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&client->zero_copy_bufs, entry);
+        client->zero_copy_pending -= zbuf->size;
+        qemu_vfree(zbuf->buf);
+        g_free(zbuf);
+    }
+}
+
 void nbd_client_put(NBDClient *client)
 {
     if (--client->refcount == 0) {
@@ -1391,6 +1441,9 @@ void nbd_client_put(NBDClient *client)
          */
         assert(client->closing);
 
+        if (client->zero_copy) {
+            nbd_zero_copy_release(client, true);
+        }
         qio_channel_detach_aio_context(client->ioc);
         object_unref(OBJECT(client->sioc));
         object_unref(OBJECT(client->ioc));
@@ -1442,8 +1495,27 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
+    QIOChannelSocket *sioc = client->sioc;
 
-    if (req->data) {
+    if (client->zero_copy) {
+        nbd_zero_copy_release(client, false);
+    }
+
+    if (req->data && client->zero_copy &&
+        sioc->zero_copy_sent < sioc->zero_copy_queued)
+    {
+        /*
+         * We don't track which send carried which buffer, so conservatively
+         * wait for every zero-copy send issued so far.
+         */
+        NBDZeroCopyBuf *zbuf = g_new(NBDZeroCopyBuf, 1);
+
+        zbuf->buf = req->data;
+        zbuf->size = req->len;
+        zbuf->seq = sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, zbuf, entry);
+        client->zero_copy_pending += zbuf->size;
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
@@ -1516,7 +1588,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     int64_t size;
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
-    bool shared = !exp_args->writable;
+    bool multi_conn;
     int ret;
 
     assert(exp_args->type == BLOCK_EXPORT_TYPE_NBD);
@@ -1564,18 +1636,37 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     QTAILQ_INIT(&exp->clients);
     exp->name = g_strdup(arg->name);
+    exp->zero_copy = arg->has_zero_copy && arg->zero_copy;
     exp->description = g_strdup(arg->description);
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
     }
+
+    /*
+     * All connections to an export share one BlockBackend, so a flush or
+     * FUA write on any connection also covers writes that completed on the
+     * others.  That is what the NBD spec asks of multi-conn servers.
+     */
+    switch (arg->multi_conn) {
+    case ON_OFF_AUTO_ON:
+        multi_conn = true;
+        break;
+    case ON_OFF_AUTO_OFF:
+        multi_conn = false;
+        break;
+    case ON_OFF_AUTO_AUTO:
+    default:
+        multi_conn = readonly;
+        break;
+    }
+    if (multi_conn) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     exp->size = QEMU_ALIGN_DOWN(size, BDRV_SECTOR_SIZE);
 
     if (arg->bitmap) {
@@ -1602,6 +1693,11 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
             goto fail;
         }
 
+        ret = bdrv_dirty_bitmap_load(bm, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+
         if (readonly && bdrv_is_writable(bs) &&
             bdrv_dirty_bitmap_enabled(bm)) {
             ret = -EINVAL;
@@ -1706,8 +1802,16 @@ const BlockExportDriver blk_exp_nbd = {
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
+/*
+ * Send @iov to the client.  If @zero_copy is true, the last element must
+ * point into the request buffer: nbd_request_put() defers its release until
+ * the kernel is done with it, so it may be sent with MSG_ZEROCOPY.  Every
+ * other buffer may be freed as soon as this function returns and is always
+ * copied.
+ */
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
-                                        unsigned niov, Error **errp)
+                                        unsigned niov, bool zero_copy,
+                                        Error **errp)
 {
     int ret;
 
@@ -1715,7 +1819,23 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    if (zero_copy && client->zero_copy && niov > 1 &&
+        iov[niov - 1].iov_len >= NBD_ZERO_COPY_MIN_SIZE &&
+        client->zero_copy_pending < NBD_ZERO_COPY_MAX_PENDING)
+    {
+        qio_channel_set_cork(client->ioc, true);
+        ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+        if (ret == 0) {
+            ret = qio_channel_socket_writev_all_zero_copy(client->sioc,
+                                                          &iov[niov - 1], 1,
+                                                          errp);
+        }
+        qio_channel_set_cork(client->ioc, false);
+        ret = ret < 0 ? -EIO : 0;
+    } else {
+        ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ?
+              -EIO : 0;
+    }
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -1749,7 +1869,8 @@ static int nbd_co_send_simple_reply(NBDClient *client,
                                    len);
     set_be_simple_reply(&reply, nbd_err, handle);
 
-    return nbd_co_send_iov(client, iov, len ? 2 : 1, errp);
+    /* The only payload of a simple reply is read data */
+    return nbd_co_send_iov(client, iov, len ? 2 : 1, true, errp);
 }
 
 static inline void set_be_chunk(NBDStructuredReplyChunk *chunk, uint16_t flags,
@@ -1774,7 +1895,7 @@ static int coroutine_fn nbd_co_send_structured_done(NBDClient *client,
     trace_nbd_co_send_structured_done(handle);
     set_be_chunk(&chunk, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE, handle, 0);
 
-    return nbd_co_send_iov(client, iov, 1, errp);
+    return nbd_co_send_iov(client, iov, 1, false, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
@@ -1798,7 +1919,7 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov(client, iov, 2, true, errp);
 }
 
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
@@ -1822,7 +1943,7 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
     stl_be_p(&chunk.error, nbd_err);
     stw_be_p(&chunk.message_length, iov[1].iov_len);
 
-    return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, errp);
+    return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, false, errp);
 }
 
 /* Do a sparse read and send the structured reply to the client.
@@ -1872,7 +1993,7 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                          handle, sizeof(chunk) - sizeof(chunk.h));
             stq_be_p(&chunk.offset, offset + progress);
             stl_be_p(&chunk.length, pnum);
-            ret = nbd_co_send_iov(client, iov, 1, errp);
+            ret = nbd_co_send_iov(client, iov, 1, false, errp);
         } else {
             ret = blk_pread(exp->common.blk, offset + progress,
                             data + progress, pnum);
@@ -2029,7 +2150,7 @@ static int nbd_co_send_extents(NBDClient *client, uint64_t handle,
                  handle, sizeof(chunk) - sizeof(chunk.h) + iov[1].iov_len);
     stl_be_p(&chunk.context_id, context_id);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov(client, iov, 2, false, errp);
 }
 
 /* Get block status from the exported device and send it to the client */
@@ -2145,6 +2266,7 @@ static int nbd_co_receive_request(NBDRequestData *req, NBDRequest *request,
                 error_setg(errp, "No memory");
                 return -ENOMEM;
             }
+            req->len = request->len;
         }
     }
 
@@ -2509,6 +2631,7 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     Error *local_err = NULL;
 
     qemu_co_mutex_init(&client->send_lock);
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
 
     if (nbd_negotiate(client, &local_err)) {
         if (local_err) {
@@ -2518,6 +2641,16 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /* With TLS, the payload is encrypted into a bounce buffer anyway */
+    if (client->exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        if (qio_channel_socket_set_zero_copy(client->sioc, true,
+                                             &local_err) < 0) {
+            warn_report_err(local_err);
+        } else {
+            client->zero_copy = true;
+        }
+    }
+
     nbd_client_receive_next_request(client);
 }
 
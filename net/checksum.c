@@ -19,24 +19,86 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Sum @len bytes at @buf as native-endian 16-bit words.  The result is
+ * not folded; it is congruent, modulo 0xffff, to the ones' complement sum.
+ * The words are summed 32 bits at a time into 64-bit lanes, which cannot
+ * overflow for any packet size, so no carries need to be tracked.
+ */
+static uint64_t net_checksum_add_words(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+#ifdef __SSE2__
+    if (len >= 32) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc0 = zero, acc1 = zero;
+        uint64_t lanes[2];
+
+        do {
+            __m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+            buf += 32;
+            len -= 32;
+        } while (len >= 32);
+
+        _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+        sum = lanes[0] + lanes[1];
+    }
+#endif
+
+    for (; len >= 4; buf += 4, len -= 4) {
+        sum += ldl_he_p(buf);
+    }
+    if (len >= 2) {
+        sum += lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* The odd byte is the first half of a zero-padded word */
+        uint8_t tail[2] = { buf[0], 0 };
+
+        sum += lduw_he_p(tail);
+    }
+    return sum;
+}
+
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum;
+    uint16_t res;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    if (len <= 0) {
+        return 0;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+
+    sum = net_checksum_add_words(buf, len);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
     }
 
+    /*
+     * The ones' complement sum commutes with byte swapping, so the sum of
+     * native words only needs a swap to become the sum of big-endian
+     * words.  An odd @seq means @buf starts in the middle of a word.
+     */
+    res = be16_to_cpu(sum);
     if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+        res = bswap16(res);
     }
+    return res;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -52,6 +52,13 @@ static NotifierList colo_compare_notifiers =
 #define COLO_COMPARE_FREE_PRIMARY     0x01
 #define COLO_COMPARE_FREE_SECONDARY   0x02
 
+/*
+ * Packet buffers up to COMPARE_POOL_BUF_SIZE bytes, i.e. ordinary frames,
+ * are recycled instead of going back to the allocator.
+ */
+#define COMPARE_POOL_BUF_SIZE 2048
+#define COMPARE_POOL_SIZE 512
+
 #define REGULAR_PACKET_CHECK_MS 3000
 #define DEFAULT_TIME_OUT_MS 3000
 
@@ -131,6 +138,13 @@ struct CompareState {
     /* Record the connection without repetition */
     GHashTable *connection_track_table;
 
+    /*
+     * Free packet buffers of COMPARE_POOL_BUF_SIZE bytes.  Only used from
+     * the compare thread, or once it is done with this object.
+     */
+    uint8_t *buf_pool[COMPARE_POOL_SIZE];
+    unsigned n_buf_pool;
+
     IOThread *iothread;
     GMainContext *worker_context;
     QEMUTimer *packet_check_timer;
@@ -162,6 +176,45 @@ static int compare_chr_send(CompareState *s,
                             bool notify_remote_frame,
                             bool zero_copy);
 
+/*
+ * Buffers of up to COMPARE_POOL_BUF_SIZE bytes must be allocated here, so
+ * that compare_buf_free() can recycle them.  They are g_malloc()ed, so
+ * whoever ends up with one may still g_free() it.
+ */
+static uint8_t *compare_buf_alloc(CompareState *s, uint32_t size)
+{
+    if (size > COMPARE_POOL_BUF_SIZE) {
+        return g_malloc(size);
+    }
+    if (s->n_buf_pool) {
+        return s->buf_pool[--s->n_buf_pool];
+    }
+    return g_malloc(COMPARE_POOL_BUF_SIZE);
+}
+
+static void compare_buf_free(CompareState *s, uint8_t *buf, uint32_t size)
+{
+    if (size <= COMPARE_POOL_BUF_SIZE && s->n_buf_pool < COMPARE_POOL_SIZE) {
+        s->buf_pool[s->n_buf_pool++] = buf;
+    } else {
+        g_free(buf);
+    }
+}
+
+static Packet *compare_packet_new(CompareState *s, SocketReadState *rs)
+{
+    uint8_t *buf = compare_buf_alloc(s, rs->packet_len);
+
+    memcpy(buf, rs->buf, rs->packet_len);
+    return packet_new_nocopy(buf, rs->packet_len, rs->vnet_hdr_len);
+}
+
+static void compare_packet_destroy(CompareState *s, Packet *pkt)
+{
+    compare_buf_free(s, pkt->data, pkt->size);
+    packet_destroy_partial(pkt, NULL);
+}
+
 static bool packet_matches_str(const char *str,
                                const uint8_t *buf,
                                uint32_t packet_len)
@@ -253,17 +306,13 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     int ret;
 
     if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf,
-                         s->pri_rs.packet_len,
-                         s->pri_rs.vnet_hdr_len);
+        pkt = compare_packet_new(s, &s->pri_rs);
     } else {
-        pkt = packet_new(s->sec_rs.buf,
-                         s->sec_rs.packet_len,
-                         s->sec_rs.vnet_hdr_len);
+        pkt = compare_packet_new(s, &s->sec_rs);
     }
 
     if (parse_packet_early(pkt)) {
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
         pkt = NULL;
         return -1;
     }
@@ -287,7 +336,7 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     if (!ret) {
         trace_colo_compare_drop_packet(colo_mode[mode],
             "queue size too big, drop packet");
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
         pkt = NULL;
     }
 
@@ -442,7 +491,7 @@ sec:
     }
 
     if (spkt->tcp_seq == spkt->seq_end) {
-        packet_destroy(spkt, NULL);
+        compare_packet_destroy(s, spkt);
         if (!ppkt) {
             goto pri;
         } else {
@@ -451,7 +500,7 @@ sec:
     } else {
         if (conn->compare_seq && !after(spkt->seq_end, conn->compare_seq)) {
             trace_colo_compare_main("sec: this packet has compared");
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             if (!ppkt) {
                 goto pri;
             } else {
@@ -483,13 +532,13 @@ sec:
         }
         if (mark == COLO_COMPARE_FREE_SECONDARY) {
             conn->compare_seq = spkt->seq_end;
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             goto sec;
         }
         if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
             conn->compare_seq = ppkt->seq_end;
             colo_release_primary_pkt(s, ppkt);
-            packet_destroy(spkt, NULL);
+            compare_packet_destroy(s, spkt);
             goto pri;
         }
     } else {
@@ -689,6 +738,7 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
         if (result) {
             colo_release_primary_pkt(s, pkt);
             g_queue_remove(&conn->secondary_list, result->data);
+            compare_packet_destroy(s, result->data);
         } else {
             /*
              * If one packet arrive late, the secondary_list or
@@ -745,7 +795,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
         ret = qemu_chr_fe_write_all(sendco->chr, (uint8_t *)&len, sizeof(len));
 
         if (ret != sizeof(len)) {
-            g_free(entry->buf);
+            compare_buf_free(s, entry->buf, entry->size);
             g_slice_free(SendEntry, entry);
             goto err;
         }
@@ -762,7 +812,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
                                         sizeof(len));
 
             if (ret != sizeof(len)) {
-                g_free(entry->buf);
+                compare_buf_free(s, entry->buf, entry->size);
                 g_slice_free(SendEntry, entry);
                 goto err;
             }
@@ -773,12 +823,12 @@ static void coroutine_fn _compare_chr_send(void *opaque)
                                     entry->size);
 
         if (ret != entry->size) {
-            g_free(entry->buf);
+            compare_buf_free(s, entry->buf, entry->size);
             g_slice_free(SendEntry, entry);
             goto err;
         }
 
-        g_free(entry->buf);
+        compare_buf_free(s, entry->buf, entry->size);
         g_slice_free(SendEntry, entry);
     }
 
@@ -788,7 +838,7 @@ static void coroutine_fn _compare_chr_send(void *opaque)
 err:
     while (!g_queue_is_empty(&sendco->send_list)) {
         SendEntry *entry = g_queue_pop_tail(&sendco->send_list);
-        g_free(entry->buf);
+        compare_buf_free(s, entry->buf, entry->size);
         g_slice_free(SendEntry, entry);
     }
     sendco->ret = ret < 0 ? ret : -EIO;
@@ -824,7 +874,7 @@ static int compare_chr_send(CompareState *s,
     if (zero_copy) {
         entry->buf = buf;
     } else {
-        entry->buf = g_malloc(size);
+        entry->buf = compare_buf_alloc(s, size);
         memcpy(entry->buf, buf, size);
     }
     g_queue_push_head(&sendco->send_list, entry);
@@ -1367,7 +1417,7 @@ static void colo_flush_packets(void *opaque, void *user_data)
     }
     while (!g_queue_is_empty(&conn->secondary_list)) {
         pkt = g_queue_pop_head(&conn->secondary_list);
-        packet_destroy(pkt, NULL);
+        compare_packet_destroy(s, pkt);
     }
 }
 
@@ -1465,6 +1515,10 @@ static void colo_compare_finalize(Object *obj)
         g_hash_table_destroy(s->connection_track_table);
     }
 
+    while (s->n_buf_pool) {
+        g_free(s->buf_pool[--s->n_buf_pool]);
+    }
+
     object_unref(OBJECT(s->iothread));
 
     g_free(s->pri_indev);
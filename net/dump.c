@@ -30,6 +30,7 @@
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "qapi/visitor.h"
 #include "net/filter.h"
@@ -39,6 +40,25 @@ typedef struct DumpState {
     int64_t start_ts;
     int fd;
     int pcap_caplen;
+    /* Capture one packet out of @sample */
+    uint32_t sample;
+    uint32_t sample_count;
+    /* Packets not captured because the ring was full */
+    uint64_t dropped;
+
+    /*
+     * With a ring, the datapath only copies records into it and a thread
+     * writes them out to @fd.  Bytes [ring_tail, ring_head) are pending.
+     */
+    uint8_t *ring;
+    size_t ring_size;
+    uint64_t ring_head;
+    uint64_t ring_tail;
+    bool ring_stop;
+    bool ring_error;
+    QemuMutex ring_lock;
+    QemuCond ring_cond;
+    QemuThread ring_thread;
 } DumpState;
 
 #define PCAP_MAGIC 0xa1b2c3d4
@@ -62,6 +82,78 @@ struct pcap_sf_pkthdr {
     uint32_t len;
 };
 
+/* Copy @len bytes from @iov, starting at @offset, to the ring at @pos */
+static void dump_ring_copy(DumpState *s, uint64_t pos,
+                           const struct iovec *iov, int cnt,
+                           size_t offset, size_t len)
+{
+    size_t start = pos % s->ring_size;
+    size_t first = MIN(len, s->ring_size - start);
+
+    iov_to_buf(iov, cnt, offset, s->ring + start, first);
+    iov_to_buf(iov, cnt, offset + first, s->ring, len - first);
+}
+
+static void dump_ring_put(DumpState *s, struct pcap_sf_pkthdr *hdr,
+                          const struct iovec *iov, int cnt)
+{
+    struct iovec hdr_iov = { .iov_base = hdr, .iov_len = sizeof(*hdr) };
+    size_t len = sizeof(*hdr) + hdr->caplen;
+
+    qemu_mutex_lock(&s->ring_lock);
+    if (s->ring_error ||
+        s->ring_head - s->ring_tail + len > s->ring_size) {
+        /* Never wait for the writer; the guest must not slow down */
+        s->dropped++;
+        qemu_mutex_unlock(&s->ring_lock);
+        return;
+    }
+
+    dump_ring_copy(s, s->ring_head, &hdr_iov, 1, 0, sizeof(*hdr));
+    dump_ring_copy(s, s->ring_head + sizeof(*hdr), iov, cnt, 0, hdr->caplen);
+    s->ring_head += len;
+    qemu_cond_signal(&s->ring_cond);
+    qemu_mutex_unlock(&s->ring_lock);
+}
+
+static void *dump_ring_thread(void *opaque)
+{
+    DumpState *s = opaque;
+
+    qemu_mutex_lock(&s->ring_lock);
+    while (true) {
+        size_t len, start, first;
+        bool ok;
+
+        while (s->ring_head == s->ring_tail && !s->ring_stop) {
+            qemu_cond_wait(&s->ring_cond, &s->ring_lock);
+        }
+        if (s->ring_head == s->ring_tail) {
+            break;
+        }
+
+        len = s->ring_head - s->ring_tail;
+        start = s->ring_tail % s->ring_size;
+        first = MIN(len, s->ring_size - start);
+
+        /* The producer only writes outside of [ring_tail, ring_head) */
+        qemu_mutex_unlock(&s->ring_lock);
+        ok = qemu_write_full(s->fd, s->ring + start, first) == first &&
+             qemu_write_full(s->fd, s->ring, len - first) == len - first;
+        qemu_mutex_lock(&s->ring_lock);
+
+        if (!ok) {
+            error_report("network dump write error - stopping dump");
+            s->ring_error = true;
+            break;
+        }
+        s->ring_tail += len;
+    }
+    qemu_mutex_unlock(&s->ring_lock);
+
+    return NULL;
+}
+
 static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt)
 {
     struct pcap_sf_pkthdr hdr;
@@ -75,6 +167,10 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt)
         return size;
     }
 
+    if (s->sample > 1 && s->sample_count++ % s->sample) {
+        return size;
+    }
+
     ts = qemu_clock_get_us(QEMU_CLOCK_VIRTUAL);
     caplen = size > s->pcap_caplen ? s->pcap_caplen : size;
 
@@ -83,6 +179,11 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt)
     hdr.caplen = caplen;
     hdr.len = size;
 
+    if (s->ring) {
+        dump_ring_put(s, &hdr, iov, cnt);
+        return size;
+    }
+
     dumpiov[0].iov_base = &hdr;
     dumpiov[0].iov_len = sizeof(hdr);
     cnt = iov_copy(&dumpiov[1], cnt, iov, cnt, 0, caplen);
@@ -98,12 +199,30 @@ static ssize_t dump_receive_iov(DumpState *s, const struct iovec *iov, int cnt)
 
 static void dump_cleanup(DumpState *s)
 {
+    if (s->ring) {
+        /* Let the thread write out what is left */
+        qemu_mutex_lock(&s->ring_lock);
+        s->ring_stop = true;
+        qemu_cond_signal(&s->ring_cond);
+        qemu_mutex_unlock(&s->ring_lock);
+        qemu_thread_join(&s->ring_thread);
+
+        qemu_cond_destroy(&s->ring_cond);
+        qemu_mutex_destroy(&s->ring_lock);
+        g_free(s->ring);
+        s->ring = NULL;
+    }
+
     close(s->fd);
     s->fd = -1;
 }
 
+/*
+ * With @ring_size, packets are queued in a ring of that many bytes and
+ * written out by a thread; those that do not fit are dropped.
+ */
 static int net_dump_state_init(DumpState *s, const char *filename,
-                               int len, Error **errp)
+                               int len, size_t ring_size, Error **errp)
 {
     struct pcap_file_hdr hdr;
     struct tm tm;
@@ -135,6 +254,17 @@ static int net_dump_state_init(DumpState *s, const char *filename,
     qemu_get_timedate(&tm, 0);
     s->start_ts = mktime(&tm);
 
+    if (ring_size) {
+        s->ring = g_malloc(ring_size);
+        s->ring_size = ring_size;
+        s->ring_head = s->ring_tail = 0;
+        s->ring_stop = s->ring_error = false;
+        qemu_mutex_init(&s->ring_lock);
+        qemu_cond_init(&s->ring_cond);
+        qemu_thread_create(&s->ring_thread, "net-dump", dump_ring_thread,
+                           s, QEMU_THREAD_JOINABLE);
+    }
+
     return 0;
 }
 
@@ -147,6 +277,7 @@ struct NetFilterDumpState {
     DumpState ds;
     char *filename;
     uint32_t maxlen;
+    uint32_t ring_size;
 };
 
 static ssize_t filter_dump_receive_iov(NetFilterState *nf, NetClientState *sndr,
@@ -175,7 +306,15 @@ static void filter_dump_setup(NetFilterState *nf, Error **errp)
         return;
     }
 
-    net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen, errp);
+    if (nfds->ring_size && nfds->ring_size < sizeof(struct pcap_sf_pkthdr) +
+                                             nfds->maxlen) {
+        error_setg(errp, "dump filter 'ring-size' must fit a packet of "
+                   "'maxlen' bytes");
+        return;
+    }
+
+    net_dump_state_init(&nfds->ds, nfds->filename, nfds->maxlen,
+                        nfds->ring_size, errp);
 }
 
 static void filter_dump_get_maxlen(Object *obj, Visitor *v, const char *name,
@@ -204,6 +343,72 @@ static void filter_dump_set_maxlen(Object *obj, Visitor *v, const char *name,
     nfds->maxlen = value;
 }
 
+static void filter_dump_get_ring_size(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_ring_size(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    nfds->ring_size = value;
+}
+
+static void filter_dump_get_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value = nfds->ds.sample;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void filter_dump_set_sample(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%u'",
+                   object_get_typename(obj), name, value);
+        return;
+    }
+    nfds->ds.sample = value;
+}
+
+static void filter_dump_get_dropped(Object *obj, Visitor *v, const char *name,
+                                    void *opaque, Error **errp)
+{
+    NetFilterDumpState *nfds = FILTER_DUMP(obj);
+    uint64_t value;
+
+    if (nfds->ds.ring) {
+        qemu_mutex_lock(&nfds->ds.ring_lock);
+        value = nfds->ds.dropped;
+        qemu_mutex_unlock(&nfds->ds.ring_lock);
+    } else {
+        value = nfds->ds.dropped;
+    }
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static char *file_dump_get_filename(Object *obj, Error **errp)
 {
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
@@ -224,9 +429,16 @@ static void filter_dump_instance_init(Object *obj)
     NetFilterDumpState *nfds = FILTER_DUMP(obj);
 
     nfds->maxlen = 65536;
+    nfds->ds.sample = 1;
 
     object_property_add(obj, "maxlen", "uint32", filter_dump_get_maxlen,
                         filter_dump_set_maxlen, NULL, NULL);
+    object_property_add(obj, "ring-size", "uint32", filter_dump_get_ring_size,
+                        filter_dump_set_ring_size, NULL, NULL);
+    object_property_add(obj, "sample", "uint32", filter_dump_get_sample,
+                        filter_dump_set_sample, NULL, NULL);
+    object_property_add(obj, "dropped", "uint64", filter_dump_get_dropped,
+                        NULL, NULL, NULL);
     object_property_add_str(obj, "file", file_dump_get_filename,
                             file_dump_set_filename);
 }
@@ -303,9 +303,9 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
         if (sender == nf->netdev) {
             /* NET_FILTER_DIRECTION_TX */
             if (!handle_primary_tcp_pkt(s, conn, pkt, &key)) {
-                qemu_net_queue_send(s->incoming_queue, sender, 0,
-                (const uint8_t *)pkt->data, pkt->size, NULL);
-                packet_destroy(pkt, NULL);
+                qemu_net_queue_send_owned(s->incoming_queue, sender, 0,
+                                          pkt->data, pkt->size, NULL);
+                packet_destroy_partial(pkt, NULL);
                 pkt = NULL;
                 /*
                  * We block the packet here,after rewrite pkt
@@ -316,9 +316,9 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
         } else {
             /* NET_FILTER_DIRECTION_RX */
             if (!handle_secondary_tcp_pkt(s, conn, pkt, &key)) {
-                qemu_net_queue_send(s->incoming_queue, sender, 0,
-                (const uint8_t *)pkt->data, pkt->size, NULL);
-                packet_destroy(pkt, NULL);
+                qemu_net_queue_send_owned(s->incoming_queue, sender, 0,
+                                          pkt->data, pkt->size, NULL);
+                packet_destroy_partial(pkt, NULL);
                 pkt = NULL;
                 /*
                  * We block the packet here,after rewrite pkt
@@ -267,6 +267,27 @@ NetClientState *qemu_new_net_client(NetClientInfo *info,
 
     assert(info->size >= sizeof(NetClientState));
 
+    nc = g_malloc0(info->size);
+    qemu_net_client_setup(nc, info, peer, model, name,
+                          qemu_net_client_destructor);
+    nc->is_datapath = true;
+
+    return nc;
+}
+
+/*
+ * Like qemu_new_net_client(), for a client that only provides the
+ * control virtqueue of a multiqueue backend.
+ */
+NetClientState *qemu_new_net_control_client(NetClientInfo *info,
+                                            NetClientState *peer,
+                                            const char *model,
+                                            const char *name)
+{
+    NetClientState *nc;
+
+    assert(info->size >= sizeof(NetClientState));
+
     nc = g_malloc0(info->size);
     qemu_net_client_setup(nc, info, peer, model, name,
                           qemu_net_client_destructor);
@@ -523,6 +544,25 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+bool qemu_has_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move the backend's file descriptor handlers to @ctx, or back to the main
+ * loop if @ctx is NULL.  Once moved, the backend runs its handlers with
+ * @ctx acquired.
+ */
+void qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -959,6 +999,12 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
+#ifdef CONFIG_POSIX
+        [NET_CLIENT_DRIVER_PASST]     = net_init_passt,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1047,8 +1093,12 @@ static void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
+        "passt",
 #endif
     };
 
@@ -0,0 +1,381 @@
+/*
+ * passt network backend
+ *
+ * passt is an unprivileged user-mode networking daemon: it terminates
+ * the guest's L4 flows on host sockets.  QEMU talks to it over a UNIX
+ * stream socket, with each frame preceded by its length as a 32-bit big
+ * endian value, like "-netdev socket" does.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "clients.h"
+#include "util.h"
+#include "monitor/monitor.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/sockets.h"
+#include "block/aio.h"
+
+/* Bytes read from the socket at once, up to this many frames each time */
+#define PASST_RX_BUF_SIZE (4 * NET_BUFSIZE)
+
+#define PASST_HDR_SIZE 4
+
+typedef struct PasstState {
+    NetClientState nc;
+    int fd;
+    bool read_poll;
+    bool write_poll;
+
+    /*
+     * Data read from the socket; frames are passed to the peer straight
+     * from here.  [rx_off, rx_len) has not been passed yet.
+     */
+    uint8_t *rx_buf;
+    size_t rx_off;
+    size_t rx_len;
+
+    /* What the socket did not take of the last frame sent to it */
+    uint8_t *tx_buf;
+    size_t tx_off;
+    size_t tx_len;
+
+    /* IOThread the backend is served from, or NULL for the main loop */
+    AioContext *ctx;
+} PasstState;
+
+static void passt_send(void *opaque);
+static void passt_writable(void *opaque);
+
+static void passt_update_fd_handler(PasstState *s)
+{
+    IOHandler *fd_read = s->read_poll ? passt_send : NULL;
+    IOHandler *fd_write = s->write_poll ? passt_writable : NULL;
+
+    if (s->fd < 0) {
+        return;
+    }
+
+    net_set_fd_handler(s->ctx, s->fd, fd_read, fd_write, NULL, s);
+}
+
+static void passt_read_poll(PasstState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        passt_update_fd_handler(s);
+    }
+}
+
+static void passt_write_poll(PasstState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        passt_update_fd_handler(s);
+    }
+}
+
+static void passt_poll(NetClientState *nc, bool enable)
+{
+    PasstState *s = DO_UPCAST(PasstState, nc, nc);
+
+    passt_read_poll(s, enable);
+    passt_write_poll(s, enable && s->tx_len);
+}
+
+static void passt_disconnect(PasstState *s)
+{
+    passt_poll(&s->nc, false);
+    closesocket(s->fd);
+    s->fd = -1;
+    s->rx_off = s->rx_len = 0;
+    s->tx_off = s->tx_len = 0;
+    s->nc.link_down = true;
+    snprintf(s->nc.info_str, sizeof(s->nc.info_str), "passt: disconnected");
+}
+
+/* Returns false if the socket is still busy with an earlier frame */
+static bool passt_flush_tx(PasstState *s)
+{
+    ssize_t len;
+
+    while (s->tx_off < s->tx_len) {
+        len = send(s->fd, s->tx_buf + s->tx_off, s->tx_len - s->tx_off, 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                passt_write_poll(s, true);
+                return false;
+            }
+            /* The frame is lost; the read side notices the hang up */
+            break;
+        }
+        s->tx_off += len;
+    }
+
+    s->tx_off = s->tx_len = 0;
+    passt_write_poll(s, false);
+    return true;
+}
+
+static void passt_writable(void *opaque)
+{
+    PasstState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+
+    if (passt_flush_tx(s)) {
+        qemu_flush_queued_packets(&s->nc);
+    }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static ssize_t passt_receive_iov(NetClientState *nc,
+                                 const struct iovec *iov, int iovcnt)
+{
+    PasstState *s = DO_UPCAST(PasstState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    struct iovec vec[IOV_MAX];
+    uint32_t hdr;
+    ssize_t len;
+    size_t total = PASST_HDR_SIZE + size;
+
+    if (s->fd < 0 || size > NET_BUFSIZE) {
+        return size;
+    }
+    if (s->tx_len && !passt_flush_tx(s)) {
+        /* Queued by the caller until passt_writable() */
+        return 0;
+    }
+
+    /* Write the frame straight from the peer's buffers */
+    hdr = cpu_to_be32(size);
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = PASST_HDR_SIZE;
+    iovcnt = iov_copy(&vec[1], ARRAY_SIZE(vec) - 1, iov, iovcnt, 0, size);
+
+    do {
+        len = writev(s->fd, vec, iovcnt + 1);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            passt_write_poll(s, true);
+            return 0;
+        }
+        return size;
+    }
+
+    if ((size_t)len < total) {
+        /*
+         * Part of the frame is already in the stream, so the rest must
+         * follow before anything else: keep a copy of it.
+         */
+        s->tx_len = iov_to_buf(vec, iovcnt + 1, len, s->tx_buf, total - len);
+        s->tx_off = 0;
+        passt_flush_tx(s);
+    }
+
+    return size;
+}
+
+static ssize_t passt_receive(NetClientState *nc,
+                             const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return passt_receive_iov(nc, &iov, 1);
+}
+
+static void passt_send_completed(NetClientState *nc, ssize_t len);
+
+/*
+ * Pass the complete frames in rx_buf to the peer.  Returns false if the
+ * peer stopped taking them, or if the stream is corrupt.
+ */
+static bool passt_send_frames(PasstState *s)
+{
+    while (s->rx_len - s->rx_off >= PASST_HDR_SIZE) {
+        uint8_t *frame = s->rx_buf + s->rx_off;
+        uint32_t size = ldl_be_p(frame);
+
+        if (size == 0 || size > NET_BUFSIZE) {
+            error_report("passt: invalid frame size %" PRIu32
+                         ", disconnecting", size);
+            passt_disconnect(s);
+            return false;
+        }
+        if (s->rx_len - s->rx_off < PASST_HDR_SIZE + size) {
+            break;
+        }
+
+        s->rx_off += PASST_HDR_SIZE + size;
+
+        /* A frame the peer cannot take now is copied to its queue */
+        if (!qemu_send_packet_async(&s->nc, frame + PASST_HDR_SIZE, size,
+                                    passt_send_completed)) {
+            passt_read_poll(s, false);
+            return false;
+        }
+    }
+
+    /* Move the start of a partial frame to the front for the next read */
+    if (s->rx_off) {
+        memmove(s->rx_buf, s->rx_buf + s->rx_off, s->rx_len - s->rx_off);
+        s->rx_len -= s->rx_off;
+        s->rx_off = 0;
+    }
+    return true;
+}
+
+static void passt_send_completed(NetClientState *nc, ssize_t len)
+{
+    PasstState *s = DO_UPCAST(PasstState, nc, nc);
+
+    if (s->fd >= 0 && passt_send_frames(s)) {
+        passt_read_poll(s, true);
+    }
+}
+
+static void passt_send(void *opaque)
+{
+    PasstState *s = opaque;
+    AioContext *ctx = s->ctx;
+    ssize_t len;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+
+    /* One read usually brings in a batch of frames */
+    do {
+        len = recv(s->fd, s->rx_buf + s->rx_len,
+                   PASST_RX_BUF_SIZE - s->rx_len, 0);
+    } while (len < 0 && errno == EINTR);
+
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        error_report("passt: connection %s, disconnecting",
+                     len ? "failed" : "closed by passt");
+        passt_disconnect(s);
+    } else if (len > 0) {
+        s->rx_len += len;
+        passt_send_frames(s);
+    }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static void passt_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    PasstState *s = DO_UPCAST(PasstState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_DRIVER_PASST);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    net_fd_set_aio_context(s->fd, &s->ctx, ctx);
+    passt_update_fd_handler(s);
+}
+
+static void passt_cleanup(NetClientState *nc)
+{
+    PasstState *s = DO_UPCAST(PasstState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->fd >= 0) {
+        if (s->ctx) {
+            /* Wait for the handlers to finish if they are running */
+            aio_context_acquire(s->ctx);
+            passt_poll(nc, false);
+            aio_context_release(s->ctx);
+        } else {
+            passt_poll(nc, false);
+        }
+        closesocket(s->fd);
+        s->fd = -1;
+    }
+    s->ctx = NULL;
+
+    g_free(s->rx_buf);
+    s->rx_buf = NULL;
+    g_free(s->tx_buf);
+    s->tx_buf = NULL;
+}
+
+static NetClientInfo net_passt_info = {
+    .type = NET_CLIENT_DRIVER_PASST,
+    .size = sizeof(PasstState),
+    .receive = passt_receive,
+    .receive_iov = passt_receive_iov,
+    .poll = passt_poll,
+    .cleanup = passt_cleanup,
+    .set_aio_context = passt_set_aio_context,
+};
+
+/*
+ * The exported init function.
+ *
+ * ... -netdev passt,path=/tmp/passt_1.socket
+ */
+int net_init_passt(const Netdev *netdev,
+                   const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevPasstOptions *opts = &netdev->u.passt;
+    NetClientState *nc;
+    PasstState *s;
+    int fd;
+
+    if (opts->has_path == opts->has_fd) {
+        error_setg(errp, "exactly one of 'path' and 'fd' is required");
+        return -1;
+    }
+
+    if (opts->has_path) {
+        fd = unix_connect(opts->path, errp);
+    } else {
+        fd = monitor_fd_param(cur_mon, opts->fd, errp);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    qemu_set_nonblock(fd);
+
+    nc = qemu_new_net_client(&net_passt_info, peer, "passt", name);
+    s = DO_UPCAST(PasstState, nc, nc);
+    s->fd = fd;
+    s->rx_buf = g_malloc(PASST_RX_BUF_SIZE);
+    s->tx_buf = g_malloc(PASST_HDR_SIZE + NET_BUFSIZE);
+
+    if (opts->has_path) {
+        snprintf(nc->info_str, sizeof(nc->info_str), "passt: path=%s",
+                 opts->path);
+    } else {
+        snprintf(nc->info_str, sizeof(nc->info_str), "passt: fd=%d", fd);
+    }
+
+    passt_read_poll(s, true);
+    return 0;
+}
@@ -38,15 +38,27 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Packets that fit in NET_QUEUE_PACKET_SIZE bytes are recycled through a
+ * per-queue pool instead of going back to the allocator, so that a backlog
+ * of ordinary frames does not cost a malloc/free pair per packet.
  */
 
+/* Room of the pooled packets: a full-sized frame plus a vnet header */
+#define NET_QUEUE_PACKET_SIZE   2048
+#define NET_QUEUE_POOL_SIZE     256
+
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
-    uint8_t data[];
+    /* Either @inline_data or a buffer handed over by the sender */
+    uint8_t *data;
+    /* Room in @inline_data */
+    size_t capacity;
+    uint8_t inline_data[];
 };
 
 struct NetQueue {
@@ -57,6 +69,10 @@ struct NetQueue {
 
     QTAILQ_HEAD(, NetPacket) packets;
 
+    /* Recycled packets with NET_QUEUE_PACKET_SIZE bytes of room */
+    QTAILQ_HEAD(, NetPacket) free_packets;
+    uint32_t nq_free;
+
     unsigned delivering : 1;
 };
 
@@ -72,18 +88,65 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    QTAILQ_INIT(&queue->free_packets);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+/* Returns a packet with room for @size bytes of inline data */
+static NetPacket *qemu_net_queue_packet_new(NetQueue *queue, size_t size)
+{
+    NetPacket *packet;
+    size_t capacity = size;
+
+    if (size <= NET_QUEUE_PACKET_SIZE) {
+        packet = QTAILQ_FIRST(&queue->free_packets);
+        if (packet) {
+            QTAILQ_REMOVE(&queue->free_packets, packet, entry);
+            queue->nq_free--;
+            return packet;
+        }
+        capacity = NET_QUEUE_PACKET_SIZE;
+    }
+
+    packet = g_malloc(sizeof(NetPacket) + capacity);
+    packet->data = packet->inline_data;
+    packet->capacity = capacity;
+    return packet;
+}
+
+static void qemu_net_queue_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->data != packet->inline_data) {
+        g_free(packet->data);
+        packet->data = packet->inline_data;
+    }
+
+    if (packet->capacity == NET_QUEUE_PACKET_SIZE &&
+        queue->nq_free < NET_QUEUE_POOL_SIZE) {
+        QTAILQ_INSERT_HEAD(&queue->free_packets, packet, entry);
+        queue->nq_free++;
+    } else {
+        g_free(packet);
+    }
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
 
     QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         QTAILQ_REMOVE(&queue->packets, packet, entry);
+        if (packet->data != packet->inline_data) {
+            g_free(packet->data);
+        }
+        g_free(packet);
+    }
+
+    QTAILQ_FOREACH_SAFE(packet, &queue->free_packets, entry, next) {
+        QTAILQ_REMOVE(&queue->free_packets, packet, entry);
         g_free(packet);
     }
 
@@ -102,7 +165,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = qemu_net_queue_packet_new(queue, size);
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
@@ -113,6 +176,32 @@ static void qemu_net_queue_append(NetQueue *queue,
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
+/* Queue @buf itself, which the queue now owns */
+static void qemu_net_queue_append_owned(NetQueue *queue,
+                                        NetClientState *sender,
+                                        unsigned flags,
+                                        uint8_t *buf,
+                                        size_t size,
+                                        NetPacketSent *sent_cb)
+{
+    NetPacket *packet;
+
+    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        g_free(buf);
+        return; /* drop if queue full and no callback */
+    }
+    packet = g_malloc(sizeof(NetPacket));
+    packet->sender = sender;
+    packet->flags = flags;
+    packet->size = size;
+    packet->sent_cb = sent_cb;
+    packet->data = buf;
+    packet->capacity = 0;
+
+    queue->nq_count++;
+    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+}
+
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
                                unsigned flags,
@@ -131,7 +220,7 @@ void qemu_net_queue_append_iov(NetQueue *queue,
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = qemu_net_queue_packet_new(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -207,6 +296,32 @@ ssize_t qemu_net_queue_send(NetQueue *queue,
     return ret;
 }
 
+ssize_t qemu_net_queue_send_owned(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  uint8_t *data,
+                                  size_t size,
+                                  NetPacketSent *sent_cb)
+{
+    ssize_t ret;
+
+    if (queue->delivering || !qemu_can_send_packet(sender)) {
+        qemu_net_queue_append_owned(queue, sender, flags, data, size, sent_cb);
+        return 0;
+    }
+
+    ret = qemu_net_queue_deliver(queue, sender, flags, data, size);
+    if (ret == 0) {
+        qemu_net_queue_append_owned(queue, sender, flags, data, size, sent_cb);
+        return 0;
+    }
+
+    g_free(data);
+    qemu_net_queue_flush(queue);
+
+    return ret;
+}
+
 ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 NetClientState *sender,
                                 unsigned flags,
@@ -243,7 +358,7 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_queue_packet_free(queue, packet);
         }
     }
 }
@@ -276,7 +391,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_queue_packet_free(queue, packet);
     }
     return true;
 }
@@ -0,0 +1,327 @@
+/*
+ * Batched tap I/O through io_uring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "net/net.h"
+#include "tap_int.h"
+
+/* Packets in flight per direction */
+#define TAP_URING_BATCH 32
+
+/*
+ * user_data of the requests: RX slots are 0..TAP_URING_BATCH-1, TX slots
+ * follow, and cancellations use TAP_URING_CANCEL.
+ */
+#define TAP_URING_TX        TAP_URING_BATCH
+#define TAP_URING_CANCEL    (2 * TAP_URING_BATCH)
+
+struct TapUring {
+    int fd;
+    AioContext *ctx;
+    struct io_uring ring;
+
+    /* Submits the requests queued since the last submission */
+    QEMUBH *submit_bh;
+
+    TapUringReceive *receive;
+    TapUringWritable *writable;
+    void *opaque;
+
+    bool reading;
+    /* A read failed; do not post more until reading is re-enabled */
+    bool rx_stalled;
+    uint8_t *rx_buf[TAP_URING_BATCH];
+    struct iovec rx_iov[TAP_URING_BATCH];
+    bool rx_busy[TAP_URING_BATCH];
+    unsigned rx_inflight;
+
+    /* tap_uring_write() refused a packet for lack of a free slot */
+    bool tx_blocked;
+    uint8_t *tx_buf[TAP_URING_BATCH];
+    struct iovec tx_iov[TAP_URING_BATCH];
+    bool tx_busy[TAP_URING_BATCH];
+    unsigned tx_inflight;
+};
+
+/* Outside of IOThreads, behave like qemu_set_fd_handler() */
+static AioContext *tap_uring_get_aio_context(TapUring *u)
+{
+    return u->ctx ? u->ctx : iohandler_get_aio_context();
+}
+
+static struct io_uring_sqe *tap_uring_get_sqe(TapUring *u)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+
+    /* The ring has room for every slot of both directions */
+    assert(sqe);
+    return sqe;
+}
+
+static void tap_uring_submit(TapUring *u)
+{
+    int ret;
+
+    if (!io_uring_sq_ready(&u->ring)) {
+        return;
+    }
+
+    do {
+        ret = io_uring_submit(&u->ring);
+    } while (ret == -EINTR);
+
+    if (ret == -EAGAIN || ret == -EBUSY) {
+        /* The kernel is short of resources; try again later */
+        qemu_bh_schedule(u->submit_bh);
+    } else if (ret < 0) {
+        error_report("tap: io_uring submission failed: %s", strerror(-ret));
+    }
+}
+
+static void tap_uring_submit_bh(void *opaque)
+{
+    TapUring *u = opaque;
+
+    tap_uring_submit(u);
+}
+
+static void tap_uring_post_reads(TapUring *u)
+{
+    struct io_uring_sqe *sqe;
+    int i;
+
+    if (!u->reading || u->rx_stalled) {
+        return;
+    }
+
+    for (i = 0; i < TAP_URING_BATCH; i++) {
+        if (u->rx_busy[i]) {
+            continue;
+        }
+        sqe = tap_uring_get_sqe(u);
+        io_uring_prep_readv(sqe, u->fd, &u->rx_iov[i], 1, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        u->rx_busy[i] = true;
+        u->rx_inflight++;
+    }
+    qemu_bh_schedule(u->submit_bh);
+}
+
+static void tap_uring_complete_rx(TapUring *u, unsigned slot, int ret)
+{
+    u->rx_busy[slot] = false;
+    u->rx_inflight--;
+
+    if (ret > 0) {
+        u->receive(u->opaque, u->rx_buf[slot], ret);
+    } else if (ret != -EAGAIN && ret != -EINTR && ret != -ECANCELED) {
+        /* Reposting right away would fail the same way over and over */
+        u->rx_stalled = true;
+    }
+}
+
+static void tap_uring_complete_tx(TapUring *u, unsigned slot)
+{
+    /* Like writev(), a failed write just drops the packet */
+    u->tx_busy[slot] = false;
+    u->tx_inflight--;
+}
+
+static void tap_uring_complete(void *opaque)
+{
+    TapUring *u = opaque;
+    AioContext *ctx = u->ctx;
+    struct io_uring_cqe *cqe;
+    bool tx_freed = false;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+
+    while (io_uring_peek_cqe(&u->ring, &cqe) == 0) {
+        uintptr_t slot = (uintptr_t)io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (slot < TAP_URING_TX) {
+            tap_uring_complete_rx(u, slot, ret);
+        } else if (slot < TAP_URING_CANCEL) {
+            tap_uring_complete_tx(u, slot - TAP_URING_TX);
+            tx_freed = true;
+        }
+    }
+
+    if (tx_freed && u->tx_blocked) {
+        u->tx_blocked = false;
+        u->writable(u->opaque);
+    }
+
+    tap_uring_post_reads(u);
+
+    /* Completions come in bursts, so submit now rather than in a BH */
+    tap_uring_submit(u);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static void tap_uring_set_fd_handler(TapUring *u, bool enable)
+{
+    aio_set_fd_handler(tap_uring_get_aio_context(u), u->ring.ring_fd, false,
+                       enable ? tap_uring_complete : NULL, NULL, NULL, u);
+}
+
+ssize_t tap_uring_write(TapUring *u, const struct iovec *iov, int iovcnt)
+{
+    struct io_uring_sqe *sqe;
+    size_t size = iov_size(iov, iovcnt);
+    int i;
+
+    if (size > NET_BUFSIZE) {
+        ssize_t len;
+
+        /* Too big for a slot; keep the order with what is queued */
+        tap_uring_submit(u);
+        do {
+            len = writev(u->fd, iov, iovcnt);
+        } while (len == -1 && errno == EINTR);
+        return len;
+    }
+
+    for (i = 0; i < TAP_URING_BATCH && u->tx_busy[i]; i++) {
+        /* nothing */
+    }
+    if (i == TAP_URING_BATCH) {
+        u->tx_blocked = true;
+        return 0;
+    }
+
+    /* The caller may reuse @iov as soon as we return */
+    iov_to_buf(iov, iovcnt, 0, u->tx_buf[i], size);
+    u->tx_iov[i].iov_len = size;
+
+    sqe = tap_uring_get_sqe(u);
+    io_uring_prep_writev(sqe, u->fd, &u->tx_iov[i], 1, 0);
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)(TAP_URING_TX + i));
+    u->tx_busy[i] = true;
+    u->tx_inflight++;
+
+    /* Packets sent by the peer in the same burst share one submission */
+    qemu_bh_schedule(u->submit_bh);
+    return size;
+}
+
+void tap_uring_set_reading(TapUring *u, bool enable)
+{
+    u->reading = enable;
+    if (enable) {
+        u->rx_stalled = false;
+        tap_uring_post_reads(u);
+    }
+}
+
+void tap_uring_set_aio_context(TapUring *u, AioContext *ctx)
+{
+    tap_uring_set_fd_handler(u, false);
+    tap_uring_submit(u);
+    qemu_bh_delete(u->submit_bh);
+
+    u->ctx = ctx;
+
+    u->submit_bh = aio_bh_new(tap_uring_get_aio_context(u),
+                              tap_uring_submit_bh, u);
+    tap_uring_set_fd_handler(u, true);
+}
+
+TapUring *tap_uring_new(int fd, TapUringReceive *receive,
+                        TapUringWritable *writable, void *opaque,
+                        Error **errp)
+{
+    TapUring *u = g_new0(TapUring, 1);
+    int ret, i;
+
+    ret = io_uring_queue_init(2 * TAP_URING_BATCH, &u->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to initialize io_uring");
+        g_free(u);
+        return NULL;
+    }
+
+    u->fd = fd;
+    u->receive = receive;
+    u->writable = writable;
+    u->opaque = opaque;
+
+    for (i = 0; i < TAP_URING_BATCH; i++) {
+        u->rx_buf[i] = g_malloc(NET_BUFSIZE);
+        u->rx_iov[i].iov_base = u->rx_buf[i];
+        u->rx_iov[i].iov_len = NET_BUFSIZE;
+        u->tx_buf[i] = g_malloc(NET_BUFSIZE);
+        u->tx_iov[i].iov_base = u->tx_buf[i];
+    }
+
+    u->submit_bh = aio_bh_new(tap_uring_get_aio_context(u),
+                              tap_uring_submit_bh, u);
+    tap_uring_set_fd_handler(u, true);
+    return u;
+}
+
+void tap_uring_free(TapUring *u)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int i;
+
+    if (!u) {
+        return;
+    }
+
+    tap_uring_set_fd_handler(u, false);
+    qemu_bh_delete(u->submit_bh);
+
+    /* The kernel must be done with the buffers before they are freed */
+    u->reading = false;
+    tap_uring_submit(u);
+    for (i = 0; i < TAP_URING_BATCH; i++) {
+        if (u->rx_busy[i]) {
+            sqe = tap_uring_get_sqe(u);
+            io_uring_prep_cancel(sqe, (void *)(uintptr_t)i, 0);
+            io_uring_sqe_set_data(sqe, (void *)(uintptr_t)TAP_URING_CANCEL);
+        }
+    }
+    tap_uring_submit(u);
+
+    while (u->rx_inflight || u->tx_inflight) {
+        uintptr_t slot;
+
+        if (io_uring_wait_cqe(&u->ring, &cqe) < 0) {
+            continue;
+        }
+        slot = (uintptr_t)io_uring_cqe_get_data(cqe);
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (slot < TAP_URING_TX) {
+            u->rx_busy[slot] = false;
+            u->rx_inflight--;
+        } else if (slot < TAP_URING_CANCEL) {
+            tap_uring_complete_tx(u, slot - TAP_URING_TX);
+        }
+    }
+
+    io_uring_queue_exit(&u->ring);
+    for (i = 0; i < TAP_URING_BATCH; i++) {
+        g_free(u->rx_buf[i]);
+        g_free(u->tx_buf[i]);
+    }
+    g_free(u);
+}
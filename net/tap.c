@@ -33,7 +33,9 @@
 #include <net/if.h>
 
 #include "net/net.h"
+#include "block/aio.h"
 #include "clients.h"
+#include "util.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qapi/error.h"
@@ -61,6 +63,8 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx;            /* NULL when in the main loop */
+    TapUring *uring;            /* NULL unless io-uring=on */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -71,10 +75,16 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->uring) {
+        /* The tap fd is only accessed through the ring */
+        tap_uring_set_reading(s->uring, s->read_poll && s->enabled);
+        return;
+    }
+
+    net_set_fd_handler(s->ctx, s->fd, fd_read, fd_write, NULL, s);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -92,16 +102,29 @@ static void tap_write_poll(TAPState *s, bool enable)
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
 
     tap_write_poll(s, false);
 
     qemu_flush_queued_packets(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
 {
     ssize_t len;
 
+    if (s->uring) {
+        return tap_uring_write(s->uring, iov, iovcnt);
+    }
+
     do {
         len = writev(s->fd, iov, iovcnt);
     } while (len == -1 && errno == EINTR);
@@ -181,30 +204,41 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+/* Returns what qemu_send_packet_async() returned */
+static ssize_t tap_send_packet(TAPState *s, uint8_t *buf, int size)
+{
+    ssize_t ret;
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
+
+    ret = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+    if (ret == 0) {
+        tap_read_poll(s, false);
+    }
+    return ret;
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
     int size;
     int packets = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
 
+    while (true) {
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
             break;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
-        }
-
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
+        if (tap_send_packet(s, s->buf, size) <= 0) {
             break;
         }
 
@@ -219,6 +253,28 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static void tap_uring_receive(void *opaque, uint8_t *buf, int size)
+{
+    TAPState *s = opaque;
+
+    /*
+     * Packets refused by the peer are queued, so the rest of the burst can
+     * still be handed over; tap_send_packet() stops further reads.
+     */
+    tap_send_packet(s, buf, size);
+}
+
+static void tap_uring_writable(void *opaque)
+{
+    TAPState *s = opaque;
+
+    qemu_flush_queued_packets(&s->nc);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -324,12 +380,45 @@ static void tap_cleanup(NetClientState *nc)
     tap_exit_notify(&s->exit, NULL);
     qemu_remove_exit_notifier(&s->exit);
 
-    tap_read_poll(s, false);
-    tap_write_poll(s, false);
+    if (s->ctx) {
+        /* Wait for the handlers to finish if they are running */
+        aio_context_acquire(s->ctx);
+        tap_read_poll(s, false);
+        tap_write_poll(s, false);
+        tap_uring_free(s->uring);
+        s->uring = NULL;
+        aio_context_release(s->ctx);
+        s->ctx = NULL;
+    } else {
+        tap_read_poll(s, false);
+        tap_write_poll(s, false);
+        tap_uring_free(s->uring);
+        s->uring = NULL;
+    }
     close(s->fd);
     s->fd = -1;
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    if (s->uring) {
+        tap_uring_set_aio_context(s->uring, ctx);
+        s->ctx = ctx;
+        return;
+    }
+
+    net_fd_set_aio_context(s->fd, &s->ctx, ctx);
+    tap_update_fd_handler(s);
+}
+
 static void tap_poll(NetClientState *nc, bool enable)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -362,6 +451,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -668,6 +758,19 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         return;
     }
 
+    if (tap->has_io_uring && tap->io_uring) {
+        TapUring *uring = tap_uring_new(s->fd, tap_uring_receive,
+                                        tap_uring_writable, s, errp);
+
+        if (!uring) {
+            return;
+        }
+        /* Stop polling the tap fd directly */
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+        s->uring = uring;
+        tap_update_fd_handler(s);
+    }
+
     if (tap->has_fd || tap->has_fds) {
         snprintf(s->nc.info_str, sizeof(s->nc.info_str), "fd=%d", fd);
     } else if (tap->has_helper) {
@@ -689,8 +792,14 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         vhostfdname || (tap->has_vhostforce && tap->vhostforce)) {
         VhostNetOptions options;
 
+        if (s->uring) {
+            error_setg(errp, "io-uring=on is not compatible with vhost");
+            return;
+        }
+
         options.backend_type = VHOST_BACKEND_TYPE_KERNEL;
         options.net_backend = &s->nc;
+        options.nvqs = 2;
         if (tap->has_poll_us) {
             options.busyloop_timeout = tap->poll_us;
         } else {
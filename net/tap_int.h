@@ -26,7 +26,9 @@
 #ifndef NET_TAP_INT_H
 #define NET_TAP_INT_H
 
+#include "qapi/error.h"
 #include "qapi/qapi-types-net.h"
+#include "block/aio.h"
 
 int tap_open(char *ifname, int ifname_size, int *vnet_hdr,
              int vnet_hdr_required, int mq_required, Error **errp);
@@ -45,4 +47,50 @@ int tap_fd_enable(int fd);
 int tap_fd_disable(int fd);
 int tap_fd_get_ifname(int fd, char *ifname);
 
+/*
+ * Batched packet I/O on a tap fd through io_uring.  @receive is called for
+ * each packet read from the fd; @writable once tap_uring_write() can take
+ * packets again after it refused one.  Both are called with the
+ * AioContext acquired.
+ */
+typedef struct TapUring TapUring;
+typedef void TapUringReceive(void *opaque, uint8_t *buf, int size);
+typedef void TapUringWritable(void *opaque);
+
+#ifdef CONFIG_LINUX_IO_URING
+TapUring *tap_uring_new(int fd, TapUringReceive *receive,
+                        TapUringWritable *writable, void *opaque,
+                        Error **errp);
+void tap_uring_free(TapUring *u);
+void tap_uring_set_aio_context(TapUring *u, AioContext *ctx);
+void tap_uring_set_reading(TapUring *u, bool enable);
+ssize_t tap_uring_write(TapUring *u, const struct iovec *iov, int iovcnt);
+#else
+static inline TapUring *tap_uring_new(int fd, TapUringReceive *receive,
+                                      TapUringWritable *writable,
+                                      void *opaque, Error **errp)
+{
+    error_setg(errp, "io_uring support is not compiled in");
+    return NULL;
+}
+
+static inline void tap_uring_free(TapUring *u)
+{
+}
+
+static inline void tap_uring_set_aio_context(TapUring *u, AioContext *ctx)
+{
+}
+
+static inline void tap_uring_set_reading(TapUring *u, bool enable)
+{
+}
+
+static inline ssize_t tap_uring_write(TapUring *u, const struct iovec *iov,
+                                      int iovcnt)
+{
+    return -ENOSYS;
+}
+#endif
+
 #endif /* NET_TAP_INT_H */
@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/main-loop.h"
 #include "util.h"
 
 int net_parse_macaddr(uint8_t *macaddr, const char *p)
@@ -57,3 +58,21 @@ int net_parse_macaddr(uint8_t *macaddr, const char *p)
 
     return 0;
 }
+
+void net_set_fd_handler(AioContext *ctx, int fd, IOHandler *fd_read,
+                        IOHandler *fd_write, AioPollFn *io_poll, void *opaque)
+{
+    if (ctx) {
+        aio_set_fd_handler(ctx, fd, false, fd_read, fd_write, io_poll, opaque);
+    } else {
+        qemu_set_fd_handler(fd, fd_read, fd_write, opaque);
+    }
+}
+
+void net_fd_set_aio_context(int fd, AioContext **ctx, AioContext *new_ctx)
+{
+    if (fd >= 0) {
+        net_set_fd_handler(*ctx, fd, NULL, NULL, NULL, NULL);
+    }
+    *ctx = new_ctx;
+}
@@ -25,6 +25,7 @@
 #ifndef QEMU_NET_UTIL_H
 #define QEMU_NET_UTIL_H
 
+#include "block/aio.h"
 
 /*
  * Structure of an internet header, naked of options.
@@ -83,4 +84,18 @@ static inline bool in6_equal_net(const struct in6_addr *a,
 
 int net_parse_macaddr(uint8_t *macaddr, const char *p);
 
+/*
+ * Install the handlers of a backend's @fd in @ctx, or in the main loop if
+ * @ctx is NULL.  @io_poll is only used in an AioContext.
+ */
+void net_set_fd_handler(AioContext *ctx, int fd, IOHandler *fd_read,
+                        IOHandler *fd_write, AioPollFn *io_poll, void *opaque);
+
+/*
+ * Hand a backend's @fd over from *@ctx to @new_ctx, NULL being the main
+ * loop: its handlers are removed from the old context, and the caller
+ * installs them again in the new one.  A negative @fd only updates *@ctx.
+ */
+void net_fd_set_aio_context(int fd, AioContext **ctx, AioContext *new_ctx);
+
 #endif /* QEMU_NET_UTIL_H */
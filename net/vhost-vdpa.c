@@ -19,12 +19,12 @@
 #include "qemu/option.h"
 #include "qapi/error.h"
 #include <sys/ioctl.h>
+#include <linux/vhost.h>
 #include <err.h>
 #include "standard-headers/linux/virtio_net.h"
 #include "monitor/monitor.h"
 #include "hw/virtio/vhost.h"
 
-/* Todo:need to add the multiqueue support here */
 typedef struct VhostVDPAState {
     NetClientState nc;
     struct vhost_vdpa vhost_vdpa;
@@ -55,6 +55,13 @@ const int vdpa_feature_bits[] = {
     VIRTIO_F_IOMMU_PLATFORM,
     VIRTIO_F_RING_PACKED,
     VIRTIO_NET_F_GUEST_ANNOUNCE,
+    VIRTIO_NET_F_STATUS,
+    VIRTIO_NET_F_CTRL_VQ,
+    VIRTIO_NET_F_CTRL_RX,
+    VIRTIO_NET_F_CTRL_VLAN,
+    VIRTIO_NET_F_CTRL_RX_EXTRA,
+    VIRTIO_NET_F_CTRL_MAC_ADDR,
+    VIRTIO_NET_F_MQ,
     VHOST_INVALID_FEATURE_BIT
 };
 
@@ -98,7 +105,7 @@ static void vhost_vdpa_del(NetClientState *ncs)
     }
 }
 
-static int vhost_vdpa_add(NetClientState *ncs, void *be)
+static int vhost_vdpa_add(NetClientState *ncs, void *be, int nvqs)
 {
     VhostNetOptions options;
     struct vhost_net *net = NULL;
@@ -111,6 +118,7 @@ static int vhost_vdpa_add(NetClientState *ncs, void *be)
     options.net_backend = ncs;
     options.opaque      = be;
     options.busyloop_timeout = 0;
+    options.nvqs = nvqs;
 
     net = vhost_net_init(&options);
     if (!net) {
@@ -144,6 +152,11 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
         g_free(s->vhost_net);
         s->vhost_net = NULL;
     }
+    /* The other clients of the device share the descriptor of the first */
+    if (s->vhost_vdpa.index == 0 && s->vhost_vdpa.device_fd >= 0) {
+        qemu_close(s->vhost_vdpa.device_fd);
+        s->vhost_vdpa.device_fd = -1;
+    }
 }
 
 static bool vhost_vdpa_has_vnet_hdr(NetClientState *nc)
@@ -172,26 +185,77 @@ static NetClientInfo net_vhost_vdpa_info = {
         .has_ufo = vhost_vdpa_has_ufo,
 };
 
-static int net_vhost_vdpa_init(NetClientState *peer, const char *device,
-                               const char *name, const char *vhostdev)
+/*
+ * Each queue pair of the device gets its own client; if the device has
+ * a control virtqueue, one more client passes it through to the device,
+ * after all of the queue pairs.
+ */
+static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
+                                           const char *device,
+                                           const char *name,
+                                           int vdpa_device_fd,
+                                           int queue_pair_index,
+                                           int nvqs,
+                                           bool is_datapath)
 {
     NetClientState *nc = NULL;
     VhostVDPAState *s;
-    int vdpa_device_fd = -1;
     int ret = 0;
     assert(name);
-    nc = qemu_new_net_client(&net_vhost_vdpa_info, peer, device, name);
+    if (is_datapath) {
+        nc = qemu_new_net_client(&net_vhost_vdpa_info, peer, device, name);
+    } else {
+        nc = qemu_new_net_control_client(&net_vhost_vdpa_info, peer,
+                                         device, name);
+    }
     snprintf(nc->info_str, sizeof(nc->info_str), TYPE_VHOST_VDPA);
-    nc->queue_index = 0;
+    nc->queue_index = queue_pair_index;
     s = DO_UPCAST(VhostVDPAState, nc, nc);
-    vdpa_device_fd = qemu_open_old(vhostdev, O_RDWR);
-    if (vdpa_device_fd == -1) {
+    s->vhost_vdpa.device_fd = vdpa_device_fd;
+    s->vhost_vdpa.index = queue_pair_index;
+    ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa, nvqs);
+    if (ret) {
+        /*
+         * This also deletes the clients created before under the same
+         * name; the first one closes the device.
+         */
+        s->vhost_vdpa.device_fd = -1;
+        qemu_del_net_client(nc);
+        return NULL;
+    }
+    return nc;
+}
+
+static int vhost_vdpa_get_max_queue_pairs(int fd, bool *has_cvq, Error **errp)
+{
+    unsigned long config_size = offsetof(struct vhost_vdpa_config, buf);
+    g_autofree struct vhost_vdpa_config *config = NULL;
+    uint16_t max_queue_pairs;
+    uint64_t features;
+
+    if (ioctl(fd, VHOST_GET_FEATURES, &features)) {
+        error_setg_errno(errp, errno, "failed to get vhost-vdpa features");
         return -errno;
     }
-    s->vhost_vdpa.device_fd = vdpa_device_fd;
-    ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa);
-    assert(s->vhost_net);
-    return ret;
+
+    *has_cvq = features & (1ULL << VIRTIO_NET_F_CTRL_VQ);
+
+    /* Without a control virtqueue, the guest can only use the first pair */
+    if (!*has_cvq || !(features & (1ULL << VIRTIO_NET_F_MQ))) {
+        return 1;
+    }
+
+    config = g_malloc0(config_size + sizeof(max_queue_pairs));
+    config->off = offsetof(struct virtio_net_config, max_virtqueue_pairs);
+    config->len = sizeof(max_queue_pairs);
+    if (ioctl(fd, VHOST_VDPA_GET_CONFIG, config)) {
+        error_setg_errno(errp, errno, "failed to get vhost-vdpa config");
+        return -errno;
+    }
+
+    /* vDPA devices are modern, so the config space is little endian */
+    memcpy(&max_queue_pairs, config->buf, sizeof(max_queue_pairs));
+    return MAX(le16_to_cpu(max_queue_pairs), 1);
 }
 
 static int net_vhost_check_net(void *opaque, QemuOpts *opts, Error **errp)
@@ -216,6 +280,9 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
                         NetClientState *peer, Error **errp)
 {
     const NetdevVhostVDPAOptions *opts;
+    const char *vhostdev;
+    int vdpa_device_fd, queue_pairs, i;
+    bool has_cvq;
 
     assert(netdev->type == NET_CLIENT_DRIVER_VHOST_VDPA);
     opts = &netdev->u.vhost_vdpa;
@@ -224,5 +291,52 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
                           (char *)name, errp)) {
         return -1;
     }
-    return net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name, opts->vhostdev);
+
+    vhostdev = opts->has_vhostdev ? opts->vhostdev : "/dev/vhost-vdpa-0";
+    vdpa_device_fd = qemu_open_old(vhostdev, O_RDWR);
+    if (vdpa_device_fd == -1) {
+        error_setg_errno(errp, errno, "could not open '%s'", vhostdev);
+        return -errno;
+    }
+
+    queue_pairs = vhost_vdpa_get_max_queue_pairs(vdpa_device_fd, &has_cvq,
+                                                 errp);
+    if (queue_pairs < 0) {
+        qemu_close(vdpa_device_fd);
+        return queue_pairs;
+    }
+
+    /*
+     * The control virtqueue comes after all of the device's queue pairs,
+     * so they must all be exposed to the guest.
+     */
+    if (opts->has_queues && opts->queues != queue_pairs) {
+        error_setg(errp, "vhost-vdpa device '%s' has %d queue pairs, "
+                   "not %" PRId64, vhostdev, queue_pairs, opts->queues);
+        qemu_close(vdpa_device_fd);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < queue_pairs; i++) {
+        if (!net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
+                                 vdpa_device_fd, i, 2, true)) {
+            goto err;
+        }
+    }
+
+    if (has_cvq &&
+        !net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
+                             vdpa_device_fd, i, 1, false)) {
+        goto err;
+    }
+
+    return 0;
+
+err:
+    error_setg(errp, "failed to init vhost_net for vhost-vdpa device '%s'",
+               vhostdev);
+    if (i == 0) {
+        qemu_close(vdpa_device_fd);
+    }
+    return -1;
 }
@@ -95,6 +95,15 @@ void qemu_plugin_register_vcpu_tb_exec_inline(struct qemu_plugin_tb *tb,
     plugin_register_inline_op(&tb->cbs[PLUGIN_CB_INLINE], 0, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+    struct qemu_plugin_tb *tb, enum qemu_plugin_op op,
+    struct qemu_plugin_scoreboard *score, size_t offset, uint64_t imm)
+{
+    g_assert(offset + sizeof(uint64_t) <= score->element_size);
+    plugin_register_inline_op_per_vcpu(&tb->cbs[PLUGIN_CB_INLINE_PER_VCPU],
+                                       0, op, score, offset, imm);
+}
+
 void qemu_plugin_register_vcpu_insn_exec_cb(struct qemu_plugin_insn *insn,
                                             qemu_plugin_vcpu_udata_cb_t cb,
                                             enum qemu_plugin_cb_flags flags,
@@ -112,6 +121,16 @@ void qemu_plugin_register_vcpu_insn_exec_inline(struct qemu_plugin_insn *insn,
                               0, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_op op,
+    struct qemu_plugin_scoreboard *score, size_t offset, uint64_t imm)
+{
+    g_assert(offset + sizeof(uint64_t) <= score->element_size);
+    plugin_register_inline_op_per_vcpu(
+        &insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_INLINE_PER_VCPU],
+        0, op, score, offset, imm);
+}
+
 
 
 void qemu_plugin_register_vcpu_mem_cb(struct qemu_plugin_insn *insn,
@@ -133,6 +152,26 @@ void qemu_plugin_register_vcpu_mem_inline(struct qemu_plugin_insn *insn,
         rw, op, ptr, imm);
 }
 
+void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+    struct qemu_plugin_insn *insn, enum qemu_plugin_mem_rw rw,
+    enum qemu_plugin_op op, struct qemu_plugin_scoreboard *score,
+    size_t offset, uint64_t imm)
+{
+    g_assert(offset + sizeof(uint64_t) <= score->element_size);
+    plugin_register_inline_op_per_vcpu(
+        &insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_INLINE_PER_VCPU],
+        rw, op, score, offset, imm);
+}
+
+void qemu_plugin_register_vcpu_mem_buffered(struct qemu_plugin_insn *insn,
+                                            enum qemu_plugin_mem_rw rw,
+                                            struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_register_vcpu_mem_cb(&insn->cbs[PLUGIN_CB_MEM][PLUGIN_CB_REGULAR],
+                                plugin_mem_buffer_record,
+                                QEMU_PLUGIN_CB_NO_REGS, rw, buf);
+}
+
 void qemu_plugin_register_vcpu_tb_trans_cb(qemu_plugin_id_t id,
                                            qemu_plugin_vcpu_tb_trans_cb_t cb)
 {
@@ -333,6 +372,53 @@ int qemu_plugin_n_max_vcpus(void)
 #endif
 }
 
+/*
+ * Scoreboards
+ */
+
+struct qemu_plugin_scoreboard *qemu_plugin_scoreboard_new(size_t element_size)
+{
+    return plugin_scoreboard_new(element_size);
+}
+
+void qemu_plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    plugin_scoreboard_free(score);
+}
+
+void *qemu_plugin_scoreboard_find(struct qemu_plugin_scoreboard *score,
+                                  unsigned int vcpu_index)
+{
+    return score->data + vcpu_index * score->element_size;
+}
+
+uint64_t qemu_plugin_scoreboard_u64_sum(struct qemu_plugin_scoreboard *score,
+                                        size_t offset)
+{
+    return plugin_scoreboard_u64_sum(score, offset);
+}
+
+/*
+ * Memory access buffers
+ */
+
+struct qemu_plugin_mem_buffer *
+qemu_plugin_mem_buffer_new(size_t n_records, uint64_t period,
+                           qemu_plugin_vcpu_mem_batch_cb_t cb, void *udata)
+{
+    return plugin_mem_buffer_new(n_records, period, cb, udata);
+}
+
+void qemu_plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_mem_buffer_flush(buf);
+}
+
+void qemu_plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    plugin_mem_buffer_free(buf);
+}
+
 /*
  * Plugin output
  */
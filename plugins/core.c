@@ -194,10 +194,217 @@ plugin_register_cb_udata(qemu_plugin_id_t id, enum qemu_plugin_event ev,
     do_plugin_register_cb(id, ev, func, udata);
 }
 
+/*
+ * Give every scoreboard @size slots.  Translated code loads the
+ * location of the slots every time, so it is fine to move them as
+ * long as no vCPU is executing.
+ */
+static void plugin_scoreboard_grow__locked(size_t size)
+{
+    struct qemu_plugin_scoreboard *score;
+
+    QLIST_FOREACH(score, &plugin.scoreboards, entry) {
+        void *data = g_malloc0(size * score->element_size);
+
+        memcpy(data, score->data,
+               plugin.scoreboard_size * score->element_size);
+        g_free(score->data);
+        qatomic_set(&score->data, data);
+    }
+    plugin.scoreboard_size = size;
+}
+
+static void plugin_scoreboard_add_vcpu(CPUState *cpu)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (likely(cpu->cpu_index < plugin.scoreboard_size)) {
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    if (QLIST_EMPTY(&plugin.scoreboards)) {
+        /* nothing to move yet */
+        plugin.scoreboard_size = cpu->cpu_index + 1;
+        qemu_rec_mutex_unlock(&plugin.lock);
+        return;
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+#ifdef CONFIG_USER_ONLY
+    /*
+     * A new thread: stop the others, which may be running code that
+     * updates the scoreboards.  The first vCPU has no one to stop.
+     */
+    if (current_cpu) {
+        start_exclusive();
+    }
+    qemu_rec_mutex_lock(&plugin.lock);
+    if (cpu->cpu_index >= plugin.scoreboard_size) {
+        plugin_scoreboard_grow__locked(MAX(plugin.scoreboard_size * 2,
+                                           cpu->cpu_index + 1));
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+    if (current_cpu) {
+        end_exclusive();
+    }
+#else
+    /* the first scoreboard is sized for smp.max_cpus */
+    g_assert_not_reached();
+#endif
+}
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size)
+{
+    struct qemu_plugin_scoreboard *score;
+    int max_vcpus = qemu_plugin_n_max_vcpus();
+
+    score = g_new0(struct qemu_plugin_scoreboard, 1);
+    score->element_size = element_size;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    /*
+     * Only the first scoreboard can grow the others here, before any
+     * translated code refers to them: from then on the size covers
+     * smp.max_cpus, or in user mode every vCPU created so far.
+     */
+    if (max_vcpus > 0 && plugin.scoreboard_size < max_vcpus) {
+        plugin_scoreboard_grow__locked(max_vcpus);
+    }
+    if (plugin.scoreboard_size == 0) {
+        plugin.scoreboard_size = 1;
+    }
+    score->data = g_malloc0(plugin.scoreboard_size * element_size);
+    QLIST_INSERT_HEAD(&plugin.scoreboards, score, entry);
+    return score;
+}
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(score, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    g_free(score->data);
+    g_free(score);
+}
+
+uint64_t plugin_scoreboard_u64_sum(struct qemu_plugin_scoreboard *score,
+                                   size_t offset)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    for (i = 0; i < plugin.scoreboard_size; i++) {
+        total += *(uint64_t *)(score->data + i * score->element_size + offset);
+    }
+    return total;
+}
+
+/*
+ * A memory access buffer keeps its per-vCPU state in a scoreboard, so
+ * that vCPUs fill their own records without any locking.
+ */
+struct qemu_plugin_mem_buffer {
+    struct qemu_plugin_scoreboard *vcpus;
+    size_t n_records;
+    uint64_t period;
+    qemu_plugin_vcpu_mem_batch_cb_t cb;
+    void *udata;
+};
+
+struct plugin_mem_buffer_vcpu {
+    struct qemu_plugin_mem_record *records;
+    size_t n;
+    /* accesses to skip before taking the next sample */
+    uint64_t skip;
+};
+
+static inline struct plugin_mem_buffer_vcpu *
+plugin_mem_buffer_vcpu(struct qemu_plugin_mem_buffer *buf,
+                       unsigned int vcpu_index)
+{
+    return buf->vcpus->data + vcpu_index * buf->vcpus->element_size;
+}
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records, uint64_t period,
+                      qemu_plugin_vcpu_mem_batch_cb_t cb, void *udata)
+{
+    struct qemu_plugin_mem_buffer *buf;
+
+    g_assert(n_records > 0);
+    buf = g_new0(struct qemu_plugin_mem_buffer, 1);
+    buf->vcpus = plugin_scoreboard_new(sizeof(struct plugin_mem_buffer_vcpu));
+    buf->n_records = n_records;
+    buf->period = MAX(period, 1);
+    buf->cb = cb;
+    buf->udata = udata;
+    return buf;
+}
+
+/*
+ * Called directly from translated code (or from qemu_plugin_vcpu_mem_cb
+ * for accesses done by helpers) in place of a plugin's mem callback.
+ */
+void plugin_mem_buffer_record(unsigned int vcpu_index,
+                              qemu_plugin_meminfo_t info, uint64_t vaddr,
+                              void *udata)
+{
+    struct qemu_plugin_mem_buffer *buf = udata;
+    struct plugin_mem_buffer_vcpu *v = plugin_mem_buffer_vcpu(buf, vcpu_index);
+
+    if (v->skip) {
+        v->skip--;
+        return;
+    }
+    v->skip = buf->period - 1;
+
+    if (unlikely(v->records == NULL)) {
+        v->records = g_new(struct qemu_plugin_mem_record, buf->n_records);
+    }
+    v->records[v->n].vaddr = vaddr;
+    v->records[v->n].info = info;
+    if (++v->n == buf->n_records) {
+        buf->cb(vcpu_index, v->records, v->n, buf->udata);
+        v->n = 0;
+    }
+}
+
+void plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf)
+{
+    size_t i;
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    for (i = 0; i < plugin.scoreboard_size; i++) {
+        struct plugin_mem_buffer_vcpu *v = plugin_mem_buffer_vcpu(buf, i);
+
+        if (v->n) {
+            buf->cb(i, v->records, v->n, buf->udata);
+            v->n = 0;
+        }
+    }
+}
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf)
+{
+    size_t i;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    for (i = 0; i < plugin.scoreboard_size; i++) {
+        g_free(plugin_mem_buffer_vcpu(buf, i)->records);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_scoreboard_free(buf->vcpus);
+    g_free(buf);
+}
+
 void qemu_plugin_vcpu_init_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_scoreboard_add_vcpu(cpu);
+
     qemu_rec_mutex_lock(&plugin.lock);
     plugin_cpu_update__locked(&cpu->cpu_index, NULL, NULL);
     success = g_hash_table_insert(plugin.cpu_ht, &cpu->cpu_index,
@@ -278,6 +485,23 @@ void plugin_register_inline_op(GArray **arr,
     dyn_cb->inline_insn.imm = imm;
 }
 
+void plugin_register_inline_op_per_vcpu(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        struct qemu_plugin_scoreboard *score,
+                                        size_t offset, uint64_t imm)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb;
+
+    dyn_cb = plugin_get_dyn_cb(arr);
+    dyn_cb->userp = score;
+    dyn_cb->type = PLUGIN_CB_INLINE_PER_VCPU;
+    dyn_cb->rw = rw;
+    dyn_cb->inline_insn.op = op;
+    dyn_cb->inline_insn.imm = imm;
+    dyn_cb->inline_insn.offset = offset;
+}
+
 static inline uint32_t cb_to_tcg_flags(enum qemu_plugin_cb_flags flags)
 {
     uint32_t ret;
@@ -429,6 +653,22 @@ void exec_inline_op(struct qemu_plugin_dyn_cb *cb)
     }
 }
 
+static void exec_inline_op_per_vcpu(struct qemu_plugin_dyn_cb *cb,
+                                    unsigned int cpu_index)
+{
+    struct qemu_plugin_scoreboard *score = cb->userp;
+    uint64_t *val = score->data + cpu_index * score->element_size +
+                    cb->inline_insn.offset;
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        *val += cb->inline_insn.imm;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
 {
     GArray *arr = cpu->plugin_mem_cbs;
@@ -443,7 +683,7 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
         int w = !!(info & TRACE_MEM_ST) + 1;
 
         if (!(w & cb->rw)) {
-                break;
+            continue;
         }
         switch (cb->type) {
         case PLUGIN_CB_REGULAR:
@@ -452,6 +692,9 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
         case PLUGIN_CB_INLINE:
             exec_inline_op(cb);
             break;
+        case PLUGIN_CB_INLINE_PER_VCPU:
+            exec_inline_op_per_vcpu(cb, cpu->cpu_index);
+            break;
         default:
             g_assert_not_reached();
         }
@@ -496,6 +739,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QTAILQ_INIT(&plugin.ctxs);
+    QLIST_INIT(&plugin.scoreboards);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
     atexit(qemu_plugin_atexit_cb);
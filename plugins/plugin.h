@@ -43,6 +43,12 @@ struct qemu_plugin_state {
      * the code cache is flushed.
      */
     struct qht dyn_cb_arr_ht;
+    /*
+     * All scoreboards, and the number of vCPU slots that each of them
+     * has.  Protected by @lock.
+     */
+    QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    size_t scoreboard_size;
 };
 
 
@@ -68,6 +74,31 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_register_inline_op_per_vcpu(GArray **arr,
+                                        enum qemu_plugin_mem_rw rw,
+                                        enum qemu_plugin_op op,
+                                        struct qemu_plugin_scoreboard *score,
+                                        size_t offset, uint64_t imm);
+
+struct qemu_plugin_scoreboard *plugin_scoreboard_new(size_t element_size);
+
+void plugin_scoreboard_free(struct qemu_plugin_scoreboard *score);
+
+uint64_t plugin_scoreboard_u64_sum(struct qemu_plugin_scoreboard *score,
+                                   size_t offset);
+
+struct qemu_plugin_mem_buffer *
+plugin_mem_buffer_new(size_t n_records, uint64_t period,
+                      qemu_plugin_vcpu_mem_batch_cb_t cb, void *udata);
+
+void plugin_mem_buffer_flush(struct qemu_plugin_mem_buffer *buf);
+
+void plugin_mem_buffer_free(struct qemu_plugin_mem_buffer *buf);
+
+void plugin_mem_buffer_record(unsigned int vcpu_index,
+                              qemu_plugin_meminfo_t info, uint64_t vaddr,
+                              void *udata);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
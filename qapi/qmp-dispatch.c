@@ -16,6 +16,7 @@
 #include "qapi/qmp/dispatch.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
+#include "qemu/main-loop.h"
 #include "sysemu/runstate.h"
 #include "qapi/qmp/qbool.h"
 
@@ -100,6 +101,7 @@ QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
     QObject *id;
     QObject *ret = NULL;
     QDict *rsp = NULL;
+    bool drop_bql;
 
     dict = qobject_to(QDict, request);
     if (!dict) {
@@ -152,7 +154,19 @@ QDict *qmp_dispatch(const QmpCommandList *cmds, QObject *request,
         args = qdict_get_qdict(dict, "arguments");
         qobject_ref(args);
     }
+
+    /*
+     * Let vCPU threads take the BQL while a query that does not need it
+     * runs; in-band commands stay serialized by the dispatcher.
+     */
+    drop_bql = (cmd->options & QCO_NO_BQL) && qemu_mutex_iothread_locked();
+    if (drop_bql) {
+        qemu_mutex_unlock_iothread();
+    }
     cmd->fn(args, &ret, &err);
+    if (drop_bql) {
+        qemu_mutex_lock_iothread();
+    }
     qobject_unref(args);
     if (err) {
         /* or assert(!ret) after reviewing all handlers: */
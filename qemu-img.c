@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
 
 #include "qemu-common.h"
 #include "qemu-version.h"
@@ -33,11 +34,15 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
@@ -48,6 +53,7 @@
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 
@@ -81,6 +87,8 @@ enum {
     OPTION_MERGE = 274,
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
+    OPTION_READ_PERCENT = 277,
+    OPTION_DISTRIBUTION = 278,
 };
 
 typedef enum OutputFormat {
@@ -210,6 +218,8 @@ static void QEMU_NORETURN help(void)
            "  '-f' first image format\n"
            "  '-F' second image format\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
+           "  '-m' specifies how many coroutines work in parallel during the compare\n"
+           "       process (defaults to 8)\n"
            "\n"
            "Parameters to dd subcommand:\n"
            "  'bs=BYTES' read and write up to BYTES bytes at a time "
@@ -1304,6 +1314,8 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 
 #define IO_BUF_SIZE (2 * MiB)
 
+#define MAX_COROUTINES 16
+
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
@@ -1342,6 +1354,213 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     return 0;
 }
 
+typedef struct ImgCompareState {
+    BlockBackend *blk1;
+    BlockBackend *blk2;
+    const char *filename1;
+    const char *filename2;
+    int64_t total_size1;
+    int64_t total_size2;
+    int64_t total_size;
+    uint64_t progress_base;
+    bool strict;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    /* Start of the range the next coroutine compares */
+    int64_t offset;
+    /*
+     * The failure found at the lowest offset, with its exit status and
+     * message, so that the result is the same as comparing in order.
+     */
+    int64_t fail_offset;
+    int fail_ret;
+    char *fail_msg;
+} ImgCompareState;
+
+static void compare_fail(ImgCompareState *s, int64_t offset, int ret,
+                         char *msg)
+{
+    if (!s->fail_msg || offset < s->fail_offset) {
+        g_free(s->fail_msg);
+        s->fail_offset = offset;
+        s->fail_ret = ret;
+        s->fail_msg = msg;
+    } else {
+        g_free(msg);
+    }
+}
+
+/* Whether a range with block status @status reads as zeroes */
+static bool compare_status_is_zero(int status)
+{
+    return (status & BDRV_BLOCK_ZERO) || !(status & BDRV_BLOCK_ALLOCATED);
+}
+
+/*
+ * Hand out the next range whose data must be read, skipping what both
+ * images report as zero or unallocated.  Returns false when the images
+ * are done or a failure was found; every range not handed out yet
+ * comes after that failure.
+ */
+static bool coroutine_fn compare_co_next(ImgCompareState *s,
+                                         int64_t *offset, int64_t *bytes,
+                                         int *status1, int *status2)
+{
+    int64_t pnum1, pnum2, chunk;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    while (!s->fail_msg && s->offset < s->total_size) {
+        *status1 = bdrv_block_status_above(blk_bs(s->blk1), NULL, s->offset,
+                                           s->total_size1 - s->offset,
+                                           &pnum1, NULL, NULL);
+        if (*status1 < 0) {
+            compare_fail(s, s->offset, 3,
+                         g_strdup_printf("Sector allocation test failed "
+                                         "for %s", s->filename1));
+            return false;
+        }
+
+        *status2 = bdrv_block_status_above(blk_bs(s->blk2), NULL, s->offset,
+                                           s->total_size2 - s->offset,
+                                           &pnum2, NULL, NULL);
+        if (*status2 < 0) {
+            compare_fail(s, s->offset, 3,
+                         g_strdup_printf("Sector allocation test failed "
+                                         "for %s", s->filename2));
+            return false;
+        }
+
+        assert(pnum1 && pnum2);
+        chunk = MIN(pnum1, pnum2);
+
+        if (s->strict && *status1 != *status2) {
+            compare_fail(s, s->offset, 1,
+                         g_strdup_printf("Strict mode: Offset %" PRId64
+                                         " block status mismatch!\n",
+                                         s->offset));
+            return false;
+        }
+
+        if (compare_status_is_zero(*status1) &&
+            compare_status_is_zero(*status2)) {
+            s->offset += chunk;
+            qemu_progress_print(((float) chunk / s->progress_base) * 100,
+                                100);
+            continue;
+        }
+
+        *offset = s->offset;
+        *bytes = MIN(chunk, IO_BUF_SIZE);
+        s->offset += *bytes;
+        return true;
+    }
+    return false;
+}
+
+static int coroutine_fn compare_co_read(ImgCompareState *s, BlockBackend *blk,
+                                        const char *filename, int64_t offset,
+                                        int64_t bytes, uint8_t *buf)
+{
+    int ret = blk_co_pread(blk, offset, bytes, buf, 0);
+
+    if (ret < 0) {
+        compare_fail(s, offset, 4,
+                     g_strdup_printf("Error while reading offset %" PRId64
+                                     " of %s: %s",
+                                     offset, filename, strerror(-ret)));
+    }
+    return ret;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1, *buf2;
+    int64_t offset, bytes, idx;
+    int status1, status2;
+
+    s->running_coroutines++;
+    buf1 = blk_blockalign(s->blk1, IO_BUF_SIZE);
+    buf2 = blk_blockalign(s->blk2, IO_BUF_SIZE);
+
+    while (compare_co_next(s, &offset, &bytes, &status1, &status2)) {
+        if (compare_status_is_zero(status2)) {
+            /* Only the first image has data here, it must be zeroes */
+            if (compare_co_read(s, s->blk1, s->filename1,
+                                offset, bytes, buf1) < 0) {
+                break;
+            }
+            idx = find_nonzero(buf1, bytes);
+        } else if (compare_status_is_zero(status1)) {
+            if (compare_co_read(s, s->blk2, s->filename2,
+                                offset, bytes, buf2) < 0) {
+                break;
+            }
+            idx = find_nonzero(buf2, bytes);
+        } else {
+            if (compare_co_read(s, s->blk1, s->filename1,
+                                offset, bytes, buf1) < 0 ||
+                compare_co_read(s, s->blk2, s->filename2,
+                                offset, bytes, buf2) < 0) {
+                break;
+            }
+            idx = -1;
+            /* One memcmp() over the chunk, then find the differing sector */
+            if (memcmp(buf1, buf2, bytes)) {
+                int64_t pnum;
+
+                idx = compare_buffers(buf1, buf2, bytes, &pnum) ? 0 : pnum;
+            }
+        }
+
+        if (idx >= 0) {
+            compare_fail(s, offset + idx, 1,
+                         g_strdup_printf("Content mismatch at offset %"
+                                         PRId64 "!\n", offset + idx));
+            break;
+        }
+        qemu_progress_print(((float) bytes / s->progress_base) * 100, 100);
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
+/*
+ * Compare the range both images have in common with s->num_coroutines
+ * coroutines in parallel.  Returns 0 if it is identical, otherwise the
+ * exit status of img_compare() after printing why.
+ */
+static int compare_do_compare(ImgCompareState *s, bool quiet)
+{
+    int i, ret;
+
+    qemu_co_mutex_init(&s->lock);
+    for (i = 0; i < s->num_coroutines; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(compare_co_do_compare, s));
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+
+    if (!s->fail_msg) {
+        return 0;
+    }
+    if (s->fail_ret == 1) {
+        qprintf(quiet, "%s", s->fail_msg);
+    } else {
+        error_report("%s", s->fail_msg);
+    }
+    ret = s->fail_ret;
+    g_free(s->fail_msg);
+    s->fail_msg = NULL;
+    return ret;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1353,22 +1572,21 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
+    uint8_t *buf1 = NULL;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
     int64_t total_size;
-    int64_t offset = 0;
+    int64_t offset;
     int64_t chunk;
     int c;
     uint64_t progress_base;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1379,7 +1597,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:pqsm:U",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1412,6 +1630,15 @@ static int img_compare(int argc, char **argv)
         case 's':
             strict = true;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = 2;
+                goto out4;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -1473,11 +1700,8 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
     buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1503,87 +1727,23 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
-
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    s = (ImgCompareState) {
+        .blk1 = blk1,
+        .blk2 = blk2,
+        .filename1 = filename1,
+        .filename2 = filename2,
+        .total_size1 = total_size1,
+        .total_size2 = total_size2,
+        .total_size = total_size,
+        .progress_base = progress_base,
+        .strict = strict,
+        .num_coroutines = num_coroutines,
+    };
+    ret = compare_do_compare(&s, quiet);
+    if (ret) {
+        goto out;
     }
+    offset = total_size;
 
     if (total_size1 != total_size2) {
         BlockBackend *blk_over;
@@ -1627,7 +1787,6 @@ static int img_compare(int argc, char **argv)
 
 out:
     qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1661,8 +1820,6 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
-
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1682,6 +1839,7 @@ typedef struct ImgConvertState {
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
     bool wr_in_order;
+    bool target_orders_compressed;
     bool copy_range;
     bool salvage;
     bool quiet;
@@ -1869,6 +2027,53 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+typedef struct ConvertZeroCheck {
+    const uint8_t *buf;
+    int n;
+    int pnum;
+    int min;
+    int64_t sector_num;
+    int alignment;
+} ConvertZeroCheck;
+
+static int convert_zero_check_worker(void *opaque)
+{
+    ConvertZeroCheck *c = opaque;
+
+    return is_allocated_sectors_min(c->buf, c->n, &c->pnum, c->min,
+                                    c->sector_num, c->alignment);
+}
+
+/*
+ * Scanning each buffer for zeroes is the most CPU intensive part of copying
+ * between fast devices.  When several coroutines are copying, do it in the
+ * thread pool so that buffers are scanned in parallel and the main loop thread
+ * only has to drive I/O.
+ */
+static int coroutine_fn convert_co_is_allocated(ImgConvertState *s,
+                                                const uint8_t *buf, int n,
+                                                int *pnum, int64_t sector_num)
+{
+    ConvertZeroCheck c = {
+        .buf = buf,
+        .n = n,
+        .min = s->min_sparse,
+        .sector_num = sector_num,
+        .alignment = s->alignment,
+    };
+    int ret;
+
+    if (s->num_coroutines == 1) {
+        return is_allocated_sectors_min(buf, n, pnum, s->min_sparse,
+                                        sector_num, s->alignment);
+    }
+
+    ret = thread_pool_submit_co(aio_get_thread_pool(qemu_get_aio_context()),
+                                convert_zero_check_worker, &c);
+    *pnum = c.pnum;
+    return ret;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
                                          enum ImgConvertBlockStatus status)
@@ -1896,8 +2101,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * zeroed. */
             if (!s->min_sparse ||
                 (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse,
-                                          sector_num, s->alignment)) ||
+                 convert_co_is_allocated(s, buf, n, &n, sector_num)) ||
                 (s->compressed &&
                  !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
             {
@@ -2030,8 +2234,13 @@ retry:
             memset(buf, 0x00, n * BDRV_SECTOR_SIZE);
         }
 
-        if (s->wr_in_order) {
-            /* keep writes in order */
+        /*
+         * Keep writes in order.  Compressed writes to a driver that orders
+         * them itself are submitted right away so that clusters are
+         * compressed in parallel by the driver.
+         */
+        if (s->wr_in_order &&
+            !(s->compressed && s->target_orders_compressed)) {
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
                 qemu_coroutine_yield();
@@ -2703,6 +2912,7 @@ static int img_convert(int argc, char **argv)
     } else {
         s.compressed = s.compressed || bdi.needs_compressed_writes;
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
+        s.target_orders_compressed = bdi.orders_compressed_writes;
     }
 
     ret = convert_do_copy(&s);
@@ -4275,10 +4485,50 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+typedef enum BenchDistribution {
+    BENCH_DIST_SEQUENTIAL,
+    BENCH_DIST_RANDOM,
+    BENCH_DIST_ZIPF,
+} BenchDistribution;
+
+/*
+ * Zipfian offset generator after Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases" (SIGMOD '94).
+ */
+typedef struct BenchZipf {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} BenchZipf;
+
+#define BENCH_ZIPF_DEFAULT_THETA    0.99
+#define BENCH_ZIPF_EXACT_TERMS      (1 << 20)
+
+/* Latency histogram: 10% wide bins from 1 us up to 10 s */
+#define BENCH_HIST_MIN_NS           1000
+#define BENCH_HIST_MAX_NS           (10 * NANOSECONDS_PER_SECOND)
+#define BENCH_HIST_STEP             1.1
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    QEMUIOVector qiov;
+    BlockAcctCookie acct;
+} BenchRequest;
+
+struct BenchData {
     BlockBackend *blk;
+    const char *filename;
     uint64_t image_size;
     bool write;
+    int read_percent;
+    BenchDistribution dist;
+    BenchZipf zipf;
+    GRand *rand;
+    uint64_t nr_blocks;
     int bufsize;
     int step;
     int nrreq;
@@ -4286,12 +4536,104 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    size_t buf_size;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nr_free_reqs;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+
+    int64_t start_ns;
+    int64_t end_ns;
+    uint64_t base_ops[BLOCK_MAX_IOTYPE];
+    uint64_t base_time_ns[BLOCK_MAX_IOTYPE];
+};
+
+static double bench_zeta(uint64_t n, double theta)
+{
+    uint64_t exact = MIN(n, BENCH_ZIPF_EXACT_TERMS);
+    double sum = 0;
+    uint64_t i;
+
+    for (i = 1; i <= exact; i++) {
+        sum += pow(1.0 / i, theta);
+    }
+
+    /* Approximate the remaining terms by the integral of x^-theta */
+    if (n > exact) {
+        sum += (pow(n + 0.5, 1 - theta) - pow(exact + 0.5, 1 - theta)) /
+               (1 - theta);
+    }
+
+    return sum;
+}
+
+static void bench_zipf_init(BenchZipf *z, uint64_t n, double theta)
+{
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = bench_zeta(n, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t bench_zipf_next(BenchZipf *z, GRand *rand)
+{
+    double u = g_rand_double(rand);
+    double uz = u * z->zetan;
+    uint64_t rank, lo, hi;
+
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, z->theta)) {
+        rank = 1;
+    } else {
+        rank = z->n * pow(z->eta * u - z->eta + 1.0, z->alpha);
+        rank = MIN(rank, z->n - 1);
+    }
+
+    /*
+     * Scatter the popular ranks over the whole image so that the hot set
+     * is not simply the start of the disk.  rank < n guarantees that the
+     * high half of the product is below n, so divu128() cannot overflow.
+     */
+    mulu64(&lo, &hi, rank, 0x9e3779b97f4a7c15ULL);
+    divu128(&lo, &hi, z->n);
+    return hi;
+}
+
+static int64_t bench_next_offset(BenchData *b)
+{
+    int64_t offset;
+
+    switch (b->dist) {
+    case BENCH_DIST_RANDOM:
+        offset = g_rand_double(b->rand) * b->nr_blocks;
+        return MIN(offset, b->nr_blocks - 1) * b->bufsize;
+    case BENCH_DIST_ZIPF:
+        return bench_zipf_next(&b->zipf, b->rand) * b->bufsize;
+    case BENCH_DIST_SEQUENTIAL:
+    default:
+        offset = b->offset;
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    }
+}
+
+static bool bench_next_is_write(BenchData *b)
+{
+    if (b->read_percent >= 100) {
+        return false;
+    } else if (b->read_percent <= 0) {
+        return true;
+    }
+    return g_rand_int_range(b->rand, 0, 100) >= b->read_percent;
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4301,6 +4643,8 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret);
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -4321,6 +4665,10 @@ static void bench_cb(void *opaque, int ret)
         b->n--;
         b->in_flight--;
 
+        if (b->n == 0) {
+            b->end_ns = get_clock();
+        }
+
         /* Time for flush? Drain queue if requested, then flush */
         if (b->flush_interval && remaining % b->flush_interval == 0) {
             if (!b->in_flight || !b->drain_on_flush) {
@@ -4346,18 +4694,23 @@ static void bench_cb(void *opaque, int ret)
     }
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
+        BenchRequest *req = b->free_reqs[--b->nr_free_reqs];
+        int64_t offset = bench_next_offset(b);
+        bool is_write = bench_next_is_write(b);
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
          */
         b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        block_acct_start(blk_get_stats(b->blk), &req->acct, b->bufsize,
+                         is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        if (is_write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -4366,30 +4719,266 @@ static void bench_cb(void *opaque, int ret)
     }
 }
 
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret < 0) {
+        block_acct_failed(blk_get_stats(b->blk), &req->acct);
+    } else {
+        block_acct_done(blk_get_stats(b->blk), &req->acct);
+    }
+    b->free_reqs[b->nr_free_reqs++] = req;
+
+    bench_cb(b, ret);
+}
+
+static int bench_setup_histograms(BenchData *b)
+{
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+    uint64List *boundaries = NULL, **next = &boundaries;
+    double bound;
+    int ret;
+
+    for (bound = BENCH_HIST_MIN_NS; bound < BENCH_HIST_MAX_NS;
+         bound *= BENCH_HIST_STEP)
+    {
+        uint64List *entry = g_new0(uint64List, 1);
+
+        entry->value = bound;
+        *next = entry;
+        next = &entry->next;
+    }
+
+    ret = block_latency_histogram_set(stats, BLOCK_ACCT_READ, boundaries);
+    if (!ret) {
+        ret = block_latency_histogram_set(stats, BLOCK_ACCT_WRITE,
+                                          boundaries);
+    }
+    qapi_free_uint64List(boundaries);
+    return ret;
+}
+
+/*
+ * Returns the upper bound of the histogram bin containing the @pct
+ * percentile, or 0 if there were no requests.
+ */
+static uint64_t bench_hist_percentile(BlockLatencyHistogram *hist, double pct)
+{
+    uint64_t total = 0, sum = 0, target;
+    int i;
+
+    for (i = 0; i < hist->nbins; i++) {
+        total += stat64_get(&hist->bins[i]);
+    }
+    if (!total) {
+        return 0;
+    }
+
+    target = MAX(ceil(total * pct / 100.0), 1);
+    for (i = 0; i < hist->nbins - 1; i++) {
+        sum += stat64_get(&hist->bins[i]);
+        if (sum >= target) {
+            return hist->boundaries[i];
+        }
+    }
+    return hist->boundaries[hist->nbins - 2];
+}
+
+static void bench_start(BenchData *b, int depth, int count, uint64_t offset)
+{
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+    int i;
+
+    b->nrreq = depth;
+    b->n = count;
+    b->offset = offset;
+    b->in_flight = 0;
+    b->in_flush = false;
+
+    b->nr_free_reqs = depth;
+    for (i = 0; i < depth; i++) {
+        b->free_reqs[i] = &b->reqs[depth - 1 - i];
+    }
+
+    bench_setup_histograms(b);
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        b->base_ops[i] = stat64_get(&stats->nr_ops[i]);
+        b->base_time_ns[i] = stat64_get(&stats->total_time_ns[i]);
+    }
+
+    b->start_ns = get_clock();
+    b->end_ns = b->start_ns;
+    bench_cb(b, 0);
+}
+
+static const double bench_percentiles[] = { 50, 90, 99, 99.9 };
+
+static QDict *bench_latency_json(BenchData *b, enum BlockAcctType type)
+{
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+    uint64_t ops = stat64_get(&stats->nr_ops[type]) - b->base_ops[type];
+    uint64_t time_ns = stat64_get(&stats->total_time_ns[type]) -
+                       b->base_time_ns[type];
+    QDict *dict = qdict_new();
+    char key[16];
+    int i;
+
+    qdict_put_int(dict, "requests", ops);
+    qdict_put_int(dict, "mean-ns", ops ? time_ns / ops : 0);
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        snprintf(key, sizeof(key), "p%g-ns", bench_percentiles[i]);
+        qdict_put_int(dict, key,
+                      bench_hist_percentile(hist, bench_percentiles[i]));
+    }
+    return dict;
+}
+
+static void bench_report_human(BenchData *b, int count)
+{
+    static const char *const names[BLOCK_MAX_IOTYPE] = {
+        [BLOCK_ACCT_READ] = "read",
+        [BLOCK_ACCT_WRITE] = "write",
+    };
+    static const enum BlockAcctType types[] = {
+        BLOCK_ACCT_READ, BLOCK_ACCT_WRITE
+    };
+    BlockAcctStats *stats = blk_get_stats(b->blk);
+    double secs = (double)(b->end_ns - b->start_ns) / NANOSECONDS_PER_SECOND;
+    int i, j;
+
+    printf("Run completed in %3.3f seconds.\n", secs);
+    if (secs > 0) {
+        printf("%s: %.0f IOPS, %.2f MiB/s\n", b->filename, count / secs,
+               (double)count * b->bufsize / MiB / secs);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(types); i++) {
+        enum BlockAcctType type = types[i];
+        BlockLatencyHistogram *hist = &stats->latency_histogram[type];
+        uint64_t ops = stat64_get(&stats->nr_ops[type]) - b->base_ops[type];
+        uint64_t time_ns = stat64_get(&stats->total_time_ns[type]) -
+                           b->base_time_ns[type];
+
+        if (!ops) {
+            continue;
+        }
+        printf("  %s latency (us): mean %.1f", names[type],
+               (double)time_ns / ops / SCALE_US);
+        for (j = 0; j < ARRAY_SIZE(bench_percentiles); j++) {
+            printf(", p%g <= %.1f", bench_percentiles[j],
+                   (double)bench_hist_percentile(hist, bench_percentiles[j]) /
+                   SCALE_US);
+        }
+        printf("\n");
+    }
+}
+
+static QObject *bench_driver_stats_json(BenchData *b)
+{
+    BlockStatsSpecific *stats = bdrv_get_specific_stats(blk_bs(b->blk));
+    QObject *obj = NULL;
+    Visitor *v;
+
+    if (!stats) {
+        return NULL;
+    }
+
+    v = qobject_output_visitor_new(&obj);
+    visit_type_BlockStatsSpecific(v, NULL, &stats, &error_abort);
+    visit_complete(v, &obj);
+    visit_free(v);
+    qapi_free_BlockStatsSpecific(stats);
+    return obj;
+}
+
+static QDict *bench_report_json(BenchData *b, int count)
+{
+    QDict *dict = qdict_new();
+    double secs = (double)(b->end_ns - b->start_ns) / NANOSECONDS_PER_SECOND;
+    QObject *driver_stats;
+
+    qdict_put_str(dict, "filename", b->filename);
+    qdict_put_int(dict, "depth", b->nrreq);
+    qdict_put_int(dict, "buffer-size", b->bufsize);
+    qdict_put_int(dict, "requests", count);
+    qdict_put_int(dict, "read-percent", b->read_percent);
+    qdict_put(dict, "seconds", qnum_from_double(secs));
+    qdict_put(dict, "iops", qnum_from_double(secs > 0 ? count / secs : 0));
+    qdict_put(dict, "bytes-per-second",
+              qnum_from_double(secs > 0 ?
+                               (double)count * b->bufsize / secs : 0));
+    qdict_put(dict, "read", bench_latency_json(b, BLOCK_ACCT_READ));
+    qdict_put(dict, "write", bench_latency_json(b, BLOCK_ACCT_WRITE));
+
+    driver_stats = bench_driver_stats_json(b);
+    if (driver_stats) {
+        qdict_put_obj(dict, "driver-specific", driver_stats);
+    }
+    return dict;
+}
+
+static int bench_parse_depths(const char *str, int **depths)
+{
+    gchar **list = g_strsplit(str, ",", 0);
+    int n = g_strv_length(list);
+    int i;
+
+    if (!n) {
+        g_strfreev(list);
+        return -EINVAL;
+    }
+
+    *depths = g_new(int, n);
+    for (i = 0; i < n; i++) {
+        unsigned long res;
+
+        if (qemu_strtoul(list[i], NULL, 0, &res) < 0 || res == 0 ||
+            res > INT_MAX)
+        {
+            g_strfreev(list);
+            g_free(*depths);
+            *depths = NULL;
+            return -EINVAL;
+        }
+        (*depths)[i] = res;
+    }
+
+    g_strfreev(list);
+    return n;
+}
+
 static int img_bench(int argc, char **argv)
 {
     int c, ret = 0;
-    const char *fmt = NULL, *filename;
+    const char *fmt = NULL;
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
     int count = 75000;
-    int depth = 64;
+    int default_depth = 64;
+    int *depths = &default_depth;
+    int nr_depths = 1;
+    int max_depth = 0;
     int64_t offset = 0;
     size_t bufsize = 4096;
     int pattern = 0;
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
-    int64_t image_size;
-    BlockBackend *blk = NULL;
-    BenchData data = {};
+    int read_percent = -1;
+    BenchDistribution dist = BENCH_DIST_SEQUENTIAL;
+    double zipf_theta = BENCH_ZIPF_DEFAULT_THETA;
+    OutputFormat output_format = OFORMAT_HUMAN;
+    BenchData *data = NULL;
+    int nr_images = 0;
+    QList *results = NULL;
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
-    int i;
+    int i, j, k;
     bool force_share = false;
-    size_t buf_size;
 
     for (;;) {
         static const struct option long_options[] = {
@@ -4399,6 +4988,9 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"read-percent", required_argument, 0, OPTION_READ_PERCENT},
+            {"distribution", required_argument, 0, OPTION_DISTRIBUTION},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4429,16 +5021,15 @@ static int img_bench(int argc, char **argv)
             break;
         }
         case 'd':
-        {
-            unsigned long res;
-
-            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > INT_MAX) {
+            if (depths != &default_depth) {
+                g_free(depths);
+            }
+            nr_depths = bench_parse_depths(optarg, &depths);
+            if (nr_depths < 0) {
                 error_report("Invalid queue depth specified");
                 return 1;
             }
-            depth = res;
             break;
-        }
         case 'f':
             fmt = optarg;
             break;
@@ -4532,89 +5123,223 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_READ_PERCENT:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            read_percent = res;
+            break;
+        }
+        case OPTION_DISTRIBUTION:
+        {
+            const char *theta_str;
+
+            if (!strcmp(optarg, "sequential")) {
+                dist = BENCH_DIST_SEQUENTIAL;
+            } else if (!strcmp(optarg, "random")) {
+                dist = BENCH_DIST_RANDOM;
+            } else if (strstart(optarg, "zipf", &theta_str) &&
+                       (!*theta_str || *theta_str == ':'))
+            {
+                dist = BENCH_DIST_ZIPF;
+                if (*theta_str &&
+                    (qemu_strtod(theta_str + 1, NULL, &zipf_theta) < 0 ||
+                     zipf_theta <= 0 || zipf_theta >= 1))
+                {
+                    error_report("Zipf theta must be between 0 and 1 "
+                                 "(exclusive)");
+                    return 1;
+                }
+            } else {
+                error_report("Invalid distribution '%s' (expecting "
+                             "'sequential', 'random' or 'zipf[:THETA]')",
+                             optarg);
+                return 1;
+            }
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json as "
+                             "argument.");
+                return 1;
+            }
+            break;
         }
     }
 
-    if (optind != argc - 1) {
-        error_exit("Expecting one image file name");
+    if (optind >= argc) {
+        error_exit("Expecting at least one image file name");
     }
-    filename = argv[argc - 1];
 
-    if (!is_write && flush_interval) {
-        error_report("--flush-interval is only available in write tests");
+    if (read_percent < 0) {
+        read_percent = is_write ? 0 : 100;
+    } else if (read_percent < 100 && !is_write) {
+        error_report("--read-percent below 100 requires -w");
         ret = -1;
         goto out;
     }
-    if (flush_interval && flush_interval < depth) {
-        error_report("Flush interval can't be smaller than depth");
-        ret = -1;
-        goto out;
+
+    for (i = 0; i < nr_depths; i++) {
+        max_depth = MAX(max_depth, depths[i]);
+        if (flush_interval && flush_interval < depths[i]) {
+            error_report("Flush interval can't be smaller than depth");
+            ret = -1;
+            goto out;
+        }
     }
 
-    blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
-                   force_share);
-    if (!blk) {
+    if (!is_write && flush_interval) {
+        error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
     }
 
-    image_size = blk_getlength(blk);
-    if (image_size < 0) {
-        ret = image_size;
-        goto out;
+    nr_images = argc - optind;
+    data = g_new0(BenchData, nr_images);
+    for (i = 0; i < nr_images; i++) {
+        BenchData *b = &data[i];
+        int64_t image_size;
+
+        b->filename = argv[optind + i];
+        b->blk = img_open(image_opts, b->filename, fmt, flags, writethrough,
+                          quiet, force_share);
+        if (!b->blk) {
+            ret = -1;
+            goto out;
+        }
+
+        image_size = blk_getlength(b->blk);
+        if (image_size < 0) {
+            ret = image_size;
+            goto out;
+        }
+
+        b->image_size     = image_size;
+        b->bufsize        = bufsize;
+        b->step           = step ?: bufsize;
+        b->write          = is_write;
+        b->read_percent   = read_percent;
+        b->dist           = dist;
+        b->flush_interval = flush_interval;
+        b->drain_on_flush = drain_on_flush;
+        b->nr_blocks      = bufsize ? image_size / bufsize : 0;
+        b->rand           = g_rand_new_with_seed(i);
+
+        if (dist != BENCH_DIST_SEQUENTIAL && !b->nr_blocks) {
+            error_report("'%s' is smaller than the buffer size", b->filename);
+            ret = -1;
+            goto out;
+        }
+        if (dist == BENCH_DIST_ZIPF) {
+            bench_zipf_init(&b->zipf, b->nr_blocks, zipf_theta);
+        }
+
+        b->buf_size = max_depth * b->bufsize;
+        b->buf = blk_blockalign(b->blk, b->buf_size);
+        memset(b->buf, pattern, b->buf_size);
+
+        blk_register_buf(b->blk, b->buf, b->buf_size);
+
+        b->reqs = g_new0(BenchRequest, max_depth);
+        b->free_reqs = g_new(BenchRequest *, max_depth);
+        for (j = 0; j < max_depth; j++) {
+            b->reqs[j].b = b;
+            qemu_iovec_init(&b->reqs[j].qiov, 1);
+            qemu_iovec_add(&b->reqs[j].qiov,
+                           b->buf + j * b->bufsize, b->bufsize);
+        }
     }
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (output_format == OFORMAT_JSON) {
+        results = qlist_new();
     }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+    for (k = 0; k < nr_depths; k++) {
 
-    blk_register_buf(blk, data.buf, buf_size);
+        if (output_format == OFORMAT_HUMAN) {
+            if (read_percent == 0 || read_percent == 100) {
+                printf("Sending %d %s requests, %d bytes each, "
+                       "%d in parallel ", count,
+                       read_percent ? "read" : "write", data[0].bufsize,
+                       depths[k]);
+            } else {
+                printf("Sending %d requests (%d%% reads), %d bytes each, "
+                       "%d in parallel ", count, read_percent,
+                       data[0].bufsize, depths[k]);
+            }
+            if (dist == BENCH_DIST_SEQUENTIAL) {
+                printf("(starting at offset %" PRId64 ", step size %d)\n",
+                       offset, data[0].step);
+            } else if (dist == BENCH_DIST_RANDOM) {
+                printf("(random offsets)\n");
+            } else {
+                printf("(zipf offsets, theta %g)\n", zipf_theta);
+            }
+            if (flush_interval) {
+                printf("Sending flush every %d requests\n", flush_interval);
+            }
+        }
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
-    }
+        for (i = 0; i < nr_images; i++) {
+            bench_start(&data[i], depths[k], count, offset);
+        }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
+        for (i = 0; i < nr_images; i++) {
+            while (data[i].n > 0) {
+                main_loop_wait(false);
+            }
+        }
 
-    while (data.n > 0) {
-        main_loop_wait(false);
+        for (i = 0; i < nr_images; i++) {
+            if (output_format == OFORMAT_JSON) {
+                qlist_append(results, bench_report_json(&data[i], count));
+            } else {
+                bench_report_human(&data[i], count);
+            }
+        }
     }
-    gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    if (results) {
+        QString *str = qobject_to_json_pretty(QOBJECT(results));
+
+        printf("%s\n", qstring_get_str(str));
+        qobject_unref(str);
+    }
 
 out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf);
+    qobject_unref(results);
+    for (i = 0; i < nr_images; i++) {
+        BenchData *b = &data[i];
+
+        if (b->reqs) {
+            for (j = 0; j < max_depth; j++) {
+                qemu_iovec_destroy(&b->reqs[j].qiov);
+            }
+        }
+        g_free(b->reqs);
+        g_free(b->free_reqs);
+        if (b->buf) {
+            blk_unregister_buf(b->blk, b->buf);
+        }
+        qemu_vfree(b->buf);
+        if (b->rand) {
+            g_rand_free(b->rand);
+        }
+        blk_unref(b->blk);
+    }
+    g_free(data);
+    if (depths != &default_depth) {
+        g_free(depths);
     }
-    qemu_vfree(data.buf);
-    blk_unref(blk);
 
     if (ret) {
         return 1;
@@ -62,6 +62,7 @@
 #define QEMU_NBD_OPT_FORK          263
 #define QEMU_NBD_OPT_TLSAUTHZ      264
 #define QEMU_NBD_OPT_PID_FILE      265
+#define QEMU_NBD_OPT_ZERO_COPY     266
 
 #define MBR_SIZE 512
 
@@ -96,6 +97,7 @@ static void usage(const char *name)
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name (default is empty string)\n"
 "  -D, --description=TEXT    export a human-readable description\n"
+"  --zero-copy               send large read replies with MSG_ZEROCOPY\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
@@ -553,6 +555,7 @@ int main(int argc, char **argv)
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -576,6 +579,7 @@ int main(int argc, char **argv)
     char *trace_file = NULL;
     bool fork_process = false;
     bool list = false;
+    bool zero_copy = false;
     int old_stderr = -1;
     unsigned socket_activation;
     const char *pid_file_name = NULL;
@@ -781,6 +785,9 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_PID_FILE:
             pid_file_name = optarg;
             break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
         }
     }
 
@@ -1077,6 +1084,11 @@ int main(int argc, char **argv)
             .description        = g_strdup(export_description),
             .has_bitmap         = !!bitmap,
             .bitmap             = g_strdup(bitmap),
+            .has_multi_conn     = true,
+            .multi_conn         = shared > 1 ? ON_OFF_AUTO_ON
+                                             : ON_OFF_AUTO_AUTO,
+            .has_zero_copy      = true,
+            .zero_copy          = zero_copy,
         },
     };
     blk_exp_add(export_opts, &error_fatal);
@@ -122,9 +122,16 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
+    "                halt-poll-max-ns=n (longest userspace poll of an idle vCPU, default=0)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                dirty-ring-size=n (KVM dirty ring entries per vCPU, default=0)\n"
     "                tb-size=n (TCG translation block cache size)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                jmp-cache-size=n (TCG per-vCPU jump cache sets, default=4096)\n"
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                perfmap=on|off (write a perf map of translated code)\n"
+    "                jitdump=on|off (write a perf jitdump of translated code)\n"
+    "                tb-exec-count=on|off (count executions of translated code)\n"
+    "                tb-revive=on|off (reuse invalidated code that is unchanged)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
     This is used to enable an accelerator. Depending on the target
@@ -145,12 +152,38 @@ SRST
         non-MSI interrupts. Disabling the in-kernel irqchip completely
         is not recommended except for debugging purposes.
 
+    ``halt-poll-max-ns=n``
+        Lets an idle vCPU spin for up to n nanoseconds waiting for a
+        wakeup before it goes to sleep. The window adapts to how soon
+        each vCPU is usually woken up, which cuts the latency of
+        request/response workloads at the cost of host CPU time.
+        With KVM this only covers halts handled by QEMU, i.e. it has no
+        effect with the in-kernel irqchip, where the kernel polls
+        instead. ``x-query-halt-poll`` shows the statistics (default=0,
+        i.e. no polling).
+
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``dirty-ring-size=n``
+        When KVM is in use, track dirty pages with a ring of n entries
+        per vCPU instead of the dirty bitmap of each memory slot. n must
+        be a power of two; the maximum depends on the host kernel. The
+        rings are harvested by a background thread, so that syncing the
+        dirty log costs time proportional to the number of dirty pages
+        rather than to the size of guest memory (default=0, i.e. use
+        the bitmap).
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``jmp-cache-size=n``
+        Controls the number of sets of the per-vCPU cache that maps guest
+        addresses to translation blocks; each set holds two blocks. A
+        larger cache helps guests with many indirect branches, such as
+        interpreters and JITs; ``info jit`` shows its hit rate. n must
+        be a power of two between 64 and 1048576 (default=4096).
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -158,6 +191,36 @@ SRST
         where both the back-end and front-ends support it and no
         incompatible TCG features have been enabled (e.g.
         icount/replay).
+
+    ``perfmap=on|off``
+        Describe the translated code to perf(1) in
+        ``/tmp/perf-<pid>.map``, so that ``perf report`` shows the guest
+        address that hot host code was translated from. The map is
+        rewritten whenever the translation block cache is flushed
+        (default=off).
+
+    ``jitdump=on|off``
+        Describe the translated code to perf(1) in ``./jit-<pid>.dump``,
+        to be merged with ``perf inject --jit`` into a recording made
+        with ``perf record -k 1``. Unlike ``perfmap``, this also covers
+        code that was translated before a flush of the translation block
+        cache and allows ``perf annotate`` (default=off).
+
+    ``tb-exec-count=on|off``
+        Count how many times each translation block is executed, and
+        list the most executed ones with ``info jit``. This finds the
+        hot loops of a guest without a plugin; the counters are
+        approximate with multi-threaded TCG and slow down execution
+        slightly (default=off).
+
+    ``tb-revive=on|off``
+        Keep the translation blocks that are invalidated by writes to
+        guest code pages, and link them again instead of translating
+        anew if the guest code they were translated from is unchanged.
+        This helps guests that keep writing data next to their code or
+        reload the same code, such as firmware on reset; ``info jit``
+        shows how many blocks were revived. It costs a copy of the guest
+        code of each translation block (default=off).
 ERST
 
 DEF("smp", HAS_ARG, QEMU_OPTION_smp,
@@ -586,6 +649,7 @@ DEF("audiodev", HAS_ARG, QEMU_OPTION_audiodev,
     "                server= PulseAudio server address\n"
     "                in|out.name= source/sink device name\n"
     "                in|out.latency= desired latency in microseconds\n"
+    "                in|out.try-poll= run the voice from PulseAudio callbacks\n"
 #endif
 #ifdef CONFIG_AUDIO_SDL
     "-audiodev sdl,id=id[,prop[=value][,...]]\n"
@@ -743,6 +807,10 @@ SRST
         Desired latency in microseconds. The PulseAudio server will try
         to honor this value but actual latencies may be lower or higher.
 
+    ``in|out.try-poll=on|off``
+        Run the voice when the PulseAudio stream requests or delivers
+        data, rather than from the audio timer. Default is on.
+
 ``-audiodev sdl,id=id[,prop[=value][,...]]``
     Creates a backend using SDL. This backend is available on most
     systems, but you should use your platform's native backend if
@@ -2390,7 +2458,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,io-uring=on|off]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2413,6 +2481,8 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to speciy the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use io-uring=on to read and write packets in batches through io_uring\n"
+    "                    (not compatible with vhost)\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -2467,12 +2537,24 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                with 'queues=n' (default: 1) QEMU will use 'n' queues of the interface\n"
+    "                starting from queue 'm' (default: 0)\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
+    "-netdev passt,id=str[,path=socketpath][,fd=h]\n"
+    "                connect to a passt user-mode networking daemon listening\n"
+    "                on UNIX socket 'socketpath', or through connected socket 'h'\n"
 #endif
 #ifdef __linux__
-    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev\n"
+    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev[,queues=n]\n"
     "                configure a vhost-vdpa network,Establish a vhost-vdpa netdev\n"
 #endif
     "-netdev hubport,id=str,hubid=n[,netdev=nd]\n"
@@ -2491,8 +2573,11 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
-    "vhost-user|"
+    "vhost-user|passt|"
 #endif
     "socket][,option][,...][mac=macaddr]\n"
     "                initialize an on-board / default host NIC (using MAC address\n"
@@ -2953,9 +3038,56 @@ SRST
              -netdev type=vhost-user,id=net0,chardev=chr0 \
              -device virtio-net-pci,netdev=net0
 
-``-netdev vhost-vdpa,vhostdev=/path/to/dev``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP socket.  A specific program attach mode for a default
+    XDP program can be forced with 'mode', defaults to best-effort,
+    where the likely most performant mode will be in use.  Number of
+    queues 'n' should generally match the number or queues in the
+    interface, defaults to 1.  Traffic arriving on non-configured device
+    queues will not be delivered to the network backend.  'start-queue'
+    selects the first queue of the interface to use.
+
+    ::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \
+            -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
+    Packets are read and written from the event loop of each queue, so
+    with ``iothread-vq-mapping`` on virtio-net every queue is served
+    from its own IOThread, which busy polls the socket according to
+    its ``poll-max-ns`` setting.
+
+``-netdev passt,id=str[,path=socketpath][,fd=h]``
+    Connect to a passt daemon, which gives the guest network access
+    without privileges, like ``-netdev user``, but terminates the
+    guest's TCP and UDP flows directly on host sockets.  passt runs as
+    a separate process; QEMU connects to the UNIX socket it listens on
+    (``path``), or uses a socket already connected to it (``fd``).
+
+    ::
+
+        passt
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \
+            -netdev passt,id=n1,path=/tmp/passt_1.socket
+
+    Frames are passed to the guest straight from the buffer they are
+    read into, many per read, and written to passt straight from the
+    guest's buffers.  With ``iothread-vq-mapping`` on virtio-net, the
+    backend is served from that IOThread instead of the main loop.
+
+``-netdev vhost-vdpa,vhostdev=/path/to/dev[,queues=n]``
     Establish a vhost-vdpa netdev.
 
+    All the queue pairs of the device are used; ``queues``, if given,
+    must match their number.  Use ``mq=on`` on the virtio-net device
+    to let the guest use more than one.  A control virtqueue of the
+    device is passed through to the guest, which then configures
+    queues, MAC filters and VLANs on the device directly.
+
     vDPA device is a device that uses a datapath which complies with
     the virtio specifications with a vendor specific control path.
     vDPA devices can be both physically located on the hardware or
@@ -4741,12 +4873,19 @@ SRST
         filter-redirector,id=f2,netdev=hn0,queue=rx,outdev=red1 -object
         filter-rewriter,id=rew0,netdev=hn0,queue=all
 
-    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,position=head|tail|id=<id>][,insert=behind|before]``
+    ``-object filter-dump,id=id,netdev=dev[,file=filename][,maxlen=len][,ring-size=bytes][,sample=n][,position=head|tail|id=<id>][,insert=behind|before]``
         Dump the network traffic on netdev dev to the file specified by
         filename. At most len bytes (64k by default) per packet are
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
+        With ``ring-size``, packets are copied into an in-memory ring of
+        that many bytes and written to the file by a separate thread,
+        so that capturing does not slow down the network path; packets
+        that do not fit in the ring are dropped and counted in the
+        read-only ``dropped`` property. ``sample=n`` only captures one
+        packet out of n.
+
     ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
@@ -4830,7 +4969,9 @@ SRST
         be used to reference this cryptodev backend from the
         ``virtio-crypto`` device. The queues parameter is optional,
         which specify the queue number of cryptodev backend, the default
-        of queues is 1.
+        of queues is 1.  Each queue is a data queue of the
+        ``virtio-crypto`` device; the device's ``iothread-vq-mapping``
+        property spreads them over IOThreads.
 
         .. parsed-literal::
 
@@ -5095,7 +5236,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,thread-pool-min=thread-pool-min,thread-pool-max=thread-pool-max,cpu-affinity=cpus,numa-node=node,sched-policy=policy,sched-priority=priority``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -5138,6 +5279,26 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+        Blocking work of the IOThread's devices, such as fsync or ioctls,
+        is done by a pool of worker threads.  The ``thread-pool-min``
+        parameter is the number of workers kept around even when idle,
+        so that bursts of such work do not wait for threads to be
+        created (default 0).  The ``thread-pool-max`` parameter limits
+        the number of workers (default 64).  Both can also be changed
+        with ``qom-set``.
+
+        The ``cpu-affinity`` parameter is the list of host CPUs the
+        IOThread runs on, in the format of Linux's cpulist files, such
+        as ``0-3,,8`` (commas are doubled on the command line).  The
+        ``numa-node`` parameter runs it on the CPUs of a host NUMA node
+        instead.  The ``sched-policy`` parameter is one of ``other``,
+        ``batch``, ``idle``, ``fifo`` and ``rr``, and ``sched-priority``
+        is the priority for ``fifo`` and ``rr``.  They are applied by
+        the IOThread before it starts running its event loop, and
+        creating it fails if they cannot be applied.  Its worker threads
+        inherit them.  They are only supported on Linux hosts, and
+        cannot be changed once the IOThread is running.
 ERST
 
 
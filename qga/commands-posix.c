@@ -26,6 +26,7 @@
 #include "qemu/sockets.h"
 #include "qemu/base64.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "commands-common.h"
 
 #ifdef HAVE_UTMPX
@@ -238,10 +239,26 @@ typedef enum {
     RW_STATE_WRITING,
 } RwState;
 
+/* Bytes moved by each read() and write() of a guest-file-stream */
+#define GUEST_FILE_STREAM_BUF_SIZE (1 * MiB)
+
+typedef struct GuestFileStream {
+    GuestFileStreamDirection direction;
+    int port_fd;
+    int64_t remaining;  /* bytes still to be read, or -1 for no limit */
+    int64_t count;      /* bytes written to the destination */
+    uint8_t *buf;
+    size_t buf_off;
+    size_t buf_len;
+    bool done;
+    char *error;
+} GuestFileStream;
+
 struct GuestFileHandle {
     uint64_t id;
     FILE *fh;
     RwState state;
+    GuestFileStream *stream;
     QTAILQ_ENTRY(GuestFileHandle) next;
 };
 
@@ -269,7 +286,7 @@ static int64_t guest_file_handle_add(FILE *fh, Error **errp)
     return handle;
 }
 
-GuestFileHandle *guest_file_handle_find(int64_t id, Error **errp)
+static GuestFileHandle *guest_file_handle_lookup(int64_t id, Error **errp)
 {
     GuestFileHandle *gfh;
 
@@ -284,6 +301,24 @@ GuestFileHandle *guest_file_handle_find(int64_t id, Error **errp)
     return NULL;
 }
 
+GuestFileHandle *guest_file_handle_find(int64_t id, Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_lookup(id, errp);
+
+    if (gfh && gfh->stream && !gfh->stream->done) {
+        error_setg(errp, "handle '%" PRId64 "' is busy with a stream "
+                   "transfer", id);
+        return NULL;
+    }
+    return gfh;
+}
+
+static void guest_file_stream_free(GuestFileStream *gfs)
+{
+    g_free(gfs->error);
+    g_free(gfs);
+}
+
 typedef const char * const ccpc;
 
 #ifndef O_BINARY
@@ -458,6 +493,9 @@ void qmp_guest_file_close(int64_t handle, Error **errp)
     }
 
     QTAILQ_REMOVE(&guest_file_state.filehandles, gfh, next);
+    if (gfh->stream) {
+        guest_file_stream_free(gfh->stream);
+    }
     g_free(gfh);
 }
 
@@ -615,6 +653,188 @@ void qmp_guest_file_flush(int64_t handle, Error **errp)
     }
 }
 
+static void guest_file_stream_finish(GuestFileHandle *gfh, int err)
+{
+    GuestFileStream *gfs = gfh->stream;
+    int fd = fileno(gfh->fh);
+    off_t pos;
+
+    if (err) {
+        gfs->error = g_strdup_printf("stream transfer failed: %s",
+                                     strerror(err));
+    }
+    close(gfs->port_fd);
+    gfs->port_fd = -1;
+    g_free(gfs->buf);
+    gfs->buf = NULL;
+    gfs->done = true;
+
+    /* The transfer moved the descriptor; bring the stdio stream along */
+    qemu_set_nonblock(fd);
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0) {
+        fseeko(gfh->fh, pos, SEEK_SET);
+    }
+    gfh->state = RW_STATE_NEW;
+
+    slog("guest-file-stream finished, handle: %" PRId64 ", count: %" PRId64
+         "%s%s", gfh->id, gfs->count, err ? ", error: " : "",
+         err ? strerror(err) : "");
+}
+
+static gboolean guest_file_stream_cb(GIOChannel *channel,
+                                     GIOCondition condition, gpointer opaque)
+{
+    GuestFileHandle *gfh = opaque;
+    GuestFileStream *gfs = gfh->stream;
+    int fd = fileno(gfh->fh);
+    size_t len = GUEST_FILE_STREAM_BUF_SIZE;
+    ssize_t ret;
+
+    if (gfs->remaining >= 0) {
+        len = MIN(len, gfs->remaining);
+    }
+
+    if (gfs->direction == GUEST_FILE_STREAM_DIRECTION_TO_HOST) {
+        /* Refill the buffer only once the port took all of it */
+        if (gfs->buf_off == gfs->buf_len) {
+            do {
+                ret = len ? read(fd, gfs->buf, len) : 0;
+            } while (ret < 0 && errno == EINTR);
+            if (ret <= 0) {
+                guest_file_stream_finish(gfh, ret < 0 ? errno : 0);
+                return G_SOURCE_REMOVE;
+            }
+            gfs->buf_off = 0;
+            gfs->buf_len = ret;
+            if (gfs->remaining >= 0) {
+                gfs->remaining -= ret;
+            }
+        }
+
+        ret = write(gfs->port_fd, gfs->buf + gfs->buf_off,
+                    gfs->buf_len - gfs->buf_off);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return G_SOURCE_CONTINUE;
+            }
+            guest_file_stream_finish(gfh, errno);
+            return G_SOURCE_REMOVE;
+        }
+        gfs->buf_off += ret;
+        gfs->count += ret;
+    } else {
+        /* A read of 0 bytes means the host closed its end of the port */
+        ret = len ? read(gfs->port_fd, gfs->buf, len) : 0;
+        if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return G_SOURCE_CONTINUE;
+        }
+        if (ret <= 0) {
+            guest_file_stream_finish(gfh, ret < 0 ? errno : 0);
+            return G_SOURCE_REMOVE;
+        }
+        if (qemu_write_full(fd, gfs->buf, ret) != ret) {
+            guest_file_stream_finish(gfh, errno);
+            return G_SOURCE_REMOVE;
+        }
+        gfs->count += ret;
+        if (gfs->remaining >= 0) {
+            gfs->remaining -= ret;
+        }
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void qmp_guest_file_stream(int64_t handle, const char *port,
+                           GuestFileStreamDirection direction,
+                           bool has_count, int64_t count, Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
+    g_autofree char *path = NULL;
+    GuestFileStream *gfs;
+    GIOChannel *channel;
+    int port_fd;
+
+    slog("guest-file-stream called, handle: %" PRId64 ", port: %s",
+         handle, port);
+    if (!gfh) {
+        return;
+    }
+    if (has_count && count < 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER, "count");
+        return;
+    }
+    if (!*port || strchr(port, '/')) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "port",
+                   "a virtio-serial port name");
+        return;
+    }
+
+    path = g_strdup_printf("/dev/virtio-ports/%s", port);
+    port_fd = qemu_open_old(path, (direction ==
+                                   GUEST_FILE_STREAM_DIRECTION_TO_HOST ?
+                                   O_WRONLY : O_RDONLY) | O_NONBLOCK);
+    if (port_fd < 0) {
+        error_setg_errno(errp, errno, "failed to open port '%s'", path);
+        return;
+    }
+
+    /* Start from the stream's position, with nothing left in its buffer */
+    if (fflush(gfh->fh) == EOF) {
+        error_setg_errno(errp, errno, "failed to flush file");
+        close(port_fd);
+        return;
+    }
+    qemu_set_block(fileno(gfh->fh));
+
+    if (gfh->stream) {
+        guest_file_stream_free(gfh->stream);
+    }
+    gfs = g_new0(GuestFileStream, 1);
+    gfs->direction = direction;
+    gfs->port_fd = port_fd;
+    gfs->remaining = has_count ? count : -1;
+    gfs->buf = g_malloc(GUEST_FILE_STREAM_BUF_SIZE);
+    gfh->stream = gfs;
+
+    channel = g_io_channel_unix_new(port_fd);
+    g_io_add_watch(channel,
+                   (direction == GUEST_FILE_STREAM_DIRECTION_TO_HOST ?
+                    G_IO_OUT : G_IO_IN) | G_IO_HUP | G_IO_ERR,
+                   guest_file_stream_cb, gfh);
+    g_io_channel_unref(channel);
+}
+
+GuestFileStreamStatus *qmp_guest_file_stream_status(int64_t handle,
+                                                    Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_lookup(handle, errp);
+    GuestFileStreamStatus *status;
+    GuestFileStream *gfs;
+
+    if (!gfh) {
+        return NULL;
+    }
+    gfs = gfh->stream;
+    if (!gfs) {
+        error_setg(errp, "no stream transfer on handle '%" PRId64 "'",
+                   handle);
+        return NULL;
+    }
+
+    status = g_new0(GuestFileStreamStatus, 1);
+    status->active = !gfs->done;
+    status->count = gfs->count;
+    if (gfs->done) {
+        status->has_error = gfs->error != NULL;
+        status->error = g_steal_pointer(&gfs->error);
+        guest_file_stream_free(gfs);
+        gfh->stream = NULL;
+    }
+    return status;
+}
+
 /* linux-specific implementations. avoid this if at all possible. */
 #if defined(__linux__)
 
@@ -2795,6 +3015,7 @@ GList *ga_command_blacklist_init(GList *blacklist)
             "guest-get-vcpus", "guest-set-vcpus",
             "guest-get-memory-blocks", "guest-set-memory-blocks",
             "guest-get-memory-block-size", "guest-get-memory-block-info",
+            "guest-file-stream", "guest-file-stream-status",
             NULL};
         char **p = (char **)list;
 
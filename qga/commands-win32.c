@@ -474,6 +474,20 @@ void qmp_guest_file_flush(int64_t handle, Error **errp)
     }
 }
 
+void qmp_guest_file_stream(int64_t handle, const char *port,
+                           GuestFileStreamDirection direction,
+                           bool has_count, int64_t count, Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+}
+
+GuestFileStreamStatus *qmp_guest_file_stream_status(int64_t handle,
+                                                    Error **errp)
+{
+    error_setg(errp, QERR_UNSUPPORTED);
+    return NULL;
+}
+
 #ifdef CONFIG_QGA_NTDDSCSI
 
 static GuestDiskBusType win2qemu[] = {
@@ -1942,6 +1956,7 @@ GList *ga_command_blacklist_init(GList *blacklist)
         "guest-set-vcpus",
         "guest-get-memory-blocks", "guest-set-memory-blocks",
         "guest-get-memory-block-size", "guest-get-memory-block-info",
+        "guest-file-stream", "guest-file-stream-status",
         NULL};
     char **p = (char **)list_unsupported;
 
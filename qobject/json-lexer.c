@@ -12,6 +12,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "json-parser-int.h"
 
 #define MAX_TOKEN_SIZE (64ULL << 20)
@@ -280,6 +281,19 @@ void json_lexer_init(JSONLexer *lexer, bool enable_interpolation)
     lexer->x = lexer->y = 0;
 }
 
+static void json_lexer_check_token_size(JSONLexer *lexer)
+{
+    /* Do not let a single token grow to an arbitrarily large size,
+     * this is a security consideration.
+     */
+    if (lexer->token->len > MAX_TOKEN_SIZE) {
+        json_message_process_token(lexer, lexer->token, lexer->state,
+                                   lexer->x, lexer->y);
+        g_string_truncate(lexer->token, 0);
+        lexer->state = lexer->start_state;
+    }
+}
+
 static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
 {
     int new_state;
@@ -331,23 +345,65 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
         lexer->state = new_state;
     }
 
-    /* Do not let a single token grow to an arbitrarily large size,
-     * this is a security consideration.
-     */
-    if (lexer->token->len > MAX_TOKEN_SIZE) {
-        json_message_process_token(lexer, lexer->token, lexer->state,
-                                   lexer->x, lexer->y);
-        g_string_truncate(lexer->token, 0);
-        lexer->state = lexer->start_state;
+    json_lexer_check_token_size(lexer);
+}
+
+#define ONES    0x0101010101010101ULL
+#define HIGHS   (ONES * 0x80)
+
+/* Whether any byte of @v is less than @n; exact if no byte has bit 7 set */
+#define HAS_LESS(v, n)  (((v) - ONES * (n)) & ~(v) & HIGHS)
+#define HAS_ZERO(v)     HAS_LESS(v, 1)
+
+/*
+ * Return the length of the prefix of @buffer that the lexer consumes
+ * without leaving string state @state, i.e. of the characters that are
+ * simply appended to the token.  Plain ASCII is checked eight bytes at
+ * a time, which is what most strings are made of.
+ */
+static size_t json_lexer_string_span(int state, const char *buffer,
+                                     size_t size)
+{
+    uint64_t quote = ONES * (state == IN_DQ_STRING ? '"' : '\'');
+    uint64_t backslash = ONES * '\\';
+    size_t i = 0;
+
+    while (i + 8 <= size) {
+        uint64_t v = ldq_he_p(buffer + i);
+
+        if ((v & HIGHS) || HAS_LESS(v, 0x20) ||
+            HAS_ZERO(v ^ quote) || HAS_ZERO(v ^ backslash)) {
+            break;
+        }
+        i += 8;
     }
+
+    while (i < size && json_lexer[state][(uint8_t)buffer[i]] == state) {
+        i++;
+    }
+    return i;
 }
 
 void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
 {
-    size_t i;
-
-    for (i = 0; i < size; i++) {
-        json_lexer_feed_char(lexer, buffer[i], false);
+    size_t i = 0;
+    size_t n;
+
+    while (i < size) {
+        if (lexer->state == IN_DQ_STRING || lexer->state == IN_SQ_STRING) {
+            /* Stop where the per-character path would hit the limit */
+            n = MIN(size - i, MAX_TOKEN_SIZE + 1 - lexer->token->len);
+            n = json_lexer_string_span(lexer->state, buffer + i, n);
+            if (n) {
+                /* No newlines in there, they are control characters */
+                g_string_append_len(lexer->token, buffer + i, n);
+                lexer->x += n;
+                i += n;
+                json_lexer_check_token_size(lexer);
+                continue;
+            }
+        }
+        json_lexer_feed_char(lexer, buffer[i++], false);
     }
 }
 
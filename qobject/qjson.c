@@ -163,6 +163,72 @@ static void json_pretty_newline(QString *str, bool pretty, int indent)
     }
 }
 
+static void to_json_str(const char *ptr, QString *str)
+{
+    const char *run;
+    int cp;
+    char buf[16];
+    char *end;
+
+    qstring_append_chr(str, '"');
+
+    while (*ptr) {
+        /* Copy printable ASCII that needs no escaping in one go */
+        run = ptr;
+        while (*ptr >= 0x20 && *ptr < 0x7F && *ptr != '"' && *ptr != '\\') {
+            ptr++;
+        }
+        if (ptr != run) {
+            qstring_append_len(str, run, ptr - run);
+            continue;
+        }
+
+        cp = mod_utf8_codepoint(ptr, 6, &end);
+        ptr = end;
+        switch (cp) {
+        case '\"':
+            qstring_append(str, "\\\"");
+            break;
+        case '\\':
+            qstring_append(str, "\\\\");
+            break;
+        case '\b':
+            qstring_append(str, "\\b");
+            break;
+        case '\f':
+            qstring_append(str, "\\f");
+            break;
+        case '\n':
+            qstring_append(str, "\\n");
+            break;
+        case '\r':
+            qstring_append(str, "\\r");
+            break;
+        case '\t':
+            qstring_append(str, "\\t");
+            break;
+        default:
+            if (cp < 0) {
+                cp = 0xFFFD; /* replacement character */
+            }
+            if (cp > 0xFFFF) {
+                /* beyond BMP; need a surrogate pair */
+                snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
+                         0xD800 + ((cp - 0x10000) >> 10),
+                         0xDC00 + ((cp - 0x10000) & 0x3FF));
+            } else if (cp < 0x20 || cp >= 0x7F) {
+                snprintf(buf, sizeof(buf), "\\u%04X", cp);
+            } else {
+                buf[0] = cp;
+                buf[1] = 0;
+            }
+            qstring_append(str, buf);
+        }
+    }
+
+    qstring_append_chr(str, '"');
+}
+
 static void to_json(const QObject *obj, QString *str, int pretty, int indent)
 {
     switch (qobject_type(obj)) {
@@ -171,73 +237,26 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         break;
     case QTYPE_QNUM: {
         QNum *val = qobject_to(QNum, obj);
-        char *buffer = qnum_to_string(val);
+        char *buffer;
+
+        /* Integers are the common case, format them without allocating */
+        if (val->kind == QNUM_I64) {
+            qstring_append_int(str, val->u.i64);
+            break;
+        }
+        buffer = qnum_to_string(val);
         qstring_append(str, buffer);
         g_free(buffer);
         break;
     }
-    case QTYPE_QSTRING: {
-        QString *val = qobject_to(QString, obj);
-        const char *ptr;
-        int cp;
-        char buf[16];
-        char *end;
-
-        ptr = qstring_get_str(val);
-        qstring_append(str, "\"");
-
-        for (; *ptr; ptr = end) {
-            cp = mod_utf8_codepoint(ptr, 6, &end);
-            switch (cp) {
-            case '\"':
-                qstring_append(str, "\\\"");
-                break;
-            case '\\':
-                qstring_append(str, "\\\\");
-                break;
-            case '\b':
-                qstring_append(str, "\\b");
-                break;
-            case '\f':
-                qstring_append(str, "\\f");
-                break;
-            case '\n':
-                qstring_append(str, "\\n");
-                break;
-            case '\r':
-                qstring_append(str, "\\r");
-                break;
-            case '\t':
-                qstring_append(str, "\\t");
-                break;
-            default:
-                if (cp < 0) {
-                    cp = 0xFFFD; /* replacement character */
-                }
-                if (cp > 0xFFFF) {
-                    /* beyond BMP; need a surrogate pair */
-                    snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
-                             0xD800 + ((cp - 0x10000) >> 10),
-                             0xDC00 + ((cp - 0x10000) & 0x3FF));
-                } else if (cp < 0x20 || cp >= 0x7F) {
-                    snprintf(buf, sizeof(buf), "\\u%04X", cp);
-                } else {
-                    buf[0] = cp;
-                    buf[1] = 0;
-                }
-                qstring_append(str, buf);
-            }
-        };
-
-        qstring_append(str, "\"");
+    case QTYPE_QSTRING:
+        to_json_str(qstring_get_str(qobject_to(QString, obj)), str);
         break;
-    }
     case QTYPE_QDICT: {
         QDict *val = qobject_to(QDict, obj);
         const char *comma = pretty ? "," : ", ";
         const char *sep = "";
         const QDictEntry *entry;
-        QString *qkey;
 
         qstring_append(str, "{");
 
@@ -247,9 +266,7 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
             qstring_append(str, sep);
             json_pretty_newline(str, pretty, indent + 1);
 
-            qkey = qstring_from_str(qdict_entry_key(entry));
-            to_json(QOBJECT(qkey), str, pretty, indent + 1);
-            qobject_unref(qkey);
+            to_json_str(qdict_entry_key(entry), str);
 
             qstring_append(str, ": ");
             to_json(qdict_entry_value(entry), str, pretty, indent + 1);
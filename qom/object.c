@@ -289,6 +289,8 @@ static void type_initialize(TypeImpl *ti)
         return;
     }
 
+    trace_type_initialize(ti->name);
+
     ti->class_size = type_class_get_size(ti);
     ti->instance_size = type_object_get_size(ti);
     /* Any type with zero instance_size is implicitly abstract.
@@ -1051,38 +1053,70 @@ ObjectClass *object_class_get_parent(ObjectClass *class)
 typedef struct OCFData
 {
     void (*fn)(ObjectClass *klass, void *opaque);
-    const char *implements_type;
+    TypeImpl *implements_type;
     bool include_abstract;
     void *opaque;
 } OCFData;
 
+/*
+ * Whether a class of @type can be cast to @target_type.  This only looks
+ * at the type declarations, so that the classes of the types an
+ * object_class_foreach() filters out need not be initialized.
+ */
+static bool type_implements(TypeImpl *type, TypeImpl *target_type)
+{
+    int i;
+
+    for (; type; type = type_get_parent(type)) {
+        if (type == target_type) {
+            return true;
+        }
+        for (i = 0; i < type->num_interfaces; i++) {
+            TypeImpl *iface = type_get_by_name(type->interfaces[i].typename);
+
+            if (iface && type_is_ancestor(iface, target_type)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 static void object_class_foreach_tramp(gpointer key, gpointer value,
                                        gpointer opaque)
 {
     OCFData *data = opaque;
     TypeImpl *type = value;
-    ObjectClass *k;
 
-    type_initialize(type);
-    k = type->class;
-
-    if (!data->include_abstract && type->abstract) {
+    if (data->implements_type &&
+        !type_implements(type, data->implements_type)) {
         return;
     }
 
-    if (data->implements_type && 
-        !object_class_dynamic_cast(k, data->implements_type)) {
+    type_initialize(type);
+
+    if (!data->include_abstract && type->abstract) {
         return;
     }
 
-    data->fn(k, data->opaque);
+    data->fn(type->class, data->opaque);
 }
 
 void object_class_foreach(void (*fn)(ObjectClass *klass, void *opaque),
                           const char *implements_type, bool include_abstract,
                           void *opaque)
 {
-    OCFData data = { fn, implements_type, include_abstract, opaque };
+    OCFData data = { fn, NULL, include_abstract, opaque };
+
+    trace_object_class_foreach(implements_type ?: "(null)", include_abstract);
+
+    if (implements_type) {
+        data.implements_type = type_get_by_name(implements_type);
+        if (!data.implements_type) {
+            return;
+        }
+    }
 
     enumerating_types = true;
     g_hash_table_foreach(type_table_get(), object_class_foreach_tramp, &data);
@@ -10,11 +10,32 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/*
+ * After its header, the log is a sequence of blocks of up to
+ * REPLAY_BLOCK_SIZE bytes of events.  Each block starts with its flags,
+ * the size of its events and the number of bytes it takes in the file.
+ * Offsets in the log (e.g. the one saved in snapshots) count the bytes
+ * of the events, so that a block is where one can start reading when
+ * seeking.
+ */
+#define REPLAY_BLOCK_SIZE           (1 * MiB)
+#define REPLAY_BLOCK_HEADER_SIZE    (3 * sizeof(uint32_t))
+#define REPLAY_BLOCK_ZSTD           1
+
+/* Blocks the writer thread may lag behind before recording waits for it */
+#define REPLAY_WRITER_MAX_QUEUED    8
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -30,6 +51,40 @@ static unsigned long mutex_head, mutex_tail;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * Block being filled when recording, or read when replaying.  block_offset
+ * is the log offset of block_data[0].
+ */
+static uint8_t *block_data;
+static size_t block_size;
+static size_t block_pos;
+static int64_t block_offset;
+
+typedef struct ReplayBlock {
+    uint8_t *data;
+    size_t size;
+    QSIMPLEQ_ENTRY(ReplayBlock) next;
+} ReplayBlock;
+
+/* Recorded blocks waiting for the writer thread, protected by writer_lock */
+static QemuThread writer_thread;
+static QemuMutex writer_lock;
+static QemuCond writer_cond;
+static QSIMPLEQ_HEAD(, ReplayBlock) writer_queue =
+    QSIMPLEQ_HEAD_INITIALIZER(writer_queue);
+static int writer_queued;
+static bool writer_running;
+static bool writer_exiting;
+
+typedef struct ReplayIndexEntry {
+    int64_t offset;
+    int64_t file_pos;
+} ReplayIndexEntry;
+
+/* Log offset and file position of each block when replaying */
+static GArray *replay_index;
+static unsigned int block_index;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -44,12 +99,299 @@ static void replay_read_error(void)
     exit(1);
 }
 
+/* Compress a block if possible and append it to the file */
+static void replay_write_block(const uint8_t *data, size_t size)
+{
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+    uint32_t flags = 0;
+    size_t stored = size;
+#ifdef CONFIG_ZSTD
+    size_t bound = ZSTD_compressBound(size);
+    g_autofree uint8_t *zbuf = g_malloc(bound);
+    size_t ret = ZSTD_compress(zbuf, bound, data, size, 1);
+
+    if (!ZSTD_isError(ret) && ret < size) {
+        flags |= REPLAY_BLOCK_ZSTD;
+        data = zbuf;
+        stored = ret;
+    }
+#endif
+
+    stl_be_p(header, flags);
+    stl_be_p(header + 4, size);
+    stl_be_p(header + 8, stored);
+    if (fwrite(header, 1, sizeof(header), replay_file) != sizeof(header) ||
+        fwrite(data, 1, stored, replay_file) != stored) {
+        replay_write_error();
+    }
+}
+
+static void *replay_writer_thread_fn(void *opaque)
+{
+    ReplayBlock *block;
+
+    qemu_mutex_lock(&writer_lock);
+    for (;;) {
+        block = QSIMPLEQ_FIRST(&writer_queue);
+        if (!block) {
+            if (writer_exiting) {
+                break;
+            }
+            qemu_cond_wait(&writer_cond, &writer_lock);
+            continue;
+        }
+        qemu_mutex_unlock(&writer_lock);
+
+        replay_write_block(block->data, block->size);
+
+        qemu_mutex_lock(&writer_lock);
+        QSIMPLEQ_REMOVE_HEAD(&writer_queue, next);
+        writer_queued--;
+        qemu_cond_broadcast(&writer_cond);
+        g_free(block->data);
+        g_free(block);
+    }
+    qemu_mutex_unlock(&writer_lock);
+
+    return NULL;
+}
+
+/* Hand the block being recorded to the writer and start a new one */
+static void replay_flush_block(void)
+{
+    ReplayBlock *block;
+
+    if (!block_pos) {
+        return;
+    }
+
+    if (!writer_running) {
+        replay_write_block(block_data, block_pos);
+        block_offset += block_pos;
+        block_pos = 0;
+        return;
+    }
+
+    block = g_new(ReplayBlock, 1);
+    block->data = block_data;
+    block->size = block_pos;
+    block_data = g_malloc(REPLAY_BLOCK_SIZE);
+    block_offset += block_pos;
+    block_pos = 0;
+
+    qemu_mutex_lock(&writer_lock);
+    while (writer_queued >= REPLAY_WRITER_MAX_QUEUED) {
+        qemu_cond_wait(&writer_cond, &writer_lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&writer_queue, block, next);
+    writer_queued++;
+    qemu_cond_broadcast(&writer_cond);
+    qemu_mutex_unlock(&writer_lock);
+}
+
+void replay_record_start(void)
+{
+    block_data = g_malloc(REPLAY_BLOCK_SIZE);
+    block_size = REPLAY_BLOCK_SIZE;
+    block_pos = 0;
+    block_offset = 0;
+}
+
+void replay_writer_start(void)
+{
+    qemu_mutex_init(&writer_lock);
+    qemu_cond_init(&writer_cond);
+    writer_running = true;
+    qemu_thread_create(&writer_thread, "replay-writer",
+                       replay_writer_thread_fn, NULL, QEMU_THREAD_JOINABLE);
+}
+
+void replay_record_finish(void)
+{
+    replay_flush_block();
+
+    if (writer_running) {
+        qemu_mutex_lock(&writer_lock);
+        writer_exiting = true;
+        qemu_cond_broadcast(&writer_cond);
+        qemu_mutex_unlock(&writer_lock);
+
+        qemu_thread_join(&writer_thread);
+        writer_running = false;
+        writer_exiting = false;
+    }
+
+    g_free(block_data);
+    block_data = NULL;
+}
+
+/* Make block @index of the log the current one */
+static bool replay_read_block(unsigned int index)
+{
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+    ReplayIndexEntry *entry;
+    uint32_t flags, size, stored;
+
+    if (index >= replay_index->len) {
+        return false;
+    }
+    entry = &g_array_index(replay_index, ReplayIndexEntry, index);
+
+    if (fseek(replay_file, entry->file_pos, SEEK_SET) != 0 ||
+        fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+        replay_read_error();
+    }
+    flags = ldl_be_p(header);
+    size = ldl_be_p(header + 4);
+    stored = ldl_be_p(header + 8);
+
+    if (flags & REPLAY_BLOCK_ZSTD) {
+#ifdef CONFIG_ZSTD
+        g_autofree uint8_t *zbuf = g_malloc(stored);
+
+        if (fread(zbuf, 1, stored, replay_file) != stored ||
+            ZSTD_decompress(block_data, REPLAY_BLOCK_SIZE,
+                            zbuf, stored) != size) {
+            replay_read_error();
+        }
+#else
+        error_report("replay log is compressed, but QEMU was built "
+                     "without zstd support");
+        exit(1);
+#endif
+    } else if (fread(block_data, 1, stored, replay_file) != stored) {
+        replay_read_error();
+    }
+
+    block_index = index;
+    block_offset = entry->offset;
+    block_size = size;
+    block_pos = 0;
+    return true;
+}
+
+void replay_play_start(void)
+{
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+    ReplayIndexEntry entry = {
+        .offset = 0,
+        .file_pos = ftell(replay_file),
+    };
+    uint32_t flags, size, stored;
+    size_t len;
+
+    /* Only the headers are read, so that seeking needs no scan later */
+    replay_index = g_array_new(false, false, sizeof(ReplayIndexEntry));
+    for (;;) {
+        len = fread(header, 1, sizeof(header), replay_file);
+        if (len == 0 && feof(replay_file)) {
+            break;
+        }
+        if (len != sizeof(header)) {
+            replay_read_error();
+        }
+        flags = ldl_be_p(header);
+        size = ldl_be_p(header + 4);
+        stored = ldl_be_p(header + 8);
+        if (size > REPLAY_BLOCK_SIZE ||
+            (!(flags & REPLAY_BLOCK_ZSTD) && stored != size)) {
+            replay_read_error();
+        }
+
+        g_array_append_val(replay_index, entry);
+        entry.offset += size;
+        entry.file_pos += sizeof(header) + stored;
+        if (fseek(replay_file, entry.file_pos, SEEK_SET) != 0) {
+            replay_read_error();
+        }
+    }
+    clearerr(replay_file);
+
+    block_data = g_malloc(REPLAY_BLOCK_SIZE);
+    block_index = 0;
+    block_offset = 0;
+    block_size = 0;
+    block_pos = 0;
+    replay_read_block(0);
+}
+
+void replay_play_finish(void)
+{
+    g_array_free(replay_index, true);
+    replay_index = NULL;
+    g_free(block_data);
+    block_data = NULL;
+}
+
+int64_t replay_tell(void)
+{
+    return block_offset + block_pos;
+}
+
+void replay_seek(int64_t offset)
+{
+    unsigned int lo = 0, hi = replay_index->len;
+
+    /* Find the last block that starts at or before @offset */
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if (g_array_index(replay_index, ReplayIndexEntry, mid).offset <=
+            offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo != block_index && !replay_read_block(lo)) {
+        replay_read_error();
+    }
+    if (offset < block_offset || offset - block_offset > block_size) {
+        replay_read_error();
+    }
+    block_pos = offset - block_offset;
+}
+
+static void replay_write(const uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t len;
+
+        if (block_pos == REPLAY_BLOCK_SIZE) {
+            replay_flush_block();
+        }
+        len = MIN(size, REPLAY_BLOCK_SIZE - block_pos);
+        memcpy(block_data + block_pos, buf, len);
+        block_pos += len;
+        buf += len;
+        size -= len;
+    }
+}
+
+static void replay_read(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t len;
+
+        if (block_pos == block_size && !replay_read_block(block_index + 1)) {
+            replay_read_error();
+        }
+        len = MIN(size, block_size - block_pos);
+        memcpy(buf, block_data + block_pos, len);
+        block_pos += len;
+        buf += len;
+        size -= len;
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (block_pos == REPLAY_BLOCK_SIZE) {
+            replay_flush_block();
         }
+        block_data[block_pos++] = byte;
     }
 }
 
@@ -82,9 +424,7 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
-        }
+        replay_write(buf, size);
     }
 }
 
@@ -92,11 +432,10 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
+        if (block_pos == block_size && !replay_read_block(block_index + 1)) {
             replay_read_error();
         }
-        byte = r;
+        byte = block_data[block_pos++];
     }
     return byte;
 }
@@ -138,9 +477,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(buf, *size);
     }
 }
 
@@ -149,9 +486,7 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_read(*buf, *size);
     }
 }
 
@@ -113,6 +113,21 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/*! Sets up buffering of the events recorded to the log. */
+void replay_record_start(void);
+/*! Starts the thread that compresses and writes the recorded events. */
+void replay_writer_start(void);
+/*! Writes the events still buffered and stops the writer thread. */
+void replay_record_finish(void);
+/*! Indexes the blocks of the log and loads the first one. */
+void replay_play_start(void);
+/*! Frees the index and buffer of the replayed log. */
+void replay_play_finish(void);
+/*! Returns the current offset in the log. */
+int64_t replay_tell(void);
+/*! Continues replaying from offset of the log. */
+void replay_seek(int64_t offset);
+
 /* Mutex functions for protecting replay log file and ensuring
  * synchronisation between vCPU and main-loop threads. */
 
@@ -17,12 +17,13 @@
 #include "replay-internal.h"
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
+#include "qemu/bswap.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200a
+#define REPLAY_VERSION              0xe0200b
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
@@ -297,14 +298,16 @@ static void replay_enable(const char *fname, int mode)
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_record_start();
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t header[HEADER_SIZE];
+
+        if (fread(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE ||
+            ldl_be_p(header) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_play_start();
         replay_fetch_data_kind();
     }
 
@@ -369,6 +372,14 @@ void replay_start(void)
 
     /* Timer for snapshotting will be set up here. */
 
+    /*
+     * Write the log from a separate thread from now on; it cannot be
+     * started earlier, as -daemonize forks after replay_configure().
+     */
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_writer_start();
+    }
+
     replay_enable_events();
 }
 
@@ -383,6 +394,8 @@ void replay_finish(void)
     /* finalize the file */
     if (replay_file) {
         if (replay_mode == REPLAY_MODE_RECORD) {
+            uint8_t header[HEADER_SIZE] = { 0 };
+
             /*
              * Can't do it in the signal handler, therefore
              * add shutdown event here for the case of Ctrl-C.
@@ -390,10 +403,16 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+            replay_record_finish();
 
             /* write header */
+            stl_be_p(header, REPLAY_VERSION);
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE) {
+                error_report("replay write error");
+            }
+        } else if (replay_mode == REPLAY_MODE_PLAY) {
+            replay_play_finish();
         }
 
         fclose(replay_file);
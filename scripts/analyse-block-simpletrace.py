@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+#
+# Break down the cost of block requests by layer
+#
+# Reads a simpletrace file with the virtio_blk_handle_*,
+# virtio_blk_rw_complete, blk_co_p* and bdrv_co_p* events enabled, as
+# written by "tests/qtest/virtio-bench -T", and reports for each layer of
+# the graph how long requests spent in it, excluding the layers below.
+# bdrv_open_driver events, if present, give the nodes their names.
+#
+# A request is followed through the layers by its offset, which the
+# graphs of virtio-bench do not change: at any time, only one request in
+# flight has a given offset.
+#
+# Usage: ./analyse-block-simpletrace.py [--mhz MHZ] <trace-events> <trace-file>
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+
+import argparse
+import simpletrace
+
+
+class Layer(object):
+    def __init__(self, name):
+        self.name = name
+        self.requests = 0
+        self.total_ns = 0
+        self.self_ns = 0
+
+
+class Frame(object):
+    def __init__(self, layer, start):
+        self.layer = layer
+        self.start = start
+        self.children_ns = 0
+
+
+class BlockAnalyzer(simpletrace.Analyzer):
+    "Accumulates the time spent by requests in each layer."
+
+    def __init__(self):
+        self.node_names = {}
+        self.layers = {}
+        self.order = []
+        self.stacks = {}
+        self.device_reqs = {}
+
+    def _layer(self, key, name):
+        if key not in self.layers:
+            self.layers[key] = Layer(name)
+            self.order.append(key)
+        return self.layers[key]
+
+    def _enter(self, timestamp, offset, key, name):
+        frame = Frame(self._layer(key, name), timestamp)
+        self.stacks.setdefault(offset, []).append(frame)
+
+    def _leave(self, timestamp, offset, key):
+        stack = self.stacks.get(offset, [])
+        layer = self.layers.get(key)
+        # Drop frames left open by requests that failed early
+        while stack and stack[-1].layer is not layer:
+            stack.pop()
+        if not stack:
+            return
+        frame = stack.pop()
+        total = timestamp - frame.start
+        frame.layer.requests += 1
+        frame.layer.total_ns += total
+        frame.layer.self_ns += total - frame.children_ns
+        if stack:
+            stack[-1].children_ns += total
+
+    def _node(self, bs):
+        if bs in self.node_names:
+            return self.node_names[bs]
+        return "bs 0x%x" % bs
+
+    def bdrv_open_driver(self, bs, node_name, format_name):
+        self.node_names[bs] = "%s (%s)" % (node_name, format_name)
+
+    def virtio_blk_handle_read(self, timestamp, vdev, req, sector, nsectors):
+        self.device_reqs[req] = sector * 512
+        self._enter(timestamp, sector * 512, ("dev", vdev), "virtio-blk")
+
+    def virtio_blk_handle_write(self, timestamp, vdev, req, sector, nsectors):
+        self.virtio_blk_handle_read(timestamp, vdev, req, sector, nsectors)
+
+    def virtio_blk_rw_complete(self, timestamp, vdev, req, ret):
+        if req in self.device_reqs:
+            self._leave(timestamp, self.device_reqs.pop(req), ("dev", vdev))
+
+    def blk_co_preadv(self, timestamp, blk, bs, offset, nbytes, flags):
+        self._enter(timestamp, offset, ("blk", blk), "BlockBackend")
+
+    def blk_co_pwritev(self, timestamp, blk, bs, offset, nbytes, flags):
+        self.blk_co_preadv(timestamp, blk, bs, offset, nbytes, flags)
+
+    def blk_co_preadv_done(self, timestamp, blk, offset, ret):
+        self._leave(timestamp, offset, ("blk", blk))
+
+    def blk_co_pwritev_done(self, timestamp, blk, offset, ret):
+        self.blk_co_preadv_done(timestamp, blk, offset, ret)
+
+    def bdrv_co_preadv(self, timestamp, bs, offset, nbytes, flags):
+        self._enter(timestamp, offset, ("bs", bs), self._node(bs))
+
+    def bdrv_co_pwritev(self, timestamp, bs, offset, nbytes, flags):
+        self.bdrv_co_preadv(timestamp, bs, offset, nbytes, flags)
+
+    def bdrv_co_preadv_done(self, timestamp, bs, offset, ret):
+        self._leave(timestamp, offset, ("bs", bs))
+
+    def bdrv_co_pwritev_done(self, timestamp, bs, offset, ret):
+        self.bdrv_co_preadv_done(timestamp, bs, offset, ret)
+
+
+def host_mhz():
+    "The clock of the first CPU in /proc/cpuinfo, or None"
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("cpu MHz"):
+                    return float(line.split(":")[1])
+    except (IOError, ValueError):
+        pass
+    return None
+
+
+def get_args():
+    "Grab options"
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--mhz", type=float, default=host_mhz(),
+                        help="host clock, to convert times to cycles "
+                        "(default from /proc/cpuinfo)")
+    parser.add_argument("events", type=str, help='trace-events file')
+    parser.add_argument("tracefile", type=str, help='trace file read from')
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+    args = get_args()
+
+    analyzer = BlockAnalyzer()
+    simpletrace.process(args.events, args.tracefile, analyzer)
+
+    # Layers appear in the order requests first enter them: top down
+    print("%-32s %10s %12s %12s %12s" %
+          ("layer", "requests", "ns/req", "self ns/req", "self cyc/req"))
+    for key in analyzer.order:
+        layer = analyzer.layers[key]
+        if not layer.requests:
+            continue
+        self_ns = float(layer.self_ns) / layer.requests
+        cycles = "%.0f" % (self_ns * args.mhz / 1000) if args.mhz else "-"
+        print("%-32s %10d %12.0f %12.0f %12s" %
+              (layer.name, layer.requests,
+               float(layer.total_ns) / layer.requests, self_ns, cycles))
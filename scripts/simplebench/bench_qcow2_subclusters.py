@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+#
+# Compare qcow2 cluster sizes with and without extended L2 entries
+# (subcluster allocation) for small random writes.
+#
+# For every combination of cluster size and extended_l2 setting, three
+# workloads are measured:
+#
+#   allocation  -- random 4k writes to an empty image without a backing file
+#   cow         -- random 4k writes to an overlay of a fully populated base,
+#                  so that every first write to a cluster needs copy-on-write
+#   cow+flush   -- like cow, but with a flush every 16 requests, which adds
+#                  the cost of writing out qcow2 metadata
+#
+# Besides the run time, the qcow2 'cow-bytes' and 'cow-bytes-avoided'
+# statistics (see BlockStatsSpecificQcow2) are reported for each cell.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import json
+import subprocess
+import simplebench
+
+
+IMAGE_SIZE = 1024 * 1024 * 1024
+REQUEST_SIZE = 4096
+REQUEST_COUNT = 16384
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its exit code and output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    out = subp.communicate()[0]
+    if subp.returncode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-subp.returncode, ' '.join(list(args))))
+    return subp.returncode, out
+
+
+def create_base(qemu_img, base):
+    """Create a raw image of IMAGE_SIZE bytes that is fully allocated"""
+    chunk = 1024 * 1024
+    ret, out = qemu_img_pipe(qemu_img, 'create', '-f', 'raw', base,
+                             str(IMAGE_SIZE))
+    if ret == 0:
+        ret, out = qemu_img_pipe(qemu_img, 'bench', '-w', '-f', 'raw',
+                                 '-t', 'writeback', '-c',
+                                 str(IMAGE_SIZE // chunk), '-s', str(chunk),
+                                 base)
+    if ret != 0:
+        print(f'Failed to create {base}: {out}')
+        sys.exit(1)
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    image = os.path.join(env['dir'], 'overlay.qcow2')
+    opts = f'cluster_size={env["cluster_size"]},' \
+           f'extended_l2={env["extended_l2"]}'
+
+    args_create = [env['qemu_img'], 'create', '-f', 'qcow2', '-o', opts]
+    if case['backing']:
+        args_create += ['-b', env['base'], '-F', 'raw']
+    args_create += [image, str(IMAGE_SIZE)]
+
+    args_bench = [env['qemu_img'], 'bench', '-w', '-f', 'qcow2',
+                  '-t', 'none', '--output=json', '--distribution=random',
+                  '-c', str(REQUEST_COUNT), '-s', str(REQUEST_SIZE)]
+    if case['flush_interval']:
+        args_bench += ['--flush-interval', str(case['flush_interval'])]
+    args_bench += [image]
+
+    try:
+        ret, out = qemu_img_pipe(*args_create)
+        if ret != 0:
+            return {'error': 'qemu-img create failed: ' + out}
+
+        ret, out = qemu_img_pipe(*args_bench)
+        if ret != 0:
+            return {'error': 'qemu-img bench failed: ' + out}
+    except OSError as e:
+        return {'error': 'qemu-img failed: ' + str(e)}
+    finally:
+        if os.path.exists(image):
+            os.remove(image)
+
+    try:
+        result = json.loads(out)[0]
+    except (ValueError, IndexError) as e:
+        return {'error': 'cannot parse qemu-img bench output: ' + str(e)}
+
+    stats = result.get('driver-specific', {})
+    return {
+        'seconds': result['seconds'],
+        'iops': result['iops'],
+        'cow-bytes': stats.get('cow-bytes', 0),
+        'cow-bytes-avoided': stats.get('cow-bytes-avoided', 0),
+    }
+
+
+def ascii_cow(results):
+    """Return a table of the average COW MiB copied / avoided per cell."""
+    from tabulate import tabulate
+
+    def mib(runs, key):
+        ok = [r[key] for r in runs if 'seconds' in r]
+        return sum(ok) / len(ok) / (1024 * 1024) if ok else None
+
+    tab = [[''] + [e['id'] for e in results['envs']]]
+    for case in results['cases']:
+        row = [case['id']]
+        for env in results['envs']:
+            runs = results['tab'][case['id']][env['id']]['runs']
+            copied = mib(runs, 'cow-bytes')
+            avoided = mib(runs, 'cow-bytes-avoided')
+            if copied is None:
+                row.append('FAILED')
+            else:
+                row.append(f'{copied:.1f} / {avoided:.1f}')
+        tab.append(row)
+
+    return tabulate(tab)
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 3:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<directory for the test images>')
+        exit(1)
+
+    qemu_img = sys.argv[1]
+    image_dir = sys.argv[2]
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_dir}')
+        sys.exit(1)
+
+    base = os.path.join(image_dir, 'base.raw')
+    create_base(qemu_img, base)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.
+    test_cases = [
+        {'id': 'allocation', 'backing': False, 'flush_interval': 0},
+        {'id': 'cow', 'backing': True, 'flush_interval': 0},
+        {'id': 'cow+flush', 'backing': True, 'flush_interval': 16},
+    ]
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = []
+    for cluster_size in (64 * 1024, 256 * 1024, 1024 * 1024, 2048 * 1024):
+        for extended_l2 in ('off', 'on'):
+            test_envs.append({
+                'id': f'{cluster_size // 1024}k l2={extended_l2}',
+                'qemu_img': qemu_img,
+                'dir': image_dir,
+                'base': base,
+                'cluster_size': cluster_size,
+                'extended_l2': extended_l2,
+            })
+
+    try:
+        result = simplebench.bench(bench_func, test_envs, test_cases,
+                                   count=3, initial_run=False)
+    finally:
+        os.remove(base)
+
+    print('Run time (seconds):')
+    print(simplebench.ascii(result))
+    print()
+    print('COW MiB copied / avoided by subclusters:')
+    print(ascii_cow(result))
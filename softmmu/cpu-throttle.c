@@ -33,25 +33,38 @@
 /* vcpu throttling controls */
 static QEMUTimer *throttle_timer;
 static unsigned int throttle_percentage;
+/* Period of throttle_timer, set from the highest throttle percentage */
+static int64_t throttle_period_ns;
 
 #define CPU_THROTTLE_PCT_MIN 1
 #define CPU_THROTTLE_PCT_MAX 99
 #define CPU_THROTTLE_TIMESLICE_NS 10000000
 
+/* The throttle percentage that applies to @cpu, 0 if it is not throttled */
+static int cpu_throttle_get_vcpu_pct(CPUState *cpu)
+{
+    return MAX(cpu_throttle_get_percentage(),
+               qatomic_read(&cpu->throttle_percentage));
+}
+
 static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 {
     double pct;
-    double throttle_ratio;
     int64_t sleeptime_ns, endtime_ns;
 
-    if (!cpu_throttle_get_percentage()) {
+    pct = (double)cpu_throttle_get_vcpu_pct(cpu) / 100;
+    if (!pct) {
+        qatomic_set(&cpu->throttle_thread_scheduled, 0);
         return;
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
-    throttle_ratio = pct / (1 - pct);
-    /* Add 1ns to fix double's rounding error (like 0.9999999...) */
-    sleeptime_ns = (int64_t)(throttle_ratio * CPU_THROTTLE_TIMESLICE_NS + 1);
+    /*
+     * The timer fires once per period, so sleeping for pct of it gives
+     * the vCPU the expected duty cycle.  With a single percentage this
+     * is pct / (1 - pct) times CPU_THROTTLE_TIMESLICE_NS.
+     * Add 1ns to fix double's rounding error (like 0.9999999...)
+     */
+    sleeptime_ns = (int64_t)(pct * qatomic_read(&throttle_period_ns) + 1);
     endtime_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + sleeptime_ns;
     while (sleeptime_ns > 0 && !cpu->stop) {
         if (sleeptime_ns > SCALE_MS) {
@@ -70,22 +83,31 @@ static void cpu_throttle_thread(CPUState *cpu, run_on_cpu_data opaque)
 static void cpu_throttle_timer_tick(void *opaque)
 {
     CPUState *cpu;
+    int pct_max = 0;
     double pct;
 
+    CPU_FOREACH(cpu) {
+        pct_max = MAX(pct_max, cpu_throttle_get_vcpu_pct(cpu));
+    }
+
     /* Stop the timer if needed */
-    if (!cpu_throttle_get_percentage()) {
+    if (!pct_max) {
         return;
     }
+
+    pct = (double)pct_max / 100;
+    qatomic_set(&throttle_period_ns, CPU_THROTTLE_TIMESLICE_NS / (1 - pct));
+
     CPU_FOREACH(cpu) {
-        if (!qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
+        if (cpu_throttle_get_vcpu_pct(cpu) &&
+            !qatomic_xchg(&cpu->throttle_thread_scheduled, 1)) {
             async_run_on_cpu(cpu, cpu_throttle_thread,
                              RUN_ON_CPU_NULL);
         }
     }
 
-    pct = (double)cpu_throttle_get_percentage() / 100;
     timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
-                                   CPU_THROTTLE_TIMESLICE_NS / (1 - pct));
+                                   qatomic_read(&throttle_period_ns));
 }
 
 void cpu_throttle_set(int new_throttle_pct)
@@ -100,9 +122,30 @@ void cpu_throttle_set(int new_throttle_pct)
                                        CPU_THROTTLE_TIMESLICE_NS);
 }
 
+void cpu_throttle_set_vcpu(CPUState *cpu, int new_throttle_pct)
+{
+    if (new_throttle_pct) {
+        new_throttle_pct = MIN(new_throttle_pct, CPU_THROTTLE_PCT_MAX);
+        new_throttle_pct = MAX(new_throttle_pct, CPU_THROTTLE_PCT_MIN);
+    }
+
+    qatomic_set(&cpu->throttle_percentage, new_throttle_pct);
+
+    /* Don't delay the tick when adjusting the vCPUs one by one */
+    if (new_throttle_pct && !timer_pending(throttle_timer)) {
+        timer_mod(throttle_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL_RT) +
+                                           CPU_THROTTLE_TIMESLICE_NS);
+    }
+}
+
 void cpu_throttle_stop(void)
 {
+    CPUState *cpu;
+
     qatomic_set(&throttle_percentage, 0);
+    CPU_FOREACH(cpu) {
+        qatomic_set(&cpu->throttle_percentage, 0);
+    }
 }
 
 bool cpu_throttle_active(void)
@@ -115,6 +158,11 @@ int cpu_throttle_get_percentage(void)
     return qatomic_read(&throttle_percentage);
 }
 
+int cpu_throttle_get_vcpu_percentage(CPUState *cpu)
+{
+    return qatomic_read(&cpu->throttle_percentage);
+}
+
 void cpu_throttle_init(void)
 {
     throttle_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL_RT,
@@ -34,6 +34,8 @@
 #include "exec/exec-all.h"
 #include "qemu/thread.h"
 #include "qemu/plugin.h"
+#include "qemu/processor.h"
+#include "qemu/timer.h"
 #include "sysemu/cpus.h"
 #include "qemu/guest-random.h"
 #include "hw/nmi.h"
@@ -398,19 +400,88 @@ void qemu_wait_io_event_common(CPUState *cpu)
     process_queued_cpu_work(cpu);
 }
 
+/* First polling window of a vCPU whose wakeups come in quick succession */
+#define HALT_POLL_START_NS 10000
+
+/*
+ * Spin without the BQL until the vCPU is kicked or its polling window
+ * elapses.  Waking up a sleeping thread costs far more than the wakeup
+ * latency of request/response workloads, so this pays off as long as the
+ * window stays short.  Returns true if the vCPU was kicked.
+ */
+static bool qemu_halt_poll(CPUState *cpu)
+{
+    int64_t start = get_clock();
+    int64_t now = start;
+    bool kicked;
+
+    qemu_mutex_unlock_iothread();
+    while (!(kicked = qatomic_read(&cpu->halt_poll_kicked)) &&
+           (uint64_t)(now - start) < cpu->halt_poll_ns) {
+        cpu_relax();
+        now = get_clock();
+    }
+    qemu_mutex_lock_iothread();
+
+    cpu->halt_poll_total_ns += now - start;
+    return kicked;
+}
+
+/*
+ * Grow the polling window when the vCPU slept for less than the longest
+ * window, since polling would have caught the wakeup, and shrink it when
+ * the vCPU stays idle for longer than polling is worth.
+ */
+static void qemu_halt_poll_adjust(CPUState *cpu, uint64_t halt_ns,
+                                  bool polled, uint64_t max_ns)
+{
+    if (polled) {
+        cpu->halt_poll_hits++;
+    } else if (cpu->halt_poll_ns) {
+        cpu->halt_poll_misses++;
+    }
+
+    if (halt_ns > max_ns) {
+        cpu->halt_poll_ns /= 2;
+        if (cpu->halt_poll_ns < HALT_POLL_START_NS) {
+            cpu->halt_poll_ns = 0;
+        }
+    } else if (!polled) {
+        cpu->halt_poll_ns = MIN(MAX(cpu->halt_poll_ns * 2, HALT_POLL_START_NS),
+                                max_ns);
+    }
+}
+
 void qemu_wait_io_event(CPUState *cpu)
 {
-    bool slept = false;
+    uint64_t halt_poll_max_ns = current_accel()->halt_poll_max_ns;
+    bool slept = false, polled = false;
+    int64_t halt_start = 0;
+
+    /* pairs with qemu_cpu_kick() */
+    qatomic_mb_set(&cpu->halt_poll_kicked, false);
 
     while (cpu_thread_is_idle(cpu)) {
         if (!slept) {
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
+            if (halt_poll_max_ns) {
+                halt_start = get_clock();
+                if (cpu->halt_poll_ns && qemu_halt_poll(cpu)) {
+                    polled = true;
+                    continue;
+                }
+            }
         }
+        polled = false;
         qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
     }
     if (slept) {
         qemu_plugin_vcpu_resume_cb(cpu);
+        if (halt_start) {
+            qemu_halt_poll_adjust(cpu, get_clock() - halt_start, polled,
+                                  halt_poll_max_ns);
+        }
     }
 
 #ifdef _WIN32
@@ -441,6 +512,7 @@ void cpus_kick_thread(CPUState *cpu)
 
 void qemu_cpu_kick(CPUState *cpu)
 {
+    qatomic_mb_set(&cpu->halt_poll_kicked, true);
     qemu_cond_broadcast(cpu->halt_cond);
     if (cpus_accel->kick_vcpu_thread) {
         cpus_accel->kick_vcpu_thread(cpu);
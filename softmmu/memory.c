@@ -40,6 +40,10 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+/* Regions whose rendering may have changed in the current transaction */
+static GHashTable *memory_region_changed;
+/* Every FlatView must be rendered again at commit time */
+static bool memory_region_changed_all;
 bool global_dirty_log;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
@@ -976,6 +980,89 @@ static void flatviews_init(void)
     }
 }
 
+/*
+ * Record that the rendering of @mr changed, together with every region
+ * whose rendering includes @mr's: its containers and the aliases that
+ * point to any of them.  Disabled regions are not rendered, so the walk
+ * stops there, except for @mr itself, whose enabled state may be the
+ * thing that changed.
+ */
+static void memory_region_mark_changed(MemoryRegion *mr, bool first)
+{
+    MemoryRegion *alias;
+
+    for (; mr; mr = mr->container) {
+        if (!first && !mr->enabled) {
+            return;
+        }
+        if (!g_hash_table_add(memory_region_changed, mr)) {
+            /* Walked from here already, so are its containers */
+            return;
+        }
+        QTAILQ_FOREACH(alias, &mr->alias_users, alias_users_link) {
+            memory_region_mark_changed(alias, false);
+        }
+        first = false;
+    }
+}
+
+static void memory_region_update_pending_for(MemoryRegion *mr)
+{
+    memory_region_update_pending = true;
+    if (memory_region_changed_all) {
+        return;
+    }
+    if (!memory_region_changed) {
+        memory_region_changed = g_hash_table_new(g_direct_hash,
+                                                 g_direct_equal);
+    }
+    memory_region_mark_changed(mr, true);
+}
+
+static void memory_region_update_pending_all(void)
+{
+    memory_region_update_pending = true;
+    memory_region_changed_all = true;
+}
+
+static gboolean flatview_is_stale(gpointer key, gpointer value,
+                                  gpointer opaque)
+{
+    GHashTable *live = opaque;
+
+    /* The empty view, keyed by NULL, is always kept around */
+    return key && (!g_hash_table_contains(live, key) ||
+                   g_hash_table_contains(memory_region_changed, key));
+}
+
+/*
+ * Render again only the FlatViews whose root was touched by the current
+ * transaction, or that no address space had before.  Views that are not
+ * used by any address space anymore are dropped, like flatviews_reset()
+ * does.
+ */
+static void flatviews_update(void)
+{
+    g_autoptr(GHashTable) live = g_hash_table_new(g_direct_hash,
+                                                  g_direct_equal);
+    AddressSpace *as;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        g_hash_table_add(live, memory_region_get_flatview_root(as->root));
+    }
+    g_hash_table_foreach_remove(flat_views, flatview_is_stale, live);
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+        if (g_hash_table_lookup(flat_views, physmr)) {
+            continue;
+        }
+
+        generate_memory_topology(physmr);
+    }
+}
+
 static void flatviews_reset(void)
 {
     AddressSpace *as;
@@ -998,7 +1085,8 @@ static void flatviews_reset(void)
     }
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+/* Returns true if @as switched to a different FlatView */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1007,7 +1095,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1041,6 +1129,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1070,13 +1159,24 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            if (memory_region_changed_all || !flat_views) {
+                flatviews_reset();
+            } else {
+                flatviews_update();
+            }
+            if (memory_region_changed) {
+                g_hash_table_remove_all(memory_region_changed);
+            }
+            memory_region_changed_all = false;
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                /* An unchanged view has the same ioeventfds */
+                if (address_space_set_flatview(as) ||
+                    ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -1223,6 +1323,7 @@ static void memory_region_initfn(Object *obj)
     mr->romd_mode = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
+    QTAILQ_INIT(&mr->alias_users);
     QTAILQ_INIT(&mr->coalesced);
 
     op = object_property_add(OBJECT(mr), "container",
@@ -1640,6 +1741,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QTAILQ_INSERT_TAIL(&orig->alias_users, mr, alias_users_link);
 }
 
 void memory_region_init_rom_nomigrate(MemoryRegion *mr,
@@ -1715,6 +1817,18 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    /* Aliases need not outlive their target, nor the other way round */
+    if (mr->alias && QTAILQ_IN_USE(mr, alias_users_link)) {
+        QTAILQ_REMOVE(&mr->alias->alias_users, mr, alias_users_link);
+    }
+    while (!QTAILQ_EMPTY(&mr->alias_users)) {
+        MemoryRegion *alias = QTAILQ_FIRST(&mr->alias_users);
+        QTAILQ_REMOVE(&mr->alias_users, alias, alias_users_link);
+    }
+    if (memory_region_changed) {
+        g_hash_table_remove(memory_region_changed, mr);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -1836,6 +1950,134 @@ int memory_region_register_iommu_notifier(MemoryRegion *mr,
     return ret;
 }
 
+#define IOMMU_TLB_CACHE_BITS 8
+#define IOMMU_TLB_CACHE_SIZE (1 << IOMMU_TLB_CACHE_BITS)
+
+typedef struct IOMMUTLBCacheEntry {
+    IOMMUTLBEntry iotlb;        /* unused if .perm is IOMMU_NONE */
+    int iommu_idx;
+} IOMMUTLBCacheEntry;
+
+typedef struct IOMMUTLBCacheNotifier {
+    IOMMUNotifier n;
+    IOMMUTLBCache *cache;
+} IOMMUTLBCacheNotifier;
+
+struct IOMMUTLBCache {
+    QemuSpin lock;
+    /* Bumped by invalidations, so that racing translations are not cached */
+    unsigned gen;
+    int num_notifiers;
+    IOMMUTLBCacheNotifier *notifiers;   /* one per IOMMU index */
+    /* Direct-mapped by the page number of the looked up address */
+    IOMMUTLBCacheEntry entries[IOMMU_TLB_CACHE_SIZE];
+};
+
+static void iommu_tlb_cache_unmap_notify(IOMMUNotifier *n,
+                                         IOMMUTLBEntry *iotlb)
+{
+    IOMMUTLBCache *cache = container_of(n, IOMMUTLBCacheNotifier, n)->cache;
+    hwaddr start = iotlb->iova;
+    hwaddr end = iotlb->iova + iotlb->addr_mask;
+    int i;
+
+    qemu_spin_lock(&cache->lock);
+    cache->gen++;
+    for (i = 0; i < IOMMU_TLB_CACHE_SIZE; i++) {
+        IOMMUTLBCacheEntry *e = &cache->entries[i];
+
+        if (e->iotlb.perm != IOMMU_NONE && e->iommu_idx == n->iommu_idx &&
+            e->iotlb.iova <= end &&
+            start <= e->iotlb.iova + e->iotlb.addr_mask) {
+            e->iotlb.perm = IOMMU_NONE;
+        }
+    }
+    qemu_spin_unlock(&cache->lock);
+}
+
+int memory_region_iommu_enable_tlb_cache(IOMMUMemoryRegion *iommu_mr,
+                                         Error **errp)
+{
+    IOMMUTLBCache *cache;
+    int i, ret;
+
+    if (iommu_mr->tlb_cache) {
+        return 0;
+    }
+
+    cache = g_new0(IOMMUTLBCache, 1);
+    qemu_spin_init(&cache->lock);
+    cache->num_notifiers = memory_region_iommu_num_indexes(iommu_mr);
+    cache->notifiers = g_new0(IOMMUTLBCacheNotifier, cache->num_notifiers);
+    for (i = 0; i < cache->num_notifiers; i++) {
+        cache->notifiers[i].cache = cache;
+        iommu_notifier_init(&cache->notifiers[i].n,
+                            iommu_tlb_cache_unmap_notify,
+                            IOMMU_NOTIFIER_UNMAP, 0, HWADDR_MAX, i);
+        ret = memory_region_register_iommu_notifier(MEMORY_REGION(iommu_mr),
+                                                    &cache->notifiers[i].n,
+                                                    errp);
+        if (ret) {
+            while (i-- > 0) {
+                memory_region_unregister_iommu_notifier(
+                    MEMORY_REGION(iommu_mr), &cache->notifiers[i].n);
+            }
+            g_free(cache->notifiers);
+            g_free(cache);
+            return ret;
+        }
+    }
+
+    qatomic_rcu_set(&iommu_mr->tlb_cache, cache);
+    return 0;
+}
+
+/* Called from RCU critical section */
+IOMMUTLBEntry memory_region_iommu_translate_cached(IOMMUMemoryRegion *iommu_mr,
+                                                   hwaddr addr,
+                                                   IOMMUAccessFlags flag,
+                                                   int iommu_idx)
+{
+    IOMMUMemoryRegionClass *imrc =
+        memory_region_get_iommu_class_nocheck(iommu_mr);
+    IOMMUTLBCache *cache = qatomic_rcu_read(&iommu_mr->tlb_cache);
+    IOMMUTLBCacheEntry *e;
+    IOMMUTLBEntry iotlb;
+    unsigned gen;
+
+    if (!cache) {
+        return imrc->translate(iommu_mr, addr, flag, iommu_idx);
+    }
+
+    e = &cache->entries[(addr >> TARGET_PAGE_BITS) &
+                        (IOMMU_TLB_CACHE_SIZE - 1)];
+    qemu_spin_lock(&cache->lock);
+    if ((e->iotlb.perm & flag) && e->iommu_idx == iommu_idx &&
+        (addr & ~e->iotlb.addr_mask) == e->iotlb.iova) {
+        iotlb = e->iotlb;
+        qemu_spin_unlock(&cache->lock);
+        return iotlb;
+    }
+    gen = cache->gen;
+    qemu_spin_unlock(&cache->lock);
+
+    /*
+     * Failed translations are not cached, so that the IOMMU gets to
+     * report the fault every time.
+     */
+    iotlb = imrc->translate(iommu_mr, addr, flag, iommu_idx);
+    if (iotlb.perm & flag) {
+        qemu_spin_lock(&cache->lock);
+        if (cache->gen == gen) {
+            e->iotlb = iotlb;
+            e->iotlb.iova = addr & ~iotlb.addr_mask;
+            e->iommu_idx = iommu_idx;
+        }
+        qemu_spin_unlock(&cache->lock);
+    }
+    return iotlb;
+}
+
 uint64_t memory_region_iommu_get_min_page_size(IOMMUMemoryRegion *iommu_mr)
 {
     IOMMUMemoryRegionClass *imrc = IOMMU_MEMORY_REGION_GET_CLASS(iommu_mr);
@@ -1981,7 +2223,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2007,18 +2251,24 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
-        if (!listener->log_sync) {
-            continue;
-        }
-        as = listener->address_space;
-        view = address_space_get_flatview(as);
-        FOR_EACH_FLAT_RANGE(fr, view) {
-            if (fr->dirty_log_mask && (!mr || fr->mr == mr)) {
-                MemoryRegionSection mrs = section_from_flat_range(fr, view);
-                listener->log_sync(listener, &mrs);
+        if (listener->log_sync) {
+            as = listener->address_space;
+            view = address_space_get_flatview(as);
+            FOR_EACH_FLAT_RANGE(fr, view) {
+                if (fr->dirty_log_mask && (!mr || fr->mr == mr)) {
+                    MemoryRegionSection mrs = section_from_flat_range(fr, view);
+                    listener->log_sync(listener, &mrs);
+                }
             }
+            flatview_unref(view);
+        } else if (listener->log_sync_global) {
+            /*
+             * No matter whether MR is specified, what we can do here
+             * is to do a global sync, because we are not capable to
+             * sync in a finer granularity.
+             */
+            listener->log_sync_global(listener);
         }
-        flatview_unref(view);
     }
 }
 
@@ -2099,7 +2349,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2109,7 +2361,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2119,7 +2373,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2371,7 +2627,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2410,7 +2668,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2421,7 +2681,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_pending_for(mr);
     memory_region_transaction_commit();
 }
 
@@ -2437,7 +2697,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_pending_for(mr);
     memory_region_transaction_commit();
 }
 
@@ -2449,6 +2709,10 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
         memory_region_transaction_begin();
         memory_region_ref(mr);
         memory_region_del_subregion(container, mr);
+        /* A FlatView rooted at @mr is rendered at its address */
+        if (mr->enabled) {
+            memory_region_update_pending_for(mr);
+        }
         mr->container = container;
         memory_region_update_container_subregions(mr);
         memory_region_unref(mr);
@@ -2474,7 +2738,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_pending_for(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2601,7 +2867,7 @@ void memory_global_dirty_log_start(void)
 
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_pending_all();
     memory_region_transaction_commit();
 }
 
@@ -2611,7 +2877,7 @@ static void memory_global_dirty_log_do_stop(void)
 
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
-    memory_region_update_pending = true;
+    memory_region_update_pending_all();
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2761,6 +3027,11 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    qemu_mutex_init(&as->bounce_lock);
+    QLIST_INIT(&as->bounce_buffers);
+    QLIST_INIT(&as->map_client_list);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
@@ -2770,7 +3041,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 static void do_address_space_destroy(AddressSpace *as)
 {
     assert(QTAILQ_EMPTY(&as->listeners));
+    assert(QLIST_EMPTY(&as->bounce_buffers));
+    assert(QLIST_EMPTY(&as->map_client_list));
 
+    qemu_mutex_destroy(&as->bounce_lock);
     flatview_unref(as->current_map);
     g_free(as->name);
     g_free(as->ioeventfds);
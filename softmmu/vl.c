@@ -109,6 +109,7 @@
 #include "qapi/qapi-visit-block-core.h"
 #include "qapi/qapi-visit-ui.h"
 #include "qapi/qapi-commands-block-core.h"
+#include "qapi/qapi-commands-machine.h"
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-ui.h"
 #include "qapi/qmp/qerror.h"
@@ -2395,6 +2396,70 @@ static void qemu_run_machine_init_done_notifiers(void)
     notifier_list_notify(&machine_init_done_notifiers, NULL);
 }
 
+typedef struct StartupPhase {
+    const char *name;
+    int64_t start_ns;
+    int64_t end_ns;
+} StartupPhase;
+
+static StartupPhase startup_phases[16];
+static int nb_startup_phases;
+
+/*
+ * End the current phase of qemu_init() and start phase @name, or none if
+ * @name is NULL.  Times are get_clock() times.
+ */
+static void startup_phase(const char *name)
+{
+    int64_t now = get_clock();
+
+    if (nb_startup_phases) {
+        StartupPhase *phase = &startup_phases[nb_startup_phases - 1];
+
+        if (!phase->end_ns) {
+            phase->end_ns = now;
+            trace_startup_phase(phase->name, phase->end_ns - phase->start_ns);
+        }
+    }
+
+    if (name) {
+        assert(nb_startup_phases < ARRAY_SIZE(startup_phases));
+        startup_phases[nb_startup_phases++] = (StartupPhase) {
+            .name = name,
+            .start_ns = now,
+        };
+    }
+}
+
+StartupTimesInfo *qmp_x_query_startup_times(Error **errp)
+{
+    StartupTimesInfo *info = g_new0(StartupTimesInfo, 1);
+    StartupPhaseInfoList **prev = &info->phases;
+    DeviceRealizeTimeInfoList *dev;
+    int64_t now = get_clock();
+    int64_t base = startup_phases[0].start_ns;
+    int i;
+
+    for (i = 0; i < nb_startup_phases; i++) {
+        StartupPhase *phase = &startup_phases[i];
+        StartupPhaseInfoList *elem = g_new0(StartupPhaseInfoList, 1);
+
+        elem->value = g_new0(StartupPhaseInfo, 1);
+        elem->value->name = g_strdup(phase->name);
+        elem->value->start_ns = phase->start_ns - base;
+        elem->value->duration_ns = (phase->end_ns ?: now) - phase->start_ns;
+        *prev = elem;
+        prev = &elem->next;
+    }
+
+    info->devices = qdev_get_startup_realize_times();
+    for (dev = info->devices; dev; dev = dev->next) {
+        dev->value->start_ns -= base;
+    }
+
+    return info;
+}
+
 static const QEMUOption *lookup_opt(int argc, char **argv,
                                     const char **poptarg, int *poptind)
 {
@@ -2892,6 +2957,8 @@ void qemu_init(int argc, char **argv, char **envp)
     QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
     int mem_prealloc = 0; /* force preallocation of physical target memory */
 
+    startup_phase("modules");
+
     os_set_line_buffering();
 
     error_init(argv[0]);
@@ -2952,6 +3019,8 @@ void qemu_init(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    startup_phase("options");
+
     QTAILQ_INIT(&vm_change_state_head);
     os_setup_early_signal_handling();
 
@@ -4139,6 +4208,8 @@ void qemu_init(int argc, char **argv, char **envp)
     page_size_init();
     socket_init();
 
+    startup_phase("backends");
+
     qemu_opts_foreach(qemu_find_opts("object"),
                       user_creatable_add_opts_foreach,
                       object_create_initial, &error_fatal);
@@ -4174,6 +4245,7 @@ void qemu_init(int argc, char **argv, char **envp)
      * Note: uses machine properties such as kernel-irqchip, must run
      * after machine_set_property().
      */
+    startup_phase("accel");
     configure_accelerators(argv[0]);
 
     /*
@@ -4363,6 +4435,7 @@ void qemu_init(int argc, char **argv, char **envp)
     parse_numa_opts(current_machine);
 
     /* do monitor/qmp handling at preconfig state if requested */
+    startup_phase("preconfig");
     qemu_main_loop();
 
     if (machine_class->default_ram_id && current_machine->ram_size &&
@@ -4370,7 +4443,11 @@ void qemu_init(int argc, char **argv, char **envp)
         create_default_memdev(current_machine, mem_path);
     }
 
+    /* The board may write to RAM, e.g. to load firmware */
+    os_mem_prealloc_finish(&error_fatal);
+
     /* from here on runstate is RUN_STATE_PRELAUNCH */
+    startup_phase("machine");
     machine_run_board_init(current_machine);
 
     /*
@@ -4393,6 +4470,7 @@ void qemu_init(int argc, char **argv, char **envp)
                       parse_fw_cfg, fw_cfg_find(), &error_fatal);
 
     /* init USB devices */
+    startup_phase("devices");
     if (machine_usb(current_machine)) {
         if (foreach_device_config(DEV_USB, usb_parse) < 0)
             exit(1);
@@ -4428,6 +4506,7 @@ void qemu_init(int argc, char **argv, char **envp)
     }
 
     /* init local displays */
+    startup_phase("displays");
     ds = init_displaystate();
     qemu_display_init(ds, &dpy);
 
@@ -4448,6 +4527,7 @@ void qemu_init(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    startup_phase("machine-done");
     qdev_machine_creation_done();
 
     /* TODO: once all bus devices are qdevified, this should be done
@@ -4463,11 +4543,13 @@ void qemu_init(int argc, char **argv, char **envp)
     qemu_register_reset(resettable_cold_reset_fn, sysbus_get_default());
     qemu_run_machine_init_done_notifiers();
 
+    startup_phase("roms");
     if (rom_check_and_register_reset() != 0) {
         error_report("rom check and register reset failed");
         exit(1);
     }
 
+    startup_phase("reset");
     replay_start();
 
     /* This checkpoint is required by replay to separate prior clock
@@ -4509,6 +4591,7 @@ void qemu_init(int argc, char **argv, char **envp)
     accel_setup_post(current_machine);
     os_setup_post();
 
+    startup_phase(NULL);
     return;
 }
 
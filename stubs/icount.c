@@ -35,6 +35,11 @@ int64_t icount_round(int64_t count)
     abort();
     return 0;
 }
+int64_t icount_get_limit(void)
+{
+    abort();
+    return 0;
+}
 void icount_start_warp_timer(void)
 {
     abort();
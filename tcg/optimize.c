@@ -41,6 +41,12 @@ struct tcg_temp_info {
     TCGTemp *next_copy;
     tcg_target_ulong val;
     tcg_target_ulong mask;
+    /* Bits known to be one, a subset of mask.  */
+    tcg_target_ulong o_mask;
+    /* Left-aligned run of high bits known to be copies of the sign bit,
+       including the sign bit itself.  32-bit values are considered as if
+       sign-extended from bit 31.  */
+    tcg_target_ulong s_mask;
 };
 
 static inline struct tcg_temp_info *ts_info(TCGTemp *ts)
@@ -81,6 +87,8 @@ static void reset_ts(TCGTemp *ts)
     ti->prev_copy = ts;
     ti->is_const = false;
     ti->mask = -1;
+    ti->o_mask = 0;
+    ti->s_mask = 0;
 }
 
 static void reset_temp(TCGArg arg)
@@ -101,6 +109,8 @@ static void init_ts_info(struct tcg_temp_info *infos,
         ti->prev_copy = ts;
         ti->is_const = false;
         ti->mask = -1;
+        ti->o_mask = 0;
+        ti->s_mask = 0;
         set_bit(idx, temps_used->l);
     }
 }
@@ -166,6 +176,26 @@ static bool args_are_copies(TCGArg arg1, TCGArg arg2)
     return ts_are_copies(arg_temp(arg1), arg_temp(arg2));
 }
 
+/* The s_mask of a value, i.e. its redundant sign bits and the sign bit.  */
+static tcg_target_ulong smask_from_value(tcg_target_ulong val)
+{
+    int rep = TCG_TARGET_REG_BITS == 32 ? clrsb32(val) : clrsb64(val);
+    return ~(tcg_target_ulong)0 << (TCG_TARGET_REG_BITS - 1 - rep);
+}
+
+/* The s_mask implied by the known-zero high bits of MASK.  */
+static tcg_target_ulong smask_from_zmask(tcg_target_ulong mask)
+{
+    int rep = TCG_TARGET_REG_BITS == 32 ? clz32(mask) : clz64(mask);
+    return rep ? ~(tcg_target_ulong)0 << (TCG_TARGET_REG_BITS - rep) : 0;
+}
+
+/* Any 32-bit value, seen sign-extended, has at least 33 sign bits.  */
+static tcg_target_ulong smask_32(tcg_target_ulong s_mask)
+{
+    return s_mask | ~(tcg_target_ulong)0x7fffffff;
+}
+
 static void tcg_opt_gen_movi(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg val)
 {
     const TCGOpDef *def;
@@ -193,6 +223,13 @@ static void tcg_opt_gen_movi(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg val)
     if (TCG_TARGET_REG_BITS > 32 && new_op == INDEX_op_movi_i32) {
         /* High bits of the destination are now garbage.  */
         mask |= ~0xffffffffull;
+        di->o_mask = (uint32_t)val;
+        di->s_mask = smask_from_value((int32_t)val);
+    } else if (def->flags & TCG_OPF_VECTOR) {
+        di->o_mask = val;
+    } else {
+        di->o_mask = val;
+        di->s_mask = smask_from_value(val);
     }
     di->mask = mask;
 }
@@ -229,9 +266,13 @@ static void tcg_opt_gen_mov(TCGContext *s, TCGOp *op, TCGArg dst, TCGArg src)
     op->args[1] = src;
 
     mask = si->mask;
+    di->o_mask = si->o_mask;
+    di->s_mask = si->s_mask;
     if (TCG_TARGET_REG_BITS > 32 && new_op == INDEX_op_mov_i32) {
         /* High bits of the destination are now garbage.  */
         mask |= ~0xffffffffull;
+        di->o_mask &= 0xffffffffu;
+        di->s_mask = smask_32(di->s_mask);
     }
     di->mask = mask;
 
@@ -496,6 +537,71 @@ static bool do_constant_folding_cond_eq(TCGCond c)
     }
 }
 
+/* Return 2 if the condition can't be simplified, and the result of
+   comparing X against the constant Y (0 or 1) if the known-zero and
+   known-one bits of X are enough to decide it.  */
+static TCGArg do_constant_folding_cond_bits(TCGOpcode op, TCGArg x,
+                                            uint64_t y, TCGCond c)
+{
+    bool is_64 = tcg_op_defs[op].flags & TCG_OPF_64BIT;
+    uint64_t hi = arg_info(x)->mask;
+    uint64_t lo = arg_info(x)->o_mask;
+    uint64_t sign = is_64 ? 1ull << 63 : 1ull << 31;
+    uint64_t smin, smax;
+    int64_t slo, shi, sy;
+
+    if (!is_64) {
+        hi = (uint32_t)hi;
+        lo = (uint32_t)lo;
+        y = (uint32_t)y;
+    }
+
+    /* The unsigned range of X is [lo, hi].  Unless the sign bit is known,
+       the signed range goes from the smallest negative value to the
+       largest positive value.  */
+    if ((hi & sign) == 0 || (lo & sign) != 0) {
+        smin = lo;
+        smax = hi;
+    } else {
+        smin = lo | sign;
+        smax = hi & ~sign;
+    }
+    if (is_64) {
+        slo = smin;
+        shi = smax;
+        sy = y;
+    } else {
+        slo = (int32_t)smin;
+        shi = (int32_t)smax;
+        sy = (int32_t)y;
+    }
+
+    switch (c) {
+    case TCG_COND_EQ:
+        return (y & ~hi) || (lo & ~y) ? 0 : 2;
+    case TCG_COND_NE:
+        return (y & ~hi) || (lo & ~y) ? 1 : 2;
+    case TCG_COND_LTU:
+        return hi < y ? 1 : lo >= y ? 0 : 2;
+    case TCG_COND_LEU:
+        return hi <= y ? 1 : lo > y ? 0 : 2;
+    case TCG_COND_GTU:
+        return lo > y ? 1 : hi <= y ? 0 : 2;
+    case TCG_COND_GEU:
+        return lo >= y ? 1 : hi < y ? 0 : 2;
+    case TCG_COND_LT:
+        return shi < sy ? 1 : slo >= sy ? 0 : 2;
+    case TCG_COND_LE:
+        return shi <= sy ? 1 : slo > sy ? 0 : 2;
+    case TCG_COND_GT:
+        return slo > sy ? 1 : shi <= sy ? 0 : 2;
+    case TCG_COND_GE:
+        return slo >= sy ? 1 : shi < sy ? 0 : 2;
+    default:
+        return 2;
+    }
+}
+
 /* Return 2 if the condition can't be simplified, and the result
    of the condition (0 or 1) if it can */
 static TCGArg do_constant_folding_cond(TCGOpcode op, TCGArg x,
@@ -513,15 +619,8 @@ static TCGArg do_constant_folding_cond(TCGOpcode op, TCGArg x,
         }
     } else if (args_are_copies(x, y)) {
         return do_constant_folding_cond_eq(c);
-    } else if (arg_is_const(y) && yv == 0) {
-        switch (c) {
-        case TCG_COND_LTU:
-            return 0;
-        case TCG_COND_GEU:
-            return 1;
-        default:
-            return 2;
-        }
+    } else if (arg_is_const(y)) {
+        return do_constant_folding_cond_bits(op, x, yv, c);
     }
     return 2;
 }
@@ -613,7 +712,7 @@ void tcg_optimize(TCGContext *s)
     infos = tcg_malloc(sizeof(struct tcg_temp_info) * nb_temps);
 
     QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
-        tcg_target_ulong mask, partmask, affected;
+        tcg_target_ulong mask, partmask, affected, omask, smask;
         int nb_oargs, nb_iargs, i;
         TCGArg tmp;
         TCGOpcode opc = op->opc;
@@ -846,12 +945,21 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
-        /* Simplify using known-zero bits. Currently only ops with a single
-           output argument is supported. */
+        /* Simplify using known-zero, known-one and sign bits.  Currently
+           only ops with a single output argument is supported. */
         mask = -1;
         affected = -1;
+        omask = 0;
+        smask = 0;
         switch (opc) {
         CASE_OP_32_64(ext8s):
+            omask = (int8_t)arg_info(op->args[1])->o_mask;
+            smask = arg_info(op->args[1])->s_mask | ~(tcg_target_ulong)0x7f;
+            if (arg_info(op->args[1])->s_mask & 0x80) {
+                /* Already sign-extended from bit 7.  */
+                affected = 0;
+                break;
+            }
             if ((arg_info(op->args[1])->mask & 0x80) != 0) {
                 break;
             }
@@ -859,6 +967,12 @@ void tcg_optimize(TCGContext *s)
             mask = 0xff;
             goto and_const;
         CASE_OP_32_64(ext16s):
+            omask = (int16_t)arg_info(op->args[1])->o_mask;
+            smask = arg_info(op->args[1])->s_mask | ~(tcg_target_ulong)0x7fff;
+            if (arg_info(op->args[1])->s_mask & 0x8000) {
+                affected = 0;
+                break;
+            }
             if ((arg_info(op->args[1])->mask & 0x8000) != 0) {
                 break;
             }
@@ -866,6 +980,12 @@ void tcg_optimize(TCGContext *s)
             mask = 0xffff;
             goto and_const;
         case INDEX_op_ext32s_i64:
+            omask = (int32_t)arg_info(op->args[1])->o_mask;
+            smask = smask_32(arg_info(op->args[1])->s_mask);
+            if (arg_info(op->args[1])->s_mask & 0x80000000) {
+                affected = 0;
+                break;
+            }
             if ((arg_info(op->args[1])->mask & 0x80000000) != 0) {
                 break;
             }
@@ -875,43 +995,71 @@ void tcg_optimize(TCGContext *s)
 
         CASE_OP_32_64(and):
             mask = arg_info(op->args[2])->mask;
+            omask = arg_info(op->args[2])->o_mask;
+            smask = arg_info(op->args[1])->s_mask
+                    & arg_info(op->args[2])->s_mask;
             if (arg_is_const(op->args[2])) {
         and_const:
+                /* The mask is exact, known-ones are the same bits.  */
+                omask = mask;
                 affected = arg_info(op->args[1])->mask & ~mask;
             }
+            omask &= arg_info(op->args[1])->o_mask;
             mask = arg_info(op->args[1])->mask & mask;
             break;
 
         case INDEX_op_ext_i32_i64:
+            /* The s_mask of 32-bit values already describes the result.  */
+            omask = (int32_t)arg_info(op->args[1])->o_mask;
+            smask = smask_32(arg_info(op->args[1])->s_mask);
             if ((arg_info(op->args[1])->mask & 0x80000000) != 0) {
                 break;
             }
         case INDEX_op_extu_i32_i64:
             /* We do not compute affected as it is a size changing op.  */
             mask = (uint32_t)arg_info(op->args[1])->mask;
+            omask = (uint32_t)arg_info(op->args[1])->o_mask;
             break;
 
         CASE_OP_32_64(andc):
+            smask = arg_info(op->args[1])->s_mask
+                    & arg_info(op->args[2])->s_mask;
             /* Known-zeros does not imply known-ones.  Therefore unless
                op->args[2] is constant, we can't infer anything from it.  */
             if (arg_is_const(op->args[2])) {
                 mask = ~arg_info(op->args[2])->mask;
                 goto and_const;
             }
-            /* But we certainly know nothing outside args[1] may be set. */
+            /* But we certainly know nothing outside args[1] may be set,
+               and the known-zeros of args[2] keep the known-ones of
+               args[1].  */
             mask = arg_info(op->args[1])->mask;
+            omask = arg_info(op->args[1])->o_mask
+                    & ~arg_info(op->args[2])->mask;
+            break;
+
+        CASE_OP_32_64(not):
+            mask = ~arg_info(op->args[1])->o_mask;
+            omask = ~arg_info(op->args[1])->mask;
+            smask = arg_info(op->args[1])->s_mask;
             break;
 
         case INDEX_op_sar_i32:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 31;
                 mask = (int32_t)arg_info(op->args[1])->mask >> tmp;
+                omask = (int32_t)arg_info(op->args[1])->o_mask >> tmp;
+                smask = (tcg_target_long)arg_info(op->args[1])->s_mask >> tmp;
+                smask |= ~(tcg_target_ulong)0 << (31 - tmp);
             }
             break;
         case INDEX_op_sar_i64:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 63;
                 mask = (int64_t)arg_info(op->args[1])->mask >> tmp;
+                omask = (int64_t)arg_info(op->args[1])->o_mask >> tmp;
+                smask = (int64_t)arg_info(op->args[1])->s_mask >> tmp;
+                smask |= ~(tcg_target_ulong)0 << (63 - tmp);
             }
             break;
 
@@ -919,26 +1067,33 @@ void tcg_optimize(TCGContext *s)
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 31;
                 mask = (uint32_t)arg_info(op->args[1])->mask >> tmp;
+                omask = (uint32_t)arg_info(op->args[1])->o_mask >> tmp;
             }
             break;
         case INDEX_op_shr_i64:
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & 63;
                 mask = (uint64_t)arg_info(op->args[1])->mask >> tmp;
+                omask = (uint64_t)arg_info(op->args[1])->o_mask >> tmp;
             }
             break;
 
         case INDEX_op_extrl_i64_i32:
             mask = (uint32_t)arg_info(op->args[1])->mask;
+            omask = arg_info(op->args[1])->o_mask;
+            smask = arg_info(op->args[1])->s_mask;
             break;
         case INDEX_op_extrh_i64_i32:
             mask = (uint64_t)arg_info(op->args[1])->mask >> 32;
+            omask = (uint64_t)arg_info(op->args[1])->o_mask >> 32;
+            smask = (int64_t)arg_info(op->args[1])->s_mask >> 32;
             break;
 
         CASE_OP_32_64(shl):
             if (arg_is_const(op->args[2])) {
                 tmp = arg_info(op->args[2])->val & (TCG_TARGET_REG_BITS - 1);
                 mask = arg_info(op->args[1])->mask << tmp;
+                omask = arg_info(op->args[1])->o_mask << tmp;
             }
             break;
 
@@ -952,11 +1107,16 @@ void tcg_optimize(TCGContext *s)
             mask = deposit64(arg_info(op->args[1])->mask,
                              op->args[3], op->args[4],
                              arg_info(op->args[2])->mask);
+            omask = deposit64(arg_info(op->args[1])->o_mask,
+                              op->args[3], op->args[4],
+                              arg_info(op->args[2])->o_mask);
             break;
 
         CASE_OP_32_64(extract):
             mask = extract64(arg_info(op->args[1])->mask,
                              op->args[2], op->args[3]);
+            omask = extract64(arg_info(op->args[1])->o_mask,
+                              op->args[2], op->args[3]);
             if (op->args[2] == 0) {
                 affected = arg_info(op->args[1])->mask & ~mask;
             }
@@ -964,14 +1124,41 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(sextract):
             mask = sextract64(arg_info(op->args[1])->mask,
                               op->args[2], op->args[3]);
-            if (op->args[2] == 0 && (tcg_target_long)mask >= 0) {
-                affected = arg_info(op->args[1])->mask & ~mask;
+            omask = sextract64(arg_info(op->args[1])->o_mask,
+                               op->args[2], op->args[3]);
+            smask = ~(tcg_target_ulong)0 << (op->args[3] - 1);
+            if (op->args[2] == 0) {
+                if ((arg_info(op->args[1])->s_mask & smask) == smask) {
+                    /* Already sign-extended from the top of the field.  */
+                    affected = 0;
+                } else if ((tcg_target_long)mask >= 0) {
+                    affected = arg_info(op->args[1])->mask & ~mask;
+                }
+                smask |= arg_info(op->args[1])->s_mask;
             }
             break;
 
         CASE_OP_32_64(or):
+            mask = arg_info(op->args[1])->mask | arg_info(op->args[2])->mask;
+            omask = arg_info(op->args[1])->o_mask
+                    | arg_info(op->args[2])->o_mask;
+            smask = arg_info(op->args[1])->s_mask
+                    & arg_info(op->args[2])->s_mask;
+            if (arg_is_const(op->args[2])) {
+                /* Nothing to do if all bits of the constant are already
+                   known to be set.  */
+                affected = arg_info(op->args[2])->val
+                           & ~arg_info(op->args[1])->o_mask;
+            }
+            break;
         CASE_OP_32_64(xor):
             mask = arg_info(op->args[1])->mask | arg_info(op->args[2])->mask;
+            omask = (arg_info(op->args[1])->o_mask
+                     & ~arg_info(op->args[2])->mask)
+                    | (arg_info(op->args[2])->o_mask
+                       & ~arg_info(op->args[1])->mask);
+            smask = arg_info(op->args[1])->s_mask
+                    & arg_info(op->args[2])->s_mask;
             break;
 
         case INDEX_op_clz_i32:
@@ -998,8 +1185,21 @@ void tcg_optimize(TCGContext *s)
 
         CASE_OP_32_64(movcond):
             mask = arg_info(op->args[3])->mask | arg_info(op->args[4])->mask;
+            omask = arg_info(op->args[3])->o_mask
+                    & arg_info(op->args[4])->o_mask;
+            smask = arg_info(op->args[3])->s_mask
+                    & arg_info(op->args[4])->s_mask;
             break;
 
+        CASE_OP_32_64(ld8s):
+            smask = ~(tcg_target_ulong)0x7f;
+            break;
+        CASE_OP_32_64(ld16s):
+            smask = ~(tcg_target_ulong)0x7fff;
+            break;
+        case INDEX_op_ld32s_i64:
+            smask = ~(tcg_target_ulong)0x7fffffff;
+            break;
         CASE_OP_32_64(ld8u):
             mask = 0xff;
             break;
@@ -1016,6 +1216,8 @@ void tcg_optimize(TCGContext *s)
                 MemOp mop = get_memop(oi);
                 if (!(mop & MO_SIGN)) {
                     mask = (2ULL << ((8 << (mop & MO_SIZE)) - 1)) - 1;
+                } else {
+                    smask = -1ULL << ((8 << (mop & MO_SIZE)) - 1);
                 }
             }
             break;
@@ -1032,6 +1234,10 @@ void tcg_optimize(TCGContext *s)
             mask |= ~(tcg_target_ulong)0xffffffffu;
             partmask &= 0xffffffffu;
             affected &= 0xffffffffu;
+            omask &= 0xffffffffu;
+            smask |= smask_from_zmask((int32_t)partmask);
+        } else {
+            smask |= smask_from_zmask(mask);
         }
 
         if (partmask == 0) {
@@ -1039,6 +1245,13 @@ void tcg_optimize(TCGContext *s)
             tcg_opt_gen_movi(s, op, op->args[0], 0);
             continue;
         }
+        if (omask != 0 && (partmask & ~omask) == 0) {
+            /* All the bits that may be set are known to be set.  */
+            tcg_debug_assert(nb_oargs == 1);
+            tmp = def->flags & TCG_OPF_64BIT ? omask : (int32_t)omask;
+            tcg_opt_gen_movi(s, op, op->args[0], tmp);
+            continue;
+        }
         if (affected == 0) {
             tcg_debug_assert(nb_oargs == 1);
             tcg_opt_gen_mov(s, op, op->args[0], op->args[1]);
@@ -1503,6 +1716,8 @@ void tcg_optimize(TCGContext *s)
                        first output argument (only one supported so far). */
                     if (i == 0) {
                         arg_info(op->args[i])->mask = mask;
+                        arg_info(op->args[i])->o_mask = omask;
+                        arg_info(op->args[i])->s_mask = smask;
                     }
                 }
             }
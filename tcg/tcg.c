@@ -63,6 +63,7 @@
 
 #include "elf.h"
 #include "exec/log.h"
+#include "accel/tcg/perf.h"
 #include "sysemu/sysemu.h"
 
 /* Forward declarations for functions declared in tcg-target.c.inc and
@@ -161,9 +162,22 @@ static TCGContext **tcg_ctxs;
 static unsigned int n_tcg_ctxs;
 TCGv_env cpu_env = 0;
 
+/*
+ * The TBs of a region, sorted by address.  A region is filled from
+ * start to end by a single TCGContext, so TBs are only ever appended,
+ * and the TB structure comes right before its code: the TB containing
+ * a host address is the last one at or below that address.
+ *
+ * Insertions and removals are done with @lock held.  Lookups are
+ * lock-free: @nb_tbs is published after the entry it covers, and
+ * removing a TB other than the last one only clears its entry.
+ */
 struct tcg_region_tree {
     QemuMutex lock;
-    GTree *tree;
+    TranslationBlock **tbs;
+    size_t nb_tbs;      /* entries in @tbs, including removed ones */
+    size_t nb_live;     /* entries in @tbs that are not NULL */
+    size_t capacity;
     /* padding to avoid false sharing is computed at run-time */
 };
 
@@ -343,62 +357,6 @@ static void set_jmp_reset_offset(TCGContext *s, int which)
 
 #include "tcg-target.c.inc"
 
-/* compare a pointer @ptr and a tb_tc @s */
-static int ptr_cmp_tb_tc(const void *ptr, const struct tb_tc *s)
-{
-    if (ptr >= s->ptr + s->size) {
-        return 1;
-    } else if (ptr < s->ptr) {
-        return -1;
-    }
-    return 0;
-}
-
-static gint tb_tc_cmp(gconstpointer ap, gconstpointer bp)
-{
-    const struct tb_tc *a = ap;
-    const struct tb_tc *b = bp;
-
-    /*
-     * When both sizes are set, we know this isn't a lookup.
-     * This is the most likely case: every TB must be inserted; lookups
-     * are a lot less frequent.
-     */
-    if (likely(a->size && b->size)) {
-        if (a->ptr > b->ptr) {
-            return 1;
-        } else if (a->ptr < b->ptr) {
-            return -1;
-        }
-        /* a->ptr == b->ptr should happen only on deletions */
-        g_assert(a->size == b->size);
-        return 0;
-    }
-    /*
-     * All lookups have either .size field set to 0.
-     * From the glib sources we see that @ap is always the lookup key. However
-     * the docs provide no guarantee, so we just mark this case as likely.
-     */
-    if (likely(a->size == 0)) {
-        return ptr_cmp_tb_tc(a->ptr, b);
-    }
-    return ptr_cmp_tb_tc(b->ptr, a);
-}
-
-static void tcg_region_trees_init(void)
-{
-    size_t i;
-
-    tree_size = ROUND_UP(sizeof(struct tcg_region_tree), qemu_dcache_linesize);
-    region_trees = qemu_memalign(qemu_dcache_linesize, region.n * tree_size);
-    for (i = 0; i < region.n; i++) {
-        struct tcg_region_tree *rt = region_trees + i * tree_size;
-
-        qemu_mutex_init(&rt->lock);
-        rt->tree = g_tree_new(tb_tc_cmp);
-    }
-}
-
 static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
 {
     size_t region_idx;
@@ -417,21 +375,55 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
     return region_trees + region_idx * tree_size;
 }
 
+/* Index of the last of the first @n @tbs at or below @p, or -1 if none */
+static ptrdiff_t tcg_region_tree_find(TranslationBlock **tbs, size_t n,
+                                      const void *p)
+{
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if ((const void *)qatomic_read(&tbs[mid]) <= p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (ptrdiff_t)lo - 1;
+}
+
 void tcg_tb_insert(TranslationBlock *tb)
 {
     struct tcg_region_tree *rt = tc_ptr_to_region_tree(tb->tc.ptr);
 
     qemu_mutex_lock(&rt->lock);
-    g_tree_insert(rt->tree, &tb->tc, tb);
+    g_assert(rt->nb_tbs < rt->capacity);
+    tcg_debug_assert(rt->nb_tbs == 0 || rt->tbs[rt->nb_tbs - 1] < tb);
+    qatomic_set(&rt->tbs[rt->nb_tbs], tb);
+    qatomic_store_release(&rt->nb_tbs, rt->nb_tbs + 1);
+    rt->nb_live++;
     qemu_mutex_unlock(&rt->lock);
 }
 
 void tcg_tb_remove(TranslationBlock *tb)
 {
     struct tcg_region_tree *rt = tc_ptr_to_region_tree(tb->tc.ptr);
+    ptrdiff_t i;
 
     qemu_mutex_lock(&rt->lock);
-    g_tree_remove(rt->tree, &tb->tc);
+    i = tcg_region_tree_find(rt->tbs, rt->nb_tbs, tb);
+    if (i >= 0 && rt->tbs[i] == tb) {
+        /*
+         * The last TB is the common case: its code is about to be
+         * reused by the next TB of this region, so drop the entry.
+         */
+        if (i == rt->nb_tbs - 1) {
+            qatomic_set(&rt->nb_tbs, i);
+        }
+        qatomic_set(&rt->tbs[i], NULL);
+        rt->nb_live--;
+    }
     qemu_mutex_unlock(&rt->lock);
 }
 
@@ -443,12 +435,19 @@ void tcg_tb_remove(TranslationBlock *tb)
 TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr)
 {
     struct tcg_region_tree *rt = tc_ptr_to_region_tree((void *)tc_ptr);
+    size_t n = qatomic_load_acquire(&rt->nb_tbs);
+    ptrdiff_t i = tcg_region_tree_find(rt->tbs, n, (void *)tc_ptr);
     TranslationBlock *tb;
-    struct tb_tc s = { .ptr = (void *)tc_ptr };
 
-    qemu_mutex_lock(&rt->lock);
-    tb = g_tree_lookup(rt->tree, &s);
-    qemu_mutex_unlock(&rt->lock);
+    if (i < 0) {
+        return NULL;
+    }
+    tb = qatomic_read(&rt->tbs[i]);
+    if (tb == NULL ||
+        tc_ptr < (uintptr_t)tb->tc.ptr ||
+        tc_ptr >= (uintptr_t)tb->tc.ptr + tb->tc.size) {
+        return NULL;
+    }
     return tb;
 }
 
@@ -481,9 +480,17 @@ void tcg_tb_foreach(GTraverseFunc func, gpointer user_data)
     tcg_region_tree_lock_all();
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
+        size_t j;
+
+        for (j = 0; j < rt->nb_tbs; j++) {
+            TranslationBlock *tb = rt->tbs[j];
 
-        g_tree_foreach(rt->tree, func, user_data);
+            if (tb && func(&tb->tc, tb, user_data)) {
+                goto out;
+            }
+        }
     }
+ out:
     tcg_region_tree_unlock_all();
 }
 
@@ -496,20 +503,12 @@ size_t tcg_nb_tbs(void)
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
-        nb_tbs += g_tree_nnodes(rt->tree);
+        nb_tbs += rt->nb_live;
     }
     tcg_region_tree_unlock_all();
     return nb_tbs;
 }
 
-static gboolean tcg_region_tree_traverse(gpointer k, gpointer v, gpointer data)
-{
-    TranslationBlock *tb = v;
-
-    tb_destroy(tb);
-    return FALSE;
-}
-
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -517,11 +516,15 @@ static void tcg_region_tree_reset_all(void)
     tcg_region_tree_lock_all();
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
+        size_t j;
 
-        g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
-        /* Increment the refcount first so that destroy acts as a reset */
-        g_tree_ref(rt->tree);
-        g_tree_destroy(rt->tree);
+        for (j = 0; j < rt->nb_tbs; j++) {
+            if (rt->tbs[j]) {
+                tb_destroy(rt->tbs[j]);
+            }
+        }
+        qatomic_set(&rt->nb_tbs, 0);
+        rt->nb_live = 0;
     }
     tcg_region_tree_unlock_all();
 }
@@ -544,6 +547,30 @@ static void tcg_region_bounds(size_t curr_region, void **pstart, void **pend)
     *pend = end;
 }
 
+static void tcg_region_trees_init(void)
+{
+    size_t tb_size = ROUND_UP(sizeof(TranslationBlock), qemu_icache_linesize);
+    size_t i;
+
+    tree_size = ROUND_UP(sizeof(struct tcg_region_tree), qemu_dcache_linesize);
+    region_trees = qemu_memalign(qemu_dcache_linesize, region.n * tree_size);
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+        void *start, *end;
+
+        tcg_region_bounds(i, &start, &end);
+        qemu_mutex_init(&rt->lock);
+        /*
+         * Every TB takes at least tb_size bytes of the region.  Most of
+         * the array is never touched, and costs no memory until it is.
+         */
+        rt->capacity = (end - start) / tb_size + 1;
+        rt->tbs = g_new0(TranslationBlock *, rt->capacity);
+        rt->nb_tbs = 0;
+        rt->nb_live = 0;
+    }
+}
+
 static void tcg_region_assign(TCGContext *s, size_t curr_region)
 {
     void *start, *end;
@@ -1080,6 +1107,7 @@ void tcg_prologue_init(TCGContext *s)
 
     /* Deduct the prologue from the buffer.  */
     prologue_size = tcg_current_code_size(s);
+    perf_report_prologue(buf0, prologue_size);
     s->code_gen_ptr = buf1;
     s->code_gen_buffer = buf1;
     s->code_buf = buf1;
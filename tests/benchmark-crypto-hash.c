@@ -101,6 +101,9 @@ int main(int argc, char **argv)
     TEST_ONE(SHA256, 1024);
     TEST_ONE(SHA256, 4096);
     TEST_ONE(SHA256, 16384);
+    /* quorum and dirty bitmap checks hash whole requests and bitmaps */
+    TEST_ONE(SHA256, 65536);
+    TEST_ONE(SHA256, 1048576);
 
     TEST_ONE(SHA512, 512);
     TEST_ONE(SHA512, 1024);
@@ -0,0 +1,63 @@
+/*
+ * HBitmap scan, count and merge speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/hbitmap.h"
+
+/* A 16 TiB disk tracked with 64 KiB granularity */
+#define BENCH_DISK_SIZE         (16 * TiB)
+#define BENCH_GRANULARITY       16
+
+static void test_hbitmap_speed(void)
+{
+    const int64_t size = BENCH_DISK_SIZE;
+    const int64_t chunk = 1 << BENCH_GRANULARITY;
+    int impl = 0;
+
+    do {
+        HBitmap *a = hbitmap_alloc(size, BENCH_GRANULARITY);
+        HBitmap *b = hbitmap_alloc(size, BENCH_GRANULARITY);
+        int64_t offset;
+
+        /* Half of the words in use, in different places */
+        for (offset = 0; offset < size; offset += 128 * chunk) {
+            hbitmap_set(a, offset, 32 * chunk);
+            hbitmap_set(b, offset + 64 * chunk, 32 * chunk);
+        }
+
+        g_test_timer_start();
+        hbitmap_merge(a, b, a);
+        g_test_timer_elapsed();
+        g_test_message("impl %d: merge %.2f ms", impl,
+                       g_test_timer_last() * 1000);
+
+        /* Setting everything has to count what was set before */
+        g_test_timer_start();
+        hbitmap_set(b, 0, size);
+        g_test_timer_elapsed();
+        g_test_message("impl %d: count %.2f ms", impl,
+                       g_test_timer_last() * 1000);
+
+        g_test_timer_start();
+        g_assert_cmpint(hbitmap_next_zero(b, 0, size), ==, -1);
+        g_test_timer_elapsed();
+        g_test_message("impl %d: next_zero %.2f ms", impl,
+                       g_test_timer_last() * 1000);
+
+        hbitmap_free(a);
+        hbitmap_free(b);
+        impl++;
+    } while (test_hbitmap_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/hbitmap/benchmark", test_hbitmap_speed);
+    return g_test_run();
+}
@@ -65,6 +65,21 @@ static const TypeInfo intermediate_impl_info = {
     .parent = TYPE_DIRECT_IMPL,
 };
 
+#define TYPE_UNRELATED "unrelated"
+
+static bool unrelated_class_initialized;
+
+static void unrelated_class_init(ObjectClass *oc, void *data)
+{
+    unrelated_class_initialized = true;
+}
+
+static const TypeInfo unrelated_info = {
+    .name = TYPE_UNRELATED,
+    .parent = TYPE_OBJECT,
+    .class_init = unrelated_class_init,
+};
+
 static void test_interface_impl(const char *type)
 {
     Object *obj = object_new(type);
@@ -86,6 +101,19 @@ static void interface_intermediate_test(void)
     test_interface_impl(TYPE_INTERMEDIATE_IMPL);
 }
 
+static void interface_list_test(void)
+{
+    GSList *list = object_class_get_list(TYPE_TEST_IF, false);
+
+    g_assert_cmpint(g_slist_length(list), ==, 2);
+    g_assert(g_slist_find(list, object_class_by_name(TYPE_DIRECT_IMPL)));
+    g_assert(g_slist_find(list, object_class_by_name(TYPE_INTERMEDIATE_IMPL)));
+    g_slist_free(list);
+
+    /* Classes that do not match are not initialized by the walk */
+    g_assert_false(unrelated_class_initialized);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -94,10 +122,12 @@ int main(int argc, char **argv)
     type_register_static(&test_if_info);
     type_register_static(&direct_impl_info);
     type_register_static(&intermediate_impl_info);
+    type_register_static(&unrelated_info);
 
     g_test_add_func("/qom/interface/direct_impl", interface_direct_test);
     g_test_add_func("/qom/interface/intermediate_impl",
                     interface_intermediate_test);
+    g_test_add_func("/qom/interface/list", interface_list_test);
 
     return g_test_run();
 }
@@ -117,8 +117,60 @@ COMPARISONS = [
         Scenario("compr-xbzrle-cache-10",
                  compression_xbzrle=True, compression_xbzrle_cache=10),
         Scenario("compr-xbzrle-cache-20",
-                 compression_xbzrle=True, compression_xbzrle_cache=10),
+                 compression_xbzrle=True, compression_xbzrle_cache=20),
         Scenario("compr-xbzrle-cache-50",
                  compression_xbzrle=True, compression_xbzrle_cache=50),
     ]),
+
+
+    # Looking at effect of multifd with varying numbers
+    # of channels
+    Comparison("multifd-channels", scenarios = [
+        Scenario("multifd-channels-1",
+                 multifd=True, multifd_channels=1),
+        Scenario("multifd-channels-2",
+                 multifd=True, multifd_channels=2),
+        Scenario("multifd-channels-4",
+                 multifd=True, multifd_channels=4),
+        Scenario("multifd-channels-8",
+                 multifd=True, multifd_channels=8),
+    ]),
+
+
+    # Looking at effect of the multifd compression methods,
+    # which depend on the libraries QEMU was built with
+    Comparison("multifd-compr", scenarios = [
+        Scenario("multifd-compr-none",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="none"),
+        Scenario("multifd-compr-zlib",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="zlib"),
+        Scenario("multifd-compr-zstd",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="zstd"),
+        Scenario("multifd-compr-lz4",
+                 multifd=True, multifd_channels=4,
+                 multifd_compression="lz4"),
+    ]),
+
+
+    # Looking at effect of the size of the memory the
+    # guest keeps dirtying
+    Comparison("dirty-mem", scenarios = [
+        Scenario("dirty-mem-64mb", workload_mem=64),
+        Scenario("dirty-mem-256mb", workload_mem=256),
+        Scenario("dirty-mem-512mb", workload_mem=512),
+        Scenario("dirty-mem-all", workload_mem=0),
+    ]),
+
+
+    # Looking at effect of the rate at which the guest
+    # dirties its memory
+    Comparison("dirty-rate", scenarios = [
+        Scenario("dirty-rate-100mbs", workload_rate=100),
+        Scenario("dirty-rate-500mbs", workload_rate=500),
+        Scenario("dirty-rate-2000mbs", workload_rate=2000),
+        Scenario("dirty-rate-max", workload_rate=0),
+    ]),
 ]
@@ -85,6 +85,19 @@ class Report(object):
             data["transport"],
             data["sleep"])
 
+    def summary(self):
+        # The figures worth tracking from one build to the next
+        last = self._progress_history[-1]
+        return {
+            "scenario": self._scenario._name,
+            "status": last._status,
+            "total_time_ms": last._duration,
+            "downtime_ms": last._downtime,
+            "setup_time_ms": last._setup_time,
+            "transferred_bytes": last._ram._transferred_bytes,
+            "iterations": last._ram._iterations,
+        }
+
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
 
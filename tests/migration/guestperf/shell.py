@@ -20,9 +20,11 @@
 
 import argparse
 import fnmatch
+import json
 import os
 import os.path
 import platform
+import subprocess
 import sys
 import logging
 
@@ -122,6 +124,13 @@ class Shell(BaseShell):
         parser.add_argument("--compression-xbzrle", dest="compression_xbzrle", default=False, action="store_true")
         parser.add_argument("--compression-xbzrle-cache", dest="compression_xbzrle_cache", default=10, type=int)
 
+        parser.add_argument("--multifd", dest="multifd", default=False, action="store_true")
+        parser.add_argument("--multifd-channels", dest="multifd_channels", default=2, type=int)
+        parser.add_argument("--multifd-compression", dest="multifd_compression", default="none")
+
+        parser.add_argument("--workload-mem", dest="workload_mem", default=0, type=int)
+        parser.add_argument("--workload-rate", dest="workload_rate", default=0, type=int)
+
     def get_scenario(self, args):
         return Scenario(name="perfreport",
                         downtime=args.downtime,
@@ -142,7 +151,14 @@ class Shell(BaseShell):
                         compression_mt_threads=args.compression_mt_threads,
 
                         compression_xbzrle=args.compression_xbzrle,
-                        compression_xbzrle_cache=args.compression_xbzrle_cache)
+                        compression_xbzrle_cache=args.compression_xbzrle_cache,
+
+                        multifd=args.multifd,
+                        multifd_channels=args.multifd_channels,
+                        multifd_compression=args.multifd_compression,
+
+                        workload_mem=args.workload_mem,
+                        workload_rate=args.workload_rate)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -177,8 +193,18 @@ class BatchShell(BaseShell):
 
         parser = self._parser
 
+        # Comma separated list of patterns
         parser.add_argument("--filter", dest="filter", default="*")
         parser.add_argument("--output", dest="output", default=os.getcwd())
+        parser.add_argument("--summary", dest="summary", default=None)
+
+    def get_version(self, args):
+        try:
+            out = subprocess.check_output([args.binary, "--version"],
+                                          universal_newlines=True)
+            return out.split("\n")[0]
+        except (OSError, subprocess.CalledProcessError):
+            return None
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -189,31 +215,62 @@ class BatchShell(BaseShell):
 
         engine = self.get_engine(args)
         hardware = self.get_hardware(args)
+        patterns = args.filter.split(",")
+        results = []
+        failed = False
+
+        for comparison in COMPARISONS:
+            for scenario in comparison._scenarios:
+                name = os.path.join(comparison._name, scenario._name)
+                if not any(fnmatch.fnmatch(name, pattern)
+                           for pattern in patterns):
+                    if args.verbose:
+                        print("Skipping %s" % name)
+                    continue
 
-        try:
-            for comparison in COMPARISONS:
-                compdir = os.path.join(args.output, comparison._name)
-                for scenario in comparison._scenarios:
-                    name = os.path.join(comparison._name, scenario._name)
-                    if not fnmatch.fnmatch(name, args.filter):
-                        if args.verbose:
-                            print("Skipping %s" % name)
-                        continue
+                if args.verbose:
+                    print("Running %s" % name)
 
-                    if args.verbose:
-                        print("Running %s" % name)
+                dirname = os.path.join(args.output, comparison._name)
+                filename = os.path.join(dirname, scenario._name + ".json")
+                if not os.path.exists(dirname):
+                    os.makedirs(dirname)
 
-                    dirname = os.path.join(args.output, comparison._name)
-                    filename = os.path.join(dirname, scenario._name + ".json")
-                    if not os.path.exists(dirname):
-                        os.makedirs(dirname)
+                # Carry on with the other scenarios if one fails, e.g.
+                # because QEMU was built without a compression library
+                try:
                     report = engine.run(hardware, scenario)
                     with open(filename, "w") as fh:
                         print(report.to_json(), file=fh)
-        except Exception as e:
-            print("Error: %s" % str(e), file=sys.stderr)
-            if args.debug:
-                raise
+                    result = report.summary()
+                    if result["status"] != "completed":
+                        failed = True
+                except Exception as e:
+                    print("Error: %s: %s" % (name, str(e)), file=sys.stderr)
+                    if args.debug:
+                        raise
+                    result = {
+                        "scenario": scenario._name,
+                        "status": "error",
+                        "error": str(e),
+                    }
+                    failed = True
+                result["comparison"] = comparison._name
+                results.append(result)
+
+        if args.summary is not None:
+            dirname = os.path.dirname(args.summary)
+            if dirname and not os.path.exists(dirname):
+                os.makedirs(dirname)
+            with open(args.summary, "w") as fh:
+                print(json.dumps({
+                    "binary": args.binary,
+                    "version": self.get_version(args),
+                    "hardware": hardware.serialize(),
+                    "results": results,
+                }, indent=4), file=fh)
+
+        return 1 if failed else 0
 
 
 class PlotShell(object):
@@ -156,7 +156,12 @@ static unsigned long long now(void)
     return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
 }
 
-static void stressone(unsigned long long ramsizeMB)
+struct stress_args {
+    unsigned long long ramsizeMB;   /* memory dirtied by the thread */
+    unsigned long long rateMB;      /* MB per second, 0 for no limit */
+};
+
+static void stressone(unsigned long long ramsizeMB, unsigned long long rateMB)
 {
     size_t pagesPerMB = 1024 * 1024 / PAGE_SIZE;
     g_autofree char *ram = g_malloc(ramsizeMB * 1024 * 1024);
@@ -166,6 +171,8 @@ static void stressone(unsigned long long ramsizeMB)
     char *dataptr;
     size_t nMB = 0;
     unsigned long long before, after;
+    unsigned long long rate_start, elapsed;
+    size_t rate_nMB = 0;
 
     /* We don't care about initial state, but we do want
      * to fault it all into RAM, otherwise the first iter
@@ -178,7 +185,7 @@ static void stressone(unsigned long long ramsizeMB)
         return;
     }
 
-    before = now();
+    before = rate_start = now();
 
     while (1) {
 
@@ -200,6 +207,22 @@ static void stressone(unsigned long long ramsizeMB)
                 before = now();
                 nMB = 0;
             }
+
+            /*
+             * Keep to the dirtying rate by sleeping away what is left of
+             * the time the last MB should have taken, a second at a time.
+             */
+            if (rateMB) {
+                rate_nMB++;
+                elapsed = now() - rate_start;
+                if (rate_nMB * 1000 / rateMB > elapsed) {
+                    g_usleep((rate_nMB * 1000 / rateMB - elapsed) * 1000);
+                }
+                if (rate_nMB == rateMB) {
+                    rate_start = now();
+                    rate_nMB = 0;
+                }
+            }
         }
     }
 }
@@ -207,26 +230,37 @@ static void stressone(unsigned long long ramsizeMB)
 
 static void *stressthread(void *arg)
 {
-    unsigned long long ramsizeMB = *(unsigned long long *)arg;
+    struct stress_args *args = arg;
 
-    stressone(ramsizeMB);
+    stressone(args->ramsizeMB, args->rateMB);
 
     return NULL;
 }
 
-static void stress(unsigned long long ramsizeGB, int ncpus)
+/*
+ * The working set and the dirtying rate are shared out between the CPUs;
+ * a working set of 0 means all of @ramsizeGB.
+ */
+static void stress(unsigned long long ramsizeGB, unsigned long long worksetMB,
+                   unsigned long long rateMB, int ncpus)
 {
     size_t i;
-    unsigned long long ramsizeMB = ramsizeGB * 1024 / ncpus;
+    static struct stress_args args;
+
+    if (!worksetMB) {
+        worksetMB = ramsizeGB * 1024;
+    }
+    args.ramsizeMB = MAX(worksetMB / ncpus, 1);
+    args.rateMB = rateMB ? MAX(rateMB / ncpus, 1) : 0;
     ncpus--;
 
     for (i = 0; i < ncpus; i++) {
         pthread_t thr;
         pthread_create(&thr, NULL,
-                       stressthread,   &ramsizeMB);
+                       stressthread,   &args);
     }
 
-    stressone(ramsizeMB);
+    stressone(args.ramsizeMB, args.rateMB);
 }
 
 
@@ -263,14 +297,18 @@ static int mount_all(void)
 int main(int argc, char **argv)
 {
     unsigned long long ramsizeGB = 1;
+    unsigned long long worksetMB = 0;
+    unsigned long long rateMB = 0;
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:w:d:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "workset", required_argument, NULL, 'w' },
+        { "dirtyrate", required_argument, NULL, 'd' },
         { NULL, 0, NULL, 0 }
     };
     int ret;
@@ -300,9 +338,30 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'w':
+            errno = 0;
+            worksetMB = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse working set %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
+        case 'd':
+            errno = 0;
+            rateMB = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse dirty rate %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]"
+                    "[--workset MB][--dirtyrate MB/s]\n", argv0);
             exit_failure();
         }
     }
@@ -314,6 +373,12 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+        ret = get_command_arg_ull("workset", &worksetMB);
+        if (ret < 0)
+            exit_failure();
+        ret = get_command_arg_ull("dirtyrate", &rateMB);
+        if (ret < 0)
+            exit_failure();
     }
 
     if (ncpus == 0)
@@ -322,7 +387,7 @@ int main(int argc, char **argv)
     fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
             argv0, gettid(), ramsizeGB, ncpus);
 
-    stress(ramsizeGB, ncpus);
+    stress(ramsizeGB, worksetMB, rateMB, ncpus);
 
     exit_failure();
 }
@@ -6,6 +6,7 @@
  */
 #include <inttypes.h>
 #include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -27,6 +28,14 @@ typedef struct {
 static bool do_inline;
 static CPUCount inline_count;
 
+/* Per-vCPU counters updated by the inline ops */
+typedef struct {
+    uint64_t bb_count;
+    uint64_t insn_count;
+} VCPUScore;
+
+static struct qemu_plugin_scoreboard *inline_score;
+
 /* Dump running CPU total on idle? */
 static bool idle_report;
 static GPtrArray *counts;
@@ -46,6 +55,16 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("");
 
+    if (do_inline) {
+        inline_count.bb_count =
+            qemu_plugin_scoreboard_u64_sum(inline_score,
+                                           offsetof(VCPUScore, bb_count));
+        inline_count.insn_count =
+            qemu_plugin_scoreboard_u64_sum(inline_score,
+                                           offsetof(VCPUScore, insn_count));
+        qemu_plugin_scoreboard_free(inline_score);
+    }
+
     if (do_inline || !max_cpus) {
         g_string_printf(report, "bb's: %" PRIu64", insns: %" PRIu64 "\n",
                         inline_count.bb_count, inline_count.insn_count);
@@ -84,11 +103,12 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     unsigned long n_insns = qemu_plugin_tb_n_insns(tb);
 
     if (do_inline) {
-        qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
-                                                 &inline_count.bb_count, 1);
-        qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64,
-                                                 &inline_count.insn_count,
-                                                 n_insns);
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, inline_score,
+            offsetof(VCPUScore, bb_count), 1);
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, inline_score,
+            offsetof(VCPUScore, insn_count), n_insns);
     } else {
         qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -114,7 +134,9 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         }
     }
 
-    if (info->system_emulation && !do_inline) {
+    if (do_inline) {
+        inline_score = qemu_plugin_scoreboard_new(sizeof(VCPUScore));
+    } else if (info->system_emulation) {
         max_cpus = info->system.max_vcpus;
         counts = g_ptr_array_new();
         for (i = 0; i < max_cpus; i++) {
@@ -123,7 +145,7 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
             count->index = i;
             g_ptr_array_add(counts, count);
         }
-    } else if (!do_inline) {
+    } else {
         g_mutex_init(&inline_count.lock);
     }
 
@@ -9,6 +9,7 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qemu/xxhash.h"
 
 struct thread_stats {
@@ -20,6 +21,13 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    /* sampled lookup latencies, in ns; rz_* for lookups during a resize */
+    uint64_t lat;
+    uint64_t lat_max;
+    size_t lat_n;
+    uint64_t rz_lat;
+    uint64_t rz_lat_max;
+    size_t rz_lat_n;
 };
 
 struct thread_info {
@@ -61,6 +69,11 @@ static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
 
+/* time one lookup out of this many */
+#define LATENCY_SAMPLE_PERIOD 64
+static bool measure_latency;
+static unsigned int n_resizing;
+
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
 static uint64_t resize_threshold;
@@ -92,7 +105,8 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    " -L = sample lookup latency, separately for lookups during resizes";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -143,7 +157,9 @@ static void do_rz(struct thread_info *info)
         size_t size = info->resize_down ? resize_min : resize_max;
         bool resized;
 
+        qatomic_inc(&n_resizing);
         resized = qht_resize(&ht, size);
+        qatomic_dec(&n_resizing);
         info->resize_down = !info->resize_down;
 
         if (resized) {
@@ -155,6 +171,30 @@ static void do_rz(struct thread_info *info)
     g_usleep(resize_delay);
 }
 
+static bool do_lookup_timed(struct thread_stats *stats, long *p,
+                            uint32_t hash)
+{
+    bool resizing = qatomic_read(&n_resizing);
+    int64_t t;
+    bool read;
+
+    t = get_clock();
+    read = qht_lookup(&ht, p, hash);
+    t = get_clock() - t;
+    resizing |= qatomic_read(&n_resizing);
+
+    if (resizing) {
+        stats->rz_lat += t;
+        stats->rz_lat_max = MAX(stats->rz_lat_max, t);
+        stats->rz_lat_n++;
+    } else {
+        stats->lat += t;
+        stats->lat_max = MAX(stats->lat_max, t);
+        stats->lat_n++;
+    }
+    return read;
+}
+
 static void do_rw(struct thread_info *info)
 {
     struct thread_stats *stats = &info->stats;
@@ -167,7 +207,12 @@ static void do_rw(struct thread_info *info)
 
         p = &keys[r & (lookup_range - 1)];
         hash = hfunc(*p);
-        read = qht_lookup(&ht, p, hash);
+        if (measure_latency &&
+            (stats->rd + stats->not_rd) % LATENCY_SAMPLE_PERIOD == 0) {
+            read = do_lookup_timed(stats, p, hash);
+        } else {
+            read = qht_lookup(&ht, p, hash);
+        }
         if (read) {
             stats->rd++;
         } else {
@@ -383,6 +428,13 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->lat += stats->lat;
+        s->lat_max = MAX(s->lat_max, stats->lat_max);
+        s->lat_n += stats->lat_n;
+        s->rz_lat += stats->rz_lat;
+        s->rz_lat_max = MAX(s->rz_lat_max, stats->rz_lat_max);
+        s->rz_lat_n += stats->rz_lat_n;
     }
 }
 
@@ -417,6 +469,16 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+
+    if (measure_latency) {
+        printf(" Lookup latency:    %.1f ns avg, %" PRIu64 " ns max "
+               "(%zu samples)\n",
+               s.lat_n ? (double)s.lat / s.lat_n : 0.0, s.lat_max, s.lat_n);
+        printf("   during resizes:  %.1f ns avg, %" PRIu64 " ns max "
+               "(%zu samples)\n",
+               s.rz_lat_n ? (double)s.rz_lat / s.rz_lat_n : 0.0,
+               s.rz_lat_max, s.rz_lat_n);
+    }
 }
 
 static void run_test(void)
@@ -444,7 +506,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -474,6 +536,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
@@ -720,6 +720,15 @@ void qmp_expect_error_and_unref(QDict *rsp, const char *class);
  */
 bool qtest_probe_child(QTestState *s);
 
+/**
+ * qtest_pid:
+ * @s: QTestState instance to operate on.
+ *
+ * Returns: the process ID of the QEMU instance, e.g. to look at its
+ * resource usage.
+ */
+pid_t qtest_pid(QTestState *s);
+
 /**
  * qtest_set_expected_status:
  * @s: QTestState instance to operate on.
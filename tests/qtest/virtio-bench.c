@@ -0,0 +1,762 @@
+/*
+ * Virtqueue microbenchmark
+ *
+ * Drives a virtio-blk, virtio-net or virtio-scsi device through qtest and
+ * measures what QEMU spends on each request: virtqueue_pop(), the device
+ * handler, virtqueue_push() and the notification.  No guest is booted;
+ * this program is the driver.  It keeps up to -q requests in flight and
+ * makes them available -b at a time, with one kick per batch.
+ *
+ * The backends do as little as they can: virtio-blk and virtio-scsi read
+ * from a null-co node, and virtio-net transmits into a hub with no other
+ * port, which drops the frames.
+ *
+ * For the block devices, -g stacks more layers on top of null-co so that
+ * their cost can be compared with the bare graph: format drivers, filters
+ * and backing chains.  With -T, the block layer trace events of the timed
+ * run are written to a simpletrace file, from which
+ * scripts/analyse-block-simpletrace.py works out the time spent in each
+ * layer.  That needs QEMU configured with --enable-trace-backends=simple,
+ * and tracing slows down the run it measures.
+ *
+ * The results include the cost of the qtest protocol, which is the same
+ * for every build of QEMU: compare them between builds, not with numbers
+ * from a real guest.
+ *
+ *   QTEST_QEMU_BINARY=./qemu-system-x86_64 tests/qtest/virtio-bench -d scsi
+ *   QTEST_QEMU_BINARY=./qemu-system-x86_64 QTEST_QEMU_IMG=./qemu-img \
+ *       tests/qtest/virtio-bench -g throttle,qcow2 -T trace.bin
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+#include "libqos/libqos-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "standard-headers/linux/virtio_ring.h"
+#include "standard-headers/linux/virtio_scsi.h"
+
+#define BENCH_PCI_SLOT          4
+
+/* Guest memory of a request: its headers, data and status */
+#define SLOT_SIZE               4096
+#define SLOT_MAX_DESC           3
+
+/* Give up when the device completes nothing for this long */
+#define STALL_TIMEOUT_US        (5 * G_USEC_PER_SEC)
+
+/* The size of null-co nodes, and so of every layer above them */
+#define GRAPH_SIZE              "1G"
+
+/* Trace events that -T enables for the timed run */
+static const char *const bench_trace_events[] = {
+    "virtio_blk_handle_read",
+    "virtio_blk_rw_complete",
+    "blk_co_preadv*",
+    "bdrv_co_preadv*",
+};
+
+typedef struct BenchDesc {
+    uint32_t offset;            /* in the request's slot */
+    uint32_t len;
+    bool write;                 /* written by the device */
+} BenchDesc;
+
+typedef struct BenchDevice {
+    const char *name;
+    const char *args;
+    bool block;                 /* uses the node "disk" built by -g */
+    uint16_t queue;             /* index of the request virtqueue */
+    uint64_t features_clear;
+    int ndesc;
+    BenchDesc desc[SLOT_MAX_DESC];
+    /* Write the headers of request @index at @addr */
+    void (*init_slot)(QTestState *qts, uint64_t addr, unsigned index);
+} BenchDevice;
+
+typedef struct Bench {
+    const BenchDevice *dev;
+    bool packed;
+    unsigned depth;
+    unsigned batch;
+    const char *graph;
+    const char *trace_file;
+    char *tmpdir;
+
+    QOSState *qs;
+    QVirtioPCIDevice *pdev;
+    QVirtQueue *vq;
+
+    uint64_t slots;
+    unsigned *free_slots;
+    unsigned nfree;
+    void *scratch;
+
+    /* Split ring */
+    uint16_t avail_idx;
+    uint16_t used_idx;
+
+    /* Packed ring */
+    uint16_t next_avail;
+    uint16_t next_used;
+    bool avail_wrap;
+    bool used_wrap;
+} Bench;
+
+/*
+ * Each request reads its own 4 KiB aligned sector: requests in flight never
+ * overlap or get merged, and the trace analysis tells them apart by offset.
+ */
+static void blk_init_slot(QTestState *qts, uint64_t addr, unsigned index)
+{
+    struct virtio_blk_outhdr hdr = {
+        .type = cpu_to_le32(VIRTIO_BLK_T_IN),
+        .sector = cpu_to_le64(index * 8),
+    };
+
+    qtest_memwrite(qts, addr, &hdr, sizeof(hdr));
+}
+
+static void net_init_slot(QTestState *qts, uint64_t addr, unsigned index)
+{
+    /* A zero virtio-net header, then a broadcast frame */
+    qtest_memset(qts, addr, 0, sizeof(struct virtio_net_hdr_mrg_rxbuf));
+    qtest_memset(qts, addr + 64, 0xff, ETH_ALEN);
+}
+
+static void scsi_init_slot(QTestState *qts, uint64_t addr, unsigned index)
+{
+    /* READ(10) of one block of LUN 0, as for virtio-blk */
+    struct virtio_scsi_cmd_req req = {
+        .lun = { 1, 0, 0, 0 },
+        .cdb = { 0x28, 0, 0, 0, 0, 0, 0, 0, 1, 0 },
+    };
+
+    stl_be_p(&req.cdb[2], index * 8);
+    qtest_memwrite(qts, addr, &req, sizeof(req));
+}
+
+static const BenchDevice bench_devices[] = {
+    {
+        .name = "blk",
+        .args = "-device virtio-blk-pci,drive=disk,addr=%02x.0%s",
+        .block = true,
+        .queue = 0,
+        .ndesc = 3,
+        .desc = {
+            { 0, sizeof(struct virtio_blk_outhdr), false },
+            { 512, 512, true },
+            { 1024, 1, true },
+        },
+        .init_slot = blk_init_slot,
+    },
+    {
+        .name = "net",
+        .args = "-netdev hubport,id=hp0,hubid=0 "
+                "-device virtio-net-pci,netdev=hp0,addr=%02x.0%s",
+        .queue = 1,
+        .features_clear = (1ull << VIRTIO_NET_F_MQ) |
+                          (1ull << VIRTIO_NET_F_CTRL_VQ),
+        .ndesc = 2,
+        .desc = {
+            { 0, sizeof(struct virtio_net_hdr_mrg_rxbuf), false },
+            { 64, 60, false },
+        },
+        .init_slot = net_init_slot,
+    },
+    {
+        .name = "scsi",
+        .args = "-device virtio-scsi-pci,id=scsi0,addr=%02x.0%s "
+                "-device scsi-hd,bus=scsi0.0,drive=disk,scsi-id=0,lun=0",
+        .block = true,
+        .queue = 2,
+        .ndesc = 3,
+        .desc = {
+            { 0, sizeof(struct virtio_scsi_cmd_req), false },
+            { 128, sizeof(struct virtio_scsi_cmd_resp), true },
+            { 512, 512, true },
+        },
+        .init_slot = scsi_init_slot,
+    },
+};
+
+/* Run "qemu-img create @args", for the images of -g */
+static void bench_mkimg(const char *args)
+{
+    const char *qemu_img = getenv("QTEST_QEMU_IMG");
+    g_autofree char *cli = NULL;
+    g_autofree char *out = NULL;
+    g_autofree char *err_out = NULL;
+    GError *err = NULL;
+    int status;
+
+    if (!qemu_img) {
+        fprintf(stderr, "QTEST_QEMU_IMG must point to qemu-img\n");
+        exit(1);
+    }
+    cli = g_strdup_printf("%s create -q %s", qemu_img, args);
+    if (!g_spawn_command_line_sync(cli, &out, &err_out, &status, &err) ||
+        !g_spawn_check_exit_status(status, &err)) {
+        fprintf(stderr, "%s: %s\n%s", cli, err->message, err_out ?: "");
+        exit(1);
+    }
+}
+
+/*
+ * The -object and -blockdev options for b->graph, a comma separated list
+ * of layers from the device down.  null-co is always at the bottom and
+ * the top node is called "disk".  The layers are:
+ *
+ *   raw            the raw format driver
+ *   qcow2          qcow2 whose guest data is its child, mapped 1:1 with an
+ *                  external raw data file; the metadata is in a file
+ *   backing        an empty qcow2 overlay whose backing node is its child,
+ *                  so that every read goes down the chain
+ *   throttle       a throttle filter, in a group without limits
+ *   copy-on-read   a copy-on-read filter
+ */
+static char *bench_graph_args(Bench *b)
+{
+    g_auto(GStrv) layers = g_strsplit(b->graph ?: "", ",", -1);
+    int n = g_strv_length(layers);
+    GString *args = g_string_new(NULL);
+    int i;
+
+    g_string_printf(args, "-blockdev null-co,node-name=%s,size=%s",
+                    n ? "node0" : "disk", GRAPH_SIZE);
+
+    for (i = n - 1; i >= 0; i--) {
+        const char *layer = layers[i];
+        g_autofree char *child = g_strdup_printf("node%d", n - i - 1);
+        g_autofree char *node = i ? g_strdup_printf("node%d", n - i)
+                                  : g_strdup("disk");
+        g_autofree char *img = NULL;
+        g_autofree char *opts = NULL;
+
+        if (!strcmp(layer, "qcow2") || !strcmp(layer, "backing")) {
+            if (!b->tmpdir) {
+                b->tmpdir = g_dir_make_tmp("virtio-bench-XXXXXX", NULL);
+                g_assert(b->tmpdir);
+            }
+            img = g_strdup_printf("%s/%s.qcow2", b->tmpdir, node);
+        }
+
+        if (!strcmp(layer, "raw") || !strcmp(layer, "copy-on-read")) {
+            g_string_append_printf(args, " -blockdev %s,node-name=%s,file=%s",
+                                   layer, node, child);
+        } else if (!strcmp(layer, "throttle")) {
+            g_string_append_printf(args, " -object throttle-group,id=tg-%s"
+                                   " -blockdev throttle,node-name=%s,"
+                                   "throttle-group=tg-%s,file=%s",
+                                   node, node, node, child);
+        } else if (!strcmp(layer, "qcow2")) {
+            opts = g_strdup_printf("-f qcow2 -o data_file=%s/%s.data,"
+                                   "data_file_raw=on,preallocation=metadata "
+                                   "%s %s", b->tmpdir, node, img, GRAPH_SIZE);
+            bench_mkimg(opts);
+            g_string_append_printf(args, " -blockdev qcow2,node-name=%s,"
+                                   "file.driver=file,file.filename=%s,"
+                                   "data-file=%s", node, img, child);
+        } else if (!strcmp(layer, "backing")) {
+            opts = g_strdup_printf("-f qcow2 %s %s", img, GRAPH_SIZE);
+            bench_mkimg(opts);
+            g_string_append_printf(args, " -blockdev qcow2,node-name=%s,"
+                                   "file.driver=file,file.filename=%s,"
+                                   "backing=%s", node, img, child);
+        } else {
+            fprintf(stderr, "unknown layer '%s'\n", layer);
+            exit(1);
+        }
+    }
+
+    if (b->trace_file) {
+        /* Node names and drivers now, the I/O events after the warm up */
+        g_string_append_printf(args, " -trace enable=bdrv_open_driver,file=%s",
+                               b->trace_file);
+    }
+    return g_string_free(args, false);
+}
+
+static void bench_remove_tmpdir(Bench *b)
+{
+    GDir *dir;
+    const char *name;
+
+    if (!b->tmpdir) {
+        return;
+    }
+    dir = g_dir_open(b->tmpdir, 0, NULL);
+    while (dir && (name = g_dir_read_name(dir))) {
+        g_autofree char *path = g_build_filename(b->tmpdir, name, NULL);
+
+        unlink(path);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    rmdir(b->tmpdir);
+    g_free(b->tmpdir);
+}
+
+static void bench_setup(Bench *b)
+{
+    const BenchDevice *dev = b->dev;
+    QPCIAddress addr = { .devfn = QPCI_DEVFN(BENCH_PCI_SLOT, 0) };
+    g_autofree char *graph_args = NULL;
+    g_autofree char *dev_args = NULL;
+    QTestState *qts;
+    uint64_t features;
+    unsigned i;
+
+    graph_args = dev->block ? bench_graph_args(b) : g_strdup("");
+    dev_args = g_strdup_printf(dev->args, BENCH_PCI_SLOT,
+                               b->packed ? ",disable-legacy=on,packed=on" : "");
+    b->qs = qtest_pc_boot("%s %s", graph_args, dev_args);
+    qts = b->qs->qts;
+
+    b->pdev = virtio_pci_new(b->qs->pcibus, &addr);
+    g_assert(b->pdev);
+    qvirtio_pci_device_enable(b->pdev);
+    qvirtio_start_device(&b->pdev->vdev);
+
+    features = qvirtio_get_features(&b->pdev->vdev);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX) |
+                  dev->features_clear);
+    if (b->packed && !(features & (1ull << VIRTIO_F_RING_PACKED))) {
+        fprintf(stderr, "virtio-%s does not offer the packed layout\n",
+                dev->name);
+        exit(1);
+    }
+    if (!b->packed) {
+        features &= ~(1ull << VIRTIO_F_RING_PACKED);
+    }
+    qvirtio_set_features(&b->pdev->vdev, features);
+
+    b->vq = qvirtqueue_setup(&b->pdev->vdev, &b->qs->alloc, dev->queue);
+    if (b->depth * dev->ndesc > b->vq->size) {
+        fprintf(stderr, "depth %u does not fit in a ring of %u entries\n",
+                b->depth, b->vq->size);
+        exit(1);
+    }
+
+    if (b->packed) {
+        /*
+         * qvirtqueue_setup() laid out a split ring; the area is big enough
+         * for a packed ring, whose descriptors must start out zeroed.  The
+         * driver event area follows the descriptors, where the split avail
+         * ring would be.
+         */
+        qtest_memset(qts, b->vq->desc, 0,
+                     b->vq->size * sizeof(struct vring_packed_desc));
+        qtest_writew(qts, b->vq->avail, 0);
+        qtest_writew(qts, b->vq->avail + 2, VRING_PACKED_EVENT_FLAG_DISABLE);
+        b->avail_wrap = b->used_wrap = true;
+    } else {
+        qtest_writew(qts, b->vq->avail, VRING_AVAIL_F_NO_INTERRUPT);
+    }
+
+    /*
+     * Each request owns a slot of guest memory and, for the split layout,
+     * dev->ndesc descriptors at slot * dev->ndesc; none of it changes
+     * while the benchmark runs.
+     */
+    b->slots = guest_alloc(&b->qs->alloc, b->depth * SLOT_SIZE);
+    b->free_slots = g_new(unsigned, b->depth);
+    for (i = 0; i < b->depth; i++) {
+        uint64_t slot = b->slots + i * SLOT_SIZE;
+        int j;
+
+        dev->init_slot(qts, slot, i);
+        b->free_slots[b->nfree++] = i;
+
+        if (b->packed) {
+            continue;
+        }
+        for (j = 0; j < dev->ndesc; j++) {
+            struct vring_desc desc = {
+                .addr = cpu_to_le64(slot + dev->desc[j].offset),
+                .len = cpu_to_le32(dev->desc[j].len),
+            };
+            uint16_t flags = dev->desc[j].write ? VRING_DESC_F_WRITE : 0;
+
+            if (j < dev->ndesc - 1) {
+                flags |= VRING_DESC_F_NEXT;
+                desc.next = cpu_to_le16(i * dev->ndesc + j + 1);
+            }
+            desc.flags = cpu_to_le16(flags);
+            qtest_memwrite(qts, b->vq->desc +
+                           (i * dev->ndesc + j) * sizeof(desc),
+                           &desc, sizeof(desc));
+        }
+    }
+
+    b->scratch = g_malloc(b->vq->size * sizeof(struct vring_packed_desc));
+
+    qvirtio_set_driver_ok(&b->pdev->vdev);
+}
+
+static void bench_teardown(Bench *b)
+{
+    qvirtqueue_cleanup(b->pdev->vdev.bus, b->vq, &b->qs->alloc);
+    qvirtio_pci_destructor(&b->pdev->obj);
+    g_free(b->pdev);
+    qtest_shutdown(b->qs);
+    g_free(b->free_slots);
+    g_free(b->scratch);
+    bench_remove_tmpdir(b);
+}
+
+static void bench_trace_start(Bench *b)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(bench_trace_events); i++) {
+        qtest_qmp_assert_success(b->qs->qts,
+                                 "{ 'execute': 'trace-event-set-state',"
+                                 "  'arguments': { 'name': %s,"
+                                 "                 'enable': true } }",
+                                 bench_trace_events[i]);
+    }
+}
+
+/*
+ * Make @n requests available: all the ring entries first, then the index
+ * once, as a driver would for a batch.
+ */
+static void split_submit(Bench *b, const unsigned *slots, unsigned n)
+{
+    QTestState *qts = b->qs->qts;
+    uint16_t *ring = b->scratch;
+    uint64_t ring_addr = b->vq->avail + 4;
+    unsigned start = b->avail_idx % b->vq->size;
+    unsigned first = MIN(n, b->vq->size - start);
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        ring[i] = cpu_to_le16(slots[i] * b->dev->ndesc);
+    }
+    qtest_memwrite(qts, ring_addr + start * 2, ring, first * 2);
+    if (first < n) {
+        qtest_memwrite(qts, ring_addr, ring + first, (n - first) * 2);
+    }
+
+    b->avail_idx += n;
+    qtest_writew(qts, b->vq->avail + 2, b->avail_idx);
+}
+
+static unsigned split_complete(Bench *b)
+{
+    QTestState *qts = b->qs->qts;
+    struct vring_used_elem *used = b->scratch;
+    uint64_t ring_addr = b->vq->used + 4;
+    uint16_t idx = qtest_readw(qts, b->vq->used + 2);
+    unsigned n = (uint16_t)(idx - b->used_idx);
+    unsigned start = b->used_idx % b->vq->size;
+    unsigned first = MIN(n, b->vq->size - start);
+    unsigned i;
+
+    if (!n) {
+        return 0;
+    }
+
+    qtest_memread(qts, ring_addr + start * sizeof(*used), used,
+                  first * sizeof(*used));
+    if (first < n) {
+        qtest_memread(qts, ring_addr, used + first,
+                      (n - first) * sizeof(*used));
+    }
+    for (i = 0; i < n; i++) {
+        b->free_slots[b->nfree++] = le32_to_cpu(used[i].id) / b->dev->ndesc;
+    }
+
+    b->used_idx = idx;
+    return n;
+}
+
+/*
+ * Make @n requests available.  When the batch wraps around the ring, the
+ * descriptors at the start of the ring are written first, so that the
+ * device cannot see a chain whose head is available before its tail.
+ */
+static void packed_submit(Bench *b, const unsigned *slots, unsigned n)
+{
+    const BenchDevice *dev = b->dev;
+    QTestState *qts = b->qs->qts;
+    struct vring_packed_desc *desc = b->scratch;
+    unsigned start = b->next_avail;
+    unsigned count = 0, wrapped = 0;
+    unsigned i;
+    int j;
+
+    for (i = 0; i < n; i++) {
+        uint64_t slot = b->slots + slots[i] * SLOT_SIZE;
+
+        for (j = 0; j < dev->ndesc; j++) {
+            uint16_t flags = b->avail_wrap ?
+                             1 << VRING_PACKED_DESC_F_AVAIL :
+                             1 << VRING_PACKED_DESC_F_USED;
+
+            if (j < dev->ndesc - 1) {
+                flags |= VRING_DESC_F_NEXT;
+            }
+            if (dev->desc[j].write) {
+                flags |= VRING_DESC_F_WRITE;
+            }
+            desc[count].addr = cpu_to_le64(slot + dev->desc[j].offset);
+            desc[count].len = cpu_to_le32(dev->desc[j].len);
+            desc[count].id = cpu_to_le16(slots[i]);
+            desc[count].flags = cpu_to_le16(flags);
+            count++;
+
+            if (++b->next_avail == b->vq->size) {
+                b->next_avail = 0;
+                b->avail_wrap = !b->avail_wrap;
+                wrapped = count;
+            }
+        }
+    }
+
+    if (wrapped && wrapped < count) {
+        qtest_memwrite(qts, b->vq->desc, desc + wrapped,
+                       (count - wrapped) * sizeof(*desc));
+        count = wrapped;
+    }
+    qtest_memwrite(qts, b->vq->desc + start * sizeof(*desc), desc,
+                   count * sizeof(*desc));
+}
+
+static unsigned packed_complete(Bench *b)
+{
+    QTestState *qts = b->qs->qts;
+    struct vring_packed_desc desc;
+    unsigned n = 0;
+
+    for (;;) {
+        uint16_t flags;
+        bool avail, used;
+
+        qtest_memread(qts, b->vq->desc + b->next_used * sizeof(desc),
+                      &desc, sizeof(desc));
+        flags = le16_to_cpu(desc.flags);
+        avail = flags & (1 << VRING_PACKED_DESC_F_AVAIL);
+        used = flags & (1 << VRING_PACKED_DESC_F_USED);
+        if (avail != used || used != b->used_wrap) {
+            return n;
+        }
+
+        b->free_slots[b->nfree++] = le16_to_cpu(desc.id);
+        n++;
+
+        /* The device writes one descriptor for the whole chain */
+        b->next_used += b->dev->ndesc;
+        if (b->next_used >= b->vq->size) {
+            b->next_used -= b->vq->size;
+            b->used_wrap = !b->used_wrap;
+        }
+    }
+}
+
+static void bench_run(Bench *b, unsigned long requests)
+{
+    QVirtioDevice *vdev = &b->pdev->vdev;
+    unsigned long submitted = 0, completed = 0;
+    unsigned *batch = g_new(unsigned, b->batch);
+    int64_t last_progress = g_get_monotonic_time();
+
+    while (completed < requests) {
+        unsigned done;
+
+        /* Full batches only, except for the last requests */
+        while (b->nfree &&
+               (b->nfree >= b->batch || submitted + b->nfree >= requests) &&
+               submitted < requests) {
+            unsigned n = MIN(b->batch, requests - submitted);
+            unsigned i;
+
+            n = MIN(n, b->nfree);
+            for (i = 0; i < n; i++) {
+                batch[i] = b->free_slots[--b->nfree];
+            }
+            if (b->packed) {
+                packed_submit(b, batch, n);
+            } else {
+                split_submit(b, batch, n);
+            }
+            vdev->bus->virtqueue_kick(vdev, b->vq);
+            submitted += n;
+        }
+
+        done = b->packed ? packed_complete(b) : split_complete(b);
+        if (done) {
+            completed += done;
+            last_progress = g_get_monotonic_time();
+        } else if (g_get_monotonic_time() - last_progress > STALL_TIMEOUT_US) {
+            fprintf(stderr, "virtio-%s stalled after %lu of %lu requests\n",
+                    b->dev->name, completed, requests);
+            exit(1);
+        }
+    }
+
+    g_free(batch);
+}
+
+/* User plus system CPU time of @pid in nanoseconds, or -1 */
+static int64_t process_cpu_ns(pid_t pid)
+{
+    g_autofree char *path = g_strdup_printf("/proc/%d/stat", (int)pid);
+    g_autofree char *stat = NULL;
+    unsigned long utime, stime;
+    char *p;
+
+    if (!g_file_get_contents(path, &stat, NULL, NULL)) {
+        return -1;
+    }
+    /* Skip pid and comm; utime and stime are the 14th and 15th fields */
+    p = strrchr(stat, ')');
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                     "%lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (int64_t)(utime + stime) * NANOSECONDS_PER_SECOND /
+           sysconf(_SC_CLK_TCK);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -d DEVICE   blk, net or scsi (default blk)\n"
+           "  -n NUM      number of requests (default 100000)\n"
+           "  -q DEPTH    requests in flight (default 32)\n"
+           "  -b BATCH    requests made available per kick (default 8)\n"
+           "  -r LAYOUT   ring layout, split or packed (default split)\n"
+           "  -g LAYERS   block layers above null-co, from the device down:\n"
+           "              raw, qcow2, backing, throttle and copy-on-read,\n"
+           "              separated by commas (blk and scsi only)\n"
+           "  -T FILE     trace the block layer into FILE, for\n"
+           "              scripts/analyse-block-simpletrace.py\n"
+           "QTEST_QEMU_BINARY must point to qemu-system-x86_64, and\n"
+           "QTEST_QEMU_IMG to qemu-img for the qcow2 and backing layers.\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = {
+        .dev = &bench_devices[0],
+        .depth = 32,
+        .batch = 8,
+    };
+    unsigned long requests = 100000;
+    int64_t wall, cpu_ns, ticks;
+    int c, ret = 0;
+    size_t i;
+
+    while ((c = getopt(argc, argv, "d:n:q:b:r:g:T:h")) != -1) {
+        switch (c) {
+        case 'd':
+            for (i = 0; i < ARRAY_SIZE(bench_devices); i++) {
+                if (!strcmp(optarg, bench_devices[i].name)) {
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(bench_devices)) {
+                fprintf(stderr, "unknown device '%s'\n", optarg);
+                return 1;
+            }
+            b.dev = &bench_devices[i];
+            break;
+        case 'n':
+            ret = qemu_strtoul(optarg, NULL, 0, &requests);
+            break;
+        case 'q':
+            ret = qemu_strtoui(optarg, NULL, 0, &b.depth);
+            break;
+        case 'b':
+            ret = qemu_strtoui(optarg, NULL, 0, &b.batch);
+            break;
+        case 'r':
+            if (!strcmp(optarg, "packed")) {
+                b.packed = true;
+            } else if (strcmp(optarg, "split")) {
+                fprintf(stderr, "unknown ring layout '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            b.graph = optarg;
+            break;
+        case 'T':
+            b.trace_file = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "invalid number for -%c: '%s'\n", c, optarg);
+            return 1;
+        }
+    }
+    if (!requests || !b.depth || !b.batch || b.batch > b.depth) {
+        fprintf(stderr, "need 0 < batch <= depth and at least one request\n");
+        return 1;
+    }
+    if ((b.graph || b.trace_file) && !b.dev->block) {
+        fprintf(stderr, "-g and -T only apply to block devices\n");
+        return 1;
+    }
+
+    bench_setup(&b);
+
+    /* Warm up the ring, the backend and QEMU's caches */
+    bench_run(&b, b.depth * 4);
+    if (b.trace_file) {
+        bench_trace_start(&b);
+    }
+
+    cpu_ns = process_cpu_ns(qtest_pid(b.qs->qts));
+    ticks = cpu_get_host_ticks();
+    wall = get_clock();
+
+    bench_run(&b, requests);
+
+    wall = get_clock() - wall;
+    ticks = cpu_get_host_ticks() - ticks;
+    if (cpu_ns >= 0) {
+        int64_t end = process_cpu_ns(qtest_pid(b.qs->qts));
+
+        cpu_ns = end >= 0 ? end - cpu_ns : -1;
+    }
+
+    printf("virtio-%s, %s ring, depth %u, batch %u: %lu requests in "
+           "%.3f s\n", b.dev->name, b.packed ? "packed" : "split",
+           b.depth, b.batch, requests, (double)wall / NANOSECONDS_PER_SECOND);
+    if (b.dev->block) {
+        printf("  graph %s%snull-co%s\n", b.graph ?: "", b.graph ? "," : "",
+               b.trace_file ? ", traced" : "");
+    }
+    printf("  %.0f requests/s\n",
+           requests * (double)NANOSECONDS_PER_SECOND / wall);
+    if (cpu_ns >= 0) {
+        /* Host ticks per nanosecond give cycles of QEMU CPU time */
+        printf("  QEMU CPU %.0f ns/request, %.0f cycles/request\n",
+               (double)cpu_ns / requests,
+               (double)cpu_ns * ticks / wall / requests);
+    }
+
+    bench_teardown(&b);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * TCG benchmark kernels, system-mode version
+ *
+ * There is no command line to choose a kernel from, so "make bench"
+ * builds one binary per kernel with BENCH_KERNEL and BENCH_SCALE set.
+ * Without them, every kernel runs briefly, as a test.
+ *
+ * Floating point is left out: not all the boot code enables it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <minilib.h>
+
+#define BENCH_NO_FLOAT
+#include "../tcg-bench.h"
+
+#ifndef BENCH_SCALE
+#define BENCH_SCALE 1
+#endif
+
+/* Memory is not protected here */
+static void bench_code_writable(void *start, unsigned long len)
+{
+}
+
+static int bench_streq(const char *a, const char *b)
+{
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+int main(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < BENCH_NR_KERNELS; i++) {
+        const BenchKernel *k = &bench_kernels[i];
+
+#ifdef BENCH_KERNEL
+        if (!bench_streq(k->name, BENCH_KERNEL)) {
+            continue;
+        }
+#endif
+        ml_printf("tcg-bench: %s scale %d checksum 0x%x\n",
+                  k->name, BENCH_SCALE, k->fn(BENCH_SCALE));
+    }
+    return 0;
+}
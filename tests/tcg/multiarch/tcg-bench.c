@@ -0,0 +1,58 @@
+/*
+ * TCG benchmark kernels, user-mode version
+ *
+ * Usage: tcg-bench [KERNEL [SCALE]]
+ *
+ * Without arguments every kernel runs briefly, as a test.
+ * tests/tcg/tcg-bench.py runs them one at a time and times them.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "tcg-bench.h"
+
+static void bench_code_writable(void *start, unsigned long len)
+{
+    /* The guest's view of qemu_real_host_page_size */
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t lo = (uintptr_t)start & -page;
+    uintptr_t hi = ((uintptr_t)start + len + page - 1) & -page;
+
+    if (mprotect((void *)lo, hi - lo, PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        perror("mprotect");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void run(const BenchKernel *k, unsigned int scale)
+{
+    printf("tcg-bench: %s scale %u checksum 0x%08x\n",
+           k->name, scale, k->fn(scale));
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int scale = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+    unsigned int i;
+
+    for (i = 0; i < BENCH_NR_KERNELS; i++) {
+        if (argc < 2) {
+            run(&bench_kernels[i], scale);
+        } else if (!strcmp(argv[1], bench_kernels[i].name)) {
+            run(&bench_kernels[i], scale);
+            return EXIT_SUCCESS;
+        }
+    }
+    if (argc >= 2) {
+        fprintf(stderr, "unknown kernel %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
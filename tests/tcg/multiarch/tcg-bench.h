@@ -0,0 +1,185 @@
+/*
+ * TCG benchmark kernels
+ *
+ * Small deterministic workloads, each of which keeps one part of TCG
+ * busy:
+ *
+ *   translate  many blocks executed once per round, their code being
+ *              rewritten in between so that they are translated again:
+ *              tb_gen_code()
+ *   lookup     indirect calls among a few functions: tb_lookup() and
+ *              the jump cache
+ *   memory     strided loads and stores over more pages than the TLB
+ *              holds: the softmmu load/store slow path
+ *   float      double precision arithmetic: softfloat and hardfloat
+ *   none       nothing, to measure the start up and exit costs
+ *
+ * Only plain C is used, so that the user-mode and system-mode versions
+ * can share them; the including file provides bench_code_writable().
+ * Each kernel returns a checksum, which keeps the compiler from dropping
+ * the work and lets runs be compared.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TCG_BENCH_H
+#define TCG_BENCH_H
+
+#include <stdint.h>
+
+/* Make [start, start + len) writable, for the translate kernel */
+static void bench_code_writable(void *start, unsigned long len);
+
+/*
+ * A thousand distinct functions.  On hosts where a function pointer is
+ * a descriptor rather than the address of the code (ppc64 ELFv1, hppa)
+ * the translate kernel rewrites the descriptors instead, and so measures
+ * little translation.
+ */
+#define BENCH_X10(M, p) \
+    M(p##0) M(p##1) M(p##2) M(p##3) M(p##4) \
+    M(p##5) M(p##6) M(p##7) M(p##8) M(p##9)
+#define BENCH_X100(M, p) \
+    BENCH_X10(M, p##0) BENCH_X10(M, p##1) BENCH_X10(M, p##2) \
+    BENCH_X10(M, p##3) BENCH_X10(M, p##4) BENCH_X10(M, p##5) \
+    BENCH_X10(M, p##6) BENCH_X10(M, p##7) BENCH_X10(M, p##8) \
+    BENCH_X10(M, p##9)
+#define BENCH_X1000(M) \
+    BENCH_X100(M, 0) BENCH_X100(M, 1) BENCH_X100(M, 2) \
+    BENCH_X100(M, 3) BENCH_X100(M, 4) BENCH_X100(M, 5) \
+    BENCH_X100(M, 6) BENCH_X100(M, 7) BENCH_X100(M, 8) \
+    BENCH_X100(M, 9)
+
+#define BENCH_FN(n)                                         \
+    static uint32_t bench_fn_##n(uint32_t x)                \
+    {                                                       \
+        if (x & 1) {                                        \
+            x = x * 2654435761u + __COUNTER__;              \
+        } else {                                            \
+            x = (x >> 3) ^ (x << 7) ^ __COUNTER__;          \
+        }                                                   \
+        return x;                                           \
+    }
+#define BENCH_FN_PTR(n) bench_fn_##n,
+
+BENCH_X1000(BENCH_FN)
+
+static uint32_t (*const bench_fns[])(uint32_t) = {
+    BENCH_X1000(BENCH_FN_PTR)
+};
+
+#define BENCH_NR_FNS (sizeof(bench_fns) / sizeof(bench_fns[0]))
+
+static uint32_t bench_none(unsigned int scale)
+{
+    return scale;
+}
+
+static uint32_t bench_translate(unsigned int scale)
+{
+    uintptr_t lo = (uintptr_t)bench_fns[0], hi = lo;
+    uint32_t x = 1;
+    unsigned int i, round;
+
+    for (i = 0; i < BENCH_NR_FNS; i++) {
+        uintptr_t p = (uintptr_t)bench_fns[i];
+
+        lo = p < lo ? p : lo;
+        hi = p > hi ? p : hi;
+    }
+    bench_code_writable((void *)lo, hi + 1 - lo);
+
+    for (round = 0; round < scale; round++) {
+        for (i = 0; i < BENCH_NR_FNS; i++) {
+            x = bench_fns[i](x);
+        }
+        /*
+         * Rewriting the first byte of each one invalidates its block.  Guest
+         * programs cannot use qatomic_*, so use the builtins behind them to
+         * keep the compiler from dropping the store.
+         */
+        for (i = 0; i < BENCH_NR_FNS; i++) {
+            uint8_t *code = (uint8_t *)bench_fns[i];
+
+            __atomic_store_n(code, __atomic_load_n(code, __ATOMIC_RELAXED),
+                             __ATOMIC_RELAXED);
+        }
+    }
+    return x;
+}
+
+#define BENCH_LOOKUP_FNS  16
+
+static uint32_t bench_lookup(unsigned int scale)
+{
+    uint32_t x = 1;
+    unsigned long i, n = scale * 100000ul;
+
+    for (i = 0; i < n; i++) {
+        x = bench_fns[(x ^ i) % BENCH_LOOKUP_FNS](x);
+    }
+    return x;
+}
+
+/* 512 pages of 4 KiB, with a stride that also spreads over cache sets */
+#define BENCH_MEM_SIZE    (2u << 20)
+#define BENCH_MEM_STRIDE  (4096 + 64)
+
+static uint8_t bench_mem[BENCH_MEM_SIZE];
+
+static uint32_t bench_memory(unsigned int scale)
+{
+    uint32_t x = 1;
+    unsigned long i, n = scale * 100000ul;
+    unsigned long off = 0;
+
+    for (i = 0; i < n; i++) {
+        x += bench_mem[off];
+        bench_mem[off] = x;
+        off += BENCH_MEM_STRIDE;
+        if (off >= BENCH_MEM_SIZE) {
+            off -= BENCH_MEM_SIZE;
+        }
+    }
+    return x;
+}
+
+#ifndef BENCH_NO_FLOAT
+static uint32_t bench_float(unsigned int scale)
+{
+    volatile double a = 1.0, b = 3.0, c = 0.5;
+    unsigned long i, n = scale * 100000ul;
+    union {
+        double d;
+        uint64_t u;
+    } r;
+
+    for (i = 0; i < n; i++) {
+        a = a * 1.0000001 + c;
+        b = b / 1.0000003 - a * 1e-9;
+        c = (a + b) * 1e-7;
+    }
+    r.d = a + b + c;
+    return (uint32_t)(r.u ^ (r.u >> 32));
+}
+#endif
+
+typedef struct BenchKernel {
+    const char *name;
+    uint32_t (*fn)(unsigned int scale);
+} BenchKernel;
+
+static const BenchKernel bench_kernels[] = {
+    { "none", bench_none },
+    { "translate", bench_translate },
+    { "lookup", bench_lookup },
+    { "memory", bench_memory },
+#ifndef BENCH_NO_FLOAT
+    { "float", bench_float },
+#endif
+};
+
+#define BENCH_NR_KERNELS (sizeof(bench_kernels) / sizeof(bench_kernels[0]))
+
+#endif /* TCG_BENCH_H */
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+# Run the TCG benchmark kernels and report where the time goes
+#
+# Each kernel of tests/tcg/multiarch/tcg-bench.h runs on its own, under
+# "-d jit", so that QEMU prints its translation statistics at exit.
+# The wall clock time of a run is taken on the host; the "none" kernel
+# gives the start up and exit cost, which is subtracted from the others.
+# Together with the counters this splits the cost of a workload into
+# translation (TB gen count and ticks), block lookup (jump cache misses)
+# and memory accesses (TLB misses), and a JSON report can be compared
+# across QEMU builds.
+#
+# Usage: tcg-bench.py [--runs N] [--json FILE] [--kernels K1,K2...] \
+#            -- QEMU-COMMAND...
+#
+# where "{kernel}" in QEMU-COMMAND is replaced with each kernel name.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+import time
+
+
+COUNTERS = {
+    'tb_gen': re.compile(r'^TB gen count\s+(\d+) \(avg (\d+) host ticks/TB\)'),
+    'tb_invalidate': re.compile(r'^TB invalidate count\s+(\d+)'),
+    'jmp_cache': re.compile(r'^cpu\s+\d+\s+\d+ sets, lookups (\d+) '
+                            r'\(.*miss ([\d.]+)%\)'),
+    'tlb_miss': re.compile(r'^TLB misses\s+(\d+) \(victim TLB hits (\d+)%\)'),
+    'jit_cycles': re.compile(r'^JIT cycles\s+(\d+)'),
+}
+
+
+def parse_stats(output):
+    stats = {}
+    for line in output.splitlines():
+        for name, regex in COUNTERS.items():
+            m = regex.match(line.strip())
+            if not m:
+                continue
+            if name == 'tb_gen':
+                stats['tb_gen_count'] = int(m.group(1))
+                stats['tb_gen_ticks'] = int(m.group(2))
+            elif name == 'tb_invalidate':
+                stats['tb_invalidate_count'] = int(m.group(1))
+            elif name == 'jmp_cache':
+                # One line per vCPU
+                lookups = int(m.group(1))
+                misses = round(lookups * float(m.group(2)) / 100)
+                stats['jmp_lookups'] = stats.get('jmp_lookups', 0) + lookups
+                stats['jmp_misses'] = stats.get('jmp_misses', 0) + misses
+            elif name == 'tlb_miss':
+                stats['tlb_misses'] = int(m.group(1))
+                stats['tlb_victim_pct'] = int(m.group(2))
+            elif name == 'jit_cycles':
+                stats['jit_cycles'] = int(m.group(1))
+    return stats
+
+
+def run_kernel(cmd, kernel):
+    argv = [arg.replace('{kernel}', kernel) for arg in cmd]
+    start = time.perf_counter()
+    proc = subprocess.run(argv, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+    elapsed = time.perf_counter() - start
+    if proc.returncode != 0:
+        sys.stderr.write(proc.stdout)
+        raise Exception('{} exited with status {}'.format(
+            ' '.join(argv), proc.returncode))
+    return elapsed, parse_stats(proc.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run TCG benchmarks')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='runs of each kernel, the fastest is kept')
+    parser.add_argument('--kernels',
+                        default='none,translate,lookup,memory,float',
+                        help='comma separated list of kernels')
+    parser.add_argument('--json', help='write the results to this file')
+    parser.add_argument('cmd', nargs=argparse.REMAINDER,
+                        help='command line, with {kernel} for the kernel')
+    args = parser.parse_args()
+
+    cmd = args.cmd[1:] if args.cmd[:1] == ['--'] else args.cmd
+    if not cmd:
+        parser.error('no command given')
+
+    results = {}
+    for kernel in args.kernels.split(','):
+        best = None
+        for _ in range(args.runs):
+            elapsed, stats = run_kernel(cmd, kernel)
+            if best is None or elapsed < best[0]:
+                best = (elapsed, stats)
+        results[kernel] = dict(best[1], seconds=best[0])
+
+    baseline = results.get('none', {}).get('seconds', 0)
+    print('{:<10} {:>9} {:>9} {:>10} {:>10} {:>10}'.format(
+        'kernel', 'time(s)', 'net(s)', 'TBs gen', 'jmp miss', 'TLB miss'))
+    for kernel, r in results.items():
+        r['net_seconds'] = max(r['seconds'] - baseline, 0)
+        print('{:<10} {:>9.3f} {:>9.3f} {:>10} {:>10} {:>10}'.format(
+            kernel, r['seconds'], r['net_seconds'],
+            r.get('tb_gen_count', '-'), r.get('jmp_misses', '-'),
+            r.get('tlb_misses', '-')))
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'command': cmd, 'results': results}, f, indent=4)
+
+
+if __name__ == '__main__':
+    main()
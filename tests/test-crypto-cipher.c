@@ -777,6 +777,64 @@ static void test_cipher_short_plaintext(void)
     qcrypto_cipher_free(cipher);
 }
 
+static void test_cipher_sectors_mode(QCryptoCipherMode mode)
+{
+    QCryptoCipher *cipher;
+    uint8_t key[64];
+    uint8_t ivs[8 * 16];
+    uint8_t plaintext[8 * 512];
+    uint8_t ciphertext[8 * 512];
+    uint8_t expected[8 * 512];
+    size_t nkey = qcrypto_cipher_get_key_len(QCRYPTO_CIPHER_ALG_AES_256);
+    size_t i;
+
+    if (!qcrypto_cipher_supports(QCRYPTO_CIPHER_ALG_AES_256, mode)) {
+        return;
+    }
+    if (mode == QCRYPTO_CIPHER_MODE_XTS) {
+        nkey *= 2;
+    }
+
+    for (i = 0; i < sizeof(key); i++) {
+        key[i] = i;
+    }
+    for (i = 0; i < sizeof(ivs); i++) {
+        ivs[i] = i * 3;
+    }
+    for (i = 0; i < sizeof(plaintext); i++) {
+        plaintext[i] = i * 7;
+    }
+
+    cipher = qcrypto_cipher_new(QCRYPTO_CIPHER_ALG_AES_256, mode,
+                                key, nkey, &error_abort);
+    g_assert(cipher != NULL);
+
+    /* One sector at a time */
+    for (i = 0; i < 8; i++) {
+        qcrypto_cipher_setiv(cipher, ivs + i * 16, 16, &error_abort);
+        qcrypto_cipher_encrypt(cipher, plaintext + i * 512,
+                               expected + i * 512, 512, &error_abort);
+    }
+
+    qcrypto_cipher_encrypt_sectors(cipher, ivs, 16, 512,
+                                   plaintext, ciphertext, sizeof(plaintext),
+                                   &error_abort);
+    g_assert(memcmp(ciphertext, expected, sizeof(expected)) == 0);
+
+    qcrypto_cipher_decrypt_sectors(cipher, ivs, 16, 512,
+                                   expected, ciphertext, sizeof(expected),
+                                   &error_abort);
+    g_assert(memcmp(ciphertext, plaintext, sizeof(plaintext)) == 0);
+
+    qcrypto_cipher_free(cipher);
+}
+
+static void test_cipher_sectors(void)
+{
+    test_cipher_sectors_mode(QCRYPTO_CIPHER_MODE_CBC);
+    test_cipher_sectors_mode(QCRYPTO_CIPHER_MODE_XTS);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -797,5 +855,8 @@ int main(int argc, char **argv)
     g_test_add_func("/crypto/cipher/short-plaintext",
                     test_cipher_short_plaintext);
 
+    g_test_add_func("/crypto/cipher/sectors",
+                    test_cipher_sectors);
+
     return g_test_run();
 }
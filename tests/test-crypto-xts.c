@@ -321,8 +321,11 @@ static void test_xts_aes_encrypt(const void *ctx,
                                  const uint8_t *src)
 {
     const struct TestAES *aesctx = ctx;
+    size_t i;
 
-    AES_encrypt(src, dst, &aesctx->enc);
+    for (i = 0; i < length; i += 16) {
+        AES_encrypt(src + i, dst + i, &aesctx->enc);
+    }
 }
 
 
@@ -332,8 +335,11 @@ static void test_xts_aes_decrypt(const void *ctx,
                                  const uint8_t *src)
 {
     const struct TestAES *aesctx = ctx;
+    size_t i;
 
-    AES_decrypt(src, dst, &aesctx->dec);
+    for (i = 0; i < length; i += 16) {
+        AES_decrypt(src + i, dst + i, &aesctx->dec);
+    }
 }
 
 
@@ -498,6 +504,51 @@ static void test_xts_unaligned(const void *opaque)
 }
 
 
+static void test_xts_sectors(const void *opaque)
+{
+    const QCryptoXTSTestData *data = opaque;
+    uint8_t in[4 * 512], out[4 * 512], expected[4 * 512];
+    uint8_t ivs[4 * 16], T[16];
+    struct TestAES aesdata;
+    struct TestAES aestweak;
+    size_t i;
+
+    AES_set_encrypt_key(data->key1, data->keylen / 2 * 8, &aesdata.enc);
+    AES_set_decrypt_key(data->key1, data->keylen / 2 * 8, &aesdata.dec);
+    AES_set_encrypt_key(data->key2, data->keylen / 2 * 8, &aestweak.enc);
+    AES_set_decrypt_key(data->key2, data->keylen / 2 * 8, &aestweak.dec);
+
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = i * 7;
+    }
+
+    for (i = 0; i < 4; i++) {
+        STORE64L(data->seqnum + i, ivs + i * 16);
+        memset(ivs + i * 16 + 8, 0, 8);
+
+        memcpy(T, ivs + i * 16, sizeof(T));
+        xts_encrypt(&aesdata, &aestweak,
+                    test_xts_aes_encrypt,
+                    test_xts_aes_decrypt,
+                    T, 512, expected + i * 512, in + i * 512);
+    }
+
+    xts_encrypt_sectors(&aesdata, &aestweak,
+                        test_xts_aes_encrypt,
+                        test_xts_aes_decrypt,
+                        ivs, 512, sizeof(in), out, in);
+
+    g_assert(memcmp(out, expected, sizeof(out)) == 0);
+
+    xts_decrypt_sectors(&aesdata, &aestweak,
+                        test_xts_aes_encrypt,
+                        test_xts_aes_decrypt,
+                        ivs, 512, sizeof(expected), out, expected);
+
+    g_assert(memcmp(out, in, sizeof(out)) == 0);
+}
+
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -523,6 +574,10 @@ int main(int argc, char **argv)
         path = g_strdup_printf("%s/unaligned", test_data[i].path);
         g_test_add_data_func(path, &test_data[i], test_xts_unaligned);
         g_free(path);
+
+        path = g_strdup_printf("%s/sectors", test_data[i].path);
+        g_test_add_data_func(path, &test_data[i], test_xts_sectors);
+        g_free(path);
     }
 
     return g_test_run();
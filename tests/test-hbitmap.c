@@ -398,6 +398,27 @@ static void test_hbitmap_reset_all(TestHBitmapData *data,
     hbitmap_test_reset_all(data);
 }
 
+/*
+ * Bitmaps of at least 64 KiB per level are allocated as anonymous memory;
+ * check resizing across that threshold and clearing them.
+ */
+static void test_hbitmap_mapped(TestHBitmapData *data,
+                                const void *unused)
+{
+    hbitmap_test_init(data, L3 * 4, 0);
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L3 * 3, L2 + 5);
+    hbitmap_test_set(data, L3 * 4 - 1, 1);
+    hbitmap_test_truncate_impl(data, L3 / 2);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_truncate_impl(data, L3 * 4);
+    hbitmap_test_check(data, 0);
+    hbitmap_test_set(data, L3 * 2, L3);
+    hbitmap_test_reset(data, L3 * 2 + 3, L2);
+    hbitmap_test_reset_all(data);
+    hbitmap_test_set(data, L3, L1);
+}
+
 static void test_hbitmap_granularity(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -1042,6 +1063,47 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/*
+ * Exercise the vectorized word helpers (merge, count, next_zero scanning)
+ * with every implementation that this host supports.
+ */
+static void test_hbitmap_accel(TestHBitmapData *data, const void *unused)
+{
+    do {
+        HBitmap *hb;
+        uint64_t i, n;
+
+        hbitmap_test_init(data, L2 * 3 + 17, 0);
+        hb = hbitmap_alloc(data->size, 0);
+
+        for (i = 0; i < data->size; i += 37) {
+            hbitmap_test_set(data, i, MIN(3, data->size - i));
+        }
+        for (i = 5; i < data->size; i += 131) {
+            n = MIN(40, data->size - i);
+            hbitmap_set(hb, i, n);
+            bitmap_set(data->bits, i, n);
+        }
+
+        g_assert(hbitmap_merge(data->hb, hb, data->hb));
+        hbitmap_test_check(data, 0);
+
+        /* Count across word boundaries in set and reset */
+        hbitmap_test_set(data, L1 - 3, L2 + 7);
+        hbitmap_test_reset(data, 1, L2 * 2);
+
+        /* Scan for a zero behind a long run of ones */
+        hbitmap_test_set(data, 0, data->size - 1);
+        g_assert_cmpint(hbitmap_next_zero(data->hb, 3, INT64_MAX), ==,
+                        data->size - 1);
+        hbitmap_test_set(data, data->size - 1, 1);
+        g_assert_cmpint(hbitmap_next_zero(data->hb, 3, INT64_MAX), ==, -1);
+
+        hbitmap_free(hb);
+        hbitmap_test_teardown(data, NULL);
+    } while (test_hbitmap_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1061,6 +1123,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
+    hbitmap_test_add("/hbitmap/mapped", test_hbitmap_mapped);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
 
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
@@ -1113,6 +1176,9 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    /* This leaves the slowest implementation selected, so keep it last */
+    hbitmap_test_add("/hbitmap/accel", test_hbitmap_accel);
+
     g_test_run();
 
     return 0;
@@ -0,0 +1,144 @@
+/*
+ * Test interval trees
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define N 512
+
+static IntervalTreeNode nodes[N];
+static bool inserted[N];
+static IntervalTreeRoot root;
+
+/* returns the black height of @node; checks the tree invariants */
+static int check_subtree(IntervalTreeNode *node, IntervalTreeNode *parent)
+{
+    uint64_t max;
+    int left, right;
+
+    if (node == NULL) {
+        return 1;
+    }
+    g_assert(node->parent == parent);
+    if (node->red) {
+        g_assert(!node->left || !node->left->red);
+        g_assert(!node->right || !node->right->red);
+    }
+    max = node->last;
+    if (node->left) {
+        g_assert_cmpuint(node->left->start, <=, node->start);
+        max = MAX(max, node->left->subtree_last);
+    }
+    if (node->right) {
+        g_assert_cmpuint(node->right->start, >=, node->start);
+        max = MAX(max, node->right->subtree_last);
+    }
+    g_assert_cmpuint(node->subtree_last, ==, max);
+
+    left = check_subtree(node->left, node);
+    right = check_subtree(node->right, node);
+    g_assert_cmpint(left, ==, right);
+    return left + !node->red;
+}
+
+static void check_tree(void)
+{
+    if (root.root) {
+        g_assert_false(root.root->red);
+        check_subtree(root.root, NULL);
+    }
+}
+
+/* compare a lookup with a linear scan of the inserted nodes */
+static void check_lookup(uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *node;
+    uint64_t prev = 0;
+    size_t count = 0, found = 0;
+    int i;
+
+    for (i = 0; i < N; i++) {
+        if (inserted[i] && nodes[i].start <= last && start <= nodes[i].last) {
+            count++;
+        }
+    }
+
+    for (node = interval_tree_iter_first(&root, start, last);
+         node;
+         node = interval_tree_iter_next(node, start, last)) {
+        g_assert_cmpuint(node->start, <=, last);
+        g_assert_cmpuint(node->last, >=, start);
+        g_assert_cmpuint(node->start, >=, prev);
+        prev = node->start;
+        found++;
+    }
+    g_assert_cmpuint(found, ==, count);
+}
+
+static void test_empty(void)
+{
+    IntervalTreeRoot empty = { };
+
+    g_assert_null(interval_tree_iter_first(&empty, 0, UINT64_MAX));
+}
+
+static void test_disjoint(void)
+{
+    IntervalTreeNode a = { .start = 0x1000, .last = 0x1fff };
+    IntervalTreeNode b = { .start = 0x3000, .last = 0x3fff };
+    IntervalTreeRoot r = { };
+
+    interval_tree_insert(&a, &r);
+    interval_tree_insert(&b, &r);
+
+    g_assert(interval_tree_iter_first(&r, 0, UINT64_MAX) == &a);
+    g_assert(interval_tree_iter_next(&a, 0, UINT64_MAX) == &b);
+    g_assert_null(interval_tree_iter_next(&b, 0, UINT64_MAX));
+    g_assert(interval_tree_iter_first(&r, 0x1fff, 0x1fff) == &a);
+    g_assert_null(interval_tree_iter_first(&r, 0x2000, 0x2fff));
+    g_assert(interval_tree_iter_first(&r, 0x2000, 0x3000) == &b);
+
+    interval_tree_remove(&a, &r);
+    g_assert_null(interval_tree_iter_first(&r, 0, 0x2fff));
+    interval_tree_remove(&b, &r);
+    g_assert_null(r.root);
+}
+
+static void test_random(void)
+{
+    GRand *rand = g_rand_new_with_seed(0);
+    int iter, i;
+
+    for (iter = 0; iter < 100000; iter++) {
+        uint64_t start;
+
+        i = g_rand_int_range(rand, 0, N);
+        if (inserted[i]) {
+            interval_tree_remove(&nodes[i], &root);
+            inserted[i] = false;
+        } else {
+            nodes[i].start = g_rand_int_range(rand, 0, 10000);
+            nodes[i].last = nodes[i].start + g_rand_int_range(rand, 0, 300);
+            interval_tree_insert(&nodes[i], &root);
+            inserted[i] = true;
+        }
+        if (iter % 128 == 0) {
+            check_tree();
+        }
+        start = g_rand_int_range(rand, 0, 10500);
+        check_lookup(start, start + g_rand_int_range(rand, 0, 200));
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_empty);
+    g_test_add_func("/interval-tree/disjoint", test_disjoint);
+    g_test_add_func("/interval-tree/random", test_random);
+    return g_test_run();
+}
@@ -101,6 +101,49 @@ static void test_io_channel_fd(void)
     object_unref(OBJECT(ioc));
 }
 
+#ifdef CONFIG_PREADV
+static void test_io_channel_file_positional(void)
+{
+    QIOChannel *ioc;
+    char buf[8];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    ssize_t ret;
+
+    unlink(TEST_FILE);
+    ioc = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDWR | O_CREAT | O_TRUNC | O_BINARY, TEST_MASK,
+                          &error_abort));
+    g_assert(qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE));
+
+    /* Positional writes don't move the current position */
+    memcpy(buf, "positnal", sizeof(buf));
+    ret = qio_channel_pwritev(ioc, &iov, 1, 4096, &error_abort);
+    g_assert_cmpint(ret, ==, sizeof(buf));
+    g_assert_cmpint(qio_channel_io_seek(ioc, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+    ret = qio_channel_write(ioc, "stream", 6, &error_abort);
+    g_assert_cmpint(ret, ==, 6);
+
+    memset(buf, 0, sizeof(buf));
+    ret = qio_channel_preadv(ioc, &iov, 1, 4096, &error_abort);
+    g_assert_cmpint(ret, ==, sizeof(buf));
+    g_assert(memcmp(buf, "positnal", sizeof(buf)) == 0);
+
+    memset(buf, 0, sizeof(buf));
+    ret = qio_channel_preadv(ioc, &iov, 1, 0, &error_abort);
+    g_assert_cmpint(ret, ==, sizeof(buf));
+    g_assert(memcmp(buf, "stream\0\0", sizeof(buf)) == 0);
+
+    /* Reading past the end of the file returns 0 */
+    ret = qio_channel_preadv(ioc, &iov, 1, 8192, &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(ioc));
+}
+#endif
+
 
 #ifndef _WIN32
 static void test_io_channel_pipe(bool async)
@@ -116,6 +159,7 @@ static void test_io_channel_pipe(bool async)
 
     src = QIO_CHANNEL(qio_channel_file_new_fd(fd[1]));
     dst = QIO_CHANNEL(qio_channel_file_new_fd(fd[0]));
+    g_assert(!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_SEEKABLE));
 
     test = qio_channel_test_new();
     qio_channel_test_run_threads(test, async, src, dst);
@@ -147,6 +191,10 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/rdwr", test_io_channel_file_rdwr);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/file/positional",
+                    test_io_channel_file_positional);
+#endif
 #ifndef _WIN32
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
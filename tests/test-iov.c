@@ -567,6 +567,36 @@ static void test_discard_back_undo(void)
     iov_free(iov, iov_cnt);
 }
 
+static void test_qiov_inline(void)
+{
+    static char buf[16];
+    QEMUIOVector qiov, slice;
+    int i;
+
+    /* Short vectors use the inline storage, longer ones move out of it */
+    qemu_iovec_init(&qiov, 1);
+    for (i = 0; i < 2 * QEMU_IOVEC_INLINE; i++) {
+        qemu_iovec_add(&qiov, buf + i, 1);
+        if (i < QEMU_IOVEC_INLINE) {
+            g_assert(qiov.iov == qiov.inline_iov);
+        } else {
+            g_assert(qiov.iov != qiov.inline_iov);
+        }
+        g_assert(qiov.iov[0].iov_base == buf);
+        g_assert_cmpint(qiov.niov, ==, i + 1);
+        g_assert_cmpuint(qiov.size, ==, i + 1);
+    }
+
+    qemu_iovec_init_slice(&slice, &qiov, 1, 3);
+    g_assert(slice.iov == slice.inline_iov);
+    g_assert_cmpint(slice.niov, ==, 3);
+    g_assert(slice.iov[0].iov_base == buf + 1);
+    g_assert_cmpuint(slice.size, ==, 3);
+
+    qemu_iovec_destroy(&slice);
+    qemu_iovec_destroy(&qiov);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -577,5 +607,6 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/iov/discard-back", test_discard_back);
     g_test_add_func("/basic/iov/discard-front-undo", test_discard_front_undo);
     g_test_add_func("/basic/iov/discard-back-undo", test_discard_back_undo);
+    g_test_add_func("/basic/iov/qiov-inline", test_qiov_inline);
     return g_test_run();
 }
@@ -671,6 +671,49 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_reserve_credit(void)
+{
+    unsigned int bytes, ops;
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 100000;
+    cfg.buckets[THROTTLE_BPS_READ].avg = 50000;
+    cfg.buckets[THROTTLE_OPS_WRITE].avg = 1000;
+
+    throttle_init(&ts);
+    throttle_timers_init(tt, ctx, QEMU_CLOCK_VIRTUAL,
+                         read_timer_cb, write_timer_cb, &ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* reads get credit at the lower of the two bps rates */
+    g_assert(throttle_reserve_credit(&ts, false, ts.previous_leak,
+                                     &bytes, &ops));
+    g_assert_cmpuint(bytes, ==, 500);
+    g_assert_cmpuint(ops, ==, INT_MAX);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 500));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 500));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 0));
+
+    /* writes are only limited by ops */
+    g_assert(throttle_reserve_credit(&ts, true, ts.previous_leak,
+                                     &bytes, &ops));
+    g_assert_cmpuint(bytes, ==, 1000);
+    g_assert_cmpuint(ops, ==, 10);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 1500));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_WRITE].level, 10));
+
+    /* no credit if it would throttle the next request */
+    ts.cfg.buckets[THROTTLE_BPS_READ].level = 4800;
+    g_assert(!throttle_reserve_credit(&ts, false, ts.previous_leak,
+                                      &bytes, &ops));
+    g_assert_cmpuint(bytes, ==, 0);
+    g_assert_cmpuint(ops, ==, 0);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 1500));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 4800));
+
+    throttle_timers_destroy(tt);
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -764,6 +807,7 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/reserve_credit",     test_reserve_credit);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
@@ -174,6 +174,52 @@ static void test_encode_decode(void)
     }
 }
 
+/*
+ * Whatever implementation xbzrle_encode_buffer() picked must produce
+ * the same bytes as the portable one, including when it overflows.
+ */
+static void test_encode_accel(void)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE);
+    uint8_t *new = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *reference = g_malloc(PAGE_SIZE);
+    int i, j, k;
+
+    for (i = 0; i < 10000; i++) {
+        int changes = g_test_rand_int_range(0, 64);
+        int dlen = g_test_rand_int_range(0, 8) ? PAGE_SIZE :
+                   g_test_rand_int_range(0, PAGE_SIZE);
+        int rc, rc_int;
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            old[j] = g_test_rand_int_range(0, 4);
+        }
+        memcpy(new, old, PAGE_SIZE);
+        for (j = 0; j < changes; j++) {
+            int start = g_test_rand_int_range(0, PAGE_SIZE);
+            int len = g_test_rand_int_range(0, 80);
+
+            for (k = start; k < start + len && k < PAGE_SIZE; k++) {
+                new[k] = g_test_rand_int_range(0, 4);
+            }
+        }
+
+        rc = xbzrle_encode_buffer(old, new, PAGE_SIZE, compressed, dlen);
+        rc_int = xbzrle_encode_buffer_int(old, new, PAGE_SIZE, reference,
+                                          dlen);
+        g_assert_cmpint(rc, ==, rc_int);
+        if (rc > 0) {
+            g_assert(memcmp(compressed, reference, rc) == 0);
+        }
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(compressed);
+    g_free(reference);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +232,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -11,6 +11,7 @@
 #include "qemu/osdep.h"
 #ifndef _WIN32
 #include <pthread.h>
+#include <sys/mman.h>
 #endif
 #include "qemu/timer.h"
 #include "trace/control.h"
@@ -30,12 +31,17 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
+ * Each thread writes its trace records into a buffer of its own, so that
+ * tracing does not bounce a shared index between CPUs.  The buffers are
+ * single-producer, single-consumer rings: the owning thread appends records
+ * and publishes them by advancing @head, the writeout thread consumes them
+ * and advances @tail.  Buffers are never freed; when a thread exits, its
+ * buffer can be adopted by a new thread.
+ *
  * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * records to become available, writes them out in timestamp order, and then
+ * waits again.
  */
 static GMutex trace_lock;
 static GCond trace_available_cond;
@@ -45,18 +51,56 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,  /* per thread, must be a power of two */
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
+typedef struct TraceThreadBuf TraceThreadBuf;
+struct TraceThreadBuf {
+    TraceThreadBuf *next;
+    volatile gint in_use;
+    volatile gint head;
+    volatile gint tail;
+
+    /* Only used by the owning thread and its signal handlers */
+    volatile gint reserve;      /* end of the records being written */
+    unsigned int nesting;       /* number of records being written */
+
+    /* Only used by the writeout thread */
+    unsigned int writeout_head;
+
+    uint8_t data[TRACE_BUF_LEN];
+};
+
+static TraceThreadBuf *trace_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
+
 static volatile gint dropped_events;
 static uint32_t trace_pid;
-static FILE *trace_fp;
 static char *trace_file_name;
 
+/*
+ * Regular files are written through a shared mapping that moves forward
+ * in TRACE_MAP_LEN steps, and truncated to the data written when closed.
+ * Each window is allocated before it is mapped, so that running out of
+ * disk space is a write error instead of a SIGBUS.  Other files, and
+ * regular files whose next window cannot be allocated or mapped, are
+ * written with write(2).
+ */
+#ifndef _WIN32
+enum {
+    TRACE_MAP_LEN = 4 * 1024 * 1024,
+};
+
+static int trace_fd = -1;
+static bool trace_use_write;
+static uint8_t *trace_map;
+static size_t trace_map_pos;
+static off_t trace_map_off;
+#else
+static FILE *trace_fp;
+#endif
+
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
 
@@ -75,56 +119,239 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+#ifndef _WIN32
+static bool st_file_is_open(void)
+{
+    return trace_fd >= 0;
+}
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
-
-static void clear_buffer_range(unsigned int idx, size_t len)
+static bool st_file_open(const char *name)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
+#ifdef CONFIG_POSIX_FALLOCATE
+    struct stat st;
+#endif
+
+    /* QEMU's wrappers cannot be used here, they may be traced */
+    trace_fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (trace_fd < 0) {
+        return false;
     }
+    trace_map = NULL;
+    trace_map_pos = 0;
+    trace_map_off = 0;
+#ifdef CONFIG_POSIX_FALLOCATE
+    trace_use_write = fstat(trace_fd, &st) < 0 || !S_ISREG(st.st_mode);
+#else
+    /* Without posix_fallocate() a full disk would raise SIGBUS */
+    trace_use_write = true;
+#endif
+    return true;
 }
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
+
+/*
+ * Map the first window of the file, or the one after the current window.
+ * On failure, switch to write(2) at the end of the data written so far.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool st_file_map_next(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    off_t off = trace_map_off;
+    void *map = MAP_FAILED;
+    int unused __attribute__ ((unused));
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    if (trace_map) {
+        off += TRACE_MAP_LEN;
+    }
+#ifdef CONFIG_POSIX_FALLOCATE
+    if (posix_fallocate(trace_fd, off, TRACE_MAP_LEN) == 0) {
+        map = mmap(NULL, TRACE_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   trace_fd, off);
     }
+#endif
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
+    if (trace_map) {
+        munmap(trace_map, TRACE_MAP_LEN);
+        trace_map = NULL;
+    }
+    if (map == MAP_FAILED) {
+        /* Drop whatever was allocated past the data */
+        unused = ftruncate(trace_fd, off);
+        trace_use_write = true;
+        return lseek(trace_fd, off, SEEK_SET) == off;
+    }
+    trace_map = map;
+    trace_map_pos = 0;
+    trace_map_off = off;
+    return true;
+}
+
+static bool st_file_write_fd(const uint8_t *data_ptr, size_t size)
+{
+    while (size) {
+        ssize_t len = write(trace_fd, data_ptr, size);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data_ptr += len;
+        size -= len;
+    }
+    return true;
+}
+
+static bool st_file_write(const void *dataptr, size_t size)
+{
+    const uint8_t *data_ptr = dataptr;
+
+    while (size) {
+        size_t len;
+
+        if (!trace_use_write &&
+            (!trace_map || trace_map_pos == TRACE_MAP_LEN) &&
+            !st_file_map_next()) {
+            return false;
+        }
+        if (trace_use_write) {
+            return st_file_write_fd(data_ptr, size);
+        }
+        len = MIN(size, TRACE_MAP_LEN - trace_map_pos);
+        memcpy(trace_map + trace_map_pos, data_ptr, len);
+        trace_map_pos += len;
+        data_ptr += len;
+        size -= len;
+    }
     return true;
 }
 
+static void st_file_flush(void)
+{
+    /* The data is in the page cache already, write(2) is not buffered */
+}
+
+static void st_file_close(void)
+{
+    int unused __attribute__ ((unused));
+
+    if (trace_map) {
+        munmap(trace_map, TRACE_MAP_LEN);
+        trace_map = NULL;
+        /* Drop the unused tail of the last window */
+        unused = ftruncate(trace_fd, trace_map_off + trace_map_pos);
+    }
+    close(trace_fd);
+    trace_fd = -1;
+}
+#else
+static bool st_file_is_open(void)
+{
+    return trace_fp;
+}
+
+static bool st_file_open(const char *name)
+{
+    trace_fp = fopen(name, "wb");
+    return trace_fp;
+}
+
+static bool st_file_write(const void *dataptr, size_t size)
+{
+    return fwrite(dataptr, size, 1, trace_fp) == 1;
+}
+
+static void st_file_flush(void)
+{
+    fflush(trace_fp);
+}
+
+static void st_file_close(void)
+{
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
+#endif
+
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size)
+{
+    unsigned int off = idx & (TRACE_BUF_LEN - 1);
+    size_t len = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(dataptr, &tb->data[off], len);
+    memcpy((uint8_t *)dataptr + len, tb->data, size - len);
+}
+
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    const void *dataptr, size_t size)
+{
+    unsigned int off = idx & (TRACE_BUF_LEN - 1);
+    size_t len = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&tb->data[off], dataptr, len);
+    memcpy(tb->data, (const uint8_t *)dataptr + len, size - len);
+    return idx + size; /* most callers wants to know where to write next */
+}
+
+/* Write out a record straight from the ring, which it may wrap around */
+static void write_record_to_file(TraceThreadBuf *tb, unsigned int idx,
+                                 uint32_t length)
+{
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    unsigned int off = idx & (TRACE_BUF_LEN - 1);
+    size_t len = MIN(length, TRACE_BUF_LEN - off);
+
+    st_file_write(&type, sizeof(type));
+    st_file_write(&tb->data[off], len);
+    st_file_write(tb->data, length - len);
+}
+
+/* Release the buffer of an exiting thread */
+static void trace_thread_buf_release(gpointer opaque)
+{
+    TraceThreadBuf *tb = opaque;
+
+    trace_thread_buf = NULL;
+    g_atomic_int_set(&tb->in_use, 0);
+}
+
+static GPrivate trace_thread_buf_key = G_PRIVATE_INIT(trace_thread_buf_release);
+
+static TraceThreadBuf *trace_thread_buf_get(void)
+{
+    TraceThreadBuf *tb = trace_thread_buf;
+
+    if (likely(tb)) {
+        return tb;
+    }
+
+    /* Adopt the buffer of a thread that has exited, if there is one */
+    for (tb = g_atomic_pointer_get(&trace_bufs); tb; tb = tb->next) {
+        if (g_atomic_int_compare_and_exchange(&tb->in_use, 0, 1)) {
+            break;
+        }
+    }
+
+    if (!tb) {
+        /* don't use g_malloc, can deadlock when traced */
+        tb = calloc(1, sizeof(*tb));
+        if (!tb) {
+            return NULL;
+        }
+        tb->in_use = 1;
+        do {
+            tb->next = g_atomic_pointer_get(&trace_bufs);
+        } while (!g_atomic_pointer_compare_and_exchange(&trace_bufs,
+                                                        tb->next, tb));
+    }
+
+    g_atomic_int_set(&tb->reserve, g_atomic_int_get(&tb->head));
+    tb->nesting = 0;
+    trace_thread_buf = tb;
+    g_private_set(&trace_thread_buf_key, tb);
+    return tb;
+}
+
 /**
  * Kick writeout thread
  *
@@ -154,16 +381,61 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/*
+ * Merge the records published by all threads so far, oldest first.  Records
+ * published while this runs are left for the next round, so the output is
+ * ordered within each round, and within each thread.
+ */
+static void writeout_records(void)
+{
+    TraceThreadBuf *tb;
+
+    for (tb = g_atomic_pointer_get(&trace_bufs); tb; tb = tb->next) {
+        tb->writeout_head = g_atomic_int_get(&tb->head);
+    }
+    smp_rmb(); /* read memory barrier before accessing the records */
+
+    for (;;) {
+        TraceThreadBuf *oldest = NULL;
+        uint64_t oldest_ns = 0;
+        unsigned int idx;
+        TraceRecord record;
+
+        for (tb = g_atomic_pointer_get(&trace_bufs); tb; tb = tb->next) {
+            uint64_t timestamp_ns;
+
+            idx = tb->tail;
+            if (idx == tb->writeout_head) {
+                continue;
+            }
+            read_from_buffer(tb, idx + offsetof(TraceRecord, timestamp_ns),
+                             &timestamp_ns, sizeof(timestamp_ns));
+            if (!oldest || timestamp_ns < oldest_ns) {
+                oldest = tb;
+                oldest_ns = timestamp_ns;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+
+        idx = oldest->tail;
+        read_from_buffer(oldest, idx, &record, sizeof(TraceRecord));
+        write_record_to_file(oldest, idx, record.length);
+
+        /* make sure the record is read before it can be overwritten */
+        smp_mb();
+        g_atomic_int_set(&oldest->tail, idx + record.length);
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
     int dropped_count;
-    size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
     for (;;) {
@@ -179,102 +451,87 @@ static gpointer writeout_thread(gpointer opaque)
             } while (!g_atomic_int_compare_and_exchange(&dropped_events,
                                                         dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
-        }
-
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            st_file_write(&type, sizeof(type));
+            st_file_write(&dropped.rec, dropped.rec.length);
         }
 
-        fflush(trace_fp);
+        writeout_records();
+        st_file_flush();
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *tb = trace_thread_buf_get();
+    unsigned int idx;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
+    TraceRecord record = {
+        .event = event,
+        .timestamp_ns = get_clock(),
+        .length = rec_len,
+        .pid = trace_pid,
+    };
+
+    if (!tb) {
+        g_atomic_int_inc(&dropped_events);
+        return -ENOSPC;
+    }
 
+    /*
+     * A record can be started from a signal handler while another one is
+     * being written; the records are published when both are finished.
+     * Count this record before reserving its space, so that a nested one
+     * cannot publish it, and reserve the space atomically, so that the
+     * two never get the same offset.
+     */
+    tb->nesting++;
     do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
+        idx = g_atomic_int_get(&tb->reserve);
+        if (idx + rec_len - (unsigned int)g_atomic_int_get(&tb->tail) >
+            TRACE_BUF_LEN) {
             /* Trace Buffer Full, Event dropped ! */
+            tb->nesting--;
             g_atomic_int_inc(&dropped_events);
             return -ENOSPC;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
+    } while (!g_atomic_int_compare_and_exchange(&tb->reserve, idx,
+                                                idx + rec_len));
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    write_to_buffer(tb, idx, &record, sizeof(TraceRecord));
 
+    rec->tbuf = tb;
     rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->rec_off = idx + sizeof(TraceRecord);
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+void trace_record_finish(TraceBufferRecord *rec)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
-}
+    TraceThreadBuf *tb = rec->tbuf;
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+    if (--tb->nesting == 0) {
+        smp_wmb(); /* write barrier before publishing the records */
+        g_atomic_int_set(&tb->head, g_atomic_int_get(&tb->reserve));
     }
-    return idx; /* most callers wants to know where to write next */
-}
-
-void trace_record_finish(TraceBufferRecord *rec)
-{
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
+    if ((unsigned int)g_atomic_int_get(&tb->reserve) -
+        (unsigned int)g_atomic_int_get(&tb->tail)
         > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
@@ -291,10 +548,10 @@ static int st_write_event_mapping(void)
         uint64_t id = trace_event_get_id(ev);
         const char *name = trace_event_get_name(ev);
         uint32_t len = strlen(name);
-        if (fwrite(&type, sizeof(type), 1, trace_fp) != 1 ||
-            fwrite(&id, sizeof(id), 1, trace_fp) != 1 ||
-            fwrite(&len, sizeof(len), 1, trace_fp) != 1 ||
-            fwrite(name, len, 1, trace_fp) != 1) {
+        if (!st_file_write(&type, sizeof(type)) ||
+            !st_file_write(&id, sizeof(id)) ||
+            !st_file_write(&len, sizeof(len)) ||
+            !st_file_write(name, len)) {
             return -1;
         }
     }
@@ -309,9 +566,9 @@ static int st_write_event_mapping(void)
  */
 bool st_set_trace_file_enabled(bool enable)
 {
-    bool was_enabled = trace_fp;
+    bool was_enabled = st_file_is_open();
 
-    if (enable == !!trace_fp) {
+    if (enable == was_enabled) {
         return was_enabled;     /* no change */
     }
 
@@ -328,15 +585,13 @@ bool st_set_trace_file_enabled(bool enable)
             .header_version = HEADER_VERSION,
         };
 
-        trace_fp = fopen(trace_file_name, "wb");
-        if (!trace_fp) {
+        if (!st_file_open(trace_file_name)) {
             return was_enabled;
         }
 
-        if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
+        if (!st_file_write(&header, sizeof header) ||
             st_write_event_mapping() < 0) {
-            fclose(trace_fp);
-            trace_fp = NULL;
+            st_file_close();
             return was_enabled;
         }
 
@@ -344,8 +599,7 @@ bool st_set_trace_file_enabled(bool enable)
         trace_writeout_enabled = true;
         flush_trace_file(false);
     } else {
-        fclose(trace_fp);
-        trace_fp = NULL;
+        st_file_close();
     }
     return was_enabled;
 }
@@ -375,7 +629,7 @@ void st_set_trace_file(const char *file)
 void st_print_trace_file_status(void)
 {
     qemu_printf("Trace file \"%s\" %s.\n",
-                trace_file_name, trace_fp ? "on" : "off");
+                trace_file_name, st_file_is_open() ? "on" : "off");
 }
 
 void st_flush_trace_buffer(void)
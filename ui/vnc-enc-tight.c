@@ -41,6 +41,9 @@
 #ifdef CONFIG_VNC_JPEG
 #include <jpeglib.h>
 #endif
+#ifdef CONFIG_VNC_TURBOJPEG
+#include <turbojpeg.h>
+#endif
 
 #include "qemu/bswap.h"
 #include "vnc.h"
@@ -341,6 +344,39 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
 /*
  * Code to determine how many different colors used in rectangle.
  */
+/*
+ * Returns the index of the first pixel from @i on that differs from @c.
+ * Blocks of pixels are compared without an early exit, so that the
+ * compiler can turn them into vector compares.
+ */
+#define DEFINE_RUN_LENGTH_FUNCTION(bpp)                                 \
+                                                                        \
+    static inline size_t                                                \
+    tight_find_run_end##bpp(const uint##bpp##_t *data, size_t i,        \
+                            size_t count, uint##bpp##_t c) {            \
+        uint##bpp##_t diff;                                             \
+        int j;                                                          \
+                                                                        \
+        while (i + 16 <= count) {                                       \
+            diff = 0;                                                   \
+            for (j = 0; j < 16; j++) {                                  \
+                diff |= data[i + j] ^ c;                                \
+            }                                                           \
+            if (diff) {                                                 \
+                break;                                                  \
+            }                                                           \
+            i += 16;                                                    \
+        }                                                               \
+        while (i < count && data[i] == c) {                             \
+            i++;                                                        \
+        }                                                               \
+        return i;                                                       \
+    }
+
+DEFINE_RUN_LENGTH_FUNCTION(8)
+DEFINE_RUN_LENGTH_FUNCTION(16)
+DEFINE_RUN_LENGTH_FUNCTION(32)
+
 #define DEFINE_FILL_PALETTE_FUNCTION(bpp)                               \
                                                                         \
     static int                                                          \
@@ -355,9 +391,7 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
         data = (uint##bpp##_t *)vs->tight->tight.buffer;                \
                                                                         \
         c0 = data[0];                                                   \
-        i = 1;                                                          \
-        while (i < count && data[i] == c0)                              \
-            i++;                                                        \
+        i = tight_find_run_end##bpp(data, 1, count, c0);                \
         if (i >= count) {                                               \
             *bg = *fg = c0;                                             \
             return 1;                                                   \
@@ -399,14 +433,12 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
         palette_put(palette, c1);                                       \
         palette_put(palette, ci);                                       \
                                                                         \
-        for (i++; i < count; i++) {                                     \
-            if (data[i] == ci) {                                        \
-                continue;                                               \
-            } else {                                                    \
-                ci = data[i];                                           \
-                if (!palette_put(palette, (uint32_t)ci)) {              \
-                    return 0;                                           \
-                }                                                       \
+        for (i = tight_find_run_end##bpp(data, i + 1, count, ci);       \
+             i < count;                                                 \
+             i = tight_find_run_end##bpp(data, i + 1, count, ci)) {     \
+            ci = data[i];                                               \
+            if (!palette_put(palette, (uint32_t)ci)) {                  \
+                return 0;                                               \
             }                                                           \
         }                                                               \
                                                                         \
@@ -552,13 +584,19 @@ tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
     uint32_t *buf32;
     uint32_t pix32;
     int shift[3];
-    int *prev;
-    int here[3], upper[3], left[3], upperleft[3];
+    uint8_t *upper, *here, *tmp;
     int prediction;
-    int x, y, c;
+    int x, y, c, i;
 
+    /*
+     * The prediction only depends on the input pixels, so unpack each
+     * row first: then the loop over the samples has no dependency from
+     * one iteration to the next and can be vectorized.
+     */
     buf32 = (uint32_t *)buf;
-    memset(vs->tight->gradient.buffer, 0, w * 3 * sizeof(int));
+    upper = vs->tight->gradient.buffer;
+    here = upper + w * 3;
+    memset(upper, 0, w * 3);
 
     if (1 /* FIXME */) {
         shift[0] = vs->client_pf.rshift;
@@ -571,29 +609,26 @@ tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
     }
 
     for (y = 0; y < h; y++) {
-        for (c = 0; c < 3; c++) {
-            upper[c] = 0;
-            here[c] = 0;
-        }
-        prev = (int *)vs->tight->gradient.buffer;
         for (x = 0; x < w; x++) {
             pix32 = *buf32++;
             for (c = 0; c < 3; c++) {
-                upperleft[c] = upper[c];
-                left[c] = here[c];
-                upper[c] = *prev;
-                here[c] = (int)(pix32 >> shift[c] & 0xFF);
-                *prev++ = here[c];
-
-                prediction = left[c] + upper[c] - upperleft[c];
-                if (prediction < 0) {
-                    prediction = 0;
-                } else if (prediction > 0xFF) {
-                    prediction = 0xFF;
-                }
-                *buf++ = (char)(here[c] - prediction);
+                here[x * 3 + c] = pix32 >> shift[c];
             }
         }
+
+        /* Left and upper left are 0 for the first pixel */
+        for (i = 0; i < 3; i++) {
+            *buf++ = here[i] - upper[i];
+        }
+        for (i = 3; i < w * 3; i++) {
+            prediction = here[i - 3] + upper[i] - upper[i - 3];
+            prediction = MIN(MAX(prediction, 0), 0xFF);
+            *buf++ = here[i] - prediction;
+        }
+
+        tmp = upper;
+        upper = here;
+        here = tmp;
     }
 }
 
@@ -1173,7 +1208,8 @@ static void jpeg_term_destination(j_compress_ptr cinfo)
     buffer->offset = buffer->capacity - cinfo->dest->free_in_buffer;
 }
 
-static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
+static void tight_compress_libjpeg(VncState *vs, int x, int y, int w, int h,
+                                   int quality)
 {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
@@ -1183,10 +1219,6 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
     uint8_t *buf;
     int dy;
 
-    if (surface_bytes_per_pixel(vs->vd->ds) == 1) {
-        return send_full_color_rect(vs, x, y, w, h);
-    }
-
     buffer_reserve(&vs->tight->jpeg, 2048);
 
     cinfo.err = jpeg_std_error(&jerr);
@@ -1219,6 +1251,57 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
 
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
+}
+
+#ifdef CONFIG_VNC_TURBOJPEG
+/*
+ * TurboJPEG reads the server surface as it is, without converting each
+ * line to RGB888 first, and the compressor is kept from one rectangle to
+ * the next.  The subsampling matches the libjpeg defaults.
+ */
+static int tight_compress_turbojpeg(VncState *vs, int x, int y, int w, int h,
+                                    int quality)
+{
+    unsigned long size = tjBufSize(w, h, TJSAMP_420);
+    unsigned char *dst;
+#ifdef HOST_WORDS_BIGENDIAN
+    int pf = TJPF_XRGB;
+#else
+    int pf = TJPF_BGRX;
+#endif
+
+    if (!vs->tight->tjhandle) {
+        vs->tight->tjhandle = tjInitCompress();
+        if (!vs->tight->tjhandle) {
+            return -1;
+        }
+    }
+
+    buffer_reserve(&vs->tight->jpeg, size);
+    dst = buffer_end(&vs->tight->jpeg);
+    if (tjCompress2(vs->tight->tjhandle, vnc_server_fb_ptr(vs->vd, x, y),
+                    w, vnc_server_fb_stride(vs->vd), h, pf, &dst, &size,
+                    TJSAMP_420, quality, TJFLAG_NOREALLOC) < 0) {
+        return -1;
+    }
+    vs->tight->jpeg.offset += size;
+    return 0;
+}
+#endif
+
+static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
+{
+    if (surface_bytes_per_pixel(vs->vd->ds) == 1) {
+        return send_full_color_rect(vs, x, y, w, h);
+    }
+
+#ifdef CONFIG_VNC_TURBOJPEG
+    if (tight_compress_turbojpeg(vs, x, y, w, h, quality) < 0) {
+        tight_compress_libjpeg(vs, x, y, w, h, quality);
+    }
+#else
+    tight_compress_libjpeg(vs, x, y, w, h, quality);
+#endif
 
     vnc_write_u8(vs, VNC_TIGHT_JPEG << 4);
 
@@ -1706,6 +1789,12 @@ void vnc_tight_clear(VncState *vs)
 #ifdef CONFIG_VNC_JPEG
     buffer_free(&vs->tight->jpeg);
 #endif
+#ifdef CONFIG_VNC_TURBOJPEG
+    if (vs->tight->tjhandle) {
+        tjDestroy(vs->tight->tjhandle);
+        vs->tight->tjhandle = NULL;
+    }
+#endif
 #ifdef CONFIG_VNC_PNG
     buffer_free(&vs->tight->png);
 #endif
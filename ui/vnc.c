@@ -49,6 +49,7 @@
 #include "crypto/random.h"
 #include "qom/object_interfaces.h"
 #include "qemu/cutils.h"
+#include "qemu/bswap.h"
 #include "io/dns-resolver.h"
 
 #define VNC_REFRESH_INTERVAL_BASE GUI_REFRESH_INTERVAL_DEFAULT
@@ -2878,6 +2879,30 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/*
+ * Copy @len bytes from @src to @dst if they differ, and return whether
+ * they did.  Full blocks are compared a word at a time with no early
+ * exit, which compilers turn into vector compares.
+ */
+static inline bool vnc_cmp_copy(uint8_t *dst, const uint8_t *src, int len)
+{
+    if (len == VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES) {
+        uint64_t diff = 0;
+        int i;
+
+        for (i = 0; i < len; i += sizeof(uint64_t)) {
+            diff |= ldq_he_p(dst + i) ^ ldq_he_p(src + i);
+        }
+        if (!diff) {
+            return false;
+        }
+    } else if (memcmp(dst, src, len) == 0) {
+        return false;
+    }
+    memcpy(dst, src, len);
+    return true;
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
@@ -2885,6 +2910,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int height = MIN(pixman_image_get_height(vd->guest.fb),
                      pixman_image_get_height(vd->server));
     int cmp_bytes, server_stride, line_bytes, guest_ll, guest_stride, y = 0;
+    int x = 0, row_end = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+    int tmpbuf_y = -1;
     uint8_t *guest_row0 = NULL, *server_row0;
     VncState *vs;
     int has_dirty = 0;
@@ -2921,42 +2948,59 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     line_bytes = MIN(server_stride, guest_ll);
 
     for (;;) {
-        int x;
+        int x_end, run_bytes;
         uint8_t *guest_ptr, *server_ptr;
         unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                              height * VNC_DIRTY_BPL(&vd->guest),
-                                             y * VNC_DIRTY_BPL(&vd->guest));
+                                             y * VNC_DIRTY_BPL(&vd->guest) + x);
         if (offset == height * VNC_DIRTY_BPL(&vd->guest)) {
             /* no more dirty bits */
             break;
         }
         y = offset / VNC_DIRTY_BPL(&vd->guest);
         x = offset % VNC_DIRTY_BPL(&vd->guest);
+        if (x >= row_end) {
+            y++;
+            x = 0;
+            continue;
+        }
+
+        /* Handle the whole run of dirty bits at once */
+        x_end = find_next_zero_bit(vd->guest.dirty[y], row_end, x);
+        bitmap_clear(vd->guest.dirty[y], x, x_end - x);
+        run_bytes = MIN(x_end * cmp_bytes, line_bytes) - x * cmp_bytes;
+        assert(run_bytes >= 0);
 
         server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
 
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
+            if (tmpbuf_y != y) {
+                qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
+                tmpbuf_y = y;
+            }
             guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
         }
         guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+        /*
+         * Devices often report more than they changed (a blinking cursor,
+         * a full redraw of the same picture), so first check the run as a
+         * whole: a long memcmp is much faster than one per block.
+         */
+        if (memcmp(server_ptr, guest_ptr, run_bytes) == 0) {
+            x = x_end;
+            continue;
+        }
+
+        for (; x < x_end;
              x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
-            }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            int _cmp_bytes = MIN(cmp_bytes, line_bytes - x * cmp_bytes);
+
+            if (!vnc_cmp_copy(server_ptr, guest_ptr, _cmp_bytes)) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
             if (!vd->non_adaptive) {
                 vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
                                  y, &tv);
@@ -2966,8 +3010,6 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
             }
             has_dirty++;
         }
-
-        y++;
     }
     qemu_pixman_image_unref(tmpbuf);
     return has_dirty;
@@ -157,6 +157,8 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    /* Worker threads encoding from the server surface, under mutex */
+    int encoders;
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -198,6 +200,9 @@ typedef struct VncTight {
 #ifdef CONFIG_VNC_JPEG
     Buffer jpeg;
 #endif
+#ifdef CONFIG_VNC_TURBOJPEG
+    void *tjhandle;             /* reused from one rectangle to the next */
+#endif
 #ifdef CONFIG_VNC_PNG
     Buffer png;
 #endif
@@ -247,6 +252,8 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    /* Taken by a worker thread, protected by the queue lock */
+    bool running;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -25,6 +25,16 @@
 /* Stop userspace polling on a handler if it isn't active for some time */
 #define POLL_IDLE_INTERVAL_NS (7 * NANOSECONDS_PER_SECOND)
 
+/*
+ * Every POLL_ADMISSION_EVENTS events on a polled handler, check that
+ * polling found at least POLL_MIN_HIT_PERCENT of them.  Handlers whose
+ * events mostly come after polling gave up only slow down the others, so
+ * they are not polled again for POLL_READMIT_INTERVAL_NS.
+ */
+#define POLL_ADMISSION_EVENTS 64
+#define POLL_MIN_HIT_PERCENT 25
+#define POLL_READMIT_INTERVAL_NS (1 * NANOSECONDS_PER_SECOND)
+
 bool aio_poll_disabled(AioContext *ctx)
 {
     return qatomic_read(&ctx->poll_disable_cnt);
@@ -86,13 +96,14 @@ static bool aio_remove_fd_handler(AioContext *ctx, AioHandler *node)
     return true;
 }
 
-void aio_set_fd_handler(AioContext *ctx,
-                        int fd,
-                        bool is_external,
-                        IOHandler *io_read,
-                        IOHandler *io_write,
-                        AioPollFn *io_poll,
-                        void *opaque)
+static void aio_set_fd_handler_common(AioContext *ctx,
+                                      int fd,
+                                      bool is_external,
+                                      bool is_event_notifier,
+                                      IOHandler *io_read,
+                                      IOHandler *io_write,
+                                      AioPollFn *io_poll,
+                                      void *opaque)
 {
     AioHandler *node;
     AioHandler *new_node = NULL;
@@ -128,6 +139,7 @@ void aio_set_fd_handler(AioContext *ctx,
         new_node->io_poll = io_poll;
         new_node->opaque = opaque;
         new_node->is_external = is_external;
+        new_node->is_event_notifier = is_event_notifier;
 
         if (is_new) {
             new_node->pfd.fd = fd;
@@ -163,6 +175,18 @@ void aio_set_fd_handler(AioContext *ctx,
     }
 }
 
+void aio_set_fd_handler(AioContext *ctx,
+                        int fd,
+                        bool is_external,
+                        IOHandler *io_read,
+                        IOHandler *io_write,
+                        AioPollFn *io_poll,
+                        void *opaque)
+{
+    aio_set_fd_handler_common(ctx, fd, is_external, false,
+                              io_read, io_write, io_poll, opaque);
+}
+
 void aio_set_fd_poll(AioContext *ctx, int fd,
                      IOHandler *io_poll_begin,
                      IOHandler *io_poll_end)
@@ -183,8 +207,9 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifierHandler *io_read,
                             AioPollFn *io_poll)
 {
-    aio_set_fd_handler(ctx, event_notifier_get_fd(notifier), is_external,
-                       (IOHandler *)io_read, NULL, io_poll, notifier);
+    aio_set_fd_handler_common(ctx, event_notifier_get_fd(notifier),
+                              is_external, true,
+                              (IOHandler *)io_read, NULL, io_poll, notifier);
 }
 
 void aio_set_event_notifier_poll(AioContext *ctx,
@@ -297,7 +322,82 @@ static void aio_free_deleted_handlers(AioContext *ctx)
     qemu_lockcnt_inc_and_unlock(&ctx->list_lock);
 }
 
-static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
+static bool fdmon_supports_polling(AioContext *ctx)
+{
+    return ctx->fdmon_ops->need_wait != aio_poll_disabled;
+}
+
+/* Stop polling @node; returns true if a final poll made progress */
+static bool poll_remove_handler(AioContext *ctx, AioHandler *node)
+{
+    node->poll_idle_timeout = 0LL;
+    node->poll_hits = 0;
+    node->poll_misses = 0;
+    QLIST_SAFE_REMOVE(node, node_poll);
+    if (ctx->poll_started && node->io_poll_end) {
+        node->io_poll_end(node->opaque);
+
+        /*
+         * Final poll in case ->io_poll_end() races with an event.
+         * Nevermind about re-adding the handler in the rare case where
+         * this causes progress.
+         */
+        return node->io_poll(node->opaque);
+    }
+    return false;
+}
+
+/* Account an event of a polled handler, evicting it if polling rarely helps */
+static void poll_account_event(AioContext *ctx, AioHandler *node, bool hit)
+{
+    unsigned events;
+
+    if (hit) {
+        node->poll_hits++;
+        stat64_inc(&ctx->poll_hits);
+    } else {
+        node->poll_misses++;
+        stat64_inc(&ctx->poll_misses);
+    }
+
+    events = node->poll_hits + node->poll_misses;
+    if (events < POLL_ADMISSION_EVENTS) {
+        return;
+    }
+
+    /* See remove_idle_poll_handlers() for fd monitors that cannot poll */
+    if (node->poll_hits * 100 < events * POLL_MIN_HIT_PERCENT &&
+        fdmon_supports_polling(ctx)) {
+        trace_poll_evict(ctx, node, node->pfd.fd, node->poll_hits, events);
+        stat64_inc(&ctx->poll_evictions);
+        node->poll_readmit_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                                  POLL_READMIT_INTERVAL_NS;
+        poll_remove_handler(ctx, node);
+        return;
+    }
+
+    node->poll_hits = 0;
+    node->poll_misses = 0;
+}
+
+static bool poll_may_admit(AioHandler *node)
+{
+    if (node->poll_readmit_time == 0) {
+        return true;
+    }
+    if (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < node->poll_readmit_time) {
+        return false;
+    }
+    node->poll_readmit_time = 0;
+    return true;
+}
+
+/*
+ * @polled: whether userspace polling ran before the fd monitor reported
+ * the events, i.e. whether polling missed them on handlers it polled
+ */
+static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node,
+                                 bool polled)
 {
     bool progress = false;
     int revents;
@@ -305,6 +405,12 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
     revents = node->pfd.revents & node->pfd.events;
     node->pfd.revents = 0;
 
+    if (polled && revents && node->opaque != &ctx->notifier &&
+        !QLIST_IS_INSERTED(node, node_deleted) &&
+        QLIST_IS_INSERTED(node, node_poll)) {
+        poll_account_event(ctx, node, false);
+    }
+
     /*
      * Start polling AioHandlers when they become ready because activity is
      * likely to continue.  Note that starvation is theoretically possible when
@@ -313,7 +419,7 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
      */
     if (!QLIST_IS_INSERTED(node, node_deleted) &&
         !QLIST_IS_INSERTED(node, node_poll) &&
-        node->io_poll) {
+        node->io_poll && poll_may_admit(node)) {
         trace_poll_add(ctx, node, node->pfd.fd, revents);
         if (ctx->poll_started && node->io_poll_begin) {
             node->io_poll_begin(node->opaque);
@@ -348,14 +454,15 @@ static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
  * scanning all handlers with aio_dispatch_handlers().
  */
 static bool aio_dispatch_ready_handlers(AioContext *ctx,
-                                        AioHandlerList *ready_list)
+                                        AioHandlerList *ready_list,
+                                        bool polled)
 {
     bool progress = false;
     AioHandler *node;
 
     while ((node = QLIST_FIRST(ready_list))) {
         QLIST_REMOVE(node, node_ready);
-        progress = aio_dispatch_handler(ctx, node) || progress;
+        progress = aio_dispatch_handler(ctx, node, polled) || progress;
     }
 
     return progress;
@@ -368,7 +475,7 @@ static bool aio_dispatch_handlers(AioContext *ctx)
     bool progress = false;
 
     QLIST_FOREACH_SAFE_RCU(node, &ctx->aio_handlers, node, tmp) {
-        progress = aio_dispatch_handler(ctx, node) || progress;
+        progress = aio_dispatch_handler(ctx, node, false) || progress;
     }
 
     return progress;
@@ -404,6 +511,7 @@ static bool run_poll_handlers_once(AioContext *ctx,
              */
             *timeout = 0;
             if (node->opaque != &ctx->notifier) {
+                poll_account_event(ctx, node, true);
                 progress = true;
             }
         }
@@ -414,11 +522,6 @@ static bool run_poll_handlers_once(AioContext *ctx,
     return progress;
 }
 
-static bool fdmon_supports_polling(AioContext *ctx)
-{
-    return ctx->fdmon_ops->need_wait != aio_poll_disabled;
-}
-
 static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
 {
     AioHandler *node;
@@ -440,18 +543,7 @@ static bool remove_idle_poll_handlers(AioContext *ctx, int64_t now)
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
         } else if (now >= node->poll_idle_timeout) {
             trace_poll_remove(ctx, node, node->pfd.fd);
-            node->poll_idle_timeout = 0LL;
-            QLIST_SAFE_REMOVE(node, node_poll);
-            if (ctx->poll_started && node->io_poll_end) {
-                node->io_poll_end(node->opaque);
-
-                /*
-                 * Final poll in case ->io_poll_end() races with an event.
-                 * Nevermind about re-adding the handler in the rare case where
-                 * this causes progress.
-                 */
-                progress = node->io_poll(node->opaque) || progress;
-            }
+            progress = poll_remove_handler(ctx, node) || progress;
         }
     }
 
@@ -515,12 +607,13 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
  * @ctx: the AioContext
  * @timeout: timeout for blocking wait, computed by the caller and updated if
  *    polling succeeds.
+ * @polled: set to true if polling ran for a while without finding events
  *
  * Note that the caller must have incremented ctx->list_lock.
  *
  * Returns: true if progress was made, false otherwise
  */
-static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
+static bool try_poll_mode(AioContext *ctx, int64_t *timeout, bool *polled)
 {
     int64_t max_ns;
 
@@ -535,6 +628,7 @@ static bool try_poll_mode(AioContext *ctx, int64_t *timeout)
         if (run_poll_handlers(ctx, max_ns, timeout)) {
             return true;
         }
+        *polled = true;
     }
 
     if (poll_set_started(ctx, false)) {
@@ -550,6 +644,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
     int ret = 0;
     bool progress;
+    bool polled = false;
     bool use_notify_me;
     int64_t timeout;
     int64_t start = 0;
@@ -568,7 +663,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
-    progress = try_poll_mode(ctx, &timeout);
+    progress = try_poll_mode(ctx, &timeout, &polled);
     assert(!(timeout && progress));
 
     /*
@@ -653,7 +748,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     progress |= aio_bh_poll(ctx);
 
     if (ret > 0) {
-        progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+        progress |= aio_dispatch_ready_handlers(ctx, &ready_list, polled);
     }
 
     aio_free_deleted_handlers(ctx);
@@ -710,3 +805,10 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 
     aio_notify(ctx);
 }
+
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    stats->hits = stat64_get(&ctx->poll_hits);
+    stats->misses = stat64_get(&ctx->poll_misses);
+    stats->evictions = stat64_get(&ctx->poll_evictions);
+}
@@ -36,7 +36,11 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_readmit_time; /* when a low hit rate handler may poll again */
+    unsigned poll_hits;        /* events found by ->io_poll() */
+    unsigned poll_misses;      /* events found by the fd monitor while polled */
     bool is_external;
+    bool is_event_notifier;    /* pfd is an eventfd, see fdmon-io_uring.c */
 };
 
 /* Add a handler to a ready list */
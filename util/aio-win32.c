@@ -434,3 +434,8 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
         error_setg(errp, "AioContext polling is not implemented on Windows");
     }
 }
+
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats)
+{
+    *stats = (AioPollStats) { };
+}
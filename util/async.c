@@ -32,6 +32,7 @@
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
+#include "qemu/error-report.h"
 #include "trace.h"
 
 /***********************************************************/
@@ -370,11 +371,37 @@ GSource *aio_get_g_source(AioContext *ctx)
 ThreadPool *aio_get_thread_pool(AioContext *ctx)
 {
     if (!ctx->thread_pool) {
-        ctx->thread_pool = thread_pool_new(ctx);
+        qatomic_set(&ctx->thread_pool, thread_pool_new(ctx));
     }
     return ctx->thread_pool;
 }
 
+ThreadPool *aio_peek_thread_pool(AioContext *ctx)
+{
+    return qatomic_read(&ctx->thread_pool);
+}
+
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp)
+{
+    ThreadPool *pool;
+
+    if (min < 0 || max <= 0 || min > max || max > INT_MAX) {
+        error_setg(errp, "invalid thread pool limits min=%" PRId64
+                   " max=%" PRId64 ", 0 <= min <= max and 0 < max <= %d "
+                   "are required", min, max, INT_MAX);
+        return;
+    }
+
+    ctx->thread_pool_min = min;
+    ctx->thread_pool_max = max;
+
+    pool = aio_peek_thread_pool(ctx);
+    if (pool) {
+        thread_pool_set_params(pool, min, max);
+    }
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp)
 {
@@ -395,13 +422,18 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, bool sqpoll,
+                                      int sq_cpu, Error **errp)
 {
     if (ctx->linux_io_uring) {
+        if (sqpoll && !luring_uses_sqpoll(ctx->linux_io_uring)) {
+            warn_report_once("io_uring instance for this AioContext was "
+                             "created without SQPOLL, ignoring aio-sqpoll");
+        }
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(sqpoll, sq_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -529,6 +561,8 @@ AioContext *aio_context_new(Error **errp)
 #endif
 
     ctx->thread_pool = NULL;
+    ctx->thread_pool_min = THREAD_POOL_MIN_THREADS_DEFAULT;
+    ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
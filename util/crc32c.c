@@ -26,6 +26,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/crc32c.h"
 
 /*
@@ -104,12 +105,158 @@ static const uint32_t crc32c_table[256] = {
     0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L
 };
 
+/*
+ * crc32c_slice[k][i] is the CRC of byte i followed by k zero bytes, so
+ * that eight bytes can be folded in with eight independent lookups.
+ * crc32c_slice[0] is crc32c_table.
+ */
+static uint32_t crc32c_slice[8][256];
 
-uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+static uint32_t crc32c_bytes(uint32_t crc, const uint8_t *data,
+                             unsigned int length)
 {
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
-    return crc^0xffffffff;
+    return crc;
+}
+
+static uint32_t crc32c_slice8(uint32_t crc, const uint8_t *data,
+                              unsigned int length)
+{
+    for (; length >= 8; length -= 8, data += 8) {
+        uint32_t lo = crc ^ ldl_le_p(data);
+        uint32_t hi = ldl_le_p(data + 4);
+
+        crc = crc32c_slice[7][lo & 0xff] ^
+              crc32c_slice[6][(lo >> 8) & 0xff] ^
+              crc32c_slice[5][(lo >> 16) & 0xff] ^
+              crc32c_slice[4][lo >> 24] ^
+              crc32c_slice[3][hi & 0xff] ^
+              crc32c_slice[2][(hi >> 8) & 0xff] ^
+              crc32c_slice[1][(hi >> 16) & 0xff] ^
+              crc32c_slice[0][hi >> 24];
+    }
+    return crc32c_bytes(crc, data, length);
+}
+
+#ifdef CONFIG_CRC32C_OPT
+#if defined(__x86_64__) || defined(__i386__)
+#include "qemu/cpuid.h"
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#include <nmmintrin.h>
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data,
+                             unsigned int length)
+{
+    for (; length && ((uintptr_t)data & 7); length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+#ifdef __x86_64__
+    {
+        uint64_t crc64 = crc;
+
+        for (; length >= 8; length -= 8, data += 8) {
+            crc64 = _mm_crc32_u64(crc64, *(const uint64_t *)data);
+        }
+        crc = crc64;
+    }
+#endif
+    for (; length >= 4; length -= 4, data += 4) {
+        crc = _mm_crc32_u32(crc, *(const uint32_t *)data);
+    }
+    for (; length; length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#pragma GCC pop_options
+
+static bool crc32c_have_accel(void)
+{
+    int a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) < 1) {
+        return false;
+    }
+    __cpuid(1, a, b, c, d);
+    return c & bit_SSE4_2;
+}
+
+#define crc32c_accel_fn crc32c_sse42
+
+#elif defined(__aarch64__)
+#ifdef CONFIG_LINUX
+#include "elf.h"
+
+/* From the kernel's arch/arm64/include/uapi/asm/hwcap.h */
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+#pragma GCC push_options
+#pragma GCC target("+crc")
+#include <arm_acle.h>
+
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *data,
+                             unsigned int length)
+{
+    for (; length && ((uintptr_t)data & 7); length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    for (; length >= 8; length -= 8, data += 8) {
+        crc = __crc32cd(crc, ldq_le_p(data));
+    }
+    for (; length; length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#pragma GCC pop_options
+
+static bool crc32c_have_accel(void)
+{
+#if defined(__ARM_FEATURE_CRC32)
+    return true;
+#elif defined(CONFIG_LINUX)
+    return qemu_getauxval(AT_HWCAP) & HWCAP_CRC32;
+#else
+    return false;
+#endif
+}
+
+#define crc32c_accel_fn crc32c_armv8
+
+#endif
+#endif /* CONFIG_CRC32C_OPT */
+
+static uint32_t (*crc32c_accel)(uint32_t, const uint8_t *, unsigned int) =
+    crc32c_bytes;
+
+static void __attribute__((constructor)) init_crc32c_accel(void)
+{
+    int i, k;
+
+    memcpy(crc32c_slice[0], crc32c_table, sizeof(crc32c_table));
+    for (k = 1; k < 8; k++) {
+        for (i = 0; i < 256; i++) {
+            uint32_t crc = crc32c_slice[k - 1][i];
+
+            crc32c_slice[k][i] = crc32c_table[crc & 0xff] ^ (crc >> 8);
+        }
+    }
+    crc32c_accel = crc32c_slice8;
+
+#ifdef crc32c_accel_fn
+    if (crc32c_have_accel()) {
+        crc32c_accel = crc32c_accel_fn;
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
+{
+    return crc32c_accel(crc, data, length) ^ 0xffffffff;
 }
 
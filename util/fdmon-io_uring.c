@@ -25,7 +25,13 @@
  *
  * File descriptor monitoring is implemented using the following operations:
  *
- * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.  It is
+ *    one-shot and re-armed after each event, except for EventNotifiers where
+ *    the kernel supports IORING_POLL_ADD_MULTI: then it stays armed and posts
+ *    a cqe with IORING_CQE_F_MORE for each event.  Multishot poll only
+ *    reports new wakeups, which is fine for eventfds because every write
+ *    wakes them up, but many fd handlers rely on being called again while
+ *    their fd stays readable.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -172,6 +178,11 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     int events = poll_events_from_pfd(node->pfd.events);
 
     io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#ifdef IORING_POLL_ADD_MULTI
+    if (ctx->fdmon_io_uring_multishot && node->is_event_notifier) {
+        sqe->len |= IORING_POLL_ADD_MULTI;
+    }
+#endif
     io_uring_sqe_set_data(sqe, node);
 }
 
@@ -228,6 +239,18 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+#ifdef IORING_CQE_F_MORE
+    /* A multishot IORING_OP_POLL_ADD that is still armed */
+    if (cqe->flags & IORING_CQE_F_MORE) {
+        /* Being deleted; wait for the final cqe before freeing it */
+        if (qatomic_read(&node->flags) & FDMON_IO_URING_REMOVE) {
+            return false;
+        }
+        aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
+        return true;
+    }
+#endif
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -239,9 +262,22 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /*
+     * Kernels without IORING_POLL_ADD_MULTI reject it, and a multishot
+     * IORING_OP_POLL_ADD may also be terminated, e.g. when the cq ring
+     * overflows.  Either way, re-arm it.
+     */
+    if (cqe->res < 0) {
+        if (cqe->res == -EINVAL && ctx->fdmon_io_uring_multishot) {
+            ctx->fdmon_io_uring_multishot = false;
+        }
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    /* IORING_OP_POLL_ADD was one-shot or has been terminated, re-arm it */
     add_poll_add_sqe(ctx, node);
     return true;
 }
@@ -331,6 +367,9 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+#ifdef IORING_POLL_ADD_MULTI
+    ctx->fdmon_io_uring_multishot = true;
+#endif
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -11,7 +11,10 @@
 
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
+#include "qemu/bitmap.h"
 #include "qemu/host-utils.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "trace.h"
 #include "crypto/hash.h"
 
@@ -101,6 +104,285 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/*
+ * Word-array kernels.  Scanning, counting and merging the last level is
+ * what dominates on large bitmaps (a 16 TiB disk at 64 KiB granularity has
+ * 4 million words in it), so these get vectorized variants chosen at
+ * runtime, like buffer_is_zero() does.
+ */
+
+/* Return the index of the first word in [pos, end) that is not @pattern */
+static size_t hb_find_word_not_int(const unsigned long *words, size_t pos,
+                                   size_t end, unsigned long pattern)
+{
+    while (pos < end && words[pos] == pattern) {
+        pos++;
+    }
+    return pos;
+}
+
+/* Return the number of set bits in words[0..n) */
+static uint64_t hb_count_words_int(const unsigned long *words, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(words[i]);
+    }
+    return count;
+}
+
+/* dst[] = a[] | b[], return the number of set bits in dst */
+static uint64_t hb_or_words_int(unsigned long *dst, const unsigned long *a,
+                                const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned long v = a[i] | b[i];
+
+        /* Don't dirty pages that stay the same, see hb_alloc_words() */
+        if (dst[i] != v) {
+            dst[i] = v;
+        }
+        count += ctpopl(v);
+    }
+    return count;
+}
+
+#if defined(CONFIG_AVX2_OPT) && HOST_LONG_BITS == 64
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/*
+ * Population count of each 64-bit lane, using a nibble lookup table
+ * (there is no AVX2 instruction for it).
+ */
+static inline __m256i hb_popcnt_avx2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                                  _mm256_shuffle_epi8(lut, hi));
+
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+static inline uint64_t hb_sum_avx2(__m256i acc)
+{
+    return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+           _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+}
+
+static size_t hb_find_word_not_avx2(const unsigned long *words, size_t pos,
+                                    size_t end, unsigned long pattern)
+{
+    __m256i pat = _mm256_set1_epi64x(pattern);
+
+    /* Compare blocks of 8 words, and let the scalar loop find the word */
+    while (pos + 8 <= end) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)&words[pos]);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)&words[pos + 4]);
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi64(v0, pat),
+                                      _mm256_cmpeq_epi64(v1, pat));
+
+        if (_mm256_movemask_epi8(eq) != -1) {
+            break;
+        }
+        pos += 8;
+    }
+    return hb_find_word_not_int(words, pos, end, pattern);
+}
+
+static uint64_t hb_count_words_avx2(const unsigned long *words, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&words[i]);
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_count_words_int(words + i, n - i);
+}
+
+static uint64_t hb_or_words_avx2(unsigned long *dst, const unsigned long *a,
+                                 const unsigned long *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_or_si256(
+            _mm256_loadu_si256((const __m256i *)&a[i]),
+            _mm256_loadu_si256((const __m256i *)&b[i]));
+        __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(v, d)) != -1) {
+            _mm256_storeu_si256((__m256i *)&dst[i], v);
+        }
+        acc = _mm256_add_epi64(acc, hb_popcnt_avx2(v));
+    }
+    return hb_sum_avx2(acc) + hb_or_words_int(dst + i, a + i, b + i, n - i);
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+
+#define HB_ACCEL_AVX2 1
+
+static unsigned hb_accel_cache;
+#endif /* CONFIG_AVX2_OPT && HOST_LONG_BITS == 64 */
+
+static size_t (*hb_find_word_not)(const unsigned long *, size_t, size_t,
+                                  unsigned long) = hb_find_word_not_int;
+static uint64_t (*hb_count_words)(const unsigned long *, size_t) =
+    hb_count_words_int;
+static uint64_t (*hb_or_words)(unsigned long *, const unsigned long *,
+                               const unsigned long *, size_t) =
+    hb_or_words_int;
+
+#ifdef HB_ACCEL_AVX2
+static void hb_init_accel(unsigned cache)
+{
+    if (cache & HB_ACCEL_AVX2) {
+        hb_find_word_not = hb_find_word_not_avx2;
+        hb_count_words = hb_count_words_avx2;
+        hb_or_words = hb_or_words_avx2;
+    } else {
+        hb_find_word_not = hb_find_word_not_int;
+        hb_count_words = hb_count_words_int;
+        hb_or_words = hb_or_words_int;
+    }
+}
+
+static void __attribute__((constructor)) hb_init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= HB_ACCEL_AVX2;
+            }
+        }
+    }
+    hb_accel_cache = cache;
+    hb_init_accel(cache);
+}
+
+bool test_hbitmap_next_accel(void)
+{
+    /* Disable the accelerator we used before and select a new one.  */
+    if (hb_accel_cache == 0) {
+        return false;
+    }
+    hb_accel_cache &= hb_accel_cache - 1;
+    hb_init_accel(hb_accel_cache);
+    return true;
+}
+#else
+bool test_hbitmap_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Large levels (in practice the last one, and the one above it for huge
+ * disks) are allocated as anonymous memory, and the code below takes care
+ * not to store zeroes over zeroes.  Pages without any set bit then stay
+ * unbacked and read from the shared zero page, so a mostly clean bitmap
+ * only costs memory for the areas that actually are dirty, instead of
+ * one bit per granularity chunk of the whole disk.
+ */
+#define HBITMAP_MAPPED_MIN_SIZE (64 * KiB)
+
+static bool hb_words_mapped(uint64_t n)
+{
+    return n * sizeof(unsigned long) >= HBITMAP_MAPPED_MIN_SIZE;
+}
+
+static unsigned long *hb_alloc_words(uint64_t n)
+{
+    size_t size = n * sizeof(unsigned long);
+    unsigned long *words;
+
+    if (!hb_words_mapped(n)) {
+        return g_new0(unsigned long, n);
+    }
+
+    words = qemu_anon_ram_alloc(size, NULL, false);
+    if (!words) {
+        g_error("hbitmap: failed to allocate %zu bytes", size);
+    }
+    /* Huge pages would back 2 MiB at the first set bit */
+    qemu_madvise(words, size, QEMU_MADV_NOHUGEPAGE);
+    return words;
+}
+
+static void hb_free_words(unsigned long *words, uint64_t n)
+{
+    if (hb_words_mapped(n)) {
+        qemu_anon_ram_free(words, n * sizeof(unsigned long));
+    } else {
+        g_free(words);
+    }
+}
+
+/* Resize to @new_n words; words past @old_n read as zero afterwards */
+static unsigned long *hb_realloc_words(unsigned long *words, uint64_t old_n,
+                                       uint64_t new_n)
+{
+    unsigned long *new_words;
+    size_t page = qemu_real_host_page_size / sizeof(unsigned long);
+    uint64_t i, n = MIN(old_n, new_n);
+
+    if (!hb_words_mapped(old_n) && !hb_words_mapped(new_n)) {
+        words = g_renew(unsigned long, words, new_n);
+        if (new_n > old_n) {
+            memset(&words[old_n], 0, (new_n - old_n) * sizeof(*words));
+        }
+        return words;
+    }
+
+    new_words = hb_alloc_words(new_n);
+    for (i = 0; i < n; i += page) {
+        size_t len = MIN(page, n - i) * sizeof(unsigned long);
+
+        if (!buffer_is_zero(&words[i], len)) {
+            memcpy(&new_words[i], &words[i], len);
+        }
+    }
+    hb_free_words(words, old_n);
+    return new_words;
+}
+
+/* Clear words[0..n) without writing to the parts that are already zero */
+static void hb_clear_words(unsigned long *words, uint64_t n)
+{
+    uint64_t i = 0;
+
+    while ((i = hb_find_word_not(words, i, n, 0)) < n) {
+        words[i++] = 0;
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +527,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_word_not(last_lev, pos + 1, sz, (unsigned long)-1);
         if (pos >= sz) {
             return -1;
         }
@@ -316,63 +595,30 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
- */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
-{
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
-
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
-    }
-
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
-}
-
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+/* Count the number of set bits between start and last, not accounting for
+ * the granularity.  This is a linear scan of the last level rather than an
+ * iteration over the set words: that is cheap enough with hb_count_words,
+ * and doesn't degrade on dense bitmaps.
  */
 static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 {
-    HBitmapIter hbi;
-    uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t last_pos = last >> BITS_PER_LEVEL;
+    unsigned long first_mask = BITMAP_FIRST_WORD_MASK(start);
+    unsigned long last_mask = BITMAP_LAST_WORD_MASK(last + 1);
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
-        }
-        count += ctpopl(cur);
+    if (hb->size == 0) {
+        /* last is -1 when called for the whole of an empty bitmap */
+        return 0;
     }
-
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
+    if (pos == last_pos) {
+        return ctpopl(words[pos] & first_mask & last_mask);
     }
 
-    return count;
+    return ctpopl(words[pos] & first_mask) +
+           hb_count_words(words + pos + 1, last_pos - pos - 1) +
+           ctpopl(words[last_pos] & last_mask);
 }
 
 /* Setting starts at the last layer and propagates up if an element
@@ -467,7 +713,9 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
-    *elem &= ~mask;
+    if (*elem & mask) {
+        *elem &= ~mask;
+    }
     return blanked;
 }
 
@@ -502,8 +750,10 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            if (hb->levels[level][i]) {
+                changed = true;
+                hb->levels[level][i] = 0UL;
+            }
         }
     }
 
@@ -554,9 +804,15 @@ void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
 
-    /* Same as hbitmap_alloc() except for memset() instead of malloc() */
+    /* Same as hbitmap_alloc() except for clearing instead of allocating */
     for (i = HBITMAP_LEVELS; --i >= 1; ) {
-        memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        if (hb_words_mapped(hb->sizes[i])) {
+            /* Give the memory back rather than keeping zeroed pages */
+            hb_free_words(hb->levels[i], hb->sizes[i]);
+            hb->levels[i] = hb_alloc_words(hb->sizes[i]);
+        } else {
+            memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        }
     }
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
@@ -673,12 +929,14 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el;
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
+        memcpy(&el, buf, sizeof(el));
+        el = (BITS_PER_LONG == 32 ? le32_to_cpu(el) : le64_to_cpu(el));
+
+        /* Leave zero pages alone, see hb_alloc_words() */
+        if (*cur != el) {
+            *cur = el;
         }
 
         buf += sizeof(unsigned long);
@@ -700,7 +958,7 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_clear_words(first, el_count);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -753,7 +1011,7 @@ void hbitmap_free(HBitmap *hb)
     unsigned i;
     assert(!hb->meta);
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
-        g_free(hb->levels[i]);
+        hb_free_words(hb->levels[i], hb->sizes[i]);
     }
     g_free(hb);
 }
@@ -775,7 +1033,7 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        hb->levels[i] = hb_alloc_words(size);
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -829,11 +1087,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
-        hb->levels[i] = g_realloc(hb->levels[i], size * sizeof(unsigned long));
-        if (!shrink) {
-            memset(&hb->levels[i][old], 0x00,
-                   (size - old) * sizeof(*hb->levels[i]));
-        }
+        hb->levels[i] = hb_realloc_words(hb->levels[i], old, size);
     }
     if (hb->meta) {
         hbitmap_truncate(hb->meta, hb->size << hb->granularity);
@@ -910,14 +1164,19 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
 
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    /*
+     * Merge the last level and recompute the dirty count in the same pass.
+     * Bits beyond the end are always clear, so they don't add to it.
+     */
+    i = HBITMAP_LEVELS - 1;
+    result->count = hb_or_words(result->levels[i], a->levels[i],
+                                b->levels[i], a->sizes[i]);
 
     return true;
 }
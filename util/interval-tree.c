@@ -0,0 +1,368 @@
+/*
+ * Interval tree of closed [start, last] ranges.
+ *
+ * This is a red-black tree keyed by the start of the ranges, where each
+ * node also records the largest end found in its subtree, so that a
+ * search can skip subtrees that end before the range it looks for.
+ *
+ * Child pointers are written with atomic stores, in an order that never
+ * lets a descending reader walk into a cycle, so that
+ * interval_tree_iter_first() can run while the tree is being updated.  Such a reader may be sent down the wrong subtree by
+ * a concurrent rotation and miss a node, but everything it compares
+ * against is the node's own range, which never changes while the node is
+ * in the tree, so a node it returns does intersect the range.
+ * subtree_last is read without atomics: a stale or torn value can only
+ * make the reader skip a subtree, i.e. produce another false negative.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/interval-tree.h"
+
+static uint64_t compute_subtree_last(const IntervalTreeNode *node)
+{
+    uint64_t max = node->last;
+
+    if (node->left && node->left->subtree_last > max) {
+        max = node->left->subtree_last;
+    }
+    if (node->right && node->right->subtree_last > max) {
+        max = node->right->subtree_last;
+    }
+    return max;
+}
+
+static inline bool is_red(const IntervalTreeNode *node)
+{
+    return node && node->red;
+}
+
+static void replace_child(IntervalTreeRoot *root, IntervalTreeNode *parent,
+                          IntervalTreeNode *old, IntervalTreeNode *new)
+{
+    if (parent == NULL) {
+        qatomic_set(&root->root, new);
+    } else if (parent->left == old) {
+        qatomic_set(&parent->left, new);
+    } else {
+        qatomic_set(&parent->right, new);
+    }
+}
+
+/*
+ *     x              y
+ *    / \            / \
+ *   a   y    ->    x   c
+ *      / \        / \
+ *     b   c      a   b
+ */
+static void rotate_left(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->right;
+    IntervalTreeNode *b = y->left;
+
+    qatomic_set(&x->right, b);
+    if (b) {
+        b->parent = x;
+    }
+    y->parent = x->parent;
+    qatomic_set(&y->left, x);
+    replace_child(root, y->parent, x, y);
+    x->parent = y;
+
+    y->subtree_last = x->subtree_last;
+    x->subtree_last = compute_subtree_last(x);
+}
+
+/* mirror image of rotate_left() */
+static void rotate_right(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->left;
+    IntervalTreeNode *b = y->right;
+
+    qatomic_set(&x->left, b);
+    if (b) {
+        b->parent = x;
+    }
+    y->parent = x->parent;
+    qatomic_set(&y->right, x);
+    replace_child(root, y->parent, x, y);
+    x->parent = y;
+
+    y->subtree_last = x->subtree_last;
+    x->subtree_last = compute_subtree_last(x);
+}
+
+static void insert_fixup(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    IntervalTreeNode *parent, *gparent, *uncle;
+
+    while ((parent = node->parent) && parent->red) {
+        /* a red node is never the root, so there is a grandparent */
+        gparent = parent->parent;
+        if (parent == gparent->left) {
+            uncle = gparent->right;
+            if (is_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_right(root, gparent);
+        } else {
+            uncle = gparent->left;
+            if (is_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            rotate_left(root, gparent);
+        }
+    }
+    root->root->red = false;
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *parent = NULL;
+    IntervalTreeNode *cur = root->root;
+    bool left = false;
+
+    while (cur) {
+        if (cur->subtree_last < node->last) {
+            cur->subtree_last = node->last;
+        }
+        parent = cur;
+        left = node->start < cur->start;
+        cur = left ? cur->left : cur->right;
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->red = true;
+    node->subtree_last = node->last;
+
+    /* publish the node only once it is fully initialized */
+    if (parent == NULL) {
+        qatomic_rcu_set(&root->root, node);
+    } else if (left) {
+        qatomic_rcu_set(&parent->left, node);
+    } else {
+        qatomic_rcu_set(&parent->right, node);
+    }
+    insert_fixup(root, node);
+}
+
+static void transplant(IntervalTreeRoot *root, IntervalTreeNode *old,
+                       IntervalTreeNode *new)
+{
+    replace_child(root, old->parent, old, new);
+    if (new) {
+        new->parent = old->parent;
+    }
+}
+
+/*
+ * @node has one black node fewer on its paths than its sibling; @node
+ * may be NULL, hence @parent.
+ */
+static void remove_fixup(IntervalTreeRoot *root, IntervalTreeNode *node,
+                         IntervalTreeNode *parent)
+{
+    IntervalTreeNode *sibling;
+
+    while (node != root->root && !is_red(node)) {
+        if (node == parent->left) {
+            sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rotate_left(root, parent);
+        } else {
+            sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rotate_right(root, parent);
+        }
+        node = root->root;
+    }
+    if (node) {
+        node->red = false;
+    }
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *child, *parent, *succ;
+    bool removed_red;
+
+    if (node->left == NULL || node->right == NULL) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        transplant(root, node, child);
+    } else {
+        /* replace @node with its successor, which has no left child */
+        succ = node->right;
+        while (succ->left) {
+            succ = succ->left;
+        }
+        removed_red = succ->red;
+        child = succ->right;
+        if (succ->parent == node) {
+            parent = succ;
+        } else {
+            parent = succ->parent;
+            transplant(root, succ, child);
+            qatomic_set(&succ->right, node->right);
+            succ->right->parent = succ;
+        }
+        /* link both children before making @succ reachable again */
+        qatomic_set(&succ->left, node->left);
+        succ->left->parent = succ;
+        succ->red = node->red;
+        transplant(root, node, succ);
+    }
+
+    /* everything that changed is on the path from @parent to the root */
+    for (node = parent; node; node = node->parent) {
+        node->subtree_last = compute_subtree_last(node);
+    }
+
+    if (!removed_red) {
+        remove_fixup(root, child, parent);
+    }
+}
+
+/*
+ * Find the leftmost node of the subtree rooted at @node that intersects
+ * [@start, @last].  @node's subtree must have a node ending at or after
+ * @start.
+ */
+static IntervalTreeNode *subtree_search(IntervalTreeNode *node,
+                                        uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *tmp;
+
+    while (true) {
+        /*
+         * If something on the left ends at or after @start, the leftmost
+         * such node is the only candidate: all nodes after it start after
+         * it too, so if it starts after @last so do they.
+         */
+        tmp = qatomic_read(&node->left);
+        if (tmp && start <= tmp->subtree_last) {
+            node = tmp;
+            continue;
+        }
+        if (node->start <= last) {
+            if (start <= node->last) {
+                return node;
+            }
+            tmp = qatomic_read(&node->right);
+            if (tmp && start <= tmp->subtree_last) {
+                node = tmp;
+                continue;
+            }
+        }
+        return NULL;
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *node = qatomic_rcu_read(&root->root);
+
+    if (node == NULL || node->subtree_last < start) {
+        return NULL;
+    }
+    return subtree_search(node, start, last);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *next = node->right;
+    IntervalTreeNode *prev;
+
+    while (true) {
+        if (next && start <= next->subtree_last) {
+            return subtree_search(next, start, last);
+        }
+
+        /* go up until we come from a left child */
+        do {
+            prev = node;
+            node = node->parent;
+            if (node == NULL) {
+                return NULL;
+            }
+            next = node->right;
+        } while (prev == next);
+
+        if (last < node->start) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+    }
+}
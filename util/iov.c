@@ -267,11 +267,22 @@ unsigned iov_copy(struct iovec *dst_iov, unsigned int dst_iov_cnt,
 
 /* io vectors */
 
+/* Point @qiov to storage for @niov entries, without allocating if possible */
+static void qemu_iovec_alloc(QEMUIOVector *qiov, int niov)
+{
+    if (niov <= QEMU_IOVEC_INLINE) {
+        qiov->iov = qiov->inline_iov;
+        qiov->nalloc = QEMU_IOVEC_INLINE;
+    } else {
+        qiov->iov = g_new(struct iovec, niov);
+        qiov->nalloc = niov;
+    }
+}
+
 void qemu_iovec_init(QEMUIOVector *qiov, int alloc_hint)
 {
-    qiov->iov = g_new(struct iovec, alloc_hint);
+    qemu_iovec_alloc(qiov, alloc_hint);
     qiov->niov = 0;
-    qiov->nalloc = alloc_hint;
     qiov->size = 0;
 }
 
@@ -293,7 +304,13 @@ void qemu_iovec_add(QEMUIOVector *qiov, void *base, size_t len)
 
     if (qiov->niov == qiov->nalloc) {
         qiov->nalloc = 2 * qiov->nalloc + 1;
-        qiov->iov = g_renew(struct iovec, qiov->iov, qiov->nalloc);
+        if (qiov->iov == qiov->inline_iov) {
+            qiov->iov = g_new(struct iovec, qiov->nalloc);
+            memcpy(qiov->iov, qiov->inline_iov,
+                   qiov->niov * sizeof(struct iovec));
+        } else {
+            qiov->iov = g_renew(struct iovec, qiov->iov, qiov->nalloc);
+        }
     }
     qiov->iov[qiov->niov].iov_base = base;
     qiov->iov[qiov->niov].iov_len = len;
@@ -435,9 +452,11 @@ void qemu_iovec_init_extended(
         qemu_iovec_init_buf(qiov, NULL, 0);
         p = &qiov->local_iov;
     } else {
-        qiov->niov = qiov->nalloc = total_niov;
+        /* Padding adds at most two entries, so this rarely allocates */
+        qemu_iovec_alloc(qiov, total_niov);
+        qiov->niov = total_niov;
         qiov->size = head_len + mid_len + tail_len;
-        p = qiov->iov = g_new(struct iovec, qiov->niov);
+        p = qiov->iov;
     }
 
     if (head_len) {
@@ -497,7 +516,7 @@ void qemu_iovec_init_slice(QEMUIOVector *qiov, QEMUIOVector *source,
 
 void qemu_iovec_destroy(QEMUIOVector *qiov)
 {
-    if (qiov->nalloc != -1) {
+    if (qiov->nalloc != -1 && qiov->iov != qiov->inline_iov) {
         g_free(qiov->iov);
     }
 
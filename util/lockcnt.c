@@ -108,7 +108,7 @@ static void lockcnt_wake(QemuLockCnt *lockcnt)
     qemu_futex_wake(&lockcnt->count, 1);
 }
 
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt)
+void qemu_lockcnt_inc_impl(QemuLockCnt *lockcnt, const char *file, int line)
 {
     int val = qatomic_read(&lockcnt->count);
     bool waited = false;
@@ -233,7 +233,7 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
     return false;
 }
 
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt)
+void qemu_lockcnt_lock_impl(QemuLockCnt *lockcnt, const char *file, int line)
 {
     int val = qatomic_read(&lockcnt->count);
     int step = QEMU_LOCKCNT_STATE_LOCKED;
@@ -305,13 +305,13 @@ void qemu_lockcnt_destroy(QemuLockCnt *lockcnt)
     qemu_mutex_destroy(&lockcnt->mutex);
 }
 
-void qemu_lockcnt_inc(QemuLockCnt *lockcnt)
+void qemu_lockcnt_inc_impl(QemuLockCnt *lockcnt, const char *file, int line)
 {
     int old;
     for (;;) {
         old = qatomic_read(&lockcnt->count);
         if (old == 0) {
-            qemu_lockcnt_lock(lockcnt);
+            qemu_lockcnt_lock_impl(lockcnt, __FILE__, __LINE__);
             qemu_lockcnt_inc_and_unlock(lockcnt);
             return;
         } else {
@@ -344,7 +344,7 @@ bool qemu_lockcnt_dec_and_lock(QemuLockCnt *lockcnt)
         return false;
     }
 
-    qemu_lockcnt_lock(lockcnt);
+    qemu_lockcnt_lock_impl(lockcnt, __FILE__, __LINE__);
     if (qatomic_fetch_dec(&lockcnt->count) == 1) {
         return true;
     }
@@ -367,7 +367,7 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
         return false;
     }
 
-    qemu_lockcnt_lock(lockcnt);
+    qemu_lockcnt_lock_impl(lockcnt, __FILE__, __LINE__);
     if (qatomic_fetch_dec(&lockcnt->count) == 1) {
         return true;
     }
@@ -376,9 +376,9 @@ bool qemu_lockcnt_dec_if_lock(QemuLockCnt *lockcnt)
     return false;
 }
 
-void qemu_lockcnt_lock(QemuLockCnt *lockcnt)
+void qemu_lockcnt_lock_impl(QemuLockCnt *lockcnt, const char *file, int line)
 {
-    qemu_mutex_lock(&lockcnt->mutex);
+    qemu_mutex_lock_impl(&lockcnt->mutex, file, line);
 }
 
 void qemu_lockcnt_inc_and_unlock(QemuLockCnt *lockcnt)
@@ -334,6 +334,9 @@ const QEMULogItem qemu_log_items[] = {
 #endif
     { LOG_STRACE, "strace",
       "log every user-mode syscall, its input, and its result" },
+    { LOG_JIT_STATS, "jit",
+      "print translation and execution statistics (as \"info jit\")\n"
+      "when QEMU exits" },
     { 0, NULL, NULL },
 };
 
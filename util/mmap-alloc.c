@@ -86,7 +86,8 @@ void *qemu_ram_mmap(int fd,
                     size_t size,
                     size_t align,
                     bool shared,
-                    bool is_pmem)
+                    bool is_pmem,
+                    bool *map_sync)
 {
     int flags;
     int map_sync_flags = 0;
@@ -143,13 +144,18 @@ void *qemu_ram_mmap(int fd,
     if (shared && is_pmem) {
         map_sync_flags = MAP_SYNC | MAP_SHARED_VALIDATE;
     }
+    if (map_sync) {
+        *map_sync = false;
+    }
 
     offset = QEMU_ALIGN_UP((uintptr_t)guardptr, align) - (uintptr_t)guardptr;
 
     ptr = mmap(guardptr + offset, size, PROT_READ | PROT_WRITE,
                flags | map_sync_flags, fd, 0);
 
-    if (ptr == MAP_FAILED && map_sync_flags) {
+    if (ptr != MAP_FAILED && map_sync && (map_sync_flags & MAP_SYNC)) {
+        *map_sync = true;
+    } else if (ptr == MAP_FAILED && map_sync_flags) {
         if (errno == ENOTSUP) {
             char *proc_link, *file_name;
             int len;
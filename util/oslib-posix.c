@@ -39,9 +39,11 @@
 #include "qemu/thread.h"
 #include <libgen.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -72,22 +74,54 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+#if defined(CONFIG_LINUX) && !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+typedef struct MemsetThread MemsetThread;
+
+/* One os_mem_prealloc() call */
+typedef struct MemsetContext {
+    bool all_threads_created;
+    bool any_thread_failed;
+    bool populate_write;
+    MemsetThread *threads;
+    int num_threads;
+#ifdef CONFIG_LINUX
+    bool pin;
+    cpu_set_t cpus;
+#endif
+    QLIST_ENTRY(MemsetContext) next;
+    QLIST_ENTRY(MemsetContext) next_async;
+} MemsetContext;
+
 struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+    MemsetContext *context;
 };
-typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+/* Contexts whose threads are running, for the SIGBUS handler */
+static QLIST_HEAD(, MemsetContext) memset_contexts =
+    QLIST_HEAD_INITIALIZER(memset_contexts);
+/* Asynchronous contexts, joined by os_mem_prealloc_finish() */
+static QLIST_HEAD(, MemsetContext) memset_async_contexts =
+    QLIST_HEAD_INITIALIZER(memset_async_contexts);
+static bool memset_async_done;
+
+static struct sigaction sigbus_oldact;
+static bool sigbus_installed;
 
 static QemuMutex page_mutex;
 static QemuCond page_cond;
-static bool threads_created_flag;
+/*
+ * Protects the lists and the SIGBUS handler above, for callers that run
+ * outside the main loop
+ */
+static QemuMutex memset_lock;
 
 int qemu_get_thread_id(void)
 {
@@ -227,7 +261,7 @@ void *qemu_memalign(size_t alignment, size_t size)
 void *qemu_anon_ram_alloc(size_t size, uint64_t *alignment, bool shared)
 {
     size_t align = QEMU_VMALLOC_ALIGN;
-    void *ptr = qemu_ram_mmap(-1, size, align, shared, false);
+    void *ptr = qemu_ram_mmap(-1, size, align, shared, false, NULL);
 
     if (ptr == MAP_FAILED) {
         return NULL;
@@ -443,19 +477,40 @@ const char *qemu_get_exec_dir(void)
 
 static void sigbus_handler(int signal)
 {
+    MemsetContext *context;
     int i;
-    if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
+
+    QLIST_FOREACH(context, &memset_contexts, next) {
+        for (i = 0; i < context->num_threads; i++) {
+            if (qemu_thread_is_self(&context->threads[i].pgthread)) {
+                siglongjmp(context->threads[i].env, 1);
             }
         }
     }
 }
 
+static void touch_pages(char *addr, size_t numpages, size_t hpagesize)
+{
+    size_t i;
+
+    for (i = 0; i < numpages; i++) {
+        /*
+         * Read & write back the same value, so we don't
+         * corrupt existing user/app data that might be
+         * stored.
+         *
+         * 'volatile' to stop compiler optimizing this away
+         * to a no-op
+         */
+        *(volatile char *)addr = *addr;
+        addr += hpagesize;
+    }
+}
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
+    MemsetContext *context = memset_args->context;
     sigset_t set, oldset;
 
     /*
@@ -464,39 +519,44 @@ static void *do_touch_pages(void *arg)
      * clearing until all threads have been created.
      */
     qemu_mutex_lock(&page_mutex);
-    while(!threads_created_flag){
+    while (!context->all_threads_created) {
         qemu_cond_wait(&page_cond, &page_mutex);
     }
     qemu_mutex_unlock(&page_mutex);
 
+#ifdef CONFIG_LINUX
+    /*
+     * Let the pages be zeroed by CPUs close to the memory they end up
+     * on; a failure only costs speed.
+     */
+    if (context->pin) {
+        sched_setaffinity(0, sizeof(context->cpus), &context->cpus);
+    }
+
+    /*
+     * MADV_POPULATE_WRITE faults the pages in without writing to them,
+     * and reports failures as an error instead of SIGBUS.
+     */
+    if (context->populate_write) {
+        if (madvise(memset_args->addr,
+                    memset_args->numpages * memset_args->hpagesize,
+                    MADV_POPULATE_WRITE)) {
+            context->any_thread_failed = true;
+        }
+        return NULL;
+    }
+#endif
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        context->any_thread_failed = true;
     } else {
-        char *addr = memset_args->addr;
-        size_t numpages = memset_args->numpages;
-        size_t hpagesize = memset_args->hpagesize;
-        size_t i;
-        for (i = 0; i < numpages; i++) {
-            /*
-             * Read & write back the same value, so we don't
-             * corrupt existing user/app data that might be
-             * stored.
-             *
-             * 'volatile' to stop compiler optimizing this away
-             * to a no-op
-             *
-             * TODO: get a better solution from kernel so we
-             * don't need to write at all so we don't cause
-             * wear on the storage backing the region...
-             */
-            *(volatile char *)addr = *addr;
-            addr += hpagesize;
-        }
+        touch_pages(memset_args->addr, memset_args->numpages,
+                    memset_args->hpagesize);
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
     return NULL;
@@ -514,81 +574,242 @@ static inline int get_memset_num_threads(int smp_cpus)
     return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+#ifdef CONFIG_LINUX
+/* Add the CPUs of host NUMA node @node to @cpus */
+static bool host_node_add_cpus(unsigned long node, cpu_set_t *cpus)
 {
-    static gsize initialized = 0;
+    g_autofree char *path =
+        g_strdup_printf("/sys/devices/system/node/node%lu/cpulist", node);
+    g_autofree char *list = NULL;
+    const char *p;
+
+    if (!g_file_get_contents(path, &list, NULL, NULL)) {
+        return false;
+    }
+
+    /* e.g. "0-7,64-71" */
+    p = list;
+    while (*p && *p != '\n') {
+        unsigned long first, last;
+
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            return false;
+        }
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            return false;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, cpus);
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return true;
+}
+
+/*
+ * Pin the threads of @context to the CPUs of the host nodes in
+ * @host_nodes, if they can all be found.
+ */
+static void memset_context_set_nodes(MemsetContext *context,
+                                     const unsigned long *host_nodes,
+                                     unsigned long maxnode)
+{
+    unsigned long node;
+
+    if (!host_nodes) {
+        return;
+    }
+
+    CPU_ZERO(&context->cpus);
+    for (node = find_first_bit(host_nodes, maxnode); node < maxnode;
+         node = find_next_bit(host_nodes, maxnode, node + 1)) {
+        if (!host_node_add_cpus(node, &context->cpus)) {
+            return;
+        }
+    }
+    context->pin = CPU_COUNT(&context->cpus) > 0;
+}
+
+static bool madv_populate_write_possible(char *area, size_t pagesize)
+{
+    /*
+     * Sense on every call: some mappings, e.g. of /dev/mem, do not
+     * support it.  EINVAL means that either the kernel does not know
+     * the advice or the mapping does not support it.
+     */
+    return !madvise(area, pagesize, MADV_POPULATE_WRITE) || errno != EINVAL;
+}
+#endif
+
+static bool install_sigbus_handler(Error **errp)
+{
+    struct sigaction act;
+
+    if (sigbus_installed) {
+        return true;
+    }
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = &sigbus_handler;
+    act.sa_flags = 0;
+
+    if (sigaction(SIGBUS, &act, &sigbus_oldact)) {
+        error_setg_errno(errp, errno,
+            "os_mem_prealloc: failed to install signal handler");
+        return false;
+    }
+    sigbus_installed = true;
+    return true;
+}
+
+/* Restore the SIGBUS handler once no preallocation is running */
+static void restore_sigbus_handler(void)
+{
+    if (!sigbus_installed || !QLIST_EMPTY(&memset_contexts)) {
+        return;
+    }
+
+    if (sigaction(SIGBUS, &sigbus_oldact, NULL)) {
+        /* Terminate QEMU since it can't recover from error */
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
+    }
+    sigbus_installed = false;
+}
+
+static MemsetContext *touch_all_pages(char *area, size_t hpagesize,
+                                      size_t numpages, int smp_cpus,
+                                      const unsigned long *host_nodes,
+                                      unsigned long maxnode)
+{
+    MemsetContext *context = g_new0(MemsetContext, 1);
     size_t numpages_per_thread, leftover;
     char *addr = area;
     int i = 0;
 
-    if (g_once_init_enter(&initialized)) {
-        qemu_mutex_init(&page_mutex);
-        qemu_cond_init(&page_cond);
-        g_once_init_leave(&initialized, 1);
-    }
 
-    memset_thread_failed = false;
-    threads_created_flag = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = numpages / memset_num_threads;
-    leftover = numpages % memset_num_threads;
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
+    context->num_threads = get_memset_num_threads(smp_cpus);
+#ifdef CONFIG_LINUX
+    memset_context_set_nodes(context, host_nodes, maxnode);
+    if (context->pin) {
+        context->num_threads = MIN(context->num_threads,
+                                   CPU_COUNT(&context->cpus));
+    }
+    context->populate_write = madv_populate_write_possible(area, hpagesize);
+#endif
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    numpages_per_thread = numpages / context->num_threads;
+    leftover = numpages % context->num_threads;
+    QLIST_INSERT_HEAD(&memset_contexts, context, next);
+    for (i = 0; i < context->num_threads; i++) {
+        context->threads[i].addr = addr;
+        context->threads[i].numpages = numpages_per_thread + (i < leftover);
+        context->threads[i].hpagesize = hpagesize;
+        context->threads[i].context = context;
+        qemu_thread_create(&context->threads[i].pgthread, "touch_pages",
+                           do_touch_pages, &context->threads[i],
                            QEMU_THREAD_JOINABLE);
-        addr += memset_thread[i].numpages * hpagesize;
+        addr += context->threads[i].numpages * hpagesize;
     }
 
     qemu_mutex_lock(&page_mutex);
-    threads_created_flag = true;
+    context->all_threads_created = true;
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
 
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
+    return context;
+}
+
+/* Returns true if all pages of @context could be allocated */
+static bool wait_all_pages(MemsetContext *context)
+{
+    bool ret;
+    int i;
+
+    for (i = 0; i < context->num_threads; i++) {
+        qemu_thread_join(&context->threads[i].pgthread);
     }
-    g_free(memset_thread);
-    memset_thread = NULL;
+    qemu_mutex_lock(&memset_lock);
+    QLIST_REMOVE(context, next);
+    qemu_mutex_unlock(&memset_lock);
+    ret = !context->any_thread_failed;
+    g_free(context->threads);
+    g_free(context);
+    return ret;
+}
+
+static void memset_init(void)
+{
+    static gsize initialized = 0;
 
-    return memset_thread_failed;
+    if (g_once_init_enter(&initialized)) {
+        qemu_mutex_init(&page_mutex);
+        qemu_cond_init(&page_cond);
+        qemu_mutex_init(&memset_lock);
+        g_once_init_leave(&initialized, 1);
+    }
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+                     const unsigned long *host_nodes, unsigned long maxnode,
+                     bool async, Error **errp)
 {
-    int ret;
-    struct sigaction act, oldact;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    MemsetContext *context;
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
-
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
+    memset_init();
+    qemu_mutex_lock(&memset_lock);
+    if (!install_sigbus_handler(errp)) {
+        qemu_mutex_unlock(&memset_lock);
         return;
     }
 
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    context = touch_all_pages(area, hpagesize, numpages, smp_cpus,
+                              host_nodes, maxnode);
+    if (async && !memset_async_done) {
+        QLIST_INSERT_HEAD(&memset_async_contexts, context, next_async);
+        qemu_mutex_unlock(&memset_lock);
+        return;
+    }
+    qemu_mutex_unlock(&memset_lock);
+
+    if (!wait_all_pages(context)) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
+    qemu_mutex_lock(&memset_lock);
+    restore_sigbus_handler();
+    qemu_mutex_unlock(&memset_lock);
+}
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+bool os_mem_prealloc_finish(Error **errp)
+{
+    MemsetContext *context;
+    bool ret = true;
+
+    memset_init();
+    qemu_mutex_lock(&memset_lock);
+    memset_async_done = true;
+    while (!QLIST_EMPTY(&memset_async_contexts)) {
+        context = QLIST_FIRST(&memset_async_contexts);
+        QLIST_REMOVE(context, next_async);
+        qemu_mutex_unlock(&memset_lock);
+        ret &= wait_all_pages(context);
+        qemu_mutex_lock(&memset_lock);
+    }
+    restore_sigbus_handler();
+    qemu_mutex_unlock(&memset_lock);
+
+    if (!ret) {
+        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
+            "pages available to allocate guest RAM");
     }
+    return ret;
 }
 
 char *qemu_get_pid_name(pid_t pid)
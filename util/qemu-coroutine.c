@@ -18,12 +18,21 @@
 #include "qemu/atomic.h"
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
+#include "qemu/stats64.h"
 #include "block/aio.h"
 
 enum {
-    POOL_BATCH_SIZE = 64,
+    POOL_MIN_BATCH_SIZE = 64,
 };
 
+/*
+ * Coroutines moved at once from the release pool to a thread's alloc pool.
+ * Devices that keep many requests in flight raise it, see
+ * qemu_coroutine_inc_pool_size(), so that the pools do not keep freeing
+ * coroutines just to create them again.
+ */
+static unsigned int pool_batch_size = POOL_MIN_BATCH_SIZE;
+
 /** Free list to speed up creation */
 static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
 static unsigned int release_pool_size;
@@ -31,6 +40,21 @@ static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(po
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
+/*
+ * Pool statistics.  Creations are counted per thread and only added to
+ * the total on the slow path, which allocates or refills anyway.
+ */
+static Stat64 pool_created;
+static Stat64 pool_allocated;
+static Stat64 pool_freed;
+static __thread unsigned int pool_created_unflushed;
+
+static void coroutine_pool_flush_stats(void)
+{
+    stat64_add(&pool_created, pool_created_unflushed);
+    pool_created_unflushed = 0;
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
@@ -39,17 +63,22 @@ static void coroutine_pool_cleanup(Notifier *n, void *value)
     QSLIST_FOREACH_SAFE(co, &alloc_pool, pool_next, tmp) {
         QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
         qemu_coroutine_delete(co);
+        stat64_inc(&pool_freed);
     }
+    coroutine_pool_flush_stats();
 }
 
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
 
+    pool_created_unflushed++;
+
     if (CONFIG_COROUTINE_POOL) {
         co = QSLIST_FIRST(&alloc_pool);
         if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
+            coroutine_pool_flush_stats();
+            if (release_pool_size > qatomic_read(&pool_batch_size)) {
                 /* Slow path; a good place to register the destructor, too.  */
                 if (!coroutine_pool_cleanup_notifier.notify) {
                     coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
@@ -73,6 +102,8 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 
     if (!co) {
         co = qemu_coroutine_new();
+        stat64_inc(&pool_allocated);
+        coroutine_pool_flush_stats();
     }
 
     co->entry = entry;
@@ -86,12 +117,14 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
+        unsigned int batch_size = qatomic_read(&pool_batch_size);
+
+        if (release_pool_size < batch_size * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             qatomic_inc(&release_pool_size);
             return;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        if (alloc_pool_size < batch_size) {
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
             return;
@@ -99,6 +132,28 @@ static void coroutine_delete(Coroutine *co)
     }
 
     qemu_coroutine_delete(co);
+    stat64_inc(&pool_freed);
+}
+
+void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size)
+{
+    qatomic_add(&pool_batch_size, additional_pool_size);
+}
+
+void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
+{
+    qatomic_sub(&pool_batch_size, removing_pool_size);
+}
+
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats)
+{
+    /* Make our own creations visible at least */
+    coroutine_pool_flush_stats();
+
+    stats->batch_size = qatomic_read(&pool_batch_size);
+    stats->created = stat64_get(&pool_created);
+    stats->allocated = stat64_get(&pool_allocated);
+    stats->freed = stat64_get(&pool_freed);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
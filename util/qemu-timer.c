@@ -67,7 +67,23 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+
+    /*
+     * Binary min-heap of the pending timers, ordered by expire_time and
+     * then by seq so that timers with the same expire_time fire in the
+     * order they were armed.
+     */
+    QEMUTimer **active_timers;
+    size_t nr_active;
+    size_t active_size;
+    uint64_t next_seq;
+
+    /*
+     * expire_time of the root of the heap, or -1 if there are no pending
+     * timers.  Written under active_timers_lock, read without it.
+     */
+    int64_t first_expire;
+
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -106,6 +122,7 @@ QEMUTimerList *timerlist_new(QEMUClockType type,
     timer_list->clock = clock;
     timer_list->notify_cb = cb;
     timer_list->notify_opaque = opaque;
+    timer_list->first_expire = -1;
     qemu_mutex_init(&timer_list->active_timers_lock);
     QLIST_INSERT_HEAD(&clock->timerlists, timer_list, list);
     return timer_list;
@@ -118,6 +135,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -172,7 +190,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!qatomic_read(&timer_list->active_timers);
+    return qatomic_read_i64(&timer_list->first_expire) != -1;
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -183,19 +201,12 @@ bool qemu_clock_has_timers(QEMUClockType type)
 
 bool timerlist_expired(QEMUTimerList *timer_list)
 {
-    int64_t expire_time;
+    int64_t expire_time = qatomic_read_i64(&timer_list->first_expire);
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (expire_time == -1) {
         return false;
     }
 
-    WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
-            return false;
-        }
-        expire_time = timer_list->active_timers->expire_time;
-    }
-
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
 }
 
@@ -215,23 +226,17 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
-        return -1;
-    }
-
     if (!timer_list->clock->enabled) {
         return -1;
     }
 
-    /* The active timers list may be modified before the caller uses our return
+    /* The active timers may be modified before the caller uses our return
      * value but ->notify_cb() is called when the deadline changes.  Therefore
      * the caller should notice the change and there is no race condition.
      */
-    WITH_QEMU_LOCK_GUARD(&timer_list->active_timers_lock) {
-        if (!timer_list->active_timers) {
-            return -1;
-        }
-        expire_time = timer_list->active_timers->expire_time;
+    expire_time = qatomic_read_i64(&timer_list->first_expire);
+    if (expire_time == -1) {
+        return -1;
     }
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -256,24 +261,33 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
     QEMUTimer *ts;
     QEMUTimerList *timer_list;
     QEMUClock *clock = qemu_clock_ptr(type);
+    size_t i;
 
     if (!clock->enabled) {
         return -1;
     }
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
+        expire_time = -1;
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
-        /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
+        for (i = 0; i < timer_list->nr_active; i++) {
+            ts = timer_list->active_timers[i];
+            /* Skip all external timers */
+            if (ts->attributes & ~attr_mask) {
+                continue;
+            }
+            if (expire_time == -1 || ts->expire_time < expire_time) {
+                expire_time = ts->expire_time;
+            }
+            /* Nothing in the heap expires before the root */
+            if (i == 0) {
+                break;
+            }
         }
-        if (!ts) {
-            qemu_mutex_unlock(&timer_list->active_timers_lock);
+        qemu_mutex_unlock(&timer_list->active_timers_lock);
+        if (expire_time == -1) {
             continue;
         }
-        expire_time = ts->expire_time;
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
 
         delta = expire_time - qemu_clock_get_ns(type);
         if (delta <= 0) {
@@ -376,43 +390,107 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static bool timer_before(QEMUTimer *a, QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
+static void timerlist_heap_set(QEMUTimerList *timer_list, size_t i,
+                               QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timerlist_sift_up(QEMUTimerList *timer_list, size_t i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
             break;
         }
-        pt = &t->next;
+        timerlist_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
     }
+    timerlist_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timerlist_sift_down(QEMUTimerList *timer_list, size_t i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->active_timers[i];
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        size_t child = 2 * i + 1;
+
+        if (child >= timer_list->nr_active) {
+            break;
+        }
+        if (child + 1 < timer_list->nr_active &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
             break;
         }
-        pt = &t->next;
+        timerlist_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
     }
+    timerlist_heap_set(timer_list, i, ts);
+}
+
+static void timerlist_update_first(QEMUTimerList *timer_list)
+{
+    qatomic_set_i64(&timer_list->first_expire,
+                    timer_list->nr_active ?
+                    timer_list->active_timers[0]->expire_time : -1);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    size_t i = ts->heap_index;
+    size_t parent = (i - 1) / 2;
+    QEMUTimer *last;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+    ts->expire_time = -1;
+
+    last = timer_list->active_timers[--timer_list->nr_active];
+    if (last != ts) {
+        timerlist_heap_set(timer_list, i, last);
+        if (i > 0 && timer_before(last, timer_list->active_timers[parent])) {
+            timerlist_sift_up(timer_list, i);
+        } else {
+            timerlist_sift_down(timer_list, i);
+        }
+    }
+    timerlist_update_first(timer_list);
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    if (timer_list->nr_active == timer_list->active_size) {
+        timer_list->active_size = MAX(16, timer_list->active_size * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->active_size);
+    }
+
+    /* among timers with the same expire_time, the new one goes last */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->next_seq++;
+    timerlist_heap_set(timer_list, timer_list->nr_active++, ts);
+    timerlist_sift_up(timer_list, ts->heap_index);
+    timerlist_update_first(timer_list);
 
-    return pt == &timer_list->active_timers;
+    return ts->heap_index == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -504,7 +582,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!qatomic_read(&timer_list->active_timers)) {
+    if (!timerlist_has_timers(timer_list)) {
         return false;
     }
 
@@ -543,7 +621,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while (timer_list->nr_active) {
+        ts = timer_list->active_timers[0];
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -563,9 +642,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -43,14 +43,24 @@
  * just-removed entry. This makes lookups slightly faster, since the moment an
  * invalid entry is found, the (failed) lookup is over.
  *
- * Resizing is done by taking all bucket spinlocks (so that no other writers can
- * race with us) and then copying all entries into a new hash map. Then, the
- * ht->map pointer is set, and the old map is freed once no RCU readers can see
- * it anymore.
+ * Resizing is incremental, so that writers are not stalled for the whole
+ * duration of a resize of a large table: the new map is published in
+ * the old map's @migrate_to, and then the old head buckets are migrated one
+ * at a time, each with only its own spinlock (and that of the destination
+ * buckets) held. Once all buckets have been migrated the ht->map pointer is
+ * set, and the old map is freed once no RCU readers can see it anymore.
+ * While the migration is in progress both maps are live:
+ * - Lookups that miss in a map retry in the map's @migrate_to, if any. An
+ *   entry is copied to the new map before it is removed from the old one, so
+ *   it is always found in at least one of them.
+ * - Writers that lock an already-migrated bucket drop its lock and operate
+ *   on the new map instead.
+ * Resizes, resets and iterations are serialized through ht->lock.
  *
- * Writers check for concurrent resizes by comparing ht->map before and after
- * acquiring their bucket lock. If they don't match, a resize has occurred
- * while the bucket spinlock was being acquired.
+ * Writers check for concurrent resizes after acquiring their bucket lock by
+ * looking at the map's @n_migrated. A map is only replaced once all of its
+ * buckets are migrated, so this also catches writers that raced with the end
+ * of a resize and locked a bucket of the old map.
  *
  * Related Work:
  * - Idea of cacheline-sized buckets with full hashes taken from:
@@ -159,6 +169,10 @@ QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
  * @n_added_buckets: number of added (i.e. "non-head") buckets
  * @n_added_buckets_threshold: threshold to trigger an upward resize once the
  *                             number of added buckets surpasses it.
+ * @migrate_to: map that the entries are being moved to by a resize, or NULL.
+ * @n_migrated: number of head buckets, starting from the first, whose entries
+ *              have been moved to @migrate_to. Only changes with the lock of
+ *              the bucket being migrated held.
  *
  * Buckets are tracked in what we call a "map", i.e. this structure.
  */
@@ -168,13 +182,14 @@ struct qht_map {
     size_t n_buckets;
     size_t n_added_buckets;
     size_t n_added_buckets_threshold;
+    struct qht_map *migrate_to;
+    size_t n_migrated;
 };
 
 /* trigger a resize when n_added_buckets > n_buckets / div */
 #define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
 
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new,
-                                bool reset);
+static void qht_do_resize(struct qht *ht, struct qht_map *new);
 static void qht_grow_maybe(struct qht *ht);
 
 #ifdef QHT_DEBUG
@@ -264,52 +279,19 @@ static void qht_map_unlock_buckets(struct qht_map *map)
     }
 }
 
-/*
- * Call with at least a bucket lock held.
- * @map should be the value read before acquiring the lock (or locks).
- */
-static inline bool qht_map_is_stale__locked(const struct qht *ht,
-                                            const struct qht_map *map)
+/* call with the lock of a head bucket of @map held */
+static inline bool qht_bucket_is_migrated__locked(const struct qht_map *map,
+                                                  const struct qht_bucket *b)
 {
-    return map != ht->map;
+    return (size_t)(b - map->buckets) < qatomic_read(&map->n_migrated);
 }
 
 /*
- * Grab all bucket locks, and set @pmap after making sure the map isn't stale.
- *
- * Pairs with qht_map_unlock_buckets(), hence the pass-by-reference.
- *
- * Note: callers cannot have ht->lock held.
- */
-static inline
-void qht_map_lock_buckets__no_stale(struct qht *ht, struct qht_map **pmap)
-{
-    struct qht_map *map;
-
-    map = qatomic_rcu_read(&ht->map);
-    qht_map_lock_buckets(map);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return;
-    }
-    qht_map_unlock_buckets(map);
-
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    qht_map_lock_buckets(map);
-    qht_unlock(ht);
-    *pmap = map;
-    return;
-}
-
-/*
- * Get a head bucket and lock it, making sure its parent map is not stale.
+ * Get a head bucket and lock it, making sure that its entries have not been
+ * migrated to a new map.
  * @pmap is filled with a pointer to the bucket's parent map.
  *
  * Unlock with qemu_spin_unlock(&b->lock).
- *
- * Note: callers cannot have ht->lock held.
  */
 static inline
 struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
@@ -322,18 +304,18 @@ struct qht_bucket *qht_bucket_lock__no_stale(struct qht *ht, uint32_t hash,
     b = qht_map_to_bucket(map, hash);
 
     qemu_spin_lock(&b->lock);
-    if (likely(!qht_map_is_stale__locked(ht, map))) {
-        *pmap = map;
-        return b;
-    }
-    qemu_spin_unlock(&b->lock);
 
-    /* we raced with a resize; acquire ht->lock to see the updated ht->map */
-    qht_lock(ht);
-    map = ht->map;
-    b = qht_map_to_bucket(map, hash);
-    qemu_spin_lock(&b->lock);
-    qht_unlock(ht);
+    /*
+     * We raced with a resize, which may have moved the bucket's entries
+     * already.  Maps are not freed under the RCU read lock, so follow
+     * @migrate_to until we find where the entries are now.
+     */
+    while (unlikely(qht_bucket_is_migrated__locked(map, b))) {
+        qemu_spin_unlock(&b->lock);
+        map = map->migrate_to;
+        b = qht_map_to_bucket(map, hash);
+        qemu_spin_lock(&b->lock);
+    }
     *pmap = map;
     return b;
 }
@@ -378,6 +360,8 @@ static struct qht_map *qht_map_create(size_t n_buckets)
     map->n_buckets = n_buckets;
 
     map->n_added_buckets = 0;
+    map->migrate_to = NULL;
+    map->n_migrated = 0;
     map->n_added_buckets_threshold = n_buckets /
         QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
 
@@ -450,19 +434,41 @@ void qht_reset(struct qht *ht)
 {
     struct qht_map *map;
 
-    qht_map_lock_buckets__no_stale(ht, &map);
+    /* ht->lock waits for resizes, after which ht->map has all the entries */
+    qht_lock(ht);
+    map = ht->map;
+    qht_map_lock_buckets(map);
     qht_map_reset__all_locked(map);
     qht_map_unlock_buckets(map);
+    qht_unlock(ht);
 }
 
-static inline void qht_do_resize(struct qht *ht, struct qht_map *new)
+/*
+ * Atomically perform a reset, and replace the map with @new if not NULL.
+ * Call with ht->lock held.
+ */
+static void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
 {
-    qht_do_resize_reset(ht, new, false);
-}
+    struct qht_map *old = ht->map;
 
-static inline void qht_do_resize_and_reset(struct qht *ht, struct qht_map *new)
-{
-    qht_do_resize_reset(ht, new, true);
+    qht_map_lock_buckets(old);
+    qht_map_reset__all_locked(old);
+
+    if (new == NULL) {
+        qht_map_unlock_buckets(old);
+        return;
+    }
+
+    /*
+     * There are no entries to copy; just send writers that are waiting for
+     * the old map's locks to @new.
+     */
+    g_assert(new->n_buckets != old->n_buckets);
+    qatomic_rcu_set(&old->migrate_to, new);
+    qatomic_set(&old->n_migrated, old->n_buckets);
+    qatomic_rcu_set(&ht->map, new);
+    qht_map_unlock_buckets(old);
+    call_rcu(old, qht_map_destroy, rcu);
 }
 
 bool qht_reset_size(struct qht *ht, size_t n_elems)
@@ -525,15 +531,14 @@ void *qht_lookup__slowpath(const struct qht_bucket *b, qht_lookup_func_t func,
     return ret;
 }
 
-void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
-                        qht_lookup_func_t func)
+static inline
+void *qht_map_lookup(const struct qht_map *map, qht_lookup_func_t func,
+                     const void *userp, uint32_t hash)
 {
     const struct qht_bucket *b;
-    const struct qht_map *map;
     unsigned int version;
     void *ret;
 
-    map = qatomic_rcu_read(&ht->map);
     b = qht_map_to_bucket(map, hash);
 
     version = seqlock_read_begin(&b->sequence);
@@ -548,6 +553,30 @@ void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
     return qht_lookup__slowpath(b, func, userp, hash);
 }
 
+void *qht_lookup_custom(const struct qht *ht, const void *userp, uint32_t hash,
+                        qht_lookup_func_t func)
+{
+    const struct qht_map *map;
+    void *ret;
+
+    map = qatomic_rcu_read(&ht->map);
+    for (;;) {
+        ret = qht_map_lookup(map, func, userp, hash);
+        if (likely(ret)) {
+            return ret;
+        }
+        /*
+         * The entry may have been migrated by a resize.  The read barrier
+         * in seqlock_read_retry orders this load after the bucket's; entries
+         * are copied to @migrate_to before they are removed from @map.
+         */
+        map = qatomic_rcu_read(&map->migrate_to);
+        if (likely(map == NULL)) {
+            return NULL;
+        }
+    }
+}
+
 void *qht_lookup(const struct qht *ht, const void *userp, uint32_t hash)
 {
     return qht_lookup_custom(ht, userp, hash, ht->cmp);
@@ -804,10 +833,13 @@ do_qht_iter(struct qht *ht, const struct qht_iter *iter, void *userp)
 {
     struct qht_map *map;
 
-    map = qatomic_rcu_read(&ht->map);
+    /* wait for resizes, so that all the entries are in ht->map */
+    qht_lock(ht);
+    map = ht->map;
     qht_map_lock_buckets(map);
     qht_map_iter__all_locked(map, iter, userp);
     qht_map_unlock_buckets(map);
+    qht_unlock(ht);
 }
 
 void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
@@ -830,55 +862,58 @@ void qht_iter_remove(struct qht *ht, qht_iter_bool_func_t func, void *userp)
     do_qht_iter(ht, &iter, userp);
 }
 
-struct qht_map_copy_data {
-    struct qht *ht;
-    struct qht_map *new;
-};
-
-static void qht_map_copy(void *p, uint32_t hash, void *userp)
+/*
+ * Move the entries of @head's chain to @new. Call with head->lock held; the
+ * destination buckets are locked since writers may already be using them.
+ */
+static void qht_bucket_migrate__locked(struct qht *ht, struct qht_bucket *head,
+                                       struct qht_map *new)
 {
-    struct qht_map_copy_data *data = userp;
-    struct qht *ht = data->ht;
-    struct qht_map *new = data->new;
-    struct qht_bucket *b = qht_map_to_bucket(new, hash);
+    struct qht_bucket *b = head;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            struct qht_bucket *to;
 
-    /* no need to acquire b->lock because no thread has seen this map yet */
-    qht_insert__locked(ht, new, b, p, hash, NULL);
+            if (b->pointers[i] == NULL) {
+                goto done;
+            }
+            to = qht_map_to_bucket(new, b->hashes[i]);
+            qemu_spin_lock(&to->lock);
+            qht_insert__locked(ht, new, to, b->pointers[i], b->hashes[i],
+                               NULL);
+            qemu_spin_unlock(&to->lock);
+        }
+        b = b->next;
+    } while (b);
+ done:
+    /* only now, so that concurrent lookups find the entries in either map */
+    qht_bucket_reset__locked(head);
 }
 
 /*
- * Atomically perform a resize and/or reset.
+ * Incrementally move all entries to @new, then make it the current map.
  * Call with ht->lock held.
  */
-static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
+static void qht_do_resize(struct qht *ht, struct qht_map *new)
 {
-    struct qht_map *old;
-    const struct qht_iter iter = {
-        .f.retvoid = qht_map_copy,
-        .type = QHT_ITER_VOID,
-    };
-    struct qht_map_copy_data data;
+    struct qht_map *old = ht->map;
+    size_t i;
 
-    old = ht->map;
-    qht_map_lock_buckets(old);
+    g_assert(new->n_buckets != old->n_buckets);
+    qatomic_rcu_set(&old->migrate_to, new);
 
-    if (reset) {
-        qht_map_reset__all_locked(old);
-    }
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *head = &old->buckets[i];
 
-    if (new == NULL) {
-        qht_map_unlock_buckets(old);
-        return;
+        qemu_spin_lock(&head->lock);
+        qht_bucket_migrate__locked(ht, head, new);
+        qatomic_set(&old->n_migrated, i + 1);
+        qemu_spin_unlock(&head->lock);
     }
 
-    g_assert(new->n_buckets != old->n_buckets);
-    data.ht = ht;
-    data.new = new;
-    qht_map_iter__all_locked(old, &iter, &data);
-    qht_map_debug__all_locked(new);
-
     qatomic_rcu_set(&ht->map, new);
-    qht_map_unlock_buckets(old);
     call_rcu(old, qht_map_destroy, rcu);
 }
 
@@ -10,11 +10,15 @@
  * help diagnose performance problems, e.g. scalability issues when
  * contention is high.
  *
- * The primitives currently supported are mutexes, recursive mutexes and
- * condition variables. Note that not all related functions are intercepted;
- * instead we profile only those functions that can have a performance impact,
- * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
- * contention (e.g. mutex_lock, mutex_trylock).
+ * The primitives currently supported are mutexes, recursive mutexes,
+ * condition variables, coroutine mutexes and rwlocks, and QemuLockCnt. Note
+ * that not all related functions are intercepted; instead we profile only
+ * those functions that can have a performance impact, either due to blocking
+ * (e.g. cond_wait, mutex_lock) or cache line contention (e.g. mutex_lock,
+ * mutex_trylock).
+ *
+ * For coroutine locks, the time recorded is the time the coroutine spent
+ * waiting for the lock, including the time it was suspended.
  *
  * QSP's design focuses on speed and scalability. This is achieved
  * by having threads do their profiling entirely on thread-local data.
@@ -60,6 +64,7 @@
 #include "qemu/osdep.h"
 #include "qemu/qemu-print.h"
 #include "qemu/thread.h"
+#include "qemu/coroutine.h"
 #include "qemu/timer.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
@@ -70,6 +75,9 @@ enum QSPType {
     QSP_BQL_MUTEX,
     QSP_REC_MUTEX,
     QSP_CONDVAR,
+    QSP_CO_MUTEX,
+    QSP_CO_RWLOCK,
+    QSP_LOCKCNT,
 };
 
 struct QSPCallSite {
@@ -122,6 +130,9 @@ static const char * const qsp_typenames[] = {
     [QSP_BQL_MUTEX] = "BQL mutex",
     [QSP_REC_MUTEX] = "rec_mutex",
     [QSP_CONDVAR]   = "condvar",
+    [QSP_CO_MUTEX]  = "co_mutex",
+    [QSP_CO_RWLOCK] = "co_rwlock",
+    [QSP_LOCKCNT]   = "lockcnt",
 };
 
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
@@ -132,6 +143,12 @@ QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func =
     qemu_rec_mutex_trylock_impl;
 QemuCondWaitFunc qemu_cond_wait_func = qemu_cond_wait_impl;
 QemuCondTimedWaitFunc qemu_cond_timedwait_func = qemu_cond_timedwait_impl;
+QemuCoMutexLockFunc qemu_co_mutex_lock_func = qemu_co_mutex_lock_impl;
+QemuCoRwlockLockFunc qemu_co_rwlock_rdlock_func = qemu_co_rwlock_rdlock_impl;
+QemuCoRwlockLockFunc qemu_co_rwlock_upgrade_func = qemu_co_rwlock_upgrade_impl;
+QemuCoRwlockLockFunc qemu_co_rwlock_wrlock_func = qemu_co_rwlock_wrlock_impl;
+QemuLockCntFunc qemu_lockcnt_inc_func = qemu_lockcnt_inc_impl;
+QemuLockCntFunc qemu_lockcnt_lock_func = qemu_lockcnt_lock_impl;
 
 /*
  * It pays off to _not_ hash callsite->file; hashing a string is slow, and
@@ -396,6 +413,46 @@ QSP_GEN_VOID(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_lock,
 QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
              qemu_rec_mutex_trylock_impl)
 
+QSP_GEN_VOID(QemuLockCnt, QSP_LOCKCNT, qsp_lockcnt_inc, qemu_lockcnt_inc_impl)
+QSP_GEN_VOID(QemuLockCnt, QSP_LOCKCNT, qsp_lockcnt_lock,
+             qemu_lockcnt_lock_impl)
+
+/*
+ * A coroutine can resume in a different thread than the one it was suspended
+ * in, so look up the (per-thread) entry out of line: this keeps the compiler
+ * from computing the address of qsp_thread before the lock is taken.
+ */
+static __attribute__((noinline))
+void qsp_co_entry_record(const void *obj, const char *file, int line,
+                         enum QSPType type, int64_t delta)
+{
+    QSPEntry *e = qsp_entry_get(obj, file, line, type);
+
+    qsp_entry_record(e, delta);
+}
+
+#define QSP_GEN_CO_VOID(type_, qsp_t_, func_, impl_)                    \
+    static void coroutine_fn func_(type_ *obj, const char *file, int line) \
+    {                                                                   \
+        int64_t t0, t1;                                                 \
+                                                                        \
+        t0 = get_clock();                                               \
+        impl_(obj, file, line);                                         \
+        t1 = get_clock();                                               \
+                                                                        \
+        qsp_co_entry_record(obj, file, line, qsp_t_, t1 - t0);          \
+    }
+
+QSP_GEN_CO_VOID(CoMutex, QSP_CO_MUTEX, qsp_co_mutex_lock,
+                qemu_co_mutex_lock_impl)
+QSP_GEN_CO_VOID(CoRwlock, QSP_CO_RWLOCK, qsp_co_rwlock_rdlock,
+                qemu_co_rwlock_rdlock_impl)
+QSP_GEN_CO_VOID(CoRwlock, QSP_CO_RWLOCK, qsp_co_rwlock_upgrade,
+                qemu_co_rwlock_upgrade_impl)
+QSP_GEN_CO_VOID(CoRwlock, QSP_CO_RWLOCK, qsp_co_rwlock_wrlock,
+                qemu_co_rwlock_wrlock_impl)
+
+#undef QSP_GEN_CO_VOID
 #undef QSP_GEN_RET1
 #undef QSP_GEN_VOID
 
@@ -444,6 +501,12 @@ void qsp_enable(void)
     qatomic_set(&qemu_rec_mutex_trylock_func, qsp_rec_mutex_trylock);
     qatomic_set(&qemu_cond_wait_func, qsp_cond_wait);
     qatomic_set(&qemu_cond_timedwait_func, qsp_cond_timedwait);
+    qatomic_set(&qemu_co_mutex_lock_func, qsp_co_mutex_lock);
+    qatomic_set(&qemu_co_rwlock_rdlock_func, qsp_co_rwlock_rdlock);
+    qatomic_set(&qemu_co_rwlock_upgrade_func, qsp_co_rwlock_upgrade);
+    qatomic_set(&qemu_co_rwlock_wrlock_func, qsp_co_rwlock_wrlock);
+    qatomic_set(&qemu_lockcnt_inc_func, qsp_lockcnt_inc);
+    qatomic_set(&qemu_lockcnt_lock_func, qsp_lockcnt_lock);
 }
 
 void qsp_disable(void)
@@ -455,6 +518,12 @@ void qsp_disable(void)
     qatomic_set(&qemu_rec_mutex_trylock_func, qemu_rec_mutex_trylock_impl);
     qatomic_set(&qemu_cond_wait_func, qemu_cond_wait_impl);
     qatomic_set(&qemu_cond_timedwait_func, qemu_cond_timedwait_impl);
+    qatomic_set(&qemu_co_mutex_lock_func, qemu_co_mutex_lock_impl);
+    qatomic_set(&qemu_co_rwlock_rdlock_func, qemu_co_rwlock_rdlock_impl);
+    qatomic_set(&qemu_co_rwlock_upgrade_func, qemu_co_rwlock_upgrade_impl);
+    qatomic_set(&qemu_co_rwlock_wrlock_func, qemu_co_rwlock_wrlock_impl);
+    qatomic_set(&qemu_lockcnt_inc_func, qemu_lockcnt_inc_impl);
+    qatomic_set(&qemu_lockcnt_lock_func, qemu_lockcnt_lock_impl);
 }
 
 static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
@@ -175,6 +175,19 @@ void synchronize_rcu(void)
 
 #define RCU_CALL_MIN_SIZE        30
 
+/*
+ * After a batch of this many callbacks, give the memory they freed back to
+ * the system: a storm of memory topology updates can otherwise leave the
+ * RSS high until call_rcu_thread goes idle.
+ */
+#define RCU_CALL_TRIM_SIZE       1000
+
+/*
+ * Callbacks are run with the BQL taken; drop it every this many callbacks
+ * so that a large batch does not stall the main loop and vCPU threads.
+ */
+#define RCU_CALL_BQL_BATCH       256
+
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
@@ -183,6 +196,9 @@ static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
+/* Nonzero while some thread waits for the callbacks in drain_call_rcu() */
+static int rcu_call_expedite;
+
 static void enqueue(struct rcu_head *node)
 {
     struct rcu_head **old_tail;
@@ -241,12 +257,16 @@ static void *call_rcu_thread(void *opaque)
     for (;;) {
         int tries = 0;
         int n = qatomic_read(&rcu_call_count);
+        int done = 0;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless someone is waiting for them in drain_call_rcu().
          * Fetch rcu_call_count now, we only must process elements that were
          * added before synchronize_rcu() starts.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 ||
+               (n < RCU_CALL_MIN_SIZE && !qatomic_read(&rcu_call_expedite) &&
+                ++tries <= 5)) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
@@ -265,6 +285,11 @@ static void *call_rcu_thread(void *opaque)
         synchronize_rcu();
         qemu_mutex_lock_iothread();
         while (n > 0) {
+            if (++done % RCU_CALL_BQL_BATCH == 0) {
+                qemu_mutex_unlock_iothread();
+                qemu_mutex_lock_iothread();
+            }
+
             node = try_dequeue();
             while (!node) {
                 qemu_mutex_unlock_iothread();
@@ -281,6 +306,12 @@ static void *call_rcu_thread(void *opaque)
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
+
+#if defined(CONFIG_MALLOC_TRIM)
+        if (done >= RCU_CALL_TRIM_SIZE) {
+            malloc_trim(4 * 1024 * 1024);
+        }
+#endif
     }
     abort();
 }
@@ -339,8 +370,10 @@ void drain_call_rcu(void)
      * assumed.
      */
 
+    qatomic_inc(&rcu_call_expedite);
     call_rcu1(&rcu_drain.rcu, drain_rcu_callback);
     qemu_event_wait(&rcu_drain.drain_complete_event);
+    qatomic_dec(&rcu_call_expedite);
 
     if (locked) {
         qemu_mutex_lock_iothread();
@@ -19,6 +19,13 @@ membarrier(int cmd, int flags)
 {
     return syscall(__NR_membarrier, cmd, flags);
 }
+
+/*
+ * MEMBARRIER_CMD_SHARED waits for a scheduler grace period, which takes
+ * milliseconds.  The expedited command IPIs the CPUs running our threads
+ * instead and returns in microseconds; use it if the kernel has it.
+ */
+static int membarrier_cmd = MEMBARRIER_CMD_SHARED;
 #endif
 
 void smp_mb_global(void)
@@ -26,7 +33,7 @@ void smp_mb_global(void)
 #if defined CONFIG_WIN32
     FlushProcessWriteBuffers();
 #elif defined CONFIG_LINUX
-    membarrier(MEMBARRIER_CMD_SHARED, 0);
+    membarrier(membarrier_cmd, 0);
 #else
 #error --enable-membarrier is not supported on this operating system.
 #endif
@@ -46,5 +53,11 @@ void smp_mb_global_init(void)
         error_report("Please upgrade your system to a newer version of Linux");
         exit(1);
     }
+#ifdef MEMBARRIER_CMD_PRIVATE_EXPEDITED
+    if ((ret & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+        membarrier_cmd = MEMBARRIER_CMD_PRIVATE_EXPEDITED;
+    }
+#endif
 #endif
 }
@@ -45,6 +45,9 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
+    /* When the request was queued, for the statistics */
+    int64_t submit_ns;
+
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
@@ -58,7 +61,6 @@ struct ThreadPool {
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
@@ -70,7 +72,16 @@ struct ThreadPool {
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int min_threads;     /* idle threads do not exit below this */
+    int max_threads;
     bool stopping;
+
+    /* Statistics, see thread_pool_get_stats().  Protected by lock.  */
+    int queue_depth;
+    int max_queue_depth;
+    uint64_t nr_requests;
+    uint64_t queue_ns;
+    uint64_t run_ns;
 };
 
 static void *worker_thread(void *opaque)
@@ -83,15 +94,21 @@ static void *worker_thread(void *opaque)
 
     while (!pool->stopping) {
         ThreadPoolElement *req;
+        int64_t start_ns;
         int ret;
 
+        /*
+         * Idle threads exit after a while, unless there is work that we
+         * raced with or they are needed to keep min_threads around.
+         */
         do {
             pool->idle_threads++;
             qemu_mutex_unlock(&pool->lock);
             ret = qemu_sem_timedwait(&pool->sem, 10000);
             qemu_mutex_lock(&pool->lock);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
+        } while (ret == -1 && (!QTAILQ_EMPTY(&pool->request_list) ||
+                               pool->cur_threads <= pool->min_threads));
         if (ret == -1 || pool->stopping) {
             break;
         }
@@ -99,6 +116,9 @@ static void *worker_thread(void *opaque)
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
         req->state = THREAD_ACTIVE;
+        start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        pool->queue_depth--;
+        pool->queue_ns += start_ns - req->submit_ns;
         qemu_mutex_unlock(&pool->lock);
 
         ret = req->func(req->arg);
@@ -109,6 +129,8 @@ static void *worker_thread(void *opaque)
         req->state = THREAD_DONE;
 
         qemu_mutex_lock(&pool->lock);
+        pool->nr_requests++;
+        pool->run_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
 
         qemu_bh_schedule(pool->completion_bh);
     }
@@ -219,6 +241,7 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        pool->queue_depth--;
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -260,7 +283,10 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
         spawn_thread(pool);
     }
+    req->submit_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    pool->queue_depth++;
+    pool->max_queue_depth = MAX(pool->max_queue_depth, pool->queue_depth);
     qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
@@ -306,11 +332,12 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
     QTAILQ_INIT(&pool->request_list);
+
+    thread_pool_set_params(pool, ctx->thread_pool_min, ctx->thread_pool_max);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -320,6 +347,36 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_set_params(ThreadPool *pool, int min_threads,
+                            int max_threads)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&pool->lock);
+
+    /*
+     * Threads beyond a lowered maximum exit as they become idle; new ones
+     * for a raised minimum are created by the AioContext's thread, so that
+     * they inherit its affinity.
+     */
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
+    for (i = pool->cur_threads; i < pool->min_threads; i++) {
+        spawn_thread(pool);
+    }
+}
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    QEMU_LOCK_GUARD(&pool->lock);
+
+    stats->threads = pool->cur_threads;
+    stats->requests = pool->nr_requests;
+    stats->max_queue_depth = pool->max_queue_depth;
+    stats->queue_ns = pool->queue_ns;
+    stats->run_ns = pool->run_ns;
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
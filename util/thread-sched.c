@@ -0,0 +1,199 @@
+/*
+ * CPU affinity and scheduling policy of QEMU threads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/thread-sched.h"
+
+#ifdef CONFIG_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static bool thread_sched_is_set(const ThreadSchedParams *params)
+{
+    return params->cpus || params->numa_node >= 0 || params->policy;
+}
+
+#ifdef CONFIG_LINUX
+static const struct {
+    const char *name;
+    int policy;
+} thread_sched_policies[] = {
+    { "other", SCHED_OTHER },
+    { "batch", SCHED_BATCH },
+    { "idle", SCHED_IDLE },
+    { "fifo", SCHED_FIFO },
+    { "rr", SCHED_RR },
+};
+
+/* Parse a list of CPUs in the format of the kernel's cpulist files */
+static bool thread_sched_parse_cpus(const char *str, cpu_set_t *set,
+                                    Error **errp)
+{
+    const char *end;
+    unsigned long first, last;
+
+    CPU_ZERO(set);
+    for (;;) {
+        if (qemu_strtoul(str, &end, 10, &first) < 0) {
+            goto invalid;
+        }
+        last = first;
+        if (*end == '-' &&
+            (qemu_strtoul(end + 1, &end, 10, &last) < 0 || last < first)) {
+            goto invalid;
+        }
+        if (last >= CPU_SETSIZE) {
+            error_setg(errp, "CPU %lu is out of range, the maximum is %d",
+                       last, CPU_SETSIZE - 1);
+            return false;
+        }
+        for (; first <= last; first++) {
+            CPU_SET(first, set);
+        }
+        if (*end != ',') {
+            break;
+        }
+        str = end + 1;
+    }
+
+    if (*end == '\0') {
+        return true;
+    }
+
+invalid:
+    error_setg(errp, "invalid CPU list, expected e.g. '0-3,8'");
+    return false;
+}
+
+static bool thread_sched_node_cpus(int node, cpu_set_t *set, Error **errp)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *cpulist = NULL;
+    g_autoptr(GError) gerr = NULL;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%d/cpulist", node);
+    if (!g_file_get_contents(path, &cpulist, NULL, &gerr)) {
+        error_setg(errp, "host NUMA node %d is not available: %s",
+                   node, gerr->message);
+        return false;
+    }
+    g_strstrip(cpulist);
+    if (!*cpulist) {
+        error_setg(errp, "host NUMA node %d has no CPUs", node);
+        return false;
+    }
+    return thread_sched_parse_cpus(cpulist, set, errp);
+}
+
+static bool thread_sched_parse(const ThreadSchedParams *params,
+                               cpu_set_t *set, bool *has_set, int *policy,
+                               Error **errp)
+{
+    int i, min, max;
+
+    *has_set = params->cpus || params->numa_node >= 0;
+    if (params->cpus && params->numa_node >= 0) {
+        error_setg(errp, "a CPU list and a NUMA node cannot both be set");
+        return false;
+    }
+    if (params->cpus && !thread_sched_parse_cpus(params->cpus, set, errp)) {
+        return false;
+    }
+    if (params->numa_node >= 0 &&
+        !thread_sched_node_cpus(params->numa_node, set, errp)) {
+        return false;
+    }
+
+    *policy = -1;
+    if (!params->policy) {
+        if (params->priority) {
+            error_setg(errp, "a priority needs a scheduling policy");
+            return false;
+        }
+        return true;
+    }
+    for (i = 0; i < ARRAY_SIZE(thread_sched_policies); i++) {
+        if (!strcmp(params->policy, thread_sched_policies[i].name)) {
+            *policy = thread_sched_policies[i].policy;
+            break;
+        }
+    }
+    if (*policy < 0) {
+        error_setg(errp, "invalid scheduling policy '%s', expected one of "
+                   "'other', 'batch', 'idle', 'fifo' or 'rr'",
+                   params->policy);
+        return false;
+    }
+
+    min = sched_get_priority_min(*policy);
+    max = sched_get_priority_max(*policy);
+    if (params->priority < min || params->priority > max) {
+        error_setg(errp, "priority %" PRId32 " is out of range for "
+                   "scheduling policy '%s', expected %d to %d",
+                   params->priority, params->policy, min, max);
+        return false;
+    }
+    return true;
+}
+
+bool thread_sched_check(const ThreadSchedParams *params, Error **errp)
+{
+    cpu_set_t set;
+    bool has_set;
+    int policy;
+
+    return thread_sched_parse(params, &set, &has_set, &policy, errp);
+}
+
+bool thread_sched_apply(const ThreadSchedParams *params, Error **errp)
+{
+    struct sched_param param = { .sched_priority = params->priority };
+    cpu_set_t set;
+    bool has_set;
+    int policy, ret;
+
+    if (!thread_sched_is_set(params)) {
+        return true;
+    }
+    if (!thread_sched_parse(params, &set, &has_set, &policy, errp)) {
+        return false;
+    }
+
+    /* On Linux, 0 is the calling thread rather than the whole process */
+    if (has_set && sched_setaffinity(0, sizeof(set), &set) < 0) {
+        error_setg_errno(errp, errno, "failed to set the CPU affinity");
+        return false;
+    }
+    if (policy >= 0) {
+        ret = pthread_setschedparam(pthread_self(), policy, &param);
+        if (ret) {
+            error_setg_errno(errp, ret, "failed to set scheduling policy '%s'",
+                             params->policy);
+            return false;
+        }
+    }
+    return true;
+}
+#else
+bool thread_sched_check(const ThreadSchedParams *params, Error **errp)
+{
+    if (thread_sched_is_set(params)) {
+        error_setg(errp, "CPU affinity and scheduling policies of threads "
+                   "are not supported on this host");
+        return false;
+    }
+    return true;
+}
+
+bool thread_sched_apply(const ThreadSchedParams *params, Error **errp)
+{
+    return thread_sched_check(params, errp);
+}
+#endif
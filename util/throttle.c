@@ -485,6 +485,97 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+/* add @bytes and @ops to the buckets used by this type of operation
+ *
+ * Unlimited buckets are left alone so that credit reserved for them,
+ * which is effectively infinite, does not overflow their level.
+ */
+static void throttle_add_units(ThrottleState *ts, bool is_write,
+                               double bytes, double ops)
+{
+    const BucketType bucket_types[2][4] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ,
+          THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE,
+          THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    unsigned i;
+
+    for (i = 0; i < 4; i++) {
+        LeakyBucket *bkt = &ts->cfg.buckets[bucket_types[is_write][i]];
+        double units = i < 2 ? bytes : ops;
+
+        if (!bkt->avg) {
+            continue;
+        }
+        bkt->level += units;
+        if (bkt->burst_length > 1) {
+            bkt->burst_level += units;
+        }
+    }
+}
+
+/* compute how many units of credit to hand out at once for a set of
+ * buckets: a hundredth of a second's worth at the lowest of their rates
+ */
+static unsigned int throttle_credit_size(ThrottleState *ts,
+                                         BucketType total, BucketType rw)
+{
+    uint64_t avg_total = ts->cfg.buckets[total].avg;
+    uint64_t avg_rw = ts->cfg.buckets[rw].avg;
+    uint64_t avg;
+
+    if (!avg_total && !avg_rw) {
+        return INT_MAX;
+    } else if (!avg_total || !avg_rw) {
+        avg = avg_total | avg_rw;
+    } else {
+        avg = MIN(avg_total, avg_rw);
+    }
+
+    return MIN(avg / THROTTLE_CREDIT_PER_SECOND, INT_MAX);
+}
+
+/* reserve credit for future operations of one type
+ *
+ * The credit is accounted in the buckets right away, so the caller can
+ * later perform I/O up to the returned amounts without calling
+ * throttle_account() or checking the limits again.  No credit is handed
+ * out if it would cause the next operation to be throttled.
+ *
+ * @is_write: the type of operation (read/write)
+ * @now:      the current clock timestamp
+ * @bytes:    the number of bytes reserved
+ * @ops:      the number of operations reserved
+ * @ret:      true if some credit was reserved
+ */
+bool throttle_reserve_credit(ThrottleState *ts, bool is_write, int64_t now,
+                             unsigned int *bytes, unsigned int *ops)
+{
+    *bytes = throttle_credit_size(ts, THROTTLE_BPS_TOTAL,
+                                  is_write ? THROTTLE_BPS_WRITE
+                                           : THROTTLE_BPS_READ);
+    *ops = throttle_credit_size(ts, THROTTLE_OPS_TOTAL,
+                                is_write ? THROTTLE_OPS_WRITE
+                                         : THROTTLE_OPS_READ);
+    if (!*bytes || !*ops) {
+        goto fail;
+    }
+
+    throttle_do_leak(ts, now);
+    throttle_add_units(ts, is_write, *bytes, *ops);
+
+    if (throttle_compute_wait_for(ts, is_write)) {
+        throttle_add_units(ts, is_write, -(double)*bytes, -(double)*ops);
+        goto fail;
+    }
+    return true;
+
+fail:
+    *bytes = *ops = 0;
+    return false;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
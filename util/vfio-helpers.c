@@ -22,6 +22,7 @@
 #include "qemu/event_notifier.h"
 #include "qemu/vfio-helpers.h"
 #include "qemu/lockable.h"
+#include "qemu/interval-tree.h"
 #include "trace.h"
 
 #define QEMU_VFIO_DEBUG 0
@@ -34,12 +35,19 @@
 #define QEMU_VFIO_IOVA_MAX (1ULL << 39)
 
 typedef struct {
+    /* [host, host + size - 1], in QEMUVFIOState.mappings */
+    IntervalTreeNode node;
     /* Page aligned addr. */
     void *host;
     size_t size;
     uint64_t iova;
 } IOVAMapping;
 
+/* IOVAs of unmapped fixed mappings, below low_water_mark */
+typedef struct {
+    IntervalTreeNode node;
+} IOVAHole;
+
 struct IOVARange {
     uint64_t start;
     uint64_t end;
@@ -83,8 +91,10 @@ struct QEMUVFIOState {
      * - Addresses lower than QEMU_VFIO_IOVA_MIN are reserved as invalid;
      *
      * - Fixed mappings of HVAs are assigned "low" IOVAs in the range of
-     *   [QEMU_VFIO_IOVA_MIN, low_water_mark).  Once allocated they will not be
-     *   reclaimed - low_water_mark never shrinks;
+     *   [QEMU_VFIO_IOVA_MIN, low_water_mark).  When they are unmapped, their
+     *   IOVAs go to @holes, merged with the adjacent holes, and are given to
+     *   later fixed mappings that fit; a hole that reaches low_water_mark
+     *   lowers it instead;
      *
      * - IOVAs in range [low_water_mark, high_water_mark) are free;
      *
@@ -95,8 +105,9 @@ struct QEMUVFIOState {
      **/
     uint64_t low_water_mark;
     uint64_t high_water_mark;
-    IOVAMapping *mappings;
-    int nr_mappings;
+    IntervalTreeRoot holes;
+    /* fixed mappings, by host address */
+    IntervalTreeRoot mappings;
 };
 
 /**
@@ -513,89 +524,52 @@ static void qemu_vfio_dump_mapping(IOVAMapping *m)
 
 static void qemu_vfio_dump_mappings(QEMUVFIOState *s)
 {
-    int i;
+    IntervalTreeNode *node;
 
     if (QEMU_VFIO_DEBUG) {
         printf("vfio mappings\n");
-        for (i = 0; i < s->nr_mappings; ++i) {
-            qemu_vfio_dump_mapping(&s->mappings[i]);
+        for (node = interval_tree_iter_first(&s->mappings, 0, UINT64_MAX);
+             node;
+             node = interval_tree_iter_next(node, 0, UINT64_MAX)) {
+            qemu_vfio_dump_mapping(container_of(node, IOVAMapping, node));
         }
     }
 }
 
 /**
- * Find the mapping entry that contains [host, host + size) and set @index to
- * the position. If no entry contains it, @index is the position _after_ which
- * to insert the new mapping. IOW, it is the index of the largest element that
- * is smaller than @host, or -1 if no entry is.
+ * Find the mapping entry that contains @host.
  */
-static IOVAMapping *qemu_vfio_find_mapping(QEMUVFIOState *s, void *host,
-                                           int *index)
+static IOVAMapping *qemu_vfio_find_mapping(QEMUVFIOState *s, void *host)
 {
-    IOVAMapping *p = s->mappings;
-    IOVAMapping *q = p ? p + s->nr_mappings - 1 : NULL;
-    IOVAMapping *mid;
+    IntervalTreeNode *node;
+
     trace_qemu_vfio_find_mapping(s, host);
-    if (!p) {
-        *index = -1;
-        return NULL;
-    }
-    while (true) {
-        mid = p + (q - p) / 2;
-        if (mid == p) {
-            break;
-        }
-        if (mid->host > host) {
-            q = mid;
-        } else if (mid->host < host) {
-            p = mid;
-        } else {
-            break;
-        }
-    }
-    if (mid->host > host) {
-        mid--;
-    } else if (mid < &s->mappings[s->nr_mappings - 1]
-               && (mid + 1)->host <= host) {
-        mid++;
-    }
-    *index = mid - &s->mappings[0];
-    if (mid >= &s->mappings[0] &&
-        mid->host <= host && mid->host + mid->size > host) {
-        assert(mid < &s->mappings[s->nr_mappings]);
-        return mid;
-    }
-    /* At this point *index + 1 is the right position to insert the new
-     * mapping.*/
-    return NULL;
+    node = interval_tree_iter_first(&s->mappings, (uintptr_t)host,
+                                    (uintptr_t)host);
+    return node ? container_of(node, IOVAMapping, node) : NULL;
 }
 
 /**
- * Allocate IOVA and create a new mapping record and insert it in @s.
+ * Create a new mapping record and insert it in @s.
  */
 static IOVAMapping *qemu_vfio_add_mapping(QEMUVFIOState *s,
                                           void *host, size_t size,
-                                          int index, uint64_t iova)
+                                          uint64_t iova)
 {
-    int shift;
-    IOVAMapping m = {.host = host, .size = size, .iova = iova};
-    IOVAMapping *insert;
+    IOVAMapping *m = g_new0(IOVAMapping, 1);
 
     assert(QEMU_IS_ALIGNED(size, qemu_real_host_page_size));
     assert(QEMU_IS_ALIGNED(s->low_water_mark, qemu_real_host_page_size));
     assert(QEMU_IS_ALIGNED(s->high_water_mark, qemu_real_host_page_size));
-    trace_qemu_vfio_new_mapping(s, host, size, index, iova);
-
-    assert(index >= 0);
-    s->nr_mappings++;
-    s->mappings = g_renew(IOVAMapping, s->mappings, s->nr_mappings);
-    insert = &s->mappings[index];
-    shift = s->nr_mappings - index - 1;
-    if (shift) {
-        memmove(insert + 1, insert, shift * sizeof(s->mappings[0]));
-    }
-    *insert = m;
-    return insert;
+    trace_qemu_vfio_new_mapping(s, host, size, iova);
+
+    m->host = host;
+    m->size = size;
+    m->iova = iova;
+    m->node.start = (uintptr_t)host;
+    m->node.last = (uintptr_t)host + size - 1;
+    interval_tree_insert(&m->node, &s->mappings);
+    return m;
 }
 
 /* Do the DMA mapping with VFIO. */
@@ -618,13 +592,69 @@ static int qemu_vfio_do_mapping(QEMUVFIOState *s, void *host, size_t size,
     return 0;
 }
 
+/*
+ * Give back the fixed IOVAs [iova, iova + size), merging them with the
+ * holes around them, or lowering low_water_mark if they reach it.
+ */
+static void qemu_vfio_free_fixed_iova(QEMUVFIOState *s, uint64_t iova,
+                                      size_t size)
+{
+    uint64_t start = iova, last = iova + size - 1;
+    IntervalTreeNode *node;
+    IOVAHole *hole;
+
+    /* the holes that end at @iova - 1 or start at @last + 1 */
+    while ((node = interval_tree_iter_first(&s->holes, start - 1, last + 1))) {
+        start = MIN(start, node->start);
+        last = MAX(last, node->last);
+        interval_tree_remove(node, &s->holes);
+        g_free(container_of(node, IOVAHole, node));
+    }
+
+    if (last + 1 == s->low_water_mark) {
+        s->low_water_mark = start;
+        return;
+    }
+    hole = g_new0(IOVAHole, 1);
+    hole->node.start = start;
+    hole->node.last = last;
+    interval_tree_insert(&hole->node, &s->holes);
+}
+
+/* Take @size bytes of IOVA from the first hole that is large enough. */
+static int qemu_vfio_reuse_fixed_iova(QEMUVFIOState *s, size_t size,
+                                      uint64_t *iova)
+{
+    IntervalTreeNode *node;
+    IOVAHole *hole;
+
+    for (node = interval_tree_iter_first(&s->holes, 0, UINT64_MAX);
+         node;
+         node = interval_tree_iter_next(node, 0, UINT64_MAX)) {
+        if (node->last - node->start + 1 < size) {
+            continue;
+        }
+        *iova = node->start;
+        trace_qemu_vfio_reuse_iova(s, size, *iova);
+        interval_tree_remove(node, &s->holes);
+        hole = container_of(node, IOVAHole, node);
+        if (node->last - node->start + 1 == size) {
+            g_free(hole);
+        } else {
+            hole->node.start += size;
+            interval_tree_insert(&hole->node, &s->holes);
+        }
+        return 0;
+    }
+    return -ENOMEM;
+}
+
 /**
  * Undo the DMA mapping from @s with VFIO, and remove from mapping list.
  */
 static void qemu_vfio_undo_mapping(QEMUVFIOState *s, IOVAMapping *mapping,
                                    Error **errp)
 {
-    int index;
     struct vfio_iommu_type1_dma_unmap unmap = {
         .argsz = sizeof(unmap),
         .flags = 0,
@@ -632,33 +662,31 @@ static void qemu_vfio_undo_mapping(QEMUVFIOState *s, IOVAMapping *mapping,
         .size = mapping->size,
     };
 
-    index = mapping - s->mappings;
     assert(mapping->size > 0);
     assert(QEMU_IS_ALIGNED(mapping->size, qemu_real_host_page_size));
-    assert(index >= 0 && index < s->nr_mappings);
     if (ioctl(s->container, VFIO_IOMMU_UNMAP_DMA, &unmap)) {
         error_setg_errno(errp, errno, "VFIO_UNMAP_DMA failed");
+    } else {
+        /* the IOVAs can only be reused if nothing is left mapped there */
+        qemu_vfio_free_fixed_iova(s, mapping->iova, mapping->size);
     }
-    memmove(mapping, &s->mappings[index + 1],
-            sizeof(s->mappings[0]) * (s->nr_mappings - index - 1));
-    s->nr_mappings--;
-    s->mappings = g_renew(IOVAMapping, s->mappings, s->nr_mappings);
+    interval_tree_remove(&mapping->node, &s->mappings);
+    g_free(mapping);
 }
 
-/* Check if the mapping list is (ascending) ordered. */
+/* Check that the mappings do not overlap. */
 static bool qemu_vfio_verify_mappings(QEMUVFIOState *s)
 {
-    int i;
+    IntervalTreeNode *node, *next;
+
     if (QEMU_VFIO_DEBUG) {
-        for (i = 0; i < s->nr_mappings - 1; ++i) {
-            if (!(s->mappings[i].host < s->mappings[i + 1].host)) {
-                fprintf(stderr, "item %d not sorted!\n", i);
-                qemu_vfio_dump_mappings(s);
-                return false;
-            }
-            if (!(s->mappings[i].host + s->mappings[i].size <=
-                  s->mappings[i + 1].host)) {
-                fprintf(stderr, "item %d overlap with next!\n", i);
+        for (node = interval_tree_iter_first(&s->mappings, 0, UINT64_MAX);
+             node;
+             node = next) {
+            next = interval_tree_iter_next(node, 0, UINT64_MAX);
+            if (next && node->last >= next->start) {
+                fprintf(stderr, "mapping %p overlaps with next!\n",
+                        container_of(node, IOVAMapping, node)->host);
                 qemu_vfio_dump_mappings(s);
                 return false;
             }
@@ -720,7 +748,6 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
                       bool temporary, uint64_t *iova)
 {
     int ret = 0;
-    int index;
     IOVAMapping *mapping;
     uint64_t iova0;
 
@@ -728,41 +755,35 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
     assert(QEMU_IS_ALIGNED(size, qemu_real_host_page_size));
     trace_qemu_vfio_dma_map(s, host, size, temporary, iova);
     qemu_mutex_lock(&s->lock);
-    mapping = qemu_vfio_find_mapping(s, host, &index);
+    mapping = qemu_vfio_find_mapping(s, host);
     if (mapping) {
         iova0 = mapping->iova + ((uint8_t *)host - (uint8_t *)mapping->host);
-    } else {
-        if (s->high_water_mark - s->low_water_mark + 1 < size) {
-            ret = -ENOMEM;
-            goto out;
-        }
-        if (!temporary) {
-            if (qemu_vfio_find_fixed_iova(s, size, &iova0)) {
+    } else if (!temporary) {
+        if (qemu_vfio_reuse_fixed_iova(s, size, &iova0)) {
+            if (s->high_water_mark - s->low_water_mark + 1 < size ||
+                qemu_vfio_find_fixed_iova(s, size, &iova0)) {
                 ret = -ENOMEM;
                 goto out;
             }
+        }
 
-            mapping = qemu_vfio_add_mapping(s, host, size, index + 1, iova0);
-            if (!mapping) {
-                ret = -ENOMEM;
-                goto out;
-            }
-            assert(qemu_vfio_verify_mappings(s));
-            ret = qemu_vfio_do_mapping(s, host, size, iova0);
-            if (ret) {
-                qemu_vfio_undo_mapping(s, mapping, NULL);
-                goto out;
-            }
-            qemu_vfio_dump_mappings(s);
-        } else {
-            if (qemu_vfio_find_temp_iova(s, size, &iova0)) {
-                ret = -ENOMEM;
-                goto out;
-            }
-            ret = qemu_vfio_do_mapping(s, host, size, iova0);
-            if (ret) {
-                goto out;
-            }
+        mapping = qemu_vfio_add_mapping(s, host, size, iova0);
+        assert(qemu_vfio_verify_mappings(s));
+        ret = qemu_vfio_do_mapping(s, host, size, iova0);
+        if (ret) {
+            qemu_vfio_undo_mapping(s, mapping, NULL);
+            goto out;
+        }
+        qemu_vfio_dump_mappings(s);
+    } else {
+        if (s->high_water_mark - s->low_water_mark + 1 < size ||
+            qemu_vfio_find_temp_iova(s, size, &iova0)) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        ret = qemu_vfio_do_mapping(s, host, size, iova0);
+        if (ret) {
+            goto out;
         }
     }
     if (iova) {
@@ -796,7 +817,6 @@ int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s)
  * qemu_vfio_dma_map(). */
 void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host)
 {
-    int index = 0;
     IOVAMapping *m;
 
     if (!host) {
@@ -805,12 +825,10 @@ void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host)
 
     trace_qemu_vfio_dma_unmap(s, host);
     qemu_mutex_lock(&s->lock);
-    m = qemu_vfio_find_mapping(s, host, &index);
-    if (!m) {
-        goto out;
+    m = qemu_vfio_find_mapping(s, host);
+    if (m) {
+        qemu_vfio_undo_mapping(s, m, NULL);
     }
-    qemu_vfio_undo_mapping(s, m, NULL);
-out:
     qemu_mutex_unlock(&s->lock);
 }
 
@@ -822,13 +840,18 @@ static void qemu_vfio_reset(QEMUVFIOState *s)
 /* Close and free the VFIO resources. */
 void qemu_vfio_close(QEMUVFIOState *s)
 {
-    int i;
+    IntervalTreeNode *node;
 
     if (!s) {
         return;
     }
-    for (i = 0; i < s->nr_mappings; ++i) {
-        qemu_vfio_undo_mapping(s, &s->mappings[i], NULL);
+    while ((node = interval_tree_iter_first(&s->mappings, 0, UINT64_MAX))) {
+        qemu_vfio_undo_mapping(s, container_of(node, IOVAMapping, node),
+                               NULL);
+    }
+    while ((node = interval_tree_iter_first(&s->holes, 0, UINT64_MAX))) {
+        interval_tree_remove(node, &s->holes);
+        g_free(container_of(node, IOVAHole, node));
     }
     ram_block_notifier_remove(&s->ram_notifier);
     g_free(s->usable_iova_ranges);